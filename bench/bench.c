@@ -0,0 +1,404 @@
+/**
+ * @file	    bench.c
+ * @brief	    Benchmarks of the kernels PINC spends most time in
+ *
+ * Times each kernel on the sizes and particle densities given in the [bench]
+ * section of the input file (see bench/bench.ini) and reports the throughput
+ * in particles per second, nodes per second and effective bandwidth. Built
+ * and run by "make bench".
+ *
+ * The effective bandwidth is the data a kernel must at least read and write
+ * (particles, or nodes of the grids it reads and writes) divided by the time,
+ * and is left out for kernels where this is not well defined (the solvers).
+ * It is summed over MPI processes, and the time is that of the slowest one.
+ *
+ * The results are also written to bench:output as comma-separated values, one
+ * row per kernel and size, along with the version and compiler flags, such
+ * that runs of different commits or flags can be compared.
+ */
+
+#include "core.h"
+#include "pusher.h"
+#include "multigrid.h"
+#include "spectral.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifndef BENCH_FLAGS
+#define BENCH_FLAGS ""
+#endif
+
+/**
+ * @brief	Sizes of one kernel benchmark
+ */
+typedef struct {
+	FILE *csv;				///< Comma-separated output (only on rank 0)
+	const MpiInfo *mpiInfo;	///< MpiInfo
+	int size;				///< Nodes along each dimension per subdomain
+	int ppc;				///< Particles per cell of each specie
+	int nRepetitions;		///< Timed runs of each kernel
+} Bench;
+
+/**
+ * @brief	Reports the throughput of a kernel
+ * @param	bench		Bench
+ * @param	kernel		Name of the kernel
+ * @param	nanoSec		Time of all repetitions on this MPI process
+ * @param	nParticles	Particles processed per run on this MPI process
+ * @param	nNodes		Nodes processed per run on this MPI process
+ * @param	bytes		Bytes read and written per run (0 if not defined)
+ */
+static void bReport(const Bench *bench, const char *kernel,
+					unsigned long long int nanoSec, double nParticles,
+					double nNodes, double bytes){
+
+	double local[3] = {nParticles, nNodes, bytes};
+	double global[3];
+	double seconds = nanoSec/1e9;
+	MPI_Allreduce(local, global, 3, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+	MPI_Allreduce(MPI_IN_PLACE, &seconds, 1, MPI_DOUBLE, MPI_MAX,
+				  MPI_COMM_WORLD);
+
+	double runs = bench->nRepetitions/seconds;
+	double particleRate = global[0]*runs;
+	double nodeRate = global[1]*runs;
+	double bandwidth = global[2]*runs/1e9;
+
+	int nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+
+	msg(STATUS, "%-22s %4i %4i %10.3e %10.3e %10.3e %8.3f", kernel,
+		bench->size, bench->ppc, seconds/bench->nRepetitions,
+		particleRate, nodeRate, bandwidth);
+
+	if(bench->csv){
+		fprintf(bench->csv, "%s,%s,%s,%i,%i,%i,%i,%i,%.6e,%.6e,%.6e,",
+				VERSION, BENCH_FLAGS, kernel, bench->mpiInfo->mpiSize,
+				nThreads, bench->size, bench->ppc,
+				bench->nRepetitions, seconds/bench->nRepetitions,
+				particleRate, nodeRate);
+		if(bytes>0) fprintf(bench->csv, "%.6e", bandwidth);
+		fprintf(bench->csv, "\n");
+	}
+}
+
+/**
+ * @brief	Nodes in the halo slices exchanged by gHaloOp()
+ * @param	grid	Grid
+ * @return	Nodes (of all components)
+ */
+static double bHaloNodes(const Grid *grid){
+
+	double nNodes = 0;
+	for(int d=1;d<grid->rank;d++)
+		nNodes += 2.0*grid->sizeProd[grid->rank]/grid->size[d];
+	return nNodes;
+}
+
+/**
+ * @brief	Particles of all species
+ * @param	pop		Population
+ * @return	Number of particles
+ */
+static double bParticles(const Population *pop){
+
+	double nParticles = 0;
+	for(int s=0;s<pop->nSpecies;s++)
+		nParticles += pop->iStop[s]-pop->iStart[s];
+	return nParticles;
+}
+
+/**
+ * @brief	Benchmarks the particle kernels
+ * @param	bench	Bench
+ * @param	pop		Population
+ * @param	rho		Charge density
+ * @param	E		Electric field (zero)
+ * @param	mpiInfo	MpiInfo
+ *
+ * Each repetition moves, migrates, deposits and accelerates the particles as
+ * in a time step, such that the particles stay valid throughout.
+ */
+static void bParticleKernels(	const Bench *bench, Population *pop,
+								Grid *rho, const Grid *E, MpiInfo *mpiInfo){
+
+	Timer *tMove = tAlloc();
+	Timer *tExtract = tAlloc();
+	Timer *tMigrate = tAlloc();
+	Timer *tDistr = tAlloc();
+	Timer *tAcc = tAlloc();
+
+	int nDims = pop->nDims;
+	double nTrueNodes = gTotTruesize(rho, mpiInfo)/mpiInfo->mpiSize;
+	double nParticles = bParticles(pop);
+	double nMigrants = 0;
+
+	// The first run is not timed
+	for(int r=-1;r<bench->nRepetitions;r++){
+
+		if(r==0){
+			tReset(tMove);
+			tReset(tExtract);
+			tReset(tMigrate);
+			tReset(tDistr);
+			tReset(tAcc);
+			nMigrants = 0;
+		}
+
+		MPI_Barrier(MPI_COMM_WORLD);
+		tStart(tMove);
+		puMove(pop);
+		tStop(tMove);
+
+		MPI_Barrier(MPI_COMM_WORLD);
+		tStart(tExtract);
+		puExtractEmigrants3D(pop, mpiInfo);
+		tStop(tExtract);
+
+		int nNeighbors = mpiInfo->nNeighbors;
+		nMigrants += alSum(mpiInfo->nEmigrants, pop->nSpecies*nNeighbors);
+
+		MPI_Barrier(MPI_COMM_WORLD);
+		tStart(tMigrate);
+		puMigrate(pop, mpiInfo, rho);
+		tStop(tMigrate);
+
+		MPI_Barrier(MPI_COMM_WORLD);
+		tStart(tDistr);
+		puDistr3D1(pop, rho);
+		tStop(tDistr);
+
+		MPI_Barrier(MPI_COMM_WORLD);
+		tStart(tAcc);
+		puAcc3D1KE(pop, E, 1.);
+		tStop(tAcc);
+	}
+	nMigrants /= bench->nRepetitions;
+
+	// Particle data read and written, and nodes of the grids
+	double pSize = sizeof(popFloat)*nDims;
+	double gSize = sizeof(double);
+	bReport(bench, "puMove", tMove->total, nParticles, 0,
+			3*pSize*nParticles);
+	bReport(bench, "puExtractEmigrants3D", tExtract->total, nParticles, 0,
+			pSize*nParticles);
+	bReport(bench, "puMigrate", tMigrate->total, nMigrants, 0,
+			4*pSize*nMigrants);
+	bReport(bench, "puDistr3D1", tDistr->total, nParticles, nTrueNodes,
+			pSize*nParticles+gSize*nTrueNodes);
+	bReport(bench, "puAcc3D1KE", tAcc->total, nParticles, nTrueNodes,
+			3*pSize*nParticles+nDims*gSize*nTrueNodes);
+
+	tFree(tMove);
+	tFree(tExtract);
+	tFree(tMigrate);
+	tFree(tDistr);
+	tFree(tAcc);
+}
+
+/**
+ * @brief	Benchmarks the grid kernels and the solvers
+ * @param	bench	Bench
+ * @param	ini		Input file dictionary
+ * @param	rho		Charge density
+ * @param	phi		Electric potential
+ * @param	E		Electric field
+ * @param	mpiInfo	MpiInfo
+ */
+static void bGridKernels(	const Bench *bench, dictionary *ini, Grid *rho,
+							Grid *phi, Grid *E, MpiInfo *mpiInfo){
+
+	int nDims = mpiInfo->nDims;
+	int nRepetitions = bench->nRepetitions;
+	double nTrueNodes = gTotTruesize(rho, mpiInfo)/mpiInfo->mpiSize;
+	double gSize = sizeof(double);
+	Timer *t = tAlloc();
+
+	gsl_rng *rng = gsl_rng_alloc(gsl_rng_mt19937);
+	gsl_rng_set(rng, mpiInfo->mpiRank+1);
+	gFillRng(rho, mpiInfo, rng);
+	gNeutralizeGrid(rho, mpiInfo);
+	gsl_rng_free(rng);
+
+	// Untimed first runs (r=-1) of each kernel
+	for(int r=-1;r<nRepetitions;r++){
+		if(r==0) tReset(t);
+		MPI_Barrier(MPI_COMM_WORLD);
+		tStart(t);
+		gHaloOp(setSlice, phi, mpiInfo, TOHALO);
+		tStop(t);
+	}
+	double nHalo = bHaloNodes(phi);
+	bReport(bench, "gHaloOp", t->total, 0, nHalo, 2*gSize*nHalo);
+
+	for(int r=-1;r<nRepetitions;r++){
+		if(r==0) tReset(t);
+		MPI_Barrier(MPI_COMM_WORLD);
+		tStart(t);
+		gFinDiff1st(phi, E);
+		tStop(t);
+	}
+	bReport(bench, "gFinDiff1st", t->total, 0, nTrueNodes,
+			(1+nDims)*gSize*nTrueNodes);
+
+	// With the tiles gAlloc() set from grid:tileSize, and untiled
+	Grid *lapl = gAlloc(ini, SCALAR);
+	int *tiled = malloc(nDims*sizeof(*tiled));
+	int *untiled = malloc(nDims*sizeof(*untiled));
+	for(int d=0;d<nDims;d++){
+		tiled[d] = phi->tileSize[d+1];
+		untiled[d] = phi->trueSize[d+1];
+	}
+	for(int r=-1;r<nRepetitions;r++){
+		if(r==0) tReset(t);
+		MPI_Barrier(MPI_COMM_WORLD);
+		tStart(t);
+		gFinDiff2nd3D(lapl, phi);
+		tStop(t);
+	}
+	bReport(bench, "gFinDiff2nd3D", t->total, 0, nTrueNodes,
+			2*gSize*nTrueNodes);
+
+	gSetTileSize(phi, untiled);
+	for(int r=-1;r<nRepetitions;r++){
+		if(r==0) tReset(t);
+		MPI_Barrier(MPI_COMM_WORLD);
+		tStart(t);
+		gFinDiff2nd3D(lapl, phi);
+		tStop(t);
+	}
+	bReport(bench, "gFinDiff2nd3D untiled", t->total, 0, nTrueNodes,
+			2*gSize*nTrueNodes);
+	gSetTileSize(phi, tiled);
+	free(tiled);
+	free(untiled);
+	gFree(lapl);
+
+	// One iteration each run
+	for(int r=-1;r<nRepetitions;r++){
+		if(r==0) tReset(t);
+		MPI_Barrier(MPI_COMM_WORLD);
+		tStart(t);
+		mgGS3D(phi, rho, 1, mpiInfo);
+		tStop(t);
+	}
+	bReport(bench, "mgGS3D", t->total, 0, nTrueNodes, 3*gSize*nTrueNodes);
+
+	// One V-cycle each run
+	MultigridSolver *mg = mgAllocSolver(ini, rho, phi, mpiInfo);
+	int bottom = mg->mgRho->nLevels-1;
+	for(int r=-1;r<nRepetitions;r++){
+		if(r==0) tReset(t);
+		MPI_Barrier(MPI_COMM_WORLD);
+		tStart(t);
+		mgVRegular(0, bottom, 0, mg->mgRho, mg->mgPhi, mg->mgRes, mpiInfo);
+		tStop(t);
+	}
+	bReport(bench, "mgVRegular", t->total, 0, nTrueNodes, 0);
+	mgFreeSolver(mg);
+
+	SpectralSolver *spectral = sAlloc(ini, rho, phi, mpiInfo);
+	for(int r=-1;r<nRepetitions;r++){
+		if(r==0) tReset(t);
+		MPI_Barrier(MPI_COMM_WORLD);
+		tStart(t);
+		sSolve(spectral, rho, phi, mpiInfo);
+		tStop(t);
+	}
+	bReport(bench, "sSolve", t->total, 0, nTrueNodes, 0);
+	sFree(spectral);
+
+	tFree(t);
+}
+
+int main(int argc, char *argv[]){
+
+	int threadSupport;
+	MPI_Init_thread(&argc,&argv,MPI_THREAD_FUNNELED,&threadSupport);
+	dictionary *ini = iniOpen(argc,argv);
+	msg(STATUS, "PINC %s benchmarks (%s)", VERSION, BENCH_FLAGS);
+	thSetup(ini);
+
+	int nSizes = iniGetNElements(ini, "bench:sizes");
+	int nPpcs = iniGetNElements(ini, "bench:particlesPerCell");
+	int *sizes = iniGetIntArr(ini, "bench:sizes", nSizes);
+	int *ppcs = iniGetIntArr(ini, "bench:particlesPerCell", nPpcs);
+	int nRepetitions = iniGetInt(ini, "bench:nRepetitions");
+	if(nRepetitions<1) msg(ERROR, "bench:nRepetitions must be positive");
+
+	int mpiRank;
+	MPI_Comm_rank(MPI_COMM_WORLD, &mpiRank);
+	FILE *csv = NULL;
+	if(mpiRank==0){
+		char *fName = iniGetStr(ini, "bench:output");
+		csv = fopen(fName, "w");
+		if(!csv) msg(ERROR, "Could not open '%s'", fName);
+		fprintf(csv, "version,flags,kernel,processes,threads,size,ppc,"
+					 "repetitions,seconds,particles/s,nodes/s,GB/s\n");
+		free(fName);
+	}
+	iniClose(ini);
+
+	msg(STATUS, "%-22s %4s %4s %10s %10s %10s %8s", "kernel", "size",
+		"ppc", "seconds", "particles/s", "nodes/s", "GB/s");
+
+	for(int i=0;i<nSizes;i++){
+		for(int j=0;j<nPpcs;j++){
+
+			// The input is normalized anew for each size
+			char value[64];
+			ini = iniOpen(argc,argv);
+			sprintf(value, "%i,%i,%i", sizes[i], sizes[i], sizes[i]);
+			iniparser_set(ini, "grid:trueSize", value);
+			sprintf(value, "%i pc", ppcs[j]);
+			iniparser_set(ini, "population:nParticles", value);
+			sprintf(value, "%i pc", 2*ppcs[j]);
+			iniparser_set(ini, "population:nAlloc", value);
+
+			Units *units = uAlloc(ini);
+			uNormalize(ini, units);
+			MpiInfo *mpiInfo = gAllocMpi(ini);
+			Population *pop = pAlloc(ini);
+			Grid *E = gAlloc(ini, VECTOR);
+			Grid *rho = gAlloc(ini, SCALAR);
+			Grid *phi = gAlloc(ini, SCALAR);
+			gCreateNeighborhood(ini, mpiInfo, rho);
+			gSetBndSlices(phi, mpiInfo);
+			gZero(E);
+			gZero(phi);
+
+			gsl_rng *rngSync = gsl_rng_alloc(gsl_rng_mt19937);
+			pPosUniform(ini, pop, mpiInfo, rngSync);
+			pVelMaxwell(ini, pop, mpiInfo, rngSync);
+			gsl_rng_free(rngSync);
+
+			Bench bench = {csv, mpiInfo, sizes[i], ppcs[j], nRepetitions};
+			bParticleKernels(&bench, pop, rho, E, mpiInfo);
+
+			// Independent of the particles
+			if(j==0) bGridKernels(&bench, ini, rho, phi, E, mpiInfo);
+
+			gFree(E);
+			gFree(rho);
+			gFree(phi);
+			pFree(pop);
+			gDestroyNeighborhood(mpiInfo);
+			gFreeMpi(mpiInfo);
+			uFree(units);
+			iniClose(ini);
+		}
+	}
+
+	if(csv) fclose(csv);
+	free(sizes);
+	free(ppcs);
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	msg(STATUS, "Benchmarks completed");
+	MPI_Finalize();
+
+	return 0;
+}
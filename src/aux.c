@@ -6,12 +6,20 @@
  * Small auxiliary functions.
  */
 #define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE		// madvise()
+#define _GNU_SOURCE			// sched_setaffinity()
 
 #include "core.h"
 #include <time.h>
 #include <mpi.h>
 #include <stdarg.h>
 #include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sched.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 /******************************************************************************
  * LOCAL FUNCTION DECLARATIONS
@@ -84,6 +92,604 @@ void tMsg(long long int nanoSec, const char *string){
 
 }
 
+/******************************************************************************
+ * TIMING REGION FUNCTIONS
+ *****************************************************************************/
+
+/**
+ * @brief A named timing region, see tRegionBegin()
+ */
+typedef struct{
+	const char *name;				///< Name as given to tRegionBegin()
+	char path[64];					///< Names of the parents and itself, separated by /
+	int parent;						///< Enclosing region (-1 if none)
+	Timer timer;					///< Time spent in the region
+	long int nCalls;				///< Number of times entered
+	unsigned long long int written;	///< timer.total at the last history row
+} TimingRegion;
+
+static int regionLevel = 0;				// diagnostics:timing
+static int nRegions = 0;
+static int nRegionsAlloc = 0;
+static int nRegionsCreated = 0;			// Regions with datasets in the history
+static int currentRegion = -1;
+static TimingRegion *regions = NULL;
+
+static int tRegionNameIn(const char *name, const char * const *names, int nNames){
+
+	for(int n=0;n<nNames;n++) if(!strcmp(name,names[n])) return 1;
+	return 0;
+}
+
+void tRegionSetup(const dictionary *ini){
+
+	regionLevel = iniGetInt(ini,"diagnostics:timing");
+	if(regionLevel<0 || regionLevel>2)
+		msg(ERROR,"diagnostics:timing must be 0, 1 or 2");
+}
+
+void tRegionBegin(const char *name){
+
+	if(!regionLevel) return;
+
+	// Names are usually literals, so comparing pointers is enough most times
+	int i = 0;
+	while(i<nRegions && (regions[i].parent!=currentRegion
+		|| (regions[i].name!=name && strcmp(regions[i].name,name)))) i++;
+
+	if(i==nRegions){
+
+		if(nRegions==nRegionsAlloc){
+			nRegionsAlloc = nRegionsAlloc ? 2*nRegionsAlloc : 32;
+			regions = realloc(regions,nRegionsAlloc*sizeof(*regions));
+		}
+
+		TimingRegion *region = &regions[i];
+		const char *parentPath = currentRegion<0 ? "" : regions[currentRegion].path;
+		if(strlen(parentPath)+strlen(name)+2 > sizeof(region->path))
+			msg(ERROR,"Too deeply nested timing region '%s'",name);
+
+		region->name = name;
+		snprintf(region->path,sizeof(region->path),"%s/%s",parentPath,name);
+		region->parent = currentRegion;
+		region->timer.total = 0;
+		region->nCalls = 0;
+		region->written = 0;
+		nRegions++;
+	}
+
+	regions[i].nCalls++;
+	currentRegion = i;
+	tStart(&regions[i].timer);
+}
+
+void tRegionEnd(const char *name){
+
+	if(!regionLevel) return;
+
+	TimingRegion *region = &regions[currentRegion];
+	if(region->name!=name && strcmp(region->name,name))
+		msg(ERROR,"Ending timing region '%s' inside '%s'",name,region->path);
+
+	tStop(&region->timer);
+	currentRegion = region->parent;
+}
+
+void tRegionWriteHistory(XyBuffer *buf, double x){
+
+	if(regionLevel<2) return;
+
+	// Rows must be the same on all MPI nodes
+	int counts[2] = {-nRegions, nRegions};
+	MPI_Allreduce(MPI_IN_PLACE,counts,2,MPI_INT,MPI_MAX,simComm());
+	if(-counts[0]!=counts[1]){
+		msg(WARNING,"Timing regions differ between MPI nodes, stopped writing them to history");
+		regionLevel = 1;
+		return;
+	}
+
+	char name[64];
+	for(int i=0;i<nRegions;i++){
+
+		// A group per region, since regions may be nested in it. Skipped if
+		// the name of the dataset gets too long.
+		TimingRegion *region = &regions[i];
+		if(strlen(region->path)+strlen("/timing/total") >= sizeof(name)) continue;
+		snprintf(name,sizeof(name),"/timing%s/total",region->path);
+
+		if(i>=nRegionsCreated) xyCreateDataset(buf->h5,name);
+
+		double seconds = (region->timer.total-region->written)/1e9;
+		region->written = region->timer.total;
+		xyBufWrite(buf,name,x,seconds,MPI_MAX);
+	}
+	nRegionsCreated = nRegions;
+}
+
+void tRegionReport(void){
+
+	if(!regionLevel) return;
+
+	int mpiRank, mpiSize;
+	MPI_Comm_rank(simComm(),&mpiRank);
+	MPI_Comm_size(simComm(),&mpiSize);
+
+	// Regions are matched by path such that MPI nodes may have different ones
+	int pathSize = sizeof(regions->path);
+	char *path = malloc(nRegions*pathSize);
+	double *seconds = malloc(nRegions*sizeof(*seconds));
+	for(int i=0;i<nRegions;i++){
+		strcpy(&path[i*pathSize],regions[i].path);
+		seconds[i] = regions[i].timer.total/1e9;
+	}
+
+	int *count = malloc(mpiSize*sizeof(*count));
+	int *displ = malloc(mpiSize*sizeof(*displ));
+	MPI_Gather(&nRegions,1,MPI_INT,count,1,MPI_INT,0,simComm());
+	int nAll = 0;
+	if(mpiRank==0){
+		for(int r=0;r<mpiSize;r++){
+			displ[r] = nAll;
+			nAll += count[r];
+		}
+	}
+
+	char *allPath = malloc(nAll*pathSize);
+	double *allSeconds = malloc(nAll*sizeof(*allSeconds));
+	MPI_Gatherv(seconds,nRegions,MPI_DOUBLE,allSeconds,count,displ,MPI_DOUBLE,0,simComm());
+	for(int r=0;r<mpiSize && mpiRank==0;r++){
+		count[r] *= pathSize;
+		displ[r] *= pathSize;
+	}
+	MPI_Gatherv(path,nRegions*pathSize,MPI_CHAR,allPath,count,displ,MPI_CHAR,0,simComm());
+
+	if(mpiRank==0){
+
+		// Unique paths in the order they first appear, counting missing as 0
+		int nUnique = 0;
+		int *unique = malloc(nAll*sizeof(*unique));
+		double *min = malloc(nAll*sizeof(*min));
+		double *max = malloc(nAll*sizeof(*max));
+		double *sum = malloc(nAll*sizeof(*sum));
+		int *nRanks = malloc(nAll*sizeof(*nRanks));
+		for(int i=0;i<nAll;i++){
+			int u = 0;
+			while(u<nUnique && strcmp(&allPath[unique[u]*pathSize],&allPath[i*pathSize])) u++;
+			if(u==nUnique){
+				unique[u] = i;
+				min[u] = allSeconds[i];
+				max[u] = allSeconds[i];
+				sum[u] = 0;
+				nRanks[u] = 0;
+				nUnique++;
+			}
+			if(allSeconds[i]<min[u]) min[u] = allSeconds[i];
+			if(allSeconds[i]>max[u]) max[u] = allSeconds[i];
+			sum[u] += allSeconds[i];
+			nRanks[u]++;
+		}
+
+		msg(TIMER,"Timing regions (seconds, min/avg/max over MPI nodes, max/avg):");
+		for(int u=0;u<nUnique;u++){
+
+			const char *p = &allPath[unique[u]*pathSize];
+			int depth = 0;
+			for(const char *c=p;*c;c++) if(*c=='/') depth++;
+			const char *leaf = strrchr(p,'/')+1;
+
+			if(nRanks[u]<mpiSize) min[u] = 0;
+			double avg = sum[u]/mpiSize;
+			msg(TIMER,"%*s%-*s %10.4f %10.4f %10.4f %6.2f",
+				2*depth,"",30-2*depth,leaf,min[u],avg,max[u],avg>0 ? max[u]/avg : 1.);
+		}
+
+		free(unique);
+		free(min);
+		free(max);
+		free(sum);
+		free(nRanks);
+	}
+
+	free(allSeconds);
+	free(allPath);
+	free(displ);
+	free(count);
+	free(seconds);
+	free(path);
+}
+
+double tRegionSeconds(const char *path, const char * const *names, int nNames){
+
+	unsigned long long int total = 0;
+	size_t pathLen = strlen(path);
+
+	for(int i=0;i<nRegions;i++){
+
+		TimingRegion *region = &regions[i];
+		if(names==NULL){
+			if(!strcmp(region->path,path)) total += region->timer.total;
+			continue;
+		}
+
+		// Descendants of path, the name of which is one of names
+		if(strncmp(region->path,path,pathLen) || region->path[pathLen]!='/') continue;
+		if(!tRegionNameIn(region->name,names,nNames)) continue;
+
+		// Count only the outermost, if nested in another of names below path
+		int nested = 0;
+		for(int j=region->parent;j>=0 && strlen(regions[j].path)>pathLen;j=regions[j].parent)
+			if(tRegionNameIn(regions[j].name,names,nNames)) nested = 1;
+
+		if(!nested) total += region->timer.total;
+	}
+
+	return total/1e9;
+}
+
+void tRegionFree(void){
+
+	if(currentRegion>=0)
+		msg(WARNING,"Timing region '%s' not ended",regions[currentRegion].path);
+
+	free(regions);
+	regions = NULL;
+	nRegions = 0;
+	nRegionsAlloc = 0;
+	nRegionsCreated = 0;
+	currentRegion = -1;
+}
+
+/******************************************************************************
+ * SIMULATION COMMUNICATOR FUNCTIONS
+ *****************************************************************************/
+
+static MPI_Comm simulationComm = MPI_COMM_NULL;	// MPI_COMM_WORLD until set
+static int simulationMember = -1;
+
+void simSetComm(MPI_Comm comm, int member){
+	simulationComm = comm;
+	simulationMember = member;
+}
+
+void simFreeComm(void){
+	if(simulationComm!=MPI_COMM_NULL) MPI_Comm_free(&simulationComm);
+	simulationMember = -1;
+}
+
+MPI_Comm simComm(void){
+	return simulationComm==MPI_COMM_NULL ? MPI_COMM_WORLD : simulationComm;
+}
+
+int simMember(void){
+	return simulationMember;
+}
+
+/******************************************************************************
+ * CONSISTENCY CHECK FUNCTIONS
+ *****************************************************************************/
+
+static int checkLevel = CHECK_LEVEL;	// diagnostics:checks (capped)
+static long int checkInterval = 1;		// diagnostics:checkInterval
+static int checkActive = CHECK_LEVEL>0;
+static int checkVerbose = 1;
+
+void chSetup(const dictionary *ini){
+
+	char *checks = iniGetStr(ini,"diagnostics:checks");
+	if(!strcmp(checks,"OFF"))			checkLevel = 0;
+	else if(!strcmp(checks,"SAMPLED"))	checkLevel = 1;
+	else if(!strcmp(checks,"FULL"))		checkLevel = 2;
+	else msg(ERROR,"diagnostics:checks must be OFF, SAMPLED or FULL");
+
+	if(checkLevel>CHECK_LEVEL){
+		msg(WARNING,"diagnostics:checks = %s is not compiled in (CHECK_LEVEL=%i)",
+			checks,CHECK_LEVEL);
+		checkLevel = CHECK_LEVEL;
+	}
+	free(checks);
+
+	checkInterval = iniGetInt(ini,"diagnostics:checkInterval");
+	if(checkInterval<1) msg(ERROR,"diagnostics:checkInterval must be positive");
+
+	checkActive = checkLevel>0;
+}
+
+int chBeginStep(long int n){
+
+	int sampled = n%checkInterval==0;
+	checkActive = checkLevel==2 || (checkLevel==1 && sampled);
+	checkVerbose = checkLevel==2 || sampled;
+	return checkActive;
+}
+
+int chActive(void){
+	return CHECK_LEVEL>0 && checkActive;
+}
+
+int chVerbose(void){
+	return checkVerbose;
+}
+
+/******************************************************************************
+ * REDUCTION FUNCTIONS
+ *****************************************************************************/
+
+Reduction *rAlloc(MPI_Op op){
+
+	Reduction *red = malloc(sizeof(*red));
+
+	red->op = op;
+	red->n = 0;
+	red->nAlloc = 16;
+	red->local = malloc(red->nAlloc*sizeof(*red->local));
+	red->global = malloc(red->nAlloc*sizeof(*red->global));
+	red->targets = malloc(red->nAlloc*sizeof(*red->targets));
+	red->request = MPI_REQUEST_NULL;
+	MPI_Comm_dup(simComm(), &red->comm);
+
+	return red;
+}
+
+void rFree(Reduction *red){
+
+	rEnd(red);
+	MPI_Comm_free(&red->comm);
+	free(red->local);
+	free(red->global);
+	free(red->targets);
+	free(red);
+}
+
+void rAdd(Reduction *red, double *value, int n){
+
+	if(red->request != MPI_REQUEST_NULL)
+		msg(ERROR, "cannot add to a reduction in progress");
+
+	if(red->n+n > red->nAlloc){
+		while(red->n+n > red->nAlloc) red->nAlloc *= 2;
+		red->local = realloc(red->local, red->nAlloc*sizeof(*red->local));
+		red->global = realloc(red->global, red->nAlloc*sizeof(*red->global));
+		red->targets = realloc(red->targets, red->nAlloc*sizeof(*red->targets));
+	}
+
+	for(int i=0; i<n; i++) red->targets[red->n++] = &value[i];
+}
+
+void rBegin(Reduction *red){
+
+	int n = red->n;
+	for(int i=0; i<n; i++) red->local[i] = *red->targets[i];
+
+	MPI_Iallreduce(red->local, red->global, n, MPI_DOUBLE, red->op, red->comm,
+				   &red->request);
+}
+
+void rEnd(Reduction *red){
+
+	if(red->request == MPI_REQUEST_NULL) return;
+
+	MPI_Wait(&red->request, MPI_STATUS_IGNORE);
+
+	int n = red->n;
+	for(int i=0; i<n; i++) *red->targets[i] = red->global[i];
+
+	red->n = 0;
+}
+
+/******************************************************************************
+ * ARENA FUNCTIONS
+ *****************************************************************************/
+
+Arena *arAlloc(size_t size, int hugePages){
+
+	// Huge pages are only used for blocks aligned to them
+	size_t align = ARENA_ALIGN;
+	size_t hugePageSize = 2*1024*1024;
+	if(hugePages) align = hugePageSize;
+
+	size = arPad(size);
+	if(size == 0) size = ARENA_ALIGN;
+
+	void *base = NULL;
+	if(posix_memalign(&base, align, size))
+		msg(ERROR, "failed to allocate arena of %zu bytes", size);
+
+#ifdef MADV_HUGEPAGE
+	if(hugePages && size >= hugePageSize) madvise(base, size, MADV_HUGEPAGE);
+#else
+	if(hugePages) msg(WARNING, "huge pages not supported on this system");
+#endif
+
+	// First touch
+	memset(base, 0, size);
+
+	Arena *arena = malloc(sizeof(*arena));
+	arena->base = base;
+	arena->size = size;
+	arena->used = 0;
+
+	return arena;
+}
+
+void arFree(Arena *arena){
+
+	free(arena->base);
+	free(arena);
+}
+
+void *arGet(Arena *arena, size_t size){
+
+	size = arPad(size);
+	if(arena->used + size > arena->size)
+		msg(ERROR, "arena of %zu bytes exhausted", arena->size);
+
+	void *piece = arena->base + arena->used;
+	arena->used += size;
+
+	return piece;
+}
+
+size_t arPad(size_t size){
+
+	return (size+ARENA_ALIGN-1)/ARENA_ALIGN*ARENA_ALIGN;
+}
+
+/******************************************************************************
+ * THREAD FUNCTIONS
+ *****************************************************************************/
+
+static void thPin(int nThreads, int spread){
+
+#ifdef __linux__
+	// Cores inherited from the MPI launcher
+	cpu_set_t mask;
+	if(sched_getaffinity(0, sizeof(mask), &mask))
+		msg(ERROR, "failed to read the affinity mask of the process");
+
+	int nCpus = CPU_COUNT(&mask);
+	int *cpus = malloc(nCpus*sizeof(*cpus));
+	for(int c=0, i=0; i<nCpus; c++) if(CPU_ISSET(c, &mask)) cpus[i++] = c;
+
+	if(nThreads > nCpus)
+		msg(WARNING, "%d threads share the %d cores of a process", nThreads, nCpus);
+
+	#pragma omp parallel num_threads(nThreads)
+	{
+		int t = 0;
+#ifdef _OPENMP
+		t = omp_get_thread_num();
+#endif
+		int i = spread ? (int)((long int)t*nCpus/nThreads) : t%nCpus;
+
+		cpu_set_t own;
+		CPU_ZERO(&own);
+		CPU_SET(cpus[i], &own);
+		sched_setaffinity(0, sizeof(own), &own);
+	}
+
+	free(cpus);
+#else
+	msg(WARNING, "thread pinning not supported on this system");
+#endif
+}
+
+void thSetup(const dictionary *ini){
+
+	int nThreads = iniGetInt(ini, "threads:nThreads");
+	if(nThreads < 0) msg(ERROR, "threads:nThreads must be non-negative");
+
+	char *pinning = iniGetStr(ini, "threads:pinning");
+	int pin = 0, spread = 0;
+	if(!strcmp(pinning,"NONE"))			pin = 0;
+	else if(!strcmp(pinning,"CLOSE"))	pin = 1;
+	else if(!strcmp(pinning,"SPREAD"))	pin = spread = 1;
+	else msg(ERROR, "threads:pinning must be NONE, CLOSE or SPREAD");
+	free(pinning);
+
+#ifdef _OPENMP
+	if(nThreads > 0) omp_set_num_threads(nThreads);
+	nThreads = omp_get_max_threads();
+#else
+	if(nThreads > 1) msg(WARNING, "compiled without OpenMP, using 1 thread");
+	nThreads = 1;
+#endif
+
+	if(pin) thPin(nThreads, spread);
+
+	msg(STATUS, "using %d thread(s) per process", nThreads);
+}
+
+/******************************************************************************
+ * RANDOM NUMBER FUNCTIONS
+ *****************************************************************************/
+
+void phSet(Philox *ph, unsigned long int seed, unsigned long int stream){
+
+	ph->key[0] = (unsigned int)seed;
+	ph->key[1] = (unsigned int)(seed>>32);
+	ph->stream[0] = (unsigned int)stream;
+	ph->stream[1] = (unsigned int)(stream>>32);
+}
+
+/**
+ * @brief Ten rounds of Philox4x32 on one counter (inlined into SIMD loops)
+ */
+static inline void phRounds(const Philox *ph, unsigned long int counter,
+							unsigned int *res){
+
+	unsigned int c0 = (unsigned int)counter;
+	unsigned int c1 = (unsigned int)(counter>>32);
+	unsigned int c2 = ph->stream[0];
+	unsigned int c3 = ph->stream[1];
+	unsigned int k0 = ph->key[0];
+	unsigned int k1 = ph->key[1];
+
+	for(int r=0;r<10;r++){
+		unsigned long int p0 = 0xD2511F53UL*c0;
+		unsigned long int p1 = 0xCD9E8D57UL*c2;
+		unsigned int hi0 = (unsigned int)(p0>>32), lo0 = (unsigned int)p0;
+		unsigned int hi1 = (unsigned int)(p1>>32), lo1 = (unsigned int)p1;
+		c0 = hi1^c1^k0;
+		c1 = lo1;
+		c2 = hi0^c3^k1;
+		c3 = lo0;
+		k0 += 0x9E3779B9U;
+		k1 += 0xBB67AE85U;
+	}
+
+	res[0] = c0;
+	res[1] = c1;
+	res[2] = c2;
+	res[3] = c3;
+}
+
+/**
+ * @brief Uniform variate in (0,1) of two random words
+ */
+static inline double phToDouble(unsigned int lo, unsigned int hi){
+
+	unsigned long int bits = ((unsigned long int)hi<<32 | lo) >> 11;
+	return (bits+0.5)*0x1.0p-53;
+}
+
+void phRandom(const Philox *ph, unsigned long int counter, unsigned int *res){
+	phRounds(ph, counter, res);
+}
+
+void phUniform(const Philox *ph, unsigned long int counter, double *res, long int n){
+
+	long int nPairs = n/2;
+
+	#pragma omp simd
+	for(long int i=0;i<nPairs;i++){
+		unsigned int x[4];
+		phRounds(ph, counter+i, x);
+		res[2*i]   = phToDouble(x[0],x[1]);
+		res[2*i+1] = phToDouble(x[2],x[3]);
+	}
+
+	if(n%2){
+		unsigned int x[4];
+		phRounds(ph, counter+nPairs, x);
+		res[n-1] = phToDouble(x[0],x[1]);
+	}
+}
+
+void phGaussian(const Philox *ph, unsigned long int counter, double *res, long int n){
+
+	long int nPairs = (n+1)/2;
+
+	#pragma omp simd
+	for(long int i=0;i<nPairs;i++){
+		unsigned int x[4];
+		phRounds(ph, counter+i, x);
+		double r = sqrt(-2.*log(phToDouble(x[0],x[1])));
+		double theta = 2.*M_PI*phToDouble(x[2],x[3]);
+		res[2*i] = r*cos(theta);
+		if(2*i+1<n) res[2*i+1] = r*sin(theta);
+	}
+}
+
 /******************************************************************************
  * STRING FUNCTIONS
  *****************************************************************************/
@@ -122,7 +728,12 @@ char *strCatAlloc(int n, ...){
  * ARRAY FUNCTIONS
  *****************************************************************************/
 
+// adSum() and adDotProd() sum blocks of this many elements in SIMD lanes, and
+// longer arrays pairwise (recursively halving them)
+#define PAIRWISE_BLOCK 128
+
 void adAdd(const double *a, const double *b, double *res, long int n){
+	#pragma omp simd
 	for(long int i=0;i<n;i++) res[i]=a[i]+b[i];
 }
 
@@ -135,6 +746,7 @@ void alAdd(const long int *a, const long int *b, long int *res, long int n){
 }
 
 void adMul(const double *a, const double *b, double *res, long int n){
+	#pragma omp simd
 	for(long int i=0;i<n;i++) res[i]=a[i]*b[i];
 }
 
@@ -147,6 +759,7 @@ void alMul(const long int *a, const long int *b, long int *res, long int n){
 }
 
 void adScale(double *a, long int n, double value){
+	#pragma omp simd
 	for(long int i=0;i<n;i++) a[i] *= value;
 }
 
@@ -159,6 +772,7 @@ void alScale(long int *a, long int n, int value){
 }
 
 void adShift(double *a, long int n, double value){
+	#pragma omp simd
 	for(long int i=0;i<n;i++) a[i] += value;
 }
 
@@ -172,7 +786,8 @@ void alShift(long int *a, long int n, long int value){
 
 double adMax(const double *a, long int n){
 	double res = a[0];
-	for(long int i=1;i<n;i++) if(a[i] > res) res = a[i];
+	#pragma omp simd reduction(max:res)
+	for(long int i=1;i<n;i++) res = a[i] > res ? a[i] : res;
 	return res;
 }
 
@@ -190,7 +805,8 @@ long int alMax(const long int *a, long int n){
 
 double adMin(const double *a, long int n){
 	double res = a[0];
-	for(long int i=1;i<n;i++) if(a[i] < res) res = a[i];
+	#pragma omp simd reduction(min:res)
+	for(long int i=1;i<n;i++) res = a[i] < res ? a[i] : res;
 	return res;
 }
 
@@ -225,13 +841,20 @@ long int alExt(const long int *a, long int n){
 }
 
 double adSum(const double *a, long int n){
-	double sum = 0;
-	for(long int i=0;i<n;i++) sum += a[i];
-	return sum;
+
+	if(n<=PAIRWISE_BLOCK){
+		double sum = 0;
+		#pragma omp simd reduction(+:sum)
+		for(long int i=0;i<n;i++) sum += a[i];
+		return sum;
+	}
+
+	long int half = n/2;
+	return adSum(a,half) + adSum(a+half,n-half);
 }
 
 long int aiSum(const int *a, long int n){
-	int sum = 0;
+	long int sum = 0;
 	for(long int i=0;i<n;i++) sum += a[i];
 	return sum;
 }
@@ -261,7 +884,7 @@ double adProd(const double *a, long int n){
 }
 
 long int aiProd(const int *a, long int n){
-	int res = 1;
+	long int res = 1;
 	for(long int i=0;i<n;i++) res *= a[i];
 	return res;
 }
@@ -272,19 +895,26 @@ long int alProd(const int *a, long int n){
 	return res;
 }
 
-int adDotProd(const double *a, const double *b, long int n){
-	double res = 0;
-	for(long int i=0;i<n;i++) res += a[i]*b[i];
-	return res;
+double adDotProd(const double *a, const double *b, long int n){
+
+	if(n<=PAIRWISE_BLOCK){
+		double res = 0;
+		#pragma omp simd reduction(+:res)
+		for(long int i=0;i<n;i++) res += a[i]*b[i];
+		return res;
+	}
+
+	long int half = n/2;
+	return adDotProd(a,b,half) + adDotProd(a+half,b+half,n-half);
 }
 
-int aiDotProd(const int *a, const int *b, long int n){
-	int res = 0;
-	for(long int i=0;i<n;i++) res += a[i]*b[i];
+long int aiDotProd(const int *a, const int *b, long int n){
+	long int res = 0;
+	for(long int i=0;i<n;i++) res += (long int)a[i]*b[i];
 	return res;
 }
 
-int alDotProd(const long int *a, const long int *b, long int n){
+long int alDotProd(const long int *a, const long int *b, long int n){
 	long int res = 0;
 	for(long int i=0;i<n;i++) res += a[i]*b[i];
 	return res;
@@ -305,6 +935,51 @@ int alEq(const long int *a, const long int *b, long int n){
 	return 1;
 }
 
+void adInvert(double *a, long int n){
+
+	// Reduce a to the identity, applying the same row operations to inv
+	double *inv = malloc(n*n*sizeof(*inv));
+	adSetAll(inv,n*n,0);
+	for(long int i=0;i<n;i++) inv[i*n+i] = 1;
+
+	for(long int c=0;c<n;c++){
+
+		long int pivot = c;
+		for(long int r=c+1;r<n;r++)
+			if(fabs(a[r*n+c])>fabs(a[pivot*n+c])) pivot = r;
+		if(a[pivot*n+c]==0) msg(ERROR,"Cannot invert singular matrix");
+
+		if(pivot!=c){
+			for(long int k=0;k<n;k++){
+				double temp = a[c*n+k];
+				a[c*n+k] = a[pivot*n+k];
+				a[pivot*n+k] = temp;
+				temp = inv[c*n+k];
+				inv[c*n+k] = inv[pivot*n+k];
+				inv[pivot*n+k] = temp;
+			}
+		}
+
+		double scale = 1.0/a[c*n+c];
+		for(long int k=0;k<n;k++){
+			a[c*n+k] *= scale;
+			inv[c*n+k] *= scale;
+		}
+
+		for(long int r=0;r<n;r++){
+			double factor = a[r*n+c];
+			if(r==c || factor==0) continue;
+			for(long int k=0;k<n;k++){
+				a[r*n+k] -= factor*a[c*n+k];
+				inv[r*n+k] -= factor*inv[c*n+k];
+			}
+		}
+	}
+
+	for(long int i=0;i<n*n;i++) a[i] = inv[i];
+	free(inv);
+}
+
 void adCumProd(const double *a, double *res, long int n){
 	res[0]=1;
 	for(long int i=0;i<n;i++) res[i+1]=res[i]*a[i];
@@ -399,7 +1074,7 @@ void alSet(long int *a, long int n, ...){
 void adPrintInner(double *a, long int inc, long int end, char *varName){
 
 	int rank;
-	MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+	MPI_Comm_rank(simComm(),&rank);
 
 	printf("PRINT(%i): %s(1:%li:%li) = \n  [",rank,varName,inc,end);
 	int i;
@@ -415,7 +1090,7 @@ void adPrintInner(double *a, long int inc, long int end, char *varName){
 void aiPrintInner(int *a, long int inc, long int end, char *varName){
 
 	int rank;
-	MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+	MPI_Comm_rank(simComm(),&rank);
 
 	printf("PRINT(%i): %s(1:%li:%li) = \n  [",rank,varName,inc,end);
 	int i;
@@ -429,7 +1104,7 @@ void aiPrintInner(int *a, long int inc, long int end, char *varName){
 void alPrintInner(long int *a, long int inc, long int end, char *varName){
 
 	int rank;
-	MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+	MPI_Comm_rank(simComm(),&rank);
 
 	printf("PRINT(%i): %s(1:%li:%li) = \n  [",rank,varName,inc,end);
 	int i;
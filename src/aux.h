@@ -75,6 +75,377 @@ void tReset(Timer *t);
  */
 void tMsg(long long int nanoSec, const char *string);
 
+/**
+ * @brief	Returns the current time of a monotonic clock
+ * @return	Time in nanoseconds since an arbitrary point
+ */
+unsigned long long int getNanoSec(void);
+
+///@}
+
+/**
+ * @name Timing regions
+ *
+ * Named timing regions which may be nested, for profiling where the time goes
+ * in each phase of a time step:
+ * \code
+ tRegionBegin("solve");
+ solve(solver, rho, phi, mpiInfo);	// Has "halo" regions inside
+ tRegionEnd("solve");
+ * \endcode
+ * A region is identified by its name and the region it is entered in, such
+ * that "halo" inside "solve" and "halo" inside "migrate" are timed separately.
+ * The regions are enabled by diagnostics:timing:
+ *
+ * timing	| Meaning
+ * ---------|----------------------------------------------------------------
+ * 0		| Disabled. Then entering a region only costs a branch.
+ * 1		| Print the time spent in each region at the end of the run
+ * 2		| As 1, and also write the time of each step to the history file
+ *
+ * The state is global to each MPI process, and not thread-safe, so regions
+ * must not be entered inside OpenMP parallel regions.
+ */
+///@{
+
+/**
+ * @brief	Enables or disables the timing regions
+ * @param	ini		Input file dictionary
+ *
+ * Called once by main() after MPI is initialized.
+ */
+void tRegionSetup(const dictionary *ini);
+
+/**
+ * @brief	Enters a timing region
+ * @param	name	Name of the region (within the current region)
+ * @see		tRegionEnd()
+ *
+ * name is stored, and should be a string literal.
+ */
+void tRegionBegin(const char *name);
+
+/**
+ * @brief	Leaves the current timing region
+ * @param	name	Name of the region (must be the current one)
+ * @see		tRegionBegin()
+ */
+void tRegionEnd(const char *name);
+
+/**
+ * @brief	Writes the time spent in each region since the last call to history
+ * @param	buf		Buffer of the history file
+ * @param	x		x-value (time step)
+ *
+ * Writes the maximum time across MPI nodes to a dataset named after the path
+ * of each region, e.g. /timing/step/solve/halo/total for "halo" inside "solve"
+ * inside "step". New regions get datasets as they appear.
+ * Only does something if diagnostics:timing is 2, and is collective.
+ */
+void tRegionWriteHistory(XyBuffer *buf, double x);
+
+/**
+ * @brief	Prints the time spent in each region
+ *
+ * Prints the minimum, average and maximum time across MPI nodes of each region,
+ * indented by nesting, and the ratio of the maximum to the average as a measure
+ * of load imbalance. MPI nodes missing a region count as 0 seconds. Collective.
+ */
+void tRegionReport(void);
+
+/**
+ * @brief	Time spent in a region, or in regions of some names inside it
+ * @param	path	Path of the region, e.g. "/step/solve"
+ * @param	names	Names of regions inside it (NULL for the region itself)
+ * @param	nNames	Number of names
+ * @return	Seconds spent on this MPI node (0 if the region is not found)
+ *
+ * E.g. names "halo" and "migrate" gives the time spent communicating within a
+ * region. Regions inside others of the given names are not counted twice.
+ */
+double tRegionSeconds(const char *path, const char * const *names, int nNames);
+
+/**
+ * @brief	Frees the timing regions
+ */
+void tRegionFree(void);
+
+///@}
+
+/**
+ * @name Simulation communicator
+ *
+ * The processes running one simulation, which is all of them (MPI_COMM_WORLD)
+ * unless the world is split between the members of an ensemble (see
+ * ensemble()). gAllocMpi() creates the communicators of MpiInfo from it, and
+ * functions given an MpiInfo communicate through those. simComm() is only for
+ * functions without one, e.g. msg(), the timing regions and the output files.
+ */
+///@{
+
+/**
+ * @brief	Sets the communicator of the simulation
+ * @param	comm	Communicator
+ * @param	member	Index to tag messages with (-1 for none)
+ *
+ * To be called before anything else communicates, i.e. before gAllocMpi().
+ * comm is then owned by this module and freed by simFreeComm(), which main()
+ * calls after the run.
+ */
+void simSetComm(MPI_Comm comm, int member);
+
+/**
+ * @brief	Frees the communicator set by simSetComm()
+ *
+ * Then simComm() is MPI_COMM_WORLD again. Does nothing if none was set.
+ */
+void simFreeComm(void);
+
+/**
+ * @brief	Returns the communicator of the simulation
+ * @return	Communicator
+ */
+MPI_Comm simComm(void);
+
+/**
+ * @brief	Returns the ensemble member of this process
+ * @return	Member index, or -1 if not running an ensemble
+ */
+int simMember(void);
+
+///@}
+
+/**
+ * @name Consistency checks
+ *
+ * Checks which are only for catching bugs, like pVelAssertMax() and
+ * pPosAssertInLocalFrame(), cost a pass over all particles or nodes. They are
+ * run on the time steps chosen by diagnostics:checks:
+ *
+ * checks	| Meaning
+ * ---------|----------------------------------------------------------------
+ * OFF		| Never
+ * SAMPLED	| Every diagnostics:checkInterval time steps
+ * FULL		| Every time step
+ *
+ * The time step is also only printed on the steps of diagnostics:checkInterval
+ * unless it is FULL. Checks above CHECK_LEVEL (0 for OFF, 1 for SAMPLED, 2 for
+ * FULL) are compiled out, e.g. using CADD=-DCHECK_LEVEL=0 for production runs.
+ * The checks are the same on all MPI processes such that they may reduce.
+ */
+///@{
+
+#ifndef CHECK_LEVEL
+#define CHECK_LEVEL 2	///< Highest level of checks compiled in
+#endif
+
+/**
+ * @brief	Sets the level of checks
+ * @param	ini		Input file dictionary
+ *
+ * Called once by main(). Checks are FULL until then.
+ */
+void chSetup(const dictionary *ini);
+
+/**
+ * @brief	Starts a time step
+ * @param	n		Time step
+ * @return	Whether checks are to be done this time step
+ */
+int chBeginStep(long int n);
+
+/**
+ * @brief	Whether checks are to be done this time step
+ * @return	1 if so, 0 if not
+ * @see		chBeginStep()
+ */
+int chActive(void);
+
+/**
+ * @brief	Whether to print the progress of this time step
+ * @return	1 if so, 0 if not
+ */
+int chVerbose(void);
+
+///@}
+
+/**
+ * @name Reduction functions
+ */
+///@{
+
+/**
+ * @brief	Allocates a Reduction struct
+ * @param	op		MPI reduction operation to apply, e.g. MPI_SUM
+ * @return	Pointer to Reduction struct
+ * @see		Reduction, rFree()
+ *
+ * Collective across simComm() since it duplicates the communicator.
+ * Remember to free using rFree().
+ */
+Reduction *rAlloc(MPI_Op op);
+
+/**
+ * @brief	Frees a Reduction struct allocated with rAlloc()
+ * @param	red		Pointer to Reduction struct
+ */
+void rFree(Reduction *red);
+
+/**
+ * @brief	Registers scalars to be reduced across MPI nodes
+ * @param	red		Reduction
+ * @param	value	Pointer to the first of n consecutive scalars
+ * @param	n		Number of scalars
+ * @see		rBegin(), rEnd()
+ *
+ * The scalars are read when rBegin() is called, not now, and overwritten by
+ * their reduced values in rEnd(). They must therefore remain valid until then.
+ */
+void rAdd(Reduction *red, double *value, int n);
+
+/**
+ * @brief	Starts reducing all registered scalars
+ * @param	red		Reduction
+ * @see		rEnd()
+ *
+ * Copies the registered scalars to a buffer and starts one non-blocking
+ * reduction of them all. Must be called by all MPI nodes with the same number
+ * of registered scalars.
+ */
+void rBegin(Reduction *red);
+
+/**
+ * @brief	Completes the reduction started by rBegin()
+ * @param	red		Reduction
+ *
+ * Waits for the reduction to complete, stores the reduced values to the
+ * registered scalars and clears the registry. Does nothing if no reduction is
+ * pending.
+ */
+void rEnd(Reduction *red);
+
+///@}
+
+/**
+ * @name Arena functions
+ */
+///@{
+
+/**
+ * @brief	Allocates an Arena
+ * @param	size		Size in bytes
+ * @param	hugePages	Ask for the block to be backed by huge pages (1) or not (0)
+ * @return	Pointer to Arena
+ * @see		Arena, arGet(), arFree()
+ *
+ * The block is zeroed by the calling thread. On NUMA systems the pages are
+ * therefore placed (by first touch) on the memory node of the core running
+ * it, so allocate it after the process is pinned. Huge pages are requested
+ * using madvise() where available, and otherwise ignored.
+ */
+Arena *arAlloc(size_t size, int hugePages);
+
+/**
+ * @brief	Frees an Arena and all pieces handed out from it
+ * @param	arena	Pointer to Arena
+ */
+void arFree(Arena *arena);
+
+/**
+ * @brief	Hands out a piece of an Arena
+ * @param	arena	Arena
+ * @param	size	Size in bytes
+ * @return	Pointer to piece (aligned to ARENA_ALIGN bytes)
+ *
+ * Pieces are handed out consecutively. Exceeding the size of the Arena is an
+ * error, use arPad() to compute the required size beforehand.
+ */
+void *arGet(Arena *arena, size_t size);
+
+/**
+ * @brief	Returns the space a piece of a given size takes in an Arena
+ * @param	size	Size of piece in bytes
+ * @return	Size rounded up to a multiple of ARENA_ALIGN
+ */
+size_t arPad(size_t size);
+
+///@}
+
+/**
+ * @name Thread functions
+ */
+///@{
+
+/**
+ * @brief	Sets the number of OpenMP threads and pins them to cores
+ * @param	ini		Input file
+ *
+ * Reads the following keys from the threads section of the input file:
+ *
+ * Key		| Description
+ * ---------|----------------------------------------------------------------
+ * nThreads	| Threads per MPI process (0 to use OMP_NUM_THREADS)
+ * pinning	| NONE, CLOSE or SPREAD
+ *
+ * With NONE the threads are left to the OpenMP runtime (OMP_PROC_BIND and
+ * OMP_PLACES). Otherwise each thread is bound to one of the cores the MPI
+ * launcher bound the process to, so bind each rank to several cores, e.g.
+ * "mpirun --map-by ppr:2:socket:pe=8". CLOSE gives consecutive threads
+ * consecutive cores while SPREAD spaces them evenly over the cores.
+ *
+ * Call it after MPI is initialized and before any memory is touched, such that
+ * the pages of grids and particles are placed close to the threads using them.
+ * Without OpenMP this only warns if more than one thread is asked for.
+ */
+void thSetup(const dictionary *ini);
+
+///@}
+
+/**
+ * @name Counter-based random numbers
+ */
+///@{
+
+/**
+ * @brief	Sets the key and stream of a Philox generator
+ * @param	ph		Philox
+ * @param	seed	Seed (key)
+ * @param	stream	Stream (upper half of the counter)
+ */
+void phSet(Philox *ph, unsigned long int seed, unsigned long int stream);
+
+/**
+ * @brief	Computes the 128 random bits of a counter
+ * @param	ph		Philox
+ * @param	counter	Lower half of the counter
+ * @param	res		The bits as 4 words
+ */
+void phRandom(const Philox *ph, unsigned long int counter, unsigned int *res);
+
+/**
+ * @brief	Generates uniform variates in the open interval (0,1)
+ * @param	ph		Philox
+ * @param	counter	Counter of the first two variates
+ * @param	res		Variates (n elements)
+ * @param	n		Number of variates
+ *
+ * Variates 2i and 2i+1 are made from counter+i, such that the next (n+1)/2
+ * counters are used. Each has 53 random bits. Thread-safe.
+ */
+void phUniform(const Philox *ph, unsigned long int counter, double *res, long int n);
+
+/**
+ * @brief	Generates standard normal variates
+ * @param	ph		Philox
+ * @param	counter	Counter of the first two variates
+ * @param	res		Variates (n elements)
+ * @param	n		Number of variates
+ *
+ * As phUniform(), but each pair of uniforms are transformed to a pair of
+ * normal variates with the Box-Muller transform. Thread-safe.
+ */
+void phGaussian(const Philox *ph, unsigned long int counter, double *res, long int n);
+
 ///@}
 
 /**
@@ -128,7 +499,8 @@ char *strCatAlloc(int n,...);
  * may be in the long int range).
  *
  * In-place operations are supported, i.e. the 'res' array may very well be the
- * same as one or both of the input array. Example:
+ * same as one or both of the input array. It may not partially overlap them,
+ * however, since the 'ad' functions are vectorized. Example:
  *
  * @code
  *	int n = 3;
@@ -203,7 +575,8 @@ int aiExt(const int *a, long int n);
 /// For instance, if -6 is the minimum and 5 is the maximum the return value is
 /// -6.
 long int alExt(const long int *a, long int n);
-///@brief Returns sum of all elements
+///@brief Returns sum of all elements. The sum is vectorized and pairwise,
+/// such that the rounding error grows only logarithmically with n.
 double adSum(const double *a, long int n);
 ///@brief Returns sum of all elements
 long int aiSum(const int *a, long int n);
@@ -221,12 +594,12 @@ double adProd(const double *a, long int n);
 long int aiProd(const int *a, long int n);
 ///@brief Returns product of all elements
 long int alProd(const int *a, long int n);
+///@brief Returns dot product of vectors (summed like adSum())
+double adDotProd(const double *a, const double *b, long int n);
 ///@brief Returns dot product of vectors
-int adDotProd(const double *a, const double *b, long int n);
-///@brief Returns dot product of vectors
-int aiDotProd(const int *a, const int *b, long int n);
+long int aiDotProd(const int *a, const int *b, long int n);
 ///@brief Returns dot product of vectors
-int alDotProd(const long int *a, const long int *b, long int n);
+long int alDotProd(const long int *a, const long int *b, long int n);
 ///@brief Returns 1 if arrays are equal, 0 otherwise. Every element must be
 /// at maximum 'tol' apart to be considered equal (max-norm).
 int adEq(const double *a, const double *b, long int n, double tol);
@@ -234,6 +607,9 @@ int adEq(const double *a, const double *b, long int n, double tol);
 int aiEq(const int *a, const int *b, long int n);
 ///@brief Returns 1 if arrays are equal, 0 otherwise
 int alEq(const long int *a, const long int *b, long int n);
+///@brief Inverts the n-by-n matrix 'a' (row-major) in place, using Gauss-Jordan
+/// elimination with partial pivoting. Stops with an error if 'a' is singular.
+void adInvert(double *a, long int n);
 ///@brief Determine cumulative product of elements in 'a' starting at 1.
 /// Hence the cumulative product of {5,4,3} is {1,5,20,60}. Notice that the
 /// result is of lenght n+1 in this case.
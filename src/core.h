@@ -24,6 +24,70 @@
 /******************************************************************************
  * DEFINING CORE DATATYPES (used by several modules)
  *****************************************************************************/
+/**
+ * @brief Defines the memory layout of particles in a Population
+ * @see Population
+ */
+typedef enum{
+	AOS = 0x00,		///< Array of structures, i.e. (x,y,z) of each particle after each other
+	SOA = 0x01		///< Structure of arrays, i.e. x of all particles, then y, then z
+} popLayout;
+
+/**
+ * @brief Where the particles of a Population are up to date
+ * @see pToDevice()
+ */
+typedef enum{
+	ON_HOST = 0x00,		///< Only on the host (not mapped to a device)
+	ON_BOTH = 0x01,		///< Mapped to a device, and the same on both
+	ON_DEVICE = 0x02	///< Mapped to a device, and only up to date there
+} popResidency;
+
+/**
+ * @brief Defines how migrants are exchanged between subdomains
+ * @see MpiInfo
+ * @see puMigrate
+ */
+typedef enum{
+	MIGRATE_SPLIT = 0x00,	///< Exchange the number of migrants first, then the migrants
+	MIGRATE_PROBED = 0x01	///< Send both in one message, received using MPI_Mprobe()
+} migrateProtocol;
+
+/**
+ * @brief Floating point type used to store particle positions and velocities
+ * @see Population
+ *
+ * Particles are stored in double precision unless PINC is compiled with
+ * POP_SINGLE defined (e.g. CADD=-DPOP_SINGLE), in which case single precision
+ * is used. This halves the memory footprint of Population and of the migration
+ * buffers in MpiInfo, and the memory traffic when pushing particles. Fields and
+ * energies are still computed in double precision. Since positions are stored
+ * relative to the subdomain, and subdomains rarely exceed a few hundred nodes
+ * in each direction, a single precision position is accurate to about 1e-5
+ * cells. POP_MPI_FLOAT and POP_H5_FLOAT are the corresponding MPI and HDF5
+ * datatypes.
+ */
+#ifdef POP_SINGLE
+typedef float popFloat;
+#define POP_MPI_FLOAT MPI_FLOAT
+#define POP_H5_FLOAT H5T_NATIVE_FLOAT
+#else
+typedef double popFloat;
+#define POP_MPI_FLOAT MPI_DOUBLE
+#define POP_H5_FLOAT H5T_NATIVE_DOUBLE
+#endif
+
+/**
+ * @brief Smallest loop worth splitting between OpenMP threads
+ *
+ * Grid, multigrid and pusher kernels are OpenMP-parallel when PINC is compiled
+ * with OpenMP (e.g. "make omp"), but run serially on boxes of fewer nodes (or
+ * species of fewer particles) than this, such as the coarsest multigrid
+ * levels, where starting the threads costs more than it gains. The number of threads and their pinning is set by the threads section
+ * of the input file (see thSetup()).
+ */
+#define OMP_MIN_NODES 8192
+
 /**
  * @brief Contains a population of particles.
  *
@@ -36,7 +100,7 @@
  *	Population pop;
  *  ...
  *	for(int i=0;i<3;i++){
- *		double *iPos = &pop.pos[i*pop.nDims];
+ *		popFloat *iPos = &pop.pos[i*pop.nDims];
  *		printf("Particle %i is located at (%f,%f,%f).\n",i,iPos[0],iPos[1],iPos[2]);
  *	}
  * @endcode
@@ -65,23 +129,127 @@
  * energy for the current subdomain, and a separate function must be employed
  * to sum the energy across the subdomains and store it to an .h5-file.
  *
+ * weight is the statistical weight of each particle relative to the other
+ * particles of its specie, i.e., the particle represents weight times
+ * Units::weights[s] physical particles and has weight times the charge and
+ * mass of the specie. It varies when particles are merged and split by
+ * pMergeSplit(), and is NULL (all particles equally heavy) unless
+ * population:mergeInterval is positive. weight[i] belongs to particle i in
+ * either layout.
+ *
+ * T and S are the rotation parameters used by the Boris accelerators for each
+ * specie, generated from the external B-field by puGet3DRotationParameters().
+ * They are zero (no rotation) unless set.
+ *
  * If a population h5 output file is created, the handler to this file is
- * stored in h5.
+ * stored in h5. h5Type is the datatype of the stored positions and velocities,
+ * and h5NRowsChunk and h5Deflate the chunking and compression of the datasets
+ * (see createH5RowsPList()). These are set from files:popPrecision,
+ * files:popChunk and files:popDeflate by pOpenH5().
+ *
+ * The above describes the AOS (array of structures) layout. In the SOA
+ * (structure of arrays) layout, selected by population:layout, the allocated
+ * space of each specie is instead divided into nDims arrays, one per
+ * component, such that component d of particle i of specie s is:
+ *
+ * @code
+ *	long int nAlloc = iStart[s+1]-iStart[s];
+ *	pos[iStart[s]*nDims + d*nAlloc + i-iStart[s]];
+ * @endcode
+ *
+ * This lets kernels operating on one component at a time be vectorized. The
+ * arrays are aligned to cache lines. Most functions in population.c take care
+ * of the layout themselves, whereas kernels in pusher.c typically only supports
+ * one of them. The layout can be changed using pSetLayout().
+ *
+ * The kernels ending with Offload (e.g. puAcc3D1KEOffload()) run on an OpenMP
+ * target device, and keep pos and vel resident there between time steps. The
+ * residency tells whether the host copy is up to date, and pToHost() must be
+ * called before using the particles on the host after such kernels. deviceIdx
+ * and deviceBuf are scratch space of those kernels for nDeviceAlloc particles,
+ * see pReserveDevice().
+ *
+ * pSort() records where the particles of each cell start in cellStart, such
+ * that with nCells=cellProd[nDims] the particles of specie s in cell c are at
+ * i=cellStart[s*(nCells+1)+c] to i=cellStart[s*(nCells+1)+c+1]-1. This remains true for the first
+ * sortedStop[s] particles, except that they may have moved up to sortAge
+ * pushes away from their cell since, and that the particles at the nDisplaced
+ * indices in displaced have been put there afterwards. Particles after
+ * sortedStop[s] (e.g. immigrants) are not in order. Only kernels which keep
+ * this bookkeeping up to date, such as puExtractEmigrants3DShell(), rely on
+ * it, and functions reordering particles otherwise discard it by setting
+ * sortedStop[s]=iStart[s].
+ *
+ * The storage of each specie is fixed unless growth is positive (set by
+ * population:growth), in which case pReserve() and pCompact() reallocate pos,
+ * vel and weight to fit the number of particles, changing iStart. Pointers
+ * into them, and indices of particles not of the specie being grown, are then
+ * no longer valid.
  */
 typedef struct{
-	double *pos;		///< Position
-	double *vel;		///< Velocity
+	popFloat *pos;		///< Position
+	popFloat *vel;		///< Velocity
 	long int *iStart;	///< First index of specie s (nSpecies+1 elements)
 	long int *iStop;	///< First index not of specie s (nSpecies elements)
 	double *charge;		///< Charge (nSpecies elements)
 	double *mass;		///< Mass (nSpecies elements)
 	double *kinEnergy;	///< Kinetic energy (nSpecies+1 elements)
 	double *potEnergy;	///< Potential energy (nSpecies+1 elements)
+	popFloat *weight;	///< Relative weight of each particle (or NULL)
+	double *T;			///< Boris rotation parameter t (3*nSpecies elements)
+	double *S;			///< Boris rotation parameter s (3*nSpecies elements)
 	int nSpecies;		///< Number of species
 	int nDims;			///< Number of dimensions (usually 3)
+	popLayout layout;	///< Memory layout of pos and vel
 	hid_t h5;			///< HDF5 file handler
+	hid_t h5Type;		///< HDF5 datatype of pos and vel in file
+	long int h5NRowsChunk;	///< Particles per HDF5 chunk (0 for contiguous)
+	int h5Deflate;		///< HDF5 deflate level
+	popResidency residency;	///< Where pos and vel are up to date
+	long int *deviceIdx;	///< Particle indices on the device
+	popFloat *deviceBuf;	///< Particles on the device (2*nDims per particle)
+	long int nDeviceAlloc;	///< Particles deviceIdx and deviceBuf hold
+	long int *cellStart;	///< First particle of each cell at pSort()
+	long int *cellProd;	///< Cumulative product of cells at pSort() (nDims+1)
+	long int *sortedStop;	///< End of the cell-ordered particles (nSpecies)
+	int sortAge;		///< Pushes since pSort()
+	long int *displaced;	///< Particles moved since pSort()
+	long int nDisplaced;	///< Number of elements in displaced
+	long int nDisplacedAlloc;	///< Elements allocated for displaced
+	double growth;		///< Factor to over-allocate species by (0 for fixed)
 } Population;
 
+/**
+ * @brief In-situ velocity distributions and phase-space histograms
+ *
+ * Instead of storing every particle and binning them in post-processing, the
+ * particles are binned in the simulation and only the histograms are stored,
+ * see pWritePhaseSpace(). For each specie s, local holds nBins counts: First
+ * nVelBins bins of the velocity component 0, 1, ... in the range
+ * [-velMax[s],velMax[s]), then nXBins*nVBins bins of position xDim in the
+ * global domain [0,xMax), wrapped periodically, versus velocity component vDim
+ * in the same range as above, the latter being the fastest varying. Particles
+ * outside the ranges are not counted.
+ *
+ * The settings are read from the [diagnostics] section by pAllocPhaseSpace().
+ */
+typedef struct{
+	int nSpecies;		///< Number of species
+	int nDims;			///< Number of dimensions
+	int nVelBins;		///< Bins of the histogram of each velocity component
+	double *velMax;		///< Half-width of the velocity range (nSpecies elements)
+	int xDim;			///< Position dimension of the phase-space histogram
+	int vDim;			///< Velocity component of the phase-space histogram
+	int nXBins;			///< Bins of the phase-space histogram along position
+	int nVBins;			///< Bins of the phase-space histogram along velocity
+	double xMax;		///< Global size of the domain along xDim
+	long int nBins;		///< Number of bins of each specie
+	long int *local;	///< Counts of this MPI node (nSpecies*nBins elements)
+	long int *global;	///< Counts of all MPI nodes (on rank 0)
+	hid_t h5;			///< HDF5 file handler
+	MPI_Comm comm;		///< Private communicator
+} PhaseSpace;
+
 /**
  * @brief Contains information regarding how the PIC code is parallelized.
  *
@@ -105,15 +273,33 @@ typedef struct{
  * @code
  *	int J = (int)(posToNode[0]*pos[0]);
  * @endcode
+ *
+ * cuts[d][J] is the first global node of the subdomains with subdomain[d]==J,
+ * and cuts[d][nSubdomains[d]] is the global size along dimension d. trueSize
+ * is the number of true nodes in this subdomain. The subdomains start out
+ * equally large, but gBalance() may move the cuts to even out the number of
+ * particles, after which trueSize differs between the subdomains and
+ * posToSubdomain no longer applies.
+ *
+ * comm is a Cartesian communicator of the subdomains, in which the rank
+ * mpiRank is the lexicographic index of the subdomain (the first dimension
+ * varying fastest). It may differ from the rank in simComm(), since
+ * ranks are placed to keep neighboring subdomains on the same node (see
+ * gAllocMpi()). Point-to-point communication between subdomains must therefore
+ * use comm, or communicators duplicated from it such as migrateComm and
+ * haloComm. Output is still done by rank 0 of simComm() (see msg()).
  */
 typedef struct{
-	int mpiRank;				///< MPI rank
+	MPI_Comm comm;				///< Cartesian communicator of the subdomains
+	int mpiRank;				///< MPI rank in comm
 	int mpiSize;				///< MPI size
 	int nDims;					///< Number of dimensions
 	int *subdomain;				///< MPI node (nDims elements)
 	int *nSubdomains;			///< Number of MPI nodes (nDims elements)
 	int *nSubdomainsProd;		///< Cumulative product of nSubdomains (nDims+1 elements)
 	int *offset;				///< Offset from global reference frame (nDims elements)
+	int *trueSize;				///< True size of this subdomain (nDims elements)
+	int **cuts;					///< First global node of each subdomain (nDims arrays of nSubdomains[d]+1 elements)
 	double *posToSubdomain;		///< Factor for converting position to subdomain (nDims elements)
 
 	int nSpecies;				///< Number of species
@@ -124,10 +310,21 @@ typedef struct{
 	long int *nEmigrants;		///< Number of migrants of each specie to each neighbor (nSpecies*nNeighbor elements)
 	long int *nEmigrantsAlloc;	///< Number of migrants allocated for to each neighbor (nNeighbor elements)
 	long int *nImmigrants;		///< Number of immigrants of each specie from each neighbour (nSpecies*nNeighbor elements)
-	long int nImmigrantsAlloc;
-	double **emigrants;			///< Buffer to house emigrants
-	double **emigrantsDummy;	///< YAY
-	double *immigrants;			///< Buffer to house immigrants
+	long int *nImmigrantsAlloc;	///< Number of immigrants allocated for from each neighbor (nNeighbor elements)
+	popFloat **emigrants;		///< Buffer to house emigrants
+	popFloat **emigrantsDummy;	///< YAY
+	popFloat **immigrants;		///< Buffer to house immigrants from each neighbor
+	int migrantSize;			///< Values per migrant (2*nDims, plus 1 for its weight if weighted)
+	migrateProtocol migration;	///< How migrants are exchanged (grid:migration)
+	MPI_Comm migrateComm;		///< Communicator used only for migrants
+	MPI_Comm haloComm;			///< Communicator used only for halo exchange
+	int nPendingImmigrants;		///< Number of immigrant messages not yet received
+	long int *nEmigrantsHighWater;	///< Most emigrants to each neighbor since last shrinking buffers (nNeighbor elements)
+	long int *nImmigrantsHighWater;	///< Most immigrants from each neighbor since last shrinking buffers (nNeighbor elements)
+	long int *nEmigrantsPeak;	///< Most emigrants to each neighbor in one migration (nNeighbor elements)
+	long int *nEmigrantsSum;	///< Emigrants to each neighbor summed over all migrations (nNeighbor elements)
+	long int nMigrations;		///< Number of migrations carried out
+	long int nResizes;			///< Number of times a migrant buffer has been resized
 	double *thresholds;			///< Threshold for migration (2*nDims elements)
 
 	MPI_Request *send;
@@ -147,6 +344,24 @@ typedef enum{
 } bndType;
 
 
+/**
+ * @brief A contiguous block of memory handed out in aligned pieces
+ *
+ *	Used to let many arrays which are used together, e.g. all levels of a
+ *	multigrid hierarchy, share one block allocated by arAlloc() rather than be
+ *	malloc'ed one by one. Pieces are handed out by arGet() and the whole block
+ *	is freed at once by arFree(). Each piece starts at a multiple of
+ *	ARENA_ALIGN bytes.
+ */
+typedef struct{
+	char *base;			///< Start of block
+	size_t size;		///< Size of block in bytes
+	size_t used;		///< Number of bytes handed out
+} Arena;
+
+/// Alignment of pieces of an Arena in bytes (a cache line)
+#define ARENA_ALIGN 64
+
 /**
  * @brief A grid-valued quantity, for instance charge density or E-field.
  *
@@ -251,11 +466,46 @@ typedef enum{
  * and are used by gWriteH5(). The other two h5-variables are also used by
  * gWriteH5() since they only needs to be computed once.
  *
- * 'slice' is a buffer which is large enough to store any slice cut through the
- * array using getSlice().
+ * 'recvSlice' is a buffer which is large enough to store two slices cut
+ * through the array using getSlice(). Slices are otherwise sent directly from
+ * 'val' using the MPI datatypes in 'sliceTypes' and 'faceTypes', created by
+ * gCreateHalo().
+ *
+ * 'haloBoxes' splits the true grid into 2*rank-1 boxes. Box 0 is the interior,
+ * which doesn't touch the ghost layers in any stencil along the axes, and the
+ * rest is the shell around it. The lower corner of box b (inclusive) starts at
+ * haloBoxes[2*rank*b] and the upper corner (exclusive) at
+ * haloBoxes[2*rank*b+rank], each with rank elements.
+ *
+ * 'tileSize' is the size of the tiles the stencil kernels (e.g. gFinDiff2nd3D())
+ * splits boxes of nodes into to keep the neighbors in cache. It is set from
+ * grid:tileSize by gSetTileSize().
+ *
+ * 'arena' is the Arena in which val, the slice buffers and the size arrays are
+ * stored, or NULL if they are malloc'ed separately as by gAlloc(). gFree() only
+ * frees them in the latter case.
+ *
+ * 'colorTypes' is created by gCreateColorHalo(), or NULL, and has two
+ * datatypes per dimension d starting at colorTypes[2*d]. They are the nodes of
+ * faceTypes[d] whose other indices sum to an even and odd number,
+ * respectively. The red-black smoothers use them to exchange only the color
+ * just updated.
+ *
+ * 'singleTypes' is created by gCreateSingleHalo(), or NULL. They are the slices
+ * of sliceTypes for an array of floats shaped as val, and are used to exchange
+ * the single precision levels of the multigrid solver (see gHaloOpSingle()).
+ *
+ * 'haloTime', if not NULL, is a counter the halo functions (gHaloOp(),
+ * gHaloOpBegin(), gHaloOpEnd(), etc.) add the nanoseconds they spend to. It's
+ * NULL unless set by the user, e.g. to the same counter for several grids.
+ *
+ * 'deep' is a copy of the grid padded with more ghost layers, created by
+ * gCreateDeepHalo(), or NULL. Smoothers use it to do several sweeps per halo
+ * exchange. The ghost layers of the copy are exchanged with all 3^nDims-1
+ * neighbors at once using the MPI datatypes in its 'deepTypes'.
  */
 
-typedef struct{
+typedef struct Grid{
 	double *val;		///< Array of values on the grid
 	int rank;			///< Number of dimensions of array (not grid)
 	int *size;			///< Size of array (including ghosts) (rank elements)
@@ -263,9 +513,19 @@ typedef struct{
 	long int *sizeProd;	///< Cumulative product of size (rank+1 elements)
 	int *nGhostLayers;	///< Number of ghost layers in grid (2*rank elements)
 
-	double *sendSlice;	///< Slice buffer of the grid sent to other
-	double *recvSlice;	///< Slice buffer of the grid sent to other
+	double *recvSlice;	///< Buffer for slices recieved from the lower and upper neighbor
+	MPI_Datatype *sliceTypes;	///< A slice through all of val along each dimension (rank elements)
+	MPI_Datatype *faceTypes;	///< As sliceTypes, but excluding ghost layers of other dimensions (rank elements)
+	MPI_Datatype *colorTypes;	///< As faceTypes, but only nodes of one parity (2*rank elements, or NULL)
+	MPI_Datatype *singleTypes;	///< As sliceTypes, but of floats (rank elements, or NULL)
+	MPI_Request *haloRequests;	///< Requests of halo exchanges in progress (4*rank elements)
+	unsigned long long int *haloTime;	///< Nanoseconds spent in halo exchanges are added here (or NULL)
+	int *haloBoxes;		///< Interior and shell of the true grid (2*rank*(2*rank-1) elements)
+	int *tileSize;		///< Size of tiles traversed by stencil kernels (rank elements)
+	Arena *arena;		///< Arena holding the arrays of the grid (or NULL)
 	double *bndSlice;	///< Slices used by Dirichlet and Neumann boundaries
+	struct Grid *deep;	///< Copy with deeper ghost layers (or NULL)
+	MPI_Datatype *deepTypes;	///< Blocks sent to and received from each neighbor (2*3^nDims elements, only in deep)
 	hid_t h5;			///< HDF5 file handler
 	hid_t h5MemSpace;	///< HDF5 memory space description
 	hid_t h5FileSpace;	///< HDF5 file space description
@@ -273,6 +533,53 @@ typedef struct{
 	bndType *bnd;		///< Array storing boundary conditions
 } Grid;
 
+/**
+ * @brief Sub-cycling of heavy species
+ *
+ * Specie s is only pushed (moved, migrated, deposited and accelerated) every
+ * subcycles[s] time steps, with a correspondingly larger time step. In
+ * between, its particles are hidden from the kernels and the charge density it
+ * deposited on its last push step, kept in rhoSpecies[s], is used instead. See
+ * puSubcycleBegin().
+ */
+typedef struct{
+	int nSpecies;		///< Number of species
+	int *subcycles;		///< Time steps per push (nSpecies elements)
+	int active;			///< Whether any specie is sub-cycled
+	int cached;			///< Whether rhoSpecies has been deposited
+	long int n;			///< Time step of puSubcycleBegin()
+	Grid **rhoSpecies;	///< Charge density of specie s, if sub-cycled
+	long int *nHidden;	///< Number of particles of hidden species
+	double *kinEnergy;	///< Kinetic energy of each specie on its last push
+	double *mass;		///< Saved mass of species being pushed
+} Subcycle;
+
+/**
+ * @brief Reduced-resolution and time-averaged output of a Grid
+ *
+ * Stores a Grid quantity with fewer nodes and less often than gWriteH5(), see
+ * gWriteOutput(). The values of 'interval' time-steps are summed in 'sum' (and
+ * divided by the number of steps if 'mean'), and the resolution is halved
+ * 'nLevels' times by the multigrid restrictor before writing.
+ *
+ * 'levels' are scalar grids of each resolution, from the finest (levels[0]) to
+ * the coarsest (levels[nLevels]). Vector quantities are restricted one
+ * component at a time through them. For scalar quantities levels[0] is 'sum'.
+ * 'coarse' is the grid being written, and holds the .grid.h5-file. It is
+ * 'sum' if nLevels is 0.
+ */
+typedef struct{
+	Grid *sum;			///< Values summed over the time-steps averaged
+	Grid **levels;		///< Scalar grids of each resolution (nLevels+1 elements)
+	Grid *coarse;		///< Grid being written
+	int nLevels;		///< Number of times the resolution is halved
+	int interval;		///< Number of time-steps averaged
+	int nSteps;			///< Number of time-steps since the last write
+	int nSummed;		///< Number of time-steps in sum (less if resized)
+	int mean;			///< Divide the sum by the number of time-steps if true
+	void (*restrictor)(const Grid *fine, Grid *coarse);
+} GridOutput;
+
 /**
  * @brief Contains characteristic scales to be used for normalization and
  * denormalization in PINC.
@@ -437,8 +744,148 @@ typedef struct{
 	unsigned long long int total;		/// Total time
 	unsigned long long int start;		/// Previous start time
 } Timer;
+
+/**
+ * @brief Key and stream of a counter-based random number generator
+ * @see phSet(), phUniform(), phGaussian()
+ *
+ *	Philox4x32-10 (Salmon et al., "Parallel random numbers: As easy as 1, 2,
+ *	3", SC'11) maps a 128-bit counter and a 64-bit key to 128 random bits.
+ *	There is no state to advance, so any number of the sequence can be
+ *	generated directly from its counter, in any order, by many threads at once
+ *	and in SIMD lanes. The upper half of the counter is the stream (e.g. a cell
+ *	or a specie) and the lower half is passed to each call. Each counter gives
+ *	two uniform or two normal variates:
+ *	\code
+ Philox ph;
+ phSet(&ph, seed, cell);
+
+ double vel[3*nParticlesInCell];
+ phGaussian(&ph, 0, vel, 3*nParticlesInCell);	// Uses counters 0, 1, 2, ...
+ *	\endcode
+ *	The numbers only depend on the seed, stream and counter, not on the
+ *	machine, the number of threads or the loop order.
+ */
+typedef struct{
+	unsigned int key[2];		///< Key (the seed)
+	unsigned int stream[2];		///< Upper half of the counter
+} Philox;
+
+/**
+ * @brief Aggregates global reductions of scalars into one collective operation
+ *
+ *	Rather than reducing each diagnostic quantity across MPI nodes separately,
+ *	with one blocking collective per quantity, the scalars registered using
+ *	rAdd() during a time step are gathered in one buffer and reduced together
+ *	with one non-blocking MPI_Iallreduce() started by rBegin(). rEnd() waits for
+ *	it to complete, writes the global values back to the registered addresses
+ *	and clears the registry for the next time step:
+ *	\code
+ Reduction *red = rAlloc(MPI_SUM);
+
+ for(int n = 1; n <= nTimeSteps; n++){
+	 ...
+	 rAdd(red, &a, 1);
+	 rAdd(red, b, 3);
+	 rBegin(red);
+	 ...	// Work not depending on a or b
+	 rEnd(red);	// a and b are now summed across all MPI nodes
+ }
+
+ rFree(red);
+ *	\endcode
+ */
+typedef struct{
+	MPI_Op op;					///< Reduction operation
+	int n;						///< Number of registered scalars
+	int nAlloc;					///< Number of scalars allocated for
+	double *local;				///< Local values (n of them)
+	double *global;				///< Reduced values (n of them)
+	double **targets;			///< Addresses to write reduced values to
+	MPI_Request request;		///< Request of pending reduction
+	MPI_Comm comm;				///< Private communicator for the reductions
+} Reduction;
+
+/**
+ * @brief Snapshots staged in memory to be written to H5-files later
+ *
+ *	Collective writes to parallel H5-files make all MPI nodes wait for the
+ *	slowest one each time. Instead, gWriteH5Staged() and pWriteH5Staged() copy
+ *	a snapshot into memory owned by the stage, and the simulation then goes on
+ *	changing the original. The staged datasets are written all at once by
+ *	stFlush(), which is done whenever more than files:stagingBudget MiB was
+ *	staged on any MPI node (back-pressure), and by stFree():
+ *	\code
+ Stage *stage = stAlloc(ini);
+
+ for(int n = 1; n <= nTimeSteps; n++){
+	 ...
+	 gWriteH5Staged(stage, phi, mpiInfo, (double)n);
+ }
+
+ stFree(stage);	// Before closing the files
+ gCloseH5(phi);
+ *	\endcode
+ *
+ *	The budget is checked when a dataset is staged, against the amount staged
+ *	by all nodes when the previous dataset was staged, such that no extra
+ *	synchronization is needed. It may therefore be exceeded by one dataset. All
+ *	nodes must stage the same datasets in the same order, as for the collective
+ *	writes. With no budget, datasets are written at once.
+ */
+typedef struct{
+	long int budget;			///< Bytes that may be staged before flushing
+	long int nBytes;			///< Bytes staged on this MPI node
+	long int nBytesMax;			///< Max nBytes of all nodes at the last staging
+	long int nBytesSent;		///< nBytes being reduced into nBytesMax
+	MPI_Request request;		///< Request of pending reduction
+	int n;						///< Number of staged datasets
+	int nAlloc;					///< Number of staged datasets allocated for
+	struct StagedDataset *datasets;	///< Staged datasets (n of them)
+	MPI_Comm comm;				///< Private communicator
+} Stage;
+
+/**
+ * @brief Rows of (x,y) datasets buffered in memory to be written in batches
+ *
+ *	xyWrite() reduces, extends and writes one row at a time, which is a lot of
+ *	small collective operations when done for many datasets every time-step.
+ *	xyBufWrite() instead appends the row to the buffer, and all buffered rows
+ *	are reduced by one reduction per MPI_Op and written with one extension and
+ *	one write per dataset by xyBufFlush(). This is done whenever some dataset
+ *	has files:historyInterval rows buffered, and by xyBufFree():
+ *	\code
+ hid_t hist = xyOpenH5(ini,"history");
+ xyCreateDataset(hist,"/energy/potential");
+ XyBuffer *buf = xyBufAlloc(ini,hist);
+
+ for(int n = 1; n <= nTimeSteps; n++){
+	 ...
+	 xyBufWrite(buf,"/energy/potential",(double)n,energy,MPI_SUM);
+ }
+
+ xyBufFree(buf);	// Before closing the file
+ xyCloseH5(hist);
+ *	\endcode
+ *
+ *	All MPI nodes must write the same rows in the same order, as for xyWrite().
+ */
+typedef struct{
+	hid_t h5;					///< File the datasets are in
+	long int interval;			///< Rows buffered per dataset before flushing
+	int nSeries;				///< Number of datasets written to so far
+	int nSeriesAlloc;			///< Number of datasets allocated for
+	struct XySeries *series;	///< Datasets written to (nSeries of them)
+	long int nRows;				///< Number of buffered rows
+	long int nRowsAlloc;		///< Number of rows allocated for
+	int *rowSeries;				///< Dataset of each row
+	double *x;					///< x of each row
+	double *y;					///< y of each row (reduced on rank 0 on flush)
+	MPI_Op *op;					///< Reduction of y of each row
+	MPI_Comm comm;				///< Private communicator
+} XyBuffer;
+
 //
-// unsigned long long int getNanoSec();
 // void tMsg(int rank, Timer *timer, format....);
 // void tStart(...);
 // void tStop(...);
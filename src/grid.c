@@ -9,12 +9,16 @@
  */
 
 #include "core.h"
+#include "multigrid.h"
 #include <mpi.h>
 #include <math.h>
 #include <hdf5.h>
 #include <gsl/gsl_rng.h>
 #include <gsl/gsl_randist.h>
 
+/// Cache size assumed when choosing tile sizes automatically (see gSetTileSize())
+#define TILE_CACHE_BYTES (256*1024)
+
 
 
 /******************************************************************************
@@ -23,9 +27,42 @@
 /**
  * @brief Returns the ND-index of this MPI node in the global reference frame
  * @param	ini		input settings
+ * @param	mpiRank	Rank in MpiInfo.comm
  * @return	The N-dimensional index of this MPI node
  */
-static int *getSubdomain(const dictionary *ini);
+static int *getSubdomain(const dictionary *ini, int mpiRank);
+
+/**
+ * @brief Creates the Cartesian communicator of the subdomains
+ * @param	ini		input settings
+ * @return	Communicator
+ *
+ * See MpiInfo.comm and grid:nodeBlock.
+ */
+static MPI_Comm createSubdomainComm(const dictionary *ini);
+
+/**
+ * @brief Returns the rank which places a node's processes in one block of subdomains
+ * @param	nDims			Number of dimensions
+ * @param	nSubdomains		Number of subdomains (nDims elements)
+ * @param	nodeBlock		Number of subdomains per node (nDims elements)
+ * @return	Rank in the communicator of the subdomains
+ *
+ * Nodes are numbered by the lowest rank (in simComm()) on them, and each is
+ * given one block of subdomains in lexicographic order. Its processes are
+ * given the subdomains of the block in the order of their rank.
+ */
+static int nodeBlockRank(int nDims, const int *nSubdomains, const int *nodeBlock);
+
+/**
+ * @brief Selects the part of the .h5-file belonging to this subdomain
+ * @param[in,out]	grid		Grid with an open .h5-file
+ * @param			mpiInfo		MpiInfo
+ *
+ * Sets h5MemSpace and h5FileSpace from the sizes of grid and the cuts in
+ * mpiInfo.
+ */
+static void setH5Spaces(Grid *grid, const MpiInfo *mpiInfo, int nLevels);
 
 /**
  * @brief Gets, sends, recieves and sets a slice, using MPI
@@ -49,6 +86,49 @@ static int *getSubdomain(const dictionary *ini);
  * @see gHaloOpDim
  */
 
+/**
+ * @brief Posts the non-blocking halo exchange along one dimension
+ * @param	grid		Grid
+ * @param	val			Values to exchange, shaped as grid->val
+ * @param	valSize		Size of each value in val (in bytes)
+ * @param	mpiInfo		MpiInfo
+ * @param	d			Dimension
+ * @param	dir			Direction of operation
+ * @param	upType		Datatype of the slices going up (to the upper neighbor)
+ * @param	downType	Datatype of the slices going down
+ * @param	buffered	Whether to recieve into recvSlice rather than val
+ * @param	req			Returns 4 requests to wait for
+ *
+ * Slices are sent directly from val using the derived datatypes. Unless
+ * buffered, they are also recieved directly into val, which amounts to
+ * setSlice(). Buffered slices for the lower and upper neighbor is stored
+ * consecutively in recvSlice, and must be put in place after completion.
+ * The types differ only for colorTypes (see gHaloOpColorBegin()). val is
+ * grid->val except for the single precision copies of gHaloOpSingle().
+ */
+static void haloPost(Grid *grid, void *val, size_t valSize,
+					 const MpiInfo *mpiInfo, int d, opDirection dir,
+					 MPI_Datatype upType, MPI_Datatype downType,
+					 int buffered, MPI_Request *req);
+
+/**
+ * @brief Kernels of the finite differences working on a box of nodes
+ * @param	lower	Lower corner of box (inclusive, rank elements)
+ * @param	upper	Upper corner of box (exclusive, rank elements)
+ *
+ * Used by gFinDiff1st(), gFinDiff2ndND() and gFinDiff2nd3D() to differentiate
+ * the interior and shell (see Grid.haloBoxes) separately. The box is traversed
+ * one tile at a time (see Grid.tileSize). finDiff2nd3DBox() adds addition to
+ * the result unless it is NULL.
+ */
+static void finDiff1stBox(const Grid *scalar, Grid *field, double factor,
+						  const int *lower, const int *upper);
+static void finDiff2ndNDBox(Grid *result, const Grid *object,
+							const int *lower, const int *upper);
+static void finDiff2nd3DBox(Grid *result, const Grid *object,
+							const Grid *addition,
+							const int *lower, const int *upper);
+
 static double gPotEnergyInner(	const double **rhoVal, const double **phiVal,
 								const int *nGhostLayersBefore, const int *nGhostLayersAfter,
 								const int *trueSize, const long int *sizeProd);
@@ -69,6 +149,212 @@ static void gExpandInner(	const double **in, double **out,
  * LOCAL FUNCTION DEFINITIONS
  *****************************************************************************/
 
+static void haloPost(Grid *grid, void *val, size_t valSize,
+					 const MpiInfo *mpiInfo, int d, opDirection dir,
+					 MPI_Datatype upType, MPI_Datatype downType,
+					 int buffered, MPI_Request *req){
+
+	//Load MpiInfo
+	int mpiRank = mpiInfo->mpiRank;
+	int *subdomain = mpiInfo->subdomain;
+	int *nSubdomains = mpiInfo->nSubdomains;
+	int *nSubdomainsProd = mpiInfo->nSubdomainsProd;
+	MPI_Comm comm = mpiInfo->haloComm;
+
+	//Load
+	int rank = grid->rank;
+	int *size = grid->size;
+	long int *sizeProd = grid->sizeProd;
+	double *recvSlice = grid->recvSlice;
+
+	// Displacements are in bytes, since val may be of any type
+	char *bytes = val;
+	long int stride = sizeProd[d]*valSize;
+
+	// dir=TOHALO=0: take 2nd outermost layer and place it outermost
+	// dir=FROMHALO=1: take outermost layer and place it 2nd outermost
+	int offsetUpperTake  = size[d]-2+dir;
+	int offsetUpperPlace = size[d]-1-dir;
+	int offsetLowerTake  =         1-dir;
+	int offsetLowerPlace =           dir;
+
+	//Dimension used for subdomains, 1 less entry than grid dimensions
+	int dd = d - 1;
+	int nSlicePoints = sizeProd[rank]/size[d];
+
+	int firstElem = mpiRank - subdomain[dd]*nSubdomainsProd[dd];
+
+	int upperSubdomain = firstElem
+		+ ((subdomain[dd] + 1)%nSubdomains[dd])*nSubdomainsProd[dd];
+	int lowerSubdomain = firstElem
+		+ ((subdomain[dd] - 1 + nSubdomains[dd])%nSubdomains[dd])*nSubdomainsProd[dd];
+
+	// Slices going up and down along each dimension have their own tag
+	int tagUp = 2*d+1;
+	int tagDown = 2*d;
+
+	if(buffered){
+		MPI_Irecv(recvSlice, nSlicePoints, MPI_DOUBLE,
+				  lowerSubdomain, tagUp, comm, &req[0]);
+		MPI_Irecv(recvSlice+nSlicePoints, nSlicePoints, MPI_DOUBLE,
+				  upperSubdomain, tagDown, comm, &req[1]);
+	} else {
+		MPI_Irecv(bytes+offsetLowerPlace*stride, 1, upType,
+				  lowerSubdomain, tagUp, comm, &req[0]);
+		MPI_Irecv(bytes+offsetUpperPlace*stride, 1, downType,
+				  upperSubdomain, tagDown, comm, &req[1]);
+	}
+
+	MPI_Isend(bytes+offsetUpperTake*stride, 1, upType,
+			  upperSubdomain, tagUp, comm, &req[2]);
+	MPI_Isend(bytes+offsetLowerTake*stride, 1, downType,
+			  lowerSubdomain, tagDown, comm, &req[3]);
+
+}
+
+static void finDiff1stBox(const Grid *scalar, Grid *field, double factor,
+						  const int *lower, const int *upper){
+
+	int rank = scalar->rank;
+	long int *sizeProd = scalar->sizeProd;
+	long int fNext = field->sizeProd[1];
+
+	const double *restrict scalarVal = scalar->val;
+	double *restrict fieldVal = field->val;
+
+	double coeff = 0.5*factor;
+
+	long int nTiles = gBoxTiles(scalar, lower, upper);
+
+	// The threads share the rows of one tile at a time
+	#pragma omp parallel if(gBoxRows(scalar, lower, upper)*(upper[1]-lower[1]) >= OMP_MIN_NODES)
+	{
+		int *tile = malloc(2*rank*sizeof(*tile));
+		int *tLower = &tile[0];
+		int *tUpper = &tile[rank];
+
+		for(long int t = 0; t < nTiles; t++){
+
+			gBoxTile(scalar, lower, upper, t, tLower, tUpper);
+
+			long int nRows = gBoxRows(scalar, tLower, tUpper);
+			int nRow = tUpper[1]-tLower[1];
+
+			#pragma omp for schedule(static)
+			for(long int r = 0; r < nRows; r++){
+				long int start = gBoxRowStart(scalar, tLower, tUpper, r);
+				for(int d = 1; d < rank; d++){
+					const double *sNext = &scalarVal[start + sizeProd[d]];
+					const double *sPrev = &scalarVal[start - sizeProd[d]];
+					double *f = &fieldVal[start*fNext + (d-1)];
+					for(int j = 0; j < nRow; j++){
+						f[j*fNext] = coeff*(sNext[j] - sPrev[j]);
+					}
+				}
+			}
+		}
+
+		free(tile);
+	}
+}
+
+static void finDiff2ndNDBox(Grid *result, const Grid *object,
+							const int *lower, const int *upper){
+
+	int rank = object->rank;
+	long int *sizeProd = object->sizeProd;
+
+	double *restrict resultVal = result->val;
+	const double *restrict objectVal = object->val;
+
+	double coeff = 2.*(rank-1);
+
+	long int nTiles = gBoxTiles(object, lower, upper);
+
+	#pragma omp parallel if(gBoxRows(object, lower, upper)*(upper[1]-lower[1]) >= OMP_MIN_NODES)
+	{
+		int *tile = malloc(2*rank*sizeof(*tile));
+		int *tLower = &tile[0];
+		int *tUpper = &tile[rank];
+
+		for(long int t = 0; t < nTiles; t++){
+
+			gBoxTile(object, lower, upper, t, tLower, tUpper);
+
+			long int nRows = gBoxRows(object, tLower, tUpper);
+			int nRow = tUpper[1]-tLower[1];
+
+			#pragma omp for schedule(static)
+			for(long int r = 0; r < nRows; r++){
+				long int g = gBoxRowStart(object, tLower, tUpper, r);
+				for(int j = 0; j < nRow; j++){
+					resultVal[g] = -coeff*objectVal[g];
+					for(int d = 1; d < rank; d++){
+						long int gStep = sizeProd[d];
+						resultVal[g] += objectVal[g + gStep] + objectVal[g - gStep];
+					}
+					g++;
+				}
+			}
+		}
+
+		free(tile);
+	}
+}
+
+static void finDiff2nd3DBox(Grid *result, const Grid *object,
+							const Grid *addition,
+							const int *lower, const int *upper){
+
+	long int *sizeProd = object->sizeProd;
+	long int gj = sizeProd[1];
+	long int gk = sizeProd[2];
+	long int gl = sizeProd[3];
+
+	double *restrict resultVal = result->val;
+	const double *restrict objectVal = object->val;
+	const double *restrict addVal = addition ? addition->val : NULL;
+
+	// Within a tile the l-direction is streamed through, such that only a
+	// few planes of the tile needs to stay in cache. The threads share the
+	// rows of one tile at a time.
+	long int nTiles = gBoxTiles(object, lower, upper);
+
+	#pragma omp parallel if(gBoxRows(object, lower, upper)*(upper[1]-lower[1]) >= OMP_MIN_NODES)
+	{
+		int tLower[4], tUpper[4];
+
+		for(long int t = 0; t < nTiles; t++){
+
+			gBoxTile(object, lower, upper, t, tLower, tUpper);
+
+			#pragma omp for collapse(2) schedule(static)
+			for(int l = tLower[3]; l < tUpper[3]; l++){
+				for(int k = tLower[2]; k < tUpper[2]; k++){
+					long int gStart = tLower[1]*gj + k*gk + l*gl;
+					long int gStop = tUpper[1]*gj + k*gk + l*gl;
+					if(addVal){
+						for(long int g = gStart; g < gStop; g++){
+							resultVal[g] = (-6.*objectVal[g]
+											+ (objectVal[g+gj] + objectVal[g-gj]
+											+ objectVal[g+gk] + objectVal[g-gk]
+											+ objectVal[g+gl] + objectVal[g-gl]))
+											+ addVal[g];
+						}
+					} else {
+						for(long int g = gStart; g < gStop; g++){
+							resultVal[g] = -6.*objectVal[g]
+											+ (objectVal[g+gj] + objectVal[g-gj]
+											+ objectVal[g+gk] + objectVal[g-gk]
+											+ objectVal[g+gl] + objectVal[g-gl]);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
 static double *getSliceInner(double *nextGhost, const double **valp, const long int *mul,
 											const int *points, const long int finalMul){
 
@@ -146,33 +432,120 @@ void addSlice(const double *slice, Grid *grid, int d, int offset){
 	addSliceInner(slice, &val, &sizeProd[rank-1], &size[rank-1], sizeProd[d]);
 }
 
-static int *getSubdomain(const dictionary *ini){
+static int *getSubdomain(const dictionary *ini, int mpiRank){
+
+	// Get ini info
+	int nDims = iniGetInt(ini,"grid:nDims");
+	int *nSubdomains = iniGetIntArr(ini,"grid:nSubdomains",nDims);
+
+	// Determine subdomain of this MPI node
+	int *subdomain = malloc(nDims*sizeof(*subdomain));
+	for(int d=0;d<nDims;d++){
+		subdomain[d] = mpiRank % nSubdomains[d];
+		mpiRank /= nSubdomains[d];
+	}
+
+	free(nSubdomains);
+	return subdomain;
+
+}
+
+static MPI_Comm createSubdomainComm(const dictionary *ini){
 
 	// Get MPI info
-	int mpiSize, mpiRank;
-	MPI_Comm_size(MPI_COMM_WORLD,&mpiSize);
-	MPI_Comm_rank(MPI_COMM_WORLD,&mpiRank);
+	int mpiSize;
+	MPI_Comm_size(simComm(),&mpiSize);
 
 	// Get ini info
 	int nDims = iniGetInt(ini,"grid:nDims");
 	int *nSubdomains = iniGetIntArr(ini,"grid:nSubdomains",nDims);
-
+	int *nodeBlock = iniGetIntArr(ini,"grid:nodeBlock",nDims);
 
 	// Sanity check
 	int totalNSubdomains = aiProd(nSubdomains,nDims);
 	if(totalNSubdomains!=mpiSize)
 		msg(ERROR,"The product of grid:nSubdomains does not match the number of MPI processes");
 
-	// Determine subdomain of this MPI node
-	int *subdomain = malloc(nDims*sizeof(*subdomain));
+	// MPI orders ranks with the last dimension varying fastest, PINC with the
+	// first. Reversing the dimensions makes the rank in the communicator equal
+	// the lexicographic index of the subdomain used throughout PINC.
+	int *dims = malloc(nDims*sizeof(*dims));
+	int *periods = malloc(nDims*sizeof(*periods));
 	for(int d=0;d<nDims;d++){
-		subdomain[d] = mpiRank % nSubdomains[d];
-		mpiRank /= nSubdomains[d];
+		dims[d] = nSubdomains[nDims-1-d];
+		periods[d] = 1;
 	}
 
+	MPI_Comm comm;
+	if(nodeBlock[0]<=0){
+
+		// Let MPI reorder ranks to match the hardware topology
+		MPI_Cart_create(simComm(),nDims,dims,periods,1,&comm);
+
+	} else {
+
+		int rank = nodeBlockRank(nDims,nSubdomains,nodeBlock);
+
+		MPI_Comm ordered;
+		MPI_Comm_split(simComm(),0,rank,&ordered);
+		MPI_Cart_create(ordered,nDims,dims,periods,0,&comm);
+		MPI_Comm_free(&ordered);
+	}
+
+	free(dims);
+	free(periods);
 	free(nSubdomains);
-	return subdomain;
+	free(nodeBlock);
 
+	return comm;
+}
+
+static int nodeBlockRank(int nDims, const int *nSubdomains, const int *nodeBlock){
+
+	int worldRank;
+	MPI_Comm_rank(simComm(),&worldRank);
+
+	// Processes sharing memory are on the same node
+	MPI_Comm node;
+	MPI_Comm_split_type(simComm(),MPI_COMM_TYPE_SHARED,0,MPI_INFO_NULL,&node);
+	int nodeRank, nodeSize;
+	MPI_Comm_rank(node,&nodeRank);
+	MPI_Comm_size(node,&nodeSize);
+
+	if(nodeSize!=aiProd(nodeBlock,nDims))
+		msg(ERROR|ALL,"%i processes on this node but the product of grid:nodeBlock is %i",
+			nodeSize,aiProd(nodeBlock,nDims));
+
+	for(int d=0;d<nDims;d++){
+		if(nSubdomains[d]%nodeBlock[d])
+			msg(ERROR,"grid:nSubdomains must be a multiple of grid:nodeBlock");
+	}
+
+	// Number the nodes by their lowest rank
+	MPI_Comm leaders;
+	MPI_Comm_split(simComm(),nodeRank==0 ? 0 : MPI_UNDEFINED,worldRank,&leaders);
+	int nodeIndex = 0;
+	if(nodeRank==0){
+		MPI_Comm_rank(leaders,&nodeIndex);
+		MPI_Comm_free(&leaders);
+	}
+	MPI_Bcast(&nodeIndex,1,MPI_INT,0,node);
+	MPI_Comm_free(&node);
+
+	// Subdomain from the block of the node and the position within the block
+	int rank = 0;
+	int mul = 1;
+	for(int d=0;d<nDims;d++){
+		int nBlocks = nSubdomains[d]/nodeBlock[d];
+		int subdomain = (nodeIndex%nBlocks)*nodeBlock[d] + nodeRank%nodeBlock[d];
+		nodeIndex /= nBlocks;
+		nodeRank /= nodeBlock[d];
+
+		rank += subdomain*mul;
+		mul *= nSubdomains[d];
+	}
+
+	return rank;
 }
 
 static void gContractInner(	const double **in, double **out,
@@ -223,184 +596,710 @@ static void gExpandInner(	const double **in, double **out,
  *	FINITE DIFFERENCE
  *****************************************************************************/
 
- void gFinDiff1st(const Grid *scalar, Grid *field){
+ void gFinDiff1st(Grid *scalar, Grid *field){
 
-	// Performs first order centered finite difference on scalar and returns a field
+	gFinDiff1stScaled(scalar, field, 1.);
+}
 
+void gFinDiff1stScaled(Grid *scalar, Grid *field, double factor){
+
+	// Performs first order centered finite difference on scalar and returns a field
+	// Interior nodes first, such that a pending halo exchange can complete
 	int rank = scalar->rank;
-	// int *size = scalar->size;
-	long int *sizeProd = scalar->sizeProd;
-	long int *fieldSizeProd = field->sizeProd;
+	int *box = scalar->haloBoxes;
+
+	finDiff1stBox(scalar, field, factor, &box[0], &box[rank]);
+	gHaloOpEnd(scalar);
+	for(int b = 1; b < 2*rank-1; b++)
+		finDiff1stBox(scalar, field, factor, &box[2*rank*b], &box[2*rank*b+rank]);
+}
+
+
+void gFinDiff2ndND(Grid *result, Grid *object){
+
+	int rank = object->rank;
+	int *box = object->haloBoxes;
+
+	finDiff2ndNDBox(result, object, &box[0], &box[rank]);
+	gHaloOpEnd(object);
+	for(int b = 1; b < 2*rank-1; b++)
+		finDiff2ndNDBox(result, object, &box[2*rank*b], &box[2*rank*b+rank]);
+
+	return;
+}
+
+void gFinDiff2nd3D(Grid *result, Grid *object){
+
+	gFinDiff2nd3DAdd(result, object, NULL);
+
+	return;
+}
+
+void gFinDiff2nd3DAdd(Grid *result, Grid *object, const Grid *addition){
+
+	int rank = object->rank;
+	int *box = object->haloBoxes;
+
+	finDiff2nd3DBox(result, object, addition, &box[0], &box[rank]);
+	gHaloOpEnd(object);
+	for(int b = 1; b < 2*rank-1; b++)
+		finDiff2nd3DBox(result, object, addition, &box[2*rank*b], &box[2*rank*b+rank]);
+
+	return;
+}
+
+/******************************************************************************
+ *	HALO FUNCTIONS
+ *****************************************************************************/
+
+/**
+ * @brief Returns the time to pass to haloToc() if the grid's halo is timed
+ */
+static unsigned long long int haloTic(const Grid *grid){
+	return grid->haloTime ? getNanoSec() : 0;
+}
+
+/**
+ * @brief Adds the time since haloTic() to Grid.haloTime, if set
+ */
+static void haloToc(const Grid *grid, unsigned long long int tic){
+	if(grid->haloTime) *grid->haloTime += getNanoSec()-tic;
+}
+
+void gHaloOp(funPtr sliceOp, Grid *grid, const MpiInfo *mpiInfo, opDirection dir){
+
+	// One dimension at a time, such that the slices sent in later dimensions
+	// includes the ghost layers recieved in earlier ones (i.e. the corners).
+	int rank = grid->rank;
+	for(int d = 1; d < rank; d++){
+		gHaloOpDim(sliceOp, grid, mpiInfo, d, dir);
+	}
+
+}
+
+void gHaloOpDim(funPtr sliceOp, Grid *grid, const MpiInfo *mpiInfo, int d, opDirection dir){
+
+	tRegionBegin("halo");
+	unsigned long long int tic = haloTic(grid);
+	MPI_Request *req = grid->haloRequests;
+	int buffered = (sliceOp != (funPtr)setSlice);
+
+	MPI_Datatype type = grid->sliceTypes[d];
+	haloPost(grid, grid->val, sizeof(double), mpiInfo, d, dir,
+			 type, type, buffered, req);
+	MPI_Waitall(4, req, MPI_STATUSES_IGNORE);
+
+	if(buffered){
+		int *size = grid->size;
+		long int nSlicePoints = grid->sizeProd[grid->rank]/size[d];
+		sliceOp(grid->recvSlice, grid, d, dir);						// Lower
+		sliceOp(grid->recvSlice+nSlicePoints, grid, d, size[d]-1-dir);	// Upper
+	}
+
+	haloToc(grid, tic);
+	tRegionEnd("halo");
+}
+
+void gHaloOpFaces(Grid *grid, const MpiInfo *mpiInfo, opDirection dir){
 
-	double *scalarVal = scalar->val;
-	double *fieldVal = field->val;
+	gHaloOpBegin(grid, mpiInfo, dir);
+	gHaloOpEnd(grid);
 
- 	// Scalar indices
-	long int sNext, sPrev;
-	long int f;
-	int fNext = fieldSizeProd[1];
+}
 
-	long int start = alSum(&sizeProd[1], rank-1 );
-	long int end = sizeProd[rank]-start;
+void gHaloOpBegin(Grid *grid, const MpiInfo *mpiInfo, opDirection dir){
 
+	unsigned long long int tic = haloTic(grid);
+	int rank = grid->rank;
+	MPI_Request *req = grid->haloRequests;
 
-	// Centered Finite difference
+	// The face slices of different dimensions never overlap, so all of them
+	// can be in flight at once.
 	for(int d = 1; d < rank; d++){
-		sNext = start + sizeProd[d];
-		sPrev = start - sizeProd[d];
-		f = start*fieldSizeProd[1] + (d-1);
+		MPI_Datatype type = grid->faceTypes[d];
+		haloPost(grid, grid->val, sizeof(double), mpiInfo, d, dir,
+				 type, type, 0, &req[4*(d-1)]);
+	}
+
+	haloToc(grid, tic);
+}
+
+void gHaloOpColorBegin(Grid *grid, const MpiInfo *mpiInfo, int color){
 
+	MPI_Datatype *colorTypes = grid->colorTypes;
+	if(!colorTypes){
+		gHaloOpBegin(grid, mpiInfo, TOHALO);
+		return;
+	}
+
+	unsigned long long int tic = haloTic(grid);
+	int rank = grid->rank;
+	int *size = grid->size;
+	MPI_Request *req = grid->haloRequests;
 
-		for(int g = start; g < end; g++){
-			fieldVal[f] = 0.5*(scalarVal[sNext] - scalarVal[sPrev]);
-			sNext++;
-			sPrev++;
-			f += fNext;
+	// A node's color is the parity of the sum of all its indices, so the
+	// pattern of the other indices depends on the index of the layer. The
+	// slice going down is taken from layer 1, and the one going up from layer
+	// size[d]-2, which has the same parity for all subdomains (or else the
+	// types aren't created).
+	for(int d = 1; d < rank; d++){
+		MPI_Datatype upType = colorTypes[2*d+(color+size[d])%2];
+		MPI_Datatype downType = colorTypes[2*d+(color+1)%2];
+		haloPost(grid, grid->val, sizeof(double), mpiInfo, d, TOHALO,
+				 upType, downType, 0, &req[4*(d-1)]);
+	}
+
+	haloToc(grid, tic);
+}
+
+void gHaloOpEnd(Grid *grid){
+
+	// Completed requests are MPI_REQUEST_NULL, so this is a no-op if there's
+	// no exchange in progress.
+	unsigned long long int tic = haloTic(grid);
+	MPI_Waitall(4*(grid->rank-1), grid->haloRequests, MPI_STATUSES_IGNORE);
+	haloToc(grid, tic);
+
+}
+
+void gHaloOpSingle(float *val, Grid *grid, const MpiInfo *mpiInfo){
+
+	// As gHaloOp(), one dimension at a time to include the corners
+	int rank = grid->rank;
+	for(int d = 1; d < rank; d++){
+		gHaloOpDimSingle(val, grid, mpiInfo, d);
+	}
+
+}
+
+void gHaloOpDimSingle(float *val, Grid *grid, const MpiInfo *mpiInfo, int d){
+
+	unsigned long long int tic = haloTic(grid);
+	MPI_Request *req = grid->haloRequests;
+	MPI_Datatype type = grid->singleTypes[d];
+	haloPost(grid, val, sizeof(float), mpiInfo, d, TOHALO, type, type, 0, req);
+	MPI_Waitall(4, req, MPI_STATUSES_IGNORE);
+	haloToc(grid, tic);
+
+}
+
+long int gBoxRows(const Grid *grid, const int *lower, const int *upper){
+
+	long int nRows = 1;
+	for(int d = 1; d < grid->rank; d++){
+		if(upper[d] <= lower[d]) return 0;
+		if(d > 1) nRows *= upper[d]-lower[d];
+	}
+	return nRows;
+
+}
+
+long int gBoxRowStart(const Grid *grid, const int *lower, const int *upper, long int r){
+
+	long int *sizeProd = grid->sizeProd;
+
+	long int g = lower[1]*sizeProd[1];
+	for(int d = 2; d < grid->rank; d++){
+		int n = upper[d]-lower[d];
+		g += (lower[d] + r%n)*sizeProd[d];
+		r /= n;
+	}
+	return g;
+
+}
+
+long int gBoxTiles(const Grid *grid, const int *lower, const int *upper){
+
+	int *tileSize = grid->tileSize;
+
+	long int nTiles = 1;
+	for(int d = 1; d < grid->rank; d++){
+		int n = upper[d]-lower[d];
+		if(n <= 0) return 0;
+		nTiles *= (n+tileSize[d]-1)/tileSize[d];
+	}
+	return nTiles;
+
+}
+
+void gBoxTile(const Grid *grid, const int *lower, const int *upper, long int t,
+			  int *tileLower, int *tileUpper){
+
+	int *tileSize = grid->tileSize;
+
+	tileLower[0] = lower[0];
+	tileUpper[0] = upper[0];
+	for(int d = 1; d < grid->rank; d++){
+		int nTiles = (upper[d]-lower[d]+tileSize[d]-1)/tileSize[d];
+		tileLower[d] = lower[d] + (t%nTiles)*tileSize[d];
+		tileUpper[d] = tileLower[d] + tileSize[d];
+		if(tileUpper[d] > upper[d]) tileUpper[d] = upper[d];
+		t /= nTiles;
+	}
+
+}
+
+void gSetTileSize(Grid *grid, const int *tileSize){
+
+	int rank = grid->rank;
+	int *trueSize = grid->trueSize;
+	int *size = grid->size;
+
+	if(grid->tileSize == NULL) grid->tileSize = malloc(rank*sizeof(*grid->tileSize));
+	int *gridTileSize = grid->tileSize;
+	gridTileSize[0] = size[0];
+
+	// The unit-stride dimension is kept whole to keep long, vectorizable
+	// rows, and the outermost dimension is streamed through. Dimensions in
+	// between are tiled such that the planes of a tile touched during the
+	// sweep (three of the object and one of the result) fit in cache.
+	for(int d = 1; d < rank; d++){
+		int s = tileSize ? tileSize[d-1] : 0;
+		if(s <= 0){
+			if(d == 1 || d == rank-1){
+				s = trueSize[d];
+			} else {
+				long int planeBytes = 4*size[0]*sizeof(double);
+				for(int dd = 1; dd < d; dd++) planeBytes *= gridTileSize[dd]+2;
+				s = TILE_CACHE_BYTES/planeBytes - 2;
+			}
 		}
+		if(s < 1) s = 1;
+		if(s > trueSize[d]) s = trueSize[d];
+		gridTileSize[d] = s;
 	}
+
 }
 
+void gCreateHalo(Grid *grid){
 
-void gFinDiff2ndND(Grid *result, const Grid *object){
+	int rank = grid->rank;
+	int *size = grid->size;
+	int *nGhostLayers = grid->nGhostLayers;
 
-	// Load
-	int rank = object->rank;
-	long int *sizeProd = object->sizeProd;
+	int *subSize = malloc(rank*sizeof(*subSize));
+	int *start = malloc(rank*sizeof(*start));
 
-	double *resultVal = result->val;
-	double *objectVal = object->val;
+	MPI_Datatype *sliceTypes = malloc(rank*sizeof(*sliceTypes));
+	MPI_Datatype *faceTypes = malloc(rank*sizeof(*faceTypes));
+	MPI_Request *haloRequests = malloc(4*rank*sizeof(*haloRequests));
+	for(int r = 0; r < 4*rank; r++) haloRequests[r] = MPI_REQUEST_NULL;
+
+	// No slices along the first (non-physical) dimension
+	sliceTypes[0] = MPI_DATATYPE_NULL;
+	faceTypes[0] = MPI_DATATYPE_NULL;
+
+	// The first index is the fastest varying one, as in Fortran. Each type
+	// describes the slice at offset 0, other slices are reached by displacing
+	// the buffer by offset*sizeProd[d].
+	for(int d = 1; d < rank; d++){
+
+		for(int dd = 0; dd < rank; dd++){
+			subSize[dd] = size[dd];
+			start[dd] = 0;
+		}
+		subSize[d] = 1;
+
+		MPI_Type_create_subarray(rank, size, subSize, start, MPI_ORDER_FORTRAN,
+								 MPI_DOUBLE, &sliceTypes[d]);
+		MPI_Type_commit(&sliceTypes[d]);
+
+		for(int dd = 1; dd < rank; dd++){
+			if(dd == d) continue;
+			subSize[dd] = size[dd]-nGhostLayers[dd]-nGhostLayers[dd+rank];
+			start[dd] = nGhostLayers[dd];
+		}
+
+		MPI_Type_create_subarray(rank, size, subSize, start, MPI_ORDER_FORTRAN,
+								 MPI_DOUBLE, &faceTypes[d]);
+		MPI_Type_commit(&faceTypes[d]);
+	}
+
+	free(subSize);
+	free(start);
+
+	// The interior is the nodes which doesn't depend on the ghost layers,
+	// and the shell is the rest of the true nodes. Along dimension d the
+	// shell is two slabs, one at each side, which excludes the shell along
+	// lower dimensions to avoid overlap.
+	int nBoxes = 2*rank-1;
+	int *haloBoxes = malloc(2*rank*nBoxes*sizeof(*haloBoxes));
+	for(int b = 0; b < nBoxes; b++){
+
+		int *lower = &haloBoxes[2*rank*b];
+		int *upper = &haloBoxes[2*rank*b+rank];
+		int dBox = (b+1)/2;		// Dimension of slab (0 for interior)
+
+		lower[0] = 0;
+		upper[0] = size[0];
+		for(int d = 1; d < rank; d++){
+			int first = nGhostLayers[d];
+			int last = size[d]-nGhostLayers[d+rank]-1;
+			if(d == dBox){
+				lower[d] = (b%2) ? first : last;
+				upper[d] = lower[d]+1;
+				if(!(b%2) && first == last) upper[d] = lower[d];
+			} else if(d < dBox || dBox == 0){
+				lower[d] = first+1;
+				upper[d] = last;
+			} else {
+				lower[d] = first;
+				upper[d] = last+1;
+			}
+			if(upper[d] < lower[d]) upper[d] = lower[d];
+		}
+	}
+
+	grid->haloBoxes = haloBoxes;
+	grid->sliceTypes = sliceTypes;
+	grid->faceTypes = faceTypes;
+	grid->haloRequests = haloRequests;
+
+}
+
+void gDestroyHalo(Grid *grid){
+
+	for(int d = 1; d < grid->rank; d++){
+		MPI_Type_free(&grid->sliceTypes[d]);
+		MPI_Type_free(&grid->faceTypes[d]);
+	}
+	free(grid->sliceTypes);
+	free(grid->faceTypes);
+	free(grid->haloRequests);
+	free(grid->haloBoxes);
+
+}
+
+void gCreateColorHalo(Grid *grid){
+
+	int rank = grid->rank;
+	int *size = grid->size;
+	int *trueSize = grid->trueSize;
+	int *nGhostLayers = grid->nGhostLayers;
+	long int *sizeProd = grid->sizeProd;
+
+	MPI_Datatype *colorTypes = malloc(2*rank*sizeof(*colorTypes));
+	colorTypes[0] = MPI_DATATYPE_NULL;
+	colorTypes[1] = MPI_DATATYPE_NULL;
+
+	// Same nodes as faceTypes[d], split by the parity of the sum of the
+	// indices other than d. Each node is a block of size[0] values.
+	long int nFaceNodes = sizeProd[rank]/size[0];
+	int *displ = malloc(nFaceNodes*sizeof(*displ));
+	int *index = malloc(rank*sizeof(*index));
+
+	for(int d = 1; d < rank; d++){
+
+		long int nNodes = 1;
+		for(int dd = 1; dd < rank; dd++) if(dd != d) nNodes *= trueSize[dd];
+
+		for(int parity = 0; parity < 2; parity++){
+
+			int nDispl = 0;
+			for(long int n = 0; n < nNodes; n++){
+
+				long int rest = n;
+				int sum = 0;
+				long int g = 0;
+				for(int dd = 1; dd < rank; dd++){
+					if(dd == d) continue;
+					index[dd] = nGhostLayers[dd] + rest%trueSize[dd];
+					rest /= trueSize[dd];
+					sum += index[dd];
+					g += index[dd]*sizeProd[dd];
+				}
+				if(sum%2 == parity) displ[nDispl++] = (int)g;
+			}
+
+			MPI_Type_create_indexed_block(nDispl, size[0], displ, MPI_DOUBLE,
+										  &colorTypes[2*d+parity]);
+			MPI_Type_commit(&colorTypes[2*d+parity]);
+		}
+	}
+
+	free(displ);
+	free(index);
+
+	grid->colorTypes = colorTypes;
+
+}
+
+void gDestroyColorHalo(Grid *grid){
+
+	if(grid->colorTypes == NULL) return;
+
+	for(int t = 2; t < 2*grid->rank; t++) MPI_Type_free(&grid->colorTypes[t]);
+	free(grid->colorTypes);
+	grid->colorTypes = NULL;
+
+}
+
+void gCreateSingleHalo(Grid *grid){
+
+	int rank = grid->rank;
+	int *size = grid->size;
+
+	int *subSize = malloc(rank*sizeof(*subSize));
+	int *start = calloc(rank, sizeof(*start));
+
+	MPI_Datatype *singleTypes = malloc(rank*sizeof(*singleTypes));
+	singleTypes[0] = MPI_DATATYPE_NULL;
+
+	// Same slices as sliceTypes
+	for(int d = 1; d < rank; d++){
+		for(int dd = 0; dd < rank; dd++) subSize[dd] = size[dd];
+		subSize[d] = 1;
+
+		MPI_Type_create_subarray(rank, size, subSize, start, MPI_ORDER_FORTRAN,
+								 MPI_FLOAT, &singleTypes[d]);
+		MPI_Type_commit(&singleTypes[d]);
+	}
+
+	free(subSize);
+	free(start);
+
+	grid->singleTypes = singleTypes;
+
+}
+
+void gDestroySingleHalo(Grid *grid){
+
+	if(grid->singleTypes == NULL) return;
+
+	for(int d = 1; d < grid->rank; d++) MPI_Type_free(&grid->singleTypes[d]);
+	free(grid->singleTypes);
+	grid->singleTypes = NULL;
+
+}
+
+void gCreateDeepHalo(Grid *grid, int depth){
+
+	int rank = grid->rank;
+
+	for(int d = 1; d < rank; d++){
+		if(grid->nGhostLayers[d] > depth || grid->nGhostLayers[d+rank] > depth)
+			msg(ERROR, "deep halo of depth %d is shallower than the grid", depth);
+		if(grid->trueSize[d] < depth)
+			msg(ERROR, "deep halo of depth %d is deeper than the grid is wide", depth);
+	}
+
+	int *size 			= malloc(rank*sizeof(*size));
+	int *trueSize 		= malloc(rank*sizeof(*trueSize));
+	int *nGhostLayers 	= malloc(2*rank*sizeof(*nGhostLayers));
+	long int *sizeProd	= malloc((rank+1)*sizeof(*sizeProd));
+	bndType *bnd		= malloc(2*rank*sizeof(*bnd));
+
+	size[0] = grid->size[0];
+	trueSize[0] = grid->trueSize[0];
+	nGhostLayers[0] = 0;
+	nGhostLayers[rank] = 0;
+	for(int d = 1; d < rank; d++){
+		trueSize[d] = grid->trueSize[d];
+		nGhostLayers[d] = depth;
+		nGhostLayers[d+rank] = depth;
+		size[d] = trueSize[d] + 2*depth;
+	}
+	for(int r = 0; r < 2*rank; r++) bnd[r] = grid->bnd[r];
+	ailCumProd(size, sizeProd, rank);
+
+	// One block of ghost layers towards each neighbor, indexed as in the
+	// neighborhood of MpiInfo (the first dimension varying fastest). The
+	// first nNeighbors types are sent, the last nNeighbors received. Blocks
+	// along dimensions where the neighbor isn't displaced span the true nodes.
+	int nNeighbors = 1;
+	for(int d = 1; d < rank; d++) nNeighbors *= 3;
+
+	MPI_Datatype *types = malloc(2*nNeighbors*sizeof(*types));
+	MPI_Request *requests = malloc(2*nNeighbors*sizeof(*requests));
+
+	int *subSize = malloc(rank*sizeof(*subSize));
+	int *sendStart = malloc(rank*sizeof(*sendStart));
+	int *recvStart = malloc(rank*sizeof(*recvStart));
+
+	for(int ne = 0; ne < nNeighbors; ne++){
+
+		requests[ne] = MPI_REQUEST_NULL;
+		requests[ne+nNeighbors] = MPI_REQUEST_NULL;
+		types[ne] = MPI_DATATYPE_NULL;
+		types[ne+nNeighbors] = MPI_DATATYPE_NULL;
+		if(ne == (nNeighbors-1)/2) continue;	// Self
+
+		subSize[0] = size[0];
+		sendStart[0] = 0;
+		recvStart[0] = 0;
+		for(int d = 1, n = ne; d < rank; d++, n /= 3){
+			int dir = n%3 - 1;
+			if(dir == 0){
+				subSize[d] = trueSize[d];
+				sendStart[d] = depth;
+				recvStart[d] = depth;
+			} else {
+				subSize[d] = depth;
+				sendStart[d] = (dir < 0) ? depth : trueSize[d];
+				recvStart[d] = (dir < 0) ? 0 : trueSize[d]+depth;
+			}
+		}
+
+		MPI_Type_create_subarray(rank, size, subSize, sendStart, MPI_ORDER_FORTRAN,
+								 MPI_DOUBLE, &types[ne]);
+		MPI_Type_commit(&types[ne]);
+		MPI_Type_create_subarray(rank, size, subSize, recvStart, MPI_ORDER_FORTRAN,
+								 MPI_DOUBLE, &types[ne+nNeighbors]);
+		MPI_Type_commit(&types[ne+nNeighbors]);
+	}
+
+	free(subSize);
+	free(sendStart);
+	free(recvStart);
+
+	Grid *deep = malloc(sizeof(*deep));
+	deep->rank = rank;
+	deep->size = size;
+	deep->trueSize = trueSize;
+	deep->sizeProd = sizeProd;
+	deep->nGhostLayers = nGhostLayers;
+	deep->val = calloc(sizeProd[rank], sizeof(*deep->val));
+	deep->bnd = bnd;
+	deep->deepTypes = types;
+	deep->haloRequests = requests;
+	deep->recvSlice = NULL;
+	deep->bndSlice = NULL;
+	deep->sliceTypes = NULL;
+	deep->faceTypes = NULL;
+	deep->haloBoxes = NULL;
+	deep->tileSize = NULL;
+	deep->arena = NULL;
+	deep->deep = NULL;
+	deep->colorTypes = NULL;
+	deep->singleTypes = NULL;
+	deep->haloTime = NULL;
+	deep->h5 = 0;
+
+	grid->deep = deep;
 
-	// Index of neighboring nodes
-	long int g = alSum(&sizeProd[1], rank-1 );
-	long int end = sizeProd[rank] - 2*g;
-	int gStep;
+}
 
-	double coeff = 2.*(rank-1);
+void gDestroyDeepHalo(Grid *grid){
 
-	// Laplacian
-	for(int q = 0; q < end +1; q++){
-		resultVal[g] = -coeff*objectVal[g];
-		for(int r = 1; r < rank; r++){
-			gStep = sizeProd[r];
-			resultVal[g] += objectVal[g + gStep] + objectVal[g - gStep];
-		}
+	Grid *deep = grid->deep;
+	if(deep == NULL) return;
 
+	int nNeighbors = 1;
+	for(int d = 1; d < deep->rank; d++) nNeighbors *= 3;
 
-		// Increment indices
-		g++;
+	for(int t = 0; t < 2*nNeighbors; t++){
+		if(deep->deepTypes[t] != MPI_DATATYPE_NULL) MPI_Type_free(&deep->deepTypes[t]);
 	}
+	free(deep->deepTypes);
+	free(deep->haloRequests);
+	free(deep->size);
+	free(deep->trueSize);
+	free(deep->sizeProd);
+	free(deep->nGhostLayers);
+	free(deep->bnd);
+	free(deep->val);
+	free(deep);
+
+	grid->deep = NULL;
 
-	return;
 }
 
-void gFinDiff2nd3D(Grid *result, const  Grid *object){
+/*
+ * Copies all of grid (including its ghost layers) to the middle of grid->deep
+ * (toDeep=1) or back (toDeep=0), one row at a time.
+ */
+static void deepCopy(const Grid *grid, int toDeep){
 
- 	// Load
- 	int rank = object->rank;
- 	long int *sizeProd = object->sizeProd;
+	Grid *deep = grid->deep;
+	int rank = grid->rank;
+	int *size = grid->size;
 
- 	double *resultVal = result->val;
- 	double *objectVal = object->val;
+	int *lower = malloc(4*rank*sizeof(*lower));
+	int *upper = &lower[rank];
+	int *deepLower = &lower[2*rank];
+	int *deepUpper = &lower[3*rank];
+	for(int d = 0; d < rank; d++){
+		int shift = deep->nGhostLayers[d] - grid->nGhostLayers[d];
+		lower[d] = 0;
+		upper[d] = size[d];
+		deepLower[d] = shift;
+		deepUpper[d] = shift + size[d];
+	}
 
- 	// Index of neighboring nodes
- 	long int g = sizeProd[1] + sizeProd[2] + sizeProd[3];
- 	long int gj = g + sizeProd[1];
- 	long int gjj= g - sizeProd[1];
- 	long int gk = g + sizeProd[2];
- 	long int gkk= g - sizeProd[2];
- 	long int gl = g + sizeProd[3];
- 	long int gll= g - sizeProd[3];
+	long int nRows = gBoxRows(grid, lower, upper);
+	size_t rowBytes = size[1]*grid->sizeProd[1]*sizeof(*grid->val);
 
-	long int end = sizeProd[rank] - 2*g;
+	for(long int r = 0; r < nRows; r++){
+		double *g = &grid->val[gBoxRowStart(grid, lower, upper, r)];
+		double *h = &deep->val[gBoxRowStart(deep, deepLower, deepUpper, r)];
+		if(toDeep)	memcpy(h, g, rowBytes);
+		else		memcpy(g, h, rowBytes);
+	}
 
- 	// Laplacian
- 	for(int q = 0; q < end; q++){
- 		resultVal[g] = -6.*objectVal[g];
- 		resultVal[g] += objectVal[gj] + objectVal[gjj]
- 						+objectVal[gk] + objectVal[gkk]
- 						+objectVal[gl] + objectVal[gll];
+	free(lower);
 
- 		// Increment indices
- 		g++;
- 		gj++;
- 		gjj++;
- 		gk++;
- 		gkk++;
- 		gl++;
- 		gll++;
- 	}
+}
 
- 	return;
- }
+void gToDeep(const Grid *grid){
 
-/******************************************************************************
- *	HALO FUNCTIONS
- *****************************************************************************/
+	deepCopy(grid, 1);
 
-void gHaloOp(funPtr sliceOp, Grid *grid, const MpiInfo *mpiInfo, opDirection dir){
+}
 
-	int rank = grid->rank;
-	for(int d = 1; d < rank; d++){
-		gHaloOpDim(sliceOp, grid, mpiInfo, d, dir);
-	}
+void gFromDeep(Grid *grid){
+
+	deepCopy(grid, 0);
 
 }
 
-void gHaloOpDim(funPtr sliceOp, Grid *grid, const MpiInfo *mpiInfo, int d, opDirection dir){
+void gHaloOpDeepBegin(const Grid *grid, const MpiInfo *mpiInfo){
 
- 	//Load MpiInfo
- 	int mpiRank = mpiInfo->mpiRank;
- 	int *subdomain = mpiInfo->subdomain;
- 	int *nSubdomains = mpiInfo->nSubdomains;
- 	int *nSubdomainsProd = mpiInfo->nSubdomainsProd;
+	unsigned long long int tic = haloTic(grid);
+	Grid *deep = grid->deep;
+	int nDims = deep->rank-1;
+	int *subdomain = mpiInfo->subdomain;
+	int *nSubdomains = mpiInfo->nSubdomains;
+	int *nSubdomainsProd = mpiInfo->nSubdomainsProd;
+	MPI_Comm comm = mpiInfo->haloComm;
 
-	//Load
-	int rank = grid->rank;
-	int *size = grid->size;
-	long int *sizeProd = grid->sizeProd;
-	double *sendSlice = grid->sendSlice;
-	double *recvSlice = grid->recvSlice;
+	MPI_Datatype *types = deep->deepTypes;
+	MPI_Request *req = deep->haloRequests;
 
-	// dir=TOHALO=0: take 2nd outermost layer and place it outermost
-	// dir=FROMHALO=1: take outermost layer and place it 2nd outermost
-	int offsetUpperTake  = size[d]-2+dir;
-	int offsetUpperPlace = size[d]-1-dir;
-	int offsetLowerTake  =         1-dir;
-	int offsetLowerPlace =           dir;
+	int nNeighbors = 1;
+	for(int d = 0; d < nDims; d++) nNeighbors *= 3;
 
-	//Dimension used for subdomains, 1 less entry than grid dimensions
-	int dd = d - 1;
-	int nSlicePoints = sizeProd[rank]/size[d];
+	// Tags start above those used by gHaloOp(). A block sent towards neighbor
+	// ne is tagged ne, and arrives from the opposite neighbor.
+	int tagBase = 2*deep->rank;
 
-	int firstElem = mpiRank - subdomain[dd]*nSubdomainsProd[dd];
+	for(int ne = 0; ne < nNeighbors; ne++){
+		if(ne == (nNeighbors-1)/2) continue;
 
- 	// msg(STATUS,"lowerSubdomain: %i",lowerSubdomain);
+		int neighborRank = 0;
+		for(int d = 0, n = ne; d < nDims; d++, n /= 3){
+			int s = (subdomain[d] + n%3 - 1 + nSubdomains[d])%nSubdomains[d];
+			neighborRank += s*nSubdomainsProd[d];
+		}
 
-	int upperSubdomain = firstElem
-		+ ((subdomain[dd] + 1)%nSubdomains[dd])*nSubdomainsProd[dd];
-	int lowerSubdomain = firstElem
-		+ ((subdomain[dd] - 1 + nSubdomains[dd])%nSubdomains[dd])*nSubdomainsProd[dd];
+		MPI_Irecv(deep->val, 1, types[ne+nNeighbors], neighborRank,
+				  tagBase + nNeighbors-1-ne, comm, &req[ne+nNeighbors]);
+		MPI_Isend(deep->val, 1, types[ne], neighborRank,
+				  tagBase + ne, comm, &req[ne]);
+	}
 
-	MPI_Status 	status;
+	haloToc(grid, tic);
+}
+
+void gHaloOpDeepEnd(const Grid *grid){
 
-	// TBD: Ommitting this seems to yield race condition between consecutive
-	// calls to gHaloOpDim(). I'm not quite sure why so this should be
-	// investigated further.
-	MPI_Barrier(MPI_COMM_WORLD);
+	unsigned long long int tic = haloTic(grid);
+	Grid *deep = grid->deep;
 
-	// Send and recieve upper (tag 1)
-	getSlice(sendSlice, grid, d, offsetUpperTake);
-	MPI_Sendrecv(sendSlice, nSlicePoints, MPI_DOUBLE, upperSubdomain, 1,
-                 recvSlice, nSlicePoints, MPI_DOUBLE, lowerSubdomain, 1,
-                 MPI_COMM_WORLD, &status);
-	sliceOp(recvSlice, grid, d, offsetLowerPlace);
+	int nNeighbors = 1;
+	for(int d = 1; d < deep->rank; d++) nNeighbors *= 3;
 
-	// Send and recieve lower (tag 0)
-	getSlice(sendSlice, grid, d, offsetLowerTake);
-	MPI_Sendrecv(sendSlice, nSlicePoints, MPI_DOUBLE, lowerSubdomain, 0,
-                 recvSlice, nSlicePoints, MPI_DOUBLE, upperSubdomain, 0,
-                 MPI_COMM_WORLD, &status);
-	sliceOp(recvSlice, grid, d, offsetUpperPlace);
+	MPI_Waitall(2*nNeighbors, deep->haloRequests, MPI_STATUSES_IGNORE);
+	haloToc(grid, tic);
 
 }
 
@@ -411,15 +1310,20 @@ void gHaloOpDim(funPtr sliceOp, Grid *grid, const MpiInfo *mpiInfo, int d, opDir
 
 Grid *gAlloc(const dictionary *ini, int nValues){
 
-	// Get MPI info
-	int mpiSize, mpiRank;
-	MPI_Comm_size(MPI_COMM_WORLD,&mpiSize);
-	MPI_Comm_rank(MPI_COMM_WORLD,&mpiRank);
+	int nDims = iniGetInt(ini, "grid:nDims");
+	int *trueSize = iniGetIntArr(ini, "grid:trueSize", nDims);
+	Grid *grid = gAllocSized(ini, nValues, trueSize);
+	free(trueSize);
+
+	return grid;
+}
+
+Grid *gAllocSized(const dictionary *ini, int nValues, const int *trueSizeTemp){
 
 	// Load data from ini
 	int nDims = iniGetInt(ini, "grid:nDims");
-	int *trueSizeTemp = iniGetIntArr(ini, "grid:trueSize", nDims);
 	int *nGhostLayersTemp = iniGetIntArr(ini, "grid:nGhostLayers", 2*nDims);
+	int *tileSize = iniGetIntArr(ini, "grid:tileSize", nDims);
 	char **boundaries = iniGetStrArr(ini, "grid:boundaries" , 2*nDims);
 
 	// Calculate the number of grid points (True points + ghost points)
@@ -442,7 +1346,6 @@ Grid *gAlloc(const dictionary *ini, int nValues){
 
 		size[d] = trueSize[d] + nGhostLayers[d] + nGhostLayers[d+rank];
 	}
-	free(trueSizeTemp);
 	free(nGhostLayersTemp);
 
 	//Cumulative products
@@ -459,10 +1362,9 @@ Grid *gAlloc(const dictionary *ini, int nValues){
 		if(nSlice>nSliceMax) nSliceMax = nSlice;
 	}
 
-	// Memory for values and a slice
+	// Memory for values and slices
 	double *val = malloc(sizeProd[rank]*sizeof(*val));
-	double *sendSlice = malloc(nSliceMax*sizeof(*sendSlice));
-	double *recvSlice = malloc(nSliceMax*sizeof(*recvSlice));
+	double *recvSlice = malloc(2*nSliceMax*sizeof(*recvSlice));
 	double *bndSlice = malloc(2*rank*nSliceMax*sizeof(*bndSlice));
 	// Maybe seek a different solution where it is only stored where needed
 
@@ -490,10 +1392,20 @@ Grid *gAlloc(const dictionary *ini, int nValues){
 	grid->nGhostLayers = nGhostLayers;
 	grid->val = val;
 	grid->h5 = 0;	// Must be activated separately
-	grid->sendSlice = sendSlice;
 	grid->recvSlice = recvSlice;
 	grid->bndSlice = bndSlice;
 	grid->bnd = bnd;
+	grid->tileSize = NULL;
+	grid->arena = NULL;
+	grid->deep = NULL;
+	grid->deepTypes = NULL;
+	grid->colorTypes = NULL;
+	grid->singleTypes = NULL;
+	grid->haloTime = NULL;
+
+	gCreateHalo(grid);
+	gSetTileSize(grid, tileSize);
+	free(tileSize);
 
 	return grid;
 }
@@ -501,9 +1413,10 @@ Grid *gAlloc(const dictionary *ini, int nValues){
 MpiInfo *gAllocMpi(const dictionary *ini){
 
 	// Get MPI info
+	MPI_Comm comm = createSubdomainComm(ini);
 	int mpiSize, mpiRank;
-	MPI_Comm_size(MPI_COMM_WORLD,&mpiSize);
-	MPI_Comm_rank(MPI_COMM_WORLD,&mpiRank);
+	MPI_Comm_size(comm,&mpiSize);
+	MPI_Comm_rank(comm,&mpiRank);
 
 	// Load data from ini
 	int nDims = iniGetInt(ini, "grid:nDims");
@@ -515,14 +1428,18 @@ MpiInfo *gAllocMpi(const dictionary *ini){
 	aiCumProd(nSubdomains,nSubdomainsProd,nDims);
 
 	//Position of the subdomain in the total domain
-	int *subdomain = getSubdomain(ini);
+	int *subdomain = getSubdomain(ini, mpiRank);
 	int *offset = malloc(nDims*sizeof(*offset));
 	double *posToSubdomain = malloc(nDims*sizeof(*posToSubdomain));
+	int **cuts = malloc(nDims*sizeof(*cuts));
 
 	for(int d = 0; d < nDims; d++){
 		// offset[d] = subdomain[d]*trueSize[d];
 		offset[d] = subdomain[d]*trueSize[d]-nGhostLayers[d];
 		posToSubdomain[d] = (double)1/trueSize[d];
+
+		cuts[d] = malloc((nSubdomains[d]+1)*sizeof(**cuts));
+		for(int j = 0; j <= nSubdomains[d]; j++) cuts[d][j] = j*trueSize[d];
 	}
 
     MpiInfo *mpiInfo = malloc(sizeof(*mpiInfo));
@@ -530,40 +1447,107 @@ MpiInfo *gAllocMpi(const dictionary *ini){
 	mpiInfo->nSubdomains = nSubdomains;
 	mpiInfo->nSubdomainsProd = nSubdomainsProd;
 	mpiInfo->offset = offset;
+	mpiInfo->trueSize = trueSize;
+	mpiInfo->cuts = cuts;
 	mpiInfo->nDims = nDims;
 	mpiInfo->posToSubdomain = posToSubdomain;
 	mpiInfo->mpiSize = mpiSize;
 	mpiInfo->mpiRank = mpiRank;
+	mpiInfo->comm = comm;
 
 	mpiInfo->nSpecies = nSpecies;
 	mpiInfo->nNeighbors = 0;	// Neighbourhood not created
 
-	free(trueSize);
+	MPI_Comm_dup(comm,&mpiInfo->haloComm);
+	free(nGhostLayers);
 
     return mpiInfo;
 }
 
+MpiInfo *gAllocMpiSelf(const dictionary *ini, const int *trueSizeTemp){
+
+	int nDims = iniGetInt(ini, "grid:nDims");
+	int nSpecies = iniGetInt(ini, "population:nSpecies");
+	int *nGhostLayers = iniGetIntArr(ini, "grid:nGhostLayers", 2*nDims);
+
+	int *subdomain = malloc(nDims*sizeof(*subdomain));
+	int *nSubdomains = malloc(nDims*sizeof(*nSubdomains));
+	int *nSubdomainsProd = malloc((nDims+1)*sizeof(*nSubdomainsProd));
+	int *offset = malloc(nDims*sizeof(*offset));
+	int *trueSize = malloc(nDims*sizeof(*trueSize));
+	double *posToSubdomain = malloc(nDims*sizeof(*posToSubdomain));
+	int **cuts = malloc(nDims*sizeof(*cuts));
+
+	for(int d = 0; d < nDims; d++){
+		subdomain[d] = 0;
+		nSubdomains[d] = 1;
+		offset[d] = -nGhostLayers[d];
+		trueSize[d] = trueSizeTemp[d];
+		posToSubdomain[d] = (double)1/trueSize[d];
+
+		cuts[d] = malloc(2*sizeof(**cuts));
+		cuts[d][0] = 0;
+		cuts[d][1] = trueSize[d];
+	}
+	aiCumProd(nSubdomains,nSubdomainsProd,nDims);
+
+	MpiInfo *mpiInfo = malloc(sizeof(*mpiInfo));
+	mpiInfo->subdomain = subdomain;
+	mpiInfo->nSubdomains = nSubdomains;
+	mpiInfo->nSubdomainsProd = nSubdomainsProd;
+	mpiInfo->offset = offset;
+	mpiInfo->trueSize = trueSize;
+	mpiInfo->cuts = cuts;
+	mpiInfo->nDims = nDims;
+	mpiInfo->posToSubdomain = posToSubdomain;
+	mpiInfo->mpiSize = 1;
+	mpiInfo->mpiRank = 0;
+
+	mpiInfo->nSpecies = nSpecies;
+	mpiInfo->nNeighbors = 0;	// Neighbourhood not created
+
+	MPI_Comm_dup(MPI_COMM_SELF,&mpiInfo->comm);
+	MPI_Comm_dup(MPI_COMM_SELF,&mpiInfo->haloComm);
+	free(nGhostLayers);
+
+	return mpiInfo;
+}
+
 void gFreeMpi(MpiInfo *mpiInfo){
 
+	MPI_Comm_free(&mpiInfo->haloComm);
+	MPI_Comm_free(&mpiInfo->comm);
+
 	free(mpiInfo->subdomain);
 	free(mpiInfo->nSubdomains);
 	free(mpiInfo->nSubdomainsProd);
 	free(mpiInfo->offset);
 	free(mpiInfo->posToSubdomain);
+	free(mpiInfo->trueSize);
+	for(int d=0;d<mpiInfo->nDims;d++) free(mpiInfo->cuts[d]);
+	free(mpiInfo->cuts);
 	free(mpiInfo);
 
 }
 
 void gFree(Grid *grid){
 
-	free(grid->size);
-	free(grid->trueSize);
-	free(grid->sizeProd);
-	free(grid->nGhostLayers);
-	free(grid->val);
-	free(grid->sendSlice);
-	free(grid->recvSlice);
-	free(grid->bnd);
+	free(grid->tileSize);
+	gDestroyHalo(grid);
+	gDestroyColorHalo(grid);
+	gDestroySingleHalo(grid);
+	gDestroyDeepHalo(grid);
+
+	// Freed along with the rest of the arena by its owner
+	if(grid->arena == NULL){
+		free(grid->size);
+		free(grid->trueSize);
+		free(grid->sizeProd);
+		free(grid->nGhostLayers);
+		free(grid->val);
+		free(grid->recvSlice);
+		free(grid->bnd);
+	}
 	free(grid);
 
 }
@@ -604,6 +1588,157 @@ long int gGetGlobalVolume(const dictionary *ini){
 
 }
 
+void gBalanceCuts(	const long int *hist, int nPlanes, int nParts,
+					int granularity, int *cuts){
+
+	if(nPlanes%granularity || nPlanes/granularity<nParts)
+		msg(ERROR,"Cannot divide %i nodes into %i subdomains of multiples of %i nodes",
+				  nPlanes, nParts, granularity);
+
+	int nBlocks = nPlanes/granularity;
+	long int total = 0;
+	for(int j=0;j<nPlanes;j++) total += hist[j];
+
+	// Each cut is moved up one block at a time for as long as that brings the
+	// number of particles below it closer to its share
+	int b = 0;
+	long int below = 0;
+	cuts[0] = 0;
+	for(int i=1;i<nParts;i++){
+
+		double share = (double)i*total/nParts;
+		int bMin = cuts[i-1]/granularity+1;
+		int bMax = nBlocks-(nParts-i);
+
+		while(b<bMax){
+			long int next = below;
+			for(int j=b*granularity;j<(b+1)*granularity;j++) next += hist[j];
+			if(b>=bMin && fabs(next-share)>=fabs(below-share)) break;
+			below = next;
+			b++;
+		}
+
+		cuts[i] = b*granularity;
+	}
+	cuts[nParts] = nPlanes;
+
+}
+
+/**
+ * @brief Moves the cuts along dimension d, updating MpiInfo accordingly
+ * @return	1 if any cut moved, 0 otherwise
+ */
+static int gSetCuts(MpiInfo *mpiInfo, int d, const int *newCuts){
+
+	int nDims = mpiInfo->nDims;
+	int *nSubdomains = mpiInfo->nSubdomains;
+	int **cuts = mpiInfo->cuts;
+
+	int j = mpiInfo->subdomain[d];
+	int newSize = newCuts[j+1]-newCuts[j];
+	if(mpiInfo->nNeighbors>0)
+		mpiInfo->thresholds[nDims+d] += newSize-mpiInfo->trueSize[d];
+	mpiInfo->offset[d] += newCuts[j]-cuts[d][j];
+	mpiInfo->trueSize[d] = newSize;
+
+	int moved = 0;
+	for(int J=0;J<=nSubdomains[d];J++){
+		if(newCuts[J]!=cuts[d][J]) moved = 1;
+		cuts[d][J] = newCuts[J];
+	}
+
+	return moved;
+}
+
+int gBalance(MpiInfo *mpiInfo, const Population *pop, int granularity, double tolerance){
+
+	int nDims = mpiInfo->nDims;
+	int *nSubdomains = mpiInfo->nSubdomains;
+	int **cuts = mpiInfo->cuts;
+	MPI_Comm comm = mpiInfo->comm;
+
+	long int nLocal = 0;
+	for(int s=0;s<pop->nSpecies;s++) nLocal += pop->iStop[s]-pop->iStart[s];
+
+	long int nMax, nTotal;
+	MPI_Allreduce(&nLocal,&nMax,1,MPI_LONG,MPI_MAX,comm);
+	MPI_Allreduce(&nLocal,&nTotal,1,MPI_LONG,MPI_SUM,comm);
+	double imbalance = nTotal>0 ? (double)nMax*mpiInfo->mpiSize/nTotal : 1;
+	if(imbalance<=tolerance) return 0;
+
+	int moved = 0;
+	for(int d=0;d<nDims;d++){
+
+		int nPlanes = cuts[d][nSubdomains[d]];
+		long int *hist = malloc(nPlanes*sizeof(*hist));
+		int *newCuts = malloc((nSubdomains[d]+1)*sizeof(*newCuts));
+
+		// Every rank counts its particles in each plane and finds the same cuts
+		pHistogram(pop, d, nPlanes, hist);
+		MPI_Allreduce(MPI_IN_PLACE,hist,nPlanes,MPI_LONG,MPI_SUM,comm);
+		gBalanceCuts(hist, nPlanes, nSubdomains[d], granularity, newCuts);
+
+		if(gSetCuts(mpiInfo, d, newCuts)) moved = 1;
+
+		free(hist);
+		free(newCuts);
+	}
+
+	if(moved) msg(STATUS,"Moved subdomain boundaries (most particles in a "
+						 "subdomain was %.2f times the average)",imbalance);
+
+	return moved;
+}
+
+void gWriteCheckpointMpi(hid_t ck, const MpiInfo *mpiInfo){
+
+	char name[32];
+	for(int d=0;d<mpiInfo->nDims;d++){
+		sprintf(name,"cuts %i",d);
+		ckWrite(ck, name, H5T_NATIVE_INT, mpiInfo->cuts[d], mpiInfo->nSubdomains[d]+1);
+	}
+}
+
+int gReadCheckpointMpi(hid_t ck, MpiInfo *mpiInfo){
+
+	char name[32];
+	int moved = 0;
+	for(int d=0;d<mpiInfo->nDims;d++){
+		int *newCuts = malloc((mpiInfo->nSubdomains[d]+1)*sizeof(*newCuts));
+		sprintf(name,"cuts %i",d);
+		ckRead(ck, name, H5T_NATIVE_INT, newCuts, mpiInfo->nSubdomains[d]+1);
+		if(gSetCuts(mpiInfo, d, newCuts)) moved = 1;
+		free(newCuts);
+	}
+
+	return moved;
+}
+
+void gWriteCheckpoint(hid_t ck, const char *name, const Grid *grid){
+	ckWrite(ck, name, H5T_NATIVE_DOUBLE, grid->val, grid->sizeProd[grid->rank]);
+}
+
+void gReadCheckpoint(hid_t ck, const char *name, Grid *grid){
+	ckRead(ck, name, H5T_NATIVE_DOUBLE, grid->val, grid->sizeProd[grid->rank]);
+}
+
+Grid *gResize(const dictionary *ini, Grid *grid, const MpiInfo *mpiInfo){
+
+	Grid *resized = gAllocSized(ini, grid->size[0], mpiInfo->trueSize);
+	gZero(resized);
+
+	if(grid->h5){
+		H5Sclose(grid->h5MemSpace);
+		H5Sclose(grid->h5FileSpace);
+		resized->h5 = grid->h5;
+		setH5Spaces(resized, mpiInfo, 0);
+	}
+
+	gFree(grid);
+
+	return resized;
+}
+
 void gSetBndSlices(Grid *grid,MpiInfo *mpiInfo){
 
 	int rank = grid->rank;
@@ -668,21 +1803,27 @@ void gMul(Grid *grid, double num){
 
 	int rank = grid->rank;
 	long int nElements = grid->sizeProd[rank];
-	for(long int p=0;p<nElements;p++) grid->val[p] *= num;
+	double *val = grid->val;
+	#pragma omp parallel for simd if(nElements >= OMP_MIN_NODES) schedule(static)
+	for(long int p=0;p<nElements;p++) val[p] *= num;
 }
 
 void gAdd(Grid *grid, double num){
 
 	int rank = grid->rank;
 	long int nElements = grid->sizeProd[rank];
-	for(long int p=0;p<nElements;p++) grid->val[p] += num;
+	double *val = grid->val;
+	#pragma omp parallel for simd if(nElements >= OMP_MIN_NODES) schedule(static)
+	for(long int p=0;p<nElements;p++) val[p] += num;
 }
 
 void gSub(Grid *grid, double num){
 
 	int rank = grid->rank;
 	long int nElements = grid->sizeProd[rank];
-	for(long int p=0;p<nElements;p++) grid->val[p] -= num;
+	double *val = grid->val;
+	#pragma omp parallel for simd if(nElements >= OMP_MIN_NODES) schedule(static)
+	for(long int p=0;p<nElements;p++) val[p] -= num;
 }
 
 void gSquare(Grid *grid){
@@ -690,6 +1831,7 @@ void gSquare(Grid *grid){
 	int rank = grid->rank;
 	long int nElements = grid->sizeProd[rank];
 	double *val = grid->val;
+	#pragma omp parallel for simd if(nElements >= OMP_MIN_NODES) schedule(static)
 	for(long int g=0;g<nElements;g++) val[g] = val[g]*val[g];
 
 }
@@ -699,7 +1841,9 @@ void gZero(Grid *grid){
 
 	int rank = grid->rank;
 	long int nElements = grid->sizeProd[rank];
-	for(long int p=0;p<nElements;p++) grid->val[p] = 0;
+	double *val = grid->val;
+	#pragma omp parallel for simd if(nElements >= OMP_MIN_NODES) schedule(static)
+	for(long int p=0;p<nElements;p++) val[p] = 0;
 }
 
 void gSet(Grid *grid, const double *value){
@@ -721,7 +1865,9 @@ void gCopy(const Grid *original, Grid *copy){
 	double *origVal =	original->val;
 	double *copyVal=	copy->val;
 
-	for(int g = 0; g < sizeProd[rank]; g++) copyVal[g] = origVal[g];
+	long int nElements = sizeProd[rank];
+	#pragma omp parallel for simd if(nElements >= OMP_MIN_NODES) schedule(static)
+	for(long int g = 0; g < nElements; g++) copyVal[g] = origVal[g];
 
 }
 
@@ -732,18 +1878,15 @@ void gNeutralizeGrid(Grid *grid, const MpiInfo *mpiInfo){
 	int *trueSize = grid->trueSize;
 	int *nGhostLayers = grid->nGhostLayers;
 	int rank = grid->rank;
-	int mpiSize = mpiInfo->mpiSize;
-
-
 
 	double myCharge = gNeutralizeGridInner(&val,&nGhostLayers[rank-1],
 					&nGhostLayers[2*rank-1],&trueSize[rank-1],&sizeProd[rank-1]);
 	double totCharge = 0;
 
-	MPI_Barrier(MPI_COMM_WORLD);
-	MPI_Allreduce(&myCharge, &totCharge, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+	MPI_Allreduce(&myCharge, &totCharge, 1, MPI_DOUBLE, MPI_SUM, mpiInfo->comm);
 
-	double avgCharge = totCharge/((double)aiProd(&trueSize[1] , rank-1)*mpiSize);
+	// The subdomains need not be equally large (see gBalance())
+	double avgCharge = totCharge/(double)gTotTruesize(grid, mpiInfo);
 
 	gSub(grid, avgCharge);
 
@@ -759,8 +1902,8 @@ static inline double gNeutralizeGridInner(	const double **val, const int *nGhost
 
 		*val += *sizeProd**nGhostLayersBefore;
 
-		for(int j=0;j<*trueSize;j++)
-			charge += (*(*val)++);
+		charge += adSum(*val,*trueSize);
+		*val += *trueSize;
 
 		*val += *sizeProd**nGhostLayersAfter;
 
@@ -779,14 +1922,16 @@ static inline double gNeutralizeGridInner(	const double **val, const int *nGhost
 
 
 
-void gAddTo(Grid *result, Grid *addition){
+void gAddTo(Grid *result, const Grid *addition){
 
 	int rank = result->rank;
 	long int *sizeProd = result->sizeProd;
 	double *resultVal = result->val;
-	double *addVal = addition->val;
+	const double *addVal = addition->val;
 
-	for(long int g = 0; g < sizeProd[rank]; g++)	resultVal[g] += addVal[g];
+	long int nElements = sizeProd[rank];
+	#pragma omp parallel for simd if(nElements >= OMP_MIN_NODES) schedule(static)
+	for(long int g = 0; g < nElements; g++)	resultVal[g] += addVal[g];
 
 }
 
@@ -797,7 +1942,9 @@ void gSubFrom(Grid *result, const Grid *subtraction){
 	double *resultVal = result->val;
 	double *subVal = subtraction->val;
 
-	for(long int g = 0; g < sizeProd[rank]; g++)	resultVal[g] -= subVal[g];
+	long int nElements = sizeProd[rank];
+	#pragma omp parallel for simd if(nElements >= OMP_MIN_NODES) schedule(static)
+	for(long int g = 0; g < nElements; g++)	resultVal[g] -= subVal[g];
 
 }
 
@@ -811,8 +1958,9 @@ static double gSumTruegridInner(const double **val, const int *nGhostLayersBefor
 
 		*val += *sizeProd**nGhostLayersBefore;
 
-		for(int j=0;j<*trueSize;j++)
-			sum += (*(*val)++);
+		// Rows are summed by the vectorized adSum()
+		sum += adSum(*val,*trueSize);
+		*val += *trueSize;
 
 		*val += *sizeProd**nGhostLayersAfter;
 
@@ -854,7 +2002,12 @@ long int gTotTruesize(const Grid *grid, const MpiInfo *mpiInfo){
 
 	long int totTruesize = 1;
 
-	for(int r = 1; r < rank; r++) 	totTruesize *= nSubdomains[r-1]*trueSize[r];
+	// The subdomains may differ in size (see gBalance()), but grid is scaled
+	// down from this subdomain by the same factor as from the whole domain
+	for(int r = 1; r < rank; r++){
+		long int global = mpiInfo->cuts[r-1][nSubdomains[r-1]];
+		totTruesize *= global*trueSize[r]/mpiInfo->trueSize[r-1];
+	}
 
 	return totTruesize;
 }
@@ -863,7 +2016,12 @@ void gAssertNeutralGrid(const Grid *rho, const MpiInfo *mpiInfo){
 
 	double sum = gSumTruegrid(rho);
 	double totSum = 1.;
-	MPI_Allreduce(&sum, &totSum, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+	MPI_Allreduce(&sum, &totSum, 1, MPI_DOUBLE, MPI_SUM, mpiInfo->comm);
+
+	gAssertNeutralSum(totSum);
+}
+
+void gAssertNeutralSum(double totSum){
 
 	if( totSum < -0.001 || totSum > 0.001) msg(ERROR, "Total charge is %f", totSum);
 }
@@ -963,7 +2121,7 @@ void gNeumann(Grid *grid, const int boundary, const MpiInfo *mpiInfo){
 	int rank = grid->rank;
 	int *size = grid->size;
 	double *bndSlice = grid->bndSlice;
-	double *slice = grid->sendSlice;
+	double *slice = grid->recvSlice;
 
 	//Compute dimensions and slicesize
 	int d = boundary%rank;
@@ -1081,14 +2239,18 @@ void gCreateNeighborhood(const dictionary *ini, MpiInfo *mpiInfo, Grid *grid){
 		}
 	}
 
+	// Weighted particles carry their weight along (see pMergeSplit())
+	int migrantSize = 2*nDims;
+	if(iniGetInt(ini,"population:mergeInterval")>0) migrantSize++;
+
 	long int **migrants = malloc(nNeighbors*sizeof(**migrants));
 	long int **migrantsDummy = malloc(nNeighbors*sizeof(**migrantsDummy));
-	double **emigrants = malloc(nNeighbors*sizeof(**emigrants));
-	double **emigrantsDummy = malloc(nNeighbors*sizeof(**emigrantsDummy));
+	popFloat **emigrants = malloc(nNeighbors*sizeof(*emigrants));
+	popFloat **emigrantsDummy = malloc(nNeighbors*sizeof(*emigrantsDummy));
 	for(int i=0;i<nNeighbors;i++)
 		if(i!=neighborhoodCenter){
 			migrants[i] = malloc(nEmigrantsAlloc[i]*sizeof(*migrants));
-			emigrants[i] = malloc(2*nDims*nEmigrantsAlloc[i]*sizeof(*emigrants));
+			emigrants[i] = malloc(migrantSize*nEmigrantsAlloc[i]*sizeof(**emigrants));
 		}
 
 	double *thresholds = iniGetDoubleArr(ini,"grid:thresholds",2*nDims);
@@ -1103,8 +2265,15 @@ void gCreateNeighborhood(const dictionary *ini, MpiInfo *mpiInfo, Grid *grid){
 	long int *nEmigrants = malloc(nNeighbors*nSpecies*sizeof(*nEmigrants));
 	long int *nImmigrants = malloc(nNeighbors*nSpecies*sizeof(*nImmigrants));
 
-	long int nImmigrantsAlloc = 2*nDims*alMax(nEmigrantsAlloc,nNeighbors);
-	double *immigrants = malloc(nImmigrantsAlloc*sizeof(*immigrants));
+	// Neighbor ne sends us what it has allocated for towards its neighbor in
+	// the opposite direction
+	long int *nImmigrantsAlloc = malloc(nNeighbors*sizeof(*nImmigrantsAlloc));
+	popFloat **immigrants = malloc(nNeighbors*sizeof(*immigrants));
+	for(int ne=0;ne<nNeighbors;ne++){
+		nImmigrantsAlloc[ne] = nEmigrantsAlloc[nNeighbors-1-ne];
+		if(ne!=neighborhoodCenter)
+			immigrants[ne] = malloc(migrantSize*nImmigrantsAlloc[ne]*sizeof(**immigrants));
+	}
 
 	MPI_Request *send = malloc(nNeighbors*sizeof(*send));
 	MPI_Request *recv = malloc(nNeighbors*sizeof(*recv));
@@ -1124,9 +2293,29 @@ void gCreateNeighborhood(const dictionary *ini, MpiInfo *mpiInfo, Grid *grid){
 	mpiInfo->nEmigrants = nEmigrants;
 	mpiInfo->nImmigrants = nImmigrants;
 	mpiInfo->nEmigrantsAlloc = nEmigrantsAlloc;
-	mpiInfo->nImmigrantsAlloc = nImmigrantsAlloc;
 	mpiInfo->thresholds = thresholds;
 	mpiInfo->immigrants = immigrants;
+	mpiInfo->nImmigrantsAlloc = nImmigrantsAlloc;
+	mpiInfo->migrantSize = migrantSize;
+	mpiInfo->nPendingImmigrants = 0;
+
+	// Statistics used to resize the buffers (see puMigrate())
+	mpiInfo->nEmigrantsHighWater = calloc(nNeighbors,sizeof(long int));
+	mpiInfo->nImmigrantsHighWater = calloc(nNeighbors,sizeof(long int));
+	mpiInfo->nEmigrantsPeak = calloc(nNeighbors,sizeof(long int));
+	mpiInfo->nEmigrantsSum = calloc(nNeighbors,sizeof(long int));
+	mpiInfo->nMigrations = 0;
+	mpiInfo->nResizes = 0;
+
+	char *migration = iniGetStr(ini,"grid:migration");
+	if(!strcmp(migration,"SPLIT"))			mpiInfo->migration = MIGRATE_SPLIT;
+	else if(!strcmp(migration,"PROBED"))	mpiInfo->migration = MIGRATE_PROBED;
+	else msg(ERROR,"grid:migration must be SPLIT or PROBED");
+	free(migration);
+
+	// A separate communicator lets migrants be probed for using MPI_ANY_SOURCE
+	// and MPI_ANY_TAG without catching other messages.
+	MPI_Comm_dup(mpiInfo->comm,&mpiInfo->migrateComm);
 	mpiInfo->neighborhoodCenter = neighborhoodCenter;
 
 }
@@ -1134,11 +2323,12 @@ void gCreateNeighborhood(const dictionary *ini, MpiInfo *mpiInfo, Grid *grid){
 void gDestroyNeighborhood(MpiInfo *mpiInfo){
 
 	long int **migrants = mpiInfo->migrants;
-	double **emigrants = mpiInfo->emigrants;
+	popFloat **emigrants = mpiInfo->emigrants;
 	for(int neigh=0;neigh<mpiInfo->nNeighbors;neigh++){
 		if(neigh!=mpiInfo->neighborhoodCenter){
 			free(migrants[neigh]);
 			free(emigrants[neigh]);
+			free(mpiInfo->immigrants[neigh]);
 		}
 	}
 	free(migrants);
@@ -1149,9 +2339,15 @@ void gDestroyNeighborhood(MpiInfo *mpiInfo){
 	free(mpiInfo->nEmigrantsAlloc);
 	free(mpiInfo->thresholds);
 	free(mpiInfo->immigrants);
+	free(mpiInfo->nImmigrantsAlloc);
+	free(mpiInfo->nEmigrantsHighWater);
+	free(mpiInfo->nImmigrantsHighWater);
+	free(mpiInfo->nEmigrantsPeak);
+	free(mpiInfo->nEmigrantsSum);
 	free(mpiInfo->nImmigrants);
 	free(mpiInfo->send);
 	free(mpiInfo->recv);
+	MPI_Comm_free(&mpiInfo->migrateComm);
 }
 
 /******************************************************************************
@@ -1179,6 +2375,19 @@ void gWriteH5(const Grid *grid, const MpiInfo *mpiInfo, double n){
 	H5Pclose(pList);
 }
 
+void gWriteH5Staged(Stage *stage, const Grid *grid, const MpiInfo *mpiInfo, double n){
+
+	long int nBytes = grid->sizeProd[grid->rank]*sizeof(*grid->val);
+	double *copy = malloc(nBytes);
+	memcpy(copy, grid->val, nBytes);
+
+	char name[64];
+	sprintf(name,"/n=%.1f",n);
+
+	stAdd(stage, grid->h5, name, H5T_NATIVE_DOUBLE, grid->h5MemSpace,
+		  grid->h5FileSpace, copy, nBytes);
+}
+
 void gReadH5(Grid *grid, const MpiInfo *mpiInfo, double n){
 
 	hid_t fileSpace = grid->h5FileSpace;
@@ -1210,14 +2419,6 @@ void gCloseH5(Grid *grid){
 void gOpenH5(const dictionary *ini, Grid *grid, const MpiInfo *mpiInfo,
 			 const Units *units, double denorm, const char *fName){
 
-	int rank = grid->rank;
-	int nDims = rank-1;
-	int *size = grid->size;
-	int *trueSize = grid->trueSize;
-	int	*nGhostLayers = grid->nGhostLayers;
-	int *nSubdomains = mpiInfo->nSubdomains;
-	int *subdomain = mpiInfo->subdomain;
-
 	/*
 	 * CREATE FILE
 	 */
@@ -1231,6 +2432,25 @@ void gOpenH5(const dictionary *ini, Grid *grid, const MpiInfo *mpiInfo,
 	setH5Attr(file,"Axis denormalization factor",&units->length,1);
 	setH5Attr(file,"Quantity denormalization factor",&denorm,1);
 
+	grid->h5 = file;
+	setH5Spaces(grid, mpiInfo, 0);
+
+}
+
+/**
+ * @brief Sets the HDF5 spaces of a grid of the subdomain halved nLevels times
+ */
+static void setH5Spaces(Grid *grid, const MpiInfo *mpiInfo, int nLevels){
+
+	int rank = grid->rank;
+	int nDims = rank-1;
+	int *size = grid->size;
+	int *trueSize = grid->trueSize;
+	int	*nGhostLayers = grid->nGhostLayers;
+	int *nSubdomains = mpiInfo->nSubdomains;
+	int *subdomain = mpiInfo->subdomain;
+	int **cuts = mpiInfo->cuts;
+
 	/*
 	 * HDF5 HYPERSLAB DEFINITION
 	 */
@@ -1244,8 +2464,10 @@ void gOpenH5(const dictionary *ini, Grid *grid, const MpiInfo *mpiInfo,
 		// HDF5 indices needs to be reversed compared to ours due to non-C ordering.
 		memDims[d]		= (hsize_t)size[rank-d-1];
 		memOffset[d]	= (hsize_t)nGhostLayers[rank-d-1];
-		fileDims[d]		= (hsize_t)trueSize[rank-d-1]*nSubdomains[rank-d-2];
-		fileOffset[d]	= (hsize_t)trueSize[rank-d-1]*subdomain[rank-d-2];
+		if(d<nDims){
+			fileDims[d]		= (hsize_t)(cuts[rank-d-2][nSubdomains[rank-d-2]]>>nLevels);
+			fileOffset[d]	= (hsize_t)(cuts[rank-d-2][subdomain[rank-d-2]]>>nLevels);
+		}
 	}
 
 	fileDims[rank-1] = (hsize_t)trueSize[0];
@@ -1263,12 +2485,170 @@ void gOpenH5(const dictionary *ini, Grid *grid, const MpiInfo *mpiInfo,
 	free(memOffset);
 	free(fileOffset);
 
-	grid->h5 = file;
 	grid->h5MemSpace = memSpace;
 	grid->h5FileSpace = fileSpace;
 
 }
 
+/**
+ * @brief Allocates the grids of GridOutput for the current subdomain
+ */
+static void gAllocOutputGrids(const dictionary *ini, GridOutput *out,
+							  int nValues, const MpiInfo *mpiInfo){
+
+	int nDims = mpiInfo->nDims;
+	int nLevels = out->nLevels;
+	int *trueSize = malloc(nDims*sizeof(*trueSize));
+	for(int d=0;d<nDims;d++) trueSize[d] = mpiInfo->trueSize[d];
+
+	out->sum = gAllocSized(ini, nValues, trueSize);
+	gZero(out->sum);
+	out->nSummed = 0;
+
+	if(nLevels==0){
+		out->levels = NULL;
+		out->coarse = out->sum;
+		free(trueSize);
+		return;
+	}
+
+	for(int d=0;d<nDims;d++){
+		if(trueSize[d]%(1<<nLevels))
+			msg(ERROR,"Subdomains must be multiples of 2^files:gridCoarsening nodes");
+	}
+
+	out->levels = malloc((nLevels+1)*sizeof(*out->levels));
+	out->levels[0] = nValues==1 ? out->sum : gAllocSized(ini, SCALAR, trueSize);
+	for(int l=1;l<=nLevels;l++){
+		for(int d=0;d<nDims;d++) trueSize[d] /= 2;
+		out->levels[l] = gAllocSized(ini, SCALAR, trueSize);
+	}
+	out->coarse = gAllocSized(ini, nValues, trueSize);
+
+	free(trueSize);
+}
+
+/**
+ * @brief Frees the grids of GridOutput (but not the .grid.h5-file)
+ */
+static void gFreeOutputGrids(GridOutput *out){
+
+	int nLevels = out->nLevels;
+	if(nLevels>0){
+		if(out->levels[0]!=out->sum) gFree(out->levels[0]);
+		for(int l=1;l<=nLevels;l++) gFree(out->levels[l]);
+		free(out->levels);
+		gFree(out->coarse);
+	}
+	gFree(out->sum);
+}
+
+GridOutput *gAllocOutput(const dictionary *ini, const Grid *grid,
+						 const MpiInfo *mpiInfo, const Units *units,
+						 double denorm, const char *fName){
+
+	GridOutput *out = malloc(sizeof(*out));
+	out->nLevels = iniGetInt(ini,"files:gridCoarsening");
+	out->interval = iniGetInt(ini,"files:gridAverage");
+	out->nSteps = 0;
+
+	char *accumulate = iniGetStr(ini,"files:gridAccumulate");
+	if(!strcmp(accumulate,"MEAN"))		out->mean = 1;
+	else if(!strcmp(accumulate,"SUM"))	out->mean = 0;
+	else msg(ERROR,"files:gridAccumulate must be MEAN or SUM");
+	free(accumulate);
+
+	if(out->nLevels<0) msg(ERROR,"files:gridCoarsening must be non-negative");
+	if(out->interval<1) msg(ERROR,"files:gridAverage must be at least 1");
+
+	// The same restrictors as the multigrid solver, see mgSetRestrictProlong()
+	out->restrictor = grid->rank==4 ? &mgHalfRestrict3D : &mgHalfRestrictND;
+
+	int nValues = grid->size[0];
+	gAllocOutputGrids(ini, out, nValues, mpiInfo);
+
+	// As gOpenH5(), but the nodes are further apart
+	hid_t file = openH5File(ini,fName,"grid");
+
+	double axisDenorm = units->length*(1<<out->nLevels);
+	double nAccumulated = out->interval;
+	setH5Attr(file,"Axis denormalization factor",&axisDenorm,1);
+	setH5Attr(file,"Quantity denormalization factor",&denorm,1);
+	setH5Attr(file,"Time-steps accumulated",&nAccumulated,1);
+
+	out->coarse->h5 = file;
+	setH5Spaces(out->coarse, mpiInfo, out->nLevels);
+
+	return out;
+}
+
+void gResizeOutput(const dictionary *ini, GridOutput *out, const MpiInfo *mpiInfo){
+
+	hid_t h5 = out->coarse->h5;
+	H5Sclose(out->coarse->h5MemSpace);
+	H5Sclose(out->coarse->h5FileSpace);
+
+	int nValues = out->sum->size[0];
+	gFreeOutputGrids(out);
+	gAllocOutputGrids(ini, out, nValues, mpiInfo);
+
+	out->coarse->h5 = h5;
+	setH5Spaces(out->coarse, mpiInfo, out->nLevels);
+}
+
+void gFreeOutput(GridOutput *out){
+
+	gCloseH5(out->coarse);
+	gFreeOutputGrids(out);
+	free(out);
+}
+
+void gWriteOutput(GridOutput *out, const Grid *grid, const MpiInfo *mpiInfo, double n){
+
+	Grid *sum = out->sum;
+	if(out->nSummed==0)	gCopy(grid, sum);
+	else				gAddTo(sum, grid);
+	out->nSummed++;
+	out->nSteps++;
+
+	if(out->nSteps<out->interval) return;
+
+	if(out->mean) gMul(sum, 1./out->nSummed);
+	out->nSummed = 0;
+	out->nSteps = 0;
+
+	int nLevels = out->nLevels;
+	if(nLevels>0){
+
+		Grid **levels = out->levels;
+		Grid *coarse = out->coarse;
+		int nValues = sum->size[0];
+
+		// The restrictors need the neighbors of the nodes at the edges
+		gHaloOp(setSlice, sum, mpiInfo, TOHALO);
+
+		for(int v=0;v<nValues;v++){
+
+			if(nValues>1){
+				long int nNodes = levels[0]->sizeProd[levels[0]->rank];
+				for(long int p=0;p<nNodes;p++)
+					levels[0]->val[p] = sum->val[p*nValues+v];
+			}
+
+			for(int l=1;l<=nLevels;l++){
+				if(l>1) gHaloOp(setSlice, levels[l-1], mpiInfo, TOHALO);
+				out->restrictor(levels[l-1], levels[l]);
+			}
+
+			long int nNodes = coarse->sizeProd[coarse->rank]/nValues;
+			for(long int p=0;p<nNodes;p++)
+				coarse->val[p*nValues+v] = levels[nLevels]->val[p];
+		}
+	}
+
+	gWriteH5(out->coarse, mpiInfo, n);
+}
+
 /******************************************************************************
  * ENERGY FUNCTIONS
  *****************************************************************************/
@@ -1303,9 +2683,9 @@ static double gPotEnergyInner(	const double **rhoVal, const double **phiVal,
 	*phiVal += *sizeProd**nGhostLayersBefore;
 
 	if(*sizeProd==1){
-		for(int j=0;j<*trueSize;j++){
-			energy += (*(*rhoVal)++)*(*(*phiVal)++);
-		}
+		energy += adDotProd(*rhoVal,*phiVal,*trueSize);
+		*rhoVal += *trueSize;
+		*phiVal += *trueSize;
 	} else {
 		for(int j=0;j<*trueSize;j++){
 			energy += gPotEnergyInner(	rhoVal, phiVal,
@@ -1364,7 +2744,7 @@ void gFillHeavi(Grid *grid, int d, const MpiInfo *mpiInfo){
    long int ind = 0;
    if(nSubdomains[d-1]==1){
 	   //SetSlices
-	   double *slice = grid->sendSlice;
+	   double *slice = grid->recvSlice;
 
 	   int nSlicePoints = sizeProd[rank]/size[d];
 
@@ -1391,8 +2771,8 @@ void gFillHeavi(Grid *grid, int d, const MpiInfo *mpiInfo){
 			   }
 		   }
 	   }
-	// Set in 0 at between domains (sendSlice is safe to use, since it is reset every time it is used)
-	   double *slice = grid->sendSlice;
+	// Set in 0 at between domains (recvSlice is safe to use, since it is reset every time it is used)
+	   double *slice = grid->recvSlice;
 	   for(int j = 0; j < sizeProd[4]; j++)	slice[j] = 0.;
 	   if(subdomain[d-1] == 0)	setSlice(slice, grid, d, 1);
 
@@ -1424,7 +2804,7 @@ void gFillHeaviSol(Grid *grid, int d ,const MpiInfo *mpiInfo){
 	   //Smart setSlice-use
 	   double half = 0.5*trueSize[d];
 	   double *sol = malloc(trueSize[d]*sizeof(*sol));
-	   double *slice = grid->sendSlice;
+	   double *slice = grid->recvSlice;
 	   long int nSlicePoints = sizeProd[rank]/size[d];
 
 	   //First half  f = -(a-x)*x/2
@@ -1573,7 +2953,7 @@ void gFillSin(Grid *grid,int d, const MpiInfo *mpiInfo, int norm){
 	long int *sizeProd = grid->sizeProd;
 
 	double *sol = malloc(trueSize[d]*sizeof(*sol));
-	double *slice = grid->sendSlice;
+	double *slice = grid->recvSlice;
 	long int nSlicePoints = sizeProd[rank]/size[d];
 
 	//f = sin(x*2pi/L)
@@ -1620,7 +3000,7 @@ void gFillSinSol(Grid *grid, int d ,const MpiInfo *mpiInfo){
 	long int *sizeProd = grid->sizeProd;
 
 	double *sol = malloc(trueSize[d]*sizeof(*sol));
-	double *slice = grid->sendSlice;
+	double *slice = grid->recvSlice;
 	long int nSlicePoints = sizeProd[rank]/size[d];
 
 	//f = sin(x/2piL)
@@ -1658,7 +3038,7 @@ void gFillSinESol(Grid *grid, int d ,const MpiInfo *mpiInfo){
 	long int *sizeProd = grid->sizeProd;
 
 	double *sol = calloc(sizeProd[1]*trueSize[d],sizeof(*sol));
-	double *slice = grid->sendSlice;
+	double *slice = grid->recvSlice;
 	long int nSlicePoints = sizeProd[rank]/size[d];
 
 	//f = cos(x/2piL)
@@ -1724,9 +3104,40 @@ void gFillRng(Grid *grid, const MpiInfo *mpiInfo, const gsl_rng *rng){
 
    //Load
    double *val = grid->val;
-   long int *sizeProd = grid->sizeProd;
+   int *size = grid->size;
    int rank = grid->rank;
-   for(int g = 0; g < sizeProd[rank]; g++) val[g] = gsl_ran_gaussian_ziggurat (rng,1.);
+   int nDims = rank-1;
+   int nValues = size[0];
+   int *offset = mpiInfo->offset;
+   long int nNodes = grid->sizeProd[rank]/nValues;
+   long int nPairs = (nValues+1)/2;
+
+   // Global size, to wrap the ghost nodes around
+   int *L = malloc(nDims*sizeof(*L));
+   for(int d=0;d<nDims;d++) L[d] = mpiInfo->cuts[d][mpiInfo->nSubdomains[d]];
+
+   // The values of a node only depends on its global index
+   Philox ph;
+   phSet(&ph, gsl_rng_get(rng), 0);
+
+   #pragma omp parallel for if(nNodes >= OMP_MIN_NODES) schedule(static)
+   for(long int p = 0; p < nNodes; p++){
+
+      long int node = 0;
+      long int rest = p;
+      long int stride = 1;
+      for(int d=0;d<nDims;d++){
+         int g = (int)(rest%size[d+1]) + offset[d];
+         rest /= size[d+1];
+         g = (g%L[d]+L[d])%L[d];
+         node += stride*g;
+         stride *= L[d];
+      }
+
+      phGaussian(&ph, node*nPairs, &val[p*nValues], nValues);
+   }
+
+   free(L);
 
    return;
 }
@@ -41,6 +41,68 @@ typedef enum{
 
 Grid *gAlloc(const dictionary *ini, int nValues);
 
+/**
+ * @brief Allocates a Grid object of a given size
+ * @param	ini			Input file
+ * @param	nValues		Number of values per grid point (use SCALAR or VECTOR)
+ * @param	trueSize	Number of true nodes along each dimension (nDims elements)
+ * @return				Pointer to Grid
+ *
+ * As gAlloc() but with trueSize given rather than taken from grid:trueSize,
+ * e.g. for subdomains resized by gBalance().
+ */
+Grid *gAllocSized(const dictionary *ini, int nValues, const int *trueSize);
+
+/**
+ * @brief Reallocates a Grid to the size of this subdomain
+ * @param	ini			Input file
+ * @param	grid		Grid to replace (freed)
+ * @param	mpiInfo		MpiInfo
+ * @return				Pointer to new Grid
+ *
+ * Replaces grid by a grid of size MpiInfo.trueSize, e.g. after gBalance().
+ * An open .h5-file is carried over. The values are not: the new grid is zero.
+ */
+Grid *gResize(const dictionary *ini, Grid *grid, const MpiInfo *mpiInfo);
+
+/**
+ * @brief Writes the cuts between the subdomains to a checkpoint
+ * @param	ck			Checkpoint
+ * @param	mpiInfo		MpiInfo
+ * @see		ckCreate()
+ */
+void gWriteCheckpointMpi(hid_t ck, const MpiInfo *mpiInfo);
+
+/**
+ * @brief Restores the cuts between the subdomains from a checkpoint
+ * @param	ck			Checkpoint
+ * @param	mpiInfo		MpiInfo
+ * @return				1 if they differ from those of mpiInfo, 0 otherwise
+ * @see		ckOpen()
+ *
+ * MpiInfo is updated as by gBalance(), and if the cuts moved, the grids must
+ * be reallocated by gResize() before being read from the checkpoint.
+ */
+int gReadCheckpointMpi(hid_t ck, MpiInfo *mpiInfo);
+
+/**
+ * @brief Writes a grid, including ghost nodes, to a checkpoint
+ * @param	ck		Checkpoint
+ * @param	name	Dataset name
+ * @param	grid	Grid
+ * @see		ckCreate()
+ */
+void gWriteCheckpoint(hid_t ck, const char *name, const Grid *grid);
+
+/**
+ * @brief Reads a grid, including ghost nodes, from a checkpoint
+ * @param	ck		Checkpoint
+ * @param	name	Dataset name
+ * @param	grid	Grid of the same size as the one written
+ * @see		ckOpen()
+ */
+void gReadCheckpoint(hid_t ck, const char *name, Grid *grid);
+
 /**
  * @brief Frees allocated grid
  * @param	grid	Grid
@@ -69,9 +131,32 @@ void gSetBndSlices(Grid *grid,MpiInfo *mpiInfo);
  * @brief Allocates the memory for an MpiInfo struct according to input file
  * @param	ini		Input file dictionary
  * @return	Pointer to MpiInfo
+ *
+ * Creates the Cartesian communicator MpiInfo.comm of the subdomains. If
+ * grid:nodeBlock is 0 MPI is allowed to reorder the ranks to fit the hardware.
+ * Otherwise it specifies a block of subdomains (along each dimension) to place
+ * the processes of each node in, e.g. 2,2,2 for nodes running 8 processes.
+ * Neighboring subdomains then mostly share a node, such that most of the halo
+ * and migrant traffic goes through shared memory rather than the network.
+ * The blocks must tile grid:nSubdomains and all nodes must run as many
+ * processes as there are subdomains in a block.
  */
 MpiInfo *gAllocMpi(const dictionary *ini);
 
+/**
+ * @brief Allocates an MpiInfo of a single subdomain on MPI_COMM_SELF
+ * @param	ini			Input file
+ * @param	trueSize	True size of the subdomain (nDims elements)
+ * @return	MpiInfo
+ *
+ * The subdomain is its own neighbor along every dimension, so grid operations
+ * like gHaloOp() and gNeutralizeGrid() can be done on a whole domain held by
+ * one MPI process without involving the others. Used for the coarse levels
+ * gathered onto one process by the multigrid solver. No neighborhood is
+ * created. Freed by gFreeMpi().
+ */
+MpiInfo *gAllocMpiSelf(const dictionary *ini, const int *trueSize);
+
 /**
  * @brief Frees the memory of an MpiInfo struct
  * @param	mpiInfo		MpiInfo
@@ -79,6 +164,55 @@ MpiInfo *gAllocMpi(const dictionary *ini);
  */
 void gFreeMpi(MpiInfo *mpiInfo);
 
+/**
+ * @brief Moves the subdomain boundaries to even out the number of particles
+ * @param[in,out]	mpiInfo		MpiInfo
+ * @param			pop			Population (global reference frame)
+ * @param			granularity	Subdomain sizes must be multiples of this
+ * @param			tolerance	Accepted ratio of most to average particles
+ * @return			1 if the boundaries were moved, 0 otherwise
+ *
+ * Does nothing unless the subdomain with the most particles has more than
+ * tolerance times the average number of particles. Otherwise, the particles
+ * are counted in every plane of nodes along each dimension, and the cuts
+ * along that dimension are chosen to split them evenly (see gBalanceCuts()).
+ * The subdomains thus remain a rectilinear grid, and neighbors keep sharing
+ * whole faces.
+ *
+ * MpiInfo.cuts, trueSize, offset and the migration thresholds are updated.
+ * The caller must move the particles to their new subdomains using
+ * pRedistribute() and reallocate the grids (and anything allocated from them)
+ * using gResize(). Typically:
+ *
+ * @code
+ *	pToGlobalFrame(pop, mpiInfo);
+ *	int moved = gBalance(mpiInfo, pop, granularity, tolerance);
+ *	if(moved) pRedistribute(pop, mpiInfo);
+ *	pToLocalFrame(pop, mpiInfo);
+ *	if(moved) rho = gResize(ini, rho, mpiInfo);
+ * @endcode
+ *
+ * Collective across MpiInfo.comm. The multigrid solver requires granularity
+ * to be 2^multigrid:mgLevels.
+ */
+int gBalance(MpiInfo *mpiInfo, const Population *pop, int granularity, double tolerance);
+
+/**
+ * @brief Splits a histogram into parts of nearly equal sum
+ * @param		hist		Number of particles in each plane (nPlanes elements)
+ * @param		nPlanes		Number of planes
+ * @param		nParts		Number of parts
+ * @param		granularity	Every part must be a multiple of this many planes
+ * @param[out]	cuts		First plane of each part, and nPlanes (nParts+1 elements)
+ * @return		void
+ *
+ * Each cut is placed at the multiple of granularity where the number of
+ * particles below it is closest to its share, while every part is kept at
+ * least granularity planes large.
+ */
+void gBalanceCuts(	const long int *hist, int nPlanes, int nParts,
+					int granularity, int *cuts);
+
 /**
  * @brief Send and recieves the overlapping layers of the subdomains
  * @param sliceOp			Slicing operation
@@ -132,7 +266,10 @@ void gFreeMpi(MpiInfo *mpiInfo);
  * @endcode
  *
  * If needed it should be quick to facilitate for more slice operations, in
- * addition to set and add.
+ * addition to set and add. With setSlice the slices are recieved directly into
+ * the ghost layers, while other slice operations takes them via recvSlice.
+ * Each dimension and direction uses its own tag (2*d+1 upwards and 2*d
+ * downwards) on MpiInfo.haloComm, so no barrier is needed between calls.
  *
  * NB! Only works with 1 ghost layer.
  * @see gHaloOp
@@ -155,6 +292,288 @@ void gHaloOpDim(funPtr sliceOp, Grid *grid, const MpiInfo *mpiInfo, int d, opDir
  */
 void gHaloOp(funPtr sliceOp, Grid *grid, const MpiInfo *mpiInfo, opDirection dir);
 
+/**
+ * @brief Sets the ghost layers of the faces in all dimensions at once
+ * @param *grid				Grid struct
+ * @param *mpiInfo			MpiInfo struct
+ * @param dir				Direction of operation
+ *
+ * Same as gHaloOp(setSlice, grid, mpiInfo, dir), except that the edges and
+ * corners of the ghost layers (where the ghost layers of two or more
+ * dimensions intersect) are left untouched. In return, the exchanges along
+ * all dimensions are in flight at the same time rather than one after
+ * another. Use it when the values are only needed by stencils along the axes,
+ * like finite differences and half-weighting restriction.
+ *
+ * NB! Only works with 1 ghost layer.
+ * @see gHaloOp
+ */
+void gHaloOpFaces(Grid *grid, const MpiInfo *mpiInfo, opDirection dir);
+
+/**
+ * @brief Starts gHaloOpFaces() without waiting for it to complete
+ * @param *grid				Grid struct
+ * @param *mpiInfo			MpiInfo struct
+ * @param dir				Direction of operation
+ *
+ * This allows work which doesn't depend on the ghost layers to be done while
+ * they are in flight, for instance on the interior of Grid.haloBoxes:
+ *
+ * @code
+	gHaloOpBegin(phi, mpiInfo, TOHALO);
+	// Work on interior of phi
+	gHaloOpEnd(phi);
+	// Work on shell of phi
+ * @endcode
+ *
+ * Until gHaloOpEnd() is called, the ghost layers and the outermost true layers
+ * may be read but not written, and no other halo operation may be done on the
+ * same grid.
+ *
+ * @see gHaloOpEnd
+ */
+void gHaloOpBegin(Grid *grid, const MpiInfo *mpiInfo, opDirection dir);
+
+/**
+ * @brief Waits for the halo exchange started by gHaloOpBegin() to complete
+ * @param *grid				Grid struct
+ *
+ * Does nothing if there is no halo exchange in progress. Kernels overlapping
+ * their work with the exchange can therefore call this unconditionally.
+ */
+void gHaloOpEnd(Grid *grid);
+
+/**
+ * @brief Starts sending the outermost true nodes of one color to the halo
+ * @param *grid				Grid struct
+ * @param *mpiInfo			MpiInfo struct
+ * @param color				Parity of the sum of the indices of the nodes
+ *
+ * As gHaloOpBegin() in the TOHALO direction, but only nodes of the given
+ * color are sent, using Grid.colorTypes. A red-black smoother only changes one
+ * color per pass, and the ghost nodes of the other color are those recieved
+ * after the previous pass, so this halves the data sent. Complete with
+ * gHaloOpEnd(). Sends all the nodes if gCreateColorHalo() hasn't been called.
+ */
+void gHaloOpColorBegin(Grid *grid, const MpiInfo *mpiInfo, int color);
+
+/**
+ * @brief Sets the ghost layers of a single precision copy of a grid
+ * @param *val				Array of floats shaped as grid->val
+ * @param *grid				Grid struct
+ * @param *mpiInfo			MpiInfo struct
+ *
+ * Same as gHaloOp(setSlice, grid, mpiInfo, TOHALO), but for val rather than
+ * grid->val, which halves the size of the messages. gHaloOpDimSingle() does one
+ * dimension. Needs Grid.singleTypes (see gCreateSingleHalo()).
+ *
+ * NB! Only works with 1 ghost layer.
+ */
+void gHaloOpSingle(float *val, Grid *grid, const MpiInfo *mpiInfo);
+void gHaloOpDimSingle(float *val, Grid *grid, const MpiInfo *mpiInfo, int d);
+
+/**
+ * @brief Returns the number of rows in a box of nodes
+ * @param	grid	Grid
+ * @param	lower	Lower corner of box (inclusive, rank elements)
+ * @param	upper	Upper corner of box (exclusive, rank elements)
+ * @return	Number of rows
+ *
+ * A row is the nodes from lower[1] to upper[1] with all other indices fixed,
+ * which are contiguous in memory when there's one value per node. An empty box
+ * has no rows.
+ *
+ * @see gBoxRowStart
+ */
+long int gBoxRows(const Grid *grid, const int *lower, const int *upper);
+
+/**
+ * @brief Returns the linear index of the first node in a row of a box
+ * @param	grid	Grid
+ * @param	lower	Lower corner of box (inclusive, rank elements)
+ * @param	upper	Upper corner of box (exclusive, rank elements)
+ * @param	r		Row number (0 to gBoxRows()-1)
+ * @return	Linear index in Grid.val
+ *
+ * The index is for the first value of the node, assuming lower[0]=0.
+ */
+long int gBoxRowStart(const Grid *grid, const int *lower, const int *upper, long int r);
+
+/**
+ * @brief Returns the number of tiles in a box of nodes
+ * @param	grid	Grid
+ * @param	lower	Lower corner of box (inclusive, rank elements)
+ * @param	upper	Upper corner of box (exclusive, rank elements)
+ * @return	Number of tiles
+ *
+ * The box is split into tiles of at most Grid.tileSize nodes. An empty box has
+ * no tiles.
+ *
+ * @see gBoxTile
+ */
+long int gBoxTiles(const Grid *grid, const int *lower, const int *upper);
+
+/**
+ * @brief Returns the corners of a tile in a box of nodes
+ * @param	grid		Grid
+ * @param	lower		Lower corner of box (inclusive, rank elements)
+ * @param	upper		Upper corner of box (exclusive, rank elements)
+ * @param	t			Tile number (0 to gBoxTiles()-1)
+ * @param[out]	tileLower	Lower corner of tile (inclusive, rank elements)
+ * @param[out]	tileUpper	Upper corner of tile (exclusive, rank elements)
+ *
+ * The tile is itself a box, which can be traversed using gBoxRows() and
+ * gBoxRowStart(). Tiles along the lowest dimension are numbered first.
+ */
+void gBoxTile(const Grid *grid, const int *lower, const int *upper, long int t,
+			  int *tileLower, int *tileUpper);
+
+/**
+ * @brief Sets the size of the tiles used by the stencil kernels
+ * @param	grid		Grid
+ * @param	tileSize	Requested tile size (rank-1 elements), or NULL
+ *
+ * Non-positive elements of tileSize, or all of them if tileSize is NULL, are
+ * chosen automatically: The lowest (unit-stride) and highest dimension are not
+ * tiled, while dimensions in between are tiled such that the few planes of a
+ * tile needed at once fit in a 256 KiB cache. Tiles are in any case no larger
+ * than the true grid. Called by gAlloc() using grid:tileSize, and must be
+ * called for grids allocated by other means.
+ */
+void gSetTileSize(Grid *grid, const int *tileSize);
+
+/**
+ * @brief Creates what is needed for halo exchange of a grid
+ * @param	grid	Grid
+ * @return	void
+ *
+ * Creates the MPI datatypes of the slices through the grid used to exchange
+ * ghost layers directly from Grid.val, and space for the requests. This is
+ * done by gAlloc() and must be done for grids allocated by other means before
+ * using gHaloOp(). Destroyed by gDestroyHalo(), which is called by gFree().
+ *
+ * @see gHaloOp
+ */
+void gCreateHalo(Grid *grid);
+
+/**
+ * @brief Destroys what was created by gCreateHalo()
+ * @param	grid	Grid
+ * @return	void
+ */
+void gDestroyHalo(Grid *grid);
+
+/**
+ * @brief Creates the datatypes of gHaloOpColorBegin()
+ * @param	grid	Grid
+ * @return	void
+ *
+ * Creates Grid.colorTypes. Neighboring subdomains must both have them or both
+ * not, and the sizes along each dimension must have the same parity for all
+ * subdomains, which is most easily ensured by only creating them where all
+ * true sizes are even. Destroyed by gDestroyColorHalo(), which is called by
+ * gFree().
+ */
+void gCreateColorHalo(Grid *grid);
+
+/**
+ * @brief Destroys what was created by gCreateColorHalo()
+ * @param	grid	Grid
+ * @return	void
+ *
+ * Does nothing if the grid has no Grid.colorTypes.
+ */
+void gDestroyColorHalo(Grid *grid);
+
+/**
+ * @brief Creates the datatypes of gHaloOpSingle()
+ * @param	grid	Grid
+ * @return	void
+ *
+ * Creates Grid.singleTypes. Destroyed by gDestroySingleHalo(), which is called
+ * by gFree() and does nothing if the grid has no Grid.singleTypes.
+ */
+void gCreateSingleHalo(Grid *grid);
+void gDestroySingleHalo(Grid *grid);
+
+/**
+ * @brief Creates a copy of a grid with deeper ghost layers
+ * @param	grid	Grid
+ * @param	depth	Number of ghost layers of the copy along each boundary
+ * @return	void
+ *
+ * Creates Grid.deep, which has the same true nodes as grid but depth ghost
+ * layers on every side. A stencil kernel needing one layer can then do depth
+ * sweeps per halo exchange, each on a region one layer smaller than the
+ * previous, at the price of redundantly computing the nodes in the ghost
+ * layers. This pays off where each exchange is mostly latency, such as on
+ * coarse multigrid levels (see multigrid:haloDepth):
+ *
+ * @code
+	gToDeep(phi);
+	gHaloOpDeepBegin(phi, mpiInfo);
+	gHaloOpDeepEnd(phi);
+	// Up to depth sweeps on phi->deep
+	gFromDeep(phi);
+ * @endcode
+ *
+ * depth must be at least the number of ghost layers of grid, and at most the
+ * true size of every subdomain. Destroyed by gDestroyDeepHalo(), which is
+ * called by gFree().
+ */
+void gCreateDeepHalo(Grid *grid, int depth);
+
+/**
+ * @brief Destroys what was created by gCreateDeepHalo()
+ * @param	grid	Grid
+ * @return	void
+ *
+ * Does nothing if grid has no deep halo.
+ */
+void gDestroyDeepHalo(Grid *grid);
+
+/**
+ * @brief Copies a grid into the middle of its deep copy
+ * @param	grid	Grid with a deep halo
+ * @return	void
+ *
+ * The true nodes and ghost layers of grid are copied. Only Grid.deep is
+ * modified. The rest of the ghost layers of the copy must be set by
+ * gHaloOpDeepBegin().
+ */
+void gToDeep(const Grid *grid);
+
+/**
+ * @brief Copies the middle of the deep copy of a grid back to the grid
+ * @param	grid	Grid with a deep halo
+ * @return	void
+ *
+ * The inverse of gToDeep(), including the ghost layers of grid.
+ */
+void gFromDeep(Grid *grid);
+
+/**
+ * @brief Starts exchanging all ghost layers of the deep copy of a grid
+ * @param	grid	Grid with a deep halo
+ * @param	mpiInfo	MpiInfo
+ * @return	void
+ *
+ * The ghost layers of Grid.deep, including edges and corners, are received
+ * from all 3^nDims-1 neighbors at once, so unlike gHaloOp() this takes only
+ * one round of messages. Ghost layers are always taken from the neighbors,
+ * which is only correct for periodic boundaries. Only Grid.deep is modified.
+ *
+ * @see gHaloOpDeepEnd
+ */
+void gHaloOpDeepBegin(const Grid *grid, const MpiInfo *mpiInfo);
+
+/**
+ * @brief Waits for the exchange started by gHaloOpDeepBegin() to complete
+ * @param	grid	Grid with a deep halo
+ * @return	void
+ */
+void gHaloOpDeepEnd(const Grid *grid);
+
 /**
  * @brief Extracts a (dim-1) dimensional slice of grid values.
  * @param	slice 		Return array
@@ -311,9 +730,25 @@ long int gTotTruesize(const Grid *grid, const MpiInfo *mpiInfo);
  * @brief Performs a central space finite difference on a grid
  * @param 	scalar 	Value to do the finite differencing on
  * @return	field	Field returned after derivating
+ *
+ * Only the true nodes of field are computed. The interior is computed before
+ * the shell, with gHaloOpEnd() in between, so a halo exchange of scalar
+ * started by gHaloOpBegin() is overlapped with the interior work. The same
+ * goes for gFinDiff2nd3D() and gFinDiff2ndND().
  */
 
-void gFinDiff1st(const Grid *scalar, Grid *field);
+void gFinDiff1st(Grid *scalar, Grid *field);
+
+/**
+ * @brief Same as gFinDiff1st(), but multiplies the result by a factor
+ * @param 	scalar 	Value to do the finite differencing on
+ * @param	factor	Factor to multiply by
+ * @return	field	Field returned after derivating
+ *
+ * This saves a pass through field compared to using gMul() afterwards, e.g.
+ * the electric field is gFinDiff1stScaled(phi, E, -1.).
+ */
+void gFinDiff1stScaled(Grid *scalar, Grid *field, double factor);
 
 /**
  * @brief Performs a 2nd order central space finite difference on a grid
@@ -322,7 +757,18 @@ void gFinDiff1st(const Grid *scalar, Grid *field);
  *
  *
  */
-void gFinDiff2nd3D(Grid *phi,const Grid *rho);
+void gFinDiff2nd3D(Grid *phi, Grid *rho);
+
+/**
+ * @brief Same as gFinDiff2nd3D(), but adds another grid to the result
+ * @param 	rho 		Value to do the finite differencing on
+ * @param	addition	Grid to add, or NULL
+ * @return	phi			Finite difference plus addition
+ *
+ * Adding while the result is in cache saves a pass through the grids, e.g.
+ * for the residual in mgResidual().
+ */
+void gFinDiff2nd3DAdd(Grid *phi, Grid *rho, const Grid *addition);
 
 /**
  * @brief Performs a 2nd order central space finite difference on a grid
@@ -331,7 +777,7 @@ void gFinDiff2nd3D(Grid *phi,const Grid *rho);
  *
  *
  */
-void gFinDiff2ndND(Grid *phi,const Grid *rho);
+void gFinDiff2ndND(Grid *phi, Grid *rho);
 
  /**
  * @brief Normalize E-field
@@ -364,7 +810,7 @@ void gNeutralizeGrid(Grid *rho, const MpiInfo *mpiInfo);
 * Adds one grid to another. result = result + addition
 *
 */
-void gAddTo(Grid *result, Grid *addition);
+void gAddTo(Grid *result, const Grid *addition);
 
 /**
 * @brief Subtracts a grid from another.
@@ -390,6 +836,16 @@ double gSumTruegrid(const Grid *grid);
 
 void gAssertNeutralGrid(const Grid *rho, const MpiInfo *mpiInfo);
 
+/**
+* @brief Asserts that a grid sum reduced across subdomains is neutral
+* @param	totSum	Sum of the true grid across all subdomains
+*
+* Same check as gAssertNeutralGrid() but for a gSumTruegrid() already reduced,
+* e.g. using a Reduction along with other diagnostics, rather than by its own
+* collective operation.
+*/
+void gAssertNeutralSum(double totSum);
+
 /**
  * @brief Applies boundary conditions to edge
  * @param 	grid		Grid to apply boundary conditions to
@@ -465,6 +921,20 @@ void gOpenH5(const dictionary *ini, Grid *grid, const MpiInfo *mpiInfo,
  */
 void gWriteH5(const Grid *grid, const MpiInfo *mpiInfo, double n);
 
+/**
+ * @brief	Stages the values in Grid to be stored in .grid.h5-file
+ * @param	stage			Stage
+ * @param	grid			Grid
+ * @param	mpiInfo			MpiInfo
+ * @param	n				Timestep of quantity to be stored
+ * @return	void
+ * @see		Stage, gWriteH5()
+ *
+ * As gWriteH5(), but the values are copied and written later by the Stage,
+ * such that the grid can be changed right away.
+ */
+void gWriteH5Staged(Stage *stage, const Grid *grid, const MpiInfo *mpiInfo, double n);
+
 /**
  * @brief	Read values from .grid.h5-fiel to Grid
  * @param	grid			Grid
@@ -487,6 +957,64 @@ void gReadH5(Grid *grid, const MpiInfo *mpiInfo, double n);
  */
 void gCloseH5(Grid *grid);
 
+/**
+ * @brief	Allocates GridOutput and creates its .grid.h5-file
+ * @param	ini				Dictionary to input file
+ * @param	grid			Grid to be stored
+ * @param	mpiInfo			MpiInfo
+ * @param	units			Units
+ * @param	denorm			Quantity denormalization factor
+ * @param	fName			Filename
+ * @return	GridOutput
+ * @see		GridOutput, gWriteOutput(), gOpenH5()
+ *
+ * The file is as that of gOpenH5(), except that the resolution is halved
+ * files:gridCoarsening times, such that the "Axis denormalization factor" is
+ * 2^gridCoarsening step sizes, and that each dataset is the mean
+ * (files:gridAccumulate = MEAN) or sum (SUM) of files:gridAverage time-steps,
+ * which is also stored in the attribute "Time-steps accumulated". With a
+ * coarsening of 0 and an average of 1 it's the same as gWriteH5() every
+ * time-step.
+ *
+ * The subdomains must be multiples of 2^gridCoarsening nodes. Remember to call
+ * gFreeOutput().
+ */
+GridOutput *gAllocOutput(const dictionary *ini, const Grid *grid,
+						 const MpiInfo *mpiInfo, const Units *units,
+						 double denorm, const char *fName);
+
+/**
+ * @brief	Reallocates GridOutput after the subdomains are changed
+ * @param	ini				Dictionary to input file
+ * @param	out				GridOutput
+ * @param	mpiInfo			MpiInfo
+ * @see		gResize()
+ *
+ * As by gResize(), the values summed so far are lost, and the next dataset is
+ * the mean or sum of fewer time-steps.
+ */
+void gResizeOutput(const dictionary *ini, GridOutput *out, const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Closes the .grid.h5-file and frees GridOutput
+ * @param	out				GridOutput
+ */
+void gFreeOutput(GridOutput *out);
+
+/**
+ * @brief	Adds the values of a time-step to GridOutput, and stores them
+ * @param	out				GridOutput
+ * @param	grid			Grid
+ * @param	mpiInfo			MpiInfo
+ * @param	n				Timestep of quantity to be stored
+ *
+ * Call it every time-step. Every files:gridAverage calls the values are
+ * restricted (see mgHalfRestrict3D() and mgHalfRestrictND()) and stored to a
+ * dataset named as by gWriteH5(), by the n of the last time-step. Only then it
+ * communicates and does I/O. Collective.
+ */
+void gWriteOutput(GridOutput *out, const Grid *grid, const MpiInfo *mpiInfo, double n);
+
 /**
  * @brief Creates a neighborhood in MpiInfo
  * @param			ini		Dictionary to input file
@@ -194,15 +194,19 @@ void msg(msgKind kind, const char* restrict format,...){
 		    break;
 	}
 
+	// Tag messages with the ensemble member, if any
+	char tag[32] = "";
+	if(simMember()>=0) snprintf(tag,sizeof(tag)," [member %i]",simMember());
+
 	// Parse and assemble message
 	int rank;
 	char msg[bufferSize], buffer[bufferSize];
-	MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+	MPI_Comm_rank(simComm(),&rank);
 	vsnprintf(msg,bufferSize,format,args);
 	if((kind&ALL)){
-		snprintf(buffer,bufferSize,"%s (%i): %s",prefix,rank,msg);
+		snprintf(buffer,bufferSize,"%s%s (%i): %s",prefix,tag,rank,msg);
 	} else {
-		snprintf(buffer,bufferSize,"%s: %s",prefix,msg);
+		snprintf(buffer,bufferSize,"%s%s: %s",prefix,tag,msg);
 	}
 	va_end(args);
 
@@ -270,10 +274,14 @@ dictionary* iniOpen(int argc, char *argv[]){
 			free(nSubdomains);
 			exit(0);
 		} else {
-			char *value = strstr(argv[i],"=");
+			// Copied such that argv can be parsed again later
+			char *key = strdup(argv[i]);
+			char *value = strstr(key,"=");
+			if(value==NULL) msg(ERROR,"Expected key=value, got '%s'",key);
 			*value = '\0';
 			value++;
-			iniparser_set(ini,argv[i],value);
+			iniparser_set(ini,key,value);
+			free(key);
 		}
 	}
 
@@ -578,7 +586,7 @@ hid_t openH5File(const dictionary *ini, const char *fName, const char *fSubExt){
 
 	// Enable MPI-I/O access
 	hid_t pList = H5Pcreate(H5P_FILE_ACCESS);
-	H5Pset_fapl_mpio(pList,MPI_COMM_WORLD,MPI_INFO_NULL);
+	H5Pset_fapl_mpio(pList,simComm(),MPI_INFO_NULL);
 
 	// Make sure parent folder exist
 	if(makePath(fTotName))
@@ -658,6 +666,18 @@ void createH5Group(hid_t h5, const char *name){
 }
 
 
+hid_t createH5RowsPList(long int nRowsChunk, int deflate, long int nRows, int nCols){
+
+	if(nRowsChunk == 0) return H5P_DEFAULT;
+
+	hsize_t chunkDims[] = {nRowsChunk < nRows ? nRowsChunk : nRows, nCols};
+	hid_t pList = H5Pcreate(H5P_DATASET_CREATE);
+	H5Pset_chunk(pList, 2, chunkDims);
+	if(deflate) H5Pset_deflate(pList, deflate);
+
+	return pList;
+}
+
 hid_t xyOpenH5(const dictionary *ini, const char *fName){
 
 	return openH5File(ini,fName,"xy");
@@ -666,14 +686,18 @@ hid_t xyOpenH5(const dictionary *ini, const char *fName){
 void xyCreateDataset(hid_t h5, const char *name){
 
 	int mpiRank;
-	MPI_Comm_rank(MPI_COMM_WORLD,&mpiRank);
+	MPI_Comm_rank(simComm(),&mpiRank);
 
 	createH5Group(h5,name);	// Creates parent groups
 
+	// Rows are appended to an existing dataset, e.g. after a restart
+	if(H5Lexists(h5,name,H5P_DEFAULT)) return;
+
 	const int arrSize=2;
 
-	// Enable chunking of data in order to use extendible (unlimited) datasets
-	hsize_t chunkDims[] = {1,2};
+	// Enable chunking of data in order to use extendible (unlimited) datasets.
+	// Chunks of many rows makes appending rows cheap.
+	hsize_t chunkDims[] = {256,2};
 	hid_t pList = H5Pcreate(H5P_DATASET_CREATE);
     H5Pset_chunk(pList, arrSize, chunkDims);
 
@@ -692,11 +716,12 @@ void xyCreateDataset(hid_t h5, const char *name){
 void xyWrite(hid_t h5, const char* name, double x, double y, MPI_Op op){
 
 	int mpiRank;
-	MPI_Comm_rank(MPI_COMM_WORLD,&mpiRank);
+	MPI_Comm_rank(simComm(),&mpiRank);
 
-	// Reduce data across nodes
-	double yReduced;
-	MPI_Reduce(&y,&yReduced,1,MPI_DOUBLE,op,0,MPI_COMM_WORLD);
+	// Reduce data across nodes unless already done
+	double yReduced = y;
+	if(op!=MPI_OP_NULL)
+		MPI_Reduce(&y,&yReduced,1,MPI_DOUBLE,op,0,simComm());
 
 	// Load dataset
 	hid_t dataset = H5Dopen(h5,name,H5P_DEFAULT);
@@ -738,6 +763,489 @@ void xyCloseH5(hid_t h5){
 	H5Fclose(h5);
 }
 
+/**
+ * @brief A dataset written to through an XyBuffer
+ */
+typedef struct XySeries{
+	char name[64];
+	hid_t dataset;
+	long int nRows;		///< Buffered rows
+} XySeries;
+
+XyBuffer *xyBufAlloc(const dictionary *ini, hid_t h5){
+
+	long int interval = iniGetLongInt(ini, "files:historyInterval");
+	if(interval < 1) msg(ERROR, "files:historyInterval must be at least 1");
+
+	XyBuffer *buf = malloc(sizeof(*buf));
+	buf->h5 = h5;
+	buf->interval = interval;
+	buf->nSeries = 0;
+	buf->nSeriesAlloc = 0;
+	buf->series = NULL;
+	buf->nRows = 0;
+	buf->nRowsAlloc = 0;
+	buf->rowSeries = NULL;
+	buf->x = NULL;
+	buf->y = NULL;
+	buf->op = NULL;
+	MPI_Comm_dup(simComm(), &buf->comm);
+
+	return buf;
+}
+
+void xyBufFree(XyBuffer *buf){
+
+	xyBufFlush(buf);
+
+	for(int i=0; i<buf->nSeries; i++) H5Dclose(buf->series[i].dataset);
+
+	free(buf->series);
+	free(buf->rowSeries);
+	free(buf->x);
+	free(buf->y);
+	free(buf->op);
+	MPI_Comm_free(&buf->comm);
+	free(buf);
+}
+
+void xyBufFlush(XyBuffer *buf){
+
+	int mpiRank;
+	MPI_Comm_rank(buf->comm, &mpiRank);
+
+	long int nRows = buf->nRows;
+	if(!nRows) return;
+
+	// One reduction per MPI_Op of all rows using it
+	double *local = malloc(2*nRows*sizeof(*local));
+	double *global = local + nRows;
+	int *done = calloc(nRows, sizeof(*done));
+
+	for(long int r=0; r<nRows; r++){
+
+		MPI_Op op = buf->op[r];
+		if(done[r] || op == MPI_OP_NULL) continue;
+
+		int n = 0;
+		for(long int q=r; q<nRows; q++){
+			if(buf->op[q] == op) local[n++] = buf->y[q];
+		}
+
+		MPI_Reduce(local, global, n, MPI_DOUBLE, op, 0, buf->comm);
+
+		n = 0;
+		for(long int q=r; q<nRows; q++){
+			if(buf->op[q] == op){
+				if(mpiRank == 0) buf->y[q] = global[n];
+				n++;
+				done[q] = 1;
+			}
+		}
+	}
+
+	free(done);
+
+	// One extension and one write per dataset
+	double *data = local;
+	for(int i=0; i<buf->nSeries; i++){
+
+		XySeries *series = &buf->series[i];
+		if(!series->nRows) continue;
+
+		hid_t fileSpace = H5Dget_space(series->dataset);
+		hsize_t fileDims[2];
+		H5Sget_simple_extent_dims(fileSpace, fileDims, NULL);
+		H5Sclose(fileSpace);
+
+		hsize_t offset[] = {fileDims[0], 0};
+		fileDims[0] += series->nRows;
+		H5Dset_extent(series->dataset, fileDims); // Must be done on all nodes
+		fileSpace = H5Dget_space(series->dataset);
+
+		if(mpiRank == 0){
+			long int n = 0;
+			for(long int r=0; r<nRows; r++){
+				if(buf->rowSeries[r] == i){
+					data[2*n] = buf->x[r];
+					data[2*n+1] = buf->y[r];
+					n++;
+				}
+			}
+
+			hsize_t memDims[] = {n, 2};
+			H5Sselect_hyperslab(fileSpace, H5S_SELECT_SET, offset, NULL, memDims, NULL);
+			hid_t memSpace = H5Screate_simple(2, memDims, NULL);
+			H5Dwrite(series->dataset, H5T_NATIVE_DOUBLE, memSpace, fileSpace,
+					 H5P_DEFAULT, data);
+			H5Sclose(memSpace);
+		}
+
+		H5Sclose(fileSpace);
+		series->nRows = 0;
+	}
+
+	free(local);
+	buf->nRows = 0;
+}
+
+void xyBufWrite(XyBuffer *buf, const char *name, double x, double y, MPI_Op op){
+
+	// Find the dataset, or open it the first time it's written to
+	int i = 0;
+	while(i < buf->nSeries && strcmp(buf->series[i].name, name)) i++;
+
+	if(i == buf->nSeries){
+
+		if(strlen(name) >= sizeof(buf->series[i].name))
+			msg(ERROR, "Too long dataset name '%s'", name);
+
+		if(buf->nSeries == buf->nSeriesAlloc){
+			buf->nSeriesAlloc = buf->nSeriesAlloc ? 2*buf->nSeriesAlloc : 8;
+			buf->series = realloc(buf->series, buf->nSeriesAlloc*sizeof(*buf->series));
+		}
+
+		XySeries *series = &buf->series[i];
+		strcpy(series->name, name);
+		series->dataset = H5Dopen(buf->h5, name, H5P_DEFAULT);
+		series->nRows = 0;
+		buf->nSeries++;
+	}
+
+	if(buf->nRows == buf->nRowsAlloc){
+		long int nAlloc = buf->nRowsAlloc ? 2*buf->nRowsAlloc : 64;
+		buf->rowSeries = realloc(buf->rowSeries, nAlloc*sizeof(*buf->rowSeries));
+		buf->x = realloc(buf->x, nAlloc*sizeof(*buf->x));
+		buf->y = realloc(buf->y, nAlloc*sizeof(*buf->y));
+		buf->op = realloc(buf->op, nAlloc*sizeof(*buf->op));
+		buf->nRowsAlloc = nAlloc;
+	}
+
+	long int r = buf->nRows++;
+	buf->rowSeries[r] = i;
+	buf->x[r] = x;
+	buf->y[r] = y;
+	buf->op[r] = op;
+
+	if(++buf->series[i].nRows >= buf->interval) xyBufFlush(buf);
+}
+
+/******************************************************************************
+ * DEFINING STAGING FUNCTIONS
+ *****************************************************************************/
+
+/**
+ * @brief A dataset staged by stAdd() or stAddRows()
+ *
+ * If memSpace is 0, the data is nRows rows of nCols, and the spaces and
+ * creation property list are made when flushing.
+ */
+typedef struct StagedDataset{
+	hid_t h5;
+	char name[64];
+	hid_t memType;
+	hid_t fileType;
+	hid_t memSpace;
+	hid_t fileSpace;
+	void *data;
+	long int nBytes;
+	long int nRows;
+	int nCols;
+	long int nRowsChunk;
+	int deflate;
+} StagedDataset;
+
+Stage *stAlloc(const dictionary *ini){
+
+	double budget = iniGetDouble(ini, "files:stagingBudget");
+	if(budget < 0) msg(ERROR, "files:stagingBudget can't be negative");
+
+	Stage *stage = malloc(sizeof(*stage));
+	stage->budget = (long int)(budget*1024*1024);
+	stage->nBytes = 0;
+	stage->nBytesMax = 0;
+	stage->nBytesSent = 0;
+	stage->request = MPI_REQUEST_NULL;
+	stage->n = 0;
+	stage->nAlloc = 0;
+	stage->datasets = NULL;
+	MPI_Comm_dup(simComm(), &stage->comm);
+
+	return stage;
+}
+
+void stFree(Stage *stage){
+
+	stFlush(stage);
+	MPI_Comm_free(&stage->comm);
+	free(stage->datasets);
+	free(stage);
+}
+
+/**
+ * @brief Writes one staged dataset and frees its data
+ */
+static void stWrite(Stage *stage, StagedDataset *set){
+
+	hid_t memSpace = set->memSpace;
+	hid_t fileSpace = set->fileSpace;
+	hid_t createList = H5P_DEFAULT;
+
+	if(!memSpace){
+
+		int mpiRank, mpiSize;
+		MPI_Comm_rank(stage->comm, &mpiRank);
+		MPI_Comm_size(stage->comm, &mpiSize);
+
+		long int *offsets = malloc((mpiSize+1)*sizeof(*offsets));
+		offsets[0] = 0;
+		MPI_Allgather(&set->nRows, 1, MPI_LONG, &offsets[1], 1, MPI_LONG, stage->comm);
+		for(int r = 1; r <= mpiSize; r++) offsets[r] += offsets[r-1];
+
+		long int nRowsTotal = offsets[mpiSize];
+		hsize_t fileDims[] = {nRowsTotal, set->nCols};
+		hsize_t memDims[] = {set->nRows, set->nCols};
+		hsize_t offset[] = {offsets[mpiRank], 0};
+		free(offsets);
+
+		// HDF5 may crash on empty datasets
+		if(!nRowsTotal){
+			msg(WARNING, "No rows of %s to store in .h5-file", set->name);
+			free(set->data);
+			return;
+		}
+
+		memSpace = H5Screate_simple(2, memDims, NULL);
+		fileSpace = H5Screate_simple(2, fileDims, NULL);
+		H5Sselect_hyperslab(fileSpace, H5S_SELECT_SET, offset, NULL, memDims, NULL);
+		createList = createH5RowsPList(set->nRowsChunk, set->deflate,
+									   nRowsTotal, set->nCols);
+	}
+
+	hid_t pList = H5Pcreate(H5P_DATASET_XFER);
+	H5Pset_dxpl_mpio(pList, H5FD_MPIO_COLLECTIVE);
+
+	hid_t dataset = H5Dcreate(set->h5, set->name, set->fileType, fileSpace,
+							  H5P_DEFAULT, createList, H5P_DEFAULT);
+	H5Dwrite(dataset, set->memType, memSpace, fileSpace, pList, set->data);
+
+	H5Dclose(dataset);
+	H5Pclose(pList);
+	if(createList != H5P_DEFAULT) H5Pclose(createList);
+	H5Sclose(memSpace);
+	H5Sclose(fileSpace);
+	free(set->data);
+}
+
+void stFlush(Stage *stage){
+
+	MPI_Wait(&stage->request, MPI_STATUS_IGNORE);
+
+	for(int i = 0; i < stage->n; i++) stWrite(stage, &stage->datasets[i]);
+
+	stage->n = 0;
+	stage->nBytes = 0;
+	stage->nBytesMax = 0;
+}
+
+/**
+ * @brief Appends a dataset to the stage, flushing first if over budget
+ */
+static void stPush(Stage *stage, StagedDataset set){
+
+	// nBytesMax is that of the previous staging, and the same on all nodes
+	MPI_Wait(&stage->request, MPI_STATUS_IGNORE);
+	if(stage->nBytesMax > stage->budget) stFlush(stage);
+
+	if(stage->n == stage->nAlloc){
+		stage->nAlloc = stage->nAlloc ? 2*stage->nAlloc : 16;
+		stage->datasets = realloc(stage->datasets,
+								  stage->nAlloc*sizeof(*stage->datasets));
+	}
+	stage->datasets[stage->n++] = set;
+	stage->nBytes += set.nBytes;
+
+	if(stage->budget == 0){
+		stFlush(stage);
+	} else {
+		stage->nBytesSent = stage->nBytes;
+		MPI_Iallreduce(&stage->nBytesSent, &stage->nBytesMax, 1, MPI_LONG,
+					   MPI_MAX, stage->comm, &stage->request);
+	}
+}
+
+void stAdd(Stage *stage, hid_t h5, const char *name, hid_t memType,
+		   hid_t memSpace, hid_t fileSpace, void *data, long int nBytes){
+
+	StagedDataset set;
+	set.h5 = h5;
+	snprintf(set.name, sizeof(set.name), "%s", name);
+	set.memType = memType;
+	set.fileType = H5T_IEEE_F64LE;
+	set.memSpace = H5Scopy(memSpace);
+	set.fileSpace = H5Scopy(fileSpace);
+	set.data = data;
+	set.nBytes = nBytes;
+	set.nRows = 0;
+	set.nCols = 0;
+	set.nRowsChunk = 0;
+	set.deflate = 0;
+
+	stPush(stage, set);
+}
+
+void stAddRows(Stage *stage, hid_t h5, const char *name, hid_t memType,
+			   hid_t fileType, long int nRowsChunk, int deflate,
+			   void *data, long int nRows, int nCols){
+
+	StagedDataset set;
+	set.h5 = h5;
+	snprintf(set.name, sizeof(set.name), "%s", name);
+	set.memType = memType;
+	set.fileType = fileType;
+	set.memSpace = 0;
+	set.fileSpace = 0;
+	set.data = data;
+	set.nBytes = nRows*nCols*H5Tget_size(memType);
+	set.nRows = nRows;
+	set.nCols = nCols;
+	set.nRowsChunk = nRowsChunk;
+	set.deflate = deflate;
+
+	stPush(stage, set);
+}
+
+/******************************************************************************
+ * DEFINING CHECKPOINT FUNCTIONS
+ *****************************************************************************/
+
+/**
+ * @brief Name of the checkpoint file of this MPI node (malloc'ed)
+ *
+ * The prefix files:output is applied as by openH5File().
+ */
+static char *ckFileName(const dictionary *ini, const char *suffix){
+
+	int mpiRank;
+	MPI_Comm_rank(simComm(), &mpiRank);
+
+	char *fPrefix = iniGetStr(ini,"files:output");
+
+	char sep[2] = "\0\0";
+	char lastchar = fPrefix[strlen(fPrefix)-1];
+	if(strcmp(fPrefix,".")==0) sep[0]='/';
+	else if(strlen(fPrefix)>0 && lastchar!='/') sep[0]='_';
+
+	char rank[16];
+	sprintf(rank, "%i", mpiRank);
+
+	char *fTotName = strCatAlloc(5, fPrefix, sep, "checkpoint.", rank, suffix);
+	free(fPrefix);
+
+	return fTotName;
+}
+
+hid_t ckCreate(const dictionary *ini, long int n){
+
+	char *fName = ckFileName(ini, ".ck.h5.tmp");
+
+	if(makePath(fName))
+		msg(ERROR,"Could not open or create folder for '%s'.",fName);
+
+	hid_t ck = H5Fcreate(fName, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+	if(ck<0) msg(ERROR|ALL, "Could not create checkpoint '%s'", fName);
+	free(fName);
+
+	int mpiSize;
+	MPI_Comm_size(simComm(), &mpiSize);
+	long int header[] = {n, mpiSize};
+	ckWrite(ck, "header", H5T_NATIVE_LONG, header, 2);
+
+	return ck;
+}
+
+void ckClose(const dictionary *ini, hid_t ck){
+
+	H5Fclose(ck);
+
+	// Replace the previous checkpoint only once this one is complete
+	char *fTmpName = ckFileName(ini, ".ck.h5.tmp");
+	char *fName = ckFileName(ini, ".ck.h5");
+	if(rename(fTmpName, fName))
+		msg(ERROR|ALL, "Could not rename '%s' to '%s'", fTmpName, fName);
+	free(fTmpName);
+	free(fName);
+
+	MPI_Barrier(simComm());
+}
+
+hid_t ckOpen(const dictionary *ini, long int *n){
+
+	char *fName = ckFileName(ini, ".ck.h5");
+
+	hid_t ck = H5Fopen(fName, H5F_ACC_RDONLY, H5P_DEFAULT);
+	if(ck<0) msg(ERROR|ALL, "Could not open checkpoint '%s'", fName);
+	free(fName);
+
+	int mpiSize;
+	MPI_Comm_size(simComm(), &mpiSize);
+	long int header[2];
+	ckRead(ck, "header", H5T_NATIVE_LONG, header, 2);
+	if(header[1] != mpiSize)
+		msg(ERROR, "Checkpoint was made by %li MPI nodes, not %i",
+			header[1], mpiSize);
+
+	// All nodes must continue from the same time-step
+	long int nMin, nMax;
+	MPI_Allreduce(&header[0], &nMin, 1, MPI_LONG, MPI_MIN, simComm());
+	MPI_Allreduce(&header[0], &nMax, 1, MPI_LONG, MPI_MAX, simComm());
+	if(nMin != nMax)
+		msg(ERROR, "Checkpoints are of different time-steps (%li to %li)",
+			nMin, nMax);
+
+	*n = header[0];
+	return ck;
+}
+
+void ckWrite(hid_t ck, const char *name, hid_t memType, const void *data,
+			 long int n){
+
+	hsize_t dims[] = {n};
+	hid_t space = H5Screate_simple(1, dims, NULL);
+	hid_t dataset = H5Dcreate(ck, name, memType, space,
+							  H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	if(n) H5Dwrite(dataset, memType, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
+	H5Dclose(dataset);
+	H5Sclose(space);
+}
+
+void ckRead(hid_t ck, const char *name, hid_t memType, void *data, long int n){
+
+	hid_t dataset = H5Dopen(ck, name, H5P_DEFAULT);
+	if(dataset<0) msg(ERROR|ALL, "Dataset '%s' missing in checkpoint", name);
+
+	hid_t space = H5Dget_space(dataset);
+	hssize_t nStored = H5Sget_simple_extent_npoints(space);
+	if(nStored != n)
+		msg(ERROR|ALL, "Checkpoint has %li elements of '%s', not %li",
+			(long int)nStored, name, n);
+
+	if(n) H5Dread(dataset, memType, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
+	H5Sclose(space);
+	H5Dclose(dataset);
+}
+
+void ckWriteRng(hid_t ck, const char *name, const gsl_rng *rng){
+
+	// The state of the generators in GSL is plain data
+	ckWrite(ck, name, H5T_NATIVE_UCHAR, gsl_rng_state(rng), gsl_rng_size(rng));
+}
+
+void ckReadRng(hid_t ck, const char *name, gsl_rng *rng){
+
+	ckRead(ck, name, H5T_NATIVE_UCHAR, gsl_rng_state(rng), gsl_rng_size(rng));
+}
+
 /******************************************************************************
  * DEFINING LOCAL LIST PARSING FUNCTIONS
  *****************************************************************************/
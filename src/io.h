@@ -132,7 +132,9 @@ funPtr selectInner(dictionary *ini, const char *key, const char *string,...);
  *
  * The message will by default be printed only once. However, the message
  * kind can be bitwise ORed with ALL, e.g. STATUS|ALL, to print on all MPI
- * nodes.
+ * nodes. "Once" and the rank printed with ALL both refer to simComm(), so in
+ * an ensemble each member prints its own messages, tagged with the member
+ * number, e.g. "STATUS [member 1]: ...".
  */
 void msg(msgKind kind, const char* restrict format,...);
 
@@ -358,6 +360,19 @@ hid_t openH5File(const dictionary* ini, const char *fName, const char *fSubExt);
  */
 void setH5Attr(hid_t h5, const char *name, const double *value, int size);
 
+/**
+ * @brief Creates the property list of a dataset of rows
+ * @param	nRowsChunk	Rows per chunk (0 for a contiguous dataset)
+ * @param	deflate		Deflate (gzip) compression level 0-9 (0 for none)
+ * @param	nRows		Rows of the dataset
+ * @param	nCols		Columns of the dataset
+ * @return	Dataset creation property list, or H5P_DEFAULT
+ *
+ * Chunks are cut to nRows, as they can't be larger than a fixed size dataset.
+ * Close the return value using H5Pclose() unless it's H5P_DEFAULT.
+ */
+hid_t createH5RowsPList(long int nRowsChunk, int deflate, long int nRows, int nCols);
+
 /**
  * @brief Creates a group in a .h5-file recursively
  * @param	h5		.h5-file identifier
@@ -399,7 +414,7 @@ void xyCloseH5(hid_t h5);
  * @param	name	Dataset name
  * @param	x		x-value
  * @param	y		y-value
- * @param	op		MPI reduction operation performed on y
+ * @param	op		MPI reduction operation performed on y, or MPI_OP_NULL
  * @return	void
  *
  * A datapoint on a curve in the xy-plane is appended at the end of a dataset in
@@ -409,7 +424,8 @@ void xyCloseH5(hid_t h5);
  * In parallel executions, the y value is reduced across all MPI nodes using the
  * specified MPI reduction operation, for instance MPI_SUM to sum the y-value of
  * all MPI nodes before writing to file. If the x value differs amongst the
- * nodes, the x-value of rank 0 is simply used.
+ * nodes, the x-value of rank 0 is simply used. If y is already reduced, e.g.
+ * using a Reduction, specify MPI_OP_NULL to write the y-value of rank 0 as is.
  *
  * The dataset must be created beforehand by calling xyCreateDataset() and the
  * file is created by xyOpenH5(). Remember to close the H5 file using
@@ -441,10 +457,222 @@ void xyWrite(hid_t h5, const char* name, double x, double y, MPI_Op op);
  * @return			void
  *
  * Creates a dataset specified by its name and all parent groups with it. For
- * example, see xyWrite().
+ * example, see xyWrite(). An existing dataset is left as is, such that rows are
+ * appended to it.
  */
 void xyCreateDataset(hid_t h5, const char *name);
 
+/**
+ * @brief Allocates a buffer of rows for (x,y) datasets in a .xy.h5-file
+ * @param	ini		Dictionary to input file
+ * @param	h5		.xy.h5-file identifier
+ * @return	XyBuffer
+ * @see		XyBuffer
+ *
+ * Rows are flushed when some dataset has files:historyInterval rows buffered.
+ * Collective.
+ */
+XyBuffer *xyBufAlloc(const dictionary *ini, hid_t h5);
+
+/**
+ * @brief Flushes and frees an XyBuffer
+ * @param	buf		XyBuffer
+ *
+ * Collective. Must be called before the .xy.h5-file is closed.
+ */
+void xyBufFree(XyBuffer *buf);
+
+/**
+ * @brief Reduces and writes all buffered rows
+ * @param	buf		XyBuffer
+ *
+ * Collective.
+ */
+void xyBufFlush(XyBuffer *buf);
+
+/**
+ * @brief Buffers an (x,y) datapoint to be written to a dataset
+ * @param	buf		XyBuffer
+ * @param	name	Dataset name
+ * @param	x		x-value
+ * @param	y		y-value
+ * @param	op		MPI reduction operation performed on y, or MPI_OP_NULL
+ * @return	void
+ *
+ * As xyWrite(), except that the row is buffered. The dataset must be created
+ * beforehand by xyCreateDataset(). May flush the buffer, and is thus collective.
+ */
+void xyBufWrite(XyBuffer *buf, const char *name, double x, double y, MPI_Op op);
+
+/**
+ * @name Staging of H5 output
+ * @see Stage
+ */
+///@{
+
+/**
+ * @brief Allocates a Stage with a budget of files:stagingBudget MiB
+ * @param	ini		Input file
+ * @return	Stage
+ *
+ * Remember to free using stFree().
+ */
+Stage *stAlloc(const dictionary *ini);
+
+/**
+ * @brief Writes all staged datasets, and frees the Stage
+ * @param	stage	Stage
+ *
+ * Collective. Must be called before the files staged to are closed.
+ */
+void stFree(Stage *stage);
+
+/**
+ * @brief Writes all staged datasets
+ * @param	stage	Stage
+ *
+ * Collective. The datasets are written in the order they were staged.
+ */
+void stFlush(Stage *stage);
+
+/**
+ * @brief Stages a dataset of a fixed hyperslab
+ * @param	stage		Stage
+ * @param	h5			File to write to
+ * @param	name		Name of the dataset
+ * @param	memType		Datatype of data
+ * @param	memSpace	Selection of data to write (copied)
+ * @param	fileSpace	Space and selection of this MPI node in the file (copied)
+ * @param	data		Data (malloc'ed, taken over by the Stage)
+ * @param	nBytes		Size of data
+ *
+ * The dataset is stored as H5T_IEEE_F64LE, as by gWriteH5().
+ */
+void stAdd(Stage *stage, hid_t h5, const char *name, hid_t memType,
+		   hid_t memSpace, hid_t fileSpace, void *data, long int nBytes);
+
+/**
+ * @brief Stages a dataset of rows concatenated across MPI nodes
+ * @param	stage		Stage
+ * @param	h5			File to write to
+ * @param	name		Name of the dataset
+ * @param	memType		Datatype of data
+ * @param	fileType	Datatype in the file
+ * @param	nRowsChunk	Rows per chunk, see createH5RowsPList()
+ * @param	deflate		Compression level, see createH5RowsPList()
+ * @param	data		nRows*nCols elements (malloc'ed, taken over by the Stage)
+ * @param	nRows		Number of rows of this MPI node
+ * @param	nCols		Number of columns
+ *
+ * The rows are laid out in the order of the MPI ranks, as pWriteH5() does. The
+ * offsets are found when flushing, and a dataset with no rows on any node is
+ * skipped with a warning.
+ */
+void stAddRows(Stage *stage, hid_t h5, const char *name, hid_t memType,
+			   hid_t fileType, long int nRowsChunk, int deflate,
+			   void *data, long int nRows, int nCols);
+
+///@}
+
+/**
+ * @name Checkpoint and restart
+ *
+ * Each MPI node writes its own checkpoint file without any communication,
+ * named "checkpoint.<rank>.ck.h5" and prefixed by files:output. A restart must
+ * therefore use the same number of MPI nodes and the same input file. The file
+ * is first written as "<name>.tmp" and then renamed, such that a node failure
+ * while checkpointing leaves the previous checkpoint intact.
+ *
+ * Example:
+ * @code
+ *	hid_t ck = ckCreate(ini, n);
+ *	pWriteCheckpoint(ck, pop);
+ *	gWriteCheckpoint(ck, "phi", phi);
+ *	ckWriteRng(ck, "rng", rng);
+ *	ckClose(ini, ck);
+ *
+ *	long int n;
+ *	ck = ckOpen(ini, &n);
+ *	pReadCheckpoint(ck, pop);
+ *	...
+ *	H5Fclose(ck);
+ * @endcode
+ *
+ * The data is stored in the native format of the machine, and is read back
+ * bit for bit.
+ */
+///@{
+
+/**
+ * @brief Creates the checkpoint file of this MPI node
+ * @param	ini		Input file
+ * @param	n		Time-step of the checkpoint
+ * @return	File identifier
+ */
+hid_t ckCreate(const dictionary *ini, long int n);
+
+/**
+ * @brief Closes a created checkpoint file, replacing the previous one
+ * @param	ini		Input file
+ * @param	ck		File identifier
+ *
+ * Collective, such that the checkpoints of all nodes are replaced before any
+ * node goes on.
+ */
+void ckClose(const dictionary *ini, hid_t ck);
+
+/**
+ * @brief Opens the checkpoint file of this MPI node for reading
+ * @param	ini		Input file
+ * @param[out]	n	Time-step of the checkpoint
+ * @return	File identifier (close with H5Fclose())
+ *
+ * Collective. Fails if the checkpoint was made by another number of MPI nodes
+ * or the nodes' checkpoints are of different time-steps.
+ */
+hid_t ckOpen(const dictionary *ini, long int *n);
+
+/**
+ * @brief Writes a one-dimensional dataset to a checkpoint
+ * @param	ck		File identifier
+ * @param	name	Dataset name
+ * @param	memType	Datatype of data, also used in the file
+ * @param	data	Data
+ * @param	n		Number of elements
+ */
+void ckWrite(hid_t ck, const char *name, hid_t memType, const void *data,
+			 long int n);
+
+/**
+ * @brief Reads a one-dimensional dataset from a checkpoint
+ * @param	ck		File identifier
+ * @param	name	Dataset name
+ * @param	memType	Datatype of data
+ * @param[out]	data	Data
+ * @param	n		Number of elements expected
+ *
+ * Fails if the dataset doesn't have n elements.
+ */
+void ckRead(hid_t ck, const char *name, hid_t memType, void *data, long int n);
+
+/**
+ * @brief Writes the state of a GSL random number generator to a checkpoint
+ * @param	ck		File identifier
+ * @param	name	Dataset name
+ * @param	rng		Generator
+ */
+void ckWriteRng(hid_t ck, const char *name, const gsl_rng *rng);
+
+/**
+ * @brief Reads the state of a GSL random number generator from a checkpoint
+ * @param	ck		File identifier
+ * @param	name	Dataset name
+ * @param	rng		Generator of the same type as the one written
+ */
+void ckReadRng(hid_t ck, const char *name, gsl_rng *rng);
+
+///@}
+
 /**
  * @brief Writes grid structs to a parsefile
  * @param ini 		dictionary of the input file
@@ -16,14 +16,29 @@
 void regular(dictionary *ini);
 funPtr regular_set(dictionary *ini){ return regular; }
 
+void poissonBenchmark(dictionary *ini);
+funPtr poissonBenchmark_set(dictionary *ini){ return poissonBenchmark; }
+
+void scaling(dictionary *ini);
+funPtr scaling_set(dictionary *ini){ return scaling; }
+
+void ensemble(dictionary *ini);
+funPtr ensemble_set(dictionary *ini){ return ensemble; }
+
 int main(int argc, char *argv[]){
 
 	/*
 	 * INITIALIZE PINC
 	 */
-	MPI_Init(&argc,&argv);
+	int threadSupport;
+	MPI_Init_thread(&argc,&argv,MPI_THREAD_FUNNELED,&threadSupport);
 	dictionary *ini = iniOpen(argc,argv); // No printing before this
 	msg(STATUS, "PINC %s started.", VERSION);    // Needs MPI
+	if(threadSupport < MPI_THREAD_FUNNELED)
+		msg(WARNING, "MPI library does not support threads");
+	thSetup(ini);
+	tRegionSetup(ini);
+	chSetup(ini);
 	MPI_Barrier(MPI_COMM_WORLD);
 
 	/*
@@ -32,9 +47,16 @@ int main(int argc, char *argv[]){
 	void (*run)() = select(ini,"methods:mode",	regular_set,
 												mgMode_set,
 												mgModeErrorScaling_set,
-												sMode_set);
+												sMode_set,
+												poissonBenchmark_set,
+												scaling_set,
+												ensemble_set);
 	run(ini);
 
+	tRegionReport();
+	tRegionFree();
+	simFreeComm();
+
 	/*
 	 * FINALIZE PINC
 	 */
@@ -57,25 +79,54 @@ void regular(dictionary *ini){
 												puAccND1_set,
 												puAccND1KE_set,
 												puAccND0_set,
-												puAccND0KE_set);
+												puAccND0KE_set,
+												puAcc3D1SoA_set,
+												puAcc3D1KESoA_set,
+												puBoris3D1_set,
+												puBoris3D1KE_set,
+												puAccND2_set,
+												puAccND2KE_set,
+												puAcc3D1KEOffload_set,
+												puAcc3D1KEWeighted_set,
+												puAcc3D1Phi_set,
+												puAcc3D1KEPhi_set);
 
 	void (*distr)() 			= select(ini,	"methods:distr",
 												puDistr3D1_set,
 												puDistrND1_set,
-												puDistrND0_set);
+												puDistrND0_set,
+												puDistr3D1Threaded_set,
+												puDistrND1Threaded_set,
+												puDistr3D1SoA_set,
+												puDistrND2_set,
+												puDistr3D1Offload_set,
+												puDistr3D1Weighted_set);
 
 	void (*extractEmigrants)()	= select(ini,	"methods:migrate",
 												puExtractEmigrants3D_set,
-												puExtractEmigrantsND_set);
+												puExtractEmigrantsND_set,
+												puExtractEmigrants3DSoA_set,
+												puExtractEmigrants3DOffload_set,
+												puExtractEmigrants3DWeighted_set,
+												puExtractEmigrants3DShell_set);
+
+	void (*sweep)()				= select(ini,	"methods:sweep",
+												puSweepSplit_set,
+												puSweepFused3D1_set,
+												puSweepOffload_set);
 
 	void (*solverInterface)()	= select(ini,	"methods:poisson",
 												mgSolver_set,
-												sSolver_set);
+												sSolver_set,
+												mgcgSolver_set);
 
 	void (*solve)() = NULL;
 	void *(*solverAlloc)() = NULL;
 	void (*solverFree)() = NULL;
-	solverInterface(&solve, &solverAlloc, &solverFree);
+	void (*solverWriteCheckpoint)() = NULL;	// NULL if stateless
+	void (*solverReadCheckpoint)() = NULL;
+	solverInterface(&solve, &solverAlloc, &solverFree,
+					&solverWriteCheckpoint, &solverReadCheckpoint);
 
 	/*
 	 * INITIALIZE PINC VARIABLES
@@ -85,10 +136,14 @@ void regular(dictionary *ini){
 
 	MpiInfo *mpiInfo = gAllocMpi(ini);
 	Population *pop = pAlloc(ini);
-	Grid *E   = gAlloc(ini, VECTOR);
+	puGet3DRotationParameters(ini, pop->T, pop->S);
+	// Accelerators gathering from phi need no E (see puGathersPhi())
+	int gatherPhi = puGathersPhi(ini);
+	Grid *E   = gatherPhi ? NULL : gAlloc(ini, VECTOR);
 	Grid *rho = gAlloc(ini, SCALAR);
 	Grid *phi = gAlloc(ini, SCALAR);
-	void *solver = solverAlloc(ini, rho, phi);
+	void *solver = solverAlloc(ini, rho, phi, mpiInfo);
+	Subcycle *subcycle = puAllocSubcycle(ini, pop, rho);
 	// Object *obj = oAlloc(ini);
 
 	// Creating a neighbourhood in the rho to handle migrants
@@ -102,60 +157,134 @@ void regular(dictionary *ini){
 	gsl_rng *rng = gsl_rng_alloc(gsl_rng_mt19937);
 	gsl_rng_set(rng,mpiInfo->mpiRank+1); // Seed needs to be >=1
 
+	// Members of an ensemble get streams of their own, none of them the same
+	if(simMember()>=0){
+		int worldRank, worldSize;
+		MPI_Comm_rank(MPI_COMM_WORLD,&worldRank);
+		MPI_Comm_size(MPI_COMM_WORLD,&worldSize);
+		gsl_rng_set(rng,worldRank+1);
+		gsl_rng_set(rngSync,worldSize+simMember()+1);
+	}
+
 	/*
 	 * PREPARE FILES FOR WRITING
 	 */
 	pOpenH5(ini, pop, units, "pop");
 	gOpenH5(ini, rho, mpiInfo, units, units->chargeDensity, "rho");
 	gOpenH5(ini, phi, mpiInfo, units, units->potential, "phi");
-	gOpenH5(ini, E,   mpiInfo, units, units->eField, "E");
+	if(E) gOpenH5(ini, E,   mpiInfo, units, units->eField, "E");
   // oOpenH5(ini, obj, mpiInfo, units, 1, "test");
   // oReadH5(obj, mpiInfo);
+  // oComputeCapacitanceMatrix(obj, solve, solver, rho, phi, mpiInfo);
 
 	hid_t history = xyOpenH5(ini,"history");
 	pCreateEnergyDatasets(history,pop);
 
+	// Snapshots are copied and written when files:stagingBudget is exceeded
+	Stage *stage = stAlloc(ini);
+
 	// Add more time series to history if you want
 	// xyCreateDataset(history,"/group/group/dataset");
 
+	// Rows are written every files:historyInterval time-steps
+	XyBuffer *historyBuf = xyBufAlloc(ini,history);
+
+	// Velocity and phase-space histograms every diagnostics:interval steps
+	int diagInterval = iniGetInt(ini,"diagnostics:interval");
+	PhaseSpace *phaseSpace = NULL;
+	if(diagInterval>0) phaseSpace = pAllocPhaseSpace(ini, pop, units, mpiInfo);
+
 	/*
-	 * INITIAL CONDITIONS
+	 * RESTART (instead of initial conditions and half-step)
 	 */
+	int checkpointInterval = iniGetInt(ini,"files:checkpointInterval");
+	int restart = iniGetInt(ini,"files:restart");
+	long int nStart = 0;
 
-	// Initalize particles
-	// pPosUniform(ini, pop, mpiInfo, rngSync);
-	pPosLattice(ini, pop, mpiInfo);
-	pVelZero(pop);
-	// pVelMaxwell(ini, pop, rng);
-	double maxVel = iniGetDouble(ini,"population:maxVel");
+	if(restart){
 
-	// Perturb particles
-	pPosPerturb(ini, pop, mpiInfo);
+		hid_t ck = ckOpen(ini, &nStart);
+		msg(STATUS,"Restarting from time-step %li",nStart);
 
-	// Migrate those out-of-bounds due to perturbation
-	extractEmigrants(pop, mpiInfo);
+		// The subdomains may have been rebalanced before the checkpoint
+		if(gReadCheckpointMpi(ck, mpiInfo)){
+			solverFree(solver);
+			if(E) E = gResize(ini, E, mpiInfo);
+			rho = gResize(ini, rho, mpiInfo);
+			phi = gResize(ini, phi, mpiInfo);
+			gSetBndSlices(phi, mpiInfo);
+			solver = solverAlloc(ini, rho, phi, mpiInfo);
+		}
 
-	puMigrate(pop, mpiInfo, rho);
+		pReadCheckpoint(ck, pop);
+		gReadCheckpoint(ck, "phi", phi);	// Initial guess of the solver
+		if(solverReadCheckpoint) solverReadCheckpoint(ck, solver);
+		ckReadRng(ck, "rng", rng);
+		ckReadRng(ck, "rngSync", rngSync);
+		H5Fclose(ck);
 
-	/*
-	 * INITIALIZATION (E.g. half-step)
-	 */
+		// E is not checkpointed, since it follows from phi
+		if(E){
+			gHaloOpBegin(phi, mpiInfo, TOHALO);
+			gFinDiff1stScaled(phi, E, -1.);
+			gHaloOp(setSlice, E, mpiInfo, TOHALO);
+		}
 
-	// Get initial charge density
-	distr(pop, rho);
-	gHaloOp(addSlice, rho, mpiInfo, FROMHALO);
+	} else {
 
-	// Get initial E-field
-	solve(solver, rho, phi, mpiInfo);
-	gFinDiff1st(phi, E);
-	gHaloOp(setSlice, E, mpiInfo, TOHALO);
-	gMul(E, -1.);
+		/*
+		 * INITIAL CONDITIONS
+		 */
+
+		// Initalize particles
+		// pPosUniform(ini, pop, mpiInfo, rngSync);
+		pPosLattice(ini, pop, mpiInfo);
+		pVelZero(pop);
+		// pVelMaxwell(ini, pop, mpiInfo, rngSync);
 
+		// Perturb particles
+		pPosPerturb(ini, pop, mpiInfo);
 
-	// Advance velocities half a step
-	gMul(E, 0.5);
-	acc(pop, E);
-	gMul(E, 2.0);
+		// Migrate those out-of-bounds due to perturbation
+		extractEmigrants(pop, mpiInfo);
+
+		puMigrate(pop, mpiInfo, rho);
+
+		/*
+		 * INITIALIZATION (E.g. half-step)
+		 */
+
+		// Get initial charge density
+		distr(pop, rho);
+		gHaloOp(addSlice, rho, mpiInfo, FROMHALO);
+
+		// Get initial E-field
+		solve(solver, rho, phi, mpiInfo);
+		if(gatherPhi){
+			gHaloOp(setSlice, phi, mpiInfo, TOHALO);
+		} else {
+			gHaloOpBegin(phi, mpiInfo, TOHALO); // Needed by sSolve but not mgSolve
+			gFinDiff1stScaled(phi, E, -1.);
+			gHaloOp(setSlice, E, mpiInfo, TOHALO);
+		}
+
+		// Advance velocities half a step (of each specie's own time step)
+		puSubcycleBegin(subcycle, pop, 0);
+		acc(pop, gatherPhi ? phi : E, 0.5);
+		puSubcycleEnd(subcycle, pop);
+
+	}
+
+	double maxVel = iniGetDouble(ini,"population:maxVel");
+
+	// Fields at reduced resolution, averaged over files:gridAverage steps
+	int gridAverage = iniGetInt(ini,"files:gridAverage");
+	GridOutput *rhoOut = NULL, *phiOut = NULL, *EOut = NULL;
+	if(gridAverage>0){
+		rhoOut = gAllocOutput(ini, rho, mpiInfo, units, units->chargeDensity, "rhoReduced");
+		phiOut = gAllocOutput(ini, phi, mpiInfo, units, units->potential, "phiReduced");
+		if(E) EOut = gAllocOutput(ini, E, mpiInfo, units, units->eField, "EReduced");
+	}
 
 	/*
 	 * TIME LOOP
@@ -163,32 +292,106 @@ void regular(dictionary *ini){
 
 	Timer *t = tAlloc(mpiInfo->mpiRank);
 
+	// Sorting particles by cell speeds up the push and deposit kernels, but
+	// the particles get out of order again as they move. The kernels are timed
+	// on the steps just before and just after each sort to see what it gains.
+	int sortInterval = iniGetInt(ini,"population:sortInterval");
+	Timer *tSort = tAlloc(mpiInfo->mpiRank);
+	Timer *tKernels = tAlloc(mpiInfo->mpiRank);
+	long long int kernelsPrev = 0, kernelsBefore = 0, kernelsAfter = 0;
+	int nSorts = 0;
+
+	// Particles are merged and split to keep the number per cell in range
+	int mergeInterval = iniGetInt(ini,"population:mergeInterval");
+	int *ppcRange = iniGetIntArr(ini,"population:ppcRange",2);
+
+	// Diagnostics summed across subdomains in one collective per time step
+	Reduction *diag = rAlloc(MPI_SUM);
+
+	// Subdomain boundaries are moved to even out the number of particles. The
+	// multigrid solver needs subdomains of multiples of 2^mgLevels nodes, and
+	// the reduced grid output of 2^gridCoarsening nodes.
+	int balanceInterval = iniGetInt(ini,"grid:balanceInterval");
+	double balanceTolerance = iniGetDouble(ini,"grid:balanceTolerance");
+	int balanceLevels = iniGetInt(ini,"multigrid:mgLevels");
+	if(gridAverage>0 && iniGetInt(ini,"files:gridCoarsening")>balanceLevels)
+		balanceLevels = iniGetInt(ini,"files:gridCoarsening");
+	int balanceGranularity = 1<<balanceLevels;
+
 	// n should start at 1 since that's the timestep we have after the first
 	// iteration (i.e. when storing H5-files).
 	int nTimeSteps = iniGetInt(ini,"time:nTimeSteps");
-	for(int n = 1; n <= nTimeSteps; n++){
+	for(int n = nStart+1; n <= nTimeSteps; n++){
 
-		msg(STATUS,"Computing time-step %i",n);
-		MPI_Barrier(MPI_COMM_WORLD);	// Temporary, shouldn't be necessary
+		chBeginStep(n);
+		if(chVerbose()) msg(STATUS,"Computing time-step %i",n);
 
 		// Check that no particle moves beyond a cell (mostly for debugging)
-		pVelAssertMax(pop,maxVel);
+		if(chActive()){
+			pToHost(pop);
+			pVelAssertMax(pop,maxVel);
+		}
 
 		tStart(t);
+		tRegionBegin("step");
 
-		// Move particles
-		puMove(pop);
-		// oRayTrace(pop, obj);
+		// Rebalance subdomains. Only the particles need to be moved since the
+		// fields are recomputed from them, but the grids and the solver must
+		// be reallocated to the new size.
+		if(balanceInterval>0 && n>1 && (n-1)%balanceInterval==0){
+			tRegionBegin("rebalance");
+			pToGlobalFrame(pop, mpiInfo);
+			int moved = gBalance(mpiInfo, pop, balanceGranularity, balanceTolerance);
+			if(moved) pRedistribute(pop, mpiInfo);
+			pToLocalFrame(pop, mpiInfo);
 
-		// Migrate particles (periodic boundaries)
-		extractEmigrants(pop, mpiInfo);
-		puMigrate(pop, mpiInfo, rho);
+			if(moved){
+				solverFree(solver);
+				if(E) E = gResize(ini, E, mpiInfo);
+				rho = gResize(ini, rho, mpiInfo);
+				phi = gResize(ini, phi, mpiInfo);
+				gSetBndSlices(phi, mpiInfo);
+				solver = solverAlloc(ini, rho, phi, mpiInfo);
+				if(gridAverage>0){
+					gResizeOutput(ini, rhoOut, mpiInfo);
+					gResizeOutput(ini, phiOut, mpiInfo);
+					if(EOut) gResizeOutput(ini, EOut, mpiInfo);
+				}
+			}
+			tRegionEnd("rebalance");
+		}
 
-		// Check that no particle resides out-of-bounds (just for debugging)
-		pPosAssertInLocalFrame(pop, rho);
+		// Give back storage no longer needed (if population:growth>0)
+		pCompact(pop);
 
-		// Compute charge density
-		distr(pop, rho);
+		// Sort particles by cell (the previous step is the last unsorted one)
+		int sortStep = sortInterval>0 && n>1 && (n-1)%sortInterval==0;
+		if(sortStep){
+			tStart(tSort);
+			tRegionBegin("sort");
+			pSort(pop, rho);
+			tRegionEnd("sort");
+			tStop(tSort);
+		}
+
+		if(mergeInterval>0 && n>1 && (n-1)%mergeInterval==0){
+			tRegionBegin("merge");
+			pMergeSplit(pop, rho, ppcRange[0], ppcRange[1]);
+			tRegionEnd("merge");
+		}
+
+		// Move and migrate particles (periodic boundaries), and compute
+		// charge density
+		// oRayTrace(pop, obj);
+		// Species not pushed at step n are hidden until puSubcycleEnd()
+		puSubcycleBegin(subcycle, pop, n);
+		long long int kernelsStart = tKernels->total;
+		tStart(tKernels);
+		tRegionBegin("sweep");
+		sweep(pop, rho, mpiInfo, extractEmigrants, distr);
+		puSubcycleDeposit(subcycle, pop, rho, distr);
+		tRegionEnd("sweep");
+		tStop(tKernels);
 		gHaloOp(addSlice, rho, mpiInfo, FROMHALO);
 
 		// gAssertNeutralGrid(rho, mpiInfo);
@@ -199,56 +402,160 @@ void regular(dictionary *ini){
 		// mgSolve(solver, rho, phi, mpiInfo);
 		// sSolve(solver, rho, phi, mpiInfo);
 
+		tRegionBegin("solve");
 		solve(solver, rho, phi, mpiInfo);
+		// oApplyCapacitanceMatrix(obj, solve, solver, rho, phi, mpiInfo);
+		tRegionEnd("solve");
 
-		gHaloOp(setSlice, phi, mpiInfo, TOHALO); // Needed by sSolve but not mgSolve
+		// Sums for checking neutrality, reduced along with the energies
+		double phiSum = 0., ESum = 0.;
+		if(chActive()){
+			phiSum = gSumTruegrid(phi);
+			rAdd(diag, &phiSum, 1);
+		}
 
-		gAssertNeutralGrid(phi, mpiInfo);
+		// Compute E-field (the interior while the halo of phi is in flight), or
+		// only the halo of phi if the accelerator gathers from it
+		tRegionBegin("field");
+		if(gatherPhi){
+			gHaloOp(setSlice, phi, mpiInfo, TOHALO);
+		} else {
+			gHaloOpBegin(phi, mpiInfo, TOHALO); // Needed by sSolve but not mgSolve
+			gFinDiff1stScaled(phi, E, -1.);
+			gHaloOp(setSlice, E, mpiInfo, TOHALO);
+		}
+		tRegionEnd("field");
 
-		// Compute E-field
-		gFinDiff1st(phi, E);
-		gHaloOp(setSlice, E, mpiInfo, TOHALO);
-		gMul(E, -1.);
-
-		gAssertNeutralGrid(E, mpiInfo);
+		if(chActive() && E){
+			ESum = gSumTruegrid(E);
+			rAdd(diag, &ESum, 1);
+		}
 		// Apply external E
 		// gAddTo(Ext);
 
 		// Accelerate particle and compute kinetic energy for step n
-		acc(pop, E);
+		tStart(tKernels);
+		tRegionBegin("accelerate");
+		acc(pop, gatherPhi ? phi : E, 1.);
+		tRegionEnd("accelerate");
+		tStop(tKernels);
+		puSubcycleEnd(subcycle, pop);
 
+		tRegionEnd("step");
 		tStop(t);
 
+		long long int kernels = tKernels->total - kernelsStart;
+		if(sortStep){
+			kernelsBefore += kernelsPrev;
+			kernelsAfter += kernels;
+			nSorts++;
+		}
+		kernelsPrev = kernels;
+
+		tRegionBegin("diagnostics");
+
 		// Sum energy for all species
 		pSumKinEnergy(pop);
 
 		// Compute potential energy for step n
 		gPotEnergy(rho,phi,pop);
 
+		// Reduce diagnostics across subdomains
+		pAddEnergy(pop, diag);
+		rBegin(diag);
+		rEnd(diag);
+
+		if(chActive()){
+			gAssertNeutralSum(phiSum);
+			if(E) gAssertNeutralSum(ESum);
+		}
+
+		tRegionEnd("diagnostics");
+
 		// Example of writing another dataset to history.xy.h5
-		// xyWrite(history,"/group/group/dataset",(double)n,value,MPI_SUM);
+		// xyBufWrite(historyBuf,"/group/group/dataset",(double)n,value,MPI_SUM);
 
 		//Write h5 files
-		// gWriteH5(E, mpiInfo, (double) n);
-		// gWriteH5(rho, mpiInfo, (double) n);
-		// gWriteH5(phi, mpiInfo, (double) n);
-		// pWriteH5(pop, mpiInfo, (double) n, (double)n+0.5);
-		pWriteEnergy(history,pop,(double)n);
+		// gWriteH5Staged(stage, E, mpiInfo, (double) n);
+		// gWriteH5Staged(stage, rho, mpiInfo, (double) n);
+		// gWriteH5Staged(stage, phi, mpiInfo, (double) n);
+		// pWriteH5Staged(stage, pop, mpiInfo, (double) n, (double)n+0.5);
+		tRegionBegin("output");
+		pWriteEnergy(historyBuf,pop,(double)n);
+		if(diagInterval>0 && n%diagInterval==0){
+			pToHost(pop);
+			pWritePhaseSpace(phaseSpace, pop, mpiInfo, (double)n, (double)n+0.5);
+		}
+		if(gridAverage>0){
+			gWriteOutput(rhoOut, rho, mpiInfo, (double) n);
+			gWriteOutput(phiOut, phi, mpiInfo, (double) n);
+			if(EOut) gWriteOutput(EOut, E, mpiInfo, (double) n);
+		}
+		tRegionEnd("output");
+
+		// Checkpoint the state at the end of time-step n
+		if(checkpointInterval>0 && n%checkpointInterval==0){
+			tRegionBegin("checkpoint");
+			pToHost(pop);
+			hid_t ck = ckCreate(ini, n);
+			gWriteCheckpointMpi(ck, mpiInfo);
+			pWriteCheckpoint(ck, pop);
+			gWriteCheckpoint(ck, "phi", phi);
+			if(solverWriteCheckpoint) solverWriteCheckpoint(ck, solver);
+			ckWriteRng(ck, "rng", rng);
+			ckWriteRng(ck, "rngSync", rngSync);
+			ckClose(ini, ck);
+			tRegionEnd("checkpoint");
+		}
+
+		// Time spent in each region during step n (if diagnostics:timing=2)
+		tRegionWriteHistory(historyBuf,(double)n);
+
+	}
 
+	tMsg(t->total, "Time spent: ");
+
+	puMigrantStats(mpiInfo);
+
+	if(nSorts>0){
+		kernelsBefore /= nSorts;
+		kernelsAfter /= nSorts;
+
+		// Assumes the kernels slow down linearly between sorts
+		long long int saved = nSorts*sortInterval*(kernelsBefore-kernelsAfter)/2;
+
+		tMsg(tSort->total, "Time spent sorting: ");
+		tMsg(kernelsBefore, "Push and deposit per step before sorting: ");
+		tMsg(kernelsAfter, "Push and deposit per step after sorting: ");
+		if(saved>0) tMsg(saved, "Estimated push and deposit time saved: ");
+		else tMsg(-saved, "Estimated push and deposit time lost: ");
 	}
 
-	if(mpiInfo->mpiRank==0) tMsg(t->total, "Time spent: ");
+	tFree(t);
+	tFree(tSort);
+	tFree(tKernels);
+	rFree(diag);
+	free(ppcRange);
 
 	/*
 	 * FINALIZE PINC VARIABLES
 	 */
+	gDestroyNeighborhood(mpiInfo);
 	gFreeMpi(mpiInfo);
 
-	// Close h5 files
+	// Close h5 files (after writing what's staged and buffered)
+	stFree(stage);
+	xyBufFree(historyBuf);
+	if(phaseSpace) pFreePhaseSpace(phaseSpace);
+	if(gridAverage>0){
+		gFreeOutput(rhoOut);
+		gFreeOutput(phiOut);
+		if(EOut) gFreeOutput(EOut);
+	}
 	pCloseH5(pop);
 	gCloseH5(rho);
 	gCloseH5(phi);
-	gCloseH5(E);
+	if(E) gCloseH5(E);
 	// oCloseH5(obj);
 	xyCloseH5(history);
 
@@ -256,9 +563,10 @@ void regular(dictionary *ini){
 	// sFree(solver);
 	// mgFreeSolver(solver);
 	solverFree(solver);
+	puFreeSubcycle(subcycle);
 	gFree(rho);
 	gFree(phi);
-	gFree(E);
+	if(E) gFree(E);
 	pFree(pop);
 	uFree(units);
 	// oFree(obj);
@@ -267,3 +575,594 @@ void regular(dictionary *ini){
 	gsl_rng_free(rng);
 
 }
+
+/**
+ * @brief Creates the datasets of one row group of poissonBenchmark()
+ */
+static void benchCreate(hid_t h5, const char *group, int withFactor){
+
+	const char *quantities[] = {"time", "halo", "compute"};
+	const char *stats[] = {"min", "max", "avg"};
+	char name[64];
+
+	for(int q = 0; q < 3; q++){
+		for(int s = 0; s < 3; s++){
+			sprintf(name, "%s/%s/%s", group, quantities[q], stats[s]);
+			xyCreateDataset(h5, name);
+		}
+	}
+
+	sprintf(name, "%s/unknownsPerSecond", group);
+	xyCreateDataset(h5, name);
+
+	if(withFactor){
+		sprintf(name, "%s/convergenceFactor", group);
+		xyCreateDataset(h5, name);
+	}
+}
+
+/**
+ * @brief Writes the per process times of one row of poissonBenchmark()
+ *
+ * The times are reduced to their min, max and average across processes. The
+ * unknowns per second are those of the slowest process. A factor less than 0
+ * is not written.
+ */
+static void benchWrite(hid_t h5, const char *group, const char *label, double x,
+					   double time, double halo, long int nUnknowns, double factor,
+					   const MpiInfo *mpiInfo){
+
+	const char *quantities[] = {"time", "halo", "compute"};
+	double values[] = {time, halo, time-halo};
+	double reduced[3][3];
+	char name[64];
+
+	for(int q = 0; q < 3; q++){
+		MPI_Allreduce(&values[q], &reduced[q][0], 1, MPI_DOUBLE, MPI_MIN, simComm());
+		MPI_Allreduce(&values[q], &reduced[q][1], 1, MPI_DOUBLE, MPI_MAX, simComm());
+		MPI_Allreduce(&values[q], &reduced[q][2], 1, MPI_DOUBLE, MPI_SUM, simComm());
+		reduced[q][2] /= mpiInfo->mpiSize;
+
+		sprintf(name, "%s/%s/min", group, quantities[q]);
+		xyWrite(h5, name, x, reduced[q][0], MPI_OP_NULL);
+		sprintf(name, "%s/%s/max", group, quantities[q]);
+		xyWrite(h5, name, x, reduced[q][1], MPI_OP_NULL);
+		sprintf(name, "%s/%s/avg", group, quantities[q]);
+		xyWrite(h5, name, x, reduced[q][2], MPI_OP_NULL);
+	}
+
+	double unknownsPerSecond = nUnknowns/reduced[0][1];
+	sprintf(name, "%s/unknownsPerSecond", group);
+	xyWrite(h5, name, x, unknownsPerSecond, MPI_OP_NULL);
+
+	if(factor >= 0){
+		sprintf(name, "%s/convergenceFactor", group);
+		xyWrite(h5, name, x, factor, MPI_OP_NULL);
+		msg(STATUS, "%s: %.3e s (%.3e-%.3e), %.1f%% halo, %.3e unknowns/s, factor %.3e",
+			label, reduced[0][2], reduced[0][0], reduced[0][1],
+			100*reduced[1][2]/reduced[0][2], unknownsPerSecond, factor);
+	} else {
+		msg(STATUS, "%s: %.3e s (%.3e-%.3e), %.1f%% halo, %.3e unknowns/s",
+			label, reduced[0][2], reduced[0][0], reduced[0][1],
+			100*reduced[1][2]/reduced[0][2], unknownsPerSecond);
+	}
+}
+
+/**
+ * @brief Benchmarks the Poisson solver of methods:poisson
+ * @param	ini		Input file
+ *
+ * The solver is timed on a neutralized, normally distributed charge density
+ * over methods:nBenchmark repetitions of each of the following, written to
+ * benchmark.xy.h5 and logged:
+ *	- /solve: Whole solves from a zero initial guess (x is 0)
+ *	- /cycle: Multigrid cycles from a zero initial guess (x is 0)
+ *	- /level: The work of a V cycle on each multigrid level (x is the level)
+ *
+ * The latter two are done for mgSolver, and for the preconditioner of
+ * mgcgSolver. For each there's the time, the part of it spent in halo
+ * exchanges and the rest (compute) as min, max and avg across processes, and
+ * the unknowns per second of the slowest process. The convergenceFactor is
+ * the reduction of the RMS residual per cycle, or over the solve. Halo
+ * exchanges are those of the grids of a multigrid solver, and of rho and phi.
+ */
+void poissonBenchmark(dictionary *ini){
+
+	/*
+	 * SELECT METHODS
+	 */
+	void (*solverInterface)()	= select(ini,	"methods:poisson",
+												mgSolver_set,
+												sSolver_set,
+												mgcgSolver_set);
+
+	void (*solve)() = NULL;
+	void *(*solverAlloc)() = NULL;
+	void (*solverFree)() = NULL;
+	void (*solverWriteCheckpoint)() = NULL;	// NULL if stateless
+	void (*solverReadCheckpoint)() = NULL;
+	solverInterface(&solve, &solverAlloc, &solverFree,
+					&solverWriteCheckpoint, &solverReadCheckpoint);
+
+	/*
+	 * INITIALIZE PINC VARIABLES
+	 */
+	Units *units=uAlloc(ini);
+	uNormalize(ini, units);
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Grid *rho = gAlloc(ini, SCALAR);
+	Grid *phi = gAlloc(ini, SCALAR);
+	Grid *res = gAlloc(ini, SCALAR);
+	void *solver = solverAlloc(ini, rho, phi, mpiInfo);
+	gSetBndSlices(phi, mpiInfo);
+
+	// The multigrid solver, or the preconditioner of the Krylov solver
+	MultigridSolver *mg = NULL;
+	if(solve == (funPtr)mgSolve) mg = solver;
+	if(solve == (funPtr)mgcgSolve) mg = ((MgcgSolver *)solver)->pre;
+
+	int nRepetitions = iniGetInt(ini, "methods:nBenchmark");
+	if(nRepetitions < 1) msg(ERROR, "methods:nBenchmark must be positive");
+
+	// Noise has all the modes particles give rise to
+	gsl_rng *rng = gsl_rng_alloc(gsl_rng_mt19937);
+	gsl_rng_set(rng,mpiInfo->mpiRank+1);
+	gFillRng(rho, mpiInfo, rng);
+	gNeutralizeGrid(rho, mpiInfo);
+
+	gCopy(rho, res);
+	double rhoRms = sqrt(mgSumTrueSquared(res, mpiInfo)/gTotTruesize(res, mpiInfo));
+
+	hid_t h5 = xyOpenH5(ini, "benchmark");
+
+	/*
+	 * WHOLE SOLVES, FROM ZERO
+	 */
+	unsigned long long int haloTime = 0;
+	rho->haloTime = &haloTime;
+	phi->haloTime = &haloTime;
+	if(solve == (funPtr)mgSolve) mgSetHaloTime(solver, &haloTime);
+	if(solve == (funPtr)mgcgSolve) mgcgSetHaloTime(solver, &haloTime);
+
+	// Untimed solve to warm up caches, plans and pages
+	gZero(phi);
+	solve(solver, rho, phi, mpiInfo);
+
+	haloTime = 0;
+	unsigned long long int total = 0;
+	for(int r = 0; r < nRepetitions; r++){
+		gZero(phi);
+		MPI_Barrier(simComm());
+		unsigned long long int start = getNanoSec();
+		solve(solver, rho, phi, mpiInfo);
+		total += getNanoSec()-start;
+	}
+
+	rho->haloTime = NULL;
+	phi->haloTime = NULL;
+	if(solve == (funPtr)mgSolve) mgSetHaloTime(solver, NULL);
+	if(solve == (funPtr)mgcgSolve) mgcgSetHaloTime(solver, NULL);
+
+	gHaloOp(setSlice, phi, mpiInfo, TOHALO);
+	gBnd(phi, mpiInfo);
+	mgResidual(res, rho, phi, mpiInfo);
+	double resRms = sqrt(mgSumTrueSquared(res, mpiInfo)/gTotTruesize(res, mpiInfo));
+
+	long int nUnknowns = gTotTruesize(rho, mpiInfo);
+	benchCreate(h5, "/solve", 1);
+	benchWrite(h5, "/solve", "Solve", 0, 1e-9*total/nRepetitions,
+			   1e-9*haloTime/nRepetitions, nUnknowns, resRms/rhoRms, mpiInfo);
+
+	/*
+	 * MULTIGRID CYCLES AND LEVELS
+	 */
+	if(mg){
+		Grid *mgRho = mg->mgRho->grids[0];
+		if(mgRho != rho) gCopy(rho, mgRho);
+
+		double time, halo, factor;
+		mgBenchmarkCycle(mg, nRepetitions, &time, &halo, &factor, mpiInfo);
+		benchCreate(h5, "/cycle", 1);
+		benchWrite(h5, "/cycle", "Cycle", 0, time, halo, nUnknowns, factor, mpiInfo);
+
+		benchCreate(h5, "/level", 0);
+		for(int l = 0; l < mg->mgRho->nLevels; l++){
+			char label[32];
+			sprintf(label, "Level %d", l);
+			mgBenchmarkLevel(mg, l, nRepetitions, &time, &halo, mpiInfo);
+			long int nLevelUnknowns = gTotTruesize(mg->mgRho->grids[l], mpiInfo);
+			benchWrite(h5, "/level", label, l, time, halo, nLevelUnknowns, -1, mpiInfo);
+		}
+	}
+
+	xyCloseH5(h5);
+
+	/*
+	 * FINALIZE PINC VARIABLES
+	 */
+	gsl_rng_free(rng);
+	solverFree(solver);
+	gFree(rho);
+	gFree(phi);
+	gFree(res);
+	gFreeMpi(mpiInfo);
+	uFree(units);
+
+}
+
+/**
+ * @brief Scales the numbers of a list in the input file, keeping any suffix
+ * @param	ini			Input file dictionary
+ * @param	key			Key of the list
+ * @param	suffix		Suffix, e.g. "pc"
+ * @param	withSuffix	Whether to scale the elements with (1) or without (0) it
+ * @param	mul			Factor of each element (repeated if fewer)
+ * @param	mulLen		Number of factors
+ */
+static void scalingScaleList(dictionary *ini, const char *key, const char *suffix,
+							 int withSuffix, const double *mul, int mulLen){
+
+	int nElements = iniGetNElements(ini,key);
+	char **strArr = iniGetStrArr(ini,key,nElements);
+
+	const int numSize=64;
+	char num[numSize];
+	char list[1024] = "";
+
+	for(int i=0;i<nElements;i++){
+		char *rest;
+		double val = strtod(strArr[i],&rest);
+		if((strstr(strArr[i],suffix)!=NULL)==withSuffix) val *= mul[i%mulLen];
+		snprintf(num,numSize,",%.17g%s",val,rest);
+		strcat(list,num);
+	}
+	iniparser_set(ini,key,&list[1]);
+
+	freeStrArr(strArr);
+}
+
+/**
+ * @brief Divides a grid into subdomains for a number of MPI processes
+ * @param		nDims		Number of dimensions
+ * @param		mpiSize		Number of MPI processes
+ * @param		weak		Whether the subdomain (1) or global (0) size is fixed
+ * @param		L			Size of the subdomains (weak) or global grid (strong)
+ * @param[out]	nSubdomains	Number of subdomains along each dimension
+ * @param[out]	trueSize	Size of the subdomains
+ *
+ * Each prime factor of mpiSize, largest first, multiplies the subdomains along
+ * the dimension where they are the longest (strong scaling), or where the
+ * global grid is the shortest (weak scaling), to keep them close to cubic.
+ */
+static void scalingDecompose(int nDims, int mpiSize, int weak, const int *L,
+							 int *nSubdomains, int *trueSize){
+
+	int nFactors = 0;
+	int factors[32];
+	for(int p=2, n=mpiSize; n>1; p++){
+		while(n%p==0){
+			factors[nFactors++] = p;
+			n /= p;
+		}
+	}
+
+	for(int d=0;d<nDims;d++) nSubdomains[d] = 1;
+
+	for(int f=nFactors-1;f>=0;f--){
+		int p = factors[f];
+		int best = -1;
+		long int bestLength = 0;
+		for(int d=0;d<nDims;d++){
+			long int length;
+			if(weak){
+				length = -(long int)L[d]*nSubdomains[d];
+			} else {
+				if(L[d]%(nSubdomains[d]*p)) continue;
+				length = L[d]/nSubdomains[d];
+			}
+			if(best<0 || length>bestLength){
+				best = d;
+				bestLength = length;
+			}
+		}
+		if(best<0) msg(ERROR,"Cannot divide the grid among %i MPI processes",mpiSize);
+		nSubdomains[best] *= p;
+	}
+
+	for(int d=0;d<nDims;d++)
+		trueSize[d] = weak ? L[d] : L[d]/nSubdomains[d];
+}
+
+/**
+ * @brief Gets the time per step of a phase in an earlier row of the table
+ * @param	fName	Filename of the table
+ * @param	type	Type of scaling study
+ * @param	mpiSize	Number of MPI processes of the row
+ * @param	phase	Phase of the row
+ * @param[out]	seconds	Total, communication and computation time
+ * @return	1 if found, 0 if not
+ */
+static int scalingReadRow(const char *fName, const char *type, int mpiSize,
+						  const char *phase, double *seconds){
+
+	FILE *file = fopen(fName,"r");
+	if(!file) return 0;
+
+	int found = 0;
+	char line[512];
+	while(!found && fgets(line,sizeof(line),file)){
+		char rowType[16], rowPhase[64];
+		int rowSize;
+		int n = sscanf(line,"%15[^,],%d,%*[^,],%*[^,],%63[^,],%lf,%lf,%lf",
+					   rowType,&rowSize,rowPhase,&seconds[0],&seconds[1],&seconds[2]);
+		found = n==6 && !strcmp(rowType,type) && rowSize==mpiSize
+				&& !strcmp(rowPhase,phase);
+	}
+
+	fclose(file);
+	return found;
+}
+
+/**
+ * @brief Runs a step of a weak or strong scaling study
+ * @param	ini		Input file
+ *
+ * Run once on each number of MPI processes in methods:scalingRanks, in order,
+ * on the same input file, e.g.
+ * @code
+ *	for n in 1 2 4 8; do mpirun -np $n ./pinc input.ini methods:mode=scaling; done
+ * @endcode
+ * The input file is the baseline, and grid:nSubdomains must be of the first
+ * number of processes. For the others, the grid is divided among the
+ * processes by scalingDecompose(). For STRONG scaling of methods:scaling, the
+ * global grid and the number of particles are kept. For WEAK scaling the
+ * subdomains are, and particles not given per cell ("pc") and cell sizes given
+ * per global grid ("tot") are scaled accordingly.
+ *
+ * Then regular() is run for time:nTimeSteps with timing regions enabled, and
+ * one row per phase, i.e. per timing region directly inside or beside the time
+ * step, is added to "scaling.csv" (prefixed by files:output). The table is
+ * started anew on the first number of processes. The rows have the seconds per
+ * time step of the slowest process, the part of it spent communicating (in
+ * "halo" and "migrate" regions), the remaining computation, and the parallel
+ * efficiency of the total and of the computation relative to the first number
+ * of processes. The efficiency is T0*P0/(T*P) for strong scaling, and T0/T for
+ * weak scaling.
+ */
+void scaling(dictionary *ini){
+
+	int mpiRank, mpiSize;
+	MPI_Comm_rank(simComm(),&mpiRank);
+	MPI_Comm_size(simComm(),&mpiSize);
+
+	char *type = iniGetStr(ini,"methods:scaling");
+	int weak = !strcmp(type,"WEAK");
+	if(!weak && strcmp(type,"STRONG"))
+		msg(ERROR,"methods:scaling must be STRONG or WEAK");
+
+	int nCounts = iniGetNElements(ini,"methods:scalingRanks");
+	int *counts = iniGetIntArr(ini,"methods:scalingRanks",nCounts);
+	int index = 0;
+	while(index<nCounts && counts[index]!=mpiSize) index++;
+	if(index==nCounts)
+		msg(ERROR,"%i MPI processes is not one of methods:scalingRanks",mpiSize);
+
+	int nDims = iniGetInt(ini,"grid:nDims");
+	int *nSubdomains = iniGetIntArr(ini,"grid:nSubdomains",nDims);
+	int *trueSize = iniGetIntArr(ini,"grid:trueSize",nDims);
+	if(aiProd(nSubdomains,nDims)!=counts[0])
+		msg(ERROR,"grid:nSubdomains must be for the first of methods:scalingRanks");
+
+	/*
+	 * DERIVE THE CONFIGURATION OF THIS NUMBER OF PROCESSES
+	 */
+	if(index>0){
+
+		int *L = malloc(nDims*sizeof(*L));
+		double *mul = malloc(nDims*sizeof(*mul));
+		for(int d=0;d<nDims;d++)
+			L[d] = weak ? trueSize[d] : trueSize[d]*nSubdomains[d];
+		for(int d=0;d<nDims;d++) mul[d] = nSubdomains[d];
+
+		scalingDecompose(nDims,mpiSize,weak,L,nSubdomains,trueSize);
+		iniSetIntArr(ini,"grid:nSubdomains",nSubdomains,nDims);
+		iniSetIntArr(ini,"grid:trueSize",trueSize,nDims);
+
+		if(weak){
+			double factor = (double)mpiSize/counts[0];
+			scalingScaleList(ini,"population:nParticles","pc",0,&factor,1);
+			scalingScaleList(ini,"population:nAlloc","pc",0,&factor,1);
+			for(int d=0;d<nDims;d++) mul[d] = nSubdomains[d]/mul[d];
+			scalingScaleList(ini,"grid:stepSize","tot",1,mul,nDims);
+		}
+
+		free(L);
+		free(mul);
+	}
+
+	msg(STATUS,"%s scaling on %i MPI processes: nSubdomains=%s, trueSize=%s",
+		type, mpiSize, iniparser_getstring(ini,"grid:nSubdomains",""),
+		iniparser_getstring(ini,"grid:trueSize",""));
+
+	if(iniGetInt(ini,"diagnostics:timing")<1) iniSetInt(ini,"diagnostics:timing",1);
+	tRegionSetup(ini);
+
+	regular(ini);
+
+	/*
+	 * TABULATE THE TIME OF EACH PHASE
+	 */
+	const char *phases[] = {"/step", "/step/rebalance", "/step/sort",
+							"/step/sweep", "/step/solve", "/step/field",
+							"/step/accelerate", "/diagnostics", "/output",
+							"/checkpoint"};
+	const char *communication[] = {"halo", "migrate"};
+	int nPhases = sizeof(phases)/sizeof(*phases);
+	int nTimeSteps = iniGetInt(ini,"time:nTimeSteps");
+
+	// Total, communication and computation of the slowest process per step
+	double (*seconds)[3] = malloc(nPhases*sizeof(*seconds));
+	for(int p=0;p<nPhases;p++){
+		double local[3];
+		local[0] = tRegionSeconds(phases[p],NULL,0)/nTimeSteps;
+		local[1] = tRegionSeconds(phases[p],communication,2)/nTimeSteps;
+		local[2] = local[0]-local[1];
+		MPI_Allreduce(local,seconds[p],3,MPI_DOUBLE,MPI_MAX,simComm());
+	}
+
+	if(mpiRank==0){
+
+		char *fPrefix = iniGetStr(ini,"files:output");
+		char sep[2] = "\0\0";
+		char lastchar = fPrefix[strlen(fPrefix)-1];
+		if(strcmp(fPrefix,".")==0) sep[0]='/';
+		else if(strlen(fPrefix)>0 && lastchar!='/') sep[0]='_';
+		char *fName = strCatAlloc(3,fPrefix,sep,"scaling.csv");
+
+		char sub[64] = "", size[64] = "";
+		for(int d=0;d<nDims;d++){
+			sprintf(&sub[strlen(sub)],d ? "x%i" : "%i",nSubdomains[d]);
+			sprintf(&size[strlen(size)],d ? "x%i" : "%i",trueSize[d]);
+		}
+
+		// Read the baseline before the table may be started anew
+		double (*base)[3] = malloc(nPhases*sizeof(*base));
+		int *hasBase = malloc(nPhases*sizeof(*hasBase));
+		for(int p=0;p<nPhases;p++){
+			if(index==0){
+				memcpy(base[p],seconds[p],sizeof(*base));
+				hasBase[p] = 1;
+			} else {
+				hasBase[p] = scalingReadRow(fName,type,counts[0],phases[p],base[p]);
+			}
+		}
+
+		FILE *file = fopen(fName,index==0 ? "w" : "a");
+		if(!file) msg(ERROR,"Could not open '%s'",fName);
+		if(index==0)
+			fprintf(file,"type,processes,subdomains,trueSize,phase,seconds,"
+						 "communication,computation,efficiency,"
+						 "computationEfficiency\n");
+
+		msg(STATUS,"%-18s %11s %11s %11s %10s %10s","phase","seconds/step",
+			"comm.","comp.","eff.","comp. eff.");
+		for(int p=0;p<nPhases;p++){
+
+			if(seconds[p][0]<=0) continue;
+
+			double eff = -1, compEff = -1;
+			if(hasBase[p]){
+				double work = weak ? 1. : (double)counts[0]/mpiSize;
+				eff = work*base[p][0]/seconds[p][0];
+				if(seconds[p][2]>0) compEff = work*base[p][2]/seconds[p][2];
+			}
+
+			fprintf(file,"%s,%i,%s,%s,%s,%.6e,%.6e,%.6e,",type,mpiSize,sub,size,
+					phases[p],seconds[p][0],seconds[p][1],seconds[p][2]);
+			if(eff>=0) fprintf(file,"%.4f",eff);
+			fprintf(file,",");
+			if(compEff>=0) fprintf(file,"%.4f",compEff);
+			fprintf(file,"\n");
+
+			msg(STATUS,"%-18s %11.4e %11.4e %11.4e %10.4f %10.4f",phases[p],
+				seconds[p][0],seconds[p][1],seconds[p][2],eff,compEff);
+		}
+		fclose(file);
+
+		if(index>0 && !hasBase[0])
+			msg(WARNING,"No %s row of %i processes in '%s' to compute efficiencies from",
+				type,counts[0],fName);
+
+		free(base);
+		free(hasBase);
+		free(fName);
+		free(fPrefix);
+	}
+
+	free(seconds);
+	free(nSubdomains);
+	free(trueSize);
+	free(counts);
+	free(type);
+}
+
+/**
+ * @brief Runs an ensemble of independent simulations in one MPI job
+ * @param	ini		Input file
+ *
+ * The MPI processes are split into methods:ensembleMembers groups of equal
+ * size, each with its own communicator (see simSetComm()) on which regular()
+ * is run. The group of a member must fit grid:nSubdomains like in a regular
+ * run, e.g. 32 processes with 8 members gives each member 4 processes.
+ *
+ * The members differ by the keys listed in methods:ensembleVary, e.g.
+ * "time:timeStep, population:thermalVelocity". methods:ensembleValues has one
+ * scalar per key and member, all the keys of member 0 first, then of member 1,
+ * etc. Keys holding lists can therefore only be set to a single value.
+ *
+ * The members also draw from different random number streams. With an empty
+ * methods:ensembleVary they differ only by those, e.g. for statistics of noise
+ * when the initial conditions are random (not so with pPosLattice()).
+ *
+ * Each member writes its output with files:output suffixed by "member<i>",
+ * and its messages are tagged with the member number (see msg()).
+ */
+void ensemble(dictionary *ini){
+
+	int worldRank, worldSize;
+	MPI_Comm_rank(MPI_COMM_WORLD,&worldRank);
+	MPI_Comm_size(MPI_COMM_WORLD,&worldSize);
+
+	int nMembers = iniGetInt(ini,"methods:ensembleMembers");
+	if(nMembers<1 || worldSize%nMembers)
+		msg(ERROR,"methods:ensembleMembers must divide the %i MPI processes",worldSize);
+
+	int member = worldRank/(worldSize/nMembers);
+	MPI_Comm comm;
+	MPI_Comm_split(MPI_COMM_WORLD,member,worldRank,&comm);
+
+	/*
+	 * SET THE KEYS OF THIS MEMBER
+	 */
+	int nKeys = iniGetNElements(ini,"methods:ensembleVary");
+	if(nKeys>0){
+
+		char **keys = iniGetStrArr(ini,"methods:ensembleVary",nKeys);
+		int nValues = iniGetNElements(ini,"methods:ensembleValues");
+		if(nValues!=nMembers*nKeys)
+			msg(ERROR,"methods:ensembleValues must have %i values (members times keys), "
+				"not %i",nMembers*nKeys,nValues);
+		char **values = iniGetStrArr(ini,"methods:ensembleValues",nValues);
+
+		for(int k=0;k<nKeys;k++){
+			if(iniparser_find_entry(ini,keys[k])==0)
+				msg(ERROR,"methods:ensembleVary has %s which is not in the input file",keys[k]);
+			iniparser_set(ini,keys[k],values[member*nKeys+k]);
+		}
+
+		freeStrArr(keys);
+		freeStrArr(values);
+	}
+
+	/*
+	 * GIVE THIS MEMBER ITS OWN OUTPUT FILES
+	 */
+	char *fPrefix = iniGetStr(ini,"files:output");
+	char sep[2] = "\0\0";
+	char lastchar = fPrefix[strlen(fPrefix)-1];
+	if(strcmp(fPrefix,".")==0) sep[0]='/';
+	else if(strlen(fPrefix)>0 && lastchar!='/') sep[0]='_';
+	char name[32];
+	sprintf(name,"member%i",member);
+	char *output = strCatAlloc(3,fPrefix,sep,name);
+	iniSetStr(ini,"files:output",output);
+	free(output);
+	free(fPrefix);
+
+	simSetComm(comm,member);
+	msg(STATUS,"Ensemble member %i of %i on %i MPI processes",
+		member,nMembers,worldSize/nMembers);
+
+	regular(ini);
+}
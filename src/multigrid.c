@@ -88,9 +88,15 @@ void mgSetRestrictProlong(const dictionary *ini,Multigrid *multigrid){
 
 	int rank = multigrid->grids[0]->rank;
 
+	multigrid->residualRestrictor = NULL;
+	multigrid->prolongAdder = NULL;
+
 	if(!strcmp(restrictor, "halfWeight")){
 		if(rank == 3)	multigrid->restrictor = &mgHalfRestrict2D;
-		else if(rank == 4) multigrid->restrictor = &mgHalfRestrict3D;
+		else if(rank == 4){
+			multigrid->restrictor = &mgHalfRestrict3D;
+			multigrid->residualRestrictor = &mgHalfRestrictResidual3D;
+		}
 		else msg(ERROR, "No restricting algorithm for D%d", rank-1);
 	} else if(!strcmp(restrictor, "halfWeightND")){
 		multigrid->restrictor = &mgHalfRestrictND;
@@ -98,7 +104,10 @@ void mgSetRestrictProlong(const dictionary *ini,Multigrid *multigrid){
 
 	if(!strcmp(prolongator, "bilinear")){
 		if(rank == 3)	multigrid->prolongator = &mgBilinProl2D;
-		else if(rank==4)	multigrid->prolongator = &mgBilinProl3D;
+		else if(rank==4){
+			multigrid->prolongator = &mgBilinProl3D;
+			multigrid->prolongAdder = &mgBilinProlAdd3D;
+		}
 		else msg(ERROR, "No restricting algorithm for D%d", rank-1);
 	} else if(!strcmp(prolongator, "bilinearND")){
 		multigrid->prolongator = &mgBilinProlND;
@@ -125,63 +134,103 @@ funPtr getMgAlgo(const dictionary *ini){
 }
 
 
+/**
+ * @brief Computes the size of a level in the multigrid hierarchy
+ * @param	grid			Finest grid
+ * @param	q				Level
+ * @param[out]	subTrueSize	True size of level (rank elements)
+ * @param[out]	subSize		Size of level (rank elements)
+ * @return					Number of elements in the largest slice
+ */
+static long int mgSubGridSize(const Grid *grid, int q,
+							  int *subTrueSize, int *subSize){
+
+	int *trueSize = grid->trueSize;
+	int *nGhostLayers = grid->nGhostLayers;
+	int rank = grid->rank;
+
+	//Set first entries (nValues)
+	subTrueSize[0] = trueSize[0];
+	subSize[0] = subTrueSize[0];
+
+	//The subgrid needs half the grid points
+	for(int d = 1; d < rank; d++)	subTrueSize[d] = trueSize[d]/(pow(2,q));
+
+	// Calculate the number of grid points (True points + ghost points)
+	for(int d = 1 ; d < rank ; d ++){
+		subSize[d] = subTrueSize[d] + nGhostLayers[d] + nGhostLayers[rank + d];
+	}
+	//Slice elements
+	long int nSliceMax = 0;
+	for(int d=0;d<rank;d++){
+		long int nSlice = 1;
+		for(int dd=0;dd<rank;dd++){
+			if(dd!=d) nSlice *= subSize[dd];
+		}
+		if(nSlice>nSliceMax) nSliceMax = nSlice;
+	}
+
+	return nSliceMax;
+}
+
 Grid **mgAllocSubGrids(const dictionary *ini, Grid *grid,
-						const int nLevels){
+						const int nLevels, Arena **arena){
 
 	//Gather information on finest grid
 	Grid **grids = malloc((nLevels) * sizeof(Grid));
 
-	int *trueSize = grid->trueSize;
 	int *nGhostLayers = grid->nGhostLayers;
 	bndType *bnd = grid->bnd;
 	int rank = grid->rank;
+	int *tileSize = iniGetIntArr(ini, "grid:tileSize", rank-1);
+	int hugePages = iniGetInt(ini, "multigrid:hugePages");
 
 	//Set first grid to point to f grid
 	grids[0] = grid;
 
-	//Cycle through subgrids
+	// All arrays of the subgrids are stored consecutively in one arena
+	int *subTrueSize = malloc(rank*sizeof(*subTrueSize));
+	int *subSize = malloc(rank*sizeof(*subSize));
+	size_t nBytes = 0;
 	for(int q = 1; q < nLevels; q++){
-		//Allocate
-		int *subTrueSize = malloc(rank*sizeof(subTrueSize));
-		int *subSize = malloc(rank *sizeof(*subSize));
-
-		//Set first entries (nValues)
-		subTrueSize[0] = trueSize[0];
-		subSize[0] = subTrueSize[0];
+		long int nSliceMax = mgSubGridSize(grid, q, subTrueSize, subSize);
+		long int nNodes = 1;
+		for(int d = 0; d < rank; d++) nNodes *= subSize[d];
+
+		nBytes += arPad(nNodes*sizeof(double));
+		nBytes += arPad(2*nSliceMax*sizeof(double));
+		nBytes += arPad(2*rank*nSliceMax*sizeof(double));
+		nBytes += 2*arPad(rank*sizeof(int));
+		nBytes += arPad((rank+1)*sizeof(long int));
+		nBytes += arPad(2*rank*sizeof(int));
+		nBytes += arPad(2*rank*sizeof(bndType));
+	}
+	free(subTrueSize);
+	free(subSize);
 
-		//The subgrid needs half the grid points
-		for(int d = 1; d < rank; d++)	subTrueSize[d] = trueSize[d]/(pow(2,q));
+	*arena = arAlloc(nBytes, hugePages);
 
-		// Calculate the number of grid points (True points + ghost points)
-		subSize[0] = trueSize[0];
-		for(int d = 1 ; d < rank ; d ++){
-			subSize[d] = subTrueSize[d] + nGhostLayers[d] + nGhostLayers[rank + d];
-		}
-		//Slice elements
-		long int nSliceMax = 0;
-		for(int d=0;d<rank;d++){
-			long int nSlice = 1;
-			for(int dd=0;dd<rank;dd++){
-				if(dd!=d) nSlice *= subSize[dd];
-			}
-			if(nSlice>nSliceMax) nSliceMax = nSlice;
-		}
+	//Cycle through subgrids
+	for(int q = 1; q < nLevels; q++){
+		//Allocate
+		int *subTrueSize = arGet(*arena, rank*sizeof(*subTrueSize));
+		int *subSize = arGet(*arena, rank*sizeof(*subSize));
+		long int nSliceMax = mgSubGridSize(grid, q, subTrueSize, subSize);
 
-		long int *subSizeProd = malloc((rank+1)*sizeof(*subSizeProd));
+		long int *subSizeProd = arGet(*arena, (rank+1)*sizeof(*subSizeProd));
 		ailCumProd(subSize, subSizeProd, rank);
 
 		//Alloc slice and val
-		double *val = malloc(subSizeProd[rank]*sizeof(*val));
-		double *sendSlice = malloc(nSliceMax*sizeof(*sendSlice));
-		double *recvSlice = malloc(nSliceMax*sizeof(*recvSlice));
-		double *bndSlice = malloc(2*rank*nSliceMax*sizeof(*bndSlice));
+		double *val = arGet(*arena, subSizeProd[rank]*sizeof(*val));
+		double *recvSlice = arGet(*arena, 2*nSliceMax*sizeof(*recvSlice));
+		double *bndSlice = arGet(*arena, 2*rank*nSliceMax*sizeof(*bndSlice));
 
 		//Ghost layer vector
-		int *subNGhostLayers = malloc(rank*2*sizeof(*subNGhostLayers));
+		int *subNGhostLayers = arGet(*arena, rank*2*sizeof(*subNGhostLayers));
 		for(int d = 0; d < 2*rank; d++)	subNGhostLayers[d] = nGhostLayers[d];
 
 		//Copying boundaries
-		bndType *subBnd = malloc(rank*2*sizeof(*subBnd));
+		bndType *subBnd = arGet(*arena, rank*2*sizeof(*subBnd));
 		for(int d = 0; d < 2*rank; d++)	subBnd[d] = bnd[d];
 
 		//Assign to grid
@@ -193,14 +242,24 @@ Grid **mgAllocSubGrids(const dictionary *ini, Grid *grid,
 		grid->sizeProd = subSizeProd;
 		grid->nGhostLayers = subNGhostLayers;
 
-		grid->sendSlice = sendSlice;
 		grid->recvSlice = recvSlice;
 		grid->bndSlice = bndSlice;
 		grid->h5 = 0;
 		grid->bnd = subBnd;
+		grid->tileSize = NULL;
+		grid->arena = *arena;
+		grid->deep = NULL;
+		grid->deepTypes = NULL;
+		grid->colorTypes = NULL;
+		grid->singleTypes = NULL;
+		grid->haloTime = NULL;
+
+		gCreateHalo(grid);
+		gSetTileSize(grid, tileSize);
 
 		grids[q] = grid;
 	}
+	free(tileSize);
 
 	return grids;
 }
@@ -209,29 +268,56 @@ Grid **mgAllocSubGrids(const dictionary *ini, Grid *grid,
  *		Inline functions
  ************************************************/
 
- inline static void loopRedBlack2D(double *rhoVal,double *phiVal,long int *sizeProd, int *trueSize, int kEdgeInc,
- 				long int g){
+ /**
+  * @brief Colors of the nodes in red and black Gauss-Seidel
+  *
+  * The color is the parity of the sum of the indices of a node in the array.
+  */
+enum{BLACK = 0, RED = 1};
+
+ inline static void loopRedBlack2DBox(double *phiVal, const double *rhoVal,
+ 				const long int *sizeProd, const int *lower, const int *upper, int color){
+
+ 	long int gj = sizeProd[1];
+ 	long int gk = sizeProd[2];
+
+ 	#pragma omp parallel for if((upper[1]-lower[1])*(upper[2]-lower[2]) >= OMP_MIN_NODES) schedule(static)
+ 	for(int k = lower[2]; k < upper[2]; k++){
+ 		int j = lower[1] + (lower[1]+k+color)%2;
+ 		long int g = j*gj + k*gk;
+ 		for(; j < upper[1]; j += 2){
+ 			phiVal[g] = 0.25*(	phiVal[g+gj] + phiVal[g-gj] +
+ 								phiVal[g+gk] + phiVal[g-gk] + rhoVal[g]);
+ 			g += 2;
+ 		}
+ 	}
 
- 	long int gj = g + sizeProd[1];
- 	long int gjj= g - sizeProd[1];
- 	long int gk = g + sizeProd[2];
- 	long int gkk= g - sizeProd[2];
+ 	return;
+ }
 
- 	for(int k = 1; k < trueSize[2]; k +=2){
- 		for(int j = 1; j < trueSize[1]; j += 2){
- 			phiVal[g] = 0.25*(	phiVal[gj] + phiVal[gjj] +
- 								phiVal[gk] + phiVal[gkk] + rhoVal[g]);
- 			g	+=2;
- 			gj	+=2;
- 			gjj	+=2;
- 			gk	+=2;
- 			gkk	+=2;
+ inline static void loopRedBlack3DBox(double *phiVal, const double *rhoVal,
+ 				const long int *sizeProd, const int *lower, const int *upper, int color){
+
+ 	long int gj = sizeProd[1];
+ 	long int gk = sizeProd[2];
+ 	long int gl = sizeProd[3];
+
+ 	double coeff = 1./6.;
+
+ 	// Each row only writes nodes of one color and reads the other
+ 	#pragma omp parallel for collapse(2) schedule(static) \
+ 		if((upper[1]-lower[1])*(upper[2]-lower[2])*(upper[3]-lower[3]) >= OMP_MIN_NODES)
+ 	for(int l = lower[3]; l < upper[3]; l++){
+ 		for(int k = lower[2]; k < upper[2]; k++){
+ 			int j = lower[1] + (lower[1]+k+l+color)%2;
+ 			long int g = j*gj + k*gk + l*gl;
+ 			for(; j < upper[1]; j += 2){
+ 				phiVal[g] = coeff*(	phiVal[g+gj] + phiVal[g-gj] +
+ 									phiVal[g+gk] + phiVal[g-gk] +
+ 									phiVal[g+gl] + phiVal[g-gl] + rhoVal[g]);
+ 				g += 2;
+ 			}
  		}
- 		g	+=kEdgeInc;
- 		gj	+=kEdgeInc;
- 		gjj	+=kEdgeInc;
- 		gk	+=kEdgeInc;
- 		gkk	+=kEdgeInc;
  	}
 
  	return;
@@ -294,25 +380,38 @@ Grid **mgAllocSubGrids(const dictionary *ini, Grid *grid,
  ************************************************/
 
 
-Multigrid *mgAlloc(const dictionary *ini, Grid *grid){
+/**
+ * @brief mgAlloc() with a given number of levels
+ */
+static Multigrid *mgAllocLevels(const dictionary *ini, Grid *grid, int nLevels){
 
 	//Multigrid
-	int nLevels = iniGetInt(ini, "multigrid:mgLevels");
 	int nMGCycles = iniGetInt(ini, "multigrid:mgCycles");
 	int nPreSmooth = iniGetInt(ini, "multigrid:nPreSmooth");
 	int nPostSmooth = iniGetInt(ini, "multigrid:nPostSmooth");
 	int nCoarseSolve = iniGetInt(ini, "multigrid:nCoarseSolve");
+	double tolerance = iniGetDouble(ini, "multigrid:tolerance");
+	char *toleranceType = iniGetStr(ini, "multigrid:toleranceType");
+	int checkInterval = iniGetInt(ini, "multigrid:checkInterval");
+	int warmStart = iniGetInt(ini, "multigrid:warmStart");
 	//Load data
 	int nDims = grid->rank-1;
 	int *trueSize = grid->trueSize;
 
 
 	//Sanity checks
-	if(nLevels<1) msg(ERROR, "Multi Grid levels is 0, need 1 grid level \n");
-	if(nLevels==1) msg(WARNING, "Multi Grid levels is 1, using Gauss-Seidel Red'Black \n");
-
 	if(!nMGCycles) msg(ERROR, "MG cycles is 0 \n");
 
+	int relTolerance = 0;
+	if(!strcmp(toleranceType, "RELATIVE")) relTolerance = 1;
+	else if(strcmp(toleranceType, "ABSOLUTE"))
+		msg(ERROR, "multigrid:toleranceType must be ABSOLUTE or RELATIVE");
+	free(toleranceType);
+
+	if(checkInterval < 0) msg(ERROR, "multigrid:checkInterval can't be negative");
+	if(checkInterval && tolerance <= 0)
+		msg(ERROR, "multigrid:tolerance must be positive unless checkInterval is 0");
+
 
 	// Sanity check (true grid points need to be a multiple of 2^(multigrid levels)
 	for(int d = 0; d < nDims; d++){
@@ -328,7 +427,8 @@ Multigrid *mgAlloc(const dictionary *ini, Grid *grid){
 		}
 	}
 
-	Grid **grids = mgAllocSubGrids(ini, grid, nLevels);
+	Arena *arena;
+	Grid **grids = mgAllocSubGrids(ini, grid, nLevels, &arena);
 
 	//Store in multigrid struct
     Multigrid *multigrid = malloc(sizeof(Multigrid));
@@ -338,7 +438,14 @@ Multigrid *mgAlloc(const dictionary *ini, Grid *grid){
 	multigrid->nPreSmooth = nPreSmooth;
 	multigrid->nPostSmooth = nPostSmooth;
 	multigrid->nCoarseSolve = nCoarseSolve;
+	multigrid->tolerance = tolerance;
+	multigrid->relTolerance = relTolerance;
+	multigrid->checkInterval = checkInterval;
+	multigrid->warmStart = warmStart;
+	multigrid->agglomeration = NULL;
+	multigrid->mixed = NULL;
     multigrid->grids = grids;
+	multigrid->arena = arena;
 
     //Setting the algorithms to be used, pointer functions
 	mgSetSolver(ini, multigrid);
@@ -348,29 +455,541 @@ Multigrid *mgAlloc(const dictionary *ini, Grid *grid){
 
 }
 
+Multigrid *mgAlloc(const dictionary *ini, Grid *grid){
+
+	int nLevels = iniGetInt(ini, "multigrid:mgLevels");
+
+	//Sanity checks
+	if(nLevels<1) msg(ERROR, "Multi Grid levels is 0, need 1 grid level \n");
+	if(nLevels==1) msg(WARNING, "Multi Grid levels is 1, using Gauss-Seidel Red'Black \n");
+
+	return mgAllocLevels(ini, grid, nLevels);
+}
+
+/**
+ * @brief Allocates Multigrid.agglomeration of mgRho, if multigrid:agglomerate is set
+ * @param	ini		Input file
+ * @param	mgRho	Multigrid of rho
+ * @param	mgAlgo	Cycle to use on the gathered levels
+ *
+ * The types locating the blocks of each process in the gathered level depend
+ * on the cuts in MpiInfo, and are created by the first solve.
+ */
+static void mgAllocAgglomeration(const dictionary *ini, Multigrid *mgRho, funPtr mgAlgo){
+
+	int nAgglomerated = iniGetInt(ini, "multigrid:agglomerate");
+	if(nAgglomerated < 0) msg(ERROR, "multigrid:agglomerate can't be negative");
+	if(nAgglomerated == 0 || mgRho->nLevels == 1) return;
+
+	Grid *coarsest = mgRho->grids[mgRho->nLevels-1];
+	int rank = coarsest->rank;
+	int nDims = rank-1;
+	int bottom = mgRho->nLevels-1;
+
+	for(int r = 0; r < 2*rank; r++){
+		if(r%rank && coarsest->bnd[r] != PERIODIC)
+			msg(ERROR, "multigrid:agglomerate requires periodic boundaries");
+	}
+
+	// Levels are halved as in mgAlloc()
+	int *globalSize = gGetGlobalSize(ini);
+	for(int d = 0; d < nDims; d++){
+		globalSize[d] >>= bottom;
+		if(globalSize[d] % (1<<nAgglomerated))
+			msg(ERROR, "multigrid:agglomerate=%d levels can't be made from a "
+				"coarsest level of %d nodes", nAgglomerated, globalSize[d]);
+	}
+
+	Agglomeration *agg = malloc(sizeof(*agg));
+	MPI_Comm_dup(simComm(), &agg->comm);
+	MPI_Comm_rank(agg->comm, &agg->mpiRank);
+	MPI_Comm_size(agg->comm, &agg->mpiSize);
+	agg->mgAlgo = mgAlgo;
+	agg->blockTypes = NULL;
+	agg->ready = 0;
+	agg->requests = malloc((agg->mpiSize+1)*sizeof(*agg->requests));
+
+	int *subSize = malloc(rank*sizeof(*subSize));
+	int *start = malloc(rank*sizeof(*start));
+	for(int d = 0; d < rank; d++){
+		subSize[d] = coarsest->trueSize[d];
+		start[d] = coarsest->nGhostLayers[d];
+	}
+	MPI_Type_create_subarray(rank, coarsest->size, subSize, start,
+							 MPI_ORDER_FORTRAN, MPI_DOUBLE, &agg->trueType);
+	MPI_Type_commit(&agg->trueType);
+	free(subSize);
+	free(start);
+
+	if(agg->mpiRank == 0){
+		Grid *rho = gAllocSized(ini, SCALAR, globalSize);
+		Grid *phi = gAllocSized(ini, SCALAR, globalSize);
+		Grid *res = gAllocSized(ini, SCALAR, globalSize);
+		gZero(rho);
+		gZero(phi);
+		gZero(res);
+		agg->mgRho = mgAllocLevels(ini, rho, nAgglomerated);
+		agg->mgPhi = mgAllocLevels(ini, phi, nAgglomerated);
+		agg->mgRes = mgAllocLevels(ini, res, nAgglomerated);
+		agg->mpiInfo = gAllocMpiSelf(ini, globalSize);
+	} else {
+		agg->mgRho = NULL;
+		agg->mgPhi = NULL;
+		agg->mgRes = NULL;
+		agg->mpiInfo = NULL;
+	}
+
+	free(globalSize);
+
+	mgRho->agglomeration = agg;
+}
+
+static void mgFreeAgglomeration(Agglomeration *agg){
+
+	if(agg->mpiRank == 0){
+		Multigrid *multigrids[3] = {agg->mgRho, agg->mgPhi, agg->mgRes};
+		for(int m = 0; m < 3; m++){
+			Grid *grid = multigrids[m]->grids[0];
+			mgFree(multigrids[m]);
+			gFree(grid);
+		}
+		gFreeMpi(agg->mpiInfo);
+	}
+
+	if(agg->blockTypes){
+		for(int r = 0; r < agg->mpiSize; r++) MPI_Type_free(&agg->blockTypes[r]);
+		free(agg->blockTypes);
+	}
+
+	MPI_Type_free(&agg->trueType);
+	MPI_Comm_free(&agg->comm);
+	free(agg->requests);
+	free(agg);
+}
+
+/**
+ * @brief Allocates Multigrid.mixed of mgRho, if multigrid:precision is MIXED
+ * @param	ini		Input file
+ * @param	mgRho	Multigrid of rho
+ * @param	mgPhi	Multigrid of phi
+ * @param	mgAlgo	Cycle
+ */
+static void mgAllocMixed(const dictionary *ini, Multigrid *mgRho,
+						 const Multigrid *mgPhi, funPtr mgAlgo){
+
+	char *precision = iniGetStr(ini, "multigrid:precision");
+	int mixed = 0;
+	if(!strcmp(precision, "MIXED")) mixed = 1;
+	else if(strcmp(precision, "DOUBLE"))
+		msg(ERROR, "multigrid:precision must be DOUBLE or MIXED");
+	free(precision);
+
+	if(!mixed || mgRho->nLevels == 1) return;
+
+	Grid **grids = mgRho->grids;
+	int rank = grids[0]->rank;
+	int nLevels = mgRho->nLevels;
+
+	if(rank != 4)
+		msg(ERROR, "multigrid:precision=MIXED is only implemented in 3D");
+	if(mgAlgo != (funPtr)mgVRecursive && mgAlgo != (funPtr)mgVRegular)
+		msg(ERROR, "multigrid:precision=MIXED requires the mgVRecursive or mgVRegular cycle");
+	if(mgRho->preSmooth != mgGS3D || mgRho->postSmooth != mgGS3D || mgRho->coarseSolv != mgGS3D)
+		msg(ERROR, "multigrid:precision=MIXED requires gaussSeidelRB smoothers and coarse solver");
+	if(mgRho->restrictor != mgHalfRestrict3D || mgRho->prolongator != mgBilinProl3D)
+		msg(ERROR, "multigrid:precision=MIXED requires halfWeight and bilinear");
+	if(mgRho->agglomeration)
+		msg(ERROR, "multigrid:precision=MIXED can't be combined with multigrid:agglomerate");
+
+	for(int r = 0; r < 2*rank; r++){
+		if(r%rank && grids[0]->bnd[r] != PERIODIC)
+			msg(ERROR, "multigrid:precision=MIXED requires periodic boundaries");
+	}
+	for(int q = 1; q < nLevels; q++){
+		if(mgPhi->grids[q]->deep)
+			msg(ERROR, "multigrid:haloDepth above 1 is only supported on the finest "
+				"level with multigrid:precision=MIXED");
+	}
+
+	MixedPrecision *single = malloc(sizeof(*single));
+	single->rho = malloc(nLevels*sizeof(*single->rho));
+	single->phi = malloc(nLevels*sizeof(*single->phi));
+	single->res = malloc(nLevels*sizeof(*single->res));
+
+	single->rho[0] = NULL;
+	single->phi[0] = NULL;
+	single->res[0] = NULL;
+	for(int q = 1; q < nLevels; q++){
+		long int nElements = grids[q]->sizeProd[rank];
+		single->rho[q] = calloc(nElements, sizeof(*single->rho[q]));
+		single->phi[q] = calloc(nElements, sizeof(*single->phi[q]));
+		single->res[q] = calloc(nElements, sizeof(*single->res[q]));
+		gCreateSingleHalo(grids[q]);
+	}
+
+	mgRho->mixed = single;
+}
+
+static void mgFreeMixed(MixedPrecision *mixed, int nLevels){
+
+	for(int q = 1; q < nLevels; q++){
+		free(mixed->rho[q]);
+		free(mixed->phi[q]);
+		free(mixed->res[q]);
+	}
+	free(mixed->rho);
+	free(mixed->phi);
+	free(mixed->res);
+	free(mixed);
+}
+
 void mgFree(Multigrid *multigrid){
 
 	Grid **grids = multigrid->grids;
 	int nLevels = multigrid->nLevels;
 
+	// The finest grid isn't ours, but its deep and color halos are
+	gDestroyDeepHalo(grids[0]);
+	gDestroyColorHalo(grids[0]);
+	if(multigrid->agglomeration) mgFreeAgglomeration(multigrid->agglomeration);
+	if(multigrid->mixed) mgFreeMixed(multigrid->mixed, nLevels);
+
 	for(int n = 1; n < nLevels; n++){
 		gFree(grids[n]);
 	}
+	arFree(multigrid->arena);
+	free(grids);
 	free(multigrid);
 
 	return;
 }
 
-MultigridSolver* mgAllocSolver(const dictionary *ini, Grid *rho, Grid *phi){
+/**
+ * @brief Creates deep halos of the levels of phi and rho (multigrid:haloDepth)
+ * @param	ini		Input file
+ * @param	mgRho	Multigrid of rho
+ * @param	mgPhi	Multigrid of phi
+ *
+ * The depth of each level is limited by the narrowest subdomain, and levels
+ * of odd widths are left alone since the red and black nodes of the ghost
+ * layers wouldn't agree with those of the neighbors.
+ */
+static void mgCreateDeepHalos(const dictionary *ini, Multigrid *mgRho, Multigrid *mgPhi){
+
+	int nLevels = mgPhi->nLevels;
+	int *haloDepth = iniGetIntArr(ini, "multigrid:haloDepth", nLevels);
+	Grid **grids = mgPhi->grids;
+	int rank = grids[0]->rank;
+
+	int deep = 0;
+	for(int q = 0; q < nLevels; q++){
+		if(haloDepth[q] < 1) msg(ERROR, "multigrid:haloDepth must be at least 1");
+		if(haloDepth[q] > 1) deep = 1;
+	}
+
+	if(deep){
+		if(rank != 4) msg(WARNING, "multigrid:haloDepth only applies to 3D smoothers");
+		for(int r = 0; r < 2*rank; r++){
+			if(r%rank && grids[0]->bnd[r] != PERIODIC)
+				msg(ERROR, "multigrid:haloDepth above 1 requires periodic boundaries");
+		}
+	}
+
+	for(int q = 0; q < nLevels; q++){
+		for(int d = 1; d < rank; d++){
+			int width = grids[q]->trueSize[d];
+			if(width < haloDepth[q]) haloDepth[q] = width;
+			if(width%2) haloDepth[q] = 1;
+		}
+	}
+	MPI_Allreduce(MPI_IN_PLACE, haloDepth, nLevels, MPI_INT, MPI_MIN, simComm());
+
+	for(int q = 0; q < nLevels && rank == 4; q++){
+		if(haloDepth[q] > 1){
+			gCreateDeepHalo(mgPhi->grids[q], haloDepth[q]);
+			gCreateDeepHalo(mgRho->grids[q], haloDepth[q]);
+		}
+	}
+
+	free(haloDepth);
+}
+
+/**
+ * @brief Lets the red-black smoothers send only the color just updated
+ * @param	mgPhi	Multigrid of phi
+ *
+ * Only done on levels where all subdomains are of even widths, such that the
+ * colors of the ghost layers agree with those of the neighbors.
+ */
+static void mgCreateColorHalos(Multigrid *mgPhi){
+
+	int nLevels = mgPhi->nLevels;
+	Grid **grids = mgPhi->grids;
+	int rank = grids[0]->rank;
+
+	int *even = malloc(nLevels*sizeof(*even));
+	for(int q = 0; q < nLevels; q++){
+		even[q] = 1;
+		for(int d = 1; d < rank; d++){
+			if(grids[q]->trueSize[d]%2) even[q] = 0;
+		}
+	}
+	MPI_Allreduce(MPI_IN_PLACE, even, nLevels, MPI_INT, MPI_LAND, simComm());
+
+	for(int q = 0; q < nLevels; q++){
+		if(even[q]) gCreateColorHalo(grids[q]);
+	}
+
+	free(even);
+}
+
+/**
+ * @brief Fills rho with neutral noise, independent of the decomposition
+ *
+ * Each true node gets a hash of its global index, which like the charge
+ * density of particles has all modes.
+ */
+static void mgFillNoise(Grid *rho, const MpiInfo *mpiInfo){
+
+	int rank = rho->rank;
+	int *size = rho->size;
+	int *nGhostLayers = rho->nGhostLayers;
+	long int *sizeProd = rho->sizeProd;
+	int *offset = mpiInfo->offset;
+
+	for(long int p = 0; p < sizeProd[rank]; p++){
+
+		unsigned long long key = 0;
+		int ghost = 0;
+		for(int d = 1; d < rank; d++){
+			int i = (int)((p/sizeProd[d])%size[d]);
+			if(i < nGhostLayers[d] || i >= size[d]-nGhostLayers[d+rank]) ghost = 1;
+			key = key*2654435761ULL + (unsigned long long)(i - nGhostLayers[d] + offset[d-1]);
+		}
+
+		// SplitMix64 finalizer
+		key += 0x9E3779B97F4A7C15ULL;
+		key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+		key ^= key >> 31;
+
+		rho->val[p] = ghost ? 0 : (double)(key >> 11)/(double)(1ULL << 53) - 0.5;
+	}
+
+	gNeutralizeGrid(rho, mpiInfo);
+}
+
+/**
+ * @brief Solves from zero as mgSolveRaw(), but gives up after maxCycles cycles
+ * @return	1 if the residual reached target, else 0
+ */
+static int mgTuneSolve(const MultigridSolver *solver, double target,
+						int maxCycles, const MpiInfo *mpiInfo){
+
+	Multigrid *mgRho = solver->mgRho;
+	Multigrid *mgPhi = solver->mgPhi;
+	Multigrid *mgRes = solver->mgRes;
+	int bottom = mgRho->nLevels-1;
+	int checkInterval = mgRho->checkInterval > 0 ? mgRho->checkInterval : 1;
+
+	Grid *phi = mgPhi->grids[0];
+	Grid *rho = mgRho->grids[0];
+	Grid *res = mgRes->grids[0];
+
+	gZero(phi);
+	for(int c = 1; c <= maxCycles; c++){
+		solver->mgAlgo(0, bottom, 0, mgRho, mgPhi, mgRes, mpiInfo);
+		if(c%checkInterval) continue;
+
+		mgResidual(res, rho, phi, mpiInfo);
+		double rms = sqrt(mgSumTrueSquared(res, mpiInfo)/gTotTruesize(res, mpiInfo));
+		if(rms <= target) return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Sets the [multigrid] keys of ini to the fastest candidate (multigrid:autoTune)
+ * @param	ini		Input file
+ * @param	rho		Charge density (restored on return)
+ * @param	phi		Electric potential (restored on return)
+ * @param	mpiInfo	MpiInfo
+ *
+ * Each candidate is timed on rho filled by mgFillNoise(), as the slowest
+ * process' average of multigrid:autoTune solves from zero after an untimed
+ * one. Candidates whose residual does not reach multigrid:tolerance within
+ * 100 cycles are skipped. The
+ * choice is logged, and multigrid:autoTune is set to 0 such that later
+ * allocations (e.g. after gBalance()) reuse it.
+ */
+static void mgAutoTune(dictionary *ini, Grid *rho, Grid *phi, const MpiInfo *mpiInfo){
+
+	int nSolves = iniGetInt(ini, "multigrid:autoTune");
+	if(nSolves < 0) msg(ERROR, "multigrid:autoTune can't be negative");
+	iniSetInt(ini, "multigrid:autoTune", 0);
+	if(nSolves == 0) return;
+
+	double tolerance = iniGetDouble(ini, "multigrid:tolerance");
+	if(tolerance <= 0) msg(ERROR, "multigrid:autoTune requires a positive multigrid:tolerance");
+
+	char *toleranceType = iniGetStr(ini, "multigrid:toleranceType");
+	int relTolerance = !strcmp(toleranceType, "RELATIVE");
+	free(toleranceType);
+
+	char *precision = iniGetStr(ini, "multigrid:precision");
+	int mixed = !strcmp(precision, "MIXED");
+	free(precision);
+
+	int rank = rho->rank;
+	int nDims = rank-1;
+
+	// MIXED only supports the recursive V cycle and Gauss-Seidel
+	const char *cycles[] = {"mgVRecursive", "mgW"};
+	const char *smoothers3D[] = {"gaussSeidelRB", "jacobian"};
+	const char *smoothersND[] = {"gaussSeidelRBND", "jacobianND"};
+	const char **smoothers = nDims == 3 ? smoothers3D : smoothersND;
+	int sweeps[] = {1, 2, 4};
+	int nCycleTypes = mixed ? 1 : 2;
+	int nSmootherTypes = mixed ? 1 : 2;
+	int nSweeps = sizeof(sweeps)/sizeof(*sweeps);
+
+	// The most levels all subdomains can be halved into, and one less. The
+	// levels of the gathered hierarchy depend on it, so keep it then.
+	int levels[2];
+	int nLevelCounts = 1;
+	levels[0] = iniGetInt(ini, "multigrid:mgLevels");
+	if(iniGetInt(ini, "multigrid:agglomerate") == 0){
+		int maxLevels = 0;
+		int divisible = 1;
+		while(divisible){
+			maxLevels++;
+			for(int d = 1; d < rank; d++){
+				if(rho->trueSize[d] % (1<<(maxLevels+1))) divisible = 0;
+			}
+		}
+		MPI_Allreduce(MPI_IN_PLACE, &maxLevels, 1, MPI_INT, MPI_MIN, mpiInfo->comm);
+		levels[0] = maxLevels;
+		levels[1] = maxLevels-1;
+		nLevelCounts = maxLevels > 2 ? 2 : 1;
+	}
+
+	// Keep the fields and the keys being tried
+	char *original[] = {
+		iniGetStr(ini, "multigrid:cycle"), iniGetStr(ini, "multigrid:preSmooth"),
+		iniGetStr(ini, "multigrid:postSmooth"), iniGetStr(ini, "multigrid:nPreSmooth"),
+		iniGetStr(ini, "multigrid:nPostSmooth"), iniGetStr(ini, "multigrid:mgLevels")};
+	const char *keys[] = {
+		"multigrid:cycle", "multigrid:preSmooth", "multigrid:postSmooth",
+		"multigrid:nPreSmooth", "multigrid:nPostSmooth", "multigrid:mgLevels"};
+	int nKeys = sizeof(keys)/sizeof(*keys);
+
+	long int nElements = rho->sizeProd[rank];
+	double *rhoSaved = malloc(nElements*sizeof(*rhoSaved));
+	double *phiSaved = malloc(nElements*sizeof(*phiSaved));
+	for(long int p = 0; p < nElements; p++){
+		rhoSaved[p] = rho->val[p];
+		phiSaved[p] = phi->val[p];
+	}
+
+	mgFillNoise(rho, mpiInfo);
+	gCopy(rho, phi);
+	double target = tolerance;
+	if(relTolerance) target *= sqrt(mgSumTrueSquared(phi, mpiInfo)/gTotTruesize(phi, mpiInfo));
+
+	// Cycles after which a candidate counts as not converging
+	int maxCycles = 100;
+	double bestTime = INFINITY;
+	int best[4] = {-1, -1, -1, -1};
+
+	for(int c = 0; c < nCycleTypes; c++)
+	for(int m = 0; m < nSmootherTypes; m++)
+	for(int n = 0; n < nSweeps; n++)
+	for(int q = 0; q < nLevelCounts; q++){
+
+		iniSetStr(ini, "multigrid:cycle", cycles[c]);
+		iniSetStr(ini, "multigrid:preSmooth", smoothers[m]);
+		iniSetStr(ini, "multigrid:postSmooth", smoothers[m]);
+		iniSetInt(ini, "multigrid:nPreSmooth", sweeps[n]);
+		iniSetInt(ini, "multigrid:nPostSmooth", sweeps[n]);
+		iniSetInt(ini, "multigrid:mgLevels", levels[q]);
+
+		MultigridSolver *solver = mgAllocSolver(ini, rho, phi, mpiInfo);
+
+		int converged = mgTuneSolve(solver, target, maxCycles, mpiInfo);
+		MPI_Barrier(mpiInfo->comm);
+		double start = MPI_Wtime();
+		for(int s = 0; s < nSolves && converged; s++){
+			mgTuneSolve(solver, target, maxCycles, mpiInfo);
+		}
+		double time = (MPI_Wtime()-start)/nSolves;
+		MPI_Allreduce(MPI_IN_PLACE, &time, 1, MPI_DOUBLE, MPI_MAX, mpiInfo->comm);
+
+		if(converged){
+			msg(STATUS, "multigrid:autoTune %s, %s, %d sweeps, %d levels: %.3e s",
+				cycles[c], smoothers[m], sweeps[n], levels[q], time);
+		} else {
+			msg(STATUS, "multigrid:autoTune %s, %s, %d sweeps, %d levels: "
+				"not converged in %d cycles", cycles[c], smoothers[m], sweeps[n],
+				levels[q], maxCycles);
+		}
+
+		if(converged && time < bestTime){
+			bestTime = time;
+			best[0] = c; best[1] = m; best[2] = n; best[3] = q;
+		}
+
+		mgFreeSolver(solver);
+	}
+
+	for(int k = 0; k < nKeys; k++){
+		iniSetStr(ini, keys[k], original[k]);
+		free(original[k]);
+	}
+
+	if(best[0] < 0){
+		msg(WARNING, "multigrid:autoTune found no candidate reaching the "
+			"tolerance, using the input file");
+	} else {
+		iniSetStr(ini, "multigrid:cycle", cycles[best[0]]);
+		iniSetStr(ini, "multigrid:preSmooth", smoothers[best[1]]);
+		iniSetStr(ini, "multigrid:postSmooth", smoothers[best[1]]);
+		iniSetInt(ini, "multigrid:nPreSmooth", sweeps[best[2]]);
+		iniSetInt(ini, "multigrid:nPostSmooth", sweeps[best[2]]);
+		iniSetInt(ini, "multigrid:mgLevels", levels[best[3]]);
+		msg(STATUS, "multigrid:autoTune chose %s, %s, %d sweeps, %d levels",
+			cycles[best[0]], smoothers[best[1]], sweeps[best[2]], levels[best[3]]);
+	}
+
+	for(long int p = 0; p < nElements; p++){
+		rho->val[p] = rhoSaved[p];
+		phi->val[p] = phiSaved[p];
+	}
+	free(rhoSaved);
+	free(phiSaved);
+}
+
+MultigridSolver* mgAllocSolver(dictionary *ini, Grid *rho, Grid *phi,
+							   const MpiInfo *mpiInfo){
+
+	if(iniGetInt(ini, "multigrid:autoTune")) mgAutoTune(ini, rho, phi, mpiInfo);
 
 	MultigridSolver *solver = (MultigridSolver *)malloc(sizeof(*solver));
 
-	Grid *res = gAlloc(ini, SCALAR);
+	Grid *res = gAllocSized(ini, SCALAR, &rho->trueSize[1]);
 	Multigrid *mgRho = mgAlloc(ini, rho);
-	Multigrid *mgRes = mgAlloc(ini, res);
 	Multigrid *mgPhi = mgAlloc(ini, phi);
 
+	// The fused kernels only leave the finest residual for mgSolveRaw()
+	Multigrid *mgRes;
+	if(mgRho->residualRestrictor && mgRho->prolongAdder) mgRes = mgAllocLevels(ini, res, 1);
+	else mgRes = mgAlloc(ini, res);
+	mgCreateDeepHalos(ini, mgRho, mgPhi);
+	mgCreateColorHalos(mgPhi);
+
 	funPtr mgAlgo = getMgAlgo(ini);
+	mgAllocAgglomeration(ini, mgRho, mgAlgo);
+	mgAllocMixed(ini, mgRho, mgPhi, mgAlgo);
 
 	solver->res = res;
 	solver->mgRho = mgRho;
@@ -391,11 +1010,15 @@ void mgFreeSolver(MultigridSolver *solver){
 }
 void mgSolver(	void (**solve)(),
 				MultigridSolver *(**solverAlloc)(),
-				void (**solverFree)()){
+				void (**solverFree)(),
+				void (**solverWriteCheckpoint)(),
+				void (**solverReadCheckpoint)()){
 
 	*solve=mgSolve;
 	*solverAlloc=mgAllocSolver;
 	*solverFree=mgFreeSolver;
+	*solverWriteCheckpoint=mgWriteCheckpoint;
+	*solverReadCheckpoint=mgReadCheckpoint;
 }
 funPtr mgSolver_set(const dictionary *ini){
 	return mgSolver;
@@ -497,81 +1120,198 @@ void mgJacob1D(Grid *phi,const Grid *rho, const int nCycles, const  MpiInfo *mpi
 
 }
 
-void mgJacob3D(Grid *phi,const Grid *rho, const int nCycles, const  MpiInfo *mpiInfo){
+/*
+ * Deep halo smoothing (see gCreateDeepHalo()): After each exchange of the d
+ * ghost layers of phi->deep, up to d passes (or sweeps) are done, each on a
+ * box extending one layer less into the ghost layers than the previous. The
+ * passes are grouped from the end such that the last pass extends 1 layer,
+ * leaving the ghost layer of phi valid, and the first group may be shorter.
+ * Returns the extension of pass p.
+ */
+static int deepExtension(int p, int nPasses, int depth){
 
-	//Common variables
-	int rank = phi->rank;
-	long int *sizeProd = phi->sizeProd;
+	return (nPasses-p)%depth;
+}
 
-	//Seperate values
-	double *phiVal = phi->val;
-	double *rhoVal = rho->val;
+static void deepExchange(Grid *phi, const Grid *rho, int p, int nPasses,
+						 int depth, const MpiInfo *mpiInfo){
 
-	//Temporary value
-	double *tempVal = malloc (sizeProd[rank]*sizeof(*tempVal));
-	double coeff = 1./6;
+	if(p > 0 && deepExtension(p, nPasses, depth) != depth-1) return;
 
-	for(int c = 0; c < nCycles; c++){
-		// Index of neighboring nodes
-		long int g =  sizeProd[1] + sizeProd[2] + sizeProd[3];
+	// rho only changes between calls
+	if(p == 0) gHaloOpDeepBegin(rho, mpiInfo);
+	gHaloOpDeepBegin(phi, mpiInfo);
+	gHaloOpDeepEnd(rho);
+	gHaloOpDeepEnd(phi);
+}
 
-		long int gj = sizeProd[1];
-		long int gjj= -sizeProd[1];
-		long int gk = sizeProd[2];
-		long int gkk= -sizeProd[2];
-		long int gl = sizeProd[3];
-		long int gll= -sizeProd[3];
+static void mgGS3DDeep(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
 
-		long int end = sizeProd[rank] - 2*g;
+	Grid *deep = phi->deep;
+	int rank = deep->rank;
+	int *size = deep->size;
+	int depth = deep->nGhostLayers[1];
 
-		for(long int q = 0; q < end; q++){
-			tempVal[g] = coeff*(phiVal[gj] + phiVal[gjj] +
-								phiVal[gk] + phiVal[gkk] +
-								phiVal[gl] + phiVal[gll] +
-								+ rhoVal[g]);
+	// Colors are the parity of the indices, which are shifted in the copy
+	int shift = 0;
+	for(int d = 1; d < rank; d++) shift += depth - phi->nGhostLayers[d];
 
-			gj++;
-			gjj++;
-			gk++;
-			gkk++;
-			gl++;
-			gll++;
-		}
+	gToDeep(phi);
+	gToDeep(rho);
 
-		for(long int q = 0; q < sizeProd[rank]; q++) phiVal[q] = tempVal[q];
+	int lower[4], upper[4];
+	lower[0] = 0;
+	upper[0] = size[0];
 
-		gHaloOp(setSlice, phi, mpiInfo, TOHALO);
-		gBnd(phi, mpiInfo);
+	int nPasses = 2*nCycles;
+	for(int p = 0; p < nPasses; p++){
+
+		deepExchange(phi, rho, p, nPasses, depth, mpiInfo);
+
+		int ext = deepExtension(p, nPasses, depth);
+		for(int d = 1; d < rank; d++){
+			lower[d] = depth-ext;
+			upper[d] = size[d]-depth+ext;
+		}
 
+		int color = (p%2) ? BLACK : RED;
+		loopRedBlack3DBox(deep->val, rho->deep->val, deep->sizeProd,
+						  lower, upper, (color+shift)%2);
 	}
 
-	free(tempVal);
+	// Subtracting the average once rather than after every pass only differs
+	// by roundoff, since a pass commutes with adding a constant.
+	gFromDeep(phi);
+	gBnd(phi, mpiInfo);
 
-	return;
 }
 
-static void mgGSNDInner(double *phiVal, const double *rhoVal, double *coeff, long int *g,
-	const int *rank,const int *nGhostLayersBefore, const int *nGhostLayersAfter,
-	const int *trueSize, const long int *sizeProd){
+static void mgJacob3DDeep(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
 
-	if(*sizeProd==1){
-		//proceed x direction
-		int q;
-		for(q = 0; q < *trueSize; q+=2){
-			int gStep;
-			phiVal[*g] = 0;
-			for(int r = 0; r < *rank-1; r++){
-				gStep 	= *(sizeProd+r);
-				phiVal[*g] += phiVal[*g+gStep] + phiVal[*g-gStep];
-			}
-			phiVal[*g] += rhoVal[*g];
-			phiVal[*g] *= *coeff;
-			*g += 2;
-		}
-		*g += *nGhostLayersBefore + *nGhostLayersAfter + (2*(*g%2)-1);
-	} else {
-		//Go down a dimension
-		int q;
+	Grid *deep = phi->deep;
+	int *size = deep->size;
+	long int *sizeProd = deep->sizeProd;
+	int depth = deep->nGhostLayers[1];
+
+	double *phiVal = deep->val;
+	double *rhoVal = rho->deep->val;
+	double *tempVal = malloc(sizeProd[4]*sizeof(*tempVal));
+	double coeff = 1./6;
+
+	long int gj = sizeProd[1];
+	long int gk = sizeProd[2];
+	long int gl = sizeProd[3];
+
+	gToDeep(phi);
+	gToDeep(rho);
+
+	for(int c = 0; c < nCycles; c++){
+
+		deepExchange(phi, rho, c, nCycles, depth, mpiInfo);
+
+		// Box of nodes from lo to size-lo along each dimension
+		int lo = depth-deepExtension(c, nCycles, depth);
+
+		#pragma omp parallel for collapse(2) if((size[1]-2*lo)*(size[2]-2*lo)*(size[3]-2*lo) >= OMP_MIN_NODES) schedule(static)
+		for(int l = lo; l < size[3]-lo; l++){
+			for(int k = lo; k < size[2]-lo; k++){
+				long int g = lo*gj + k*gk + l*gl;
+				for(int j = lo; j < size[1]-lo; j++, g++){
+					tempVal[g] = coeff*(phiVal[g+gj] + phiVal[g-gj] +
+										phiVal[g+gk] + phiVal[g-gk] +
+										phiVal[g+gl] + phiVal[g-gl] + rhoVal[g]);
+				}
+			}
+		}
+
+		#pragma omp parallel for collapse(2) if((size[1]-2*lo)*(size[2]-2*lo)*(size[3]-2*lo) >= OMP_MIN_NODES) schedule(static)
+		for(int l = lo; l < size[3]-lo; l++){
+			for(int k = lo; k < size[2]-lo; k++){
+				long int g = lo*gj + k*gk + l*gl;
+				for(int j = lo; j < size[1]-lo; j++, g++) phiVal[g] = tempVal[g];
+			}
+		}
+	}
+
+	free(tempVal);
+
+	gFromDeep(phi);
+	gBnd(phi, mpiInfo);
+
+}
+
+void mgJacob3D(Grid *phi,const Grid *rho, const int nCycles, const  MpiInfo *mpiInfo){
+
+	if(phi->deep && rho->deep){
+		mgJacob3DDeep(phi, rho, nCycles, mpiInfo);
+		return;
+	}
+
+	//Common variables
+	int rank = phi->rank;
+	long int *sizeProd = phi->sizeProd;
+
+	//Seperate values
+	double *phiVal = phi->val;
+	double *rhoVal = rho->val;
+
+	//Temporary value
+	double *tempVal = malloc (sizeProd[rank]*sizeof(*tempVal));
+	double coeff = 1./6;
+
+	// Index of first node and of neighboring nodes
+	long int g =  sizeProd[1] + sizeProd[2] + sizeProd[3];
+	long int gj = sizeProd[1];
+	long int gk = sizeProd[2];
+	long int gl = sizeProd[3];
+
+	long int end = sizeProd[rank] - 2*g;
+
+	for(int c = 0; c < nCycles; c++){
+
+		#pragma omp parallel for simd if(end >= OMP_MIN_NODES) schedule(static)
+		for(long int q = g; q < g+end; q++){
+			tempVal[q] = coeff*(phiVal[q+gj] + phiVal[q-gj] +
+								phiVal[q+gk] + phiVal[q-gk] +
+								phiVal[q+gl] + phiVal[q-gl] +
+								+ rhoVal[q]);
+		}
+
+		#pragma omp parallel for simd if(end >= OMP_MIN_NODES) schedule(static)
+		for(long int q = g; q < g+end; q++) phiVal[q] = tempVal[q];
+
+		gHaloOp(setSlice, phi, mpiInfo, TOHALO);
+		gBnd(phi, mpiInfo);
+
+	}
+
+	free(tempVal);
+
+	return;
+}
+
+static void mgGSNDInner(double *phiVal, const double *rhoVal, double *coeff, long int *g,
+	const int *rank,const int *nGhostLayersBefore, const int *nGhostLayersAfter,
+	const int *trueSize, const long int *sizeProd){
+
+	if(*sizeProd==1){
+		//proceed x direction
+		int q;
+		for(q = 0; q < *trueSize; q+=2){
+			int gStep;
+			phiVal[*g] = 0;
+			for(int r = 0; r < *rank-1; r++){
+				gStep 	= *(sizeProd+r);
+				phiVal[*g] += phiVal[*g+gStep] + phiVal[*g-gStep];
+			}
+			phiVal[*g] += rhoVal[*g];
+			phiVal[*g] *= *coeff;
+			*g += 2;
+		}
+		*g += *nGhostLayersBefore + *nGhostLayersAfter + (2*(*g%2)-1);
+	} else {
+		//Go down a dimension
+		int q;
 		for(q = 0; q < *trueSize; q++){
 			mgGSNDInner(phiVal, rhoVal, coeff, g, rank, nGhostLayersBefore-1, nGhostLayersAfter-1, trueSize-1, sizeProd-1);
 		}
@@ -624,57 +1364,32 @@ void mgGSND(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
 void mgGS2D(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
 
 	//Common variables
-	int *trueSize = phi->trueSize;
-	int *nGhostLayers = phi->nGhostLayers;
-	long int *sizeProd = phi->sizeProd;
 	int rank = phi->rank;
+	long int *sizeProd = phi->sizeProd;
+	int *box = phi->haloBoxes;
 
 	//Seperate values
 	double *phiVal = phi->val;
 	double *rhoVal = rho->val;
 
-	//Indexes
-	long int g;
-
-	for(int c = 0; c < nCycles;c++){
-
-		//Increments
-		int kEdgeInc = nGhostLayers[2] + nGhostLayers[rank + 2] + sizeProd[2];
-
-		/**************************
-		 *	Red Pass
-		 *************************/
-		//Odd numbered rows
-		g = nGhostLayers[1] + sizeProd[2];
-		loopRedBlack2D(rhoVal, phiVal, sizeProd, trueSize, kEdgeInc, g);
-
-		//Even numbered columns
-		g = nGhostLayers[1] + 1 + 2*sizeProd[2];
-		loopRedBlack2D(rhoVal, phiVal, sizeProd, trueSize, kEdgeInc, g);
-
-		gHaloOp(setSlice, phi, mpiInfo, TOHALO);
-		// gBnd(rho,mpiInfo);
-		// gBnd(phi,mpiInfo);
-
+	// As mgGS3D(), but starting with the black nodes and leaving the
+	// boundaries to the caller.
+	for(int pass = 0; pass < 2*nCycles; pass++){
 
-		/***********************************
-		 *	Black pass
-		 **********************************/
-		//Odd numbered rows
-		g = nGhostLayers[1] + 1 + sizeProd[2];
-		loopRedBlack2D(rhoVal, phiVal, sizeProd, trueSize, kEdgeInc, g);
+		int color = (pass%2) ? RED : BLACK;
 
-		//Even numbered columns
-		g = nGhostLayers[1] + 2*sizeProd[2];
-		loopRedBlack2D(rhoVal, phiVal, sizeProd, trueSize, kEdgeInc, g);
+		loopRedBlack2DBox(phiVal, rhoVal, sizeProd, &box[0], &box[rank], color);
 
+		gHaloOpEnd(phi);
 
-		gHaloOp(setSlice, phi, mpiInfo, TOHALO);
-		// gBnd(rho,mpiInfo);
-		// gBnd(phi,mpiInfo);
+		for(int b = 1; b < 2*rank-1; b++)
+			loopRedBlack2DBox(phiVal, rhoVal, sizeProd,
+							  &box[2*rank*b], &box[2*rank*b+rank], color);
 
+		gHaloOpColorBegin(phi, mpiInfo, color);
 	}
 
+	gHaloOpEnd(phi);
 
 	return;
 }
@@ -682,92 +1397,48 @@ void mgGS2D(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
 
 void mgGS3D(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
 
+	if(phi->deep && rho->deep){
+		mgGS3DDeep(phi, rho, nCycles, mpiInfo);
+		return;
+	}
+
 	//Common variables
-	int *trueSize = phi->trueSize;
-	int *size = phi->size;
-	int *nGhostLayers = phi->nGhostLayers;
+	int rank = phi->rank;
 	long int *sizeProd = phi->sizeProd;
+	int *box = phi->haloBoxes;
 
 	//Seperate values
 	double *phiVal = phi->val;
 	double *rhoVal = rho->val;
 
-	//Indexes
-	long int g;
-	int gj = sizeProd[1];
-	int gk = sizeProd[2];
-	int gl = sizeProd[3];
-
-	double coeff = 1./6.;
-
-	for(int c = 0; c < nCycles; c++){
-
-
-		/*********************
-		 *	Red Pass
-		 ********************/
-		g = sizeProd[3]*nGhostLayers[3];
-		for(int l = 0; l < trueSize[3];l++){
-			for(int k = 0; k < size[2]; k++){
-				for(int j = 0; j < size[1]; j+=2){
-					phiVal[g] = coeff*(	phiVal[g+gj] + phiVal[g-gj] +
-										phiVal[g+gk] + phiVal[g-gk] +
-										phiVal[g+gl] + phiVal[g-gl] + rhoVal[g]);
-					g	+=2;
-				}
+	// Each pass only depends on the other color, so the interior of a pass
+	// is done while the ghost layers from the previous pass are in flight,
+	// and only the color just updated is sent.
+	for(int pass = 0; pass < 2*nCycles; pass++){
 
-				// g+=(-1 + 2*(k%2))*(-1 + 2*(l%2));
+		int color = (pass%2) ? BLACK : RED;
 
-				if(l%2){
-					if(k%2)	g+=1; else g-=1;
-				} else {
-					if(k%2) g-=1; else g+=1;
-				}
+		loopRedBlack3DBox(phiVal, rhoVal, sizeProd, &box[0], &box[rank], color);
 
-			}
-			if(l%2) g-=1; else g+=1;
-			// g -= -1 + 2*(l%2);
+		if(pass){
+			gHaloOpEnd(phi);
+			gBnd(phi, mpiInfo);
 		}
 
-		gHaloOp(setSlice, phi, mpiInfo, TOHALO);
-		gBnd(phi, mpiInfo);
-
-		/*********************
-		 *	Black pass
-		 ********************/
-		 g = sizeProd[1] + sizeProd[3]*nGhostLayers[3];
-		 for(int l = 0; l < trueSize[3];l++){
-		 	for(int k = 0; k < size[2]; k++){
-		 		for(int j = 0; j < size[1]; j+=2){
-		 			phiVal[g] = coeff*(	phiVal[g+gj] + phiVal[g-gj] +
-		 								phiVal[g+gk] + phiVal[g-gk] +
-		 								phiVal[g+gl] + phiVal[g-gl] + rhoVal[g]);
-
-		 			g	+=2;
-		 		}
-					if(l%2){
-						if(k%2)	g-=1; else g+=1;
-					} else {
-						if(k%2) g+=1; else g-=1;
-					}
-				// g+=(-1 + 2*(k%2))*(-1 + 2*(l%2));
-
-
-		 	}
-				if(l%2) g+=1; else g-=1;
-			// g -= -1 + 2*(l%2);
-		 }
+		for(int b = 1; b < 2*rank-1; b++)
+			loopRedBlack3DBox(phiVal, rhoVal, sizeProd,
+							  &box[2*rank*b], &box[2*rank*b+rank], color);
 
-		gHaloOp(setSlice, phi, mpiInfo, TOHALO);
-		gBnd(phi, mpiInfo);
+		gHaloOpColorBegin(phi, mpiInfo, color);
 	}
 
+	gHaloOpEnd(phi);
+	gBnd(phi, mpiInfo);
 
 	return;
 }
 
 
-
 void mgGS3DNew(Grid *phi, const Grid *rho, int nCycles, const MpiInfo *mpiInfo){
 
 	//Common variables
@@ -846,7 +1517,6 @@ void mgHalfRestrict3D(const Grid *fine, Grid *coarse){
 	//Load fine grid
 	double *fVal = fine->val;
 	long int *fSizeProd = fine->sizeProd;
-	int rank = fine->rank;
 	int *nGhostLayers = fine->nGhostLayers;
 
 	//Load coarse grid
@@ -854,59 +1524,116 @@ void mgHalfRestrict3D(const Grid *fine, Grid *coarse){
 	long int *cSizeProd = coarse->sizeProd;
 	int *cTrueSize = coarse->trueSize;
 
+	//Neighbour offsets on the fine grid
+	long int fj = fSizeProd[1];
+	long int fk = fSizeProd[2];
+	long int fl = fSizeProd[3];
 
-	//Indexes
-	long int c = cSizeProd[1]*nGhostLayers[1] + cSizeProd[2]*nGhostLayers[2] + cSizeProd[3]*nGhostLayers[3];
+	double coeff = 1./12.;
 
-	long int f = fSizeProd[1]*nGhostLayers[1] + fSizeProd[2]*nGhostLayers[2] + fSizeProd[3]*nGhostLayers[3];
-	long int fj  = f + fSizeProd[1];
-	long int fjj = f - fSizeProd[1];
-	long int fk  = f + fSizeProd[2];
-	long int fkk = f - fSizeProd[2];
-	long int fl  = f + fSizeProd[3];
-	long int fll = f - fSizeProd[3];
+	//Cycle Coarse grid, one row of j at a time
+	#pragma omp parallel for collapse(2) if(cTrueSize[1]*cTrueSize[2]*cTrueSize[3] >= OMP_MIN_NODES) schedule(static)
+	for(int l = 0; l<cTrueSize[3]; l++){
+		for(int k = 0; k < cTrueSize[2]; k++){
+			long int c =	cSizeProd[1]*nGhostLayers[1] +
+							cSizeProd[2]*(k + nGhostLayers[2]) +
+							cSizeProd[3]*(l + nGhostLayers[3]);
+			long int f =	fSizeProd[1]*nGhostLayers[1] +
+							fSizeProd[2]*(2*k + nGhostLayers[2]) +
+							fSizeProd[3]*(2*l + nGhostLayers[3]);
+			for(int j = 0; j < cTrueSize[1]; j++){
+				cVal[c] = coeff*(6*fVal[f] + fVal[f+fj] + fVal[f-fj] + fVal[f+fk] + fVal[f-fk] + fVal[f+fl] + fVal[f-fl]);
+				c++;
+				f+=2;
+			}
+		}
+	}
 
-	int cKEdgeInc = nGhostLayers[2] + nGhostLayers[rank + 2];
-	int fKEdgeInc = nGhostLayers[2] + nGhostLayers[rank + 2] + fSizeProd[2];
-	int cLEdgeInc = (nGhostLayers[3] + nGhostLayers[rank + 3])*cSizeProd[2];
-	int fLEdgeInc = (nGhostLayers[3] + nGhostLayers[rank + 3])*fSizeProd[2] + fSizeProd[3];
+	return;
+}
+
+/**
+ * @brief Residual of one node, as computed by mgResidual() in 3D
+ */
+static inline double mgResidualNode(const double *phiVal, const double *rhoVal,
+									long int g, long int gj, long int gk, long int gl){
+
+	return (-6.*phiVal[g] + (phiVal[g+gj] + phiVal[g-gj]
+							+ phiVal[g+gk] + phiVal[g-gk]
+							+ phiVal[g+gl] + phiVal[g-gl]))
+							+ rhoVal[g];
+}
+
+void mgHalfRestrictResidual3D(const Grid *phi, const Grid *rho, Grid *coarse,
+							  const MpiInfo *mpiInfo){
+
+	//Load fine grids
+	double *phiVal = phi->val;
+	double *rhoVal = rho->val;
+	long int *fSizeProd = phi->sizeProd;
+	int *nGhostLayers = phi->nGhostLayers;
+
+	//Load coarse grid
+	double *cVal = coarse->val;
+	long int *cSizeProd = coarse->sizeProd;
+	int *cTrueSize = coarse->trueSize;
+
+	//Neighbour offsets on the fine grid
+	long int fj = fSizeProd[1];
+	long int fk = fSizeProd[2];
+	long int fl = fSizeProd[3];
 
 	double coeff = 1./12.;
 
+	gZero(coarse);
 
-	//Cycle Coarse grid
+	//Cycle Coarse grid, one row of j at a time
+	#pragma omp parallel for collapse(2) if(cTrueSize[1]*cTrueSize[2]*cTrueSize[3] >= OMP_MIN_NODES) schedule(static)
 	for(int l = 0; l<cTrueSize[3]; l++){
 		for(int k = 0; k < cTrueSize[2]; k++){
+			long int c =	cSizeProd[1]*nGhostLayers[1] +
+							cSizeProd[2]*(k + nGhostLayers[2]) +
+							cSizeProd[3]*(l + nGhostLayers[3]);
+			long int f =	fSizeProd[1]*nGhostLayers[1] +
+							fSizeProd[2]*(2*k + nGhostLayers[2]) +
+							fSizeProd[3]*(2*l + nGhostLayers[3]);
 			for(int j = 0; j < cTrueSize[1]; j++){
-				cVal[c] = coeff*(6*fVal[f] + fVal[fj] + fVal[fjj] + fVal[fk] + fVal[fkk] + fVal[fl] + fVal[fll]);
+				double sum = 6*mgResidualNode(phiVal, rhoVal, f, fj, fk, fl)
+							+ mgResidualNode(phiVal, rhoVal, f+fj, fj, fk, fl)
+							+ mgResidualNode(phiVal, rhoVal, f+fk, fj, fk, fl)
+							+ mgResidualNode(phiVal, rhoVal, f+fl, fj, fk, fl);
+				if(j) sum += mgResidualNode(phiVal, rhoVal, f-fj, fj, fk, fl);
+				if(k) sum += mgResidualNode(phiVal, rhoVal, f-fk, fj, fk, fl);
+				if(l) sum += mgResidualNode(phiVal, rhoVal, f-fl, fj, fk, fl);
+				cVal[c] = coeff*sum;
 				c++;
-				f  +=2;
-				fj +=2;
-				fjj+=2;
-				fk +=2;
-				fkk+=2;
-				fl +=2;
-				fll+=2;
+				f+=2;
+			}
+		}
+	}
+
+	// The uppermost fine nodes along d are the missing lower neighbors of the
+	// upper subdomain's lowest coarse nodes, i.e. of our upper ghost layer
+	for(int d = 1; d < 4; d++){
+		int a = d%3+1;			// The other two dimensions
+		int b = (d+1)%3+1;
+		long int c0 = cSizeProd[d]*(cTrueSize[d] + nGhostLayers[d]);
+		long int f0 = fSizeProd[d]*(2*cTrueSize[d] - 1 + nGhostLayers[d]);
+
+		#pragma omp parallel for collapse(2) if(cTrueSize[a]*cTrueSize[b] >= OMP_MIN_NODES) schedule(static)
+		for(int m = 0; m < cTrueSize[b]; m++){
+			for(int n = 0; n < cTrueSize[a]; n++){
+				long int c = c0 + cSizeProd[a]*(n + nGhostLayers[a])
+								+ cSizeProd[b]*(m + nGhostLayers[b]);
+				long int f = f0 + fSizeProd[a]*(2*n + nGhostLayers[a])
+								+ fSizeProd[b]*(2*m + nGhostLayers[b]);
+				cVal[c] = coeff*mgResidualNode(phiVal, rhoVal, f, fj, fk, fl);
 			}
-			c  += cKEdgeInc;
-			f  += fKEdgeInc;
-			fj += fKEdgeInc;
-			fjj+= fKEdgeInc;
-			fk += fKEdgeInc;
-			fkk+= fKEdgeInc;
-			fl += fKEdgeInc;
-			fll+= fKEdgeInc;
-		}
-		c  += cLEdgeInc;
-		f  += fLEdgeInc;
-		fj += fLEdgeInc;
-		fjj+= fLEdgeInc;
-		fk += fLEdgeInc;
-		fkk+= fLEdgeInc;
-		fl += fLEdgeInc;
-		fll+= fLEdgeInc;
+		}
 	}
 
+	gHaloOp(addSlice, coarse, mpiInfo, FROMHALO);
+
 	return;
 }
 
@@ -1124,113 +1851,66 @@ void mgBilinProlND(Grid *fine, const Grid *coarse,const  MpiInfo *mpiInfo){
 }
 
 
-void mgBilinProl3D(Grid *fine, const Grid *coarse,const  MpiInfo *mpiInfo){
+/**
+ * @brief Interpolates the nodes of fine between those inserted from a coarse grid
+ *
+ * The second half of mgBilinProl3D(), also used to prolongate from the single
+ * precision levels (see MixedPrecision).
+ */
+static void mgBilinInterp3D(Grid *fine, const MpiInfo *mpiInfo){
 
 	//Load fine grid
 	double *fVal = fine->val;
 	long int *fSizeProd = fine->sizeProd;
 	int *fSize = fine->size;
 	int *fTrueSize =fine->trueSize;
-	int rank = fine->rank;
-	int *nGhostLayers = fine->nGhostLayers;
-
-	//Load coarse grid
-	double *cVal = coarse->val;
-	long int *cSizeProd = coarse->sizeProd;
-	int *cTrueSize = coarse->trueSize;
-
-	//Help Indexes
-	long int f = fSizeProd[1] + fSizeProd[2] + fSizeProd[3];
-	long int c = cSizeProd[1] + cSizeProd[2] + cSizeProd[3];
-	long int fNext;
-	long int fPrev;
-
-	//Edge jumps
-	int cKEdgeInc = nGhostLayers[2] + nGhostLayers[rank + 2];
-	int fKEdgeInc = cKEdgeInc + fSizeProd[2];
-	int cLEdgeInc = (nGhostLayers[3] + nGhostLayers[rank + 3])*cSizeProd[2];
-	int fLEdgeInc = (nGhostLayers[3] + nGhostLayers[rank + 3])*fSizeProd[2] + fSizeProd[3];
 
-	//Direct insertion c->f
-	for(int l = 0; l < cTrueSize[3]; l++){
-		for(int k = 0; k < cTrueSize[2]; k++){
-			for(int j = 0; j < cTrueSize[1]; j++){
-				fVal[f] = cVal[c];
-				c++;
-				f+=2;
-			}
-			c+= cKEdgeInc;
-			f+= fKEdgeInc;
-		}
-		c+= cLEdgeInc;
-		f+= fLEdgeInc;
-	}
+	//Neighbour offsets on the fine grid
+	long int fj = fSizeProd[1];
+	long int fk = fSizeProd[2];
+	long int fl = fSizeProd[3];
 
 	//Filling ghostlayer
 	gHaloOpDim(setSlice, fine, mpiInfo, 3, TOHALO);
 
 	//Interpolation 3rd Dim
-	f = fSizeProd[1] + fSizeProd[2] + 2*fSizeProd[3];
-	fNext = f + fSizeProd[3];
-	fPrev = f - fSizeProd[3];
-
+	#pragma omp parallel for collapse(2) if(fTrueSize[1]*fTrueSize[2]*fTrueSize[3] >= OMP_MIN_NODES) schedule(static)
 	for(int l = 0; l < fTrueSize[3]; l+=2){
 		for(int k = 0; k < fSize[2]; k+=2){
+			long int f = fj + (k+1)*fk + (l+2)*fl;
 			for(int j = 0; j < fSize[1]; j+=2){
-				fVal[f] = 0.5*(fVal[fPrev]+fVal[fNext]);
+				fVal[f] = 0.5*(fVal[f-fl]+fVal[f+fl]);
 				f +=2;
-				fNext +=2;
-				fPrev +=2;
 			}
-			f		+=fSizeProd[2];
-			fNext 	+=fSizeProd[2];
-			fPrev 	+=fSizeProd[2];
 		}
-		f		+=fSizeProd[3];
-		fNext 	+=fSizeProd[3];
-		fPrev 	+=fSizeProd[3];
 	}
 
 	gHaloOpDim(setSlice, fine, mpiInfo, 2, TOHALO);
 
 	//Interpolation 2nd Dim
-	f = fSizeProd[1] + 2*fSizeProd[2] + fSizeProd[3];
-	fNext = f + fSizeProd[2];
-	fPrev = f - fSizeProd[2];
-
+	#pragma omp parallel for collapse(2) if(fTrueSize[1]*fTrueSize[2]*fTrueSize[3] >= OMP_MIN_NODES) schedule(static)
 	for(int l = 0; l < fTrueSize[3]; l++){
 		for(int k = 0; k < fSize[2]; k+=2){
+			long int f = fj + (k+2)*fk + (l+1)*fl;
 			for(int j = 0; j < fSize[1]; j+=2){
-				fVal[f] = 0.5*(fVal[fPrev]+fVal[fNext]);
+				fVal[f] = 0.5*(fVal[f-fk]+fVal[f+fk]);
 				f +=2;
-				fNext +=2;
-				fPrev +=2;
 			}
-			f		+=fSizeProd[2];
-			fNext 	+=fSizeProd[2];
-			fPrev 	+=fSizeProd[2];
 		}
 	}
 
 	gHaloOpDim(setSlice, fine, mpiInfo, 1, TOHALO);
 
-	//Interpolation 2nd Dim
-	f = 2*fSizeProd[1] + fSizeProd[2] + fSizeProd[3];
-	fNext = f + fSizeProd[1];
-	fPrev = f - fSizeProd[1];
-
+	//Interpolation 1st Dim
+	#pragma omp parallel for collapse(2) if(fTrueSize[1]*fTrueSize[2]*fTrueSize[3] >= OMP_MIN_NODES) schedule(static)
 	for(int l = 0; l < fTrueSize[3]; l++){
 		for(int k = 0; k < fTrueSize[2]; k++){
+			long int f = 2*fj + (k+1)*fk + (l+1)*fl;
 			for(int j = 0; j < fSize[1]; j+=2){
-				fVal[f] = 0.5*(fVal[fPrev]+fVal[fNext]);
+				fVal[f] = 0.5*(fVal[f-fj]+fVal[f+fj]);
 				f +=2;
-				fNext +=2;
-				fPrev +=2;
 			}
 		}
-		f		+=2*fSizeProd[2];
-		fNext 	+=2*fSizeProd[2];
-		fPrev 	+=2*fSizeProd[2];
 	}
 
 
@@ -1238,64 +1918,157 @@ void mgBilinProl3D(Grid *fine, const Grid *coarse,const  MpiInfo *mpiInfo){
 }
 
 
-void mgBilinProl2D(Grid *fine, const Grid *coarse, const MpiInfo *mpiInfo){
+void mgBilinProl3D(Grid *fine, const Grid *coarse,const  MpiInfo *mpiInfo){
 
 	//Load fine grid
 	double *fVal = fine->val;
 	long int *fSizeProd = fine->sizeProd;
-	int *fSize = fine->size;
-	int rank = fine->rank;
-	int *nGhostLayers = fine->nGhostLayers;
 
 	//Load coarse grid
 	double *cVal = coarse->val;
 	long int *cSizeProd = coarse->sizeProd;
-	int *cSize = coarse->size;
-
-	//Help Indexes
-	long int f = fSizeProd[2] + fSizeProd[1];
-	long int c = cSizeProd[2] + cSizeProd[1];
-	long int fNext;
-	long int fPrev;
+	int *cTrueSize = coarse->trueSize;
 
-	int cKEdgeInc = nGhostLayers[2] + nGhostLayers[rank + 2];
-	int fKEdgeInc = cKEdgeInc + fSizeProd[2];
+	//Neighbour offsets on the fine grid
+	long int fj = fSizeProd[1];
+	long int fk = fSizeProd[2];
+	long int fl = fSizeProd[3];
 
 	//Direct insertion c->f
-	for(int k = nGhostLayers[2]; k < cSize[2]-nGhostLayers[rank + 2]; k++){
-		for(int j = nGhostLayers[1]; j < cSize[1]-nGhostLayers[rank+1]; j++){
-			fVal[f] = cVal[c];
-			c++;
-			f+=2;
+	#pragma omp parallel for collapse(2) if(8*cTrueSize[1]*cTrueSize[2]*cTrueSize[3] >= OMP_MIN_NODES) schedule(static)
+	for(int l = 0; l < cTrueSize[3]; l++){
+		for(int k = 0; k < cTrueSize[2]; k++){
+			long int c = cSizeProd[1] + (k+1)*cSizeProd[2] + (l+1)*cSizeProd[3];
+			long int f = fj + (2*k+1)*fk + (2*l+1)*fl;
+			for(int j = 0; j < cTrueSize[1]; j++){
+				fVal[f] = cVal[c];
+				c++;
+				f+=2;
+			}
 		}
-		c+= cKEdgeInc;
-		f+= fKEdgeInc;
 	}
 
-	//Filling ghost cells
-	gHaloOpDim(setSlice, fine, mpiInfo, 2, TOHALO);
+	mgBilinInterp3D(fine, mpiInfo);
 
- 	f= fSizeProd[1];
-	fNext = f + fSizeProd[2];
-	fPrev = f - fSizeProd[2];
-	//Odd numbered columns, interpolating vertically
-	for(int k = 0; k < fSize[2]; k+=2){
-		for(int j = 0; j < fSize[1]; j+=2){
-			fVal[f] += 0.5*(fVal[fPrev]+fVal[fNext]);
-			f 		+= 2;
-			fNext 	+= 2;
-			fPrev 	+= 2;
-		}
-		f		+= fSizeProd[2];
-		fNext 	+= fSizeProd[2];
-		fPrev 	+= fSizeProd[2];
-	}
+	return;
+}
 
-	//Filling ghost cells
-	gHaloOpDim(setSlice, fine, mpiInfo, 1, TOHALO);
 
-	//Even numbered columns, interpolating horizontally
-	f = 0;
+void mgBilinProlAdd3D(Grid *fine, Grid *coarse, double factor,
+					  const MpiInfo *mpiInfo){
+
+	//Load fine grid
+	double *fVal = fine->val;
+	long int *fSizeProd = fine->sizeProd;
+	int *fTrueSize = fine->trueSize;
+	int *nGhostLayers = fine->nGhostLayers;
+
+	//Load coarse grid
+	double *cVal = coarse->val;
+	long int *cSizeProd = coarse->sizeProd;
+
+	long int cj = cSizeProd[1];
+	long int ck = cSizeProd[2];
+	long int cl = cSizeProd[3];
+
+	int periodic = 1;
+	for(int d = 1; d < 4; d++){
+		if(coarse->bnd[d] != PERIODIC || coarse->bnd[d+4] != PERIODIC) periodic = 0;
+	}
+
+	gHaloOp(setSlice, coarse, mpiInfo, TOHALO);
+
+	// Fine node 2n coincides with coarse node n, and 2n+1 is between n and
+	// n+1. Weighing all 8 corners by 1/8, with the upper corner equal to the
+	// lower one along the coinciding dimensions, covers all cases.
+	double coeff = factor*0.125;
+
+	#pragma omp parallel for collapse(2) if(fTrueSize[1]*fTrueSize[2]*fTrueSize[3] >= OMP_MIN_NODES) schedule(static)
+	for(int l = 0; l < fTrueSize[3]; l++){
+		for(int k = 0; k < fTrueSize[2]; k++){
+			long int ol = (l%2)*cl;
+			long int ok = (k%2)*ck;
+			long int cRow = cj*nGhostLayers[1] + ck*(k/2 + nGhostLayers[2])
+							+ cl*(l/2 + nGhostLayers[3]);
+			long int f =	fSizeProd[1]*nGhostLayers[1] +
+							fSizeProd[2]*(k + nGhostLayers[2]) +
+							fSizeProd[3]*(l + nGhostLayers[3]);
+			for(int j = 0; j < fTrueSize[1]; j++){
+				long int c = cRow + cj*(j/2);
+				long int oj = (j%2)*cj;
+				fVal[f] += coeff*(	cVal[c]			+ cVal[c+oj] +
+									cVal[c+ok]		+ cVal[c+ok+oj] +
+									cVal[c+ol]		+ cVal[c+ol+oj] +
+									cVal[c+ol+ok]	+ cVal[c+ol+ok+oj]);
+				f++;
+			}
+		}
+	}
+
+	if(!periodic) gBnd(coarse, mpiInfo);
+
+	return;
+}
+
+
+void mgBilinProl2D(Grid *fine, const Grid *coarse, const MpiInfo *mpiInfo){
+
+	//Load fine grid
+	double *fVal = fine->val;
+	long int *fSizeProd = fine->sizeProd;
+	int *fSize = fine->size;
+	int rank = fine->rank;
+	int *nGhostLayers = fine->nGhostLayers;
+
+	//Load coarse grid
+	double *cVal = coarse->val;
+	long int *cSizeProd = coarse->sizeProd;
+	int *cSize = coarse->size;
+
+	//Help Indexes
+	long int f = fSizeProd[2] + fSizeProd[1];
+	long int c = cSizeProd[2] + cSizeProd[1];
+	long int fNext;
+	long int fPrev;
+
+	int cKEdgeInc = nGhostLayers[2] + nGhostLayers[rank + 2];
+	int fKEdgeInc = cKEdgeInc + fSizeProd[2];
+
+	//Direct insertion c->f
+	for(int k = nGhostLayers[2]; k < cSize[2]-nGhostLayers[rank + 2]; k++){
+		for(int j = nGhostLayers[1]; j < cSize[1]-nGhostLayers[rank+1]; j++){
+			fVal[f] = cVal[c];
+			c++;
+			f+=2;
+		}
+		c+= cKEdgeInc;
+		f+= fKEdgeInc;
+	}
+
+	//Filling ghost cells
+	gHaloOpDim(setSlice, fine, mpiInfo, 2, TOHALO);
+
+ 	f= fSizeProd[1];
+	fNext = f + fSizeProd[2];
+	fPrev = f - fSizeProd[2];
+	//Odd numbered columns, interpolating vertically
+	for(int k = 0; k < fSize[2]; k+=2){
+		for(int j = 0; j < fSize[1]; j+=2){
+			fVal[f] += 0.5*(fVal[fPrev]+fVal[fNext]);
+			f 		+= 2;
+			fNext 	+= 2;
+			fPrev 	+= 2;
+		}
+		f		+= fSizeProd[2];
+		fNext 	+= fSizeProd[2];
+		fPrev 	+= fSizeProd[2];
+	}
+
+	//Filling ghost cells
+	gHaloOpDim(setSlice, fine, mpiInfo, 1, TOHALO);
+
+	//Even numbered columns, interpolating horizontally
+	f = 0;
 	fNext = f + fSizeProd[1];
 	fPrev = f - fSizeProd[1];
 
@@ -1382,7 +2155,7 @@ void mgRestrictBnd(Multigrid *mgGrid){
  *			VARIOUS COMPUTATIONS (RESIDUAL)
  ******************************************************/
 
-void mgResidual(Grid *res, const Grid *rho, const Grid *phi,const MpiInfo *mpiInfo){
+void mgResidual(Grid *res, const Grid *rho, Grid *phi,const MpiInfo *mpiInfo){
 
 	//Load
 	long int *sizeProd = res->sizeProd;
@@ -1392,13 +2165,12 @@ void mgResidual(Grid *res, const Grid *rho, const Grid *phi,const MpiInfo *mpiIn
 
 	//Should consider changing to function pointers
 	if(rank == 4){
-		gFinDiff2nd3D(res, phi);
+		gFinDiff2nd3DAdd(res, phi, rho);
 	} else {
 		gFinDiff2ndND(res,phi);
+		for (long int g = 0; g < sizeProd[rank]; g++) resVal[g] += rhoVal[g];
 	}
 
-	for (long int g = 0; g < sizeProd[rank]; g++) resVal[g] += rhoVal[g];
-
 	return;
 }
 
@@ -1439,10 +2211,10 @@ double mgResMass3D(Grid *grid, MpiInfo *mpiInfo){
 		g+=lEdgeInc;
 	}
 
-	if(mpiRank != 0) MPI_Send(&mass, 1, MPI_DOUBLE, 0, mpiRank, MPI_COMM_WORLD);
+	if(mpiRank != 0) MPI_Send(&mass, 1, MPI_DOUBLE, 0, mpiRank, mpiInfo->comm);
 	if(mpiRank == 0){
 		for(int r = 1; r < mpiSize; r++){
-			MPI_Recv(&massRecv, 1, MPI_DOUBLE, r, r, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+			MPI_Recv(&massRecv, 1, MPI_DOUBLE, r, r, mpiInfo->comm, MPI_STATUS_IGNORE);
 			mass += massRecv;
 		}
 	}
@@ -1475,7 +2247,7 @@ double mgSumTrueSquared(Grid *error,const MpiInfo *mpiInfo){
 	double sum = gSumTruegrid(error);
 
 	//Reduce
-	MPI_Allreduce(MPI_IN_PLACE, &sum, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+	MPI_Allreduce(MPI_IN_PLACE, &sum, 1, MPI_DOUBLE, MPI_SUM, mpiInfo->comm);
 
 	return sum;
 }
@@ -1490,163 +2262,689 @@ void parseMGOptim(dictionary *ini, Multigrid *multigrid){
 
 
 /*****************************************************
- *			MG CYCLES
+ *			SINGLE PRECISION LEVELS
  ****************************************************/
 
- void inline static mgVRecursiveInner(int level, int bottom, int top, Multigrid *mgRho, Multigrid *mgPhi,
-  									Multigrid *mgRes, const MpiInfo *mpiInfo){
+/**
+ * @brief Lower (inclusive) and upper (exclusive) corner of the true nodes
+ */
+static void mgSingleTrueBox(const Grid *grid, int *lower, int *upper){
 
+	int rank = grid->rank;
+	for(int d = 0; d < rank; d++){
+		lower[d] = grid->nGhostLayers[d];
+		upper[d] = grid->size[d]-grid->nGhostLayers[d+rank];
+	}
+}
 
- 	//Solve and return at coarsest level
- 	if(level == bottom){
- 		gHaloOp(setSlice, mgPhi->grids[level], mpiInfo, TOHALO);
-		gHaloOp(setSlice, mgRho->grids[level], mpiInfo, TOHALO);
-		gNeutralizeGrid(mgRho->grids[level], mpiInfo);
- 		mgRho->coarseSolv(mgPhi->grids[level], mgRho->grids[level], mgRho->nCoarseSolve, mpiInfo);
-		gBnd(mgPhi->grids[level], mpiInfo);
- 		mgRho->prolongator(mgRes->grids[level-1], mgPhi->grids[level], mpiInfo);
+/**
+ * @brief As loopRedBlack3DBox(), in single precision
+ */
+static void loopRedBlack3DSingle(float *phiVal, const float *rhoVal,
+				const long int *sizeProd, const int *lower, const int *upper, int color){
+
+	long int gj = sizeProd[1];
+	long int gk = sizeProd[2];
+	long int gl = sizeProd[3];
+
+	float coeff = 1.f/6.f;
+
+	#pragma omp parallel for collapse(2) schedule(static) \
+		if((upper[1]-lower[1])*(upper[2]-lower[2])*(upper[3]-lower[3]) >= OMP_MIN_NODES)
+	for(int l = lower[3]; l < upper[3]; l++){
+		for(int k = lower[2]; k < upper[2]; k++){
+			int j = lower[1] + (lower[1]+k+l+color)%2;
+			long int g = j*gj + k*gk + l*gl;
+			for(; j < upper[1]; j += 2){
+				phiVal[g] = coeff*(	phiVal[g+gj] + phiVal[g-gj] +
+									phiVal[g+gk] + phiVal[g-gk] +
+									phiVal[g+gl] + phiVal[g-gl] + rhoVal[g]);
+				g += 2;
+			}
+		}
+	}
+}
 
- 		return;
- 	}
+/**
+ * @brief As mgGS3D(), in single precision (periodic boundaries only)
+ *
+ * The ghost layers of phi must be set on entry, and are set on return.
+ */
+static void mgSingleGS3D(float *phi, const float *rho, Grid *grid, int nCycles,
+						 const MpiInfo *mpiInfo){
 
- 	//Gathering info
- 	int nPreSmooth = mgRho->nPreSmooth;
- 	int nPostSmooth= mgRho->nPostSmooth;
+	int lower[4], upper[4];
+	mgSingleTrueBox(grid, lower, upper);
 
- 	Grid *phi = mgPhi->grids[level];
- 	Grid *rho = mgRho->grids[level];
- 	Grid *res = mgRes->grids[level];
+	for(int pass = 0; pass < 2*nCycles; pass++){
+		int color = (pass%2) ? BLACK : RED;
+		loopRedBlack3DSingle(phi, rho, grid->sizeProd, lower, upper, color);
+		gHaloOpSingle(phi, grid, mpiInfo);
+	}
+}
 
- 	//Boundary
- 	gHaloOp(setSlice, rho, mpiInfo, TOHALO);
- 	gNeutralizeGrid(rho,mpiInfo);
+/**
+ * @brief As mgResidual(), in single precision
+ */
+static void mgSingleResidual3D(float *res, const float *rho, const float *phi,
+							   const Grid *grid){
 
- 	//Prepare to go down
- 	mgRho->preSmooth(phi, rho, nPreSmooth, mpiInfo);
- 	mgResidual(res, rho, phi, mpiInfo);
- 	gHaloOp(setSlice, res, mpiInfo, TOHALO);
+	int lower[4], upper[4];
+	mgSingleTrueBox(grid, lower, upper);
 
- 	//Go down
- 	mgRho->restrictor(res, mgRho->grids[level + 1]);
+	long int *sizeProd = grid->sizeProd;
+	long int gj = sizeProd[1];
+	long int gk = sizeProd[2];
+	long int gl = sizeProd[3];
+
+	#pragma omp parallel for collapse(2) if(sizeProd[4] >= OMP_MIN_NODES) schedule(static)
+	for(int l = lower[3]; l < upper[3]; l++){
+		for(int k = lower[2]; k < upper[2]; k++){
+			long int g = lower[1]*gj + k*gk + l*gl;
+			for(int j = lower[1]; j < upper[1]; j++){
+				res[g] = -6.f*phi[g] + (phi[g+gj] + phi[g-gj]
+										+ phi[g+gk] + phi[g-gk]
+										+ phi[g+gl] + phi[g-gl])
+										+ rho[g];
+				g++;
+			}
+		}
+	}
+}
 
-	//Repeat level + 1
- 	mgVRecursiveInner(level + 1, bottom, top, mgRho, mgPhi, mgRes, mpiInfo);
+/**
+ * @brief As gNeutralizeGrid(), in single precision but summing in double
+ */
+static void mgSingleNeutralize(float *val, const Grid *grid, const MpiInfo *mpiInfo){
 
- 	//Prepare to go up
- 	gAddTo( phi, res );
+	int lower[4], upper[4];
+	mgSingleTrueBox(grid, lower, upper);
 
- 	gHaloOp(setSlice, phi,mpiInfo, TOHALO);
- 	gBnd(phi,mpiInfo);
- 	mgRho->postSmooth(phi, rho, nPostSmooth, mpiInfo);
-	gBnd(phi, mpiInfo);
+	long int *sizeProd = grid->sizeProd;
 
- 	//Go up
- 	if(level >top){
-		mgRho->prolongator(mgRes->grids[level-1], phi, mpiInfo);
- 	}
+	double charge = 0;
+	#pragma omp parallel for collapse(2) reduction(+:charge) if(sizeProd[4] >= OMP_MIN_NODES) schedule(static)
+	for(int l = lower[3]; l < upper[3]; l++){
+		for(int k = lower[2]; k < upper[2]; k++){
+			long int g = lower[1] + k*sizeProd[2] + l*sizeProd[3];
+			for(int j = lower[1]; j < upper[1]; j++) charge += val[g++];
+		}
+	}
 
- 	return;
- }
+	MPI_Allreduce(MPI_IN_PLACE, &charge, 1, MPI_DOUBLE, MPI_SUM, mpiInfo->comm);
+	float avgCharge = (float)(charge/(double)gTotTruesize(grid, mpiInfo));
 
- void mgVRecursive(int level, int bottom, int top, Multigrid *mgRho, Multigrid *mgPhi,
-  					Multigrid *mgRes, const MpiInfo *mpiInfo){
+	long int nElements = sizeProd[4];
+	#pragma omp parallel for simd if(nElements >= OMP_MIN_NODES) schedule(static)
+	for(long int g = 0; g < nElements; g++) val[g] -= avgCharge;
+}
 
- 	mgVRecursiveInner(level, bottom, top, mgRho, mgPhi, mgRes, mpiInfo);
+/**
+ * @brief As mgHalfRestrict3D(), from the double precision finest level
+ *
+ * The weighted sum is done in double and rounded once.
+ */
+static void mgSingleRestrictFine3D(const Grid *fine, float *cVal, const Grid *coarse){
 
- 	return;
- }
+	//Load fine grid
+	double *fVal = fine->val;
+	long int *fSizeProd = fine->sizeProd;
+	int *nGhostLayers = fine->nGhostLayers;
 
+	//Load coarse grid
+	long int *cSizeProd = coarse->sizeProd;
+	int *cTrueSize = coarse->trueSize;
 
-void mgVRegular(int level, int bottom, int top, Multigrid *mgRho, Multigrid *mgPhi,
- 									Multigrid *mgRes, const MpiInfo *mpiInfo){
+	//Neighbour offsets on the fine grid
+	long int fj = fSizeProd[1];
+	long int fk = fSizeProd[2];
+	long int fl = fSizeProd[3];
 
-	//Gathering info
-	int nPreSmooth = mgRho->nPreSmooth;
-	int nPostSmooth= mgRho->nPostSmooth;
-	int nCoarseSolv= mgRho->nCoarseSolve;
+	double coeff = 1./12.;
 
-	//Needed grids
-	Grid *phi;
-	Grid *rho;
-	Grid *res;
+	#pragma omp parallel for collapse(2) if(cTrueSize[1]*cTrueSize[2]*cTrueSize[3] >= OMP_MIN_NODES) schedule(static)
+	for(int l = 0; l<cTrueSize[3]; l++){
+		for(int k = 0; k < cTrueSize[2]; k++){
+			long int c =	cSizeProd[1]*nGhostLayers[1] +
+							cSizeProd[2]*(k + nGhostLayers[2]) +
+							cSizeProd[3]*(l + nGhostLayers[3]);
+			long int f =	fSizeProd[1]*nGhostLayers[1] +
+							fSizeProd[2]*(2*k + nGhostLayers[2]) +
+							fSizeProd[3]*(2*l + nGhostLayers[3]);
+			for(int j = 0; j < cTrueSize[1]; j++){
+				cVal[c] = (float)(coeff*(6*fVal[f] + fVal[f+fj] + fVal[f-fj] + fVal[f+fk] + fVal[f-fk] + fVal[f+fl] + fVal[f-fl]));
+				c++;
+				f+=2;
+			}
+		}
+	}
+}
 
-	//Solvers
-	void (*coarseSolv)(Grid *phi, const Grid *rho, const int nCycles,
-		const MpiInfo *mpiInfo) = mgRho->coarseSolv;
-	void (*postSmooth)(Grid *phi, const Grid *rho, const int nCycles,
-		const MpiInfo *mpiInfo) = mgRho->postSmooth;
-	void (*preSmooth)(Grid *phi, const Grid *rho, const int nCycles,
-		const MpiInfo *mpiInfo) = mgRho->preSmooth;
+/**
+ * @brief As mgHalfRestrict3D(), between single precision levels
+ */
+static void mgSingleRestrict3D(const float *fVal, const Grid *fine,
+							   float *cVal, const Grid *coarse){
 
-	//Restriction/Prolongators
-	void (*restrictor)(const Grid *fine, Grid *coarse) = mgRho->restrictor;
-	void (*prolongator)(Grid *fine, const Grid *coarse,
-						const MpiInfo *mpiInfo) = mgRho->prolongator;
+	//Load fine grid
+	long int *fSizeProd = fine->sizeProd;
+	int *nGhostLayers = fine->nGhostLayers;
 
-	//Down to coarsest level
-	for(int current = level; current < bottom; current ++){
-		//Load grids
-		phi = mgPhi->grids[current];
-		rho = mgRho->grids[current];
-		res = mgRes->grids[current];
+	//Load coarse grid
+	long int *cSizeProd = coarse->sizeProd;
+	int *cTrueSize = coarse->trueSize;
 
-		//Boundary
-		gHaloOp(setSlice, phi, mpiInfo, TOHALO);
-		gBnd(phi, mpiInfo);
-		gNeutralizeGrid(rho, mpiInfo);
+	//Neighbour offsets on the fine grid
+	long int fj = fSizeProd[1];
+	long int fk = fSizeProd[2];
+	long int fl = fSizeProd[3];
 
+	float coeff = 1.f/12.f;
 
-		preSmooth(phi, rho, nPreSmooth, mpiInfo);
+	#pragma omp parallel for collapse(2) if(cTrueSize[1]*cTrueSize[2]*cTrueSize[3] >= OMP_MIN_NODES) schedule(static)
+	for(int l = 0; l<cTrueSize[3]; l++){
+		for(int k = 0; k < cTrueSize[2]; k++){
+			long int c =	cSizeProd[1]*nGhostLayers[1] +
+							cSizeProd[2]*(k + nGhostLayers[2]) +
+							cSizeProd[3]*(l + nGhostLayers[3]);
+			long int f =	fSizeProd[1]*nGhostLayers[1] +
+							fSizeProd[2]*(2*k + nGhostLayers[2]) +
+							fSizeProd[3]*(2*l + nGhostLayers[3]);
+			for(int j = 0; j < cTrueSize[1]; j++){
+				cVal[c] = coeff*(6*fVal[f] + fVal[f+fj] + fVal[f-fj] + fVal[f+fk] + fVal[f-fk] + fVal[f+fl] + fVal[f-fl]);
+				c++;
+				f+=2;
+			}
+		}
+	}
+}
 
-		gHaloOp(setSlice, rho, mpiInfo, TOHALO);
-		gBnd(phi, mpiInfo);
+/**
+ * @brief Inserts the true nodes of a single precision level into the
+ * corresponding nodes of the finer level, as the start of mgBilinProl3D()
+ * @param	fVal	Values of the finer level (float or double)
+ * @param	single	Whether fVal is float
+ */
+static void mgSingleInsert3D(void *fVal, int single, const Grid *fine,
+							 const float *cVal, const Grid *coarse){
 
-		gZero(res);
-		mgResidual(res, rho, phi, mpiInfo);
+	long int *fSizeProd = fine->sizeProd;
+
+	long int *cSizeProd = coarse->sizeProd;
+	int *cTrueSize = coarse->trueSize;
 
-		gHaloOp(setSlice, res, mpiInfo, TOHALO);
+	long int fj = fSizeProd[1];
+	long int fk = fSizeProd[2];
+	long int fl = fSizeProd[3];
 
-		restrictor(res, mgRho->grids[current + 1]);
+	float *fSingle = fVal;
+	double *fDouble = fVal;
+
+	#pragma omp parallel for collapse(2) if(8*cTrueSize[1]*cTrueSize[2]*cTrueSize[3] >= OMP_MIN_NODES) schedule(static)
+	for(int l = 0; l < cTrueSize[3]; l++){
+		for(int k = 0; k < cTrueSize[2]; k++){
+			long int c = cSizeProd[1] + (k+1)*cSizeProd[2] + (l+1)*cSizeProd[3];
+			long int f = fj + (2*k+1)*fk + (2*l+1)*fl;
+			if(single){
+				for(int j = 0; j < cTrueSize[1]; j++, c++, f+=2) fSingle[f] = cVal[c];
+			} else {
+				for(int j = 0; j < cTrueSize[1]; j++, c++, f+=2) fDouble[f] = cVal[c];
+			}
+		}
 	}
+}
 
-	rho = mgRho->grids[bottom];
-	phi = mgPhi->grids[bottom];
+/**
+ * @brief As mgBilinInterp3D(), in single precision
+ */
+static void mgSingleInterp3D(float *fVal, Grid *fine, const MpiInfo *mpiInfo){
 
-	/*****************************************************
-	 *	//OBS, ONLY NEEDED FOR PERIODIC (neutralize)
-	 *****************************************************/
-	gNeutralizeGrid(rho, mpiInfo);
+	long int *fSizeProd = fine->sizeProd;
+	int *fSize = fine->size;
+	int *fTrueSize = fine->trueSize;
 
-	//Solve at coarsest
-	gHaloOp(setSlice, rho, mpiInfo, TOHALO);
-	coarseSolv(phi, rho, nCoarseSolv, mpiInfo);
+	long int fj = fSizeProd[1];
+	long int fk = fSizeProd[2];
+	long int fl = fSizeProd[3];
 
-	//Send up
-	gHaloOp(setSlice, phi, mpiInfo, TOHALO);
-	gBnd(phi,mpiInfo);
-	prolongator(mgRes->grids[bottom-1], phi, mpiInfo);
+	gHaloOpDimSingle(fVal, fine, mpiInfo, 3);
 
+	#pragma omp parallel for collapse(2) if(fTrueSize[1]*fTrueSize[2]*fTrueSize[3] >= OMP_MIN_NODES) schedule(static)
+	for(int l = 0; l < fTrueSize[3]; l+=2){
+		for(int k = 0; k < fSize[2]; k+=2){
+			long int f = fj + (k+1)*fk + (l+2)*fl;
+			for(int j = 0; j < fSize[1]; j+=2){
+				fVal[f] = 0.5f*(fVal[f-fl]+fVal[f+fl]);
+				f +=2;
+			}
+		}
+	}
 
-	//Up to finest
-	for(int current = bottom-1; current >= top; current --){
+	gHaloOpDimSingle(fVal, fine, mpiInfo, 2);
 
-		//Load grids
+	#pragma omp parallel for collapse(2) if(fTrueSize[1]*fTrueSize[2]*fTrueSize[3] >= OMP_MIN_NODES) schedule(static)
+	for(int l = 0; l < fTrueSize[3]; l++){
+		for(int k = 0; k < fSize[2]; k+=2){
+			long int f = fj + (k+2)*fk + (l+1)*fl;
+			for(int j = 0; j < fSize[1]; j+=2){
+				fVal[f] = 0.5f*(fVal[f-fk]+fVal[f+fk]);
+				f +=2;
+			}
+		}
+	}
+
+	gHaloOpDimSingle(fVal, fine, mpiInfo, 1);
+
+	#pragma omp parallel for collapse(2) if(fTrueSize[1]*fTrueSize[2]*fTrueSize[3] >= OMP_MIN_NODES) schedule(static)
+	for(int l = 0; l < fTrueSize[3]; l++){
+		for(int k = 0; k < fTrueSize[2]; k++){
+			long int f = 2*fj + (k+1)*fk + (l+1)*fl;
+			for(int j = 0; j < fSize[1]; j+=2){
+				fVal[f] = 0.5f*(fVal[f-fj]+fVal[f+fj]);
+				f +=2;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Recursive V cycle on the single precision levels
+ *
+ * Solves for the correction of level-1 whose source is mixed->rho[level].
+ * The correction starts from zero on each level, and its ghost layers are set
+ * on return.
+ */
+static void mgSingleCycle(int level, int bottom, Multigrid *mgRho,
+						  const MpiInfo *mpiInfo){
+
+	MixedPrecision *mixed = mgRho->mixed;
+	Grid *grid = mgRho->grids[level];
+	float *rho = mixed->rho[level];
+	float *phi = mixed->phi[level];
+	float *res = mixed->res[level];
+	long int nElements = grid->sizeProd[grid->rank];
+
+	mgSingleNeutralize(rho, grid, mpiInfo);
+	for(long int g = 0; g < nElements; g++) phi[g] = 0;
+
+	if(level == bottom){
+		mgSingleGS3D(phi, rho, grid, mgRho->nCoarseSolve, mpiInfo);
+		return;
+	}
+
+	//Go down
+	mgSingleGS3D(phi, rho, grid, mgRho->nPreSmooth, mpiInfo);
+	mgSingleResidual3D(res, rho, phi, grid);
+	gHaloOpSingle(res, grid, mpiInfo);
+	mgSingleRestrict3D(res, grid, mixed->rho[level+1], mgRho->grids[level+1]);
+
+	mgSingleCycle(level+1, bottom, mgRho, mpiInfo);
+
+	//Go up
+	mgSingleInsert3D(res, 1, grid, mixed->phi[level+1], mgRho->grids[level+1]);
+	mgSingleInterp3D(res, grid, mpiInfo);
+
+	#pragma omp parallel for simd if(nElements >= OMP_MIN_NODES) schedule(static)
+	for(long int g = 0; g < nElements; g++) phi[g] += res[g];
+
+	gHaloOpSingle(phi, grid, mpiInfo);
+	mgSingleGS3D(phi, rho, grid, mgRho->nPostSmooth, mpiInfo);
+}
+
+
+
+/*****************************************************
+ *			MG CYCLES
+ ****************************************************/
+
+/**
+ * @brief Creates the types locating each process' block in the gathered level
+ *
+ * Collective. The offset of a block is that of the subdomain scaled down by
+ * the same factor as the level.
+ */
+static void mgAgglomerationBlocks(Agglomeration *agg, const Grid *coarsest,
+								  int bottom, const MpiInfo *mpiInfo){
+
+	int rank = coarsest->rank;
+	int nDims = rank-1;
+
+	int *mine = malloc(2*nDims*sizeof(*mine));
+	for(int d = 0; d < nDims; d++){
+		mine[d] = mpiInfo->cuts[d][mpiInfo->subdomain[d]] >> bottom;
+		mine[d+nDims] = coarsest->trueSize[d+1];
+	}
+
+	int *all = NULL;
+	if(agg->mpiRank == 0) all = malloc(2*nDims*agg->mpiSize*sizeof(*all));
+	MPI_Gather(mine, 2*nDims, MPI_INT, all, 2*nDims, MPI_INT, 0, agg->comm);
+
+	if(agg->mpiRank == 0){
+		Grid *gathered = agg->mgRho->grids[0];
+		int *subSize = malloc(rank*sizeof(*subSize));
+		int *start = malloc(rank*sizeof(*start));
+		subSize[0] = gathered->size[0];
+		start[0] = 0;
+
+		agg->blockTypes = malloc(agg->mpiSize*sizeof(*agg->blockTypes));
+		for(int r = 0; r < agg->mpiSize; r++){
+			for(int d = 1; d < rank; d++){
+				start[d] = gathered->nGhostLayers[d] + all[2*nDims*r+d-1];
+				subSize[d] = all[2*nDims*r+nDims+d-1];
+			}
+			MPI_Type_create_subarray(rank, gathered->size, subSize, start,
+									 MPI_ORDER_FORTRAN, MPI_DOUBLE,
+									 &agg->blockTypes[r]);
+			MPI_Type_commit(&agg->blockTypes[r]);
+		}
+
+		free(subSize);
+		free(start);
+		free(all);
+	}
+
+	agg->ready = 1;
+	free(mine);
+}
+
+/**
+ * @brief Solves the coarsest level on the root (see Agglomeration)
+ *
+ * Leaves the ghost layers of phi as the smoothers do.
+ */
+static void mgAgglomeratedSolve(Multigrid *mgRho, Multigrid *mgPhi, int bottom,
+								const MpiInfo *mpiInfo){
+
+	Agglomeration *agg = mgRho->agglomeration;
+	Grid *phi = mgPhi->grids[bottom];
+	Grid *rho = mgRho->grids[bottom];
+	MPI_Request *req = agg->requests;
+	MPI_Comm comm = agg->comm;
+	int root = agg->mpiRank == 0;
+
+	if(!agg->ready) mgAgglomerationBlocks(agg, rho, bottom, mpiInfo);
+
+	int nReq = 0;
+	if(root){
+		double *val = agg->mgRho->grids[0]->val;
+		for(int r = 0; r < agg->mpiSize; r++)
+			MPI_Irecv(val, 1, agg->blockTypes[r], r, 0, comm, &req[nReq++]);
+	}
+	MPI_Isend(rho->val, 1, agg->trueType, 0, 0, comm, &req[nReq++]);
+	MPI_Waitall(nReq, req, MPI_STATUSES_IGNORE);
+
+	if(root){
+		Multigrid *aRho = agg->mgRho;
+		Multigrid *aPhi = agg->mgPhi;
+		Multigrid *aRes = agg->mgRes;
+		MpiInfo *self = agg->mpiInfo;
+
+		gHaloOp(setSlice, aRho->grids[0], self, TOHALO);
+		if(aRho->nLevels > 1){
+			for(int c = 0; c < mgRho->nCoarseSolve; c++)
+				agg->mgAlgo(0, aRho->nLevels-1, 0, aRho, aPhi, aRes, self);
+		} else {
+			aRho->coarseSolv(aPhi->grids[0], aRho->grids[0], aRho->nCoarseSolve, self);
+		}
+	}
+
+	nReq = 0;
+	if(root){
+		double *val = agg->mgPhi->grids[0]->val;
+		for(int r = 0; r < agg->mpiSize; r++)
+			MPI_Isend(val, 1, agg->blockTypes[r], r, 1, comm, &req[nReq++]);
+	}
+	MPI_Irecv(phi->val, 1, agg->trueType, 0, 1, comm, &req[nReq++]);
+	MPI_Waitall(nReq, req, MPI_STATUSES_IGNORE);
+
+	gHaloOp(setSlice, phi, mpiInfo, TOHALO);
+}
+
+/**
+ * @brief Runs the coarse solver on the coarsest level
+ */
+static void mgCoarseSolve(Multigrid *mgRho, Multigrid *mgPhi, int bottom,
+						  const MpiInfo *mpiInfo){
+
+	if(mgRho->agglomeration){
+		mgAgglomeratedSolve(mgRho, mgPhi, bottom, mpiInfo);
+	} else {
+		mgRho->coarseSolv(mgPhi->grids[bottom], mgRho->grids[bottom],
+						  mgRho->nCoarseSolve, mpiInfo);
+	}
+}
+
+/**
+ * @brief Restricts the residual of a level to the rho of the next level
+ *
+ * Uses Multigrid.residualRestrictor if set, otherwise the residual is stored
+ * in mgRes. The ghost layers of phi must be set.
+ */
+static void mgRestrictResidual(int level, Multigrid *mgRho, Multigrid *mgPhi,
+							   Multigrid *mgRes, const MpiInfo *mpiInfo){
+
+	Grid *phi = mgPhi->grids[level];
+	Grid *rho = mgRho->grids[level];
+	Grid *coarse = mgRho->grids[level+1];
+
+	if(mgRho->residualRestrictor){
+		mgRho->residualRestrictor(phi, rho, coarse, mpiInfo);
+	} else {
+		Grid *res = mgRes->grids[level];
+		mgResidual(res, rho, phi, mpiInfo);
+		gHaloOpFaces(res, mpiInfo, TOHALO);
+		mgRho->restrictor(res, coarse);
+	}
+}
+
+/**
+ * @brief Adds (sign=1) or subtracts (sign=-1) the prolongated phi of the next
+ * level to that of a level
+ *
+ * Uses Multigrid.prolongAdder if set, otherwise the prolongation is stored in
+ * mgRes.
+ */
+static void mgCorrect(int level, int sign, Multigrid *mgRho, Multigrid *mgPhi,
+					  Multigrid *mgRes, const MpiInfo *mpiInfo){
+
+	Grid *phi = mgPhi->grids[level];
+	Grid *coarse = mgPhi->grids[level+1];
+
+	if(mgRho->prolongAdder){
+		mgRho->prolongAdder(phi, coarse, sign, mpiInfo);
+	} else {
+		Grid *res = mgRes->grids[level];
+		mgRho->prolongator(res, coarse, mpiInfo);
+		if(sign > 0) gAddTo(phi, res);
+		else gSubFrom(phi, res);
+	}
+}
+
+ void inline static mgVRecursiveInner(int level, int bottom, int top, Multigrid *mgRho, Multigrid *mgPhi,
+  									Multigrid *mgRes, const MpiInfo *mpiInfo){
+
+
+ 	//Solve and return at coarsest level
+ 	if(level == bottom){
+ 		gHaloOp(setSlice, mgPhi->grids[level], mpiInfo, TOHALO);
+		gHaloOp(setSlice, mgRho->grids[level], mpiInfo, TOHALO);
+		gNeutralizeGrid(mgRho->grids[level], mpiInfo);
+ 		mgCoarseSolve(mgRho, mgPhi, level, mpiInfo);
+		gBnd(mgPhi->grids[level], mpiInfo);
+
+ 		return;
+ 	}
+
+ 	//Gathering info
+ 	int nPreSmooth = mgRho->nPreSmooth;
+ 	int nPostSmooth= mgRho->nPostSmooth;
+
+ 	Grid *phi = mgPhi->grids[level];
+ 	Grid *rho = mgRho->grids[level];
+
+ 	//Boundary
+ 	gHaloOp(setSlice, rho, mpiInfo, TOHALO);
+ 	gNeutralizeGrid(rho,mpiInfo);
+
+ 	//Prepare to go down
+ 	mgRho->preSmooth(phi, rho, nPreSmooth, mpiInfo);
+
+ 	//Go down
+ 	mgRestrictResidual(level, mgRho, mgPhi, mgRes, mpiInfo);
+
+	//Repeat level + 1
+ 	mgVRecursiveInner(level + 1, bottom, top, mgRho, mgPhi, mgRes, mpiInfo);
+
+ 	//Prepare to go up
+ 	mgCorrect(level, 1, mgRho, mgPhi, mgRes, mpiInfo);
+
+ 	gHaloOp(setSlice, phi,mpiInfo, TOHALO);
+ 	gBnd(phi,mpiInfo);
+ 	mgRho->postSmooth(phi, rho, nPostSmooth, mpiInfo);
+	gBnd(phi, mpiInfo);
+
+ 	return;
+ }
+
+ void mgVRecursive(int level, int bottom, int top, Multigrid *mgRho, Multigrid *mgPhi,
+  					Multigrid *mgRes, const MpiInfo *mpiInfo){
+
+	if(mgRho->mixed){
+		mgVMixed(level, bottom, top, mgRho, mgPhi, mgRes, mpiInfo);
+		return;
+	}
+
+ 	mgVRecursiveInner(level, bottom, top, mgRho, mgPhi, mgRes, mpiInfo);
+
+ 	return;
+ }
+
+void mgVMixed(int level, int bottom, int top, Multigrid *mgRho, Multigrid *mgPhi,
+			  Multigrid *mgRes, const MpiInfo *mpiInfo){
+
+	MixedPrecision *mixed = mgRho->mixed;
+
+	Grid *phi = mgPhi->grids[level];
+	Grid *rho = mgRho->grids[level];
+	Grid *res = mgRes->grids[level];
+	Grid *coarse = mgRho->grids[level+1];
+
+	//Boundary
+	gHaloOp(setSlice, rho, mpiInfo, TOHALO);
+	gNeutralizeGrid(rho, mpiInfo);
+
+	//Prepare to go down
+	mgRho->preSmooth(phi, rho, mgRho->nPreSmooth, mpiInfo);
+	mgResidual(res, rho, phi, mpiInfo);
+	gHaloOpFaces(res, mpiInfo, TOHALO);
+
+	//Correction in single precision, prolongated into res
+	mgSingleRestrictFine3D(res, mixed->rho[level+1], coarse);
+	mgSingleCycle(level+1, bottom, mgRho, mpiInfo);
+	mgSingleInsert3D(res->val, 0, res, mixed->phi[level+1], coarse);
+	mgBilinInterp3D(res, mpiInfo);
+
+	//Prepare to go up
+	gAddTo(phi, res);
+
+	gHaloOp(setSlice, phi, mpiInfo, TOHALO);
+	gBnd(phi, mpiInfo);
+	mgRho->postSmooth(phi, rho, mgRho->nPostSmooth, mpiInfo);
+	gBnd(phi, mpiInfo);
+
+	return;
+}
+
+
+void mgVRegular(int level, int bottom, int top, Multigrid *mgRho, Multigrid *mgPhi,
+ 									Multigrid *mgRes, const MpiInfo *mpiInfo){
+
+	if(mgRho->mixed){
+		mgVMixed(level, bottom, top, mgRho, mgPhi, mgRes, mpiInfo);
+		return;
+	}
+
+	tRegionBegin("mgVRegular");
+
+	//Gathering info
+	int nPreSmooth = mgRho->nPreSmooth;
+	int nPostSmooth= mgRho->nPostSmooth;
+
+	//Needed grids
+	Grid *phi;
+	Grid *rho;
+
+	//Solvers
+	void (*postSmooth)(Grid *phi, const Grid *rho, const int nCycles,
+		const MpiInfo *mpiInfo) = mgRho->postSmooth;
+	void (*preSmooth)(Grid *phi, const Grid *rho, const int nCycles,
+		const MpiInfo *mpiInfo) = mgRho->preSmooth;
+
+	//Down to coarsest level
+	for(int current = level; current < bottom; current ++){
+		//Load grids
+		phi = mgPhi->grids[current];
+		rho = mgRho->grids[current];
+
+		//Boundary
+		gHaloOp(setSlice, phi, mpiInfo, TOHALO);
+		gBnd(phi, mpiInfo);
+		gNeutralizeGrid(rho, mpiInfo);
+
+
+		tRegionBegin("smooth");
+		preSmooth(phi, rho, nPreSmooth, mpiInfo);
+		tRegionEnd("smooth");
+
+		gHaloOp(setSlice, rho, mpiInfo, TOHALO);
+		gBnd(phi, mpiInfo);
+
+		tRegionBegin("restrict");
+		mgRestrictResidual(current, mgRho, mgPhi, mgRes, mpiInfo);
+		tRegionEnd("restrict");
+	}
+
+	rho = mgRho->grids[bottom];
+	phi = mgPhi->grids[bottom];
+
+	/*****************************************************
+	 *	//OBS, ONLY NEEDED FOR PERIODIC (neutralize)
+	 *****************************************************/
+	gNeutralizeGrid(rho, mpiInfo);
+
+	//Solve at coarsest
+	gHaloOp(setSlice, rho, mpiInfo, TOHALO);
+	tRegionBegin("coarse");
+	mgCoarseSolve(mgRho, mgPhi, bottom, mpiInfo);
+	tRegionEnd("coarse");
+
+	//Send up
+	gHaloOp(setSlice, phi, mpiInfo, TOHALO);
+	gBnd(phi,mpiInfo);
+
+
+	//Up to finest
+	for(int current = bottom-1; current >= top; current --){
+
+		//Load grids
 		phi = mgPhi->grids[current];
 		rho = mgRho->grids[current];
-		res = mgRes->grids[current];
 
 		//Prepare to go up
-		gSubFrom( phi, res );
+		tRegionBegin("prolong");
+		mgCorrect(current, -1, mgRho, mgPhi, mgRes, mpiInfo);
+		tRegionEnd("prolong");
 
 		gHaloOp(setSlice, phi,mpiInfo, TOHALO);
 		gBnd(phi,mpiInfo);
 
+		tRegionBegin("smooth");
 		postSmooth(phi, rho, nPostSmooth, mpiInfo);
+		tRegionEnd("smooth");
 		gBnd(phi, mpiInfo);
-
-		if(current > top) prolongator(mgRes->grids[current-1], phi, mpiInfo);
 	}
 
+	tRegionEnd("mgVRegular");
 	return;
 }
 
@@ -1686,35 +2984,57 @@ void mgW(int level, int bottom, int top, Multigrid *mgRho, Multigrid *mgPhi,
 
 
 
+/**
+ * @brief Returns the RMS of the true nodes of grid, squaring them in the process
+ */
+static double mgRmsDestroy(Grid *grid, const MpiInfo *mpiInfo){
+
+	double sum = mgSumTrueSquared(grid, mpiInfo);
+	return sqrt(sum/gTotTruesize(grid, mpiInfo));
+}
+
 void mgSolveRaw(funPtr mgAlgo, Multigrid *mgRho, Multigrid *mgPhi, Multigrid *mgRes, const MpiInfo *mpiInfo){
 
 	int nMGCycles = mgRho->nMGCycles;
+	int checkInterval = mgRho->checkInterval;
 	int bottom = mgRho->nLevels-1;
 	int nLevels = mgRho->nLevels;
 
-	// gZero(mgPhi->grids[0]);
-	double tol = 1.E-10;
-	double barRes = 2.;
+	Grid *phi = mgPhi->grids[0];
+	Grid *rho = mgRho->grids[0];
+	Grid *res = mgRes->grids[0];
+
+	if(!mgRho->warmStart) gZero(phi);
 
-	if(nLevels >1){
-		while(barRes > tol){
+	if(nLevels > 1 && checkInterval == 0){
+		for(int c = 0; c < nMGCycles; c++){
 			mgAlgo(0, bottom, 0, mgRho, mgPhi, mgRes, mpiInfo);
-			mgResidual(mgRes->grids[0],mgRho->grids[0], mgPhi->grids[0], mpiInfo);
-			gHaloOp(setSlice, mgRes->grids[0],mpiInfo,TOHALO);
-			barRes = mgSumTrueSquared(mgRes->grids[0],mpiInfo);
-			barRes /= gTotTruesize(mgRho->grids[0],mpiInfo);
-			barRes = sqrt(barRes);
-			// msg(STATUS, "barRes = %f", barRes);
-		}
-		// for(int c = 0; c < nMGCycles; c++){
-		// 	mgAlgo(0, bottom, 0, mgRho, mgPhi, mgRes, mpiInfo);
-		//
-		// }
+		}
+	} else if(nLevels > 1){
+
+		double tol = mgRho->tolerance;
+		if(mgRho->relTolerance){
+			gCopy(rho, res);
+			double rhoRms = mgRmsDestroy(res, mpiInfo);
+			if(rhoRms == 0){
+				gZero(phi);
+				return;
+			}
+			tol *= rhoRms;
+		}
+
+		// Only the true nodes of the residual are needed for its norm
+		double barRes;
+		do {
+			for(int c = 0; c < checkInterval; c++){
+				mgAlgo(0, bottom, 0, mgRho, mgPhi, mgRes, mpiInfo);
+			}
+			mgResidual(res, rho, phi, mpiInfo);
+			barRes = mgRmsDestroy(res, mpiInfo);
+		} while(barRes > tol);
+
 	}	else {
 		for(int c = 0; c < nMGCycles; c++){
-
-			Grid *phi = mgPhi->grids[0];
-			Grid *rho = mgRho->grids[0];
 			gHaloOp(setSlice, rho, mpiInfo, TOHALO);
 			gBnd(rho, mpiInfo);
 			mgRho->coarseSolv(phi, rho,
@@ -1726,6 +3046,489 @@ void mgSolveRaw(funPtr mgAlgo, Multigrid *mgRho, Multigrid *mgPhi, Multigrid *mg
 }
 
 
+/*************************************************
+ *		KRYLOV SOLVER
+ ************************************************/
+
+/**
+ * @brief Allocates a zeroed grid with homogeneous boundary slices
+ */
+static Grid *mgcgAllocGrid(const dictionary *ini, const int *trueSize){
+
+	Grid *grid = gAllocSized(ini, SCALAR, trueSize);
+	int rank = grid->rank;
+	int *size = grid->size;
+
+	long int nSliceMax = 0;
+	for(int d=0;d<rank;d++){
+		long int nSlice = 1;
+		for(int dd=0;dd<rank;dd++){
+			if(dd!=d) nSlice *= size[dd];
+		}
+		if(nSlice>nSliceMax) nSliceMax = nSlice;
+	}
+	for(long int s = 0; s < 2*rank*nSliceMax; s++) grid->bndSlice[s] = 0;
+
+	gZero(grid);
+	return grid;
+}
+
+/**
+ * @brief Returns the global dot product of the true nodes of a and b
+ */
+static double mgcgDot(const Grid *a, const Grid *b, const MpiInfo *mpiInfo){
+
+	int rank = a->rank;
+	int *trueSize = a->trueSize;
+	int *nGhostLayers = a->nGhostLayers;
+	const double *aVal = a->val;
+	const double *bVal = b->val;
+
+	int *lower = malloc(2*rank*sizeof(*lower));
+	int *upper = &lower[rank];
+	lower[0] = 0;
+	upper[0] = 1;
+	for(int d = 1; d < rank; d++){
+		lower[d] = nGhostLayers[d];
+		upper[d] = nGhostLayers[d] + trueSize[d];
+	}
+
+	long int nRows = gBoxRows(a, lower, upper);
+	int nRow = trueSize[1];
+
+	double sum = 0;
+	#pragma omp parallel for reduction(+:sum) if(nRows*nRow >= OMP_MIN_NODES) schedule(static)
+	for(long int r = 0; r < nRows; r++){
+		long int start = gBoxRowStart(a, lower, upper, r);
+		for(int j = 0; j < nRow; j++) sum += aVal[start+j]*bVal[start+j];
+	}
+	free(lower);
+
+	MPI_Allreduce(MPI_IN_PLACE, &sum, 1, MPI_DOUBLE, MPI_SUM, mpiInfo->comm);
+
+	return sum;
+}
+
+/**
+ * @brief Adds factor*addition to result (all nodes)
+ */
+static void mgcgAddScaled(Grid *result, double factor, const Grid *addition){
+
+	long int nElements = result->sizeProd[result->rank];
+	double *resultVal = result->val;
+	const double *addVal = addition->val;
+
+	#pragma omp parallel for simd if(nElements >= OMP_MIN_NODES) schedule(static)
+	for(long int g = 0; g < nElements; g++) resultVal[g] += factor*addVal[g];
+}
+
+/**
+ * @brief Sets result to addition+factor*result (all nodes)
+ */
+static void mgcgScaleAdd(Grid *result, double factor, const Grid *addition){
+
+	long int nElements = result->sizeProd[result->rank];
+	double *resultVal = result->val;
+	const double *addVal = addition->val;
+
+	#pragma omp parallel for simd if(nElements >= OMP_MIN_NODES) schedule(static)
+	for(long int g = 0; g < nElements; g++) resultVal[g] = addVal[g] + factor*resultVal[g];
+}
+
+/**
+ * @brief Stores the Laplacian of p in q, with homogeneous boundaries on p
+ *
+ * This is minus the operator of the system. On non-periodic domains the
+ * Dirichlet nodes are not unknowns, and their rows are removed by gBnd().
+ */
+static void mgcgLaplacian(const MgcgSolver *solver, Grid *q, Grid *p,
+						  const MpiInfo *mpiInfo){
+
+	gHaloOpFaces(p, mpiInfo, TOHALO);
+	gBnd(p, mpiInfo);
+
+	if(p->rank == 4) gFinDiff2nd3D(q, p);
+	else gFinDiff2ndND(q, p);
+
+	if(!solver->periodic) gBnd(q, mpiInfo);
+}
+
+/**
+ * @brief Computes the residual of phi into r, without the Dirichlet nodes
+ */
+static void mgcgResidual(const MgcgSolver *solver, const MpiInfo *mpiInfo){
+
+	Grid *phi = solver->phi;
+	Grid *r = solver->r;
+
+	gHaloOpFaces(phi, mpiInfo, TOHALO);
+	gBnd(phi, mpiInfo);
+	mgResidual(r, solver->rho, phi, mpiInfo);
+
+	// Neutralizes r on periodic domains, making the system consistent
+	gBnd(r, mpiInfo);
+}
+
+/**
+ * @brief Applies one multigrid cycle to in, and returns the result
+ */
+static Grid *mgcgPrecondition(const MgcgSolver *solver, const Grid *in,
+							  const MpiInfo *mpiInfo){
+
+	MultigridSolver *pre = solver->pre;
+	Multigrid *mgRho = pre->mgRho;
+	Multigrid *mgPhi = pre->mgPhi;
+	Grid *rho = mgRho->grids[0];
+	Grid *z = mgPhi->grids[0];
+
+	gCopy(in, rho);
+	gZero(z);
+
+	if(mgRho->nLevels > 1){
+		pre->mgAlgo(0, mgRho->nLevels-1, 0, mgRho, mgPhi, pre->mgRes, mpiInfo);
+	} else {
+		gHaloOp(setSlice, rho, mpiInfo, TOHALO);
+		gBnd(rho, mpiInfo);
+		mgRho->coarseSolv(z, rho, mgRho->nCoarseSolve, mpiInfo);
+	}
+
+	return z;
+}
+
+/**
+ * @brief Returns whether iteration k of mgcgSolve() should stop
+ */
+static int mgcgConverged(const MgcgSolver *solver, int k, double tol,
+						 const MpiInfo *mpiInfo){
+
+	Multigrid *mgRho = solver->pre->mgRho;
+	int checkInterval = mgRho->checkInterval;
+
+	if(checkInterval == 0) return k >= mgRho->nMGCycles;
+	if(k%checkInterval) return 0;
+
+	double rr = mgcgDot(solver->r, solver->r, mpiInfo);
+	return sqrt(rr/gTotTruesize(solver->r, mpiInfo)) <= tol;
+}
+
+MgcgSolver* mgcgAllocSolver(dictionary *ini, Grid *rho, Grid *phi,
+							 const MpiInfo *mpiInfo){
+
+	MgcgSolver *solver = malloc(sizeof(*solver));
+	int *trueSize = &rho->trueSize[1];
+
+	int periodic = 1;
+	for(int d = 1; d < rho->rank; d++){
+		if(rho->bnd[d] != PERIODIC || rho->bnd[d+rho->rank] != PERIODIC)
+			periodic = 0;
+	}
+
+	solver->rho = rho;
+	solver->phi = phi;
+	solver->periodic = periodic;
+	solver->r = mgcgAllocGrid(ini, trueSize);
+	solver->p = mgcgAllocGrid(ini, trueSize);
+	solver->q = mgcgAllocGrid(ini, trueSize);
+	solver->rHat = periodic ? NULL : mgcgAllocGrid(ini, trueSize);
+	solver->t = periodic ? NULL : mgcgAllocGrid(ini, trueSize);
+	solver->y = periodic ? NULL : mgcgAllocGrid(ini, trueSize);
+
+	Grid *preRho = mgcgAllocGrid(ini, trueSize);
+	Grid *prePhi = mgcgAllocGrid(ini, trueSize);
+	solver->pre = mgAllocSolver(ini, preRho, prePhi, mpiInfo);
+
+	return solver;
+}
+
+void mgcgFreeSolver(MgcgSolver *solver){
+
+	Grid *preRho = solver->pre->mgRho->grids[0];
+	Grid *prePhi = solver->pre->mgPhi->grids[0];
+	mgFreeSolver(solver->pre);
+	gFree(preRho);
+	gFree(prePhi);
+
+	gFree(solver->r);
+	gFree(solver->p);
+	gFree(solver->q);
+	if(!solver->periodic){
+		gFree(solver->rHat);
+		gFree(solver->t);
+		gFree(solver->y);
+	}
+	free(solver);
+}
+
+void mgcgSolver(void (**solve)(),
+				MgcgSolver *(**solverAlloc)(),
+				void (**solverFree)(),
+				void (**solverWriteCheckpoint)(),
+				void (**solverReadCheckpoint)()){
+
+	*solve=mgcgSolve;
+	*solverAlloc=mgcgAllocSolver;
+	*solverFree=mgcgFreeSolver;
+	*solverWriteCheckpoint=mgcgWriteCheckpoint;
+	*solverReadCheckpoint=mgcgReadCheckpoint;
+}
+
+funPtr mgcgSolver_set(const dictionary *ini){
+	return mgcgSolver;
+}
+
+/**
+ * @brief Flexible conjugate gradient, the preconditioner being nonlinear
+ */
+static void mgcgCG(const MgcgSolver *solver, double tol, const MpiInfo *mpiInfo){
+
+	Grid *phi = solver->phi;
+	Grid *r = solver->r;
+	Grid *p = solver->p;
+	Grid *q = solver->q;
+
+	if(mgcgConverged(solver, 0, tol, mpiInfo)) return;
+
+	Grid *z = mgcgPrecondition(solver, r, mpiInfo);
+	gCopy(z, p);
+	double rz = mgcgDot(r, z, mpiInfo);
+
+	for(int k = 1; rz != 0; k++){
+
+		mgcgLaplacian(solver, q, p, mpiInfo);
+		double alpha = -rz/mgcgDot(p, q, mpiInfo);
+
+		mgcgAddScaled(phi, alpha, p);
+		mgcgAddScaled(r, alpha, q);
+		if(mgcgConverged(solver, k, tol, mpiInfo)) break;
+
+		z = mgcgPrecondition(solver, r, mpiInfo);
+		double rzNew = mgcgDot(r, z, mpiInfo);
+
+		// Polak-Ribière, since r changed by alpha*q
+		double beta = alpha*mgcgDot(z, q, mpiInfo)/rz;
+		mgcgScaleAdd(p, beta, z);
+		rz = rzNew;
+	}
+}
+
+/**
+ * @brief Right-preconditioned BiCGStab
+ */
+static void mgcgBiCGStab(const MgcgSolver *solver, double tol, const MpiInfo *mpiInfo){
+
+	Grid *phi = solver->phi;
+	Grid *r = solver->r;
+	Grid *rHat = solver->rHat;
+	Grid *p = solver->p;
+	Grid *v = solver->q;
+	Grid *t = solver->t;
+	Grid *y = solver->y;
+
+	double sigma = 1, alpha = 1, omega = 1;
+	gCopy(r, rHat);
+	gZero(p);
+	gZero(v);
+
+	for(int k = 0; !mgcgConverged(solver, k, tol, mpiInfo); k++){
+
+		double sigmaNew = mgcgDot(rHat, r, mpiInfo);
+		if(sigmaNew == 0) break;
+
+		// p = r + beta*(p - omega*A*y), where v holds -A*y
+		double beta = (sigmaNew/sigma)*(alpha/omega);
+		mgcgAddScaled(p, omega, v);
+		mgcgScaleAdd(p, beta, r);
+		sigma = sigmaNew;
+
+		gCopy(mgcgPrecondition(solver, p, mpiInfo), y);
+		mgcgLaplacian(solver, v, y, mpiInfo);
+		alpha = -sigma/mgcgDot(rHat, v, mpiInfo);
+
+		mgcgAddScaled(phi, alpha, y);
+		mgcgAddScaled(r, alpha, v);
+
+		Grid *z = mgcgPrecondition(solver, r, mpiInfo);
+		mgcgLaplacian(solver, t, z, mpiInfo);
+		double tt = mgcgDot(t, t, mpiInfo);
+		if(tt == 0) break;
+		omega = -mgcgDot(t, r, mpiInfo)/tt;
+
+		mgcgAddScaled(phi, omega, z);
+		mgcgAddScaled(r, omega, t);
+	}
+}
+
+void mgcgSolve(const MgcgSolver *solver,
+	const Grid *rho, const Grid *phi, const MpiInfo *mpiInfo){
+
+	Multigrid *mgRho = solver->pre->mgRho;
+
+	if(!mgRho->warmStart) gZero(solver->phi);
+
+	double tol = mgRho->tolerance;
+	if(mgRho->relTolerance){
+		double rr = mgcgDot(solver->rho, solver->rho, mpiInfo);
+		tol *= sqrt(rr/gTotTruesize(solver->rho, mpiInfo));
+	}
+
+	mgcgResidual(solver, mpiInfo);
+
+	if(solver->periodic) mgcgCG(solver, tol, mpiInfo);
+	else mgcgBiCGStab(solver, tol, mpiInfo);
+
+	gHaloOp(setSlice, solver->phi, mpiInfo, TOHALO);
+	gBnd(solver->phi, mpiInfo);
+}
+
+
+/*************************************************
+ *		CHECKPOINTING
+ ************************************************/
+
+void mgWriteCheckpoint(hid_t ck, const MultigridSolver *solver){
+
+	Multigrid *mgPhi = solver->mgPhi;
+	char name[32];
+	for(int q = 1; q < mgPhi->nLevels; q++){
+		sprintf(name, "multigrid phi %i", q);
+		gWriteCheckpoint(ck, name, mgPhi->grids[q]);
+	}
+}
+
+void mgReadCheckpoint(hid_t ck, const MultigridSolver *solver){
+
+	Multigrid *mgPhi = solver->mgPhi;
+	char name[32];
+	for(int q = 1; q < mgPhi->nLevels; q++){
+		sprintf(name, "multigrid phi %i", q);
+		gReadCheckpoint(ck, name, mgPhi->grids[q]);
+	}
+}
+
+void mgcgWriteCheckpoint(hid_t ck, const MgcgSolver *solver){
+	mgWriteCheckpoint(ck, solver->pre);
+}
+
+void mgcgReadCheckpoint(hid_t ck, const MgcgSolver *solver){
+	mgReadCheckpoint(ck, solver->pre);
+}
+
+/*************************************************
+ *		BENCHMARKING
+ ************************************************/
+
+void mgSetHaloTime(const MultigridSolver *solver, unsigned long long int *haloTime){
+
+	Multigrid *multigrids[] = {solver->mgRho, solver->mgPhi, solver->mgRes};
+	for(int m = 0; m < 3; m++){
+		for(int q = 0; q < multigrids[m]->nLevels; q++){
+			multigrids[m]->grids[q]->haloTime = haloTime;
+		}
+	}
+}
+
+void mgcgSetHaloTime(const MgcgSolver *solver, unsigned long long int *haloTime){
+
+	Grid *grids[] = {solver->r, solver->p, solver->q, solver->rHat, solver->t, solver->y};
+	for(int g = 0; g < 6; g++){
+		if(grids[g]) grids[g]->haloTime = haloTime;
+	}
+	mgSetHaloTime(solver->pre, haloTime);
+}
+
+void mgBenchmarkCycle(const MultigridSolver *solver, int nCycles, double *time,
+					  double *halo, double *factor, const MpiInfo *mpiInfo){
+
+	Multigrid *mgRho = solver->mgRho;
+	Multigrid *mgPhi = solver->mgPhi;
+	Multigrid *mgRes = solver->mgRes;
+	int bottom = mgRho->nLevels-1;
+
+	Grid *phi = mgPhi->grids[0];
+	Grid *rho = mgRho->grids[0];
+	Grid *res = mgRes->grids[0];
+
+	gCopy(rho, res);
+	double resFirst = mgRmsDestroy(res, mpiInfo);
+	double resLast = resFirst;
+	int nConverging = 0;
+
+	unsigned long long int haloTime = 0;
+	unsigned long long int total = 0;
+	mgSetHaloTime(solver, &haloTime);
+
+	gZero(phi);
+	for(int c = 0; c < nCycles; c++){
+
+		MPI_Barrier(mpiInfo->comm);
+		unsigned long long int start = getNanoSec();
+		solver->mgAlgo(0, bottom, 0, mgRho, mgPhi, mgRes, mpiInfo);
+		total += getNanoSec()-start;
+
+		// Cycles after reaching round-off would only bias the factor towards 1
+		mgResidual(res, rho, phi, mpiInfo);
+		double resNow = mgRmsDestroy(res, mpiInfo);
+		if(resNow > 1e-13*resFirst){
+			resLast = resNow;
+			nConverging = c+1;
+		}
+	}
+
+	mgSetHaloTime(solver, NULL);
+
+	*time = 1e-9*total/nCycles;
+	*halo = 1e-9*haloTime/nCycles;
+	*factor = nConverging ? pow(resLast/resFirst, 1.0/nConverging) : 0;
+}
+
+void mgBenchmarkLevel(const MultigridSolver *solver, int level, int nVisits,
+					  double *time, double *halo, const MpiInfo *mpiInfo){
+
+	Multigrid *mgRho = solver->mgRho;
+	Multigrid *mgPhi = solver->mgPhi;
+	Multigrid *mgRes = solver->mgRes;
+	int bottom = mgRho->nLevels-1;
+
+	Grid *phi = mgPhi->grids[level];
+	Grid *rho = mgRho->grids[level];
+
+	unsigned long long int haloTime = 0;
+	unsigned long long int total = 0;
+	mgSetHaloTime(solver, &haloTime);
+
+	for(int v = 0; v < nVisits; v++){
+
+		MPI_Barrier(mpiInfo->comm);
+		unsigned long long int start = getNanoSec();
+
+		// As mgVRecursiveInner() does on the level, but alternating the sign
+		// of the (stale) correction to keep the values bounded
+		gHaloOp(setSlice, rho, mpiInfo, TOHALO);
+		gNeutralizeGrid(rho, mpiInfo);
+		if(level == bottom){
+			gHaloOp(setSlice, phi, mpiInfo, TOHALO);
+			mgCoarseSolve(mgRho, mgPhi, bottom, mpiInfo);
+			gBnd(phi, mpiInfo);
+		} else {
+			mgRho->preSmooth(phi, rho, mgRho->nPreSmooth, mpiInfo);
+			mgRestrictResidual(level, mgRho, mgPhi, mgRes, mpiInfo);
+			mgCorrect(level, v%2 ? -1 : 1, mgRho, mgPhi, mgRes, mpiInfo);
+			gHaloOp(setSlice, phi, mpiInfo, TOHALO);
+			gBnd(phi, mpiInfo);
+			mgRho->postSmooth(phi, rho, mgRho->nPostSmooth, mpiInfo);
+			gBnd(phi, mpiInfo);
+		}
+
+		total += getNanoSec()-start;
+	}
+
+	mgSetHaloTime(solver, NULL);
+
+	*time = 1e-9*total/nVisits;
+	*halo = 1e-9*haloTime/nVisits;
+}
+
+
 /*************************************************
  *		RUNS
  ************************************************/
@@ -1933,7 +3736,7 @@ void mgMode(dictionary *ini){
 	msg(STATUS, "Avg e^2 = %f", avgError);
 	msg(STATUS, "Residual squared (res^2) = %f", resSquared);
 	msg(STATUS, "Number of Cycles: %d", run);
-	if(mpiInfo->mpiRank==0) tMsg(t->total, "Time spent: ");
+	tMsg(t->total, "Time spent: ");
 
 
 	/*********************************************************************
@@ -24,13 +24,20 @@
  * The preSmooth, postSmooth and coarseSolv is set in the input.ini file, for
  * now the only options are Gauss-Seidel Red-Black (mgGS). More TBD.
  */
- typedef struct {
+ typedef struct Multigrid {
     Grid **grids;   ///< Array of Grid structs of decreasing coarseness
+	Arena *arena;	///< Arena holding the arrays of all but the finest Grid
     int nLevels;         			///< #Grid levels
     int nMGCycles;         			///< Multigrid cycles we want to run
 	int nPreSmooth;					///<
 	int nPostSmooth;
 	int nCoarseSolve;
+	double tolerance;				///< Tolerance of the RMS residual
+	int relTolerance;				///< Whether tolerance is relative to the RMS of rho
+	int checkInterval;				///< Cycles between residual checks (0 for nMGCycles cycles)
+	int warmStart;					///< Whether to start from the previous phi
+	struct Agglomeration *agglomeration;	///< Solver of the gathered coarsest level (or NULL)
+	struct MixedPrecision *mixed;	///< Single precision copies of the coarse levels (or NULL)
 
     ///< Function pointer to a Coarse Grid Solver function
     void (*coarseSolv)(	Grid *phi, const Grid *rho, const int nCycles,
@@ -45,9 +52,67 @@
 	void (*restrictor)(const Grid *fine, Grid *coarse);
     ///< Function pointer to prolongator
 	void (*prolongator)(Grid *fine, const Grid *coarse, const MpiInfo *mpiInfo);
+    ///< Function pointer to restrictor computing the residual itself (or NULL)
+	void (*residualRestrictor)(const Grid *phi, const Grid *rho, Grid *coarse,
+							   const MpiInfo *mpiInfo);
+    ///< Function pointer to prolongator adding to the fine grid (or NULL)
+	void (*prolongAdder)(Grid *fine, Grid *coarse, double factor,
+						 const MpiInfo *mpiInfo);
 
 } Multigrid;
 
+/**
+ * @brief Solver of the coarsest level gathered onto one MPI process
+ *
+ * Every subdomain can only be coarsened a few times, which leaves a large
+ * global problem at the coarsest level when there are many subdomains. Its
+ * true nodes are therefore gathered onto the root (rank 0 of simComm()),
+ * which keeps coarsening the whole domain on its own, and the solution is
+ * scattered back. Enabled by multigrid:agglomerate, which is the number of
+ * levels of the gathered hierarchy (0 to disable, 1 to only gather). The
+ * gathered hierarchy has the ghost layers and smoothers of the distributed
+ * one, and each coarse solve is nCoarseSolve cycles on it. Only periodic
+ * boundaries are supported.
+ */
+typedef struct Agglomeration {
+	MPI_Comm comm;				///< Duplicate of simComm() used for gathering
+	int mpiRank;				///< Rank in comm (the root is 0)
+	int mpiSize;				///< Size of comm
+	Multigrid *mgRho;			///< Gathered rho and its coarser levels (only on root)
+	Multigrid *mgPhi;			///< Gathered phi and its coarser levels (only on root)
+	Multigrid *mgRes;			///< Residuals of the gathered levels (only on root)
+	funPtr mgAlgo;				///< Cycle used on the gathered levels
+	MpiInfo *mpiInfo;			///< One subdomain on MPI_COMM_SELF (see gAllocMpiSelf(), only on root)
+	MPI_Datatype trueType;		///< True nodes of this process' coarsest level
+	MPI_Datatype *blockTypes;	///< Block of each process in the gathered level (mpiSize elements, only on root)
+	int ready;					///< Whether the first solve has created blockTypes
+	MPI_Request *requests;		///< Space for the requests of a gather or scatter (mpiSize+1 elements)
+} Agglomeration;
+
+/**
+ * @brief Single precision coarse levels of the multigrid solver
+ *
+ * The coarse levels only compute a correction to the finest level, which is
+ * recomputed from the double precision residual every cycle, so they need not
+ * be more accurate than the convergence of one cycle. Enabled by
+ * multigrid:precision = MIXED (DOUBLE to disable), with which every level but
+ * the finest is stored, smoothed, restricted and prolongated in float. This
+ * halves the memory traffic of these bandwidth bound kernels and the size of
+ * the halo messages (see gHaloOpSingle()), while the finest level and the
+ * correction added to it stay double. The Grid structs of the coarse levels
+ * of mgRho are only used for their shape and Grid.singleTypes.
+ *
+ * The levels are stored in mgRho, and cycled by mgVMixed() whether the cycle
+ * is mgVRecursive or mgVRegular. Only 3D with periodic boundaries and the
+ * gaussSeidelRB, halfWeight and bilinear methods is supported, and not
+ * together with agglomeration or deep halos on the coarse levels.
+ */
+typedef struct MixedPrecision {
+	float **rho;	///< Charge density of each level (nLevels elements, NULL at 0)
+	float **phi;	///< Correction of each level (nLevels elements, NULL at 0)
+	float **res;	///< Residual of each level (nLevels elements, NULL at 0)
+} MixedPrecision;
+
 typedef struct {
     Grid *res;
     Multigrid *mgRho;
@@ -56,6 +121,27 @@ typedef struct {
     funPtr mgAlgo;
 } MultigridSolver;
 
+/**
+ * @brief Krylov Poisson solver preconditioned by one multigrid cycle
+ *
+ * The work grids have homogeneous boundary slices, and q is shared between
+ * the two methods (it holds v in BiCGStab). The tolerance, toleranceType,
+ * checkInterval, mgCycles and warmStart keys of [multigrid] apply to the
+ * Krylov iterations, see mgcgSolve().
+ */
+typedef struct {
+	MultigridSolver *pre;	///< Preconditioner, solving from its rho into its phi
+	Grid *rho;				///< Charge density (source)
+	Grid *phi;				///< Electric potential (unknown)
+	Grid *r;				///< Residual
+	Grid *p;				///< Search direction
+	Grid *q;				///< Laplacian of the search direction
+	Grid *rHat;				///< Shadow residual (BiCGStab only)
+	Grid *t;				///< Laplacian of the preconditioned residual (BiCGStab only)
+	Grid *y;				///< Preconditioned search direction (BiCGStab only)
+	int periodic;			///< Whether all boundaries are periodic (CG, else BiCGStab)
+} MgcgSolver;
+
 /**
  * @brief Allocates multigrid struct
  * @param grid 		Finest grid
@@ -72,6 +158,7 @@ typedef struct {
  *	nPreSmooth:	Number of cycles the presmoother to run
  *	nPostSmooth:Number of cycles the postsmoother to run
  *	nCoarseSolve:Number of cycles for the coarse solver to run
+ *	tolerance, relTolerance, checkInterval and warmStart: See mgSolveRaw()
  *
  *	The algorithms for the solver, restrictors and prolongators are set in the
  *  allocation according to a input file, then it is handled by a function
@@ -82,6 +169,11 @@ typedef struct {
 		multigrid->prolongator(fine, coarse, mpiInfo);
  *	\endcode
  *
+ *	Where the chosen restrictor and prolongator have counterparts fused with
+ *	the residual and correction (residualRestrictor and prolongAdder, else
+ *	NULL), the V cycles use those instead. The residual is then only needed
+ *	at the finest level, which is all mgAllocSolver() allocates of it.
+ *
  *
  *	NB!The number of true grid points used in the finest grid needs to be a
  *  multiple nLevels*2, to make it possible to half the grid points down to
@@ -90,11 +182,148 @@ typedef struct {
 
 Multigrid *mgAlloc(const dictionary *ini, Grid *grid);
 
-MultigridSolver* mgAllocSolver(const dictionary *ini, Grid *rho, Grid *phi);
+/**
+ * @brief Allocates a multigrid solver
+ * @param	ini		Input file
+ * @param	rho		Charge density (source)
+ * @param	phi		Electric potential (unknown)
+ * @param	mpiInfo	MpiInfo
+ * @return	MultigridSolver
+ *
+ * If multigrid:autoTune is positive, the cycle, smoothers, number of sweeps
+ * and levels are first chosen by timing that many solves of each of a small
+ * set of candidates on a noisy charge density. The [multigrid] keys of ini
+ * are altered to the fastest candidate reaching multigrid:tolerance, which
+ * is logged such that it can be pinned in the input file. The candidates are
+ * V (mgVRecursive) and W cycles, Gauss-Seidel and Jacobi smoothers, 1, 2 or
+ * 4 sweeps, and the most levels the subdomains can be halved into or one
+ * less (kept as is with multigrid:agglomerate). With multigrid:precision =
+ * MIXED only V cycles and Gauss-Seidel are tried. rho and phi are restored.
+ */
+MultigridSolver* mgAllocSolver(dictionary *ini, Grid *rho, Grid *phi,
+							   const MpiInfo *mpiInfo);
 void mgFreeSolver(MultigridSolver *solver);
 void mgSolve(const MultigridSolver *solver,	const Grid *rho, const Grid *phi, const MpiInfo* mpiInfo);
 funPtr mgSolver_set(const dictionary *ini);
 
+/**
+ * @brief Allocates a multigrid preconditioned Krylov solver
+ * @param	ini		Input file
+ * @param	rho		Charge density (source)
+ * @param	phi		Electric potential (unknown)
+ * @param	mpiInfo	MpiInfo
+ * @return	MgcgSolver
+ *
+ * The preconditioner is a MultigridSolver set up by mgAllocSolver() from the
+ * [multigrid] section, on grids of its own. multigrid:autoTune tunes it as a
+ * standalone solver.
+ */
+MgcgSolver* mgcgAllocSolver(dictionary *ini, Grid *rho, Grid *phi,
+							 const MpiInfo *mpiInfo);
+
+/**
+ * @brief Frees MgcgSolver
+ * @param	solver	MgcgSolver
+ */
+void mgcgFreeSolver(MgcgSolver *solver);
+
+/**
+ * @brief Solves phi given rho by a multigrid preconditioned Krylov method
+ * @param	solver	MgcgSolver
+ * @param	rho		Charge density (source)
+ * @param	phi		Electric potential (unknown)
+ * @param	mpiInfo	MpiInfo
+ *
+ * On periodic domains, where the system is symmetric, this is a flexible
+ * (Polak-Ribière) conjugate gradient method, and otherwise BiCGStab. Each
+ * application of the preconditioner is one cycle of multigrid:cycle from a
+ * zero initial guess. The Krylov iterations stop as mgSolveRaw() stops its
+ * cycles: When the RMS of the residual is below multigrid:tolerance, checked
+ * every multigrid:checkInterval iterations, or after multigrid:mgCycles
+ * iterations if checkInterval is 0. A BiCGStab iteration costs two cycles.
+ *
+ * Select it by methods:poisson = mgcgSolver.
+ */
+void mgcgSolve(const MgcgSolver *solver, const Grid *rho, const Grid *phi, const MpiInfo *mpiInfo);
+funPtr mgcgSolver_set(const dictionary *ini);
+
+/**
+ * @brief Writes the state a MultigridSolver keeps between solves to a checkpoint
+ * @param	ck		Checkpoint
+ * @param	solver	MultigridSolver
+ * @see		ckCreate()
+ *
+ * The coarse levels of phi aren't zeroed before each cycle, so they carry over
+ * from one solve to the next and must be restored for a restart to continue
+ * bit for bit. The finest level is the phi passed to mgAllocSolver(), and is
+ * left to the caller.
+ */
+void mgWriteCheckpoint(hid_t ck, const MultigridSolver *solver);
+
+/**
+ * @brief Reads what mgWriteCheckpoint() wrote
+ * @param	ck		Checkpoint
+ * @param	solver	MultigridSolver allocated from the same input file
+ * @see		ckOpen()
+ */
+void mgReadCheckpoint(hid_t ck, const MultigridSolver *solver);
+
+/**
+ * @brief As mgWriteCheckpoint(), for the preconditioner of MgcgSolver
+ */
+void mgcgWriteCheckpoint(hid_t ck, const MgcgSolver *solver);
+
+/**
+ * @brief As mgReadCheckpoint(), for the preconditioner of MgcgSolver
+ */
+void mgcgReadCheckpoint(hid_t ck, const MgcgSolver *solver);
+
+/**
+ * @brief Sets Grid.haloTime of all grids of a solver
+ * @param	solver		MultigridSolver or MgcgSolver
+ * @param	haloTime	Counter to add nanoseconds spent in halo exchanges to (or NULL)
+ *
+ * Except the finest rho and phi of MultigridSolver, which are those passed to
+ * mgAllocSolver(), the grids are internal to the solver and can't be set
+ * otherwise. Used by methods:mode = poissonBenchmark.
+ */
+void mgSetHaloTime(const MultigridSolver *solver, unsigned long long int *haloTime);
+void mgcgSetHaloTime(const MgcgSolver *solver, unsigned long long int *haloTime);
+
+/**
+ * @brief Times cycles of a multigrid solver from a zero initial guess
+ * @param	solver		MultigridSolver
+ * @param	nCycles		Number of cycles to time
+ * @param[out]	time	Seconds per cycle on this process
+ * @param[out]	halo	Seconds per cycle spent in halo exchanges on this process
+ * @param[out]	factor	Reduction of the RMS residual per cycle
+ * @param	mpiInfo		MpiInfo
+ *
+ * The charge density must be in the finest level of solver->mgRho. Cycles
+ * after the residual has reached round-off are left out of the factor. Used by
+ * methods:mode = poissonBenchmark.
+ */
+void mgBenchmarkCycle(const MultigridSolver *solver, int nCycles, double *time,
+					  double *halo, double *factor, const MpiInfo *mpiInfo);
+
+/**
+ * @brief Times the work a V cycle does on one level of a multigrid solver
+ * @param	solver		MultigridSolver
+ * @param	level		Level to time
+ * @param	nVisits		Number of visits to time
+ * @param[out]	time	Seconds per visit on this process
+ * @param[out]	halo	Seconds per visit spent in halo exchanges on this process
+ * @param	mpiInfo		MpiInfo
+ *
+ * A visit is the pre-smoothing, the restriction of the residual, the
+ * correction from the next level and the post-smoothing, or the coarse solver
+ * on the coarsest level. It doesn't include the coarser levels, so the time of
+ * a V cycle is roughly the sum of those of all levels. The levels of
+ * multigrid:precision = MIXED are timed in double precision.
+ */
+void mgBenchmarkLevel(const MultigridSolver *solver, int level, int nVisits,
+					  double *time, double *halo, const MpiInfo *mpiInfo);
+
  /**
   * @brief Free multigrid struct, top gridQuantity needs to be freed seperately
   * @param 	multigrid
@@ -161,6 +390,23 @@ void mgVRegular(int level,int bottom, int top, Multigrid *mgRho,
 void mgVRecursive(int level, int bottom, int top, Multigrid *mgRho,
                     Multigrid *mgPhi,Multigrid *mgRes, const MpiInfo *mpiInfo);
 
+/**
+ * @brief Performs a multigrid V cycle with single precision coarse levels
+ * @param   level       Grid level the V cycle starts on (the finest)
+ * @param   bottom      Grid level at the bottom of the cycle
+ * @param   top         Grid level at the top of the cycle (the finest)
+ * @param   mgRho       MgGrid struct containing rho
+ * @param   mgPhi       MgGrid struct containing phi
+ * @param   mgRes       MgGrid struct containing the residual
+ * @param   mpiInfo     MpiInfo struct containing subdomain information
+ *
+ * The finest level is smoothed as in mgVRecursive(), while the correction is
+ * computed on the levels of Multigrid.mixed of mgRho, each starting from zero.
+ * Used by mgVRecursive() and mgVRegular() when mgRho has Multigrid.mixed.
+ */
+void mgVMixed(int level, int bottom, int top, Multigrid *mgRho,
+				Multigrid *mgPhi, Multigrid *mgRes, const MpiInfo *mpiInfo);
+
 /**
  * @brief Performs a Full multigrid cycle
  * @param   level       Grid level the V cycle starts on
@@ -199,6 +445,15 @@ void mgW(int level, int bottom, int top, Multigrid *mgRho, Multigrid *mgPhi,
  *
  *	This is an implementation of a Multigrid V Cycle solver. See "DOC" for more
  *  information.
+ *
+ *	Unless multigrid:warmStart is 0, the cycles start from the phi of the
+ *  previous call, which in PIC barely differs from the solution. The cycles
+ *  run until the RMS of the residual is below multigrid:tolerance, which is
+ *  absolute or relative to the RMS of rho as set by multigrid:toleranceType
+ *  (ABSOLUTE or RELATIVE). The residual costs a stencil pass and a global
+ *  reduction, and is only checked every multigrid:checkInterval cycles. With a
+ *  checkInterval of 0 the residual is never computed, and multigrid:mgCycles
+ *  cycles are run instead.
  */
 
 void mgSolveRaw(funPtr mgAlgo, Multigrid *mgRho, Multigrid *mgPhi,
@@ -228,10 +483,13 @@ void mgGS3DNew(Grid *phi, const Grid *rho, const int nCycles,
  * @return	phi
  *
  *	3D dimensional implementation of Gauss-Seidel RB, which does one sweep
- *  through the grid for each color, but has slightly more complicated behaviour
- *  on the edges, due to needing to skip the ghostlayers.
+ *  through the grid for each color. Each sweep does the interior of
+ *  Grid.haloBoxes first, while the ghost layers from the previous sweep are
+ *  still in flight (see gHaloOpBegin()), and then the shell. Only the color
+ *  just updated is sent if the grid has Grid.colorTypes (see
+ *  gHaloOpColorBegin()), as set up by mgAllocSolver() on levels of even widths.
  *
- *	NB! Assumes 1 ghost layer, and even number of grid points.
+ *	NB! Assumes 1 ghost layer.
  */
 void mgGS3D(Grid *phi, const Grid *rho, const int nCycles,
             const MpiInfo *mpiInfo);
@@ -243,10 +501,10 @@ void mgGS3D(Grid *phi, const Grid *rho, const int nCycles,
  * @param	mpiInfo	Subdomain information
  * @return	phi
  *
- *	2D dimensional implementation of Gauss-Seidel RB, which does several sweeps
- *  through the grid trying to simplify the iteration through the grid.
+ *	2D dimensional implementation of Gauss-Seidel RB, which works like mgGS3D()
+ *  but starts with the black nodes and doesn't apply the boundary conditions.
  *
- *	NB! Assumes 1 ghost layer, and even number of grid points.
+ *	NB! Assumes 1 ghost layer.
  */
 void mgGS2D(Grid *phi, const Grid *rho, const int nCycles,
             const MpiInfo *mpiInfo);
@@ -301,6 +559,24 @@ void mgHalfRestrict2D(const Grid *fine, Grid *coarse);
  */
 void mgHalfRestrict3D(const Grid *fine, Grid *coarse);
 
+/**
+ * @brief Half weight restriction of the residual, 3D
+ * @param	phi		Potential of the fine level
+ * @param	rho		Source of the fine level
+ * @param	coarse	Restricted residual
+ * @param	mpiInfo	Subdomain information
+ * @return	coarse
+ *
+ * Same as mgResidual() followed by gHaloOpFaces() and mgHalfRestrict3D(),
+ * but the residual is computed where the restriction needs it rather than
+ * stored. The ghost layers of phi must be set. The residual of the lowest
+ * fine nodes' lower neighbors belongs to the lower subdomain, which adds it
+ * to its upper ghost layer of coarse and sends it with gHaloOp() (addSlice,
+ * FROMHALO). The ghost layers of coarse are zeroed in the process.
+ */
+void mgHalfRestrictResidual3D(const Grid *phi, const Grid *rho, Grid *coarse,
+							  const MpiInfo *mpiInfo);
+
 /**
  * @brief Half weight restriction, ND
  * @param	fine	Source term
@@ -342,6 +618,23 @@ void mgBilinProl2D(Grid *fine,const Grid *coarse, const MpiInfo *mpiInfo);
  *
  */
 void mgBilinProl3D(Grid *fine,const Grid *coarse, const MpiInfo *mpiInfo);
+
+/**
+ * @brief Adds a bilinear (trilinear) interpolation to the fine grid, 3D
+ * @param	fine	Fine grid
+ * @param	coarse	Coarse grid
+ * @param	factor	Factor of the interpolated values
+ * @param	mpiInfo	Subdomain information
+ * @return	fine
+ *
+ * Same as mgBilinProl3D() into a temporary grid followed by adding factor
+ * times it to the true nodes of fine, but in one pass over fine. Each fine
+ * node is interpolated directly from its 1, 2, 4 or 8 nearest coarse nodes,
+ * which needs the ghost layers of coarse. They are set by gHaloOp(), and
+ * gBnd() unless all boundaries are periodic.
+ */
+void mgBilinProlAdd3D(Grid *fine, Grid *coarse, double factor,
+					  const MpiInfo *mpiInfo);
 /**
  * @brief Bilinear interpolation, ND
  * @param	fine	Fine grid
@@ -378,8 +671,11 @@ void mgRestrictBnd(Multigrid *mgGrid);
  *	\f[
  *		d_l = \nabla^2_l\phi_l - \rho_l
  *	\f]
+ *
+ *	A halo exchange of phi started by gHaloOpBegin() is completed after the
+ *	interior is computed (see gFinDiff2nd3D()).
  */
-void mgResidual(Grid *res, const Grid *rho, const Grid *phi,const MpiInfo *mpiInfo);
+void mgResidual(Grid *res, const Grid *rho, Grid *phi,const MpiInfo *mpiInfo);
 
 /**
  * @brief Returns mass of a grid
@@ -7,6 +7,7 @@
 
 #include "core.h"
 #include "object.h"
+#include <limits.h>
 
 /******************************************************************************
  *  LOCAL FUNCTION DECLARATIONS
@@ -20,6 +21,35 @@
  */
 void oFillLookupTables(Object *obj, const MpiInfo *mpiInfo);
 
+/**
+ * @brief   Makes the mask, the cell types and the surface lookup tables.
+ * @param	obj		Object
+ * @param	mpiInfo	MpiInfo
+ * @return	void
+ */
+static void oFillMask(Object *obj, const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Offsets from the lower corner of a cell to each of its 2^nDims corners
+ * @param	grid	Grid
+ * @return	Offsets (to be freed)
+ */
+static long int *oCornerOffsets(const Grid *grid);
+
+/**
+ * @brief	Identifier of the object a particle in a CELL_SURFACE cell is in
+ * @param	mask	Object identifiers of the nodes
+ * @param	j		Index of the cell (lower corner)
+ * @param	corner	Offsets to the corners of the cell
+ * @param	frac	Position of the particle relative to the lower corner
+ * @param	nDims	Number of dimensions
+ * @return	Identifier, or 0 if the particle is outside
+ */
+static inline int oHit(	const unsigned short *mask, long int j,
+						const long int *corner, const double *frac, int nDims);
+
+static inline long int oIndex(const Population *pop, int s, long int i, int d);
+
 /******************************************************************************
  *  LOCAL FUNCTION DEFINITIONS
  *****************************************************************************/
@@ -34,7 +64,7 @@ void oFillLookupTables(Object *obj, const MpiInfo *mpiInfo) {
         }
     }
     // Make sure each process knows about the total number of objects.
-    MPI_Allreduce(MPI_IN_PLACE, &nObjects, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &nObjects, 1, MPI_INT, MPI_MAX, mpiInfo->comm);
     
     // Initialise and compute the array storing the offsets of the objects in the lookup table.
     long int *lookupInteriorOffset = malloc((nObjects+1)*sizeof(*lookupInteriorOffset));
@@ -73,6 +103,135 @@ void oFillLookupTables(Object *obj, const MpiInfo *mpiInfo) {
     obj->lookupInteriorOffset = lookupInteriorOffset;
 }
 
+static void oFillMask(Object *obj, const MpiInfo *mpiInfo){
+
+	Grid *domain = obj->domain;
+	int nDims = domain->rank-1;
+	int nObjects = obj->nObjects;
+	const int *size = domain->size;
+	const long int *sizeProd = domain->sizeProd;
+	long int nNodes = sizeProd[domain->rank];
+
+	if(nObjects>USHRT_MAX)
+		msg(ERROR, "%i objects found but at most %i are supported", nObjects, USHRT_MAX);
+
+	gHaloOp(setSlice, domain, mpiInfo, TOHALO);
+
+	unsigned short *mask = malloc(nNodes*sizeof(*mask));
+	for(long int i=0;i<nNodes;i++){
+		double id = domain->val[i];
+		mask[i] = id>0.5 ? (unsigned short)(id+0.5) : 0;
+	}
+
+	int nCorners = 1<<nDims;
+	long int *corner = oCornerOffsets(domain);
+	int *touches = malloc((nObjects+1)*sizeof(*touches));
+	long int *lookupSurfaceOffset = malloc((nObjects+2)*sizeof(*lookupSurfaceOffset));
+	long int *count = lookupSurfaceOffset+1;	// count[id] for id=1..nObjects
+	for(long int a=0;a<nObjects+1;a++) count[a] = 0;
+
+	// Classify cells and count the surface cells touching each object. The last
+	// node along each dimension is not the lower corner of any cell.
+	unsigned char *cell = malloc(nNodes*sizeof(*cell));
+	for(int pass=0;pass<2;pass++){
+		for(long int j=0;j<nNodes;j++){
+
+			cell[j] = CELL_OUTSIDE;
+			int isCell = 1;
+			for(int d=0;d<nDims;d++)
+				if((j/sizeProd[d+1])%size[d+1]==size[d+1]-1) isCell = 0;
+			if(!isCell) continue;
+
+			int nInside = 0, same = 1;
+			for(int c=0;c<nCorners;c++){
+				int id = mask[j+corner[c]];
+				if(id) nInside++;
+				if(id!=mask[j]) same = 0;
+			}
+			if(nInside==0) continue;
+			if(nInside==nCorners && same){
+				cell[j] = CELL_INSIDE;
+				continue;
+			}
+			cell[j] = CELL_SURFACE;
+
+			// Each object touching the cell once
+			for(int c=0;c<nCorners;c++) touches[mask[j+corner[c]]] = 0;
+			for(int c=0;c<nCorners;c++){
+				int id = mask[j+corner[c]];
+				if(id==0 || touches[id]) continue;
+				touches[id] = 1;
+				if(pass==0) count[id]++;
+				else obj->lookupSurface[lookupSurfaceOffset[id-1]++] = j;
+			}
+		}
+
+		if(pass==0){
+			// Turn the counts into offsets in place
+			alCumSum(count+1,lookupSurfaceOffset,nObjects);
+			obj->lookupSurface = malloc(lookupSurfaceOffset[nObjects]*sizeof(*obj->lookupSurface));
+		} else {
+			// The offsets were advanced to the start of the next object
+			for(int a=nObjects;a>0;a--) lookupSurfaceOffset[a] = lookupSurfaceOffset[a-1];
+			lookupSurfaceOffset[0] = 0;
+		}
+	}
+
+	free(touches);
+	free(corner);
+
+	obj->mask = mask;
+	obj->cell = cell;
+	obj->lookupSurfaceOffset = lookupSurfaceOffset;
+	obj->charge = malloc(nObjects*sizeof(*obj->charge));
+	adSetAll(obj->charge,nObjects,0);
+}
+
+static long int *oCornerOffsets(const Grid *grid){
+
+	int nDims = grid->rank-1;
+	int nCorners = 1<<nDims;
+	long int *corner = malloc(nCorners*sizeof(*corner));
+	for(int c=0;c<nCorners;c++){
+		corner[c] = 0;
+		for(int d=0;d<nDims;d++)
+			if(c & (1<<d)) corner[c] += grid->sizeProd[d+1];
+	}
+	return corner;
+}
+
+static inline int oHit(	const unsigned short *mask, long int j,
+						const long int *corner, const double *frac, int nDims){
+
+	// Multilinear interpolation of inside (1) and outside (0). The particle
+	// belongs to the inside corner of largest weight.
+	double inside = 0, wMax = 0;
+	int id = 0;
+	for(int c=0;c<(1<<nDims);c++){
+		int cId = mask[j+corner[c]];
+		if(!cId) continue;
+
+		double w = 1;
+		for(int d=0;d<nDims;d++) w *= (c & (1<<d)) ? frac[d] : 1-frac[d];
+
+		inside += w;
+		if(w>wMax){
+			wMax = w;
+			id = cId;
+		}
+	}
+	return inside>=0.5 ? id : 0;
+}
+
+static inline long int oIndex(const Population *pop, int s, long int i, int d){
+
+	int nDims = pop->nDims;
+	if(pop->layout==AOS) return i*nDims+d;
+
+	long int iStart = pop->iStart[s];
+	return iStart*nDims + d*(pop->iStart[s+1]-iStart) + i-iStart;
+}
+
 
 
 /*****************************************************************************
@@ -82,6 +241,7 @@ void oFillLookupTables(Object *obj, const MpiInfo *mpiInfo) {
 Object *oAlloc(const dictionary *ini){
     
     Grid *domain = gAlloc(ini, SCALAR);
+    gZero(domain); // Only the true nodes are read from file
     
     long int *lookupInterior = NULL;
     long int *lookupInteriorOffset = NULL;
@@ -90,9 +250,20 @@ Object *oAlloc(const dictionary *ini){
     Object *obj = malloc(sizeof(*obj));
     
     obj->domain = domain;
+    obj->mask = NULL;
+    obj->cell = NULL;
     obj->lookupInterior = lookupInterior;
     obj->lookupInteriorOffset = lookupInteriorOffset;
+    obj->lookupSurface = NULL;
+    obj->lookupSurfaceOffset = NULL;
+    obj->charge = NULL;
     obj->nObjects = nObjects;
+    obj->nCapNodes = 0;
+    obj->capCount = NULL;
+    obj->capDispl = NULL;
+    obj->capMatrix = NULL;
+    obj->capSum = NULL;
+    obj->capObjects = NULL;
     
     return obj;
 }
@@ -101,8 +272,18 @@ void oFree(Object *obj){
     
     gFree(obj->domain);
     
+    free(obj->mask);
+    free(obj->cell);
     free(obj->lookupInterior);
     free(obj->lookupInteriorOffset);
+    free(obj->lookupSurface);
+    free(obj->lookupSurfaceOffset);
+    free(obj->charge);
+    free(obj->capCount);
+    free(obj->capDispl);
+    free(obj->capMatrix);
+    free(obj->capSum);
+    free(obj->capObjects);
     free(obj);
     
 }
@@ -140,10 +321,193 @@ void oReadH5(Object *obj, const MpiInfo *mpiInfo){
     
     //Count the number of objects and fills the lookup tables.
     oFillLookupTables(obj,mpiInfo);
+    oFillMask(obj,mpiInfo);
 }
 
 /******************************************************************************
  *  GLOBAL FUNCTION DEFINITIONS
  *****************************************************************************/
 
+void oRayTrace(Population *pop, Object *obj){
+
+	int nSpecies = pop->nSpecies;
+	int nDims = pop->nDims;
+	const int *size = obj->domain->size;
+	const long int *sizeProd = obj->domain->sizeProd;
+	const unsigned short *mask = obj->mask;
+	const unsigned char *cell = obj->cell;
+
+	long int *corner = oCornerOffsets(obj->domain);
+	double *frac = malloc(nDims*sizeof(*frac));
+	double *pos = malloc(nDims*sizeof(*pos));
+	double *vel = malloc(nDims*sizeof(*vel));
+
+	for(int s=0;s<nSpecies;s++){
+
+		// Cutting moves the last particle to i, which is then tested next
+		long int i = pop->iStart[s];
+		while(i<pop->iStop[s]){
+
+			long int j = 0;
+			int valid = 1;
+			for(int d=0;d<nDims;d++){
+				double x = pop->pos[oIndex(pop,s,i,d)];
+				long int k = (long int)floor(x);
+				if(k<0 || k>=size[d+1]-1) valid = 0;
+				frac[d] = x-k;
+				j += k*sizeProd[d+1];
+			}
+
+			int id = 0;
+			if(valid){
+				if(cell[j]==CELL_INSIDE) id = mask[j];
+				else if(cell[j]==CELL_SURFACE) id = oHit(mask,j,corner,frac,nDims);
+			}
+
+			if(id){
+				obj->charge[id-1] += pop->charge[s];
+				pCut(pop,s,i*nDims,pos,vel);
+			} else {
+				i++;
+			}
+		}
+	}
+
+	free(vel);
+	free(pos);
+	free(frac);
+	free(corner);
+}
+
+void oComputeCapacitanceMatrix(	Object *obj, funPtr solve, void *solver,
+								Grid *rho, Grid *phi, const MpiInfo *mpiInfo){
+
+	int mpiSize = mpiInfo->mpiSize;
+	int mpiRank = mpiInfo->mpiRank;
+	int nObjects = obj->nObjects;
+	const long int *lookup = obj->lookupInterior;
+	const long int *offset = obj->lookupInteriorOffset;
+	int nOwn = (int)offset[nObjects];
+
+	int *capCount = malloc(mpiSize*sizeof(*capCount));
+	int *capDispl = malloc(mpiSize*sizeof(*capDispl));
+	MPI_Allgather(&nOwn, 1, MPI_INT, capCount, 1, MPI_INT, mpiInfo->comm);
+	capDispl[0] = 0;
+	for(int r=1;r<mpiSize;r++) capDispl[r] = capDispl[r-1]+capCount[r-1];
+	long int nCapNodes = capDispl[mpiSize-1]+capCount[mpiSize-1];
+
+	msg(STATUS, "Computing capacitance matrix of %li object nodes", nCapNodes);
+
+	// Object (counting from 0) of each of the nodes
+	int *ownId = malloc(nOwn*sizeof(*ownId));
+	int *id = malloc(nCapNodes*sizeof(*id));
+	for(int a=0;a<nObjects;a++)
+		for(long int i=offset[a];i<offset[a+1];i++) ownId[i] = a;
+	MPI_Allgatherv(ownId, nOwn, MPI_INT, id, capCount, capDispl, MPI_INT, mpiInfo->comm);
+
+	// P[i*nCapNodes+j] is the potential at node i due to a unit charge at j
+	double *P = malloc(nCapNodes*nCapNodes*sizeof(*P));
+	double *ownPhi = malloc(nOwn*sizeof(*ownPhi));
+	double *column = malloc(nCapNodes*sizeof(*column));
+	int owner = 0;
+	for(long int j=0;j<nCapNodes;j++){
+
+		while(j>=capDispl[owner]+capCount[owner]) owner++;
 
+		gZero(rho);
+		gZero(phi);
+		if(owner==mpiRank) rho->val[lookup[j-capDispl[owner]]] = 1;
+		solve(solver, rho, phi, mpiInfo);
+
+		for(int i=0;i<nOwn;i++) ownPhi[i] = phi->val[lookup[i]];
+		MPI_Allgatherv(ownPhi, nOwn, MPI_DOUBLE, column, capCount, capDispl, MPI_DOUBLE, mpiInfo->comm);
+		for(long int i=0;i<nCapNodes;i++) P[i*nCapNodes+j] = column[i];
+	}
+
+	adInvert(P,nCapNodes);
+
+	// Keep the rows of this subdomain
+	long int first = capDispl[mpiRank];
+	double *capMatrix = malloc(nOwn*nCapNodes*sizeof(*capMatrix));
+	for(long int i=0;i<nOwn*nCapNodes;i++) capMatrix[i] = P[first*nCapNodes+i];
+
+	double *capSum = malloc(nOwn*nObjects*sizeof(*capSum));
+	adSetAll(capSum,nOwn*nObjects,0);
+	for(int i=0;i<nOwn;i++)
+		for(long int j=0;j<nCapNodes;j++)
+			capSum[i*nObjects+id[j]] += capMatrix[i*nCapNodes+j];
+
+	// Total capacitance matrix of the objects
+	double *capObjects = malloc(nObjects*nObjects*sizeof(*capObjects));
+	adSetAll(capObjects,nObjects*nObjects,0);
+	for(int i=0;i<nOwn;i++)
+		for(int b=0;b<nObjects;b++)
+			capObjects[ownId[i]*nObjects+b] += capSum[i*nObjects+b];
+	MPI_Allreduce(MPI_IN_PLACE, capObjects, nObjects*nObjects, MPI_DOUBLE, MPI_SUM, mpiInfo->comm);
+	if(nObjects>0) adInvert(capObjects,nObjects);
+
+	free(column);
+	free(ownPhi);
+	free(P);
+	free(id);
+	free(ownId);
+
+	obj->nCapNodes = nCapNodes;
+	obj->capCount = capCount;
+	obj->capDispl = capDispl;
+	obj->capMatrix = capMatrix;
+	obj->capSum = capSum;
+	obj->capObjects = capObjects;
+}
+
+void oApplyCapacitanceMatrix(	const Object *obj, funPtr solve, void *solver,
+								Grid *rho, Grid *phi, const MpiInfo *mpiInfo){
+
+	int nObjects = obj->nObjects;
+	long int nCapNodes = obj->nCapNodes;
+	const long int *lookup = obj->lookupInterior;
+	const long int *offset = obj->lookupInteriorOffset;
+	long int nOwn = offset[nObjects];
+
+	double *ownPhi = malloc(nOwn*sizeof(*ownPhi));
+	double *allPhi = malloc(nCapNodes*sizeof(*allPhi));
+	for(long int i=0;i<nOwn;i++) ownPhi[i] = phi->val[lookup[i]];
+	MPI_Allgatherv(ownPhi, (int)nOwn, MPI_DOUBLE, allPhi, obj->capCount, obj->capDispl, MPI_DOUBLE, mpiInfo->comm);
+
+	// The charge C phi, summed per object, is put after the collected charge
+	double *capPhi = ownPhi;
+	double *rhs = malloc(2*nObjects*sizeof(*rhs));
+	double *V = malloc(nObjects*sizeof(*V));
+	adSetAll(rhs,2*nObjects,0);
+	for(int a=0;a<nObjects;a++){
+		rhs[a] = obj->charge[a];
+		for(long int i=offset[a];i<offset[a+1];i++){
+			const double *row = &obj->capMatrix[i*nCapNodes];
+			double sum = 0;
+			for(long int j=0;j<nCapNodes;j++) sum += row[j]*allPhi[j];
+			capPhi[i] = sum;
+			rhs[nObjects+a] += sum;
+		}
+	}
+	MPI_Allreduce(MPI_IN_PLACE, rhs, 2*nObjects, MPI_DOUBLE, MPI_SUM, mpiInfo->comm);
+
+	// Potentials such that each object gets its collected charge
+	for(int a=0;a<nObjects;a++){
+		V[a] = 0;
+		for(int b=0;b<nObjects;b++)
+			V[a] += obj->capObjects[a*nObjects+b]*(rhs[b]+rhs[nObjects+b]);
+	}
+
+	for(long int i=0;i<nOwn;i++){
+		double dq = -capPhi[i];
+		for(int b=0;b<nObjects;b++) dq += obj->capSum[i*nObjects+b]*V[b];
+		rho->val[lookup[i]] += dq;
+	}
+
+	solve(solver, rho, phi, mpiInfo);
+
+	free(V);
+	free(rhs);
+	free(allPhi);
+	free(ownPhi);
+}
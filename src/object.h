@@ -8,14 +8,61 @@
 #ifndef OBJECT_H
 #define OBJECT_H
 
+/**
+ * @brief Classifies cells relative to the objects
+ * @see Object
+ */
+typedef enum{
+	CELL_OUTSIDE = 0x00,	///< No corner of the cell is inside an object
+	CELL_SURFACE = 0x01,	///< Some, but not all, corners are inside an object
+	CELL_INSIDE = 0x02		///< All corners are inside an object
+} cellType;
+
 /**
  * @brief Represents an object
+ *
+ * domain holds the object identifier of each node as read from file (0 outside
+ * objects, 1 for the first object and so on). Since this is a double per node
+ * it is only used while setting up. The object identifier is then stored in the
+ * much more compact mask instead, and cell holds the cellType of each cell,
+ * where a cell is indexed by the node at its lower corner. Both include ghost
+ * nodes and are indexed like domain.
+ *
+ * The objects are resolved by the grid, such that the surface of an object is
+ * where the multilinear interpolation of "inside" (1) and "outside" (0) of the
+ * nodes equals 0.5. Only particles in CELL_SURFACE cells thus need an
+ * expensive test to know if they are inside the object, see oRayTrace().
+ *
+ * lookupSurface lists the CELL_SURFACE cells touching each object, object
+ * a (counting from 0) being lookupSurface[lookupSurfaceOffset[a]] to
+ * lookupSurface[lookupSurfaceOffset[a+1]-1]. lookupInterior is organized the
+ * same way.
+ *
+ * The nodes in lookupInterior of all subdomains, in the order of the MPI
+ * ranks, are the nCapNodes nodes of the capacitance matrix method. capCount
+ * and capDispl are the number of them in each subdomain and where they begin.
+ * For the nodes of this subdomain (rows), capMatrix holds the capacitance
+ * matrix (nCapNodes columns) and capSum the sum of its columns belonging to
+ * each object (nObjects columns). capObjects is the inverse of the
+ * nObjects-by-nObjects total capacitance matrix of the objects. See
+ * oComputeCapacitanceMatrix().
  */
 typedef struct{
 	Grid *domain;					///< Represents precense of objects
+	unsigned short *mask;			///< Object identifier of each node
+	unsigned char *cell;			///< cellType of each cell
 	long int *lookupInterior;		///< Indices of the interior of the objects
 	long int *lookupInteriorOffset;	///< Offset in the above per object (nObjects+1 elements)
+	long int *lookupSurface;		///< Indices of the surface cells of the objects
+	long int *lookupSurfaceOffset;	///< Offset in the above per object (nObjects+1 elements)
+	double *charge;					///< Charge collected by each object in this subdomain (nObjects elements)
 	int nObjects;					///< Number of objects
+	long int nCapNodes;				///< Number of object nodes in all subdomains
+	int *capCount;					///< Number of object nodes per subdomain
+	int *capDispl;					///< First object node of each subdomain
+	double *capMatrix;				///< Capacitance matrix (rows of this subdomain)
+	double *capSum;					///< Column sums of capMatrix per object
+	double *capObjects;				///< Inverse total capacitance matrix
 } Object;
 
 /**
@@ -66,14 +113,80 @@ void oCloseH5(Object *obj);
  * @return	void
  * @see gReadH5()
  *
- * Reads the input objects and creates the various lookup tables needed.
+ * Reads the input objects and creates the various lookup tables needed. The
+ * identifiers are exchanged to the ghost nodes before the mask and the cell
+ * types are made, such that also particles in the ghost layers can be tested.
+ * At most 65535 objects are supported.
  */
 void oReadH5(Object *obj, const MpiInfo *mpiInfo);
 
 /**
- * TO IMPLEMENT!
+ * @brief	Removes particles which have hit an object
+ * @param[in,out]	pop		Population
+ * @param[in,out]	obj		Object
+ * @return	void
+ *
+ * Particles inside an object are removed from the population and their charge
+ * is added to obj->charge of that object. Particles must be in local frame.
+ *
+ * Most particles are far from any object, and are passed over by looking up
+ * the cell they are in, one byte per particle. Particles in CELL_INSIDE cells
+ * are removed right away, and only those in CELL_SURFACE cells get the
+ * expensive test of interpolating the object identifiers to the particle.
+ *
+ * This is meant to be called once per time step, after the particles are
+ * moved and migrated. Particles which pass an object entirely in one time step
+ * are not detected, which would take a velocity of at least one cell per step.
+ */
+void oRayTrace(Population *pop, Object *obj);
+
+/**
+ * @brief	Precomputes the capacitance matrices of the objects
+ * @param[in,out]	obj		Object
+ * @param			solve	Poisson solver (as selected by methods:poisson)
+ * @param			solver	Solver state
+ * @param			rho		Charge density
+ * @param			phi		Electric potential
+ * @param			mpiInfo	MpiInfo
+ * @return	void
+ *
+ * Charging conducting objects with the capacitance matrix method: Each object
+ * must have the same potential on all its nodes (lookupInterior), which is
+ * achieved by adding a surface charge to them. If P is the matrix of the
+ * potential at node i due to a unit charge at node j, a correction dq of the
+ * charge changes the potential on the nodes by P dq. The capacitance matrix C
+ * is the inverse of P, such that the charge needed to lift the potential phi
+ * of the nodes to V is C (V-phi).
+ *
+ * C is computed once by solving for the potential of a unit charge on each of
+ * the nCapNodes nodes in turn and inverting P. This is expensive, but
+ * afterwards each time step needs only one extra solve, regardless of the
+ * number of objects, see oApplyCapacitanceMatrix(). The contents of rho and
+ * phi are destroyed.
+ *
+ * P (nCapNodes^2 elements) is inverted on each MPI node. This is only meant for
+ * objects of moderate numbers of nodes.
+ */
+void oComputeCapacitanceMatrix(	Object *obj, funPtr solve, void *solver,
+								Grid *rho, Grid *phi, const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Makes the objects equipotential using the capacitance matrix
+ * @param			obj		Object
+ * @param			solve	Poisson solver (as used for phi)
+ * @param			solver	Solver state
+ * @param[in,out]	rho		Charge density
+ * @param[in,out]	phi		Electric potential, solved from rho
+ * @return	void
+ *
+ * To be called after phi is solved from rho. The potential V of each object is
+ * determined such that the correction charge added to its nodes equals the
+ * charge it has collected (obj->charge summed over all subdomains). The
+ * correction C (V-phi) is added to rho and phi is solved once more.
  *
+ * @see oComputeCapacitanceMatrix()
  */
-void oRayTrace(Population *pop, const Object *obj);
+void oApplyCapacitanceMatrix(	const Object *obj, funPtr solve, void *solver,
+								Grid *rho, Grid *phi, const MpiInfo *mpiInfo);
 
 #endif // OBJECT_H
@@ -11,11 +11,168 @@
 
 #include "core.h"
 #include <math.h>
+#include <string.h>
+#include <limits.h>
 #include <mpi.h>
 #include <gsl/gsl_rng.h>
 #include <gsl/gsl_randist.h>
 #include <hdf5.h>
 #include "iniparser.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/******************************************************************************
+ * DECLARING LOCAL FUNCTIONS
+ *****************************************************************************/
+
+/**
+ * @brief	Returns index of component d of particle i in pos or vel
+ * @param	pop		Population
+ * @param	s		Specie of particle
+ * @param	i		Particle index
+ * @param	d		Component
+ * @return	Index into pop->pos or pop->vel
+ *
+ * Takes care of the layout of pop (see popLayout).
+ */
+static inline long int pIndex(const Population *pop, int s, long int i, int d);
+
+/**
+ * @brief	Returns lexicographic index of the cell a particle resides in
+ * @param	pop			Population
+ * @param	s			Specie of particle
+ * @param	i			Particle index
+ * @param	cellProd	Cumulative product of grid size (excluding the first)
+ * @return	Cell index
+ *
+ * The cell is identified by its lower node, i.e. the node (int)pos.
+ */
+static inline long int pCellIndex(	const Population *pop, int s, long int i,
+									const long int *cellProd);
+
+/**
+ * @brief	Swaps particle number i and j
+ * @param[in,out]	pop		Population
+ * @param			s		Specie of particles
+ * @param			i		Particle index
+ * @param			j		Particle index
+ * @return			void
+ */
+static inline void pSwap(Population *pop, int s, long int i, long int j);
+
+/**
+ * @brief	Reallocates the particles with new room for each specie
+ * @param[in,out]	pop		Population
+ * @param			nAlloc	Particles to allocate for each specie
+ * @return			void
+ *
+ * nAlloc[s] must be at least the number of particles of specie s. Particles
+ * resident on a device (see pToDevice()) are moved through the host.
+ */
+static void pRealloc(Population *pop, const long int *nAlloc);
+
+/**
+ * @brief	Discards the cell order recorded by pSort()
+ * @param[in,out]	pop		Population
+ * @return			void
+ *
+ * To be called by functions reordering the particles.
+ */
+static void pDiscardOrder(Population *pop);
+
+/**
+ * @brief	Particle index with a sorting key, for qsort()
+ */
+typedef struct{
+	double key;
+	long int i;
+} PKey;
+static int pCompareKey(const void *a, const void *b);
+
+/**
+ * @brief	Merges groups of four particles into two
+ * @param[in,out]	pop		Population
+ * @param			s		Specie
+ * @param			key		Particles of one cell (sorted by speed)
+ * @param			n		Number of particles in key
+ * @param			nGroups	Number of groups to merge
+ * @return			void
+ *
+ * The merged-away particles get zero weight, to be removed afterwards.
+ */
+static void pMergeCell(Population *pop, int s, PKey *key, long int n, long int nGroups);
+
+/**
+ * @brief	Splits particles into two of half the weight
+ * @param[in,out]	pop		Population
+ * @param			s		Specie
+ * @param			key		Particles of one cell (sorted by decreasing weight)
+ * @param			n		Number of particles in key
+ * @param			nSplits	Number of particles to split
+ * @return			1 if there wasn't room for all new particles, else 0
+ *
+ * The caller must reserve room for the new particles (see pReserve())
+ * beforehand, since the indices in key are not valid after the storage moves.
+ */
+static int pSplitCell(Population *pop, int s, PKey *key, long int n, long int nSplits);
+
+/**
+ * @brief	Sanity check of merging and splitting
+ * @param	ini		Input file
+ * @return	void
+ *
+ * Weighted particles are only supported by the kernels suffixed Weighted and
+ * puSweepSplit(), and not by load balancing.
+ */
+static void pMergeSanity(const dictionary *ini);
+
+/**
+ * @brief	Mixes an integer into a hash (splitmix64 finalizer)
+ * @param	hash	Hash so far
+ * @param	x		Integer to mix in
+ * @return	New hash
+ *
+ * Used to derive a seed of its own for each cell (and each node of the tree
+ * in pPosUniformBox()) from the seed of the simulation, such that the random
+ * numbers of a part of the domain can be generated without generating those
+ * before it.
+ */
+static inline unsigned long int pMix(unsigned long int hash, long int x);
+
+/**
+ * @brief	gsl_rng type of the splitmix64 generator
+ *
+ * Unlike the generators of GSL it has 64 bits of seed, so that the seeds
+ * obtained by pMix() from the cells of a large domain are not likely to
+ * coincide. Its state is the seed, incremented once for every number drawn,
+ * so seeding it costs nothing.
+ */
+static const gsl_rng_type *pSplitMix;
+
+/**
+ * @brief	Generates the particles of a box of cells which are in this subdomain
+ * @param	pos		Where to put the first particle (global frame, AoS)
+ * @param	nDims	Number of dimensions
+ * @param	n		Number of particles in the box
+ * @param	lower	Lower cell of the box (inclusive, nDims elements)
+ * @param	upper	Upper cell of the box (exclusive, nDims elements)
+ * @param	own		Lower and upper cell of this subdomain (2*nDims elements)
+ * @param	seed	Seed of the specie
+ * @param	rng		Random number generator to reseed for each box
+ * @param	nMax	Number of particles there is room for at pos
+ * @return	Number of particles generated
+ *
+ * The n particles are split between the two halves of the longest side of the
+ * box by a binomial deviate, recursively, and are placed uniformly within the
+ * single cells at the bottom. Each box seeds rng by its own corners, and
+ * boxes outside this subdomain are skipped altogether. Once there isn't room
+ * for the particles of a cell, the rest are only counted.
+ */
+static long int pPosUniformBox(	popFloat *pos, int nDims, long int n,
+								int *lower, int *upper, const int *own,
+								unsigned long int seed, gsl_rng *rng,
+								long int nMax);
 
 /******************************************************************************
  * DEFINING GLOBAL FUNCTIONS
@@ -25,12 +182,13 @@ Population *pAlloc(const dictionary *ini){
 
 	// Get MPI info
 	int size, rank;
-	MPI_Comm_size(MPI_COMM_WORLD,&size);
-	MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+	MPI_Comm_size(simComm(),&size);
+	MPI_Comm_rank(simComm(),&rank);
 
 	// Load data
 	int nSpecies = iniGetInt(ini,"population:nSpecies");
 	int nDims = iniGetInt(ini,"grid:nDims");
+	popLayout layout = pGetLayout(ini);
 
 	// Number of particles to allocate for (for all computing nodes)
 	long int *nAllocTotal = iniGetLongIntArr(ini,"population:nAlloc",nSpecies);
@@ -43,6 +201,11 @@ Population *pAlloc(const dictionary *ini){
 			msg(WARNING,"increased number of allocated particles from %i to %i"
 			 			"to get integer per computing node",
 						nAllocTotal[s], nAlloc[s]*size);
+
+		// Let the arrays of each specie and component start on a cache line
+		// (in SoA). Rounded also in AoS such that pRealloc(), which rounds the
+		// same way, leaves the species before the one grown where they are.
+		nAlloc[s] = 8*((nAlloc[s]+7)/8);
 	}
 
 	long int *iStart = malloc((nSpecies+1)*sizeof(long int));
@@ -56,16 +219,51 @@ Population *pAlloc(const dictionary *ini){
 	free(nAllocTotal);
 
 	Population *pop = malloc(sizeof(Population));
-	pop->pos = malloc((long int)nDims*iStart[nSpecies]*sizeof(double));
-	pop->vel = malloc((long int)nDims*iStart[nSpecies]*sizeof(double));
+
+	// aligned_alloc() requires the size to be a multiple of the alignment
+	long int nBytes = (long int)nDims*iStart[nSpecies]*sizeof(*pop->pos);
+	nBytes = 64*((nBytes+63)/64);
+
+	pop->pos = aligned_alloc(64,nBytes);
+	pop->vel = aligned_alloc(64,nBytes);
 	pop->nSpecies = nSpecies;
 	pop->nDims = nDims;
+	pop->layout = layout;
 	pop->iStart = iStart;
 	pop->iStop = iStop;
 	pop->kinEnergy = malloc((nSpecies+1)*sizeof(double));
 	pop->potEnergy = malloc((nSpecies+1)*sizeof(double));
+	pop->T = calloc(3*nSpecies,sizeof(double));
+	pop->S = calloc(3*nSpecies,sizeof(double));
 	pop->charge = iniGetDoubleArr(ini,"population:charge",nSpecies);
 	pop->mass = iniGetDoubleArr(ini,"population:mass",nSpecies);
+	pop->h5Type = H5T_IEEE_F64LE;
+	pop->h5NRowsChunk = 0;
+	pop->h5Deflate = 0;
+	pop->residency = ON_HOST;
+	pop->deviceIdx = NULL;
+	pop->deviceBuf = NULL;
+	pop->nDeviceAlloc = 0;
+	pop->cellStart = NULL;
+	pop->cellProd = NULL;
+	pop->sortedStop = malloc(nSpecies*sizeof(*pop->sortedStop));
+	pop->sortAge = 0;
+	pop->displaced = NULL;
+	pop->nDisplaced = 0;
+	pop->nDisplacedAlloc = 0;
+	pDiscardOrder(pop);
+
+	pop->growth = iniGetDouble(ini,"population:growth");
+	if(pop->growth!=0 && pop->growth<=1)
+		msg(ERROR,"population:growth must be 0 or larger than 1");
+
+	// Particles of equal weight unless they're to be merged and split
+	pop->weight = NULL;
+	if(iniGetInt(ini,"population:mergeInterval")>0){
+		pMergeSanity(ini);
+		pop->weight = malloc(iStart[nSpecies]*sizeof(*pop->weight));
+		for(long int i=0;i<iStart[nSpecies];i++) pop->weight[i] = 1;
+	}
 
 	return pop;
 
@@ -73,10 +271,25 @@ Population *pAlloc(const dictionary *ini){
 
 void pFree(Population *pop){
 
+#ifdef _OPENMP
+	long int n = pop->nDims*pop->iStart[pop->nSpecies];
+	if(pop->residency!=ON_HOST){
+		#pragma omp target exit data map(delete:pop->pos[0:n],pop->vel[0:n])
+	}
+#endif
+	pReserveDevice(pop,0);
+
 	free(pop->pos);
 	free(pop->vel);
+	free(pop->weight);
+	free(pop->cellStart);
+	free(pop->cellProd);
+	free(pop->sortedStop);
+	free(pop->displaced);
 	free(pop->kinEnergy);
 	free(pop->potEnergy);
+	free(pop->T);
+	free(pop->S);
 	free(pop->iStart);
 	free(pop->iStop);
 	free(pop->charge);
@@ -85,65 +298,203 @@ void pFree(Population *pop){
 
 }
 
-void pPosUniform(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo, const gsl_rng *rng){
+void pToDevice(Population *pop){
+
+	if(pop->residency!=ON_HOST) return;
+
+#ifdef _OPENMP
+	if(omp_get_num_devices()==0)
+		msg(STATUS,"No OpenMP target device, offloaded kernels run on the host");
+
+	long int n = pop->nDims*pop->iStart[pop->nSpecies];
+	#pragma omp target enter data map(to:pop->pos[0:n],pop->vel[0:n])
+#endif
+
+	pop->residency = ON_BOTH;
+}
+
+void pToHost(Population *pop){
+
+	if(pop->residency!=ON_DEVICE) return;
+
+#ifdef _OPENMP
+	// Only the particles in use
+	int nDims = pop->nDims;
+	for(int s=0;s<pop->nSpecies;s++){
+		long int pStart = pop->iStart[s]*nDims;
+		long int n = (pop->iStop[s]-pop->iStart[s])*nDims;
+		#pragma omp target update from(pop->pos[pStart:n],pop->vel[pStart:n])
+	}
+#endif
+
+	pop->residency = ON_BOTH;
+}
+
+void pToDeviceRange(Population *pop, long int iFrom, long int iTo){
+
+	if(pop->residency==ON_HOST || iTo<=iFrom) return;
+
+#ifdef _OPENMP
+	int nDims = pop->nDims;
+	long int pStart = iFrom*nDims;
+	long int n = (iTo-iFrom)*nDims;
+	#pragma omp target update to(pop->pos[pStart:n],pop->vel[pStart:n])
+#endif
+}
+
+void pReserveDevice(Population *pop, long int n){
+
+	if(n>0 && n<=pop->nDeviceAlloc) return;
+
+	long int nOld = pop->nDeviceAlloc;
+	long int nBuf = 2*pop->nDims*nOld;
+	long int *idx = pop->deviceIdx;
+	popFloat *buf = pop->deviceBuf;
+	if(idx){
+		#pragma omp target exit data map(delete:idx[0:nOld],buf[0:nBuf])
+	}
+	free(idx);
+	free(buf);
+
+	// Grown by a margin to avoid frequent reallocation
+	long int nNew = n>0 ? 2*n : 0;
+	nBuf = 2*pop->nDims*nNew;
+	idx = nNew ? malloc(nNew*sizeof(*idx)) : NULL;
+	buf = nNew ? malloc(nBuf*sizeof(*buf)) : NULL;
+	if(idx){
+		#pragma omp target enter data map(alloc:idx[0:nNew],buf[0:nBuf])
+	}
+
+	pop->deviceIdx = idx;
+	pop->deviceBuf = buf;
+	pop->nDeviceAlloc = nNew;
+}
+
+popLayout pGetLayout(const dictionary *ini){
+
+	char *str = iniGetStr(ini,"population:layout");
+
+	popLayout layout = AOS;
+	if(!strcmp(str,"SoA")) layout = SOA;
+	else if(strcmp(str,"AoS")) msg(ERROR,"population:layout must be AoS or SoA");
+
+	free(str);
+	return layout;
+}
+
+void pSetLayout(Population *pop, popLayout layout){
+
+	if(pop->layout==layout) return;
+
+	int nSpecies = pop->nSpecies;
+	int nDims = pop->nDims;
+	long int *iStart = pop->iStart;
+	long int *iStop = pop->iStop;
+
+	long int nAllocMax = 0;
+	for(int s=0;s<nSpecies;s++){
+		long int nAlloc = iStart[s+1]-iStart[s];
+		if(nAlloc>nAllocMax) nAllocMax = nAlloc;
+	}
+
+	popFloat *temp = malloc(nDims*nAllocMax*sizeof(*temp));
+	popFloat *arrays[2] = {pop->pos, pop->vel};
+
+	for(int a=0;a<2;a++){
+		for(int s=0;s<nSpecies;s++){
+
+			long int nAlloc = iStart[s+1]-iStart[s];
+			long int nParticles = iStop[s]-iStart[s];
+			popFloat *block = &arrays[a][iStart[s]*nDims];
+
+			for(long int i=0;i<nParticles;i++){
+				for(int d=0;d<nDims;d++){
+					if(layout==SOA) temp[d*nAlloc+i] = block[i*nDims+d];
+					else			temp[i*nDims+d] = block[d*nAlloc+i];
+				}
+			}
+
+			if(layout==SOA){
+				for(int d=0;d<nDims;d++)
+					memcpy(&block[d*nAlloc],&temp[d*nAlloc],nParticles*sizeof(*temp));
+			} else {
+				memcpy(block,temp,nParticles*nDims*sizeof(*temp));
+			}
+		}
+	}
+
+	free(temp);
+	pop->layout = layout;
+}
+
+void pPosUniform(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo, const gsl_rng *rngSync){
 
 	// Read from ini
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
 	long int *nParticles = iniGetLongIntArr(ini,"population:nParticles",nSpecies);
-	int *trueSize = iniGetIntArr(ini,"grid:trueSize",nDims);
-
-	// Read from mpiInfo
-	int *subdomain = mpiInfo->subdomain;
-	double *posToSubdomain = mpiInfo->posToSubdomain;
 
-	// Compute normalized length of global reference frame
+	// Cells of the global domain and of this subdomain
 	int *L = gGetGlobalSize(ini);
+	int *own = malloc(2*nDims*sizeof(*own));
+	for(int d=0;d<nDims;d++){
+		own[d] = mpiInfo->cuts[d][mpiInfo->subdomain[d]];
+		own[d+nDims] = mpiInfo->cuts[d][mpiInfo->subdomain[d]+1];
+	}
 
-	for(int s=0;s<nSpecies;s++){
+	int *lower = malloc(nDims*sizeof(*lower));
+	int *upper = malloc(nDims*sizeof(*upper));
 
-		// Start on first particle of this specie
-		long int iStart = pop->iStart[s];
-		long int iStop = iStart;
-		double *pos = &pop->pos[iStart*nDims];
+	// Same seed on all MPI nodes ensure the same particles are generated
+	unsigned long int seed = gsl_rng_get(rngSync);
+	gsl_rng *rng = gsl_rng_alloc(pSplitMix);
 
-		// Iterate through all particles to be generated. Same seed on all MPI
-		// nodes ensure same particles are generated everywhere.
-		for(long int i=0;i<nParticles[s];i++){
+	// Generated in AoS layout
+	popLayout layout = pop->layout;
+	pSetLayout(pop,AOS);
 
-			// Generate position for particle i
-			for(int d=0;d<nDims;d++) pos[d] = L[d]*gsl_rng_uniform_pos(rng);
+	for(int s=0;s<nSpecies;s++){
 
-			// Count the number of dimensions where the particle resides in
-			// the range of this node
-			int correctRange = 0;
-			for(int d=0;d<nDims;d++)
-				correctRange += (subdomain[d] == (int)(posToSubdomain[d]*pos[d]));
+		// If there isn't room the particles are only counted, and the very
+		// same particles are then generated again if the specie can be grown
+		long int n = 0;
+		pop->iStop[s] = pop->iStart[s];
+		for(int attempt=0;attempt<2;attempt++){
 
-			// Iterate only if particle resides in this sub-domain.
-			if(correctRange==nDims){
-				pos += nDims;
-				iStop++;
+			if(attempt==1) pReserve(pop,s,n);
+
+			long int iStart = pop->iStart[s];
+			popFloat *pos = &pop->pos[iStart*nDims];
+
+			for(int d=0;d<nDims;d++){
+				lower[d] = 0;
+				upper[d] = L[d];
 			}
 
-		}
+			long int nMax = pop->iStart[s+1]-iStart;
+			n = pPosUniformBox(pos, nDims, nParticles[s], lower, upper,
+							   own, pMix(seed,s), rng, nMax);
 
-		if(iStop>pop->iStart[s+1]){
-			int allocated = pop->iStart[s+1]-iStart;
-			int generated = iStop-iStart;
-			msg(ERROR,	"allocated only %i particles of specie %i per node but"
-			 			"%i generated", allocated, s, generated);
+			if(n<=nMax) break;
+			if(attempt==1 || pop->growth==0)
+				msg(ERROR,"allocated only %li particles of specie %i per node "
+						  "but %li generated", nMax, s, n);
 		}
 
-		pop->iStop[s]=iStop;
+		pop->iStop[s] = pop->iStart[s]+n;
 
 	}
 
 	pToLocalFrame(pop,mpiInfo);
 
+	pSetLayout(pop,layout);
+
+	gsl_rng_free(rng);
+	free(lower);
+	free(upper);
+	free(own);
 	free(L);
 	free(nParticles);
-	free(trueSize);
 
 }
 
@@ -163,15 +514,20 @@ void pPosLattice(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo)
 	int *L = gGetGlobalSize(ini);
 	long int V = gGetGlobalVolume(ini);
 
+	// Generated in AoS layout
+	popLayout layout = pop->layout;
+	pSetLayout(pop,AOS);
+
+	popFloat *pos = malloc(nDims*sizeof(*pos));
+
 	for(int s=0;s<nSpecies;s++){
 
 		// Particle-particle distance in lattice
 		double l = pow(V/(double)nParticles[s],1.0/nDims);
 
 		// Start on first particle of this specie
-		long int iStart = pop->iStart[s];
-		long int iStop = iStart;
-		double *pos = &pop->pos[iStart*nDims];
+		pop->iStop[s] = pop->iStart[s];
+		long int generated = 0;
 
 		// Iterate through all particles to be generated
 		// Generate particles on global frame on all nodes and discard the ones
@@ -190,27 +546,32 @@ void pPosLattice(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo)
 			for(int d=0;d<nDims;d++)
 				correctRange += (subdomain[d] == (int)(posToSubdomain[d]*pos[d]));
 
-			// Iterate only if particle resides in this sub-domain.
+			// Keep only if particle resides in this sub-domain (and fits)
 			if(correctRange==nDims){
-				pos += nDims;
-				iStop++;
+				pReserve(pop,s,1);
+				long int iStop = pop->iStop[s];
+				if(iStop<pop->iStart[s+1]){
+					for(int d=0;d<nDims;d++) pop->pos[iStop*nDims+d] = pos[d];
+					pop->iStop[s]++;
+				}
+				generated++;
 			}
 
 		}
 
-		if(iStop>pop->iStart[s+1]){
-			int allocated = pop->iStart[s+1]-iStart;
-			int generated = iStop-iStart;
-			msg(ERROR,	"allocated only %i particles of specie %i per node but"
-			 			"%i generated", allocated, s, generated);
-		}
-
-		pop->iStop[s]=iStop;
+		long int allocated = pop->iStart[s+1]-pop->iStart[s];
+		if(generated>allocated)
+			msg(ERROR,	"allocated only %li particles of specie %i per node but"
+			 			"%li generated", allocated, s, generated);
 
 	}
 
+	free(pos);
+
 	pToLocalFrame(pop,mpiInfo);
 
+	pSetLayout(pop,layout);
+
 	free(L);
 	free(nParticles);
 	free(trueSize);
@@ -227,8 +588,11 @@ void pPosPerturb(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo)
 	double *mode = iniGetDoubleArr(ini,"population:perturbMode",nElements);
 
 	int *L = gGetGlobalSize(ini);
-	double *pos = pop->pos;
+	popFloat *pos = pop->pos;
 
+	// Generated in AoS layout
+	popLayout layout = pop->layout;
+	pSetLayout(pop,AOS);
 
 	pToGlobalFrame(pop,mpiInfo);
 
@@ -247,6 +611,8 @@ void pPosPerturb(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo)
 
 	pToLocalFrame(pop,mpiInfo);
 
+	pSetLayout(pop,layout);
+
 	free(L);
 	free(amplitude);
 	free(mode);
@@ -259,8 +625,8 @@ void pPosDebug(const dictionary *ini, Population *pop){
 	long int *nParticles = iniGetLongIntArr(ini,"population:nParticles",nSpecies);
 
 	int mpiRank, mpiSize;
-	MPI_Comm_rank(MPI_COMM_WORLD,&mpiRank);
-	MPI_Comm_size(MPI_COMM_WORLD,&mpiSize);
+	MPI_Comm_rank(simComm(),&mpiRank);
+	MPI_Comm_size(simComm(),&mpiSize);
 
 	for(int s=0;s<nSpecies;s++){
 		nParticles[s] /= mpiSize;
@@ -273,10 +639,14 @@ void pPosDebug(const dictionary *ini, Population *pop){
 			1,1,0,1,1,0,1,1,0,3,3,0,0,0,0,4,4,0,1,1,0,1,1,0,1,1,0,
 			1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0);
 
+	// Generated in AoS layout
+	popLayout layout = pop->layout;
+	pSetLayout(pop,AOS);
+
 	for(int s=0;s<nSpecies;s++){
 		long int iStart = pop->iStart[s];
 		pop->iStop[s] = iStart + nParticles[s];
-		double *pos = &pop->pos[iStart*nDims];
+		popFloat *pos = &pop->pos[iStart*nDims];
 
 		for(long int i=0;i<nParticles[s];i++){
 			for(int d=0;d<nDims;d++){
@@ -285,6 +655,8 @@ void pPosDebug(const dictionary *ini, Population *pop){
 		}
 	}
 
+	pSetLayout(pop,layout);
+
 	free(nParticles);
 
 }
@@ -294,7 +666,7 @@ void pPosDebug(const dictionary *ini, Population *pop){
 void pPosAssertInLocalFrame(const Population *pop, const Grid *grid){
 
 	int *size = grid->size;
-	double *pos = pop->pos;
+	popFloat *pos = pop->pos;
 
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
@@ -307,10 +679,11 @@ void pPosAssertInLocalFrame(const Population *pop, const Grid *grid){
 
 			for(int d=0; d<nDims; d++){
 
-				if(pos[i*nDims+d]>size[d+1]-1 || pos[i*nDims+d]<0){
+				long int p = pIndex(pop,s,i,d);
+				if(pos[p]>size[d+1]-1 || pos[p]<0){
 					msg(ERROR,	"Particle i=%li (of specie %i) is out of bounds"
 					 			"in dimension %i: %f>%i",
-								i, s, d, pos[i*nDims+d], size[d+1]-1);
+								i, s, d, pos[p], size[d+1]-1);
 				}
 			}
 		}
@@ -319,7 +692,7 @@ void pPosAssertInLocalFrame(const Population *pop, const Grid *grid){
 
 void pVelAssertMax(const Population *pop, double max){
 
-	double *vel = pop->vel;
+	popFloat *vel = pop->vel;
 
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
@@ -332,39 +705,107 @@ void pVelAssertMax(const Population *pop, double max){
 
 			for(int d=0;d<nDims;d++){
 
-				if(vel[i*nDims+d]>max){
+				long int p = pIndex(pop,s,i,d);
+				if(fabs(vel[p])>max){
 					msg(ERROR,	"Particle i=%li (of specie %i) travels too"
 					 			"fast in dimension %i: %f>%f",
-								i, s, d, vel[i*nDims+d], max);
+								i, s, d, vel[p], max);
 				}
 			}
 		}
 	}
 }
 
-void pVelMaxwell(const dictionary *ini, Population *pop, const gsl_rng *rng){
+void pVelMaxwell(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo,
+				 const gsl_rng *rngSync){
 
 	int nSpecies = pop->nSpecies;
 	double *velDrift = iniGetDoubleArr(ini,"population:drift",nSpecies);
 	double *velThermal = iniGetDoubleArr(ini,"population:thermalVelocity",nSpecies);
 
 	int nDims = pop->nDims;
+	int *offset = mpiInfo->offset;
+	int *trueSize = mpiInfo->trueSize;
+
+	// Lower cell of this subdomain, and how many runs of particles each cell
+	// of it has had so far
+	long int nCells = 1;
+	int *own = malloc(nDims*sizeof(*own));
+	for(int d=0;d<nDims;d++){
+		own[d] = mpiInfo->cuts[d][mpiInfo->subdomain[d]];
+		nCells *= trueSize[d];
+	}
+	long int *nRuns = malloc(nCells*sizeof(*nRuns));
+	long int *cell = malloc(nDims*sizeof(*cell));
+
+	// Normal variates of a run of particles, generated in one batch
+	long int nGaussAlloc = 64*nDims;
+	double *gauss = malloc(nGaussAlloc*sizeof(*gauss));
+
+	// Same seed on all MPI nodes ensure the same velocities regardless of
+	// which node the particles are in
+	unsigned long int seed = gsl_rng_get(rngSync);
+	Philox ph;
+
+	// Generated in AoS layout
+	popLayout layout = pop->layout;
+	pSetLayout(pop,AOS);
 
 	for(int s=0;s<nSpecies;s++){
 
 		long int iStart = pop->iStart[s];
 		long int iStop = pop->iStop[s];
+		popFloat *pos = pop->pos;
+		popFloat *vel = pop->vel;
 
 		double velTh = velThermal[s];
 
-		for(long int i=iStart;i<iStop;i++){
+		alSetAll(nRuns,nCells,0);
 
-			double *vel = &pop->vel[i*nDims];
-			for(int d=0;d<nDims;d++){
-				vel[d] = velDrift[s] + gsl_ran_gaussian_ziggurat(rng,velTh);
+		long int i = iStart;
+		while(i<iStop){
+
+			// Cell of particle i, and the run of particles in it
+			long int j = 0;
+			for(int d=nDims-1;d>=0;d--){
+				cell[d] = (long int)floor(pos[i*nDims+d]+offset[d]);
+				long int c = cell[d]-own[d];
+				if(c<0) c = 0;
+				if(c>=trueSize[d]) c = trueSize[d]-1;
+				j = j*trueSize[d] + c;
 			}
+
+			long int iRunStop = i+1;
+			for(;iRunStop<iStop;iRunStop++){
+				int same = 1;
+				for(int d=0;d<nDims;d++)
+					same &= (long int)floor(pos[iRunStop*nDims+d]+offset[d])==cell[d];
+				if(!same) break;
+			}
+
+			long int nGauss = (iRunStop-i)*nDims;
+			if(nGauss>nGaussAlloc){
+				nGaussAlloc = 2*nGauss;
+				gauss = realloc(gauss,nGaussAlloc*sizeof(*gauss));
+			}
+
+			unsigned long int stream = pMix(seed,s);
+			for(int d=0;d<nDims;d++) stream = pMix(stream,cell[d]);
+			phSet(&ph,seed,pMix(stream,nRuns[j]++));
+			phGaussian(&ph,0,gauss,nGauss);
+
+			for(long int k=0;k<nGauss;k++)
+				vel[i*nDims+k] = velDrift[s] + velTh*gauss[k];
+
+			i = iRunStop;
 		}
 	}
+	pSetLayout(pop,layout);
+
+	free(gauss);
+	free(nRuns);
+	free(cell);
+	free(own);
 	free(velDrift);
 	free(velThermal);
 }
@@ -381,7 +822,7 @@ void pVelSet(Population *pop, const double *vel){
 
 		for(long int i=iStart;i<iStop;i++){
 			for(int d=0;d<nDims;d++){
-				pop->vel[i*nDims+d] = vel[d];
+				pop->vel[pIndex(pop,s,i,d)] = vel[d];
 			}
 		}
 	}
@@ -399,7 +840,7 @@ void pVelZero(Population *pop){
 
 		for(long int i=iStart;i<iStop;i++){
 			for(int d=0;d<nDims;d++){
-				pop->vel[i*nDims+d] = 0;
+				pop->vel[pIndex(pop,s,i,d)] = 0;
 			}
 		}
 	}
@@ -411,16 +852,20 @@ void pNew(Population *pop, int s, const double *pos, const double *vel){
 	long int *iStart = pop->iStart;
 	long int *iStop = pop->iStop;	// New particle added here
 
+	if(iStop[s]>=iStart[s+1]) pReserve(pop,s,1);
+
 	if(iStop[s]>=iStart[s+1])
 		msg(WARNING,"Not enough allocated memory to add new particle to specie"
 		 			"%i. New particle ignored.",s);
 	else {
 
-		long int p = iStop[s]*nDims;
+		long int i = iStop[s];
 		for(int d=0;d<nDims;d++){
-			pop->pos[p+d] = pos[d];
-			pop->vel[p+d] = vel[d];
+			long int p = pIndex(pop,s,i,d);
+			pop->pos[p] = pos[d];
+			pop->vel[p] = vel[d];
 		}
+		if(pop->weight) pop->weight[i] = 1;
 		iStop[s]++;
 
 	}
@@ -430,222 +875,583 @@ void pNew(Population *pop, int s, const double *pos, const double *vel){
 void pCut(Population *pop, int s, long int p, double *pos, double *vel){
 
 	int nDims = pop->nDims;
-	long int pLast = (pop->iStop[s]-1)*nDims;
+	long int i = p/nDims;
+	long int iLast = pop->iStop[s]-1;
 
 	for(int d=0;d<nDims;d++){
-		pos[d] = pop->pos[p+d];
-		vel[d] = pop->vel[p+d];
-		pop->pos[p+d] = pop->pos[pLast+d];
-		pop->vel[p+d] = pop->vel[pLast+d];
+		long int pd = pIndex(pop,s,i,d);
+		long int pLast = pIndex(pop,s,iLast,d);
+		pos[d] = pop->pos[pd];
+		vel[d] = pop->vel[pd];
+		pop->pos[pd] = pop->pos[pLast];
+		pop->vel[pd] = pop->vel[pLast];
 	}
+	if(pop->weight) pop->weight[i] = pop->weight[iLast];
 
 	pop->iStop[s]--;
 
 }
 
-void pOpenH5(	const dictionary *ini, Population *pop, const Units *units,
-	   			const char *fName){
+void pReserve(Population *pop, int s, long int n){
 
-	/*
-	 * CREATE FILE
-	 */
-	hid_t file = openH5File(ini,fName,"pop");
+	long int nNeeded = pop->iStop[s]-pop->iStart[s]+n;
+	if(pop->growth==0 || nNeeded<=pop->iStart[s+1]-pop->iStart[s]) return;
 
-	/*
-	 * CREATE GROUPS
-	 */
-	hid_t group;
-	group = H5Gcreate(file,"/pos",H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT);
-	H5Gclose(group);
-	group = H5Gcreate(file,"/vel",H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT);
-	H5Gclose(group);
+	int nSpecies = pop->nSpecies;
+	long int *nAlloc = malloc(nSpecies*sizeof(*nAlloc));
+	for(int t=0;t<nSpecies;t++) nAlloc[t] = pop->iStart[t+1]-pop->iStart[t];
+	nAlloc[s] = ceil(pop->growth*nNeeded);
 
-	char name[32];	// int is max 5 digits + "/pos/specie " + '\0'
+	pRealloc(pop,nAlloc);
+	free(nAlloc);
+}
 
-	int nSpecies = pop->nSpecies;
-	for(int s=0;s<nSpecies;s++){
-		sprintf(name,"/pos/specie %i",s);
-		group = H5Gcreate(file,name,H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT);
-		H5Gclose(group);
+void pCompact(Population *pop){
 
-		sprintf(name,"/vel/specie %i",s);
-		group = H5Gcreate(file,name,H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT);
-		H5Gclose(group);
-	}
+	if(pop->growth==0) return;
 
-	pop->h5 = file;
+	// Fewer particles than this are not worth reallocating for
+	const long int nMin = 1024;
 
-	/*
-	 * CREATE ATTRIBUTES
-	 */
+	int nSpecies = pop->nSpecies;
+	double growth = pop->growth;
+	long int *nAlloc = malloc(nSpecies*sizeof(*nAlloc));
 
-	setH5Attr(file, "Position denormalization factor", &units->length, 1);
-	setH5Attr(file, "Velocity denormalization factor", &units->velocity, 1);
+	// Only species using less than 1/growth of what they would be given
+	int shrink = 0;
+	for(int s=0;s<nSpecies;s++){
+		long int n = pop->iStop[s]-pop->iStart[s];
+		if(n<nMin) n = nMin;
+		nAlloc[s] = pop->iStart[s+1]-pop->iStart[s];
+		if(nAlloc[s]>growth*growth*n){
+			nAlloc[s] = ceil(growth*n);
+			shrink = 1;
+		}
+	}
 
+	if(shrink) pRealloc(pop,nAlloc);
+	free(nAlloc);
 }
 
-void pWriteH5(Population *pop, const MpiInfo *mpiInfo, double posN, double velN){
+void pSort(Population *pop, const Grid *grid){
 
-	int mpiRank = mpiInfo->mpiRank;
-	int mpiSize = mpiInfo->mpiSize;
 	int nSpecies = pop->nSpecies;
+	int nDims = pop->nDims;
 
-	pToGlobalFrame(pop,mpiInfo);
+	long int *cellProd = malloc((nDims+1)*sizeof(*cellProd));
+	ailCumProd(&grid->size[1],cellProd,nDims);
+	long int nCells = cellProd[nDims];
 
-	/*
- 	 * HDF5 HYPERSLAB DEFINITION
-	 */
-	const int arrSize = 2;
-	hsize_t fileDims[arrSize];		// Size of data in file
-	hsize_t memDims[arrSize];		// Size of data in memory of this MPI node
-	hsize_t offset[arrSize];		// At which offset in file to store data of this MPI node
-	fileDims[1] = pop->nDims;
-	memDims[1] = pop->nDims;
-	offset[1] = 0;
+	// bucket[c] is where particles in cell c start, next[c] the first one
+	// not yet known to be in place.
+	// The offsets are kept for puExtractEmigrants3DShell()
+	if(!pop->cellProd || pop->cellProd[nDims]!=nCells){
+		free(pop->cellStart);
+		pop->cellStart = malloc(nSpecies*(nCells+1)*sizeof(*pop->cellStart));
+	}
+	free(pop->cellProd);
+	pop->cellProd = cellProd;
 
-	long int *offsetAllSubdomains = malloc((mpiSize+1)*sizeof(long int));
-	offsetAllSubdomains[0] = 0;
+	long int *next = malloc(nCells*sizeof(*next));
 
 	for(int s=0;s<nSpecies;s++){
 
-		long int nParticles = pop->iStop[s] - pop->iStart[s];
-		MPI_Allgather(	&nParticles,
-						1,
-						MPI_LONG,
-						&offsetAllSubdomains[1],
-						1,
-						MPI_LONG,
-						MPI_COMM_WORLD);
+		long int iStart = pop->iStart[s];
+		long int iStop = pop->iStop[s];
+		long int *bucket = &pop->cellStart[s*(nCells+1)];
 
-		// Take cumulative sum to actually get offset
-		// Last element equals total number of particles on all nodes
-		for(int r=1;r<=mpiSize;r++){
-			offsetAllSubdomains[r] += offsetAllSubdomains[r-1];
+		// Count particles per cell
+		alSetAll(bucket,nCells+1,0);
+		for(long int i=iStart;i<iStop;i++){
+			bucket[pCellIndex(pop,s,i,cellProd)+1]++;
 		}
 
-		// Only proceed if there actually are any particles to save, at least
-		// on one MPI node. HDF5 may crash otherwise.
-		if(offsetAllSubdomains[mpiSize]){
-
-			fileDims[0] = offsetAllSubdomains[mpiSize];
-			memDims[0] = nParticles;
-			offset[0] = offsetAllSubdomains[mpiRank];
-
-			hid_t memSpace = H5Screate_simple(arrSize,memDims,NULL);
-			hid_t fileSpace = H5Screate_simple(arrSize,fileDims,NULL);
-
-			H5Sselect_hyperslab(fileSpace,
-								H5S_SELECT_SET,
-								offset,
-								NULL,
-								memDims,
-								NULL);
-
-			/*
-			 * STORE DATA COLLECTIVELY
-			 */
-			hid_t pList = H5Pcreate(H5P_DATASET_XFER);
-		    H5Pset_dxpl_mpio(pList, H5FD_MPIO_COLLECTIVE);
-
-			char name[64];
-			hid_t dataset;
-
-			sprintf(name,"/pos/specie %i/n=%.1f",s,posN);
-			dataset = H5Dcreate(pop->h5,
-								name,
-								H5T_IEEE_F64LE,
-								fileSpace,
-								H5P_DEFAULT,
-								H5P_DEFAULT,
-								H5P_DEFAULT);
-
-			H5Dwrite(	dataset,
-						H5T_NATIVE_DOUBLE,
-						memSpace,
-						fileSpace,
-						pList,
-						&pop->pos[pop->iStart[s]*pop->nDims]);
-
-			H5Dclose(dataset);
-
-			sprintf(name,"/vel/specie %i/n=%.1f",s,velN);
-			dataset = H5Dcreate(pop->h5,
-								name,
-								H5T_IEEE_F64LE,
-								fileSpace,
-								H5P_DEFAULT,
-								H5P_DEFAULT,
-								H5P_DEFAULT);
-
-			H5Dwrite(	dataset,
-				 		H5T_NATIVE_DOUBLE,
-						memSpace,
-						fileSpace,
-						pList,
-						&pop->vel[pop->iStart[s]*pop->nDims]);
-
-			H5Dclose(dataset);
-
-			H5Pclose(pList);
-			H5Sclose(fileSpace);
-			H5Sclose(memSpace);
-
-		} else {
-			msg(WARNING,"No particles of specie %i to store in .h5-file",s);
+		bucket[0] = iStart;
+		for(long int c=0;c<nCells;c++) bucket[c+1] += bucket[c];
+		for(long int c=0;c<nCells;c++) next[c] = bucket[c];
+
+		// Swap each particle directly into the range of its cell
+		for(long int c=0;c<nCells;c++){
+			while(next[c]<bucket[c+1]){
+				long int i = next[c];
+				long int cc = pCellIndex(pop,s,i,cellProd);
+				if(cc!=c) pSwap(pop,s,i,next[cc]);
+				next[cc]++;
+			}
 		}
+
+		pop->sortedStop[s] = iStop;
 	}
- 	free(offsetAllSubdomains);
 
-	pToLocalFrame(pop,mpiInfo);
-}
+	pop->sortAge = 0;
+	pop->nDisplaced = 0;
 
-void pCloseH5(Population *pop){
-	H5Fclose(pop->h5);
+	free(next);
 }
 
+void pMergeSplit(Population *pop, const Grid *grid, int ppcMin, int ppcMax){
 
-void pCreateEnergyDatasets(hid_t xy, Population *pop){
+	if(!pop->weight) msg(ERROR,"pMergeSplit() requires population:mergeInterval>0");
 
-	char name[64];
 	int nSpecies = pop->nSpecies;
+	int nDims = pop->nDims;
 
-	sprintf(name,"/energy/potential/total");
-	xyCreateDataset(xy,name);
+	// The particles of each cell are contiguous after sorting
+	pSort(pop, grid);
 
-	sprintf(name,"/energy/kinetic/total");
-	xyCreateDataset(xy,name);
+	long int *cellProd = malloc((nDims+1)*sizeof(*cellProd));
+	ailCumProd(&grid->size[1],cellProd,nDims);
+
+	long int nKeyAlloc = 0;
+	PKey *key = NULL;
 
 	for(int s=0;s<nSpecies;s++){
-		sprintf(name,"/energy/potential/specie %i",s);
-		xyCreateDataset(xy,name);
 
-		sprintf(name,"/energy/kinetic/specie %i",s);
-		xyCreateDataset(xy,name);
-	}
-}
+		// Room for all particles split off is reserved before indexing them,
+		// since growing the storage may move them
+		long int nSplits = 0;
+		for(long int a=pop->iStart[s], b;a<pop->iStop[s];a=b){
+			long int c = pCellIndex(pop,s,a,cellProd);
+			for(b=a+1;b<pop->iStop[s] && pCellIndex(pop,s,b,cellProd)==c;b++);
+			long int n = b-a;
+			if(n<ppcMin) nSplits += ppcMin-n<n ? ppcMin-n : n;
+		}
+		pReserve(pop,s,nSplits);
 
-void pWriteEnergy(hid_t xy, Population *pop, double x){
+		// Particles split off are appended after iStop
+		long int iStop = pop->iStop[s];
+		int full = 0;
 
-	char name[64];
-	int nSpecies = pop->nSpecies;
+		long int a = pop->iStart[s];
+		while(a<iStop){
 
-	sprintf(name,"/energy/potential/total");
-	xyWrite(xy,name,x,pop->potEnergy[nSpecies],MPI_SUM);
+			long int c = pCellIndex(pop,s,a,cellProd);
+			long int b = a+1;
+			while(b<iStop && pCellIndex(pop,s,b,cellProd)==c) b++;
+			long int n = b-a;
 
-	sprintf(name,"/energy/kinetic/total");
-	xyWrite(xy,name,x,pop->kinEnergy[nSpecies],MPI_SUM);
+			if(n>nKeyAlloc){
+				nKeyAlloc = 2*n;
+				key = realloc(key,nKeyAlloc*sizeof(*key));
+			}
+
+			if(n>ppcMax){
+				for(long int k=0;k<n;k++){
+					double v2 = 0;
+					for(int d=0;d<nDims;d++){
+						double v = pop->vel[pIndex(pop,s,a+k,d)];
+						v2 += v*v;
+					}
+					key[k].key = v2;
+					key[k].i = a+k;
+				}
+				qsort(key,n,sizeof(*key),pCompareKey);
+				pMergeCell(pop,s,key,n,(n-ppcMax+1)/2);
+			}
+
+			if(n<ppcMin && !full){
+				for(long int k=0;k<n;k++){
+					key[k].key = -pop->weight[a+k];
+					key[k].i = a+k;
+				}
+				qsort(key,n,sizeof(*key),pCompareKey);
+				full = pSplitCell(pop,s,key,n,ppcMin-n);
+			}
+
+			a = b;
+		}
+
+		if(full)
+			msg(WARNING|ALL,"Not enough allocated memory to split particles of "
+							"specie %i, increase population:nAlloc",s);
+
+		// Remove merged-away particles
+		long int j = pop->iStart[s];
+		for(long int i=pop->iStart[s];i<pop->iStop[s];i++){
+			if(pop->weight[i]==0) continue;
+			if(i!=j) pSwap(pop,s,i,j);
+			j++;
+		}
+		pop->iStop[s] = j;
+	}
+
+	pDiscardOrder(pop);
+
+	free(key);
+	free(cellProd);
+}
+
+void pOpenH5(	const dictionary *ini, Population *pop, const Units *units,
+	   			const char *fName){
+
+	/*
+	 * CREATE FILE
+	 */
+	hid_t file = openH5File(ini,fName,"pop");
+
+	/*
+	 * CREATE GROUPS
+	 */
+	// Existing groups are kept when continuing a file, e.g. after a restart
+	char name[32];	// int is max 5 digits + "/pos/specie /" + '\0'
+
+	int nSpecies = pop->nSpecies;
+	for(int s=0;s<nSpecies;s++){
+		sprintf(name,"/pos/specie %i/",s);
+		createH5Group(file,name);
+
+		sprintf(name,"/vel/specie %i/",s);
+		createH5Group(file,name);
+	}
+
+	pop->h5 = file;
+
+	/*
+	 * DATASET FORMAT
+	 */
+	char *precision = iniGetStr(ini,"files:popPrecision");
+	if(!strcmp(precision,"DOUBLE"))		pop->h5Type = H5T_IEEE_F64LE;
+	else if(!strcmp(precision,"SINGLE"))	pop->h5Type = H5T_IEEE_F32LE;
+	else msg(ERROR,"files:popPrecision must be DOUBLE or SINGLE");
+	free(precision);
+
+	pop->h5NRowsChunk = iniGetLongInt(ini,"files:popChunk");
+	pop->h5Deflate = iniGetInt(ini,"files:popDeflate");
+	if(pop->h5NRowsChunk<0) msg(ERROR,"files:popChunk must be non-negative");
+	if(pop->h5Deflate<0 || pop->h5Deflate>9)
+		msg(ERROR,"files:popDeflate must be in the range 0-9");
+	if(pop->h5Deflate && !pop->h5NRowsChunk)
+		msg(ERROR,"files:popDeflate requires files:popChunk to be non-zero");
+
+	/*
+	 * CREATE ATTRIBUTES
+	 */
+
+	setH5Attr(file, "Position denormalization factor", &units->length, 1);
+	setH5Attr(file, "Velocity denormalization factor", &units->velocity, 1);
+
+}
+
+/**
+ * @brief Writes pos or vel of specie s to a dataset of rows in .pop.h5-file
+ * @param	pop		Population
+ * @param	s		Specie
+ * @param	name	Name of dataset
+ * @param	data	pop->pos or pop->vel
+ * @param	shift	Added to component d of each particle (or NULL)
+ * @param	offset	Row of first particle of each MPI node (mpiSize+1 elements)
+ * @param	mpiInfo	MpiInfo
+ *
+ * The particles are copied in blocks of PWRITE_BLOCK to a buffer in AoS layout
+ * and the datatype of the file, and written from there. This way, neither the
+ * layout nor the reference frame of pop need to be changed in place. All nodes
+ * take part in as many (collective) writes as the node with the most blocks.
+ */
+#define PWRITE_BLOCK 65536
+static void pWriteH5Rows(	const Population *pop, int s, const char *name,
+							const popFloat *data, const int *shift,
+							const long int *offset, const MpiInfo *mpiInfo){
+
+	int mpiRank = mpiInfo->mpiRank;
+	int mpiSize = mpiInfo->mpiSize;
+	int nDims = pop->nDims;
+	long int iStart = pop->iStart[s];
+	long int nParticles = pop->iStop[s] - iStart;
+
+	long int nBlocks = 0;
+	for(int r=0;r<mpiSize;r++){
+		long int n = (offset[r+1]-offset[r]+PWRITE_BLOCK-1)/PWRITE_BLOCK;
+		if(n>nBlocks) nBlocks = n;
+	}
+
+	int single = H5Tget_size(pop->h5Type)==sizeof(float);
+	void *buffer = malloc(PWRITE_BLOCK*nDims*(single?sizeof(float):sizeof(double)));
+	float *bufferF = buffer;
+	double *bufferD = buffer;
+
+	hsize_t fileDims[] = {offset[mpiSize], nDims};
+	hid_t fileSpace = H5Screate_simple(2,fileDims,NULL);
+	hid_t createList = createH5RowsPList(pop->h5NRowsChunk, pop->h5Deflate,
+										 offset[mpiSize], nDims);
+	hid_t dataset = H5Dcreate(	pop->h5, name, pop->h5Type, fileSpace,
+								H5P_DEFAULT, createList, H5P_DEFAULT);
+
+	hid_t pList = H5Pcreate(H5P_DATASET_XFER);
+	H5Pset_dxpl_mpio(pList, H5FD_MPIO_COLLECTIVE);
+
+	for(long int b=0;b<nBlocks;b++){
+
+		long int first = b*PWRITE_BLOCK;
+		long int n = nParticles-first;
+		if(n>PWRITE_BLOCK) n = PWRITE_BLOCK;
+		if(n<0) n = 0;
+
+		for(long int i=0;i<n;i++){
+			for(int d=0;d<nDims;d++){
+				double value = data[pIndex(pop,s,iStart+first+i,d)];
+				if(shift) value += shift[d];
+				if(single) bufferF[i*nDims+d] = value;
+				else bufferD[i*nDims+d] = value;
+			}
+		}
+
+		hsize_t memDims[] = {n, nDims};
+		hsize_t start[] = {offset[mpiRank]+first, 0};
+		hid_t memSpace = H5Screate_simple(2,memDims,NULL);
+		if(n){
+			H5Sselect_hyperslab(fileSpace,H5S_SELECT_SET,start,NULL,memDims,NULL);
+		} else {
+			H5Sselect_none(fileSpace);
+			H5Sselect_none(memSpace);
+		}
+
+		H5Dwrite(	dataset,
+					single ? H5T_NATIVE_FLOAT : H5T_NATIVE_DOUBLE,
+					memSpace,
+					fileSpace,
+					pList,
+					buffer);
+
+		H5Sclose(memSpace);
+	}
+
+	H5Pclose(pList);
+	if(createList != H5P_DEFAULT) H5Pclose(createList);
+	H5Dclose(dataset);
+	H5Sclose(fileSpace);
+	free(buffer);
+}
+
+void pWriteH5(const Population *pop, const MpiInfo *mpiInfo, double posN, double velN){
+
+	int mpiSize = mpiInfo->mpiSize;
+	int nSpecies = pop->nSpecies;
+
+	long int *offsetAllSubdomains = malloc((mpiSize+1)*sizeof(long int));
+	offsetAllSubdomains[0] = 0;
+
+	for(int s=0;s<nSpecies;s++){
+
+		long int nParticles = pop->iStop[s] - pop->iStart[s];
+		MPI_Allgather(	&nParticles,
+						1,
+						MPI_LONG,
+						&offsetAllSubdomains[1],
+						1,
+						MPI_LONG,
+						mpiInfo->comm);
+
+		// Take cumulative sum to actually get offset
+		// Last element equals total number of particles on all nodes
+		for(int r=1;r<=mpiSize;r++){
+			offsetAllSubdomains[r] += offsetAllSubdomains[r-1];
+		}
+
+		// Only proceed if there actually are any particles to save, at least
+		// on one MPI node. HDF5 may crash otherwise.
+		if(offsetAllSubdomains[mpiSize]){
+
+			char name[64];
+
+			sprintf(name,"/pos/specie %i/n=%.1f",s,posN);
+			pWriteH5Rows(pop, s, name, pop->pos, mpiInfo->offset,
+						 offsetAllSubdomains, mpiInfo);
+
+			sprintf(name,"/vel/specie %i/n=%.1f",s,velN);
+			pWriteH5Rows(pop, s, name, pop->vel, NULL,
+						 offsetAllSubdomains, mpiInfo);
+
+		} else {
+			msg(WARNING,"No particles of specie %i to store in .h5-file",s);
+		}
+	}
+ 	free(offsetAllSubdomains);
+}
+
+void pWriteH5Staged(Stage *stage, const Population *pop, const MpiInfo *mpiInfo,
+					double posN, double velN){
+
+	int *offset = mpiInfo->offset;
+	int nSpecies = pop->nSpecies;
+	int nDims = pop->nDims;
+
+	for(int s=0;s<nSpecies;s++){
+
+		long int iStart = pop->iStart[s];
+		long int iStop = pop->iStop[s];
+		long int nParticles = iStop-iStart;
+
+		// Copied in AoS layout, global reference frame and datatype of file
+		int single = H5Tget_size(pop->h5Type)==sizeof(float);
+		size_t size = single ? sizeof(float) : sizeof(double);
+		hid_t memType = single ? H5T_NATIVE_FLOAT : H5T_NATIVE_DOUBLE;
+		void *pos = malloc(nParticles*nDims*size);
+		void *vel = malloc(nParticles*nDims*size);
+		for(long int i=iStart;i<iStop;i++){
+			for(int d=0;d<nDims;d++){
+				long int j = (i-iStart)*nDims+d;
+				double p = (double)pop->pos[pIndex(pop,s,i,d)] + offset[d];
+				double v = pop->vel[pIndex(pop,s,i,d)];
+				if(single){
+					((float*)pos)[j] = p;
+					((float*)vel)[j] = v;
+				} else {
+					((double*)pos)[j] = p;
+					((double*)vel)[j] = v;
+				}
+			}
+		}
+
+		char name[64];
+		sprintf(name,"/pos/specie %i/n=%.1f",s,posN);
+		stAddRows(stage, pop->h5, name, memType, pop->h5Type,
+				  pop->h5NRowsChunk, pop->h5Deflate, pos, nParticles, nDims);
+		sprintf(name,"/vel/specie %i/n=%.1f",s,velN);
+		stAddRows(stage, pop->h5, name, memType, pop->h5Type,
+				  pop->h5NRowsChunk, pop->h5Deflate, vel, nParticles, nDims);
+	}
+}
+
+void pWriteCheckpoint(hid_t ck, const Population *pop){
+
+	int nSpecies = pop->nSpecies;
+	int nDims = pop->nDims;
+
+	long int *nParticles = malloc(nSpecies*sizeof(*nParticles));
+	for(int s=0;s<nSpecies;s++) nParticles[s] = pop->iStop[s]-pop->iStart[s];
+	ckWrite(ck, "nParticles", H5T_NATIVE_LONG, nParticles, nSpecies);
+
+	char name[32];
+	for(int s=0;s<nSpecies;s++){
+
+		// Copied in AoS layout but in the original order
+		long int iStart = pop->iStart[s];
+		popFloat *pos = malloc(nParticles[s]*nDims*sizeof(*pos));
+		popFloat *vel = malloc(nParticles[s]*nDims*sizeof(*vel));
+		for(long int i=0;i<nParticles[s];i++){
+			for(int d=0;d<nDims;d++){
+				pos[i*nDims+d] = pop->pos[pIndex(pop,s,iStart+i,d)];
+				vel[i*nDims+d] = pop->vel[pIndex(pop,s,iStart+i,d)];
+			}
+		}
+
+		sprintf(name,"pos %i",s);
+		ckWrite(ck, name, POP_H5_FLOAT, pos, nParticles[s]*nDims);
+		sprintf(name,"vel %i",s);
+		ckWrite(ck, name, POP_H5_FLOAT, vel, nParticles[s]*nDims);
+		if(pop->weight){
+			sprintf(name,"weight %i",s);
+			ckWrite(ck, name, POP_H5_FLOAT, &pop->weight[iStart], nParticles[s]);
+		}
+
+		free(pos);
+		free(vel);
+	}
+
+	free(nParticles);
+}
+
+void pReadCheckpoint(hid_t ck, Population *pop){
+
+	int nSpecies = pop->nSpecies;
+	int nDims = pop->nDims;
+
+	long int *nParticles = malloc(nSpecies*sizeof(*nParticles));
+	ckRead(ck, "nParticles", H5T_NATIVE_LONG, nParticles, nSpecies);
+
+	char name[32];
+	for(int s=0;s<nSpecies;s++){
+
+		pop->iStop[s] = pop->iStart[s];
+		pReserve(pop,s,nParticles[s]);
+
+		long int iStart = pop->iStart[s];
+		if(nParticles[s] > pop->iStart[s+1]-iStart)
+			msg(ERROR|ALL, "%li particles of specie %i in checkpoint, but only "
+				"%li allocated for", nParticles[s], s, pop->iStart[s+1]-iStart);
+
+		popFloat *pos = malloc(nParticles[s]*nDims*sizeof(*pos));
+		popFloat *vel = malloc(nParticles[s]*nDims*sizeof(*vel));
+
+		sprintf(name,"pos %i",s);
+		ckRead(ck, name, POP_H5_FLOAT, pos, nParticles[s]*nDims);
+		sprintf(name,"vel %i",s);
+		ckRead(ck, name, POP_H5_FLOAT, vel, nParticles[s]*nDims);
+		if(pop->weight){
+			sprintf(name,"weight %i",s);
+			ckRead(ck, name, POP_H5_FLOAT, &pop->weight[iStart], nParticles[s]);
+		}
+
+		pop->iStop[s] = iStart+nParticles[s];
+		for(long int i=0;i<nParticles[s];i++){
+			for(int d=0;d<nDims;d++){
+				pop->pos[pIndex(pop,s,iStart+i,d)] = pos[i*nDims+d];
+				pop->vel[pIndex(pop,s,iStart+i,d)] = vel[i*nDims+d];
+			}
+		}
+
+		free(pos);
+		free(vel);
+	}
+
+	free(nParticles);
+}
+
+void pCloseH5(Population *pop){
+	H5Fclose(pop->h5);
+}
+
+
+void pCreateEnergyDatasets(hid_t xy, Population *pop){
+
+	char name[64];
+	int nSpecies = pop->nSpecies;
+
+	sprintf(name,"/energy/potential/total");
+	xyCreateDataset(xy,name);
+
+	sprintf(name,"/energy/kinetic/total");
+	xyCreateDataset(xy,name);
+
+	for(int s=0;s<nSpecies;s++){
+		sprintf(name,"/energy/potential/specie %i",s);
+		xyCreateDataset(xy,name);
+
+		sprintf(name,"/energy/kinetic/specie %i",s);
+		xyCreateDataset(xy,name);
+	}
+}
+
+void pWriteEnergy(XyBuffer *buf, Population *pop, double x){
+
+	char name[64];
+	int nSpecies = pop->nSpecies;
+
+	sprintf(name,"/energy/potential/total");
+	xyBufWrite(buf,name,x,pop->potEnergy[nSpecies],MPI_OP_NULL);
+
+	sprintf(name,"/energy/kinetic/total");
+	xyBufWrite(buf,name,x,pop->kinEnergy[nSpecies],MPI_OP_NULL);
 
 	for(int s=0; s<nSpecies; s++){
 
 		sprintf(name,"/energy/potential/specie %i",s);
-		xyWrite(xy,name,x,pop->potEnergy[s],MPI_SUM);
+		xyBufWrite(buf,name,x,pop->potEnergy[s],MPI_OP_NULL);
 
 		sprintf(name,"/energy/kinetic/specie %i",s);
-		xyWrite(xy,name,x,pop->kinEnergy[s],MPI_SUM);
+		xyBufWrite(buf,name,x,pop->kinEnergy[s],MPI_OP_NULL);
 	}
 
 }
 
+void pAddEnergy(Population *pop, Reduction *red){
+
+	int nSpecies = pop->nSpecies;
+
+	rAdd(red,pop->kinEnergy,nSpecies+1);
+	rAdd(red,pop->potEnergy,nSpecies+1);
+}
+
 void pSumKinEnergy(Population *pop){
 
 	int nSpecies = pop->nSpecies;
@@ -672,6 +1478,50 @@ void pSumPotEnergy(Population *pop){
  * DEFINING LOCAL FUNCTIONS
  *****************************************************************************/
 
+static inline long int pIndex(const Population *pop, int s, long int i, int d){
+
+	int nDims = pop->nDims;
+	if(pop->layout==AOS) return i*nDims+d;
+
+	long int iStart = pop->iStart[s];
+	return iStart*nDims + d*(pop->iStart[s+1]-iStart) + i-iStart;
+}
+
+static inline long int pCellIndex(	const Population *pop, int s, long int i,
+									const long int *cellProd){
+
+	long int c = 0;
+	for(int d=0;d<pop->nDims;d++)
+		c += (long int)pop->pos[pIndex(pop,s,i,d)]*cellProd[d];
+	return c;
+}
+
+static inline void pSwap(Population *pop, int s, long int i, long int j){
+
+	int nDims = pop->nDims;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
+
+	for(int d=0;d<nDims;d++){
+		long int pi = pIndex(pop,s,i,d);
+		long int pj = pIndex(pop,s,j,d);
+
+		double temp = pos[pi];
+		pos[pi] = pos[pj];
+		pos[pj] = temp;
+
+		temp = vel[pi];
+		vel[pi] = vel[pj];
+		vel[pj] = temp;
+	}
+
+	if(pop->weight){
+		popFloat temp = pop->weight[i];
+		pop->weight[i] = pop->weight[j];
+		pop->weight[j] = temp;
+	}
+}
+
 void pToLocalFrame(Population *pop, const MpiInfo *mpiInfo){
 
 	int *offset = mpiInfo->offset;
@@ -684,9 +1534,7 @@ void pToLocalFrame(Population *pop, const MpiInfo *mpiInfo){
 		long int iStop = pop->iStop[s];
 
 		for(long int i=iStart;i<iStop;i++){
-
-			double *pos = &pop->pos[i*nDims];
-			for(int d=0;d<nDims;d++) pos[d] -= offset[d];
+			for(int d=0;d<nDims;d++) pop->pos[pIndex(pop,s,i,d)] -= offset[d];
 		}
 	}
 }
@@ -703,9 +1551,625 @@ void pToGlobalFrame(Population *pop, const MpiInfo *mpiInfo){
 		long int iStop = pop->iStop[s];
 
 		for(long int i=iStart;i<iStop;i++){
+			for(int d=0;d<nDims;d++) pop->pos[pIndex(pop,s,i,d)] += offset[d];
+		}
+	}
+}
+
+PhaseSpace *pAllocPhaseSpace(	const dictionary *ini, const Population *pop,
+								const Units *units, const MpiInfo *mpiInfo){
+
+	int nSpecies = pop->nSpecies;
+	int nDims = pop->nDims;
+
+	PhaseSpace *ps = malloc(sizeof(*ps));
+	ps->nSpecies = nSpecies;
+	ps->nDims = nDims;
+	ps->nVelBins = iniGetInt(ini,"diagnostics:velBins");
+	ps->velMax = iniGetDoubleArr(ini,"diagnostics:velMax",nSpecies);
+
+	int *dims = iniGetIntArr(ini,"diagnostics:phaseSpaceDims",2);
+	int *bins = iniGetIntArr(ini,"diagnostics:phaseSpaceBins",2);
+	ps->xDim = dims[0];
+	ps->vDim = dims[1];
+	ps->nXBins = bins[0];
+	ps->nVBins = bins[1];
+	free(dims);
+	free(bins);
+
+	if(ps->nVelBins<1 || ps->nXBins<1 || ps->nVBins<1)
+		msg(ERROR,"diagnostics:velBins and phaseSpaceBins must be positive");
+	if(ps->xDim<0 || ps->xDim>=nDims || ps->vDim<0 || ps->vDim>=nDims)
+		msg(ERROR,"diagnostics:phaseSpaceDims must be in the range 0 to %i",nDims-1);
+	for(int s=0;s<nSpecies;s++){
+		if(ps->velMax[s]<=0) msg(ERROR,"diagnostics:velMax must be positive");
+	}
+
+	int d = ps->xDim;
+	ps->xMax = mpiInfo->cuts[d][mpiInfo->nSubdomains[d]];
+	ps->nBins = (long int)nDims*ps->nVelBins + (long int)ps->nXBins*ps->nVBins;
+	ps->local = malloc(nSpecies*ps->nBins*sizeof(*ps->local));
+	ps->global = malloc(nSpecies*ps->nBins*sizeof(*ps->global));
+	MPI_Comm_dup(mpiInfo->comm,&ps->comm);
+
+	/*
+	 * CREATE FILE, GROUPS AND ATTRIBUTES
+	 */
+	hid_t file = openH5File(ini,"phaseSpace","hist");
+
+	setH5Attr(file, "Position denormalization factor", &units->length, 1);
+	setH5Attr(file, "Velocity denormalization factor", &units->velocity, 1);
+
+	char name[64];
+	for(int s=0;s<nSpecies;s++){
+
+		double velRange[] = {-ps->velMax[s], ps->velMax[s]};
+		double xRange[] = {0, ps->xMax};
+		double xvDims[] = {ps->xDim, ps->vDim};
+		hid_t group;
+
+		sprintf(name,"/velocity/specie %i/",s);
+		createH5Group(file,name);
+		group = H5Gopen(file,name,H5P_DEFAULT);
+		setH5Attr(group, "Velocity range", velRange, 2);
+		H5Gclose(group);
+
+		sprintf(name,"/phaseSpace/specie %i/",s);
+		createH5Group(file,name);
+		group = H5Gopen(file,name,H5P_DEFAULT);
+		setH5Attr(group, "Position range", xRange, 2);
+		setH5Attr(group, "Velocity range", velRange, 2);
+		setH5Attr(group, "Position dimension and velocity component", xvDims, 2);
+		H5Gclose(group);
+	}
+
+	ps->h5 = file;
+
+	return ps;
+}
 
-			double *pos = &pop->pos[i*nDims];
-			for(int d=0;d<nDims;d++) pos[d] += offset[d];
+void pFreePhaseSpace(PhaseSpace *ps){
+
+	H5Fclose(ps->h5);
+	MPI_Comm_free(&ps->comm);
+	free(ps->velMax);
+	free(ps->local);
+	free(ps->global);
+	free(ps);
+}
+
+void pBinPhaseSpace(PhaseSpace *ps, const Population *pop, const MpiInfo *mpiInfo){
+
+	int nSpecies = pop->nSpecies;
+	int nDims = pop->nDims;
+	int nVelBins = ps->nVelBins;
+	int nXBins = ps->nXBins;
+	int nVBins = ps->nVBins;
+	int xDim = ps->xDim;
+	int vDim = ps->vDim;
+	double xOffset = mpiInfo->offset[xDim];
+	double xScale = nXBins/ps->xMax;
+
+	alSetAll(ps->local,nSpecies*ps->nBins,0);
+
+	for(int s=0;s<nSpecies;s++){
+
+		long int *velHist = &ps->local[s*ps->nBins];
+		long int *xvHist = &velHist[nDims*nVelBins];
+		double velMax = ps->velMax[s];
+		double velScale = nVelBins/(2*velMax);
+		double vScale = nVBins/(2*velMax);
+
+		for(long int i=pop->iStart[s];i<pop->iStop[s];i++){
+
+			for(int d=0;d<nDims;d++){
+				double v = pop->vel[pIndex(pop,s,i,d)] + velMax;
+				if(v>=0 && v<2*velMax){
+					int j = (int)(v*velScale);
+					if(j<nVelBins) velHist[d*nVelBins+j]++;
+				}
+			}
+
+			// Particles may lie up to one threshold outside the true domain
+			double x = pop->pos[pIndex(pop,s,i,xDim)] + xOffset;
+			if(x<0) x += ps->xMax;
+			if(x>=ps->xMax) x -= ps->xMax;
+			double v = pop->vel[pIndex(pop,s,i,vDim)] + velMax;
+			if(x>=0 && x<ps->xMax && v>=0 && v<2*velMax){
+				int jx = (int)(x*xScale);
+				int jv = (int)(v*vScale);
+				if(jx<nXBins && jv<nVBins) xvHist[jx*nVBins+jv]++;
+			}
 		}
 	}
 }
+
+/**
+ * @brief Creates a dataset of counts and writes it from rank 0
+ */
+static void pWriteCounts(hid_t h5, const char *name, const long int *counts,
+						 int nRows, int nCols, int mpiRank){
+
+	hsize_t dims[] = {nRows, nCols};
+	hid_t space = H5Screate_simple(2,dims,NULL);
+	hid_t dataset = H5Dcreate(h5,name,H5T_STD_I64LE,space,
+							  H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT);
+
+	if(mpiRank==0)
+		H5Dwrite(dataset,H5T_NATIVE_LONG,H5S_ALL,H5S_ALL,H5P_DEFAULT,counts);
+
+	H5Dclose(dataset);
+	H5Sclose(space);
+}
+
+void pWritePhaseSpace(	PhaseSpace *ps, const Population *pop,
+						const MpiInfo *mpiInfo, double posN, double velN){
+
+	int nSpecies = ps->nSpecies;
+	int mpiRank;
+	MPI_Comm_rank(ps->comm,&mpiRank);
+
+	pBinPhaseSpace(ps, pop, mpiInfo);
+
+	// All histograms are reduced at once
+	MPI_Reduce(ps->local,ps->global,nSpecies*ps->nBins,MPI_LONG,MPI_SUM,0,ps->comm);
+
+	char name[64];
+	for(int s=0;s<nSpecies;s++){
+
+		long int *velHist = &ps->global[s*ps->nBins];
+		long int *xvHist = &velHist[ps->nDims*ps->nVelBins];
+
+		sprintf(name,"/velocity/specie %i/n=%.1f",s,velN);
+		pWriteCounts(ps->h5, name, velHist, ps->nDims, ps->nVelBins, mpiRank);
+
+		sprintf(name,"/phaseSpace/specie %i/n=%.1f",s,posN);
+		pWriteCounts(ps->h5, name, xvHist, ps->nXBins, ps->nVBins, mpiRank);
+	}
+}
+
+void pHistogram(const Population *pop, int d, int nBins, long int *hist){
+
+	int nSpecies = pop->nSpecies;
+
+	for(int j=0;j<nBins;j++) hist[j] = 0;
+
+	for(int s=0;s<nSpecies;s++){
+
+		long int iStart = pop->iStart[s];
+		long int iStop = pop->iStop[s];
+
+		for(long int i=iStart;i<iStop;i++){
+			int j = (int)pop->pos[pIndex(pop,s,i,d)];
+			if(j<0) j = 0;
+			if(j>=nBins) j = nBins-1;
+			hist[j]++;
+		}
+	}
+}
+
+void pRedistribute(Population *pop, const MpiInfo *mpiInfo){
+
+	int nSpecies = pop->nSpecies;
+	int nDims = pop->nDims;
+	int mpiSize = mpiInfo->mpiSize;
+	int *nSubdomains = mpiInfo->nSubdomains;
+	int *nSubdomainsProd = mpiInfo->nSubdomainsProd;
+	int **cuts = mpiInfo->cuts;
+	MPI_Comm comm = mpiInfo->comm;
+
+	long int nParticles = 0;
+	for(int s=0;s<nSpecies;s++) nParticles += pop->iStop[s]-pop->iStart[s];
+
+	// Find the new owner of each particle
+	int *owner = malloc(nParticles*sizeof(*owner));
+	long int *nSend = calloc(mpiSize*nSpecies,sizeof(*nSend));
+	long int *nRecv = malloc(mpiSize*nSpecies*sizeof(*nRecv));
+
+	long int p = 0;
+	for(int s=0;s<nSpecies;s++){
+		for(long int i=pop->iStart[s];i<pop->iStop[s];i++){
+
+			int rank = 0;
+			for(int d=0;d<nDims;d++){
+				double pos = pop->pos[pIndex(pop,s,i,d)];
+				int J = 0;
+				while(J<nSubdomains[d]-1 && pos>=cuts[d][J+1]) J++;
+				rank += J*nSubdomainsProd[d];
+			}
+
+			owner[p++] = rank;
+			nSend[rank*nSpecies+s]++;
+		}
+	}
+
+	MPI_Alltoall(nSend,nSpecies,MPI_LONG,nRecv,nSpecies,MPI_LONG,comm);
+
+	// Particles to each rank are packed by specie, as for migrants
+	int *sendCounts = malloc(4*mpiSize*sizeof(*sendCounts));
+	int *recvCounts = &sendCounts[mpiSize];
+	int *sendDispls = &sendCounts[2*mpiSize];
+	int *recvDispls = &sendCounts[3*mpiSize];
+
+	long int nSendTotal = 0, nRecvTotal = 0;
+	for(int r=0;r<mpiSize;r++){
+		long int nS = 0, nR = 0;
+		for(int s=0;s<nSpecies;s++){
+			nS += nSend[r*nSpecies+s];
+			nR += nRecv[r*nSpecies+s];
+		}
+		if(2*nDims*(nSendTotal+nS)>INT_MAX || 2*nDims*(nRecvTotal+nR)>INT_MAX)
+			msg(ERROR,"Too many particles to redistribute in one go");
+		sendDispls[r] = 2*nDims*nSendTotal;
+		recvDispls[r] = 2*nDims*nRecvTotal;
+		sendCounts[r] = 2*nDims*nS;
+		recvCounts[r] = 2*nDims*nR;
+		nSendTotal += nS;
+		nRecvTotal += nR;
+	}
+
+	// Where the next particle of each specie to each rank goes
+	long int *next = malloc(mpiSize*nSpecies*sizeof(*next));
+	for(int r=0;r<mpiSize;r++){
+		long int n = sendDispls[r]/(2*nDims);
+		for(int s=0;s<nSpecies;s++){
+			next[r*nSpecies+s] = n;
+			n += nSend[r*nSpecies+s];
+		}
+	}
+
+	popFloat *sendBuf = malloc(2*nDims*nSendTotal*sizeof(*sendBuf));
+	popFloat *recvBuf = malloc(2*nDims*nRecvTotal*sizeof(*recvBuf));
+
+	p = 0;
+	for(int s=0;s<nSpecies;s++){
+		for(long int i=pop->iStart[s];i<pop->iStop[s];i++){
+			popFloat *particle = &sendBuf[2*nDims*next[owner[p++]*nSpecies+s]++];
+			for(int d=0;d<nDims;d++){
+				particle[d] = pop->pos[pIndex(pop,s,i,d)];
+				particle[nDims+d] = pop->vel[pIndex(pop,s,i,d)];
+			}
+		}
+		pop->iStop[s] = pop->iStart[s];
+	}
+
+	MPI_Alltoallv(	sendBuf,sendCounts,sendDispls,POP_MPI_FLOAT,
+					recvBuf,recvCounts,recvDispls,POP_MPI_FLOAT,comm);
+
+	for(int s=0;s<nSpecies;s++){
+		long int n = 0;
+		for(int r=0;r<mpiSize;r++) n += nRecv[r*nSpecies+s];
+		pReserve(pop,s,n);
+	}
+
+	// pNew() takes care of the layout of pop
+	double *particle = malloc(2*nDims*sizeof(*particle));
+	popFloat *received = recvBuf;
+	for(int r=0;r<mpiSize;r++){
+		for(int s=0;s<nSpecies;s++){
+			for(long int i=0;i<nRecv[r*nSpecies+s];i++){
+				for(int d=0;d<2*nDims;d++) particle[d] = received[d];
+				pNew(pop,s,particle,&particle[nDims]);
+				received += 2*nDims;
+			}
+		}
+	}
+
+	free(particle);
+	free(sendBuf);
+	free(recvBuf);
+	free(next);
+	free(sendCounts);
+	free(nSend);
+	free(nRecv);
+	free(owner);
+
+	pDiscardOrder(pop);
+}
+
+static void pRealloc(Population *pop, const long int *nAlloc){
+
+	int nSpecies = pop->nSpecies;
+	int nDims = pop->nDims;
+	popLayout layout = pop->layout;
+	long int *iStart = pop->iStart;
+
+	int resident = pop->residency!=ON_HOST;
+	if(resident){
+		pToHost(pop);
+#ifdef _OPENMP
+		long int n = nDims*iStart[nSpecies];
+		#pragma omp target exit data map(delete:pop->pos[0:n],pop->vel[0:n])
+#endif
+		pop->residency = ON_HOST;
+	}
+
+	// Rounded as in pAlloc(), such that species whose room is unchanged stay
+	// where they are unless a specie before them changed
+	long int *iStartNew = malloc((nSpecies+1)*sizeof(*iStartNew));
+	iStartNew[0] = 0;
+	for(int s=0;s<nSpecies;s++)
+		iStartNew[s+1] = iStartNew[s]+8*((nAlloc[s]+7)/8);
+
+	long int nBytes = (long int)nDims*iStartNew[nSpecies]*sizeof(*pop->pos);
+	nBytes = 64*((nBytes+63)/64);
+	popFloat *pos = aligned_alloc(64,nBytes);
+	popFloat *vel = aligned_alloc(64,nBytes);
+	popFloat *weight = NULL;
+	if(pop->weight) weight = malloc(iStartNew[nSpecies]*sizeof(*weight));
+
+	for(int s=0;s<nSpecies;s++){
+
+		long int nOld = iStart[s+1]-iStart[s];
+		long int nNew = iStartNew[s+1]-iStartNew[s];
+
+		// Not only up to iStop, since hidden species (see puSubcycleBegin())
+		// have their particles after it
+		long int n = nOld<nNew ? nOld : nNew;
+
+		if(layout==SOA){
+			for(int d=0;d<nDims;d++){
+				long int from = iStart[s]*nDims+d*nOld;
+				long int to = iStartNew[s]*nDims+d*nNew;
+				memcpy(&pos[to],&pop->pos[from],n*sizeof(*pos));
+				memcpy(&vel[to],&pop->vel[from],n*sizeof(*vel));
+			}
+		} else {
+			memcpy(&pos[iStartNew[s]*nDims],&pop->pos[iStart[s]*nDims],
+				   n*nDims*sizeof(*pos));
+			memcpy(&vel[iStartNew[s]*nDims],&pop->vel[iStart[s]*nDims],
+				   n*nDims*sizeof(*vel));
+		}
+		// New room is of equal weight, as in pAlloc()
+		if(weight){
+			memcpy(&weight[iStartNew[s]],&pop->weight[iStart[s]],
+				   n*sizeof(*weight));
+			for(long int i=iStartNew[s]+n;i<iStartNew[s+1];i++) weight[i] = 1;
+		}
+
+		pop->iStop[s] += iStartNew[s]-iStart[s];
+	}
+
+	// Others may hold on to iStart
+	for(int s=0;s<nSpecies+1;s++) iStart[s] = iStartNew[s];
+	free(iStartNew);
+
+	free(pop->pos);
+	free(pop->vel);
+	free(pop->weight);
+	pop->pos = pos;
+	pop->vel = vel;
+	pop->weight = weight;
+
+	if(resident){
+#ifdef _OPENMP
+		long int n = nDims*iStart[nSpecies];
+		#pragma omp target enter data map(to:pop->pos[0:n],pop->vel[0:n])
+#endif
+		pop->residency = ON_BOTH;
+	}
+
+	pDiscardOrder(pop);
+}
+
+static void pDiscardOrder(Population *pop){
+
+	for(int s=0;s<pop->nSpecies;s++) pop->sortedStop[s] = pop->iStart[s];
+	pop->nDisplaced = 0;
+}
+
+static int pCompareKey(const void *a, const void *b){
+	double x = ((const PKey *)a)->key;
+	double y = ((const PKey *)b)->key;
+	return (x>y) - (x<y);
+}
+
+static void pMergeCell(Population *pop, int s, PKey *key, long int n, long int nGroups){
+
+	int nDims = pop->nDims;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
+	popFloat *weight = pop->weight;
+
+	if(nGroups>n/4) nGroups = n/4;
+
+	for(long int g=0;g<nGroups;g++){
+
+		// Consecutive in speed
+		long int i[4] = {key[4*g].i, key[4*g+1].i, key[4*g+2].i, key[4*g+3].i};
+
+		// Total weight, centre of mass, mean velocity and mean squared speed
+		double W = 0, X[3] = {0,0,0}, U[3] = {0,0,0}, V2 = 0;
+		for(int m=0;m<4;m++){
+			double w = weight[i[m]];
+			W += w;
+			for(int d=0;d<nDims;d++){
+				double v = vel[pIndex(pop,s,i[m],d)];
+				X[d] += w*pos[pIndex(pop,s,i[m],d)];
+				U[d] += w*v;
+				V2 += w*v*v;
+			}
+		}
+
+		double U2 = 0;
+		for(int d=0;d<nDims;d++){
+			X[d] /= W;
+			U[d] /= W;
+			U2 += U[d]*U[d];
+		}
+
+		// Deviation restoring the energy, along that of the fastest particle
+		double dev = V2/W-U2;
+		dev = dev>0 ? sqrt(dev) : 0;
+
+		double dir[3] = {0,0,0}, dirNorm = 0;
+		for(int d=0;d<nDims;d++){
+			dir[d] = vel[pIndex(pop,s,i[3],d)]-U[d];
+			dirNorm += dir[d]*dir[d];
+		}
+		dirNorm = sqrt(dirNorm);
+		if(dirNorm>0) for(int d=0;d<nDims;d++) dir[d] /= dirNorm;
+		else dir[0] = 1;
+
+		for(int d=0;d<nDims;d++){
+			pos[pIndex(pop,s,i[0],d)] = X[d];
+			pos[pIndex(pop,s,i[1],d)] = X[d];
+			vel[pIndex(pop,s,i[0],d)] = U[d]+dev*dir[d];
+			vel[pIndex(pop,s,i[1],d)] = U[d]-dev*dir[d];
+		}
+		weight[i[0]] = 0.5*W;
+		weight[i[1]] = 0.5*W;
+		weight[i[2]] = 0;
+		weight[i[3]] = 0;
+	}
+}
+
+static int pSplitCell(Population *pop, int s, PKey *key, long int n, long int nSplits){
+
+	if(nSplits>n) nSplits = n;
+
+	int nDims = pop->nDims;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
+	popFloat *weight = pop->weight;
+
+	double x[3], v[3];
+	for(long int k=0;k<nSplits;k++){
+
+		if(pop->iStop[s]>=pop->iStart[s+1]) return 1;
+
+		long int i = key[k].i;
+		for(int d=0;d<nDims;d++){
+			x[d] = pos[pIndex(pop,s,i,d)];
+			v[d] = vel[pIndex(pop,s,i,d)];
+		}
+
+		// Both halves stay within the cell
+		int d = k%nDims;
+		double frac = x[d]-floor(x[d]);
+		double delta = 0.5*fmin(frac,1-frac);
+
+		pos[pIndex(pop,s,i,d)] = x[d]-delta;
+		x[d] += delta;
+		weight[i] *= 0.5;
+
+		long int iNew = pop->iStop[s];
+		pNew(pop,s,x,v);
+		weight[iNew] = weight[i];
+	}
+
+	return 0;
+}
+
+static void pMergeSanity(const dictionary *ini){
+
+	const char *keys[3] = {"methods:acc", "methods:distr", "methods:migrate"};
+	for(int k=0;k<3;k++){
+		char *method = iniGetStr(ini,keys[k]);
+		int len = strlen(method);
+		if(len<8 || strcmp(&method[len-8],"Weighted"))
+			msg(ERROR,"population:mergeInterval>0 requires a weighted %s "
+					  "(suffixed Weighted)",keys[k]);
+		free(method);
+	}
+
+	char *sweep = iniGetStr(ini,"methods:sweep");
+	if(strcmp(sweep,"puSweepSplit"))
+		msg(ERROR,"population:mergeInterval>0 requires methods:sweep=puSweepSplit");
+	free(sweep);
+
+	if(iniGetInt(ini,"grid:balanceInterval")!=0)
+		msg(ERROR,"population:mergeInterval>0 requires grid:balanceInterval=0");
+
+	int *ppcRange = iniGetIntArr(ini,"population:ppcRange",2);
+	if(ppcRange[0]<1 || ppcRange[1]<2*ppcRange[0])
+		msg(ERROR,"population:ppcRange must be min,max with min>=1 and max>=2*min");
+	free(ppcRange);
+}
+
+static inline unsigned long int pMix(unsigned long int hash, long int x){
+
+	hash += 0x9e3779b97f4a7c15UL + (unsigned long int)x;
+	hash = (hash ^ (hash>>30)) * 0xbf58476d1ce4e5b9UL;
+	hash = (hash ^ (hash>>27)) * 0x94d049bb133111ebUL;
+	return hash ^ (hash>>31);
+}
+
+static void pSplitMixSet(void *state, unsigned long int seed){
+	*(unsigned long int*)state = seed;
+}
+
+static unsigned long int pSplitMixGet(void *state){
+	unsigned long int *counter = state;
+	return pMix((*counter)++,0) >> 32;
+}
+
+static double pSplitMixGetDouble(void *state){
+	unsigned long int *counter = state;
+	return (pMix((*counter)++,0) >> 11) * 0x1.0p-53;
+}
+
+static const gsl_rng_type pSplitMixType = {
+	"splitmix64", 0xffffffffUL, 0, sizeof(unsigned long int),
+	&pSplitMixSet, &pSplitMixGet, &pSplitMixGetDouble
+};
+
+static const gsl_rng_type *pSplitMix = &pSplitMixType;
+
+static long int pPosUniformBox(	popFloat *pos, int nDims, long int n,
+								int *lower, int *upper, const int *own,
+								unsigned long int seed, gsl_rng *rng,
+								long int nMax){
+
+	if(n==0) return 0;
+
+	// Skip boxes outside this subdomain, and find the longest side
+	int dSplit = 0;
+	for(int d=0;d<nDims;d++){
+		if(upper[d]<=own[d] || lower[d]>=own[d+nDims]) return 0;
+		if(upper[d]-lower[d] > upper[dSplit]-lower[dSplit]) dSplit = d;
+	}
+
+	unsigned long int hash = seed;
+	for(int d=0;d<nDims;d++){
+		hash = pMix(hash,lower[d]);
+		hash = pMix(hash,upper[d]);
+	}
+	gsl_rng_set(rng,hash);
+
+	// Single cell (which is in this subdomain)
+	if(upper[dSplit]-lower[dSplit]==1){
+
+		if(n>nMax) return n;
+
+		for(long int i=0;i<n;i++){
+			for(int d=0;d<nDims;d++)
+				pos[i*nDims+d] = lower[d] + gsl_rng_uniform_pos(rng);
+		}
+		return n;
+	}
+
+	int lowerSplit = lower[dSplit];
+	int upperSplit = upper[dSplit];
+	int middle = lowerSplit + (upperSplit-lowerSplit)/2;
+	double p = (double)(middle-lowerSplit)/(upperSplit-lowerSplit);
+
+	// Sum of binomials of at most UINT_MAX trials each (is also binomial)
+	long int nLower = 0;
+	for(long int left=n;left>0;left-=UINT_MAX){
+		unsigned int nTrials = left>UINT_MAX ? UINT_MAX : left;
+		nLower += gsl_ran_binomial(rng,p,nTrials);
+	}
+
+	upper[dSplit] = middle;
+	long int generated = pPosUniformBox(pos, nDims, nLower, lower, upper, own,
+										seed, rng, nMax);
+	upper[dSplit] = upperSplit;
+
+	lower[dSplit] = middle;
+	generated += pPosUniformBox(&pos[generated*nDims], nDims, n-nLower, lower,
+								upper, own, seed, rng, nMax-generated);
+	lower[dSplit] = lowerSplit;
+
+	return generated;
+}
@@ -16,6 +16,10 @@
  * populations:nSpecies and population:nAlloc in ini-file. This function only
  * allocates the memory for the particles, it does not generate them.
  *
+ * The particles are stored in the layout specified by population:layout (AoS
+ * or SoA, see popLayout). For SoA, nAlloc is rounded up such that the array of
+ * each component starts on a cache line.
+ *
  * Remember to call pFree() to free memory.
  */
 Population *pAlloc(const dictionary *ini);
@@ -26,23 +30,101 @@ Population *pAlloc(const dictionary *ini);
  */
 void pFree(Population *pop);
 
+/**
+ * @brief	Reads the particle layout from population:layout in ini-file
+ * @param	ini		Dictionary to input file
+ * @return	AOS or SOA
+ */
+popLayout pGetLayout(const dictionary *ini);
+
+/**
+ * @brief	Changes the layout of the particles in a population
+ * @param[in,out]	pop		Population
+ * @param			layout	New layout
+ * @return			void
+ *
+ * Transposes pos and vel of each specie in-place (by means of a temporary
+ * buffer). Does nothing if pop already has the requested layout.
+ *
+ * The functions generating particles (e.g. pPosUniform()) and pWriteH5() use
+ * this internally to work in AoS layout and restore the layout afterwards.
+ * pNew(), pCut() and the other functions accessing individual particles works
+ * directly on either layout.
+ */
+void pSetLayout(Population *pop, popLayout layout);
+
+/**
+ * @brief	Makes the particles resident on the OpenMP target device
+ * @param[in,out]	pop		Population
+ * @return			void
+ *
+ * Maps pos and vel to the default device, copying them there, unless already
+ * done. Called by the offloaded kernels, after which the particles stay on the
+ * device until pFree(). Without a device (or OpenMP) the kernels and this run
+ * on the host.
+ */
+void pToDevice(Population *pop);
+
+/**
+ * @brief	Updates the host copy of particles resident on a device
+ * @param[in,out]	pop		Population
+ * @return			void
+ *
+ * Copies the particles from the device if they've been changed there since
+ * the last call. To be called before using particles on the host after an
+ * offloaded kernel. Does nothing for particles only on the host.
+ */
+void pToHost(Population *pop);
+
+/**
+ * @brief	Copies particles changed on the host to the device
+ * @param[in,out]	pop		Population
+ * @param			iFrom	First particle
+ * @param			iTo		First particle not to copy
+ * @return			void
+ *
+ * Does nothing unless the particles are resident on a device. Used after
+ * adding particles on the host, e.g. immigrants.
+ */
+void pToDeviceRange(Population *pop, long int iFrom, long int iTo);
+
+/**
+ * @brief	Ensures the scratch space on the device holds n particles
+ * @param[in,out]	pop		Population
+ * @param			n		Number of particles
+ * @return			void
+ *
+ * Reallocates pop->deviceIdx and pop->deviceBuf, both on the host and the
+ * device, if they hold fewer than n particles. The previous content is lost.
+ */
+void pReserveDevice(Population *pop, long int n);
+
 /**
  * @brief	Assign particles uniformly distributed positions
  * @param			ini		Dictionary to input file
  * @param[in,out]	pop		Population of particles
- * @param			grid	Grid in which the particles are to be distributed
+ * @param			mpiInfo	MpiInfo
  * @param			rngSync	Synchronized random number generator
  * @return			void
  *
  * The amount of particles specified by population:nParticles in ini will be
  * generated with uniformly distributed random positions within the simulation
  * domain (global reference frame). In case of multiple subdomains only
- * particles residing in this MPI node's subdomain will be stored, and will be
- * transformed to its local reference frame. The rng should have the same seed
- * (be synchronized) on all MPI nodes when calling this function as that will
- * ensure that all nodes generates the same particles and discards particles
- * not belonging to their subdomain. Failure to do so may lead to the number of
- * particles generated being different than specified in ini.
+ * particles residing in this MPI node's subdomain will be generated, and will
+ * be transformed to its local reference frame.
+ *
+ * The number of particles in each half of the domain is drawn from a binomial
+ * distribution, and so on for each half recursively down to single cells. Each
+ * box of cells has random numbers of its own, seeded from its corners, so an
+ * MPI node only needs to generate the boxes overlapping its subdomain. This
+ * takes O(nParticles/nSubdomains) time rather than O(nParticles), and gives
+ * the same particles regardless of the decomposition (but for the round-off of
+ * positions converted to the local frame).
+ *
+ * One number is drawn from rngSync, which should have the same seed
+ * (be synchronized) on all MPI nodes when calling this function. Failure to do
+ * so may lead to the number of particles generated being different than
+ * specified in ini.
  *
  * Beware that this function do not assign any velocity to the particles.
  * @see pVelMaxwell()
@@ -86,16 +168,24 @@ void pSumKinEnergy(Population *pop);
  * @brief	Assign particles Maxwellian distributed velocities
  * @param			ini		Dictionary to input file
  * @param[in,out]	pop		Population of particles
- * @param			rng		Random number generator
+ * @param			mpiInfo	MpiInfo
+ * @param			rngSync	Synchronized random number generator
  * @return			void
  *
  * Iterates through all particles belonging to pop and assignes Maxwellian
  * distributed velocities to them, according to the temperature specified in
- * ini. Contrary to in posUniform() rng should at this point _not_ have the same
- * seed as that will lead to particles in different sub-domains having identical
- * velocities.
+ * ini.
+ *
+ * As in pPosUniform(), one number is drawn from rngSync, which should have the
+ * same seed on all MPI nodes. Each run of consecutive particles in the same
+ * cell has random numbers of its own, seeded from the global cell and the
+ * number of runs in that cell before it. Particles in different subdomains
+ * therefore get different velocities, and particles as generated by
+ * pPosUniform() (all particles of a cell after each other) get the same
+ * velocities regardless of the decomposition.
  */
-void pVelMaxwell(const dictionary *ini, Population *pop, const gsl_rng *rng);
+void pVelMaxwell(const dictionary *ini, Population *pop, const MpiInfo *mpiInfo,
+				 const gsl_rng *rngSync);
 
 /**
  * @brief	Add new particle to population
@@ -104,6 +194,9 @@ void pVelMaxwell(const dictionary *ini, Population *pop, const gsl_rng *rng);
  * @param			pos		Position of new particle (nDims elements)
  * @param			vel		Velocity of new particle (nDims elements)
  * @return			void
+ *
+ * The specie is grown by pReserve() if it is full. If that isn't possible
+ * (population:growth=0) a warning is given and the particle is ignored.
  */
 void pNew(Population *pop, int s, const double *pos, const double *vel);
 
@@ -127,6 +220,92 @@ void pNew(Population *pop, int s, const double *pos, const double *vel);
  */
 void pCut(Population *pop, int s, long int p, double *pos, double *vel);
 
+/**
+ * @brief	Makes room for more particles of a specie
+ * @param[in,out]	pop		Population
+ * @param			s		Specie
+ * @param			n		Number of particles to make room for
+ * @return					void
+ *
+ * If population:growth is positive and there isn't room for n more particles
+ * after pop->iStop[s], the particles are reallocated with room for growth
+ * times the particles of specie s then. This, like pCompact(), changes
+ * pop->pos, pop->vel, pop->weight and pop->iStart, and thereby index of the
+ * particles of the species after s. Otherwise nothing is done, and the caller
+ * must handle running out of room as before. pNew() calls it when the specie
+ * is full, but functions adding many particles (e.g. the migration) reserve
+ * room for all of them first.
+ *
+ * population:nAlloc is then only the initial allocation, and the memory used
+ * by a subdomain follows its load instead of having to fit the largest load
+ * of any subdomain.
+ */
+void pReserve(Population *pop, int s, long int n);
+
+/**
+ * @brief	Shrinks the storage of species using little of it
+ * @param[in,out]	pop		Population
+ * @return					void
+ *
+ * The counterpart of pReserve(). Species with more than growth^2 times room
+ * for their particles (and more than for a small minimum) are reallocated with
+ * room for growth times them, such that storage isn't reallocated back and
+ * forth. Does nothing unless population:growth is positive. It must not be
+ * called while species are hidden by puSubcycleBegin().
+ */
+void pCompact(Population *pop);
+
+/**
+ * @brief	Sorts particles in cell-order
+ * @param[in,out]	pop		Population
+ * @param			grid	Grid the particles reside on (e.g. rho)
+ * @return					void
+ *
+ * Sorts the particles of each specie (within iStart[s]..iStop[s]) by the index
+ * of the cell they are in using an in-place counting sort, which is O(N). The
+ * order within each cell is arbitrary.
+ *
+ * As the particles move they get out of order, and gathering fields or
+ * scattering charges then accesses the grid randomly. Calling this every once
+ * in a while makes particles close in memory also close on the grid, which is
+ * much more cache-friendly. How often is set by population:sortInterval in
+ * regular().
+ *
+ * Where the particles of each cell start is recorded in Population::cellStart,
+ * which lets puExtractEmigrants3DShell() find the particles near the
+ * subdomain boundary without testing all of them.
+ */
+void pSort(Population *pop, const Grid *grid);
+
+/**
+ * @brief	Merges and splits particles to control the number per cell
+ * @param[in,out]	pop		Population
+ * @param			grid	Grid the particles reside on (e.g. rho)
+ * @param			ppcMin	Fewest particles per cell wanted
+ * @param			ppcMax	Most particles per cell wanted
+ * @return					void
+ *
+ * Requires particle weights, i.e. population:mergeInterval>0. The particles
+ * are first sorted by pSort(). In cells with more than ppcMax particles of a
+ * specie, groups of four particles of similar speed are merged into two,
+ * until there are at most ppcMax of them (or as many groups as possible have
+ * been merged). The two particles share the weight of the group and sit at its
+ * centre of mass. Their velocities are the mean velocity plus and minus a
+ * deviation chosen such that the charge, momentum and kinetic energy of the
+ * group are conserved (the deviation is along that of the fastest
+ * particle). In cells with fewer than ppcMin (but at least one) particles,
+ * the heaviest particles are instead split into two of half the weight,
+ * displaced symmetrically within the cell along one axis, which conserves the
+ * same quantities. New particles are appended to each specie, and a warning
+ * is given if there isn't room for them.
+ *
+ * The total number of particles thereby stays between about ppcMin and ppcMax
+ * times the number of populated cells. How often it is called is set by
+ * population:mergeInterval, and ppcMin and ppcMax by population:ppcRange, in
+ * regular().
+ */
+void pMergeSplit(Population *pop, const Grid *grid, int ppcMin, int ppcMax);
+
 /**
  * @brief	Creates .pop.h5-file to store population in
  * @param	ini				Dictionary to input file
@@ -164,12 +343,101 @@ void pOpenH5(	const dictionary *ini, Population *pop, const Units *units,
  * reference frame. The function takes care of merging the particles from all
  * MPI nodes to one file.
  *
- * NB: pop is not constified because all particles are transformed to global
- * reference frame before writing to .h5-file. However, they are transferred
- * back to local reference frame after writing so pop should remain unchanged to
- * within machine precision.
+ * The particles are copied blockwise to a small buffer in AoS layout, in the
+ * global reference frame and in the datatype given by files:popPrecision,
+ * such that pop itself is left untouched. If files:popChunk is non-zero the
+ * datasets are chunked with that many particles per chunk, and compressed
+ * with deflate level files:popDeflate if that is non-zero as well.
+ */
+void pWriteH5(const Population *pop, const MpiInfo *mpiInfo, double posN, double velN);
+
+/**
+ * @brief	Stages the particles in Population to be stored in .pop.h5-file
+ * @param	stage	Stage
+ * @param	pop		Population
+ * @param	mpiInfo	MpiInfo
+ * @param	posN	Timestep of position data to be stored
+ * @param	velN	Timestep of velocity data to be stored
+ * @return			void
+ * @see		Stage, pWriteH5()
+ *
+ * As pWriteH5(), but the particles are copied to the global reference frame
+ * and written later by the Stage, such that pop is left untouched and can be
+ * changed right away. The nodes' numbers of particles aren't gathered until
+ * then either.
+ */
+void pWriteH5Staged(Stage *stage, const Population *pop, const MpiInfo *mpiInfo,
+					double posN, double velN);
+
+/**
+ * @brief	Writes the particles of this MPI node to a checkpoint
+ * @param	ck		Checkpoint
+ * @param	pop		Population
+ * @return			void
+ * @see		ckCreate(), pReadCheckpoint()
+ *
+ * The particles are stored in the local reference frame and in the order they
+ * are in memory, such that a restart continues bit for bit.
+ */
+void pWriteCheckpoint(hid_t ck, const Population *pop);
+
+/**
+ * @brief	Reads the particles of this MPI node from a checkpoint
+ * @param	ck		Checkpoint
+ * @param	pop		Population allocated from the same input file
+ * @return			void
+ * @see		ckOpen(), pWriteCheckpoint()
+ *
+ * Replaces all particles in pop, and sets Population.iStop accordingly.
+ */
+void pReadCheckpoint(hid_t ck, Population *pop);
+
+/**
+ * @brief	Allocates PhaseSpace and creates its .hist.h5-file
+ * @param	ini		Dictionary to input file
+ * @param	pop		Population
+ * @param	units	Units
+ * @param	mpiInfo	MpiInfo
+ * @return	PhaseSpace
+ * @see		PhaseSpace, pWritePhaseSpace()
+ *
+ * The file "phaseSpace.hist.h5" (see openH5File()) has the groups
+ * "/velocity/specie <s>" and "/phaseSpace/specie <s>", with the ranges of the
+ * histograms as attributes, and the same denormalization factors as the
+ * .pop.h5-file. Remember to call pFreePhaseSpace().
  */
-void pWriteH5(Population *pop, const MpiInfo *mpiInfo, double posN, double velN);
+PhaseSpace *pAllocPhaseSpace(	const dictionary *ini, const Population *pop,
+								const Units *units, const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Closes the .hist.h5-file and frees PhaseSpace
+ * @param	ps		PhaseSpace
+ */
+void pFreePhaseSpace(PhaseSpace *ps);
+
+/**
+ * @brief	Bins the particles of this MPI node into PhaseSpace.local
+ * @param	ps		PhaseSpace
+ * @param	pop		Population
+ * @param	mpiInfo	MpiInfo
+ */
+void pBinPhaseSpace(PhaseSpace *ps, const Population *pop, const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Bins the particles of all MPI nodes and stores the histograms
+ * @param	ps		PhaseSpace
+ * @param	pop		Population
+ * @param	mpiInfo	MpiInfo
+ * @param	posN	Timestep of position data
+ * @param	velN	Timestep of velocity data
+ *
+ * The histograms are summed across MPI nodes by one reduction, and stored in
+ * datasets named "n=<timestep>" as by pWriteH5(): The velocity histograms, an
+ * nDims by velBins dataset, by velN, and the phase-space histogram, an nXBins
+ * by nVBins dataset, by posN. Collective.
+ */
+void pWritePhaseSpace(	PhaseSpace *ps, const Population *pop,
+						const MpiInfo *mpiInfo, double posN, double velN);
 
 /**
  * @brief	Closes .pop.h5-file
@@ -202,6 +470,33 @@ void pToLocalFrame(Population *pop, const MpiInfo *mpiInfo);
  */
 void pToGlobalFrame(Population *pop, const MpiInfo *mpiInfo);
 
+/**
+ * @brief Counts the particles in each plane of nodes along one dimension
+ * @param		pop		Population of particles
+ * @param		d		Dimension
+ * @param		nBins	Number of planes
+ * @param[out]	hist	Number of particles in each plane (nBins elements)
+ * @return		void
+ *
+ * Particle i belongs to plane (int)pos[d]. Particles outside [0,nBins) are
+ * counted in the nearest plane. Used by gBalance() with the particles in the
+ * global reference frame.
+ */
+void pHistogram(const Population *pop, int d, int nBins, long int *hist);
+
+/**
+ * @brief Sends each particle to the subdomain it belongs to
+ * @param[in,out]	pop			Population of particles (global reference frame)
+ * @param			mpiInfo		MpiInfo
+ * @return			void
+ *
+ * Finds the owner of each particle from MpiInfo.cuts, and exchanges all
+ * particles in one collective call. Unlike puMigrate() particles may move to
+ * any subdomain, which is needed after gBalance() has moved the subdomain
+ * boundaries. The particles are left in the global reference frame.
+ */
+void pRedistribute(Population *pop, const MpiInfo *mpiInfo);
+
 /**
  * @brief Creates datasets in .xy.h5-file for storing energy
  * @param	xy		.xy.h5-identifier
@@ -225,11 +520,11 @@ void pCreateEnergyDatasets(hid_t xy, Population *pop);
 
 /**
  * @brief Writes energies to .xy.h5-file
- * @param	xy		.xy.h5-identifier
+ * @param	buf		Buffer of the .xy.h5-file
  * @param	pop		Population
  * @return			void
  *
- * Uses xyWrite() to write potential and kinetic energies stored in Population
+ * Uses xyBufWrite() to write potential and kinetic energies stored in Population
  * to .xy.h5 datasets. These datasets must first be created using
  * pCreateEnergyDatasets(). Note that this function does not populate the energy
  * variables in Population with meaningful values, energy-computing functions
@@ -238,7 +533,23 @@ void pCreateEnergyDatasets(hid_t xy, Population *pop);
  * specie, or if that is unobtainable by the algorithm, the summed (total)
  * energy for all species. In the former case, the total energy can be obtained
  * simply by addition during post-processing.
+ *
+ * The energies are written as they are, and must already be summed across
+ * subdomains, e.g. by registering them in a Reduction using pAddEnergy().
+ */
+void pWriteEnergy(XyBuffer *buf, Population *pop, double x);
+
+/**
+ * @brief Registers the energies for summation across subdomains
+ * @param	pop		Population
+ * @param	red		Reduction (using MPI_SUM)
+ * @return			void
+ * @see		rAdd(), pWriteEnergy()
+ *
+ * Registers the kinetic and potential energies of all species and their totals
+ * in red, such that they are summed across subdomains by the next rBegin() and
+ * rEnd() along with any other registered diagnostics.
  */
-void pWriteEnergy(hid_t xy, Population *pop, double x);
+void pAddEnergy(Population *pop, Reduction *red);
 
 #endif // POPULATION_H
@@ -9,6 +9,10 @@
 #include "core.h"
 #include "pusher.h"
 #include <math.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 /******************************************************************************
  * DECLARING LOCAL FUNCTIONS
@@ -34,14 +38,16 @@
  * pusher.h.
  */
 ///@{
-static inline void puInterp3D1(	double *result, const double *pos,
+#pragma omp declare target
+static inline void puInterp3D1(	double *result, const popFloat *pos,
 								const double *val, const long int *sizeProd);
+#pragma omp end declare target
 
-static inline void puInterpND0(	double *result, const double *pos,
+static inline void puInterpND0(	double *result, const popFloat *pos,
 								const double *val, const long int *sizeProd,
 								int nDims);
 
-static inline void puInterpND1(	double *result, const double *pos,
+static inline void puInterpND1(	double *result, const popFloat *pos,
 								const double *val, const long int *sizeProd,
 								int nDims, int *integer, double *decimal,
 								double *complement);
@@ -55,14 +61,127 @@ static void puDistrND1Inner(	double *val, long int p, const long int *mul,
 								long int lastMul, double *decimal,
 								double *complement, double factor);
 ///@}
+
+/**
+ * @brief	Interpolates vector field to position of a particle (3D CIC)
+ * @param[out]	ex,ey,ez	Components of field at position
+ * @param		x,y,z		Position of particle
+ * @param		val			Grid values (e.g. E->val)
+ * @param		sizeProd	sizeProd of grid (e.g. E->sizeProd)
+ * @return	void
+ *
+ * Same as puInterp3D1() but written out for scalar in- and outputs. Used in
+ * loops meant to be vectorized (e.g. the SoA and Boris accelerators), since gcc
+ * cannot vectorize loops over the small arrays passed to puInterp3D1().
+ */
+static inline void puInterp3D1Scalar(	double *ex, double *ey, double *ez,
+									double x, double y, double z,
+									const double *val, const long int *sizeProd);
+
+/**
+ * @brief	Interpolates the gradient of a scalar field to a particle (3D CIC)
+ * @param[out]	result		Gradient at position
+ * @param		pos			Position of particle
+ * @param		val			Grid values (e.g. phi->val)
+ * @param		sizeProd	sizeProd of grid (e.g. phi->sizeProd)
+ * @return	void
+ *
+ * The exact gradient of the trilinear interpolation of val within the cell of
+ * the particle, i.e. the difference along each edge of the cell weighted
+ * bilinearly in the other two dimensions. Only reads the 8 corner nodes.
+ */
+static inline void puGrad3D1(	double *result, const popFloat *pos,
+								const double *val, const long int *sizeProd);
+
+/**
+ * @brief	Deposits a weighted charge from one particle onto 8 nodes (3D CIC)
+ * @param[in,out]	val			Grid values (e.g. rho->val)
+ * @param			pos			Position of particle
+ * @param			sizeProd	sizeProd of grid (e.g. rho->sizeProd)
+ * @param			weight		Charge to deposit
+ * @return	void
+ *
+ * Used by the threaded distributors. The same weighting as in puDistr3D1().
+ */
+static inline void puDeposit3D1(	double *val, const popFloat *pos,
+									const long int *sizeProd, double weight);
+
+/** @name Specialized interpolators and depositors
+ * @brief	Interpolates to, or deposits from, one particle using fixed dimensions
+ * @param[out]		result		Vector value at position
+ * @param[in,out]	val			Grid values (e.g. E->val or rho->val)
+ * @param			pos			Position of particle
+ * @param			sizeProd	sizeProd of grid
+ * @param			nDims		Number of dimensions (1, 2 or 3)
+ * @param			order		Order of interpolation (0, 1 or 2)
+ * @param			weight		Charge to deposit
+ * @param[out]		node		Lowest node the particle is weighted to
+ * @param[out]		weights		order+1 weights starting at node
+ * @return	void
+ *
+ * puWeights() computes the weights along one dimension. Order 0 is NGP, 1 is
+ * CIC and 2 is TSC. The others loop over the (order+1)^nDims nodes surrounding
+ * a particle. They are meant to be called with constant nDims and order from
+ * the functions generated by PU_SPECIALIZE such that the compiler unrolls the
+ * loops into code equivalent to the hand-written puInterp3D1().
+ */
+///@{
+static inline void puWeights(int order, double pos, int *node, double *weights);
+
+static inline void puInterpSpec(	double *result, const popFloat *pos,
+									const double *val, const long int *sizeProd,
+									int nDims, int order);
+
+static inline void puDepositSpec(	double *val, const popFloat *pos,
+									const long int *sizeProd, int nDims,
+									int order, double weight);
+///@}
+
+/**
+ * @brief	Allocates one zeroed private tile per OpenMP thread
+ * @param	rho			Grid to deposit to
+ * @param	nThreads	Number of threads
+ * @return	Array of nThreads pointers to tiles of rho->sizeProd[rho->rank] doubles
+ *
+ * With only one thread the tile is rho->val itself such that no copies are
+ * made. Free using puFreeTiles().
+ */
+static double **puAllocTiles(Grid *rho, int nThreads);
+
 /**
- * @brief	Adds cross product of a and b to res
- * @param	a		Vector (of length 3)
- * @param	b		Vector (of length 3)
- * @param	res		Resulting vector (of length 3)
+ * @brief	Reduces (sums) the private tiles into rho and frees them
+ * @param	tiles		Tiles from puAllocTiles()
+ * @param[in,out]	rho	Grid to deposit to
+ * @param	nThreads	Number of threads
  * @return	void
  */
-static inline void addCross(const double *a, const double *b, double *res);
+static void puReduceTiles(double **tiles, Grid *rho, int nThreads);
+
+/**
+ * @brief	Makes room for one more emigrant to neighbor ne
+ * @param[in,out]	mpiInfo	MpiInfo
+ * @param			ne		Neighbor
+ * @return	void
+ *
+ * To be called by the emigrant extractors before writing an emigrant to
+ * mpiInfo->emigrantsDummy[ne]. Grows the buffer if it is full.
+ */
+static inline void reserveEmigrant(MpiInfo *mpiInfo, int ne);
+
+/**
+ * @brief	Extracts particle i of specie s if it is an emigrant
+ * @param[in,out]	pop		Population
+ * @param[in,out]	mpiInfo	MpiInfo
+ * @param			s		Specie
+ * @param			i		Particle index
+ * @return	void
+ *
+ * Used by puExtractEmigrants3DShell(). An emigrant is replaced by the last
+ * particle, which is then tested in turn, and i is recorded in
+ * Population::displaced if it is among the cell-ordered particles.
+ */
+static inline void extractIfEmigrant(Population *pop, MpiInfo *mpiInfo,
+									 int s, long int i);
 
 /**
  * @brief	Sanity check of accelerator and distributor functions
@@ -74,10 +193,42 @@ static inline void addCross(const double *a, const double *b, double *res);
  *
  * To be used in _set() functions to test validity of ini-file (since this is
  * the same for all accelerator/distributor functions, only depending on
- * order and dimensionality)
+ * order and dimensionality). Functions whose name ends with SoA are required to
+ * run with population:layout=SoA, the others with AoS. Second order functions
+ * only exist for up to three dimensions.
  */
 static void puSanity(dictionary *ini, const char* name, int dim, int order);
 
+/**
+ * @brief	Sanity check of offloaded functions
+ * @param	ini		Input file
+ * @param	name	Name of function to check for (for use in errors)
+ * @return	void
+ *
+ * The offloaded functions keep the particles on the device between them, and
+ * must therefore be used together. Fails unless all of methods:acc,
+ * methods:distr and methods:migrate are offloaded and methods:sweep is
+ * puSweepOffload, and unless load balancing and sorting (which run on the
+ * host) are turned off.
+ */
+static void puOffloadSanity(const dictionary *ini, const char* name);
+
+/**
+ * @brief	Comparison of long ints for qsort()
+ */
+static int puCompareLong(const void *a, const void *b);
+
+/**
+ * @brief	Multiplies the velocities of a specie by a factor
+ * @param[in,out]	pop		Population
+ * @param			s		Specie
+ * @param			factor	Factor
+ * @return	void
+ *
+ * Works on both the AoS and SoA layout of pop.
+ */
+static void puScaleVel(Population *pop, int s, double factor);
+
 /******************************************************************************
  * DEFINING GLOBAL FUNCTIONS
  *****************************************************************************/
@@ -86,14 +237,35 @@ void puMove(Population *pop){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
-	double *pos = pop->pos;
-	double *vel = pop->vel;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
+
+	if(pop->layout==SOA){
+		for(int s=0; s<nSpecies; s++){
+
+			long int iStart = pop->iStart[s];
+			long int nAlloc = pop->iStart[s+1]-iStart;
+			long int nParticles = pop->iStop[s]-iStart;
+
+			for(int d=0;d<nDims;d++){
+				popFloat *x = &pos[iStart*nDims+d*nAlloc];
+				popFloat *v = &vel[iStart*nDims+d*nAlloc];
+
+				#pragma omp parallel for simd if(nParticles >= OMP_MIN_NODES) schedule(static)
+				for(long int i=0;i<nParticles;i++){
+					x[i] += v[i];
+				}
+			}
+		}
+		return;
+	}
 
 	for(int s=0; s<nSpecies; s++){
 
 		long int pStart = pop->iStart[s]*nDims;
 		long int pStop = pop->iStop[s]*nDims;
 
+		#pragma omp parallel for simd if(pStop-pStart >= OMP_MIN_NODES) schedule(static)
 		for(long int p=pStart;p<pStop;p++){
 			pos[p] += vel[p];
 		}
@@ -104,7 +276,7 @@ void puPeriodic(Population *pop, Grid *grid){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
-	double *pos = pop->pos;
+	popFloat *pos = pop->pos;
 	int *nGhostLayers = grid->nGhostLayers;
 	int *trueSize = grid->trueSize;
 
@@ -126,30 +298,29 @@ funPtr puAcc3D1_set(dictionary *ini){
 	puSanity(ini,"puAcc3D1",3,1);
 	return puAcc3D1;
 }
-void puAcc3D1(Population *pop, Grid *E){
+void puAcc3D1(Population *pop, const Grid *E, double fraction){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = 3; // pop->nDims; // hard-coding allows compiler to replace by value
-	double *pos = pop->pos;
-	double *vel = pop->vel;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
 
 	long int *sizeProd = E->sizeProd;
 	double *val = E->val;
 
 	for(int s=0;s<nSpecies;s++){
 
-		gMul(E, pop->charge[s]/pop->mass[s]);
+		double factor = fraction*pop->charge[s]/pop->mass[s];
 
 		long int pStart = pop->iStart[s]*nDims;
 		long int pStop = pop->iStop[s]*nDims;
 
+		#pragma omp parallel for if(pStop-pStart >= OMP_MIN_NODES) schedule(static)
 		for(long int p=pStart;p<pStop;p+=nDims){
 			double dv[3];
 			puInterp3D1(dv,&pos[p],val,sizeProd);
-			for(int d=0;d<nDims;d++) vel[p+d] += dv[d];
+			for(int d=0;d<nDims;d++) vel[p+d] += factor*dv[d];
 		}
-
-		gMul(E, pop->mass[s]/pop->charge[s]);
 	}
 }
 
@@ -157,12 +328,12 @@ funPtr puAcc3D1KE_set(dictionary *ini){
 	puSanity(ini,"puAcc3D1KE",3,1);
 	return puAcc3D1KE;
 }
-void puAcc3D1KE(Population *pop, Grid *E){
+void puAcc3D1KE(Population *pop, const Grid *E, double fraction){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = 3; // pop->nDims; // hard-coding allows compiler to replace by value
-	double *pos = pop->pos;
-	double *vel = pop->vel;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
 	double *mass = pop->mass;
 	double *kinEnergy = pop->kinEnergy;
 
@@ -171,39 +342,261 @@ void puAcc3D1KE(Population *pop, Grid *E){
 
 	for(int s=0;s<nSpecies;s++){
 
-		gMul(E, pop->charge[s]/pop->mass[s]);
+		double factor = fraction*pop->charge[s]/pop->mass[s];
 
 		long int pStart = pop->iStart[s]*nDims;
 		long int pStop = pop->iStop[s]*nDims;
 
-		kinEnergy[s]=0;
+		double sumVelSquared = 0;
 
+		#pragma omp parallel for reduction(+:sumVelSquared) if(pStop-pStart >= OMP_MIN_NODES) schedule(static)
 		for(long int p=pStart;p<pStop;p+=nDims){
 			double dv[3];
 			puInterp3D1(dv,&pos[p],val,sizeProd);
+			for(int d=0;d<nDims;d++) dv[d] *= factor;
 			double velSquared=0;
 			for(int d=0;d<nDims;d++){
 				velSquared += vel[p+d]*(vel[p+d]+dv[d]);
 				vel[p+d] += dv[d];
 			}
-			kinEnergy[s]+=velSquared;
+			sumVelSquared+=velSquared;
 		}
 
-		kinEnergy[s]*=0.5*mass[s];
+		kinEnergy[s]=0.5*mass[s]*sumVelSquared;
+	}
+}
+
+funPtr puAcc3D1Phi_set(dictionary *ini){
+	puSanity(ini,"puAcc3D1Phi",3,1);
+	return puAcc3D1Phi;
+}
+void puAcc3D1Phi(Population *pop, const Grid *phi, double fraction){
+
+	int nSpecies = pop->nSpecies;
+	int nDims = 3;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
+
+	long int *sizeProd = phi->sizeProd;
+	double *val = phi->val;
+
+	for(int s=0;s<nSpecies;s++){
+
+		// E = -grad(phi)
+		double factor = -fraction*pop->charge[s]/pop->mass[s];
+
+		long int pStart = pop->iStart[s]*nDims;
+		long int pStop = pop->iStop[s]*nDims;
+
+		#pragma omp parallel for if(pStop-pStart >= OMP_MIN_NODES) schedule(static)
+		for(long int p=pStart;p<pStop;p+=nDims){
+			double dv[3];
+			puGrad3D1(dv,&pos[p],val,sizeProd);
+			for(int d=0;d<nDims;d++) vel[p+d] += factor*dv[d];
+		}
+	}
+}
+
+funPtr puAcc3D1KEPhi_set(dictionary *ini){
+	puSanity(ini,"puAcc3D1KEPhi",3,1);
+	return puAcc3D1KEPhi;
+}
+void puAcc3D1KEPhi(Population *pop, const Grid *phi, double fraction){
+
+	int nSpecies = pop->nSpecies;
+	int nDims = 3;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
+	double *mass = pop->mass;
+	double *kinEnergy = pop->kinEnergy;
+
+	long int *sizeProd = phi->sizeProd;
+	double *val = phi->val;
+
+	for(int s=0;s<nSpecies;s++){
+
+		// E = -grad(phi)
+		double factor = -fraction*pop->charge[s]/pop->mass[s];
+
+		long int pStart = pop->iStart[s]*nDims;
+		long int pStop = pop->iStop[s]*nDims;
+
+		double sumVelSquared = 0;
+
+		#pragma omp parallel for reduction(+:sumVelSquared) if(pStop-pStart >= OMP_MIN_NODES) schedule(static)
+		for(long int p=pStart;p<pStop;p+=nDims){
+			double dv[3];
+			puGrad3D1(dv,&pos[p],val,sizeProd);
+			for(int d=0;d<nDims;d++) dv[d] *= factor;
+			double velSquared=0;
+			for(int d=0;d<nDims;d++){
+				velSquared += vel[p+d]*(vel[p+d]+dv[d]);
+				vel[p+d] += dv[d];
+			}
+			sumVelSquared+=velSquared;
+		}
+
+		kinEnergy[s]=0.5*mass[s]*sumVelSquared;
+	}
+}
+
+int puGathersPhi(const dictionary *ini){
+	char *acc = iniGetStr(ini,"methods:acc");
+	int len = strlen(acc);
+	int phi = len>=3 && !strcmp(&acc[len-3],"Phi");
+	free(acc);
+	return phi;
+}
+
+funPtr puAcc3D1KEWeighted_set(dictionary *ini){
+	puSanity(ini,"puAcc3D1KEWeighted",3,1);
+	if(iniGetInt(ini,"population:mergeInterval")<=0)
+		msg(ERROR,"puAcc3D1KEWeighted requires population:mergeInterval>0");
+	return puAcc3D1KEWeighted;
+}
+void puAcc3D1KEWeighted(Population *pop, const Grid *E, double fraction){
+
+	int nSpecies = pop->nSpecies;
+	int nDims = 3;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
+	popFloat *weight = pop->weight;
+	double *mass = pop->mass;
+	double *kinEnergy = pop->kinEnergy;
+
+	long int *sizeProd = E->sizeProd;
+	double *val = E->val;
+
+	for(int s=0;s<nSpecies;s++){
+
+		double factor = fraction*pop->charge[s]/pop->mass[s];
 
-		gMul(E, pop->mass[s]/pop->charge[s]);
+		long int iStart = pop->iStart[s];
+		long int iStop = pop->iStop[s];
+
+		double sumVelSquared = 0;
+
+		#pragma omp parallel for reduction(+:sumVelSquared) if(iStop-iStart >= OMP_MIN_NODES) schedule(static)
+		for(long int i=iStart;i<iStop;i++){
+			long int p = i*nDims;
+			double dv[3];
+			puInterp3D1(dv,&pos[p],val,sizeProd);
+			for(int d=0;d<nDims;d++) dv[d] *= factor;
+			double velSquared=0;
+			for(int d=0;d<nDims;d++){
+				velSquared += vel[p+d]*(vel[p+d]+dv[d]);
+				vel[p+d] += dv[d];
+			}
+			sumVelSquared+=weight[i]*velSquared;
+		}
+
+		kinEnergy[s]=0.5*mass[s]*sumVelSquared;
+	}
+}
+
+funPtr puAcc3D1SoA_set(dictionary *ini){
+	puSanity(ini,"puAcc3D1SoA",3,1);
+	return puAcc3D1SoA;
+}
+void puAcc3D1SoA(Population *pop, const Grid *E, double fraction){
+
+	int nSpecies = pop->nSpecies;
+
+	long int *sizeProd = E->sizeProd;
+	double *val = E->val;
+
+	for(int s=0;s<nSpecies;s++){
+
+		double factor = fraction*pop->charge[s]/pop->mass[s];
+
+		long int iStart = pop->iStart[s];
+		long int nAlloc = pop->iStart[s+1]-iStart;
+		long int nParticles = pop->iStop[s]-iStart;
+
+		popFloat *x = &pop->pos[3*iStart];
+		popFloat *y = &x[nAlloc];
+		popFloat *z = &y[nAlloc];
+		popFloat *vx = &pop->vel[3*iStart];
+		popFloat *vy = &vx[nAlloc];
+		popFloat *vz = &vy[nAlloc];
+
+		#pragma omp parallel for simd if(nParticles >= OMP_MIN_NODES) schedule(static)
+		for(long int i=0;i<nParticles;i++){
+			double dvx, dvy, dvz;
+			puInterp3D1Scalar(&dvx,&dvy,&dvz,x[i],y[i],z[i],val,sizeProd);
+			dvx *= factor;
+			dvy *= factor;
+			dvz *= factor;
+			vx[i] += dvx;
+			vy[i] += dvy;
+			vz[i] += dvz;
+		}
+	}
+}
+
+funPtr puAcc3D1KESoA_set(dictionary *ini){
+	puSanity(ini,"puAcc3D1KESoA",3,1);
+	return puAcc3D1KESoA;
+}
+void puAcc3D1KESoA(Population *pop, const Grid *E, double fraction){
+
+	int nSpecies = pop->nSpecies;
+	double *mass = pop->mass;
+	double *kinEnergy = pop->kinEnergy;
+
+	long int *sizeProd = E->sizeProd;
+	double *val = E->val;
+
+	for(int s=0;s<nSpecies;s++){
+
+		double factor = fraction*pop->charge[s]/pop->mass[s];
+
+		long int iStart = pop->iStart[s];
+		long int nAlloc = pop->iStart[s+1]-iStart;
+		long int nParticles = pop->iStop[s]-iStart;
+
+		popFloat *x = &pop->pos[3*iStart];
+		popFloat *y = &x[nAlloc];
+		popFloat *z = &y[nAlloc];
+		popFloat *vx = &pop->vel[3*iStart];
+		popFloat *vy = &vx[nAlloc];
+		popFloat *vz = &vy[nAlloc];
+
+		double velSquared = 0;
+
+		#pragma omp parallel for simd reduction(+:velSquared) if(nParticles >= OMP_MIN_NODES) schedule(static)
+		for(long int i=0;i<nParticles;i++){
+			double dvx, dvy, dvz;
+			puInterp3D1Scalar(&dvx,&dvy,&dvz,x[i],y[i],z[i],val,sizeProd);
+			dvx *= factor;
+			dvy *= factor;
+			dvz *= factor;
+			velSquared +=	vx[i]*(vx[i]+dvx)
+						+	vy[i]*(vy[i]+dvy)
+						+	vz[i]*(vz[i]+dvz);
+			vx[i] += dvx;
+			vy[i] += dvy;
+			vz[i] += dvz;
+		}
+
+		kinEnergy[s] = 0.5*mass[s]*velSquared;
 	}
 }
+
 funPtr puAccND1KE_set(dictionary *ini){
 	puSanity(ini,"puAccND1KE",0,1);
+	int nDims = iniGetInt(ini,"grid:nDims");
+	if(nDims==1) return puAcc1D1KE;
+	if(nDims==2) return puAcc2D1KE;
+	if(nDims==3) return puAcc3D1KE;
 	return puAccND1KE;
 }
-void puAccND1KE(Population *pop, Grid *E){
+void puAccND1KE(Population *pop, const Grid *E, double fraction){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
-	double *pos = pop->pos;
-	double *vel = pop->vel;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
 	double *mass = pop->mass;
 	double *kinEnergy = pop->kinEnergy;
 
@@ -217,7 +610,7 @@ void puAccND1KE(Population *pop, Grid *E){
 
 	for(int s=0;s<nSpecies;s++){
 
-		gMul(E, pop->charge[s]/pop->mass[s]);
+		double factor = fraction*pop->charge[s]/pop->mass[s];
 
 		long int pStart = pop->iStart[s]*nDims;
 		long int pStop = pop->iStop[s]*nDims;
@@ -227,6 +620,7 @@ void puAccND1KE(Population *pop, Grid *E){
 		for(long int p=pStart;p<pStop;p+=nDims){
 
 			puInterpND1(dv,&pos[p],val,sizeProd,nDims,integer,decimal,complement);
+			for(int d=0;d<nDims;d++) dv[d] *= factor;
 			double velSquared=0;
 			for(int d=0;d<nDims;d++){
 				velSquared += vel[p+d]*(vel[p+d]+dv[d]);
@@ -236,8 +630,6 @@ void puAccND1KE(Population *pop, Grid *E){
 		}
 
 		kinEnergy[s]*=0.5*mass[s];
-
-		gMul(E, pop->mass[s]/pop->charge[s]);
 	}
 
 	free(dv);
@@ -248,14 +640,18 @@ void puAccND1KE(Population *pop, Grid *E){
 
 funPtr puAccND1_set(dictionary *ini){
 	puSanity(ini,"puAccND1",0,1);
+	int nDims = iniGetInt(ini,"grid:nDims");
+	if(nDims==1) return puAcc1D1;
+	if(nDims==2) return puAcc2D1;
+	if(nDims==3) return puAcc3D1;
 	return puAccND1;
 }
-void puAccND1(Population *pop, Grid *E){
+void puAccND1(Population *pop, const Grid *E, double fraction){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
-	double *pos = pop->pos;
-	double *vel = pop->vel;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
 
 	long int *sizeProd = E->sizeProd;
 	double *val = E->val;
@@ -267,7 +663,7 @@ void puAccND1(Population *pop, Grid *E){
 
 	for(int s=0;s<nSpecies;s++){
 
-		gMul(E, pop->charge[s]/pop->mass[s]);
+		double factor = fraction*pop->charge[s]/pop->mass[s];
 
 		long int pStart = pop->iStart[s]*nDims;
 		long int pStop = pop->iStop[s]*nDims;
@@ -275,12 +671,11 @@ void puAccND1(Population *pop, Grid *E){
 		for(long int p=pStart;p<pStop;p+=nDims){
 
 			puInterpND1(dv,&pos[p],val,sizeProd,nDims,integer,decimal,complement);
+			for(int d=0;d<nDims;d++) dv[d] *= factor;
 			for(int d=0;d<nDims;d++){
 				vel[p+d] += dv[d];
 			}
 		}
-
-		gMul(E, pop->mass[s]/pop->charge[s]);
 	}
 
 	free(dv);
@@ -291,14 +686,18 @@ void puAccND1(Population *pop, Grid *E){
 
 funPtr puAccND0KE_set(dictionary *ini){
 	puSanity(ini,"puAccND0KE",0,0);
+	int nDims = iniGetInt(ini,"grid:nDims");
+	if(nDims==1) return puAcc1D0KE;
+	if(nDims==2) return puAcc2D0KE;
+	if(nDims==3) return puAcc3D0KE;
 	return puAccND0KE;
 }
-void puAccND0KE(Population *pop, Grid *E){
+void puAccND0KE(Population *pop, const Grid *E, double fraction){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
-	double *pos = pop->pos;
-	double *vel = pop->vel;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
 	double *mass = pop->mass;
 	double *kinEnergy = pop->kinEnergy;
 
@@ -309,7 +708,7 @@ void puAccND0KE(Population *pop, Grid *E){
 
 	for(int s=0;s<nSpecies;s++){
 
-		gMul(E, pop->charge[s]/pop->mass[s]);
+		double factor = fraction*pop->charge[s]/pop->mass[s];
 
 		long int pStart = pop->iStart[s]*nDims;
 		long int pStop = pop->iStop[s]*nDims;
@@ -319,6 +718,7 @@ void puAccND0KE(Population *pop, Grid *E){
 		for(long int p=pStart;p<pStop;p+=nDims){
 
 			puInterpND0(dv,&pos[p],val,sizeProd,nDims);
+			for(int d=0;d<nDims;d++) dv[d] *= factor;
 			double velSquared=0;
 			for(int d=0;d<nDims;d++){
 				velSquared += vel[p+d]*(vel[p+d]+dv[d]);
@@ -328,8 +728,6 @@ void puAccND0KE(Population *pop, Grid *E){
 		}
 
 		kinEnergy[s]*=0.5*mass[s];
-
-		gMul(E, pop->mass[s]/pop->charge[s]);
 	}
 
 	free(dv);
@@ -337,14 +735,18 @@ void puAccND0KE(Population *pop, Grid *E){
 
 funPtr puAccND0_set(dictionary *ini){
 	puSanity(ini,"puAccND0",0,0);
-	return puAccND0KE;
+	int nDims = iniGetInt(ini,"grid:nDims");
+	if(nDims==1) return puAcc1D0;
+	if(nDims==2) return puAcc2D0;
+	if(nDims==3) return puAcc3D0;
+	return puAccND0;
 }
-void puAccND0(Population *pop, Grid *E){
+void puAccND0(Population *pop, const Grid *E, double fraction){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
-	double *pos = pop->pos;
-	double *vel = pop->vel;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
 
 	long int *sizeProd = E->sizeProd;
 	double *val = E->val;
@@ -353,7 +755,7 @@ void puAccND0(Population *pop, Grid *E){
 
 	for(int s=0;s<nSpecies;s++){
 
-		gMul(E, pop->charge[s]/pop->mass[s]);
+		double factor = fraction*pop->charge[s]/pop->mass[s];
 
 		long int pStart = pop->iStart[s]*nDims;
 		long int pStop = pop->iStop[s]*nDims;
@@ -361,63 +763,169 @@ void puAccND0(Population *pop, Grid *E){
 		for(long int p=pStart;p<pStop;p+=nDims){
 
 			puInterpND0(dv,&pos[p],val,sizeProd,nDims);
+			for(int d=0;d<nDims;d++) dv[d] *= factor;
 			for(int d=0;d<nDims;d++){
 				vel[p+d] += dv[d];
 			}
 		}
-
-		gMul(E, pop->mass[s]/pop->charge[s]);
 	}
 
 	free(dv);
 }
 
 
-void puBoris3D1(Population *pop, Grid *E, const double *T, const double *S){
+/*
+ * Generates puAccXDY(), puAccXDYKE() and puDistrXDY() for fixed X and Y. These
+ * are not selected by name but dispatched to by the ND _set() functions.
+ */
+#define PU_SPECIALIZE(X,Y)\
+void puAcc##X##D##Y(Population *pop, const Grid *E, double fraction){\
+	for(int s=0;s<pop->nSpecies;s++){\
+		double factor = fraction*pop->charge[s]/pop->mass[s];\
+		long int iStart = pop->iStart[s], iStop = pop->iStop[s];\
+		_Pragma("omp parallel for if(iStop-iStart >= OMP_MIN_NODES) schedule(static)")\
+		for(long int i=iStart;i<iStop;i++){\
+			popFloat *pos = &pop->pos[X*i];\
+			popFloat *vel = &pop->vel[X*i];\
+			double dv[X];\
+			puInterpSpec(dv,pos,E->val,E->sizeProd,X,Y);\
+			for(int d=0;d<X;d++) vel[d] += factor*dv[d];\
+		}\
+	}\
+}\
+void puAcc##X##D##Y##KE(Population *pop, const Grid *E, double fraction){\
+	for(int s=0;s<pop->nSpecies;s++){\
+		double factor = fraction*pop->charge[s]/pop->mass[s];\
+		double velSquared = 0;\
+		long int iStart = pop->iStart[s], iStop = pop->iStop[s];\
+		_Pragma("omp parallel for reduction(+:velSquared) if(iStop-iStart >= OMP_MIN_NODES) schedule(static)")\
+		for(long int i=iStart;i<iStop;i++){\
+			popFloat *pos = &pop->pos[X*i];\
+			popFloat *vel = &pop->vel[X*i];\
+			double dv[X];\
+			puInterpSpec(dv,pos,E->val,E->sizeProd,X,Y);\
+			for(int d=0;d<X;d++) dv[d] *= factor;\
+			for(int d=0;d<X;d++){\
+				velSquared += vel[d]*(vel[d]+dv[d]);\
+				vel[d] += dv[d];\
+			}\
+		}\
+		pop->kinEnergy[s] = 0.5*pop->mass[s]*velSquared;\
+	}\
+}\
+void puDistr##X##D##Y(const Population *pop, Grid *rho){\
+	gZero(rho);\
+	for(int s=0;s<pop->nSpecies;s++){\
+		for(long int i=pop->iStart[s];i<pop->iStop[s];i++){\
+			popFloat *pos = &pop->pos[X*i];\
+			puDepositSpec(rho->val,pos,rho->sizeProd,X,Y,pop->charge[s]);\
+		}\
+	}\
+}
+
+// 3D1 is the hand-written puAcc3D1(), puAcc3D1KE() and puDistr3D1()
+PU_SPECIALIZE(1,0)
+PU_SPECIALIZE(1,1)
+PU_SPECIALIZE(1,2)
+PU_SPECIALIZE(2,0)
+PU_SPECIALIZE(2,1)
+PU_SPECIALIZE(2,2)
+PU_SPECIALIZE(3,0)
+PU_SPECIALIZE(3,2)
+
+funPtr puAccND2_set(dictionary *ini){
+	puSanity(ini,"puAccND2",0,2);
+	int nDims = iniGetInt(ini,"grid:nDims");
+	if(nDims==1) return puAcc1D2;
+	if(nDims==2) return puAcc2D2;
+	if(nDims==3) return puAcc3D2;
+	return NULL; // puSanity() does not allow this
+}
+
+funPtr puAccND2KE_set(dictionary *ini){
+	puSanity(ini,"puAccND2KE",0,2);
+	int nDims = iniGetInt(ini,"grid:nDims");
+	if(nDims==1) return puAcc1D2KE;
+	if(nDims==2) return puAcc2D2KE;
+	if(nDims==3) return puAcc3D2KE;
+	return NULL; // puSanity() does not allow this
+}
+
+funPtr puDistrND2_set(dictionary *ini){
+	puSanity(ini,"puDistrND2",0,2);
+	int nDims = iniGetInt(ini,"grid:nDims");
+	if(nDims==1) return puDistr1D2;
+	if(nDims==2) return puDistr2D2;
+	if(nDims==3) return puDistr3D2;
+	return NULL; // puSanity() does not allow this
+}
+
+
+funPtr puBoris3D1_set(dictionary *ini){
+	puSanity(ini,"puBoris3D1",3,1);
+	return puBoris3D1;
+}
+void puBoris3D1(Population *pop, const Grid *E, double fraction){
 
 	int nSpecies = pop->nSpecies;
-	int nDims = 3; // pop->nDims; // hard-coding allows compiler to replace by value
-	double *pos = pop->pos;
-	double *vel = pop->vel;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
 
 	long int *sizeProd = E->sizeProd;
 	double *val = E->val;
 
 	for(int s=0;s<nSpecies;s++){
 
-		gMul(E, pop->charge[s]/pop->mass[s]);
+		double factor = fraction*pop->charge[s]/pop->mass[s];
 
-		long int pStart = pop->iStart[s]*nDims;
-		long int pStop = pop->iStop[s]*nDims;
+		long int iStart = pop->iStart[s];
+		long int iStop = pop->iStop[s];
 
-		for(long int p=pStart;p<pStop;p+=nDims){
-			double dv[3], vPrime[3];
-			puInterp3D1(dv,&pos[p],val,sizeProd);
+		double tx = pop->T[3*s], ty = pop->T[3*s+1], tz = pop->T[3*s+2];
+		double sx = pop->S[3*s], sy = pop->S[3*s+1], sz = pop->S[3*s+2];
 
-			// Add half the acceleration (becomes v minus in B&L notation)
-			for(int d=0;d<nDims;d++) vel[p+d] += 0.5*dv[d];
+		#pragma omp parallel for simd if(iStop-iStart >= OMP_MIN_NODES) schedule(static)
+		for(long int i=iStart;i<iStop;i++){
+			long int p = 3*i;
 
-			// Rotate
-			memcpy(vPrime,vel,3*sizeof(*vPrime));
-			addCross(vel,&T[3*s],vPrime); // vPrime is now v prime
-			addCross(vPrime,&S[3*s],vel); // vel is now v plus (B&L)
+			double dvx, dvy, dvz;
+			puInterp3D1Scalar(&dvx,&dvy,&dvz,pos[p],pos[p+1],pos[p+2],val,sizeProd);
+			dvx *= factor;
+			dvy *= factor;
+			dvz *= factor;
+
+			// Add half the acceleration (becomes v minus in B&L notation)
+			double vx = vel[p]   + 0.5*dvx;
+			double vy = vel[p+1] + 0.5*dvy;
+			double vz = vel[p+2] + 0.5*dvz;
+
+			// Rotate (v prime, and then v plus in B&L notation)
+			double px = vx + (vy*tz-vz*ty);
+			double py = vy + (vz*tx-vx*tz);
+			double pz = vz + (vx*ty-vy*tx);
+			vx += py*sz-pz*sy;
+			vy += pz*sx-px*sz;
+			vz += px*sy-py*sx;
 
 			// Compute energy here in KE-version
 
 			// Add half the acceleration
-			for(int d=0;d<nDims;d++) vel[p+d] += 0.5*dv[d];
+			vel[p]   = vx + 0.5*dvx;
+			vel[p+1] = vy + 0.5*dvy;
+			vel[p+2] = vz + 0.5*dvz;
 		}
-
-		gMul(E, pop->mass[s]/pop->charge[s]);
 	}
 }
 
-void puBoris3D1KE(Population *pop, Grid *E, const double *T, const double *S){
+funPtr puBoris3D1KE_set(dictionary *ini){
+	puSanity(ini,"puBoris3D1KE",3,1);
+	return puBoris3D1KE;
+}
+void puBoris3D1KE(Population *pop, const Grid *E, double fraction){
 
 	int nSpecies = pop->nSpecies;
-	int nDims = 3; // pop->nDims; // hard-coding allows compiler to replace by value
-	double *pos = pop->pos;
-	double *vel = pop->vel;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
 
 	double *kinEnergy = pop->kinEnergy;
 	double *mass = pop->mass;
@@ -427,48 +935,59 @@ void puBoris3D1KE(Population *pop, Grid *E, const double *T, const double *S){
 
 	for(int s=0;s<nSpecies;s++){
 
-		gMul(E, pop->charge[s]/pop->mass[s]);
+		double factor = fraction*pop->charge[s]/pop->mass[s];
 
-		long int pStart = pop->iStart[s]*nDims;
-		long int pStop = pop->iStop[s]*nDims;
+		long int iStart = pop->iStart[s];
+		long int iStop = pop->iStop[s];
 
-		kinEnergy[s]=0;
+		double tx = pop->T[3*s], ty = pop->T[3*s+1], tz = pop->T[3*s+2];
+		double sx = pop->S[3*s], sy = pop->S[3*s+1], sz = pop->S[3*s+2];
 
-		for(long int p=pStart;p<pStop;p+=nDims){
-			double dv[3], vPrime[3];
-			puInterp3D1(dv,&pos[p],val,sizeProd);
+		double velSquared = 0;
 
-			// Add half the acceleration (becomes v minus in B&L notation)
-			for(int d=0;d<nDims;d++) vel[p+d] += 0.5*dv[d];
+		#pragma omp parallel for simd reduction(+:velSquared) if(iStop-iStart >= OMP_MIN_NODES) schedule(static)
+		for(long int i=iStart;i<iStop;i++){
+			long int p = 3*i;
 
-			// Rotate
-			memcpy(vPrime,vel,3*sizeof(*vPrime));
-			addCross(vel,&T[3*s],vPrime); // vPrime is now v prime
-			addCross(vPrime,&S[3*s],vel); // vel is now v plus (B&L)
+			double dvx, dvy, dvz;
+			puInterp3D1Scalar(&dvx,&dvy,&dvz,pos[p],pos[p+1],pos[p+2],val,sizeProd);
+			dvx *= factor;
+			dvy *= factor;
+			dvz *= factor;
 
-			// Compute energy
-			double velSquared = 0;
-			for(int d=0;d<nDims;d++){
-				velSquared += pow(vel[p+d],2);
-			}
-			kinEnergy[s]+=velSquared;
+			// Add half the acceleration (becomes v minus in B&L notation)
+			double vx = vel[p]   + 0.5*dvx;
+			double vy = vel[p+1] + 0.5*dvy;
+			double vz = vel[p+2] + 0.5*dvz;
+
+			// Rotate (v prime, and then v plus in B&L notation)
+			double px = vx + (vy*tz-vz*ty);
+			double py = vy + (vz*tx-vx*tz);
+			double pz = vz + (vx*ty-vy*tx);
+			vx += py*sz-pz*sy;
+			vy += pz*sx-px*sz;
+			vz += px*sy-py*sx;
+
+			// Compute energy. Subtracting (dv/2)^2 makes it equal to that of
+			// puAcc3D1KE() when there is no B-field.
+			velSquared += vx*vx + vy*vy + vz*vz
+						- 0.25*(dvx*dvx + dvy*dvy + dvz*dvz);
 
 			// Add half the acceleration
-			for(int d=0;d<nDims;d++) vel[p+d] += 0.5*dv[d];
+			vel[p]   = vx + 0.5*dvx;
+			vel[p+1] = vy + 0.5*dvy;
+			vel[p+2] = vz + 0.5*dvz;
 		}
 
-		kinEnergy[s]*=0.5*mass[s];
-
-		gMul(E, pop->mass[s]/pop->charge[s]);
+		kinEnergy[s] = 0.5*mass[s]*velSquared;
 	}
 
 }
 
-void puGet3DRotationParameters(dictionary *ini, double *T, double *S){
+void puGet3DRotationParameters(const dictionary *ini, double *T, double *S){
 
-	int nDims = iniGetInt(ini,"grid:nDims");
-	int nSpecies = iniGetInt(ini,"grid:nSpecies");
-	double *BExt = iniGetDoubleArr(ini,"fields:BExt",nDims);
+	int nSpecies = iniGetInt(ini,"population:nSpecies");
+	double *BExt = iniGetDoubleArr(ini,"fields:BExt",3);
 	double *charge = iniGetDoubleArr(ini,"population:charge",nSpecies);
 	double *mass = iniGetDoubleArr(ini,"population:mass",nSpecies);
 
@@ -484,6 +1003,10 @@ void puGet3DRotationParameters(dictionary *ini, double *T, double *S){
 			S[3*s+p] = mul*T[3*s+p];
 		}
 	}
+
+	free(BExt);
+	free(charge);
+	free(mass);
 }
 
 
@@ -508,7 +1031,7 @@ void puDistr3D1(const Population *pop, Grid *rho){
 
 		for(int i=iStart;i<iStop;i++){
 
-			double *pos = &pop->pos[3*i];
+			popFloat *pos = &pop->pos[3*i];
 
 			// Integer parts of position
 			int j = (int) pos[0];
@@ -553,24 +1076,21 @@ void puDistr3D1(const Population *pop, Grid *rho){
 
 }
 
-funPtr puDistrND1_set(dictionary *ini){
-	puSanity(ini,"puDistrND1",0,1);
-	return puDistrND1;
+funPtr puDistr3D1Weighted_set(dictionary *ini){
+	puSanity(ini,"puDistr3D1Weighted",3,1);
+	if(iniGetInt(ini,"population:mergeInterval")<=0)
+		msg(ERROR,"puDistr3D1Weighted requires population:mergeInterval>0");
+	return puDistr3D1Weighted;
 }
-void puDistrND1(const Population *pop, Grid *rho){
+void puDistr3D1Weighted(const Population *pop, Grid *rho){
 
 	gZero(rho);
-
-	int nDims = pop->nDims;
 	double *val = rho->val;
 	long int *sizeProd = rho->sizeProd;
+	const popFloat *weight = pop->weight;
 
 	int nSpecies = pop->nSpecies;
 
-	int *integer = malloc(nDims*sizeof(*integer));
-	double *decimal = malloc(nDims*sizeof(*decimal));
-	double *complement = malloc(nDims*sizeof(*complement));
-
 	for(int s=0;s<nSpecies;s++){
 
 		gMul(rho, 1.0/pop->charge[s]);
@@ -578,21 +1098,121 @@ void puDistrND1(const Population *pop, Grid *rho){
 		long int iStart = pop->iStart[s];
 		long int iStop = pop->iStop[s];
 
-		for(int i=iStart;i<iStop;i++){
-
-			double *pos = &pop->pos[nDims*i];
+		for(long int i=iStart;i<iStop;i++){
 
-			long int p = 0;
+			popFloat *pos = &pop->pos[3*i];
+			double w = weight[i];
 
-			for(int d=0;d<nDims;d++){
-				integer[d] = (int) pos[d];
-				decimal[d] = pos[d] - integer[d];
-				complement[d] = 1 - decimal[d];
+			int j = (int) pos[0];
+			int k = (int) pos[1];
+			int l = (int) pos[2];
 
-				p += integer[d]*sizeProd[d+1];
-			}
+			double x = pos[0]-j;
+			double y = pos[1]-k;
+			double z = pos[2]-l;
+			double xcomp = 1-x;
+			double ycomp = 1-y;
+			double zcomp = 1-z;
 
-			puDistrND1Inner(val,p,&sizeProd[nDims],sizeProd[1],&decimal[nDims-1],&complement[nDims-1],1);
+			long int p 		= j + k*sizeProd[2] + l*sizeProd[3];
+			long int pj 	= p + 1;
+			long int pk 	= p + sizeProd[2];
+			long int pjk 	= pk + 1;
+			long int pl 	= p + sizeProd[3];
+			long int pjl 	= pl + 1;
+			long int pkl 	= pl + sizeProd[2];
+			long int pjkl 	= pkl + 1;
+
+			val[p] 		+= w*xcomp*ycomp*zcomp;
+			val[pj]		+= w*x    *ycomp*zcomp;
+			val[pk]		+= w*xcomp*y    *zcomp;
+			val[pjk]	+= w*x    *y    *zcomp;
+			val[pl]     += w*xcomp*ycomp*z    ;
+			val[pjl]	+= w*x    *ycomp*z    ;
+			val[pkl]	+= w*xcomp*y    *z    ;
+			val[pjkl]	+= w*x    *y    *z    ;
+		}
+
+		gMul(rho, pop->charge[s]);
+	}
+}
+
+funPtr puDistr3D1SoA_set(dictionary *ini){
+	puSanity(ini,"puDistr3D1SoA",3,1);
+	return puDistr3D1SoA;
+}
+void puDistr3D1SoA(const Population *pop, Grid *rho){
+
+	gZero(rho);
+	double *val = rho->val;
+	long int *sizeProd = rho->sizeProd;
+
+	int nSpecies = pop->nSpecies;
+
+	for(int s=0;s<nSpecies;s++){
+
+		double charge = pop->charge[s];
+
+		long int iStart = pop->iStart[s];
+		long int nAlloc = pop->iStart[s+1]-iStart;
+		long int nParticles = pop->iStop[s]-iStart;
+
+		const popFloat *x = &pop->pos[3*iStart];
+		const popFloat *y = &x[nAlloc];
+		const popFloat *z = &y[nAlloc];
+
+		// Scattering cannot be vectorized since particles may share nodes
+		for(long int i=0;i<nParticles;i++){
+			popFloat pos[3] = {x[i], y[i], z[i]};
+			puDeposit3D1(val,pos,sizeProd,charge);
+		}
+	}
+}
+
+funPtr puDistrND1_set(dictionary *ini){
+	puSanity(ini,"puDistrND1",0,1);
+	int nDims = iniGetInt(ini,"grid:nDims");
+	if(nDims==1) return puDistr1D1;
+	if(nDims==2) return puDistr2D1;
+	if(nDims==3) return puDistr3D1;
+	return puDistrND1;
+}
+void puDistrND1(const Population *pop, Grid *rho){
+
+	gZero(rho);
+
+	int nDims = pop->nDims;
+	double *val = rho->val;
+	long int *sizeProd = rho->sizeProd;
+
+	int nSpecies = pop->nSpecies;
+
+	int *integer = malloc(nDims*sizeof(*integer));
+	double *decimal = malloc(nDims*sizeof(*decimal));
+	double *complement = malloc(nDims*sizeof(*complement));
+
+	for(int s=0;s<nSpecies;s++){
+
+		gMul(rho, 1.0/pop->charge[s]);
+
+		long int iStart = pop->iStart[s];
+		long int iStop = pop->iStop[s];
+
+		for(int i=iStart;i<iStop;i++){
+
+			popFloat *pos = &pop->pos[nDims*i];
+
+			long int p = 0;
+
+			for(int d=0;d<nDims;d++){
+				integer[d] = (int) pos[d];
+				decimal[d] = pos[d] - integer[d];
+				complement[d] = 1 - decimal[d];
+
+				p += integer[d]*sizeProd[d+1];
+			}
+
+			puDistrND1Inner(val,p,&sizeProd[nDims],sizeProd[1],&decimal[nDims-1],&complement[nDims-1],1);
 
 		}
 
@@ -621,6 +1241,10 @@ static void puDistrND1Inner(	double *val, long int p, const long int *mul,
 
 funPtr puDistrND0_set(dictionary *ini){
 	puSanity(ini,"puDistrND0",0,0);
+	int nDims = iniGetInt(ini,"grid:nDims");
+	if(nDims==1) return puDistr1D0;
+	if(nDims==2) return puDistr2D0;
+	if(nDims==3) return puDistr3D0;
 	return puDistrND0;
 }
 void puDistrND0(const Population *pop, Grid *rho){
@@ -642,7 +1266,7 @@ void puDistrND0(const Population *pop, Grid *rho){
 
 		for(int i=iStart;i<iStop;i++){
 
-			double *pos = &pop->pos[nDims*i];
+			popFloat *pos = &pop->pos[nDims*i];
 
 			long int p = 0;
 
@@ -659,6 +1283,110 @@ void puDistrND0(const Population *pop, Grid *rho){
 	}
 }
 
+funPtr puDistr3D1Threaded_set(dictionary *ini){
+	puSanity(ini,"puDistr3D1Threaded",3,1);
+	return puDistr3D1Threaded;
+}
+void puDistr3D1Threaded(const Population *pop, Grid *rho){
+
+	int nSpecies = pop->nSpecies;
+	double *charge = pop->charge;
+	long int *sizeProd = rho->sizeProd;
+
+	int nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+
+	double **tiles = puAllocTiles(rho,nThreads);
+
+	#pragma omp parallel num_threads(nThreads)
+	{
+		int t = 0;
+#ifdef _OPENMP
+		t = omp_get_thread_num();
+#endif
+		double *tile = tiles[t];
+
+		for(int s=0;s<nSpecies;s++){
+
+			long int iStart = pop->iStart[s];
+			long int iStop = pop->iStop[s];
+			double q = charge[s];
+
+			#pragma omp for schedule(static)
+			for(long int i=iStart;i<iStop;i++){
+				puDeposit3D1(tile,&pop->pos[3*i],sizeProd,q);
+			}
+		}
+	}
+
+	puReduceTiles(tiles,rho,nThreads);
+}
+
+funPtr puDistrND1Threaded_set(dictionary *ini){
+	puSanity(ini,"puDistrND1Threaded",0,1);
+	return puDistrND1Threaded;
+}
+void puDistrND1Threaded(const Population *pop, Grid *rho){
+
+	int nDims = pop->nDims;
+	int nSpecies = pop->nSpecies;
+	double *charge = pop->charge;
+	long int *sizeProd = rho->sizeProd;
+
+	int nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+
+	double **tiles = puAllocTiles(rho,nThreads);
+
+	#pragma omp parallel num_threads(nThreads)
+	{
+		int t = 0;
+#ifdef _OPENMP
+		t = omp_get_thread_num();
+#endif
+		double *tile = tiles[t];
+
+		int *integer = malloc(nDims*sizeof(*integer));
+		double *decimal = malloc(nDims*sizeof(*decimal));
+		double *complement = malloc(nDims*sizeof(*complement));
+
+		for(int s=0;s<nSpecies;s++){
+
+			long int iStart = pop->iStart[s];
+			long int iStop = pop->iStop[s];
+			double q = charge[s];
+
+			#pragma omp for schedule(static)
+			for(long int i=iStart;i<iStop;i++){
+
+				popFloat *pos = &pop->pos[nDims*i];
+
+				long int p = 0;
+
+				for(int d=0;d<nDims;d++){
+					integer[d] = (int) pos[d];
+					decimal[d] = pos[d] - integer[d];
+					complement[d] = 1 - decimal[d];
+
+					p += integer[d]*sizeProd[d+1];
+				}
+
+				puDistrND1Inner(tile,p,&sizeProd[nDims],sizeProd[1],&decimal[nDims-1],&complement[nDims-1],q);
+			}
+		}
+
+		free(integer);
+		free(decimal);
+		free(complement);
+	}
+
+	puReduceTiles(tiles,rho,nThreads);
+}
+
 /******************************************************************************
  * MIGRATION FUNCTIONS (TO BE MOVED TO SEPARATE MODULE)
  *****************************************************************************/
@@ -667,7 +1395,7 @@ void puDistrND0(const Population *pop, Grid *rho){
 void puBndIdMigrants3D(Population *pop, MpiInfo *mpiInfo){
 
 	int nSpecies = pop->nSpecies;
-	double *pos = pop->pos;
+	popFloat *pos = pop->pos;
 	double *thresholds = mpiInfo->thresholds;
 	int neighborhoodCenter = mpiInfo->neighborhoodCenter;
 	long int *nEmigrants = mpiInfo->nEmigrants;
@@ -716,7 +1444,7 @@ void puBndIdMigrantsND(Population *pop, MpiInfo *mpiInfo){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
-	double *pos = pop->pos;
+	popFloat *pos = pop->pos;
 	double *thresholds = mpiInfo->thresholds;
 	int neighborhoodCenter = mpiInfo->neighborhoodCenter;
 	long int *nEmigrants = mpiInfo->nEmigrants;
@@ -755,17 +1483,18 @@ void puBndIdMigrantsND(Population *pop, MpiInfo *mpiInfo){
 }
 
 // Works
-// TODO: Add fault-handling in case of too small "emigrants" buffer
 funPtr puExtractEmigrants3D_set(const dictionary *ini){
 	int nDims = iniGetInt(ini, "grid:nDims");
 	if(nDims!=3) msg(ERROR, "puExtractEmigrants3D requires grid:nDims=3");
+	if(pGetLayout(ini)!=AOS)
+		msg(ERROR, "puExtractEmigrants3D requires population:layout=AoS");
 	return puExtractEmigrants3D;
 }
 void puExtractEmigrants3D(Population *pop, MpiInfo *mpiInfo){
 
 	int nSpecies = pop->nSpecies;
-	double *pos = pop->pos;
-	double *vel = pop->vel;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
 	double *thresholds = mpiInfo->thresholds;
 	const int neighborhoodCenter = 13;
 	long int *nEmigrants = mpiInfo->nEmigrants;
@@ -773,7 +1502,7 @@ void puExtractEmigrants3D(Population *pop, MpiInfo *mpiInfo){
 
 	// By using the dummy to hold data we won't lose track of the beginning of
 	// the arrays when incrementing the pointer
-	double **emigrants = mpiInfo->emigrantsDummy;
+	popFloat **emigrants = mpiInfo->emigrantsDummy;
 	for(int ne=0;ne<nNeighbors;ne++){
 		emigrants[ne] = mpiInfo->emigrants[ne];
 	}
@@ -807,6 +1536,7 @@ void puExtractEmigrants3D(Population *pop, MpiInfo *mpiInfo){
 			// 	msg(STATUS,"x1: %f",x);
 
 			if(ne!=neighborhoodCenter){
+				reserveEmigrant(mpiInfo,ne);
 				*(emigrants[ne]++) = x;
 				*(emigrants[ne]++) = y;
 				*(emigrants[ne]++) = z;
@@ -836,17 +1566,265 @@ void puExtractEmigrants3D(Population *pop, MpiInfo *mpiInfo){
 	}
 }
 
+funPtr puExtractEmigrants3DShell_set(const dictionary *ini){
+	int nDims = iniGetInt(ini, "grid:nDims");
+	if(nDims!=3) msg(ERROR, "puExtractEmigrants3DShell requires grid:nDims=3");
+	if(pGetLayout(ini)!=AOS)
+		msg(ERROR, "puExtractEmigrants3DShell requires population:layout=AoS");
+	if(iniGetInt(ini,"population:sortInterval")<=0)
+		msg(ERROR, "puExtractEmigrants3DShell requires population:sortInterval>0");
+	if(iniGetDouble(ini,"population:maxVel")>1)
+		msg(ERROR, "puExtractEmigrants3DShell requires population:maxVel<=1");
+
+	// A sub-cycled specie moves several cells per push
+	int nSpecies = iniGetInt(ini,"population:nSpecies");
+	int *subcycles = iniGetIntArr(ini,"population:subcycles",nSpecies);
+	for(int s=0;s<nSpecies;s++)
+		if(subcycles[s]!=1)
+			msg(ERROR, "puExtractEmigrants3DShell requires population:subcycles=1");
+	free(subcycles);
+
+	return puExtractEmigrants3DShell;
+}
+void puExtractEmigrants3DShell(Population *pop, MpiInfo *mpiInfo){
+
+	int nSpecies = pop->nSpecies;
+	double *thresholds = mpiInfo->thresholds;
+	long int *nEmigrants = mpiInfo->nEmigrants;
+	int nNeighbors = mpiInfo->nNeighbors;
+
+	popFloat **emigrants = mpiInfo->emigrantsDummy;
+	for(int ne=0;ne<nNeighbors;ne++){
+		emigrants[ne] = mpiInfo->emigrants[ne];
+	}
+	alSetAll(nEmigrants,nSpecies*nNeighbors,0);
+
+	// Each push since pSort() may have moved a particle one cell closer to
+	// the thresholds, so only cells up to age cells inside of them need to be
+	// scanned (all of them if pSort() hasn't been called yet).
+	int age = ++pop->sortAge;
+	long int *cellProd = pop->cellProd;
+	long int nx = cellProd ? cellProd[1] : 0;
+	long int ny = cellProd ? cellProd[2]/cellProd[1] : 0;
+	long int nz = cellProd ? cellProd[3]/cellProd[2] : 0;
+	long int nCells = cellProd ? cellProd[3] : 0;
+
+	long int lower[3], upper[3];
+	for(int d=0;d<3;d++){
+		lower[d] = (long int)floor(thresholds[d])+age+1;
+		upper[d] = (long int)floor(thresholds[3+d])-age-1;
+	}
+
+	for(int s=0;s<nSpecies;s++){
+
+		long int iStart = pop->iStart[s];
+		long int sortedStop = pop->sortedStop[s];
+		if(sortedStop>pop->iStop[s]) sortedStop = pop->iStop[s];
+
+		// Particles not in cell order
+		for(long int i=sortedStop;i<pop->iStop[s];i++)
+			extractIfEmigrant(pop,mpiInfo,s,i);
+
+		long int nDisplaced = pop->nDisplaced;
+		for(long int k=0;k<nDisplaced;k++){
+			long int i = pop->displaced[k];
+			if(i>=iStart && i<pop->iStop[s]) extractIfEmigrant(pop,mpiInfo,s,i);
+		}
+
+		// Particles in cells near the thresholds, row by row along x
+		if(sortedStop>iStart){
+			long int *cellStart = &pop->cellStart[s*(nCells+1)];
+			for(long int z=0;z<nz;z++){
+				for(long int y=0;y<ny;y++){
+
+					long int row = nx*(y+ny*z);
+					int inShell =	y<lower[1] || y>=upper[1] ||
+									z<lower[2] || z>=upper[2] ||
+									lower[0]>=upper[0];
+
+					long int ranges[2][2] = {
+						{ cellStart[row], cellStart[row+nx] },
+						{ 0, 0 }
+					};
+					if(!inShell){
+						ranges[0][1] = cellStart[row+lower[0]];
+						ranges[1][0] = cellStart[row+upper[0]];
+						ranges[1][1] = cellStart[row+nx];
+					}
+
+					for(int r=0;r<2;r++)
+						for(long int i=ranges[r][0];i<ranges[r][1] && i<pop->iStop[s];i++)
+							extractIfEmigrant(pop,mpiInfo,s,i);
+				}
+			}
+		}
+
+		// Immigrants are appended after iStop
+		if(pop->sortedStop[s]>pop->iStop[s]) pop->sortedStop[s] = pop->iStop[s];
+	}
+}
+
+funPtr puExtractEmigrants3DWeighted_set(const dictionary *ini){
+	int nDims = iniGetInt(ini, "grid:nDims");
+	if(nDims!=3) msg(ERROR, "puExtractEmigrants3DWeighted requires grid:nDims=3");
+	if(pGetLayout(ini)!=AOS)
+		msg(ERROR, "puExtractEmigrants3DWeighted requires population:layout=AoS");
+	if(iniGetInt(ini,"population:mergeInterval")<=0)
+		msg(ERROR,"puExtractEmigrants3DWeighted requires population:mergeInterval>0");
+	return puExtractEmigrants3DWeighted;
+}
+void puExtractEmigrants3DWeighted(Population *pop, MpiInfo *mpiInfo){
+
+	int nSpecies = pop->nSpecies;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
+	popFloat *weight = pop->weight;
+	double *thresholds = mpiInfo->thresholds;
+	const int neighborhoodCenter = 13;
+	long int *nEmigrants = mpiInfo->nEmigrants;
+	int nNeighbors = mpiInfo->nNeighbors;
+
+	popFloat **emigrants = mpiInfo->emigrantsDummy;
+	for(int ne=0;ne<nNeighbors;ne++){
+		emigrants[ne] = mpiInfo->emigrants[ne];
+	}
+	alSetAll(nEmigrants,nSpecies*nNeighbors,0);
+
+	double lx = thresholds[0];
+	double ly = thresholds[1];
+	double lz = thresholds[2];
+	double ux = thresholds[3];
+	double uy = thresholds[4];
+	double uz = thresholds[5];
+
+	for(int s=0;s<nSpecies;s++){
+
+		long int iStart = pop->iStart[s];
+		long int iStop = pop->iStop[s];
+
+		for(long int i=iStart;i<iStop;i++){
+			long int p = 3*i;
+			double x = pos[p];
+			double y = pos[p+1];
+			double z = pos[p+2];
+			int nx = - (x<lx) + (x>=ux);
+			int ny = - (y<ly) + (y>=uy);
+			int nz = - (z<lz) + (z>=uz);
+			int ne = neighborhoodCenter + nx + 3*ny + 9*nz;
+
+			if(ne!=neighborhoodCenter){
+				// Same as puExtractEmigrants3D() but the weight goes along
+				reserveEmigrant(mpiInfo,ne);
+				*(emigrants[ne]++) = x;
+				*(emigrants[ne]++) = y;
+				*(emigrants[ne]++) = z;
+				*(emigrants[ne]++) = vel[p];
+				*(emigrants[ne]++) = vel[p+1];
+				*(emigrants[ne]++) = vel[p+2];
+				*(emigrants[ne]++) = weight[i];
+				nEmigrants[ne*nSpecies+s]++;
+
+				long int last = iStop-1;
+				for(int d=0;d<3;d++){
+					pos[p+d] = pos[3*last+d];
+					vel[p+d] = vel[3*last+d];
+				}
+				weight[i] = weight[last];
+
+				iStop--;
+				i--;
+			}
+		}
+
+		pop->iStop[s] = iStop;
+	}
+}
+
+funPtr puExtractEmigrants3DSoA_set(const dictionary *ini){
+	int nDims = iniGetInt(ini, "grid:nDims");
+	if(nDims!=3) msg(ERROR, "puExtractEmigrants3DSoA requires grid:nDims=3");
+	if(pGetLayout(ini)!=SOA)
+		msg(ERROR, "puExtractEmigrants3DSoA requires population:layout=SoA");
+	return puExtractEmigrants3DSoA;
+}
+void puExtractEmigrants3DSoA(Population *pop, MpiInfo *mpiInfo){
+
+	int nSpecies = pop->nSpecies;
+	double *thresholds = mpiInfo->thresholds;
+	const int neighborhoodCenter = 13;
+	long int *nEmigrants = mpiInfo->nEmigrants;
+	int nNeighbors = mpiInfo->nNeighbors;
+
+	popFloat **emigrants = mpiInfo->emigrantsDummy;
+	for(int ne=0;ne<nNeighbors;ne++){
+		emigrants[ne] = mpiInfo->emigrants[ne];
+	}
+	alSetAll(nEmigrants,nSpecies*nNeighbors,0);
+
+	double lx = thresholds[0];
+	double ly = thresholds[1];
+	double lz = thresholds[2];
+	double ux = thresholds[3];
+	double uy = thresholds[4];
+	double uz = thresholds[5];
+
+	for(int s=0;s<nSpecies;s++){
+
+		long int iStart = pop->iStart[s];
+		long int nAlloc = pop->iStart[s+1]-iStart;
+		long int nParticles = pop->iStop[s]-iStart;
+
+		popFloat *x = &pop->pos[3*iStart];
+		popFloat *y = &x[nAlloc];
+		popFloat *z = &y[nAlloc];
+		popFloat *vx = &pop->vel[3*iStart];
+		popFloat *vy = &vx[nAlloc];
+		popFloat *vz = &vy[nAlloc];
+
+		for(long int i=0;i<nParticles;i++){
+			int nx = - (x[i]<lx) + (x[i]>=ux);
+			int ny = - (y[i]<ly) + (y[i]>=uy);
+			int nz = - (z[i]<lz) + (z[i]>=uz);
+			int ne = neighborhoodCenter + nx + 3*ny + 9*nz;
+
+			if(ne!=neighborhoodCenter){
+				// The emigrant buffers are interleaved regardless of layout
+				reserveEmigrant(mpiInfo,ne);
+				*(emigrants[ne]++) = x[i];
+				*(emigrants[ne]++) = y[i];
+				*(emigrants[ne]++) = z[i];
+				*(emigrants[ne]++) = vx[i];
+				*(emigrants[ne]++) = vy[i];
+				*(emigrants[ne]++) = vz[i];
+				nEmigrants[ne*nSpecies+s]++;
+
+				nParticles--;
+				x[i]  = x[nParticles];
+				y[i]  = y[nParticles];
+				z[i]  = z[nParticles];
+				vx[i] = vx[nParticles];
+				vy[i] = vy[nParticles];
+				vz[i] = vz[nParticles];
+				i--;
+			}
+		}
+
+		pop->iStop[s] = iStart+nParticles;
+	}
+}
+
 // Works
-// TODO: Add fault-handling in case of too small "emigrants" buffer
 funPtr puExtractEmigrantsND_set(const dictionary *ini){
+	if(pGetLayout(ini)!=AOS)
+		msg(ERROR, "puExtractEmigrantsND requires population:layout=AoS");
 	return puExtractEmigrantsND;
 }
 void puExtractEmigrantsND(Population *pop, MpiInfo *mpiInfo){
 
 	int nSpecies = pop->nSpecies;
 	int nDims = pop->nDims;
-	double *pos = pop->pos;
-	double *vel = pop->vel;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
 	double *thresholds = mpiInfo->thresholds;
 	int neighborhoodCenter = mpiInfo->neighborhoodCenter;
 	long int *nEmigrants = mpiInfo->nEmigrants;
@@ -854,7 +1832,7 @@ void puExtractEmigrantsND(Population *pop, MpiInfo *mpiInfo){
 
 	// By using the dummy to hold data we won't lose track of the beginning of
 	// the arrays by, say, migrants[neigh]++.
-	double **emigrants = mpiInfo->emigrantsDummy;
+	popFloat **emigrants = mpiInfo->emigrantsDummy;
 	for(int ne=0;ne<nNeighbors;ne++){
 		emigrants[ne] = mpiInfo->emigrants[ne];
 	}
@@ -877,6 +1855,7 @@ void puExtractEmigrantsND(Population *pop, MpiInfo *mpiInfo){
 				// ghost layers than necessary)
 			}
 			if(ne!=neighborhoodCenter){
+				reserveEmigrant(mpiInfo,ne);
 				for(int d=0;d<nDims;d++) *(emigrants[ne]++) = pos[p+d];
 				for(int d=0;d<nDims;d++) *(emigrants[ne]++) = vel[p+d];
 				nEmigrants[ne*nSpecies+s]++;
@@ -891,8 +1870,137 @@ void puExtractEmigrantsND(Population *pop, MpiInfo *mpiInfo){
 	}
 }
 
+/*
+ * Migrant buffers are resized automatically. They grow (to twice what's needed)
+ * when they overflow, and every MIGRANT_SHRINK_INTERVAL migrations those using
+ * less than a quarter of their size since the last time are shrunk to twice
+ * their high-water mark (but not below MIGRANT_MIN_ALLOC). grid:nEmigrantsAlloc
+ * hence only specifies the initial size.
+ */
+#define MIGRANT_SHRINK_INTERVAL 100
+#define MIGRANT_MIN_ALLOC 16
+
+static void resizeMigrants(popFloat **buffer, long int *nAlloc, long int nNew, MpiInfo *mpiInfo){
+
+	*buffer = realloc(*buffer,mpiInfo->migrantSize*nNew*sizeof(**buffer));
+	if(*buffer==NULL) msg(ERROR|ALL,"Could not resize migrant buffer to %li particles",nNew);
+	*nAlloc = nNew;
+	mpiInfo->nResizes++;
+}
+
+static void growEmigrants(MpiInfo *mpiInfo, int ne){
+
+	long int used = mpiInfo->emigrantsDummy[ne]-mpiInfo->emigrants[ne];
+	long int nNew = 2*(mpiInfo->nEmigrantsAlloc[ne]+1);
+	resizeMigrants(&mpiInfo->emigrants[ne],&mpiInfo->nEmigrantsAlloc[ne],nNew,mpiInfo);
+	mpiInfo->emigrantsDummy[ne] = mpiInfo->emigrants[ne]+used;
+}
+
+static inline void reserveEmigrant(MpiInfo *mpiInfo, int ne){
+
+	long int size = mpiInfo->migrantSize;
+	long int used = mpiInfo->emigrantsDummy[ne]-mpiInfo->emigrants[ne];
+	if(used+size>size*mpiInfo->nEmigrantsAlloc[ne]) growEmigrants(mpiInfo,ne);
+}
+
+static inline void extractIfEmigrant(Population *pop, MpiInfo *mpiInfo,
+									 int s, long int i){
+
+	int nSpecies = pop->nSpecies;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
+	double *thresholds = mpiInfo->thresholds;
+	const int neighborhoodCenter = 13;
+	popFloat **emigrants = mpiInfo->emigrantsDummy;
+
+	while(i<pop->iStop[s]){
+
+		long int p = 3*i;
+		double x = pos[p];
+		double y = pos[p+1];
+		double z = pos[p+2];
+		int nx = - (x<thresholds[0]) + (x>=thresholds[3]);
+		int ny = - (y<thresholds[1]) + (y>=thresholds[4]);
+		int nz = - (z<thresholds[2]) + (z>=thresholds[5]);
+		int ne = neighborhoodCenter + nx + 3*ny + 9*nz;
+
+		if(ne==neighborhoodCenter) return;
+
+		reserveEmigrant(mpiInfo,ne);
+		*(emigrants[ne]++) = x;
+		*(emigrants[ne]++) = y;
+		*(emigrants[ne]++) = z;
+		*(emigrants[ne]++) = vel[p];
+		*(emigrants[ne]++) = vel[p+1];
+		*(emigrants[ne]++) = vel[p+2];
+		mpiInfo->nEmigrants[ne*nSpecies+s]++;
+
+		long int pLast = 3*(--pop->iStop[s]);
+		pos[p]   = pos[pLast];
+		pos[p+1] = pos[pLast+1];
+		pos[p+2] = pos[pLast+2];
+		vel[p]   = vel[pLast];
+		vel[p+1] = vel[pLast+1];
+		vel[p+2] = vel[pLast+2];
+
+		// The replacement is no longer where pSort() put it
+		if(i<pop->iStop[s] && i<pop->sortedStop[s]){
+			if(pop->nDisplaced==pop->nDisplacedAlloc){
+				pop->nDisplacedAlloc = 2*pop->nDisplacedAlloc+1024;
+				pop->displaced = realloc(pop->displaced,
+							pop->nDisplacedAlloc*sizeof(*pop->displaced));
+			}
+			pop->displaced[pop->nDisplaced++] = i;
+		}
+	}
+}
+
+// To be called before receiving nImmigrants from neighbor ne
+static inline void reserveImmigrants(MpiInfo *mpiInfo, int ne, long int nImmigrants){
+
+	if(nImmigrants>mpiInfo->nImmigrantsHighWater[ne])
+		mpiInfo->nImmigrantsHighWater[ne] = nImmigrants;
+
+	if(nImmigrants>mpiInfo->nImmigrantsAlloc[ne])
+		resizeMigrants(&mpiInfo->immigrants[ne],&mpiInfo->nImmigrantsAlloc[ne],2*nImmigrants,mpiInfo);
+}
+
+// Records the number of emigrants and shrinks buffers where possible. To be
+// called when all migrants are sent and received.
+static void updateMigrantBuffers(MpiInfo *mpiInfo){
+
+	int nSpecies = mpiInfo->nSpecies;
+	int nNeighbors = mpiInfo->nNeighbors;
+
+	mpiInfo->nMigrations++;
+	int shrink = mpiInfo->nMigrations%MIGRANT_SHRINK_INTERVAL==0;
+
+	for(int ne=0;ne<nNeighbors;ne++){
+		if(ne==mpiInfo->neighborhoodCenter) continue;
+
+		long int nEmigrants = alSum(&mpiInfo->nEmigrants[ne*nSpecies],nSpecies);
+		mpiInfo->nEmigrantsSum[ne] += nEmigrants;
+		if(nEmigrants>mpiInfo->nEmigrantsPeak[ne]) mpiInfo->nEmigrantsPeak[ne] = nEmigrants;
+		if(nEmigrants>mpiInfo->nEmigrantsHighWater[ne]) mpiInfo->nEmigrantsHighWater[ne] = nEmigrants;
+
+		if(shrink){
+			long int nNew = 2*mpiInfo->nEmigrantsHighWater[ne];
+			if(nNew<MIGRANT_MIN_ALLOC) nNew = MIGRANT_MIN_ALLOC;
+			if(2*nNew<mpiInfo->nEmigrantsAlloc[ne])
+				resizeMigrants(&mpiInfo->emigrants[ne],&mpiInfo->nEmigrantsAlloc[ne],nNew,mpiInfo);
+
+			nNew = 2*mpiInfo->nImmigrantsHighWater[ne];
+			if(nNew<MIGRANT_MIN_ALLOC) nNew = MIGRANT_MIN_ALLOC;
+			if(2*nNew<mpiInfo->nImmigrantsAlloc[ne])
+				resizeMigrants(&mpiInfo->immigrants[ne],&mpiInfo->nImmigrantsAlloc[ne],nNew,mpiInfo);
+
+			mpiInfo->nEmigrantsHighWater[ne] = 0;
+			mpiInfo->nImmigrantsHighWater[ne] = 0;
+		}
+	}
+}
+
 // Works
-// TODO: Add fault-handling in case of too small Population struct
 static inline void exchangeNMigrants(MpiInfo *mpiInfo){
 
 	int nSpecies = mpiInfo->nSpecies;
@@ -909,8 +2017,8 @@ static inline void exchangeNMigrants(MpiInfo *mpiInfo){
 			int reciprocal = puNeighborToReciprocal(ne,mpiInfo->nDims);
 			long int *nEmigrants  = &mpiInfo->nEmigrants[nSpecies*ne];
 			long int *nImmigrants = &mpiInfo->nImmigrants[nSpecies*ne];
-			MPI_Isend(nEmigrants ,nSpecies,MPI_LONG,rank,reciprocal,MPI_COMM_WORLD,&send[ne]);
-			MPI_Irecv(nImmigrants,nSpecies,MPI_LONG,rank,ne        ,MPI_COMM_WORLD,&recv[ne]);
+			MPI_Isend(nEmigrants ,nSpecies,MPI_LONG,rank,reciprocal,mpiInfo->migrateComm,&send[ne]);
+			MPI_Irecv(nImmigrants,nSpecies,MPI_LONG,rank,ne        ,mpiInfo->migrateComm,&recv[ne]);
 		}
 	}
 
@@ -922,20 +2030,30 @@ static inline void exchangeNMigrants(MpiInfo *mpiInfo){
 // Works
 static inline void shiftImmigrants(MpiInfo *mpiInfo, Grid *grid, int ne){
 
-	double *immigrants = mpiInfo->immigrants;
+	popFloat *immigrants = mpiInfo->immigrants[ne];
 	int nSpecies = mpiInfo->nSpecies;
 	long int nImmigrantsTotal = alSum(&mpiInfo->nImmigrants[ne*nSpecies],nSpecies);
 	int nDims = mpiInfo->nDims;
+	int size = mpiInfo->migrantSize;
 
 	for(int d=0;d<nDims;d++){
 		int n = ne%3-1;
 		ne /=3;
 
-		double shift = n*grid->trueSize[d+1];
+		// Immigrants are in the frame of the neighbor they came from, whose
+		// size may differ from this subdomain's (see gBalance())
+		double shift = 0;
+		if(n>0) shift = grid->trueSize[d+1];
+		if(n<0){
+			int *cuts = mpiInfo->cuts[d];
+			int J = mpiInfo->subdomain[d];
+			int JPrev = (J+mpiInfo->nSubdomains[d]-1)%mpiInfo->nSubdomains[d];
+			shift = -(cuts[JPrev+1]-cuts[JPrev]);
+		}
 		for(int i=0;i<nImmigrantsTotal;i++){
-			immigrants[d+2*nDims*i] += shift;
+			immigrants[d+size*i] += shift;
 
-			// double pos = immigrants[d+2*nDims*i];
+			// double pos = immigrants[d+size*i];
 			// if(pos>grid->trueSize[d+1])
 			// 	msg(ERROR,"particle %i skipped two domains");
 
@@ -946,80 +2064,835 @@ static inline void shiftImmigrants(MpiInfo *mpiInfo, Grid *grid, int ne){
 }
 
 // Works
-static inline void importParticles(Population *pop, double *particles, long int *nParticles, int nSpecies){
+static inline void importParticles(Population *pop, popFloat *particles, long int *nParticles, int nSpecies){
 
 	int nDims = pop->nDims;
-	long int *iStop = pop->iStop;
+	int size = 2*nDims + (pop->weight!=NULL);
+	double *particle = malloc(2*nDims*sizeof(*particle));
 
+	// pNew() takes care of the layout of pop. Particles resident on a device
+	// are copied there.
 	for(int s=0;s<nSpecies;s++){
+		pReserve(pop,s,nParticles[s]);
+		long int iFrom = pop->iStop[s];
+		for(int i=0;i<nParticles[s];i++){
+			for(int d=0;d<2*nDims;d++) particle[d] = particles[d];
+			long int iNew = pop->iStop[s];
+			pNew(pop,s,particle,&particle[nDims]);
+			if(pop->weight && pop->iStop[s]>iNew)
+				pop->weight[iNew] = particles[2*nDims];
+			particles += size;
+		}
+		pToDeviceRange(pop,iFrom,pop->iStop[s]);
+	}
 
-		double *pos = &pop->pos[nDims*iStop[s]];
-		double *vel = &pop->vel[nDims*iStop[s]];
+	free(particle);
 
-		for(int i=0;i<nParticles[s];i++){
-			for(int d=0;d<nDims;d++) *(pos++) = *(particles++);
-			for(int d=0;d<nDims;d++) *(vel++) = *(particles++);
+}
+
+/*
+ * Creates a datatype for the numbers of migrants of each specie followed by
+ * the migrants themselves, for sending both in one message (as bytes, such that
+ * the receiver can use the length of the message to find the number of
+ * migrants). Addresses are absolute, so use it with MPI_BOTTOM.
+ */
+static MPI_Datatype migrantsType(	long int *nMigrants, popFloat *migrants,
+									int nSpecies, int size){
+
+	long int nMigrantsTotal = alSum(nMigrants,nSpecies);
+
+	int lengths[2] = {	nSpecies*sizeof(*nMigrants),
+						nMigrantsTotal*size*sizeof(*migrants) };
+	MPI_Aint displacements[2];
+	MPI_Get_address(nMigrants,&displacements[0]);
+	MPI_Get_address(migrants,&displacements[1]);
+
+	MPI_Datatype type;
+	MPI_Type_create_hindexed(2,lengths,displacements,MPI_BYTE,&type);
+	MPI_Type_commit(&type);
+
+	return type;
+}
+
+static void puMigrateBeginProbed(MpiInfo *mpiInfo){
+
+	int nSpecies = mpiInfo->nSpecies;
+	int nNeighbors = mpiInfo->nNeighbors;
+	int nDims = mpiInfo->nDims;
+	MPI_Request *send = mpiInfo->send;
+
+	// A message is sent to every neighbor, even when there's no migrants, since
+	// the receiver doesn't know in advance.
+	for(int ne=0;ne<nNeighbors;ne++){
+		if(ne!=mpiInfo->neighborhoodCenter){
+			int rank = puNeighborToRank(mpiInfo,ne);
+			int reciprocal = puNeighborToReciprocal(ne,nDims);
+
+			MPI_Datatype type = migrantsType(	&mpiInfo->nEmigrants[nSpecies*ne],
+												mpiInfo->emigrants[ne],
+												nSpecies, mpiInfo->migrantSize);
+			MPI_Isend(MPI_BOTTOM,1,type,rank,reciprocal,mpiInfo->migrateComm,&send[ne]);
+			MPI_Type_free(&type);
 		}
+	}
+
+	mpiInfo->nPendingImmigrants = nNeighbors-1;
+}
+
+static int puMigrateNextProbed(Population *pop, MpiInfo *mpiInfo, Grid *grid){
 
-		iStop[s] += nParticles[s];
+	int nSpecies = mpiInfo->nSpecies;
+	int nNeighbors = mpiInfo->nNeighbors;
+	int size = mpiInfo->migrantSize;
+
+	if(mpiInfo->nPendingImmigrants==0){
+		MPI_Waitall(nNeighbors,mpiInfo->send,MPI_STATUSES_IGNORE);
+		updateMigrantBuffers(mpiInfo);
+		return -1;
 	}
 
+	MPI_Message message;
+	MPI_Status status;
+	MPI_Mprobe(MPI_ANY_SOURCE,MPI_ANY_TAG,mpiInfo->migrateComm,&message,&status);
+	int ne = status.MPI_TAG;	// Which neighbor it is from equals the tag
+
+	int length;
+	MPI_Get_count(&status,MPI_BYTE,&length);
+	long int nImmigrants = (length-nSpecies*sizeof(long int))/(size*sizeof(popFloat));
+	reserveImmigrants(mpiInfo,ne,nImmigrants);
+
+	// The per-specie numbers are not known until received, but only the total
+	// matters for the length of the type
+	long int *nImmigrantsSpecie = &mpiInfo->nImmigrants[ne*nSpecies];
+	alSetAll(nImmigrantsSpecie,nSpecies,0);
+	nImmigrantsSpecie[0] = nImmigrants;
+	MPI_Datatype type = migrantsType(nImmigrantsSpecie,mpiInfo->immigrants[ne],nSpecies,size);
+	MPI_Mrecv(MPI_BOTTOM,1,type,&message,MPI_STATUS_IGNORE);
+	MPI_Type_free(&type);
+
+	mpiInfo->nPendingImmigrants--;
+
+	shiftImmigrants(mpiInfo,grid,ne);
+	importParticles(pop,mpiInfo->immigrants[ne],nImmigrantsSpecie,nSpecies);
+
+	return ne;
 }
 
-// Works
-static inline void exchangeMigrants(Population *pop, MpiInfo *mpiInfo, Grid *grid){
+void puMigrateBegin(MpiInfo *mpiInfo){
+
+	if(mpiInfo->migration==MIGRATE_PROBED){
+		puMigrateBeginProbed(mpiInfo);
+		return;
+	}
 
 	int nSpecies = mpiInfo->nSpecies;
 	int nNeighbors = mpiInfo->nNeighbors;
-	long int nImmigrantsAlloc = mpiInfo->nImmigrantsAlloc;
 	int nDims = mpiInfo->nDims;
-	double **emigrants = mpiInfo->emigrants;
-	double *immigrants = mpiInfo->immigrants;
-	long int *nImmigrants = mpiInfo->nImmigrants;
+	int size = mpiInfo->migrantSize;
 	MPI_Request *send = mpiInfo->send;
+	MPI_Request *recv = mpiInfo->recv;
 
+	exchangeNMigrants(mpiInfo);
+
+	// Each neighbor has its own buffer such that all messages can be received
+	// simultaneously. Empty messages are not sent at all.
 	for(int ne=0;ne<nNeighbors;ne++){
 		if(ne!=mpiInfo->neighborhoodCenter){
 			int rank = puNeighborToRank(mpiInfo,ne);
 			int reciprocal = puNeighborToReciprocal(ne,nDims);
-			long int *nEmigrants  = &mpiInfo->nEmigrants[nSpecies*ne];
-			long int length = alSum(nEmigrants,nSpecies)*2*nDims;
-			MPI_Isend(emigrants[ne],length,MPI_DOUBLE,rank,reciprocal,MPI_COMM_WORLD,&send[ne]);
+
+			long int nImmigrants = alSum(&mpiInfo->nImmigrants[nSpecies*ne],nSpecies);
+			reserveImmigrants(mpiInfo,ne,nImmigrants);
+			if(nImmigrants>0)
+				MPI_Irecv(mpiInfo->immigrants[ne],nImmigrants*size,POP_MPI_FLOAT,rank,ne,mpiInfo->migrateComm,&recv[ne]);
+
+			long int nEmigrants = alSum(&mpiInfo->nEmigrants[nSpecies*ne],nSpecies);
+			if(nEmigrants>0)
+				MPI_Isend(mpiInfo->emigrants[ne],nEmigrants*size,POP_MPI_FLOAT,rank,reciprocal,mpiInfo->migrateComm,&send[ne]);
 		}
 	}
 
-	// Since "immigrants" is reused for every receive operation MPI_Irecv cannot
-	// be used. However, in order to receive and process whichever comes first
-	// MPI_ANY_SOURCE is used.
-	for(int a=0;a<nNeighbors-1;a++){
+}
+
+int puMigrateNext(Population *pop, MpiInfo *mpiInfo, Grid *grid){
 
-		MPI_Status status;
-		MPI_Recv(immigrants,nImmigrantsAlloc,MPI_DOUBLE,MPI_ANY_SOURCE,MPI_ANY_TAG,MPI_COMM_WORLD,&status);
-		int ne = status.MPI_TAG;	// Which neighbor it is from equals the tag
+	if(mpiInfo->migration==MIGRATE_PROBED)
+		return puMigrateNextProbed(pop,mpiInfo,grid);
+
+	int nNeighbors = mpiInfo->nNeighbors;
+	int nSpecies = mpiInfo->nSpecies;
 
-		// adPrint(mpiInfo->immigrants,6);
-		shiftImmigrants(mpiInfo,grid,ne);
-		// adPrint(mpiInfo->immigrants,6);
-		importParticles(pop,immigrants,&nImmigrants[ne*nSpecies],nSpecies);
+	int ne;
+	MPI_Waitany(nNeighbors,mpiInfo->recv,&ne,MPI_STATUS_IGNORE);
 
+	if(ne==MPI_UNDEFINED){
+		MPI_Waitall(nNeighbors,mpiInfo->send,MPI_STATUSES_IGNORE);
+		updateMigrantBuffers(mpiInfo);
+		return -1;
 	}
 
-	MPI_Waitall(nNeighbors,send,MPI_STATUS_IGNORE);
+	shiftImmigrants(mpiInfo,grid,ne);
+	importParticles(pop,mpiInfo->immigrants[ne],&mpiInfo->nImmigrants[ne*nSpecies],nSpecies);
 
+	return ne;
 }
 
-// Works
 void puMigrate(Population *pop, MpiInfo *mpiInfo, Grid *grid){
 
-	exchangeNMigrants(mpiInfo);
-	exchangeMigrants(pop,mpiInfo,grid);
+	tRegionBegin("migrate");
+	puMigrateBegin(mpiInfo);
+	while(puMigrateNext(pop,mpiInfo,grid)>=0);
+	tRegionEnd("migrate");
+
+}
+
+void puMigrantStats(const MpiInfo *mpiInfo){
+
+	int nNeighbors = mpiInfo->nNeighbors;
+	if(nNeighbors==0 || mpiInfo->nMigrations==0) return;
+
+	long int *peak = malloc(nNeighbors*sizeof(*peak));
+	long int *sum = malloc(nNeighbors*sizeof(*sum));
+	long int *alloc = malloc(nNeighbors*sizeof(*alloc));
+	long int nResizes;
+
+	// Reduced to all, since the rank printing messages needn't be rank 0 in comm
+	MPI_Comm comm = mpiInfo->comm;
+	MPI_Allreduce(mpiInfo->nEmigrantsPeak,peak,nNeighbors,MPI_LONG,MPI_MAX,comm);
+	MPI_Allreduce(mpiInfo->nEmigrantsSum,sum,nNeighbors,MPI_LONG,MPI_SUM,comm);
+	MPI_Allreduce(mpiInfo->nEmigrantsAlloc,alloc,nNeighbors,MPI_LONG,MPI_MAX,comm);
+	MPI_Allreduce(&mpiInfo->nResizes,&nResizes,1,MPI_LONG,MPI_SUM,comm);
+
+	double nSamples = (double)mpiInfo->nMigrations*mpiInfo->mpiSize;
+	msg(STATUS,"Emigrants per subdomain and migration (buffers resized %li times):",nResizes);
+	for(int ne=0;ne<nNeighbors;ne++){
+		if(ne==mpiInfo->neighborhoodCenter) continue;
+		msg(STATUS,"  neighbor %2i: mean %10.1f, peak %8li, allocated %8li",
+			ne,sum[ne]/nSamples,peak[ne],alloc[ne]);
+	}
+
+	free(peak);
+	free(sum);
+	free(alloc);
+}
 
+funPtr puSweepSplit_set(dictionary *ini){
+	return puSweepSplit;
+}
+void puSweepSplit(	Population *pop, Grid *rho, MpiInfo *mpiInfo,
+					void (*extractEmigrants)(), void (*distr)()){
+
+	tRegionBegin("push");
+	puMove(pop);
+	tRegionEnd("push");
+
+	tRegionBegin("extract");
+	extractEmigrants(pop, mpiInfo);
+	tRegionEnd("extract");
+	puMigrate(pop, mpiInfo, rho);
+
+	// Check that no particle resides out-of-bounds (just for debugging)
+	if(chActive()) pPosAssertInLocalFrame(pop, rho);
+
+	tRegionBegin("deposit");
+	distr(pop, rho);
+	tRegionEnd("deposit");
+}
+
+funPtr puSweepFused3D1_set(dictionary *ini){
+	puSanity(ini,"puSweepFused3D1",3,1);
+	return puSweepFused3D1;
+}
+void puSweepFused3D1(	Population *pop, Grid *rho, MpiInfo *mpiInfo,
+						void (*extractEmigrants)(), void (*distr)()){
+
+	int nSpecies = pop->nSpecies;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
+	double *charge = pop->charge;
+	double *thresholds = mpiInfo->thresholds;
+	const int neighborhoodCenter = 13;
+	long int *nEmigrants = mpiInfo->nEmigrants;
+	int nNeighbors = mpiInfo->nNeighbors;
+
+	gZero(rho);
+	double *val = rho->val;
+	long int *sizeProd = rho->sizeProd;
+
+	popFloat **emigrants = mpiInfo->emigrantsDummy;
+	for(int ne=0;ne<nNeighbors;ne++){
+		emigrants[ne] = mpiInfo->emigrants[ne];
+	}
+	alSetAll(nEmigrants,nSpecies*nNeighbors,0);
+
+	double lx = thresholds[0];
+	double ly = thresholds[1];
+	double lz = thresholds[2];
+	double ux = thresholds[3];
+	double uy = thresholds[4];
+	double uz = thresholds[5];
+
+	for(int s=0;s<nSpecies;s++){
+
+		long int pStart = pop->iStart[s]*3;
+		long int pStop = pop->iStop[s]*3;
+
+		for(long int p=pStart;p<pStop;p+=3){
+
+			pos[p]   += vel[p];
+			pos[p+1] += vel[p+1];
+			pos[p+2] += vel[p+2];
+
+			double x = pos[p];
+			double y = pos[p+1];
+			double z = pos[p+2];
+
+			int nx = - (x<lx) + (x>=ux);
+			int ny = - (y<ly) + (y>=uy);
+			int nz = - (z<lz) + (z>=uz);
+			int ne = neighborhoodCenter + nx + 3*ny + 9*nz;
+
+			if(ne==neighborhoodCenter){
+
+				// Deposit while the particle is still in cache
+				puDeposit3D1(val,&pos[p],sizeProd,charge[s]);
+
+			} else {
+
+				// Extract emigrant and fill in with the last (unmoved) particle
+				reserveEmigrant(mpiInfo,ne);
+				*(emigrants[ne]++) = x;
+				*(emigrants[ne]++) = y;
+				*(emigrants[ne]++) = z;
+				*(emigrants[ne]++) = vel[p];
+				*(emigrants[ne]++) = vel[p+1];
+				*(emigrants[ne]++) = vel[p+2];
+				nEmigrants[ne*nSpecies+s]++;
+
+				pos[p]   = pos[pStop-3];
+				pos[p+1] = pos[pStop-2];
+				pos[p+2] = pos[pStop-1];
+				vel[p]   = vel[pStop-3];
+				vel[p+1] = vel[pStop-2];
+				vel[p+2] = vel[pStop-1];
+
+				pStop -= 3;
+				p -= 3;
+				pop->iStop[s]--;
+			}
+		}
+	}
+
+	// Immigrants are appended after the particles already deposited, and
+	// deposited as soon as each neighbor's message arrives. Importing them may
+	// reallocate the particles (see pReserve()), so the number deposited of
+	// each specie is kept rather than an index.
+	long int *nDeposited = malloc(nSpecies*sizeof(*nDeposited));
+
+	for(int s=0;s<nSpecies;s++) nDeposited[s] = pop->iStop[s]-pop->iStart[s];
+
+	puMigrateBegin(mpiInfo);
+	while(puMigrateNext(pop, mpiInfo, rho)>=0){
+		for(int s=0;s<nSpecies;s++){
+			for(long int i=pop->iStart[s]+nDeposited[s];i<pop->iStop[s];i++){
+				puDeposit3D1(val,&pop->pos[3*i],sizeProd,charge[s]);
+			}
+			nDeposited[s] = pop->iStop[s]-pop->iStart[s];
+		}
+	}
+
+	free(nDeposited);
 }
 
 void puReflect(){
 
 
 
+}
+
+/******************************************************************************
+ * SUB-CYCLING FUNCTIONS
+ *****************************************************************************/
+
+Subcycle *puAllocSubcycle(const dictionary *ini, const Population *pop, const Grid *rho){
+
+	int nSpecies = pop->nSpecies;
+	int *subcycles = iniGetIntArr(ini,"population:subcycles",nSpecies);
+
+	int active = 0;
+	for(int s=0;s<nSpecies;s++){
+		if(subcycles[s]<1) msg(ERROR,"population:subcycles must be >=1");
+		if(subcycles[s]>1) active = 1;
+	}
+
+	if(active){
+		if(iniGetInt(ini,"grid:balanceInterval")!=0)
+			msg(ERROR,"population:subcycles requires grid:balanceInterval=0");
+
+		// The Boris rotation parameters pop->T and pop->S are for one step
+		char *acc = iniGetStr(ini,"methods:acc");
+		if(!strncmp(acc,"puBoris",7))
+			msg(ERROR,"population:subcycles is not supported by %s",acc);
+		free(acc);
+
+		char *sweep = iniGetStr(ini,"methods:sweep");
+		if(!strcmp(sweep,"puSweepOffload"))
+			msg(ERROR,"population:subcycles is not supported by %s",sweep);
+		free(sweep);
+	}
+
+	Grid **rhoSpecies = malloc(nSpecies*sizeof(*rhoSpecies));
+	for(int s=0;s<nSpecies;s++){
+		rhoSpecies[s] = NULL;
+		if(subcycles[s]>1){
+			rhoSpecies[s] = gAlloc(ini, SCALAR);
+		}
+	}
+
+	Subcycle *sc = malloc(sizeof(*sc));
+	sc->nSpecies = nSpecies;
+	sc->subcycles = subcycles;
+	sc->active = active;
+	sc->cached = 0;
+	sc->n = 0;
+	sc->rhoSpecies = rhoSpecies;
+	sc->nHidden = malloc(nSpecies*sizeof(*sc->nHidden));
+	sc->kinEnergy = calloc(nSpecies,sizeof(*sc->kinEnergy));
+	sc->mass = malloc(nSpecies*sizeof(*sc->mass));
+
+	return sc;
+}
+
+void puFreeSubcycle(Subcycle *sc){
+
+	for(int s=0;s<sc->nSpecies;s++)
+		if(sc->rhoSpecies[s]) gFree(sc->rhoSpecies[s]);
+
+	free(sc->rhoSpecies);
+	free(sc->subcycles);
+	free(sc->nHidden);
+	free(sc->kinEnergy);
+	free(sc->mass);
+	free(sc);
+}
+
+void puSubcycleBegin(Subcycle *sc, Population *pop, long int n){
+
+	sc->n = n;
+	if(!sc->active) return;
+
+	for(int s=0;s<sc->nSpecies;s++){
+
+		int k = sc->subcycles[s];
+		if(k==1) continue;
+
+		if(n%k){
+			// Hidden from the kernels until puSubcycleEnd(). The count is kept
+			// rather than iStop since pReserve() may move the specie meanwhile.
+			sc->nHidden[s] = pop->iStop[s]-pop->iStart[s];
+			pop->iStop[s] = pop->iStart[s];
+		} else {
+			// Moving k steps and accelerating with the field times k
+			sc->mass[s] = pop->mass[s];
+			pop->mass[s] /= k*k;
+			puScaleVel(pop,s,k);
+		}
+	}
+}
+
+void puSubcycleEnd(Subcycle *sc, Population *pop){
+
+	if(!sc->active) return;
+
+	long int n = sc->n;
+
+	for(int s=0;s<sc->nSpecies;s++){
+
+		int k = sc->subcycles[s];
+		if(k==1) continue;
+
+		if(n%k){
+			pop->iStop[s] = pop->iStart[s]+sc->nHidden[s];
+			pop->kinEnergy[s] = sc->kinEnergy[s];
+		} else {
+			// Before it is reduced across subdomains
+			sc->kinEnergy[s] = pop->kinEnergy[s];
+			pop->mass[s] = sc->mass[s];
+			puScaleVel(pop,s,1.0/k);
+		}
+	}
+}
+
+void puSubcycleDeposit(Subcycle *sc, Population *pop, Grid *rho, void (*distr)()){
+
+	if(!sc->active) return;
+
+	int nSpecies = sc->nSpecies;
+	long int n = sc->n;
+	long int *iStop = malloc(nSpecies*sizeof(*iStop));
+	for(int s=0;s<nSpecies;s++) iStop[s] = pop->iStop[s];
+
+	for(int s=0;s<nSpecies;s++){
+
+		int k = sc->subcycles[s];
+		if(k==1) continue;
+
+		int pushed = n%k==0;
+
+		// Deposit the specie alone, also if hidden, when its density is new
+		if(pushed || !sc->cached){
+			for(int t=0;t<nSpecies;t++) pop->iStop[t] = pop->iStart[t];
+			pop->iStop[s] = pushed ? iStop[s] : pop->iStart[s]+sc->nHidden[s];
+			distr(pop, sc->rhoSpecies[s]);
+			for(int t=0;t<nSpecies;t++) pop->iStop[t] = iStop[t];
+		}
+
+		if(!pushed) gAddTo(rho, sc->rhoSpecies[s]);
+	}
+
+	sc->cached = 1;
+	free(iStop);
+}
+
+/******************************************************************************
+ * OFFLOADED FUNCTIONS
+ *****************************************************************************/
+
+void puMoveOffload(Population *pop){
+
+	pToDevice(pop);
+
+	int nSpecies = pop->nSpecies;
+	int nDims = pop->nDims;
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
+
+	for(int s=0; s<nSpecies; s++){
+
+		long int pStart = pop->iStart[s]*nDims;
+		long int pStop = pop->iStop[s]*nDims;
+
+		#pragma omp target teams distribute parallel for simd map(tofrom:pos[pStart:pStop-pStart]) map(to:vel[pStart:pStop-pStart])
+		for(long int p=pStart;p<pStop;p++){
+			pos[p] += vel[p];
+		}
+	}
+
+	pop->residency = ON_DEVICE;
+}
+
+funPtr puAcc3D1KEOffload_set(dictionary *ini){
+	puSanity(ini,"puAcc3D1KEOffload",3,1);
+	puOffloadSanity(ini,"puAcc3D1KEOffload");
+	return puAcc3D1KEOffload;
+}
+void puAcc3D1KEOffload(Population *pop, const Grid *E, double fraction){
+
+	pToDevice(pop);
+
+	int nSpecies = pop->nSpecies;
+	int nDims = 3;
+#ifdef _OPENMP
+	long int n = nDims*pop->iStart[nSpecies];
+#endif
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
+	double *mass = pop->mass;
+	double *kinEnergy = pop->kinEnergy;
+
+	// The field is solved for on the host and copied in once per time step
+	long int sizeProd[4];
+	for(int d=0;d<4;d++) sizeProd[d] = E->sizeProd[d];
+#ifdef _OPENMP
+	long int nVal = E->sizeProd[E->rank];
+#endif
+	double *val = E->val;
+	#pragma omp target enter data map(to:val[0:nVal],sizeProd[0:4])
+
+	for(int s=0;s<nSpecies;s++){
+
+		double factor = fraction*pop->charge[s]/pop->mass[s];
+
+		long int pStart = pop->iStart[s]*nDims;
+		long int pStop = pop->iStop[s]*nDims;
+
+		double sumVelSquared = 0;
+
+		#pragma omp target teams distribute parallel for reduction(+:sumVelSquared) \
+			map(tofrom:sumVelSquared,vel[0:n]) map(to:pos[0:n],val[0:nVal],sizeProd[0:4])
+		for(long int p=pStart;p<pStop;p+=nDims){
+			double dv[3];
+			puInterp3D1(dv,&pos[p],val,sizeProd);
+			for(int d=0;d<nDims;d++) dv[d] *= factor;
+			double velSquared=0;
+			for(int d=0;d<nDims;d++){
+				velSquared += vel[p+d]*(vel[p+d]+dv[d]);
+				vel[p+d] += dv[d];
+			}
+			sumVelSquared+=velSquared;
+		}
+
+		kinEnergy[s]=0.5*mass[s]*sumVelSquared;
+	}
+
+	#pragma omp target exit data map(delete:val[0:nVal],sizeProd[0:4])
+
+	pop->residency = ON_DEVICE;
+}
+
+funPtr puDistr3D1Offload_set(dictionary *ini){
+	puSanity(ini,"puDistr3D1Offload",3,1);
+	puOffloadSanity(ini,"puDistr3D1Offload");
+	return puDistr3D1Offload;
+}
+void puDistr3D1Offload(const Population *pop, Grid *rho){
+
+	int nSpecies = pop->nSpecies;
+#ifdef _OPENMP
+	long int n = 3*pop->iStart[nSpecies];
+#endif
+	popFloat *pos = pop->pos;
+
+	long int sizeProd[4];
+	for(int d=0;d<4;d++) sizeProd[d] = rho->sizeProd[d];
+	long int nVal = rho->sizeProd[rho->rank];
+	double *val = rho->val;
+
+	// Only the result is copied back, for the solver on the host
+	#pragma omp target enter data map(alloc:val[0:nVal]) map(to:sizeProd[0:4])
+
+	#pragma omp target teams distribute parallel for simd map(alloc:val[0:nVal])
+	for(long int q=0;q<nVal;q++) val[q] = 0;
+
+	for(int s=0;s<nSpecies;s++){
+
+		// Scaled like in puDistr3D1() to get the same result
+		double charge = pop->charge[s];
+		#pragma omp target teams distribute parallel for simd map(alloc:val[0:nVal])
+		for(long int q=0;q<nVal;q++) val[q] /= charge;
+
+		long int iStart = pop->iStart[s];
+		long int iStop = pop->iStop[s];
+
+		#pragma omp target teams distribute parallel for map(to:pos[0:n]) map(alloc:val[0:nVal],sizeProd[0:4])
+		for(long int i=iStart;i<iStop;i++){
+
+			const popFloat *x = &pos[3*i];
+
+			int j = (int) x[0];
+			int k = (int) x[1];
+			int l = (int) x[2];
+
+			double xw = x[0]-j;
+			double yw = x[1]-k;
+			double zw = x[2]-l;
+			double xcomp = 1-xw;
+			double ycomp = 1-yw;
+			double zcomp = 1-zw;
+
+			long int p 		= j + k*sizeProd[2] + l*sizeProd[3];
+			long int pj 	= p + 1;
+			long int pk 	= p + sizeProd[2];
+			long int pjk 	= pk + 1;
+			long int pl 	= p + sizeProd[3];
+			long int pjl 	= pl + 1;
+			long int pkl 	= pl + sizeProd[2];
+			long int pjkl 	= pkl + 1;
+
+			// Particles deposited to the same node by different threads
+			#pragma omp atomic update
+			val[p] 		+= xcomp*ycomp*zcomp;
+			#pragma omp atomic update
+			val[pj]		+= xw   *ycomp*zcomp;
+			#pragma omp atomic update
+			val[pk]		+= xcomp*yw   *zcomp;
+			#pragma omp atomic update
+			val[pjk]	+= xw   *yw   *zcomp;
+			#pragma omp atomic update
+			val[pl]     += xcomp*ycomp*zw   ;
+			#pragma omp atomic update
+			val[pjl]	+= xw   *ycomp*zw   ;
+			#pragma omp atomic update
+			val[pkl]	+= xcomp*yw   *zw   ;
+			#pragma omp atomic update
+			val[pjkl]	+= xw   *yw   *zw   ;
+		}
+
+		#pragma omp target teams distribute parallel for simd map(alloc:val[0:nVal])
+		for(long int q=0;q<nVal;q++) val[q] *= charge;
+	}
+
+	#pragma omp target exit data map(from:val[0:nVal]) map(delete:sizeProd[0:4])
+}
+
+funPtr puExtractEmigrants3DOffload_set(const dictionary *ini){
+	int nDims = iniGetInt(ini, "grid:nDims");
+	if(nDims!=3) msg(ERROR, "puExtractEmigrants3DOffload requires grid:nDims=3");
+	if(pGetLayout(ini)!=AOS)
+		msg(ERROR, "puExtractEmigrants3DOffload requires population:layout=AoS");
+	puOffloadSanity(ini,"puExtractEmigrants3DOffload");
+	return puExtractEmigrants3DOffload;
+}
+void puExtractEmigrants3DOffload(Population *pop, MpiInfo *mpiInfo){
+
+	pToDevice(pop);
+
+	int nSpecies = pop->nSpecies;
+#ifdef _OPENMP
+	long int n = 3*pop->iStart[nSpecies];
+#endif
+	popFloat *pos = pop->pos;
+	popFloat *vel = pop->vel;
+	double *thresholds = mpiInfo->thresholds;
+	const int neighborhoodCenter = 13;
+	long int *nEmigrants = mpiInfo->nEmigrants;
+	int nNeighbors = mpiInfo->nNeighbors;
+
+	popFloat **emigrants = mpiInfo->emigrantsDummy;
+	for(int ne=0;ne<nNeighbors;ne++){
+		emigrants[ne] = mpiInfo->emigrants[ne];
+	}
+	alSetAll(nEmigrants,nSpecies*nNeighbors,0);
+
+	double lx = thresholds[0];
+	double ly = thresholds[1];
+	double lz = thresholds[2];
+	double ux = thresholds[3];
+	double uy = thresholds[4];
+	double uz = thresholds[5];
+
+	for(int s=0;s<nSpecies;s++){
+
+		long int iStart = pop->iStart[s];
+		long int iStop = pop->iStop[s];
+
+		// Indices of emigrants. The scratch space must also hold the fillers
+		// used for compaction below (hence 2*nFound), or the search is redone.
+		long int nFound;
+		int overflow;
+		do{
+			long int *idx = pop->deviceIdx;
+			long int nIdx = pop->nDeviceAlloc;
+			nFound = 0;
+
+			#pragma omp target teams distribute parallel for map(tofrom:nFound) map(to:pos[0:n]) map(alloc:idx[0:nIdx])
+			for(long int i=iStart;i<iStop;i++){
+				const popFloat *x = &pos[3*i];
+				int nx = - (x[0]<lx) + (x[0]>=ux);
+				int ny = - (x[1]<ly) + (x[1]>=uy);
+				int nz = - (x[2]<lz) + (x[2]>=uz);
+				int ne = neighborhoodCenter + nx + 3*ny + 9*nz;
+
+				if(ne!=neighborhoodCenter){
+					long int k;
+					#pragma omp atomic capture
+					k = nFound++;
+					if(k<nIdx) idx[k] = i;
+				}
+			}
+
+			overflow = 2*nFound>nIdx;
+			if(overflow) pReserveDevice(pop,2*nFound);
+
+		} while(overflow);
+
+		if(nFound==0) continue;
+
+		long int m = nFound;
+		long int *idx = pop->deviceIdx;
+		popFloat *buf = pop->deviceBuf;
+#ifdef _OPENMP
+		long int nIdx = pop->nDeviceAlloc;
+		long int nBuf = 6*nIdx;
+#endif
+
+		// Emigrants in ascending order, to make the compaction deterministic
+		#pragma omp target update from(idx[0:m])
+		qsort(idx,m,sizeof(*idx),puCompareLong);
+		#pragma omp target update to(idx[0:m])
+
+		// Only the emigrants are copied to the host
+		#pragma omp target teams distribute parallel for map(to:pos[0:n],vel[0:n]) map(alloc:idx[0:nIdx],buf[0:nBuf])
+		for(long int k=0;k<m;k++){
+			long int i = idx[k];
+			for(int d=0;d<3;d++){
+				buf[6*k+d]   = pos[3*i+d];
+				buf[6*k+3+d] = vel[3*i+d];
+			}
+		}
+		#pragma omp target update from(buf[0:6*m])
+
+		for(long int k=0;k<m;k++){
+			popFloat *x = &buf[6*k];
+			int nx = - (x[0]<lx) + (x[0]>=ux);
+			int ny = - (x[1]<ly) + (x[1]>=uy);
+			int nz = - (x[2]<lz) + (x[2]>=uz);
+			int ne = neighborhoodCenter + nx + 3*ny + 9*nz;
+
+			reserveEmigrant(mpiInfo,ne);
+			for(int d=0;d<6;d++) *(emigrants[ne]++) = x[d];
+			nEmigrants[ne*nSpecies+s]++;
+		}
+
+		// Holes left below the new end are filled by the remaining particles
+		// above it, taken from the end. idx[m+h] is the filler of hole idx[h].
+		long int newStop = iStop-m;
+		long int nHoles = 0;
+		while(nHoles<m && idx[nHoles]<newStop) nHoles++;
+
+		long int e = m-1;
+		long int h = 0;
+		for(long int i=iStop-1;h<nHoles;i--){
+			if(e>=nHoles && idx[e]==i) e--;
+			else idx[m+h++] = i;
+		}
+
+		if(nHoles>0){
+			#pragma omp target update to(idx[m:nHoles])
+
+			#pragma omp target teams distribute parallel for map(tofrom:pos[0:n],vel[0:n]) map(alloc:idx[0:nIdx])
+			for(long int k=0;k<nHoles;k++){
+				long int i = idx[k];
+				long int j = idx[m+k];
+				for(int d=0;d<3;d++){
+					pos[3*i+d] = pos[3*j+d];
+					vel[3*i+d] = vel[3*j+d];
+				}
+			}
+		}
+
+		pop->iStop[s] = newStop;
+	}
+
+	pop->residency = ON_DEVICE;
+}
+
+funPtr puSweepOffload_set(dictionary *ini){
+	puOffloadSanity(ini,"puSweepOffload");
+	return puSweepOffload;
+}
+void puSweepOffload(	Population *pop, Grid *rho, MpiInfo *mpiInfo,
+						void (*extractEmigrants)(), void (*distr)()){
+
+	tRegionBegin("push");
+	puMoveOffload(pop);
+	tRegionEnd("push");
+
+	tRegionBegin("extract");
+	extractEmigrants(pop, mpiInfo);
+	tRegionEnd("extract");
+
+	// Immigrants are copied to the device as they are imported
+	puMigrate(pop, mpiInfo, rho);
+
+	if(chActive()){
+		pToHost(pop);
+		pPosAssertInLocalFrame(pop, rho);
+	}
+
+	tRegionBegin("deposit");
+	distr(pop, rho);
+	tRegionEnd("deposit");
 }
 
 /******************************************************************************
@@ -1040,6 +2913,20 @@ static void puSanity(dictionary *ini, const char* name, int dim, int order){
 	if(nDims!=dim && dim!=0)
 		msg(ERROR,"%s only supports grid:nDims=%d",name,dim);
 
+	// Functions for the SoA layout are suffixed SoA
+	int len = strlen(name);
+	if(len>3 && !strcmp(&name[len-3],"SoA")){
+		if(pGetLayout(ini)!=SOA)
+			msg(ERROR,"%s requires population:layout=SoA",name);
+	} else {
+		if(pGetLayout(ini)!=AOS)
+			msg(ERROR,"%s requires population:layout=AoS",name);
+	}
+
+	// There are no generic second order functions
+	if(order==2 && nDims>3)
+		msg(ERROR,"%s only supports grid:nDims<=3",name);
+
 	int reqLayers = 0;
 	if(order==0) reqLayers = 0;
 	if(order==1) reqLayers = 1;
@@ -1068,7 +2955,183 @@ static void puSanity(dictionary *ini, const char* name, int dim, int order){
 	free(thresholds);
 }
 
-static inline void puInterp3D1(	double *result, const double *pos,
+static void puOffloadSanity(const dictionary *ini, const char* name){
+
+	const char *keys[3] = {"methods:acc", "methods:distr", "methods:migrate"};
+	for(int k=0;k<3;k++){
+		char *method = iniGetStr(ini,keys[k]);
+		if(!strstr(method,"Offload"))
+			msg(ERROR,"%s requires an offloaded %s (e.g. %s)",
+				name, keys[k], k==0 ? "puAcc3D1KEOffload" :
+				k==1 ? "puDistr3D1Offload" : "puExtractEmigrants3DOffload");
+		free(method);
+	}
+
+	char *sweep = iniGetStr(ini,"methods:sweep");
+	if(strcmp(sweep,"puSweepOffload"))
+		msg(ERROR,"%s requires methods:sweep=puSweepOffload",name);
+	free(sweep);
+
+	if(iniGetInt(ini,"grid:balanceInterval")!=0)
+		msg(ERROR,"%s requires grid:balanceInterval=0",name);
+	if(iniGetInt(ini,"population:sortInterval")!=0)
+		msg(ERROR,"%s requires population:sortInterval=0",name);
+}
+
+static void puScaleVel(Population *pop, int s, double factor){
+
+	int nDims = pop->nDims;
+	long int iStart = pop->iStart[s];
+	long int nAlloc = pop->iStart[s+1]-iStart;
+	long int nParticles = pop->iStop[s]-iStart;
+	popFloat *vel = &pop->vel[iStart*nDims];
+
+	if(pop->layout==SOA){
+		for(int d=0;d<nDims;d++){
+			popFloat *v = &vel[d*nAlloc];
+			for(long int i=0;i<nParticles;i++) v[i] *= factor;
+		}
+	} else {
+		for(long int p=0;p<nDims*nParticles;p++) vel[p] *= factor;
+	}
+}
+
+static int puCompareLong(const void *a, const void *b){
+	long int x = *(const long int *)a;
+	long int y = *(const long int *)b;
+	return (x>y) - (x<y);
+}
+
+static inline void puInterp3D1Scalar(	double *ex, double *ey, double *ez,
+									double x, double y, double z,
+									const double *val, const long int *sizeProd){
+
+	// Integer parts of position
+	int j = (int) x;
+	int k = (int) y;
+	int l = (int) z;
+
+	// Decimal (cell-referenced) parts of position and their complement
+	x -= j;
+	y -= k;
+	z -= l;
+	double xcomp = 1-x;
+	double ycomp = 1-y;
+	double zcomp = 1-z;
+
+	// Index of neighbouring nodes
+	long int p 		= j*3 + k*sizeProd[2] + l*sizeProd[3];
+	long int pj 	= p + 3;
+	long int pk 	= p + sizeProd[2];
+	long int pjk 	= pk + 3;
+	long int pl 	= p + sizeProd[3];
+	long int pjl 	= pl + 3;
+	long int pkl 	= pl + sizeProd[2];
+	long int pjkl 	= pkl + 3;
+
+	// Weights of neighbouring nodes
+	double w 	= xcomp*ycomp*zcomp;
+	double wj	= x    *ycomp*zcomp;
+	double wk	= xcomp*y    *zcomp;
+	double wjk	= x    *y    *zcomp;
+	double wl	= xcomp*ycomp*z    ;
+	double wjl	= x    *ycomp*z    ;
+	double wkl	= xcomp*y    *z    ;
+	double wjkl	= x    *y    *z    ;
+
+	*ex =	w  *val[p  ] + wj  *val[pj  ] + wk  *val[pk  ] + wjk *val[pjk ]
+		+	wl *val[pl ] + wjl *val[pjl ] + wkl *val[pkl ] + wjkl*val[pjkl];
+
+	*ey =	w  *val[p  +1] + wj  *val[pj  +1] + wk  *val[pk  +1] + wjk *val[pjk +1]
+		+	wl *val[pl +1] + wjl *val[pjl +1] + wkl *val[pkl +1] + wjkl*val[pjkl+1];
+
+	*ez =	w  *val[p  +2] + wj  *val[pj  +2] + wk  *val[pk  +2] + wjk *val[pjk +2]
+		+	wl *val[pl +2] + wjl *val[pjl +2] + wkl *val[pkl +2] + wjkl*val[pjkl+2];
+}
+
+static inline void puDeposit3D1(	double *val, const popFloat *pos,
+									const long int *sizeProd, double weight){
+
+	// Integer parts of position
+	int j = (int) pos[0];
+	int k = (int) pos[1];
+	int l = (int) pos[2];
+
+	// Decimal (cell-referenced) parts of position and their complement
+	double x = pos[0]-j;
+	double y = pos[1]-k;
+	double z = pos[2]-l;
+	double xcomp = 1-x;
+	double ycomp = 1-y;
+	double zcomp = 1-z;
+
+	// Index of neighbouring nodes
+	long int p 		= j + k*sizeProd[2] + l*sizeProd[3];
+	long int pj 	= p + 1;
+	long int pk 	= p + sizeProd[2];
+	long int pjk 	= pk + 1;
+	long int pl 	= p + sizeProd[3];
+	long int pjl 	= pl + 1;
+	long int pkl 	= pl + sizeProd[2];
+	long int pjkl 	= pkl + 1;
+
+	xcomp *= weight;
+	x *= weight;
+
+	val[p] 		+= xcomp*ycomp*zcomp;
+	val[pj]		+= x    *ycomp*zcomp;
+	val[pk]		+= xcomp*y    *zcomp;
+	val[pjk]	+= x    *y    *zcomp;
+	val[pl]     += xcomp*ycomp*z    ;
+	val[pjl]	+= x    *ycomp*z    ;
+	val[pkl]	+= xcomp*y    *z    ;
+	val[pjkl]	+= x    *y    *z    ;
+
+}
+
+static double **puAllocTiles(Grid *rho, int nThreads){
+
+	long int nNodes = rho->sizeProd[rho->rank];
+	double **tiles = malloc(nThreads*sizeof(*tiles));
+
+	gZero(rho);
+	tiles[0] = rho->val;
+
+	// Each thread touches its own tile first to get it in its local memory
+	#pragma omp parallel num_threads(nThreads)
+	{
+		int t = 0;
+#ifdef _OPENMP
+		t = omp_get_thread_num();
+#endif
+		if(t!=0){
+			tiles[t] = malloc(nNodes*sizeof(**tiles));
+			adSetAll(tiles[t],nNodes,0);
+		}
+	}
+
+	return tiles;
+}
+
+static void puReduceTiles(double **tiles, Grid *rho, int nThreads){
+
+	long int nNodes = rho->sizeProd[rho->rank];
+	double *val = rho->val;
+
+	if(nThreads>1){
+		#pragma omp parallel for num_threads(nThreads) schedule(static)
+		for(long int g=0;g<nNodes;g++){
+			for(int t=1;t<nThreads;t++) val[g] += tiles[t][g];
+		}
+	}
+
+	for(int t=1;t<nThreads;t++) free(tiles[t]);
+	free(tiles);
+}
+
+// Also compiled for the device, for puAcc3D1KEOffload()
+#pragma omp declare target
+static inline void puInterp3D1(	double *result, const popFloat *pos,
 								const double *val, const long int *sizeProd){
 
 	// Integer parts of position
@@ -1102,8 +3165,48 @@ static inline void puInterp3D1(	double *result, const double *pos,
 							+y    *(xcomp*val[pkl +v]+x*val[pjkl+v]) );
 
 }
+#pragma omp end declare target
 
-static inline void puInterpND1(	double *result, const double *pos,
+static inline void puGrad3D1(	double *result, const popFloat *pos,
+								const double *val, const long int *sizeProd){
+
+	// Integer parts of position
+	int j = (int) pos[0];
+	int k = (int) pos[1];
+	int l = (int) pos[2];
+
+	// Decimal (cell-referenced) parts of position and their complement
+	double x = pos[0]-j;
+	double y = pos[1]-k;
+	double z = pos[2]-l;
+	double xcomp = 1-x;
+	double ycomp = 1-y;
+	double zcomp = 1-z;
+
+	// Index of neighbouring nodes
+	long int p 		= j + k*sizeProd[2] + l*sizeProd[3];
+	long int pj 	= p + 1;
+	long int pk 	= p + sizeProd[2];
+	long int pjk 	= pk + 1;
+	long int pl 	= p + sizeProd[3];
+	long int pjl 	= pl + 1;
+	long int pkl 	= pl + sizeProd[2];
+	long int pjkl 	= pkl + 1;
+
+	double v000 = val[p], v100 = val[pj], v010 = val[pk], v110 = val[pjk];
+	double v001 = val[pl], v101 = val[pjl], v011 = val[pkl], v111 = val[pjkl];
+
+	// Derivative of the linear interpolation along each dimension
+	result[0] =	zcomp*( ycomp*(v100-v000) + y*(v110-v010) )
+				+z    *( ycomp*(v101-v001) + y*(v111-v011) );
+	result[1] =	zcomp*( xcomp*(v010-v000) + x*(v110-v100) )
+				+z    *( xcomp*(v011-v001) + x*(v111-v101) );
+	result[2] =	ycomp*( xcomp*(v001-v000) + x*(v101-v100) )
+				+y    *( xcomp*(v011-v010) + x*(v111-v110) );
+
+}
+
+static inline void puInterpND1(	double *result, const popFloat *pos,
 								const double *val, const long int *sizeProd,
 								int nDims, int *integer, double *decimal,
 								double *complement){
@@ -1143,7 +3246,7 @@ static void puInterpND1Inner(	double *result, const double *val, long int p,
 
 }
 
-static inline void puInterpND0(	double *result, const double *pos,
+static inline void puInterpND0(	double *result, const popFloat *pos,
 								const double *val, const long int *sizeProd,
 								int nDims){
 
@@ -1160,6 +3263,89 @@ static inline void puInterpND0(	double *result, const double *pos,
 }
 
 
+static inline void puWeights(int order, double pos, int *node, double *weights){
+
+	if(order==0){
+		*node = (int)(pos+0.5);
+		weights[0] = 1;
+	} else if(order==1){
+		*node = (int)pos;
+		double x = pos-*node;
+		weights[0] = 1-x;
+		weights[1] = x;
+	} else {
+		int nearest = (int)(pos+0.5);
+		double x = pos-nearest;
+		*node = nearest-1;
+		weights[0] = 0.5*(0.5-x)*(0.5-x);
+		weights[1] = 0.75-x*x;
+		weights[2] = 0.5*(0.5+x)*(0.5+x);
+	}
+
+}
+
+static inline void puInterpSpec(	double *result, const popFloat *pos,
+									const double *val, const long int *sizeProd,
+									int nDims, int order){
+
+	int n = order+1;
+	int nNodes = 1;
+	long int p = 0;
+	double weights[3][3];
+
+	for(int d=0;d<nDims;d++){
+		int node;
+		puWeights(order,pos[d],&node,weights[d]);
+		p += node*sizeProd[d+1];
+		nNodes *= n;
+		result[d] = 0;
+	}
+
+	for(int c=0;c<nNodes;c++){
+		long int q = p;
+		double w = 1;
+		int r = c;
+		for(int d=0;d<nDims;d++){
+			q += (r%n)*sizeProd[d+1];
+			w *= weights[d][r%n];
+			r /= n;
+		}
+		for(int d=0;d<nDims;d++) result[d] += w*val[q+d];
+	}
+
+}
+
+static inline void puDepositSpec(	double *val, const popFloat *pos,
+									const long int *sizeProd, int nDims,
+									int order, double weight){
+
+	int n = order+1;
+	int nNodes = 1;
+	long int p = 0;
+	double weights[3][3];
+
+	for(int d=0;d<nDims;d++){
+		int node;
+		puWeights(order,pos[d],&node,weights[d]);
+		p += node*sizeProd[d+1];
+		nNodes *= n;
+	}
+
+	for(int c=0;c<nNodes;c++){
+		long int q = p;
+		double w = weight;
+		int r = c;
+		for(int d=0;d<nDims;d++){
+			q += (r%n)*sizeProd[d+1];
+			w *= weights[d][r%n];
+			r /= n;
+		}
+		val[q] += w;
+	}
+
+}
+
+
 int puNeighborToReciprocal(int neighbor, int nDims){
 
 	int reciprocal = 0;
@@ -1212,9 +3398,3 @@ int puRankToNeighbor(MpiInfo *mpiInfo, int rank){
 	return neighbor;
 
 }
-
-static inline void addCross(const double *a, const double *b, double *res){
-	res[0] +=  (a[1]*b[2]-a[2]*b[1]);
-	res[1] += -(a[0]*b[2]-a[2]*b[0]);
-	res[2] +=  (a[0]*b[1]-a[1]*b[0]);
-}
@@ -16,6 +16,8 @@
  * @param[in,out]	pop		Population
  * @return					void
  *
+ * Works on both the AoS and SoA layout of pop.
+ *
  * No boundary conditions are enforced and particles may therefore travel out of
  * bounds. Other functions must be called subsequently to enforce boundary
  * conditions or transfer them to other sub-domains as appropriate. Otherwise
@@ -47,7 +49,7 @@ void puPeriodic(Population *pop, Grid *grid);
  *	--------------------|-----------------------------------------------------------------------------------
  *	puAccXDY()			| Simple increment in velocity (e.g. leapfrog) (no external B-field)
  *	puAccXDYKE()		| Same as above but computes kinetic energy for each specie at the mid-step
- *	puBorisXDY()		| Boris algorithm (for external homogeneous B-field, S and T are vectors)
+ *	puBorisXDY()		| Boris algorithm (for external homogeneous B-field, S and T in pop)
  *	puBorisXDYKE()		| Same as above but computes kinetic energy for each specie at the mid-step
  *	puBorisInhXDY()		| Boris algorithm (for external inhomogeneous B-field, S and T are Grid quantities)
  *	puBorisInhXDYKE()	| Same as above but computes kinetic energy for each specie at the mid-step
@@ -63,18 +65,30 @@ void puPeriodic(Population *pop, Grid *grid);
  * higher than 0) some fixed dimensionality algorithms are included. For
  * instance, puInterp3D1() is much faster than puInterpND1().
  *
+ * Fixed dimensionality functions puAccXDY(), puAccXDYKE() and puDistrXDY() exist
+ * for X=1,2,3 and Y=0,1,2 (Y=2 being the TSC method). Most of them are generated
+ * from the same macro (PU_SPECIALIZE in pusher.c) with X and Y as compile-time
+ * constants. They are not selected by name. Instead the _set() functions of the
+ * ND methods (e.g. puAccND1_set()) return the specialized function matching
+ * grid:nDims, and only fall back to the slower ND function for more than three
+ * dimensions. The second order methods (e.g. puAccND2) have no such fallback.
+ *
+ * Functions suffixed SoA, e.g. puAcc3D1SoA(), operate on populations stored in
+ * the SoA layout (population:layout=SoA, see popLayout) whereas the others
+ * require the AoS layout. The SoA loops are vectorized using OpenMP SIMD
+ * directives (compile with e.g. CADD="-fopenmp-simd -march=native" to use
+ * AVX2/AVX-512 where available).
+ *
  * Remember that Boris and leapfrog methods require the velocities to be
  * located at half-integer steps. This initialization of the velocities can be
- * performed by multiplying E (and S and T in case of Boris) by 0.5,
- * accelerating once, and restoring E (and S and T) by multiplying them by 2.
- * For instance to get a leapfrog iteration:
+ * performed by accelerating once with fraction 0.5 (the fraction only applies
+ * to E, so in case of Boris S and T must be generated for the half step as
+ * well). For instance to get a leapfrog iteration:
  *
  * @code
  *	// Assume position and velocity initialized at timestep 0 here
  *
- *	gMul(E,0.5);
- *	puAcc3D1KE(pop,E); // Increment velocity to timestep 0.5
- *	gMul(E,2);
+ *	puAcc3D1KE(pop,E,0.5); // Increment velocity to timestep 0.5
  *
  *	for(int n=1; n<=nTimeSteps; n++){ // Mind the range of n
  *
@@ -86,7 +100,7 @@ void puPeriodic(Population *pop, Grid *grid);
  *
  *		// Solve field here (see e.g. multigrid.h)
  *
- *		puAcc3D1KE(pop, E); // Advance velocity to timestep n+0.5
+ *		puAcc3D1KE(pop, E, 1.); // Advance velocity to timestep n+0.5
  *	}
  * @endcode
  *
@@ -97,33 +111,69 @@ void puPeriodic(Population *pop, Grid *grid);
  *
  * @param[in,out]	pop		Population
  * @param			E		Electric field
- * @param			S		Rotation parameter (Boris only)
- * @param			T		Rotation parameter (Boris only)
+ * @param			fraction	Fraction of a time step to advance the velocities
  * @return					void
  *
- * The E input is usually not constified since it is rescaled several times
- * inside the function (specie-specific renormalization). By the end of the
- * function call, however, it should be restored to its initial value (to within
- * machine precision).
+ * The interpolated field is scaled by fraction and the charge-to-mass ratio of
+ * each specie (specie-specific renormalization), so E itself is left untouched.
  *
- * The rotation parameters S and T for the homogeneous Boris methods are
- * generated from the external B-field before the loop by
- * puGet3DRotationParameters(). For inhomogeneous fields S and T are Grid
+ * The rotation parameters S and T for the homogeneous Boris methods are stored
+ * per specie in pop->S and pop->T. They are generated from the external
+ * B-field before the loop by puGet3DRotationParameters() (regular() does
+ * this). Since they are precomputed the Boris accelerators only add a few
+ * arithmetic operations per particle compared to puAcc3D1KE(), and the loops
+ * are vectorizable in the same manner. For inhomogeneous fields S and T are Grid
  * quantities (no function to create them yet). For slowly time-varying
  * magnetic fields S and T can be regenerated each iteration. However, using a
  * Poisson solver does not properly deal with electromagnetic effects, so if
  * considering this the magnetic field must be kept quasi-static (and
  * quasi-homogeneous?).
+ *
+ * puAcc3D1KEWeighted() is puAcc3D1KE() for weighted particles (see
+ * pMergeSplit()). The acceleration is independent of the weight but each
+ * particle counts by its weight in the kinetic energy.
+ *
+ * Functions suffixed Phi, e.g. puAcc3D1KEPhi(), take the potential phi instead
+ * of E and gather the field as minus the exact gradient of its trilinear
+ * interpolation in the cell of the particle. This is the energy-conserving
+ * scheme, since the field is the gradient of the same weighting as the one
+ * depositing the charge (puDistr3D1()), whereas the accelerators of E are
+ * momentum-conserving. The field is not continuous across cells, and the
+ * particles feel a small self-force. Only the 8 nodes of phi in the cell are
+ * read, instead of 3x8 of E, and regular() neither allocates E nor exchanges
+ * its halo when methods:acc gathers from phi (see puGathersPhi()).
  */
 ///@{
-void puAcc3D1(Population *pop, Grid *E);
-void puAcc3D1KE(Population *pop, Grid *E);
-void puAccND1(Population *pop, Grid *E);
-void puAccND1KE(Population *pop, Grid *E);
-void puAccND0(Population *pop, Grid *E);
-void puAccND0KE(Population *pop, Grid *E);
-void puBoris3D1(Population *pop, Grid *E, const double *T, const double *S);
-void puBoris3D1KE(Population *pop, Grid *E, const double *T, const double *S);
+void puAcc3D1(Population *pop, const Grid *E, double fraction);
+void puAcc3D1KE(Population *pop, const Grid *E, double fraction);
+void puAccND1(Population *pop, const Grid *E, double fraction);
+void puAccND1KE(Population *pop, const Grid *E, double fraction);
+void puAccND0(Population *pop, const Grid *E, double fraction);
+void puAccND0KE(Population *pop, const Grid *E, double fraction);
+void puAcc3D1SoA(Population *pop, const Grid *E, double fraction);
+void puAcc3D1KESoA(Population *pop, const Grid *E, double fraction);
+void puBoris3D1(Population *pop, const Grid *E, double fraction);
+void puBoris3D1KE(Population *pop, const Grid *E, double fraction);
+void puAcc3D1KEWeighted(Population *pop, const Grid *E, double fraction);
+void puAcc3D1Phi(Population *pop, const Grid *phi, double fraction);
+void puAcc3D1KEPhi(Population *pop, const Grid *phi, double fraction);
+
+void puAcc1D0(Population *pop, const Grid *E, double fraction);
+void puAcc1D0KE(Population *pop, const Grid *E, double fraction);
+void puAcc1D1(Population *pop, const Grid *E, double fraction);
+void puAcc1D1KE(Population *pop, const Grid *E, double fraction);
+void puAcc1D2(Population *pop, const Grid *E, double fraction);
+void puAcc1D2KE(Population *pop, const Grid *E, double fraction);
+void puAcc2D0(Population *pop, const Grid *E, double fraction);
+void puAcc2D0KE(Population *pop, const Grid *E, double fraction);
+void puAcc2D1(Population *pop, const Grid *E, double fraction);
+void puAcc2D1KE(Population *pop, const Grid *E, double fraction);
+void puAcc2D2(Population *pop, const Grid *E, double fraction);
+void puAcc2D2KE(Population *pop, const Grid *E, double fraction);
+void puAcc3D0(Population *pop, const Grid *E, double fraction);
+void puAcc3D0KE(Population *pop, const Grid *E, double fraction);
+void puAcc3D2(Population *pop, const Grid *E, double fraction);
+void puAcc3D2KE(Population *pop, const Grid *E, double fraction);
 
 funPtr puAcc3D1_set(dictionary *ini);
 funPtr puAcc3D1KE_set(dictionary *ini);
@@ -131,18 +181,34 @@ funPtr puAccND1_set(dictionary *ini);
 funPtr puAccND1KE_set(dictionary *ini);
 funPtr puAccND0_set(dictionary *ini);
 funPtr puAccND0KE_set(dictionary *ini);
+funPtr puAcc3D1SoA_set(dictionary *ini);
+funPtr puAcc3D1KESoA_set(dictionary *ini);
+funPtr puBoris3D1_set(dictionary *ini);
+funPtr puBoris3D1KE_set(dictionary *ini);
+funPtr puAccND2_set(dictionary *ini);
+funPtr puAccND2KE_set(dictionary *ini);
+funPtr puAcc3D1KEWeighted_set(dictionary *ini);
+funPtr puAcc3D1Phi_set(dictionary *ini);
+funPtr puAcc3D1KEPhi_set(dictionary *ini);
 ///@}
 
+/**
+ * @brief Whether methods:acc gathers the field from phi instead of E
+ * @param	ini		Input file
+ * @return	1 if the accelerator is suffixed Phi, 0 if not
+ */
+int puGathersPhi(const dictionary *ini);
+
 /**
  * @brief Generates rotation parameters for puBoris-funcitons.
  * @param			ini		Input file
  * @param[out]		T		Rotation parameter named t in B&L
  * @param[out]		S		Rotation parameter named s in B&L
  *
- * S and T must be pre-allocated to hold 3*nSpecies doubles each.
- * This functions needs some cleanup.
+ * S and T must be pre-allocated to hold 3*nSpecies doubles each, e.g. pop->T and
+ * pop->S. fields:BExt is read as a 3D vector regardless of grid:nDims.
  */
-void puGet3DRotationParameters(dictionary *ini, double *T, double *S);
+void puGet3DRotationParameters(const dictionary *ini, double *T, double *S);
 
 
 /** @name Distributors
@@ -150,11 +216,23 @@ void puGet3DRotationParameters(dictionary *ini, double *T, double *S);
  * by interpolating the charges onto the nearest grid points. They are named
  * puDistrXDY() where X signifies the dimensionality and Y the order of
  * interpolation (similart to puInterpXDY() and the accelerator functions).
+ * As for the accelerators, puDistrNDY_set() returns a specialized function for
+ * grid:nDims up to three.
  *
  * These functions will crash ungracefully if particles are placed
  * out-of-bounds or out-of-threshold area. Make sure to migrate particles to
  * other subdomains before calling.
  *
+ * puDistrXDYThreaded() are OpenMP-parallel variants of the same algorithms
+ * (compile with CADD=-fopenmp). To avoid write conflicts each thread deposits
+ * onto its own private copy of the grid, and the copies are summed into rho
+ * afterwards. The result equals that of puDistrXDY() to within round-off
+ * errors. The number of threads is controlled by OMP_NUM_THREADS. Without
+ * OpenMP they run serially and deposit directly onto rho.
+ *
+ * puDistr3D1Weighted() deposits each particle with its weight times the
+ * charge of its specie (see pMergeSplit()).
+ *
  * @param			pop		Population
  * @param[in,out]	rho		Charge density
  * @return					void
@@ -163,10 +241,28 @@ void puGet3DRotationParameters(dictionary *ini, double *T, double *S);
 void puDistr3D1(const Population *pop, Grid *rho);
 void puDistrND1(const Population *pop, Grid *rho);
 void puDistrND0(const Population *pop, Grid *rho);
+void puDistr3D1Threaded(const Population *pop, Grid *rho);
+void puDistrND1Threaded(const Population *pop, Grid *rho);
+void puDistr3D1SoA(const Population *pop, Grid *rho);
+void puDistr3D1Weighted(const Population *pop, Grid *rho);
+
+void puDistr1D0(const Population *pop, Grid *rho);
+void puDistr1D1(const Population *pop, Grid *rho);
+void puDistr1D2(const Population *pop, Grid *rho);
+void puDistr2D0(const Population *pop, Grid *rho);
+void puDistr2D1(const Population *pop, Grid *rho);
+void puDistr2D2(const Population *pop, Grid *rho);
+void puDistr3D0(const Population *pop, Grid *rho);
+void puDistr3D2(const Population *pop, Grid *rho);
 
 funPtr puDistr3D1_set(dictionary *ini);
 funPtr puDistrND1_set(dictionary *ini);
 funPtr puDistrND0_set(dictionary *ini);
+funPtr puDistr3D1Threaded_set(dictionary *ini);
+funPtr puDistrND1Threaded_set(dictionary *ini);
+funPtr puDistr3D1SoA_set(dictionary *ini);
+funPtr puDistrND2_set(dictionary *ini);
+funPtr puDistr3D1Weighted_set(dictionary *ini);
 ///@}
 
 // EVERYTHING BELOW THIS SHOULD MOVE TO SEPARATE MIGRATION.H MODULE.
@@ -180,8 +276,222 @@ void puExtractEmigrantsND(Population *pop, MpiInfo *mpiInfo);
 void puExtractEmigrants3D(Population *pop, MpiInfo *mpiInfo);
 funPtr puExtractEmigrantsND_set(const dictionary *ini);
 funPtr puExtractEmigrants3D_set(const dictionary *ini);
+void puExtractEmigrants3DSoA(Population *pop, MpiInfo *mpiInfo);
+funPtr puExtractEmigrants3DSoA_set(const dictionary *ini);
 
+/**
+ * @brief	Extracts emigrants along with their weights
+ * @param[in,out]	pop		Population
+ * @param[in,out]	mpiInfo	MpiInfo
+ * @return	void
+ *
+ * Same as puExtractEmigrants3D() but for weighted particles (see
+ * pMergeSplit()). Each emigrant is followed by its weight in the emigrant
+ * buffer, which puMigrate() passes on, i.e. the buffers hold
+ * mpiInfo->migrantSize=2*nDims+1 values per particle.
+ */
+void puExtractEmigrants3DWeighted(Population *pop, MpiInfo *mpiInfo);
+funPtr puExtractEmigrants3DWeighted_set(const dictionary *ini);
+
+/**
+ * @brief	Extracts emigrants testing only particles near the boundary
+ * @param[in,out]	pop		Population
+ * @param[in,out]	mpiInfo	MpiInfo
+ * @return	void
+ *
+ * Same as puExtractEmigrants3D(), but uses the cell order recorded by pSort()
+ * (see Population) to test only the particles in cells close enough to the
+ * thresholds to have crossed them since. A particle moves at most a cell per
+ * push when population:maxVel<=1, so k pushes after sorting this is a shell
+ * of cells k cells thick on the inside of the thresholds, and the cost scales
+ * with the surface of the subdomain rather than its volume as long as
+ * population:sortInterval is small compared to the subdomain. Particles put
+ * out of order since, i.e. immigrants and particles moved into the holes
+ * left by emigrants, are also tested. Before the first sort all particles are
+ * tested.
+ *
+ * The emigrants are the same as for puExtractEmigrants3D(), but they are
+ * extracted in a different order. Requires population:sortInterval>0,
+ * population:maxVel<=1 and no sub-cycling. The limit on the velocity is only
+ * enforced by pVelAssertMax() when checks are active (see chActive()).
+ */
+void puExtractEmigrants3DShell(Population *pop, MpiInfo *mpiInfo);
+funPtr puExtractEmigrants3DShell_set(const dictionary *ini);
+
+/**
+ * @brief	Sends emigrants to and receives immigrants from the neighbors
+ * @param[in,out]	pop		Population
+ * @param[in,out]	mpiInfo	MpiInfo
+ * @param			grid	Grid
+ * @return			void (puMigrateNext() returns the neighbor imported from)
+ *
+ * puMigrate() exchanges the emigrants extracted by e.g. puExtractEmigrants3D()
+ * and appends the immigrants to pop. It is equivalent to:
+ *
+ * @code
+ *	puMigrateBegin(mpiInfo);
+ *	while(puMigrateNext(pop,mpiInfo,grid)>=0);
+ * @endcode
+ *
+ * puMigrateBegin() starts sending to all neighbors at once, each neighbor
+ * having its own immigrant buffer. puMigrateNext() waits for whichever
+ * message completes first, imports its particles, and returns the neighbor
+ * index. Once all messages are imported it returns -1. Work not depending on
+ * the immigrants may be done in between, and the immigrants of one neighbor
+ * may be processed (e.g. deposited) while the others are in flight. The
+ * particles imported by a call to puMigrateNext() are those between the
+ * previous and the current iStop of each specie.
+ *
+ * How the migrants are exchanged depends on grid:migration (see
+ * migrateProtocol). With SPLIT the number of migrants are exchanged first,
+ * after which puMigrateBegin() posts non-blocking sends and receives of the
+ * migrants themselves. With PROBED the number of migrants are sent with the
+ * migrants in one message, which puMigrateNext() probes for and receives. This
+ * halves the number of messages, and saves the latency of one round-trip
+ * between neighbors, which dominates when there are many subdomains. All
+ * migrants are sent on their own communicator, mpiInfo->migrateComm.
+ *
+ * The migrant buffers in mpiInfo are resized automatically. grid:nEmigrantsAlloc
+ * only determines their initial size. A buffer that overflows is grown to twice
+ * the needed size, and every 100 migrations the buffers using less than a
+ * quarter of their size since the previous time are shrunk to twice their
+ * high-water mark.
+ */
+///@{
 void puMigrate(Population *pop, MpiInfo *mpiInfo, Grid *grid);
+void puMigrateBegin(MpiInfo *mpiInfo);
+int puMigrateNext(Population *pop, MpiInfo *mpiInfo, Grid *grid);
+///@}
+
+/**
+ * @brief	Prints statistics of the usage of the migrant buffers
+ * @param	mpiInfo		MpiInfo
+ * @return	void
+ *
+ * For each neighbor, prints the mean and peak number of emigrants per
+ * subdomain and migration, and the largest buffer allocated, across all
+ * subdomains. Must be called by all MPI processes.
+ */
+void puMigrantStats(const MpiInfo *mpiInfo);
+
+/**
+ * @brief	Moves, migrates and deposits particles
+ * @param[in,out]	pop					Population
+ * @param[out]		rho					Charge density
+ * @param			mpiInfo				MpiInfo
+ * @param			extractEmigrants	Emigrant extractor (e.g. puExtractEmigrants3D())
+ * @param			distr				Distributor (e.g. puDistr3D1())
+ * @return			void
+ *
+ * Carries out the particle part of a time step up until the charge density is
+ * obtained (in the true grid and the ghost layers, before gHaloOp()).
+ *
+ * puSweepSplit() calls puMove(), extractEmigrants(), puMigrate() and distr()
+ * after each other, which is three separate passes through the particles.
+ *
+ * puSweepFused3D1() does it in one pass instead. Each particle is moved, and
+ * then either extracted as an emigrant or deposited while its position is
+ * still in cache. The immigrants of each neighbor are deposited as soon as they
+ * have been received, while the rest are in flight. The deposition
+ * is the same as in puDistr3D1() and the emigrants are identified as in
+ * puExtractEmigrants3D(), whereas the extractEmigrants and distr arguments are
+ * ignored. This saves memory bandwidth when the particles do not fit in cache.
+ */
+///@{
+void puSweepSplit(	Population *pop, Grid *rho, MpiInfo *mpiInfo,
+					void (*extractEmigrants)(), void (*distr)());
+void puSweepFused3D1(	Population *pop, Grid *rho, MpiInfo *mpiInfo,
+						void (*extractEmigrants)(), void (*distr)());
+
+funPtr puSweepSplit_set(dictionary *ini);
+funPtr puSweepFused3D1_set(dictionary *ini);
+///@}
+
+/**
+ * @brief	Allocates the state of sub-cycling
+ * @param	ini		Dictionary to input file
+ * @param	pop		Population
+ * @param	rho		Charge density
+ * @return	Subcycle
+ *
+ * Reads population:subcycles, the number of time steps between each push of
+ * each specie. Sub-cycling is not supported with load balancing, the Boris
+ * accelerators or the offloaded functions.
+ */
+Subcycle *puAllocSubcycle(const dictionary *ini, const Population *pop, const Grid *rho);
+
+/**
+ * @brief	Frees the state of sub-cycling
+ * @param	sc		Subcycle
+ * @return	void
+ */
+void puFreeSubcycle(Subcycle *sc);
+
+/** @name Sub-cycling
+ * Heavy species, e.g. ions, move little per time step. With
+ * population:subcycles=k for specie s it is only pushed when the time step n
+ * is a multiple of k, with a k times larger time step, cutting the cost of
+ * pushing it about k-fold. The field at that step is used for the whole push
+ * (not an average over the k steps), which keeps the leapfrog scheme of the
+ * specie second order in its own time step, k*dt. The specie is initialized
+ * with a half step of k*dt.
+ *
+ * The push of step n, i.e. sweep() and acc(), is enclosed in
+ * puSubcycleBegin() and puSubcycleEnd(). puSubcycleBegin() hides the species
+ * not pushed at step n from the kernels, by temporarily setting iStop equal to
+ * iStart, and scales the velocities and masses of those pushed such that the
+ * kernels move and accelerate them k steps at once. puSubcycleEnd() undoes
+ * this. In between, puSubcycleDeposit() must be called after sweep() and
+ * before gHaloOp() to add the charge density of the hidden species, as it was on
+ * their last push, to rho. It is kept in Subcycle, and deposited in an extra
+ * pass on the push steps of each specie (or first time called, e.g. when
+ * restarting).
+ *
+ * The kinetic energy of a hidden specie is that of its last push. The functions
+ * do nothing unless population:subcycles is larger than one for some specie.
+ */
+///@{
+void puSubcycleBegin(Subcycle *sc, Population *pop, long int n);
+void puSubcycleEnd(Subcycle *sc, Population *pop);
+void puSubcycleDeposit(Subcycle *sc, Population *pop, Grid *rho, void (*distr)());
+///@}
+
+/** @name Offloaded functions
+ * Versions of puMove(), puAcc3D1KE(), puDistr3D1(), puExtractEmigrants3D() and
+ * puSweepSplit() running on an OpenMP target device, e.g. a GPU, when built
+ * with "make gpu". Without a device they run on the host.
+ *
+ * The particles are copied to the device by the first of them called, see
+ * pToDevice(), and stay there between time steps. Only the emigrants are copied
+ * back to the host, since the migration is done by MPI on the host, and the
+ * immigrants are copied to the device as they are imported by puMigrate().
+ * The fields are solved for on the host, so the charge density is copied back
+ * after deposition and the electric field is copied to the device before
+ * acceleration, once per time step each. pToHost() must be called before
+ * using the particles on the host, e.g. for output.
+ *
+ * The deposition uses atomic operations, so the charge density may differ by
+ * round-off from that of puDistr3D1() with several threads. The emigrants are
+ * extracted in a different order than in puExtractEmigrants3D(), and the
+ * remaining particles compacted differently.
+ *
+ * They must be used together, i.e. with methods:sweep=puSweepOffload and the
+ * other methods offloaded, and are not compatible with load balancing or
+ * sorting.
+ */
+///@{
+void puMoveOffload(Population *pop);
+void puAcc3D1KEOffload(Population *pop, const Grid *E, double fraction);
+void puDistr3D1Offload(const Population *pop, Grid *rho);
+void puExtractEmigrants3DOffload(Population *pop, MpiInfo *mpiInfo);
+void puSweepOffload(	Population *pop, Grid *rho, MpiInfo *mpiInfo,
+						void (*extractEmigrants)(), void (*distr)());
+
+funPtr puAcc3D1KEOffload_set(dictionary *ini);
+funPtr puDistr3D1Offload_set(dictionary *ini);
+funPtr puExtractEmigrants3DOffload_set(const dictionary *ini);
+funPtr puSweepOffload_set(dictionary *ini);
+///@}
 
 int puRankToNeighbor(MpiInfo *mpiInfo, int rank);
 int puNeighborToRank(MpiInfo *mpiInfo, int neighbor);
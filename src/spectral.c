@@ -6,47 +6,240 @@
 #define _XOPEN_SOURCE 700
 
 #include <complex.h>
-#include <fftw3.h>
+#include <fftw3-mpi.h>
 #include <math.h>
 #include "core.h"
 #include "spectral.h"
 
-SpectralSolver* sAlloc(const dictionary *ini, const Grid *rho, Grid *phi){
+/**
+ * @brief Sets up the distributed solver for 2D and 3D
+ *
+ * FFTW-MPI distributes slabs along the last dimension. The types in
+ * gridTypes and slabTypes locate the nodes this process sends to and
+ * receives from each other process to move between the subdomains and the
+ * slabs, such that MPI_Alltoallw() does the redistribution.
+ */
+static void sAllocDistributed(SpectralSolver *solver, const Grid *rho,
+							  const MpiInfo *mpiInfo, unsigned flags){
 
-	SpectralSolver *solver = (SpectralSolver *)malloc(sizeof(*solver));
+	int rank = rho->rank;
+	int nDims = rank-1;
+	int mpiSize = mpiInfo->mpiSize;
+	int *trueSize = rho->trueSize;
+	int *nGhostLayers = rho->nGhostLayers;
+	MPI_Comm comm = mpiInfo->comm;
+
+	// FFTW is row-major, so its first dimension is our last
+	ptrdiff_t *n = malloc(2*nDims*sizeof(*n));
+	ptrdiff_t *nComplex = &n[nDims];
+	for(int d = 0; d < nDims; d++){
+		n[d] = mpiInfo->cuts[nDims-1-d][mpiInfo->nSubdomains[nDims-1-d]];
+		nComplex[d] = n[d];
+	}
+	nComplex[nDims-1] = n[nDims-1]/2+1;
+
+	ptrdiff_t localN, localStart;
+	ptrdiff_t allocLocal = fftw_mpi_local_size(nDims, nComplex, comm,
+											   &localN, &localStart);
+
+	fftw_complex *spectrum = fftw_malloc(allocLocal*sizeof(*spectrum));
+	double *slab = fftw_malloc(2*allocLocal*sizeof(*slab));
+
+	solver->fftForward = fftw_mpi_plan_dft_r2c(nDims, n, slab, spectrum, comm, flags);
+	solver->fftInverse = fftw_mpi_plan_dft_c2r(nDims, n, spectrum, slab, comm, flags);
+
+	// Spectral multiplier turning rho into phi, including the normalization
+	// of the IFFT. The DC-component is set to zero for charge neutrality.
+	long int spectralSize = localN;
+	for(int d = 1; d < nDims; d++) spectralSize *= nComplex[d];
+	double *spectralFactor = malloc(spectralSize*sizeof(*spectralFactor));
+
+	double nTotal = 1;
+	for(int d = 0; d < nDims; d++) nTotal *= n[d];
+
+	for(long int g = 0; g < spectralSize; g++){
+		long int rest = g;
+		double kSquared = 0;
+		for(int d = nDims-1; d >= 0; d--){
+			long int m = rest%nComplex[d];
+			rest /= nComplex[d];
+			if(d == 0) m += localStart;
+			if(m > n[d]/2) m -= n[d];
+			double k = 2*M_PI*m/n[d];
+			kSquared += k*k;
+		}
+		spectralFactor[g] = kSquared == 0 ? 0 : 1/(kSquared*nTotal);
+	}
 
-	int nDims = iniGetInt(ini,"grid:nDims");
-	long int *trueSize = iniGetLongIntArr(ini,"grid:trueSize",nDims);
-	long int size = trueSize[0];
-	long int spectralSize = size/2+1;
+	// Subdomain (start and size) and slab (start and size) of every process
+	int nInfo = 2*nDims+2;
+	long int *mine = malloc(nInfo*sizeof(*mine));
+	long int *all = malloc(mpiSize*nInfo*sizeof(*all));
+	for(int d = 0; d < nDims; d++){
+		mine[d] = mpiInfo->cuts[d][mpiInfo->subdomain[d]];
+		mine[nDims+d] = trueSize[d+1];
+	}
+	mine[2*nDims] = localStart;
+	mine[2*nDims+1] = localN;
+	MPI_Allgather(mine, nInfo, MPI_LONG, all, nInfo, MPI_LONG, comm);
+
+	// Slab as a grid without ghosts, each row padded as FFTW requires
+	int *slabSize = malloc(3*rank*sizeof(*slabSize));
+	int *subSize = &slabSize[rank];
+	int *start = &slabSize[2*rank];
+	slabSize[0] = 1;
+	slabSize[1] = 2*(n[nDims-1]/2+1);
+	for(int d = 2; d < rank; d++) slabSize[d] = n[nDims-d];
+	slabSize[nDims] = localN;
+	subSize[0] = 1;
+	start[0] = 0;
+
+	MPI_Datatype *gridTypes = malloc(2*mpiSize*sizeof(*gridTypes));
+	MPI_Datatype *slabTypes = &gridTypes[mpiSize];
+	int *gridCounts = malloc(3*mpiSize*sizeof(*gridCounts));
+	int *slabCounts = &gridCounts[mpiSize];
+	int *displs = &gridCounts[2*mpiSize];
+
+	for(int r = 0; r < mpiSize; r++){
+
+		long int *other = &all[r*nInfo];
+		displs[r] = 0;
+
+		// The part of this subdomain in the slab of r
+		long int lower = mine[nDims-1];
+		long int upper = lower + mine[2*nDims-1];
+		if(other[2*nDims] > lower) lower = other[2*nDims];
+		if(other[2*nDims] + other[2*nDims+1] < upper) upper = other[2*nDims] + other[2*nDims+1];
+
+		gridCounts[r] = upper > lower;
+		gridTypes[r] = MPI_DOUBLE;
+		if(gridCounts[r]){
+			for(int d = 1; d < rank; d++){
+				subSize[d] = trueSize[d];
+				start[d] = nGhostLayers[d];
+			}
+			subSize[nDims] = upper-lower;
+			start[nDims] = nGhostLayers[nDims] + lower-mine[nDims-1];
+			MPI_Type_create_subarray(rank, rho->size, subSize, start,
+									 MPI_ORDER_FORTRAN, MPI_DOUBLE, &gridTypes[r]);
+			MPI_Type_commit(&gridTypes[r]);
+		}
+
+		// The part of the subdomain of r in this slab
+		lower = other[nDims-1];
+		upper = lower + other[2*nDims-1];
+		if(localStart > lower) lower = localStart;
+		if(localStart + localN < upper) upper = localStart + localN;
+
+		slabCounts[r] = upper > lower;
+		slabTypes[r] = MPI_DOUBLE;
+		if(slabCounts[r]){
+			for(int d = 1; d < rank; d++){
+				subSize[d] = other[nDims+d-1];
+				start[d] = other[d-1];
+			}
+			subSize[nDims] = upper-lower;
+			start[nDims] = lower-localStart;
+			MPI_Type_create_subarray(rank, slabSize, subSize, start,
+									 MPI_ORDER_FORTRAN, MPI_DOUBLE, &slabTypes[r]);
+			MPI_Type_commit(&slabTypes[r]);
+		}
+	}
+
+	free(n);
+	free(mine);
+	free(all);
+	free(slabSize);
+
+	solver->spectrum = spectrum;
+	solver->spectralFactor = spectralFactor;
 	solver->spectralSize = spectralSize;
-	free(trueSize);
+	solver->slab = slab;
+	solver->comm = comm;
+	solver->mpiSize = mpiSize;
+	solver->gridTypes = gridTypes;
+	solver->slabTypes = slabTypes;
+	solver->gridCounts = gridCounts;
+	solver->slabCounts = slabCounts;
+	solver->displs = displs;
+}
+
+/**
+ * @brief Returns the FFTW planner flag given by methods:fftPlanning
+ */
+static unsigned sPlanningFlag(const dictionary *ini){
 
-	fftw_complex *spectrum = (fftw_complex *)malloc(size*sizeof(*spectrum));
-	double *spectralFactor = (double *)malloc(spectralSize*sizeof(*spectralFactor));
+	char *planning = iniGetStr(ini, "methods:fftPlanning");
+	unsigned flag = FFTW_ESTIMATE;
 
-	spectralFactor[0] = 0; // Actually infinity
-	for(int n=1; n<spectralSize; n++){
+	if(		!strcmp(planning, "ESTIMATE"))		flag = FFTW_ESTIMATE;
+	else if(!strcmp(planning, "MEASURE"))		flag = FFTW_MEASURE;
+	else if(!strcmp(planning, "PATIENT"))		flag = FFTW_PATIENT;
+	else if(!strcmp(planning, "EXHAUSTIVE"))	flag = FFTW_EXHAUSTIVE;
+	else msg(ERROR,"%s invalid value for methods:fftPlanning", planning);
 
-		// Spectral multiplier turning rho into phi
-		spectralFactor[n] = size/(2*M_PI*n);
-		spectralFactor[n] *= spectralFactor[n];
+	free(planning);
+	return flag;
+}
+
+SpectralSolver* sAlloc(const dictionary *ini, const Grid *rho, Grid *phi,
+					   const MpiInfo *mpiInfo){
+
+	SpectralSolver *solver = (SpectralSolver *)malloc(sizeof(*solver));
 
-		// Part of IFFT operations
-		spectralFactor[n] /= size;
+	unsigned flags = sPlanningFlag(ini);
+	char *wisdom = iniGetStr(ini, "methods:fftWisdom");
+	int useWisdom = strcmp(wisdom, "NONE");
+	MPI_Comm comm = mpiInfo->comm;
+
+	// Only the root reads and writes the wisdom. A missing file is fine.
+	fftw_mpi_init();
+	if(useWisdom){
+		if(mpiInfo->mpiRank == 0) fftw_import_wisdom_from_filename(wisdom);
+		fftw_mpi_broadcast_wisdom(comm);
 	}
 
+	if(rho->rank > 2){
+		sAllocDistributed(solver, rho, mpiInfo, flags);
+	} else {
+		solver->slab = NULL;
 
-	spectrum = (fftw_complex *)fftw_malloc(spectralSize*sizeof(fftw_complex));
+		long int size = rho->trueSize[1];
+		long int spectralSize = size/2+1;
+		solver->spectralSize = spectralSize;
 
-	// Replacing FFTW_ESTIMATE with FFTW_MEASURE may be beneficial for very
-	// large systems. More efficient algorithm by omitting FFTW_PRESERVE_INPUT
-	// on c2r-transform.
-	solver->fftForward = fftw_plan_dft_r2c_1d(size,rho->val,spectrum,FFTW_ESTIMATE);
-	solver->fftInverse = fftw_plan_dft_c2r_1d(size,spectrum,phi->val,FFTW_ESTIMATE||FFTW_PRESERVE_INPUT);
+		double *spectralFactor = (double *)malloc(spectralSize*sizeof(*spectralFactor));
 
-	solver->spectrum = spectrum;
-	solver->spectralFactor = spectralFactor;
+		spectralFactor[0] = 0; // Actually infinity
+		for(int n=1; n<spectralSize; n++){
+
+			// Spectral multiplier turning rho into phi
+			spectralFactor[n] = size/(2*M_PI*n);
+			spectralFactor[n] *= spectralFactor[n];
+
+			// Part of IFFT operations
+			spectralFactor[n] /= size;
+		}
+
+		fftw_complex *spectrum = (fftw_complex *)fftw_malloc(spectralSize*sizeof(fftw_complex));
+
+		// The true nodes are contiguous in 1D, so the transforms can work
+		// directly on them, leaving the ghost nodes alone. The c2r-transform
+		// is allowed to destroy the spectrum, which is more efficient.
+		double *rhoTrue = &rho->val[rho->nGhostLayers[1]];
+		double *phiTrue = &phi->val[phi->nGhostLayers[1]];
+		solver->fftForward = fftw_plan_dft_r2c_1d(size,rhoTrue,spectrum,flags);
+		solver->fftInverse = fftw_plan_dft_c2r_1d(size,spectrum,phiTrue,flags|FFTW_DESTROY_INPUT);
+
+		solver->spectrum = spectrum;
+		solver->spectralFactor = spectralFactor;
+	}
+
+	if(useWisdom){
+		fftw_mpi_gather_wisdom(comm);
+		if(mpiInfo->mpiRank == 0) fftw_export_wisdom_to_filename(wisdom);
+	}
+	free(wisdom);
 
 	return solver;
 }
@@ -55,10 +248,21 @@ void sFree(SpectralSolver *solver){
 
 	fftw_destroy_plan(solver->fftForward);
 	fftw_destroy_plan(solver->fftInverse);
-	fftw_cleanup();
+
+	if(solver->slab){
+		for(int r = 0; r < solver->mpiSize; r++){
+			if(solver->gridCounts[r]) MPI_Type_free(&solver->gridTypes[r]);
+			if(solver->slabCounts[r]) MPI_Type_free(&solver->slabTypes[r]);
+		}
+		free(solver->gridTypes);
+		free(solver->gridCounts);
+		fftw_free(solver->slab);
+	}
+
+	fftw_free(solver->spectrum);
+	fftw_mpi_cleanup();
 
 	free(solver->spectralFactor);
-	free(solver->spectrum);
 	free(solver);
 }
 
@@ -70,34 +274,71 @@ void sFree(SpectralSolver *solver){
  */
 void sSolver(	void (**solve)(),
 				SpectralSolver *(**solverAlloc)(),
-				void (**solverFree)()){
+				void (**solverFree)(),
+				void (**solverWriteCheckpoint)(),
+				void (**solverReadCheckpoint)()){
 
 	*solve=sSolve;
 	*solverAlloc=sAlloc;
 	*solverFree=sFree;
+	*solverWriteCheckpoint=NULL;	// No state between solves
+	*solverReadCheckpoint=NULL;
 }
 
 funPtr sSolver_set(dictionary *ini){
 
 	int nDims = iniGetInt(ini,"grid:nDims");
-	if(nDims!=1) msg(ERROR,"sMode only works with grid:nDims=1");
+	if(nDims>3) msg(ERROR,"sSolver only works with grid:nDims up to 3");
 
-	int *nSubdomains = iniGetIntArr(ini, "grid:nSubdomains", nDims);
-	if(nSubdomains[0]!=1) msg(ERROR,"sMode only works with grid:nSubdomains=1");
-	free(nSubdomains);
+	if(nDims==1){
+		int *nSubdomains = iniGetIntArr(ini, "grid:nSubdomains", nDims);
+		if(nSubdomains[0]!=1) msg(ERROR,"sSolver only works with grid:nSubdomains=1 in 1D");
+		free(nSubdomains);
+	}
+
+	char *boundaries = iniGetStr(ini, "grid:boundaries");
+	if(strcmp(boundaries, "PERIODIC"))
+		msg(ERROR,"sSolver only works with PERIODIC grid:boundaries");
+	free(boundaries);
 
 	return sSolver;
 }
 
+/**
+ * @brief Solves phi given rho in 2D and 3D
+ *
+ * rho is moved from the subdomains to the slabs, and phi back again, by
+ * the types of sAllocDistributed().
+ */
+static void sSolveDistributed(const SpectralSolver *solver,
+	const Grid *rho, Grid *phi){
+
+	MPI_Alltoallw(rho->val, solver->gridCounts, solver->displs, solver->gridTypes,
+				  solver->slab, solver->slabCounts, solver->displs, solver->slabTypes,
+				  solver->comm);
+
+	fftw_execute(solver->fftForward);
+
+	fftw_complex *spectrum = solver->spectrum;
+	const double *spectralFactor = solver->spectralFactor;
+	for(long int g=0; g<solver->spectralSize; g++){
+		spectrum[g] *= spectralFactor[g];
+	}
+
+	fftw_execute(solver->fftInverse);
+
+	MPI_Alltoallw(solver->slab, solver->slabCounts, solver->displs, solver->slabTypes,
+				  phi->val, solver->gridCounts, solver->displs, solver->gridTypes,
+				  solver->comm);
+}
+
 void sSolve(const SpectralSolver *solver,
 	Grid *rho, Grid *phi, const MpiInfo *mpiInfo){
 
-	int rank = rho->rank;
-	int *nGhostLayers = (int *)malloc(2*rank*sizeof(*nGhostLayers));
-	memcpy(nGhostLayers, rho->nGhostLayers, 2*rank*sizeof(*nGhostLayers));
-
-	gRemoveHalo(rho);
-	gRemoveHalo(phi);
+	if(solver->slab){
+		sSolveDistributed(solver, rho, phi);
+		return;
+	}
 
 	fftw_execute(solver->fftForward);
 
@@ -109,9 +350,6 @@ void sSolve(const SpectralSolver *solver,
 	}
 
 	fftw_execute(solver->fftInverse);
-
-	gInsertHalo(rho, nGhostLayers);
-	gInsertHalo(phi, nGhostLayers);
 }
 
 funPtr sMode_set(dictionary *ini){
@@ -130,7 +368,7 @@ void sMode(dictionary *ini){
 	Grid *rho = gAlloc(ini, SCALAR);
 	MpiInfo *mpiInfo = gAllocMpi(ini);
 
-	SpectralSolver *solver = sAlloc(ini, rho, phi);
+	SpectralSolver *solver = sAlloc(ini, rho, phi, mpiInfo);
 
 	int *trueSize = rho->trueSize;
 	int *nGhostLayers = rho->nGhostLayers;
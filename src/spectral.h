@@ -6,10 +6,17 @@
 #ifndef SPECTRAL_H
 #define SPECTRAL_H
 
-#include <fftw3.h>
+#include <fftw3-mpi.h>
 
 /**
  * @brief Spectral solver
+ *
+ * In 1D the transforms are serial and work in-place on rho and phi. In 2D and
+ * 3D they are distributed by FFTW-MPI in slabs along the last dimension, and
+ * spectrum, spectralFactor and spectralSize are those of this process' slab.
+ * rho and phi are moved between the subdomains and the slabs by
+ * MPI_Alltoallw() with the other variables, which are only set (and slab
+ * non-NULL) in 2D and 3D.
  */
 typedef struct {
 	fftw_plan fftForward;		///< Forward FFT
@@ -17,6 +24,14 @@ typedef struct {
 	fftw_complex *spectrum;		///< To hold the spectrum
 	double *spectralFactor;		///< Multiplicative factor which turns rho into phi
     long int spectralSize;		///< Size of spectrum and spectralFactor
+	double *slab;				///< Real slab, with rows padded as FFTW requires
+	MPI_Comm comm;				///< Communicator of the subdomains (mpiInfo->comm)
+	int mpiSize;				///< Number of processes in comm
+	MPI_Datatype *gridTypes;	///< Part of the subdomain in each process' slab
+	MPI_Datatype *slabTypes;	///< Part of each process' subdomain in the slab
+	int *gridCounts;			///< Whether gridTypes is non-empty, per process
+	int *slabCounts;			///< Whether slabTypes is non-empty, per process
+	int *displs;				///< Zero displacements, per process
 } SpectralSolver;
 
 /**
@@ -28,12 +43,24 @@ funPtr sMode_set(dictionary *ini);
 
 /**
  * @brief Allocates and initializes SpectralSolver
- * @param  ini Input file
- * @param  rho Charge density (source)
- * @param  phi Electric potential (unknown)
- * @return     SpectralSolver
+ * @param  ini		Input file
+ * @param  rho		Charge density (source)
+ * @param  phi		Electric potential (unknown)
+ * @param  mpiInfo	MpiInfo
+ * @return			SpectralSolver
+ *
+ * The multiplier turning the spectrum of rho into that of phi is 1/k^2 for
+ * the wave vector k of each frequency, normalized for the inverse FFT.
+ * Collective, and must be reallocated when the subdomains change.
+ *
+ * methods:fftPlanning is the FFTW planner rigor (ESTIMATE, MEASURE, PATIENT
+ * or EXHAUSTIVE). Except with ESTIMATE the planning itself runs transforms,
+ * overwriting rho and phi in 1D. To not repeat it every run, the wisdom is
+ * imported from and exported to the file methods:fftWisdom (NONE for no
+ * file), such that only the first run is slow.
  */
-SpectralSolver* sAlloc(const dictionary *ini, const Grid *rho, Grid *phi);
+SpectralSolver* sAlloc(const dictionary *ini, const Grid *rho, Grid *phi,
+					   const MpiInfo *mpiInfo);
 
 /**
  * @brief Frees SpectralSolver
@@ -114,6 +114,7 @@ void uNormalize(dictionary *ini, const Units *units){
 	iniScaleDouble(ini, "population:thermalVelocity", 1.0/units->velocity);
 	iniScaleDouble(ini, "population:drift", 1.0/units->velocity);
 	iniScaleDouble(ini, "population:perturbAmplitude", 1.0/units->length);
+	iniScaleDouble(ini, "diagnostics:velMax", 1.0/units->velocity);
 	iniScaleDouble(ini, "fields:BExt", 1.0/units->bField);
 	iniScaleDouble(ini, "fields:EExt", 1.0/units->eField);
 
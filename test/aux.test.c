@@ -4,7 +4,7 @@
  * @author		Sigvald Marholm <sigvaldm@fys.uio.no>,
  */
 
-#include "pinc.h"
+#include "core.h"
 #include "test.h"
 
 static int testAiProd(){
@@ -32,8 +32,146 @@ static int testAEq(){
 	return 0;
 }
 
+static int testAdInvert(){
+
+	// Needs pivoting since a[0] is zero
+	double a[] = {0,2,1, 1,1,0, 3,0,1};
+	double b[] = {0,2,1, 1,1,0, 3,0,1};
+	adInvert(b,3);
+
+	double prod[9];
+	for(int i=0;i<3;i++) for(int j=0;j<3;j++){
+		prod[i*3+j] = 0;
+		for(int k=0;k<3;k++) prod[i*3+j] += a[i*3+k]*b[k*3+j];
+	}
+	double identity[] = {1,0,0, 0,1,0, 0,0,1};
+	utAssert(adEq(prod,identity,9,1e-14),"adInvert() is broken");
+
+	return 0;
+}
+
+static int testAdSum(){
+
+	// Adding 0.1 one at a time is off by about 2e-4 after 1e7 terms
+	long int n = 10000000;
+	double *a = malloc(n*sizeof(*a));
+	adSetAll(a,n,0.1);
+
+	utAssert(fabs(adSum(a,n)-n*0.1)<1e-8,"adSum is inaccurate");
+	utAssert(fabs(adDotProd(a,a,n)-n*0.01)<1e-9,"adDotProd is inaccurate");
+
+	int b[] = {1,2,3};
+	utAssert(aiDotProd(b,b,3)==14,"aiDotProd is broken");
+
+	free(a);
+	return 0;
+}
+
+static int testReduction(){
+
+	int mpiSize;
+	MPI_Comm_size(MPI_COMM_WORLD,&mpiSize);
+
+	Reduction *red = rAlloc(MPI_SUM);
+
+	// More scalars than initially allocated for, registered in two rounds
+	double a = 1;
+	double b[40];
+	for(int i=0;i<40;i++) b[i] = i;
+
+	for(int round=0;round<2;round++){
+		rAdd(red,&a,1);
+		rAdd(red,b,40);
+		rBegin(red);
+		rEnd(red);
+	}
+
+	utAssert(a==mpiSize*mpiSize,"rEnd doesn't reduce the registered scalars");
+	utAssert(b[39]==39*mpiSize*mpiSize,"rEnd doesn't reduce the registered scalars");
+
+	// The registry is cleared by rEnd()
+	rBegin(red);
+	rEnd(red);
+	utAssert(a==mpiSize*mpiSize,"rEnd doesn't clear the registry");
+
+	rFree(red);
+
+	return 0;
+}
+
+static int testArena(){
+
+	Arena *arena = arAlloc(3*arPad(100*sizeof(double)),0);
+
+	double *a = arGet(arena,100*sizeof(double));
+	int *b = arGet(arena,3*sizeof(int));
+	double *c = arGet(arena,100*sizeof(double));
+
+	utAssert((size_t)a%ARENA_ALIGN==0,"arGet returns unaligned piece");
+	utAssert((size_t)b%ARENA_ALIGN==0,"arGet returns unaligned piece");
+	utAssert((size_t)c%ARENA_ALIGN==0,"arGet returns unaligned piece");
+	utAssert((char*)b-(char*)a==arPad(100*sizeof(double)),"arGet doesn't hand out consecutive pieces");
+	utAssert(a[99]==0 && c[0]==0,"arAlloc doesn't zero the arena");
+	utAssert(arPad(1)==ARENA_ALIGN && arPad(ARENA_ALIGN)==ARENA_ALIGN,"arPad is broken");
+
+	arFree(arena);
+
+	return 0;
+}
+
+// Known answers from Salmon et al., and variates independent of the batching
+static int testPhilox(){
+
+	Philox ph;
+	unsigned int res[4];
+
+	phSet(&ph,0,0);
+	phRandom(&ph,0,res);
+	unsigned int zeros[] = {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8};
+	utAssert(aiEq((int*)res,(int*)zeros,4),"Wrong Philox4x32-10 of zero counter and key");
+
+	ph.key[0] = 0xa4093822;
+	ph.key[1] = 0x299f31d0;
+	ph.stream[0] = 0x13198a2e;
+	ph.stream[1] = 0x03707344;
+	phRandom(&ph,0x85a308d3243f6a88UL,res);
+	unsigned int pi[] = {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1};
+	utAssert(aiEq((int*)res,(int*)pi,4),"Wrong Philox4x32-10 of digits of pi");
+
+	int n = 10001;
+	double *all = malloc(n*sizeof(*all));
+	double *part = malloc(n*sizeof(*part));
+
+	phSet(&ph,1234,5);
+	phGaussian(&ph,0,all,n);
+	phGaussian(&ph,0,part,100);
+	phGaussian(&ph,50,&part[100],n-100);
+	utAssert(adEq(all,part,n,0),"phGaussian() depends on the batching");
+
+	double mean = adSum(all,n)/n;
+	double var = 0;
+	for(int i=0;i<n;i++) var += (all[i]-mean)*(all[i]-mean)/n;
+	utAssert(fabs(mean)<0.05 && fabs(var-1)<0.05,"phGaussian() not standard normal");
+
+	phUniform(&ph,0,all,n);
+	int inRange = 1;
+	for(int i=0;i<n;i++) inRange &= all[i]>0 && all[i]<1;
+	mean = adSum(all,n)/n;
+	utAssert(inRange && fabs(mean-0.5)<0.02,"phUniform() not uniform on (0,1)");
+
+	free(all);
+	free(part);
+
+	return 0;
+}
+
 // All tests for aux.c is contained in this function
 void testAux(){
 	utRun(&testAiProd);
 	utRun(&testAEq);
+	utRun(&testAdInvert);
+	utRun(&testAdSum);
+	utRun(&testReduction);
+	utRun(&testArena);
+	utRun(&testPhilox);
 }
@@ -5,7 +5,7 @@
  *				Gullik Vetvik Killie <gullikvk@student.matnat.uio.no>
  */
 
-#include "pinc.h"
+#include "core.h"
 #include "test.h"
 #include "iniparser.h"
 #include <math.h>
@@ -34,27 +34,125 @@ static int testGAlloc(){
 	int *size = grid->size;
 	long int *sizeProd = grid->sizeProd;
 	int *nGhostLayers = grid->nGhostLayers;
-	double *stepSize = grid->stepSize;
 
 	int expectedSize[] = {2,5,4,3};
 	long int expectedSizeProd[] = {1,2,10,40,120};
 	int expectedNGhostLayers[] = {0,0,0,0,0,0};
-	double expectedStepSize[] = {1,1,1,1};
 
 	utAssert(grid->rank==4,"wrong rank assigned by gAlloc");
 	utAssert(aiEq(size        ,expectedSize        ,4),"wrong size assigned by gAlloc");
 	utAssert(alEq(sizeProd    ,expectedSizeProd    ,5),"wrong sizeProd assigned by gAlloc");
 	utAssert(aiEq(nGhostLayers,expectedNGhostLayers,6),"wrong nGhostLayers assigned by gAlloc");
-	utAssert(adEq(stepSize    ,expectedStepSize    ,4,0),"wrong stepSize assigned by gAlloc");
 
 	return 0;
 
 }
 
 static int testSwapHalo(){
-	//Not written because several comp nodes are not run in test mode,
-	//instead done in main.local.c
 
+	// On a single MPI node with periodic boundaries each subdomain is its own
+	// neighbor, and the result can be compared to shuffling slices manually.
+	dictionary *ini = iniGetDummy();
+	iniparser_set(ini,"grid:nDims","3");
+	iniparser_set(ini,"grid:trueSize","5,4,3");
+	iniparser_set(ini,"grid:nGhostLayers","1,1,1,1,1,1");
+	iniparser_set(ini,"grid:boundaries","PERIODIC");
+	iniparser_set(ini,"population:nSpecies","1");
+
+	Grid *grid = gAlloc(ini,SCALAR);
+	Grid *expected = gAlloc(ini,SCALAR);
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+
+	int rank = grid->rank;
+	int *size = grid->size;
+	long int nElements = grid->sizeProd[rank];
+	double *slice = malloc(nElements*sizeof(*slice));
+
+	// Set
+	for(long int p=0;p<nElements;p++) grid->val[p] = expected->val[p] = p;
+	for(int d=1;d<rank;d++){
+		getSlice(slice,expected,d,1);
+		setSlice(slice,expected,d,size[d]-1);
+		getSlice(slice,expected,d,size[d]-2);
+		setSlice(slice,expected,d,0);
+	}
+	gHaloOp(setSlice,grid,mpiInfo,TOHALO);
+	utAssert(adEq(grid->val,expected->val,nElements,0),"gHaloOp with setSlice sets wrong ghost layers");
+
+	// Add
+	for(long int p=0;p<nElements;p++) grid->val[p] = expected->val[p] = p;
+	for(int d=1;d<rank;d++){
+		getSlice(slice,expected,d,0);
+		addSlice(slice,expected,d,size[d]-2);
+		getSlice(slice,expected,d,size[d]-1);
+		addSlice(slice,expected,d,1);
+	}
+	gHaloOp(addSlice,grid,mpiInfo,FROMHALO);
+	utAssert(adEq(grid->val,expected->val,nElements,0),"gHaloOp with addSlice adds wrong ghost layers");
+
+	// Faces only, with edges and corners untouched
+	for(long int p=0;p<nElements;p++) grid->val[p] = expected->val[p] = p;
+	gHaloOp(setSlice,expected,mpiInfo,TOHALO);
+	gHaloOpFaces(grid,mpiInfo,TOHALO);
+	int correct = 1;
+	for(int l=0;l<size[3];l++) for(int k=0;k<size[2];k++) for(int j=0;j<size[1];j++){
+		long int p = j + k*size[1] + l*size[1]*size[2];
+		int nGhost = (j==0||j==size[1]-1) + (k==0||k==size[2]-1) + (l==0||l==size[3]-1);
+		if(nGhost<2 && grid->val[p]!=expected->val[p]) correct = 0;
+		if(nGhost>=2 && grid->val[p]!=p) correct = 0;
+	}
+	utAssert(correct,"gHaloOpFaces sets wrong ghost layers");
+
+	free(slice);
+	gFree(grid);
+	gFree(expected);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+static int testGHaloColor(){
+
+	// With even sizes, the color of a ghost node is that of the node it is
+	// copied from, and only ghost nodes of the color sent should change.
+	dictionary *ini = iniGetDummy();
+	iniparser_set(ini,"grid:nDims","3");
+	iniparser_set(ini,"grid:trueSize","6,4,2");
+	iniparser_set(ini,"grid:nGhostLayers","1,1,1,1,1,1");
+	iniparser_set(ini,"grid:boundaries","PERIODIC");
+	iniparser_set(ini,"population:nSpecies","1");
+
+	Grid *grid = gAlloc(ini,SCALAR);
+	Grid *expected = gAlloc(ini,SCALAR);
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	gCreateColorHalo(grid);
+
+	int rank = grid->rank;
+	int *size = grid->size;
+	long int nElements = grid->sizeProd[rank];
+
+	for(int color=0;color<2;color++){
+		for(long int p=0;p<nElements;p++) grid->val[p] = expected->val[p] = p;
+		gHaloOpFaces(expected,mpiInfo,TOHALO);
+		gHaloOpColorBegin(grid,mpiInfo,color);
+		gHaloOpEnd(grid);
+
+		int correct = 1;
+		for(int l=0;l<size[3];l++) for(int k=0;k<size[2];k++) for(int j=0;j<size[1];j++){
+			long int p = j + k*size[1] + l*size[1]*size[2];
+			int nGhost = (j==0||j==size[1]-1) + (k==0||k==size[2]-1) + (l==0||l==size[3]-1);
+			int sent = nGhost==1 && (j+k+l)%2==color;
+			if(sent && grid->val[p]!=expected->val[p]) correct = 0;
+			if(!sent && grid->val[p]!=p) correct = 0;
+		}
+		utAssert(correct,"gHaloOpColorBegin sets wrong ghost nodes");
+	}
+
+	gFree(grid);
+	gFree(expected);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
 
 	return 0;
 }
@@ -261,6 +359,193 @@ static int testSwapHalo(){
 // 	return;
 // }
 
+static int testGHaloTime(){
+
+	// Halo functions only count time when the grid has a counter, and grids
+	// sharing one add to it.
+	dictionary *ini = iniGetDummy();
+	iniparser_set(ini,"grid:nDims","3");
+	iniparser_set(ini,"grid:trueSize","6,4,2");
+	iniparser_set(ini,"grid:nGhostLayers","1,1,1,1,1,1");
+	iniparser_set(ini,"grid:boundaries","PERIODIC");
+	iniparser_set(ini,"population:nSpecies","1");
+
+	Grid *grid = gAlloc(ini,SCALAR);
+	Grid *other = gAlloc(ini,SCALAR);
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+
+	utAssert(grid->haloTime==NULL,"gAlloc doesn't leave haloTime NULL");
+	gHaloOp(setSlice,grid,mpiInfo,TOHALO);
+
+	unsigned long long int haloTime = 0;
+	grid->haloTime = &haloTime;
+	gHaloOp(setSlice,grid,mpiInfo,TOHALO);
+	unsigned long long int afterOne = haloTime;
+	utAssert(afterOne>0,"gHaloOp doesn't add to haloTime");
+
+	other->haloTime = &haloTime;
+	gHaloOpFaces(other,mpiInfo,TOHALO);
+	utAssert(haloTime>afterOne,"gHaloOpFaces doesn't add to haloTime");
+
+	grid->haloTime = NULL;
+	other->haloTime = NULL;
+	unsigned long long int before = haloTime;
+	gHaloOp(setSlice,grid,mpiInfo,TOHALO);
+	utAssert(haloTime==before,"gHaloOp adds time without haloTime");
+
+	gFree(grid);
+	gFree(other);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+static int testGHaloBoxes(){
+
+	// The interior and shell should cover each true node exactly once, also
+	// when the grid is too thin to have an interior
+	dictionary *ini = iniGetDummy();
+	iniparser_set(ini,"grid:nDims","3");
+	iniparser_set(ini,"grid:nGhostLayers","1,1,1,1,1,1");
+	iniparser_set(ini,"grid:boundaries","PERIODIC");
+
+	const char *trueSizes[] = {"5,4,3", "1,2,6"};
+	for(int t=0;t<2;t++){
+
+		iniparser_set(ini,"grid:trueSize",trueSizes[t]);
+		Grid *grid = gAlloc(ini,SCALAR);
+		gZero(grid);
+
+		int rank = grid->rank;
+		int *box = grid->haloBoxes;
+		for(int b=0;b<2*rank-1;b++){
+			int *lower = &box[2*rank*b];
+			int *upper = &box[2*rank*b+rank];
+			long int nRows = gBoxRows(grid,lower,upper);
+			for(long int r=0;r<nRows;r++){
+				long int g = gBoxRowStart(grid,lower,upper,r);
+				for(int j=lower[1];j<upper[1];j++) grid->val[g++] += 1;
+			}
+		}
+
+		int *size = grid->size;
+		int interior = 0;
+		int correct = 1;
+		for(int l=0;l<size[3];l++) for(int k=0;k<size[2];k++) for(int j=0;j<size[1];j++){
+			long int p = j + k*size[1] + l*size[1]*size[2];
+			int isTrue = j>0 && j<size[1]-1 && k>0 && k<size[2]-1 && l>0 && l<size[3]-1;
+			if(grid->val[p]!=isTrue) correct = 0;
+			if(j>1 && j<size[1]-2 && k>1 && k<size[2]-2 && l>1 && l<size[3]-2) interior++;
+		}
+		utAssert(correct,"haloBoxes does not cover the true grid exactly once");
+		utAssert(gBoxRows(grid,&box[0],&box[rank])*(box[rank+1]-box[1])==interior,"wrong size of interior in haloBoxes");
+
+		gFree(grid);
+	}
+
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+static int testGTiles(){
+
+	// The tiled stencil kernels should give exactly the same result as when
+	// traversing each box in one piece
+	dictionary *ini = iniGetDummy();
+	iniparser_set(ini,"grid:nDims","3");
+	iniparser_set(ini,"grid:trueSize","40,36,32");
+	iniparser_set(ini,"grid:nGhostLayers","1,1,1,1,1,1");
+	iniparser_set(ini,"grid:boundaries","PERIODIC");
+
+	Grid *phi = gAlloc(ini,SCALAR);
+	Grid *rho = gAlloc(ini,SCALAR);
+	Grid *res = gAlloc(ini,SCALAR);
+	Grid *resRef = gAlloc(ini,SCALAR);
+	Grid *E = gAlloc(ini,VECTOR);
+	Grid *ERef = gAlloc(ini,VECTOR);
+
+	long int nNodes = phi->sizeProd[phi->rank];
+	for(long int p=0;p<nNodes;p++){
+		phi->val[p] = sin(0.1*p);
+		rho->val[p] = cos(0.3*p);
+	}
+
+	int untiled[] = {40,36,32};
+	int tiled[] = {7,5,0};
+
+	gZero(resRef);
+	gZero(ERef);
+	gSetTileSize(phi,untiled);
+	gFinDiff2nd3D(resRef,phi);
+	gFinDiff1st(phi,ERef);
+
+	gZero(res);
+	gZero(E);
+	gSetTileSize(phi,tiled);
+	gFinDiff2nd3D(res,phi);
+	gFinDiff1st(phi,E);
+
+	utAssert(phi->tileSize[2]==5 && phi->tileSize[3]==32,"gSetTileSize sets wrong tile size");
+	utAssert(adEq(res->val,resRef->val,nNodes,0),"tiled gFinDiff2nd3D differs from untiled");
+	utAssert(adEq(E->val,ERef->val,E->sizeProd[E->rank],0),"tiled gFinDiff1st differs from untiled");
+
+	gZero(res);
+	gFinDiff2ndND(res,phi);
+	utAssert(adEq(res->val,resRef->val,nNodes,1e-12),"tiled gFinDiff2ndND differs from gFinDiff2nd3D");
+
+	gZero(res);
+	gSetTileSize(phi,NULL);
+	gFinDiff2nd3DAdd(res,phi,rho);
+	int correct = 1;
+	int *size = phi->size;
+	for(int l=1;l<size[3]-1;l++) for(int k=1;k<size[2]-1;k++) for(int j=1;j<size[1]-1;j++){
+		long int p = j + k*size[1] + l*size[1]*size[2];
+		if(res->val[p]!=resRef->val[p]+rho->val[p]) correct = 0;
+	}
+	utAssert(correct,"gFinDiff2nd3DAdd differs from gFinDiff2nd3D followed by addition");
+
+	gFree(phi);
+	gFree(rho);
+	gFree(res);
+	gFree(resRef);
+	gFree(E);
+	gFree(ERef);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+static int testGBalanceCuts(){
+
+	// Evenly spread particles should give equally large parts
+	long int hist[16];
+	int cuts[5];
+	int expected[5];
+
+	alSetAll(hist,16,3);
+	gBalanceCuts(hist,16,4,2,cuts);
+	aiSet(expected,5,0,4,8,12,16);
+	utAssert(aiEq(cuts,expected,5),"Wrong cuts for uniform histogram");
+
+	// Particles concentrated in the middle should give small parts there,
+	// but no part smaller than the granularity
+	alSetAll(hist,16,1);
+	hist[6] = hist[7] = hist[8] = hist[9] = 20;
+	gBalanceCuts(hist,16,4,2,cuts);
+	aiSet(expected,5,0,6,8,10,16);
+	utAssert(aiEq(cuts,expected,5),"Wrong cuts for peaked histogram");
+
+	alSetAll(hist,16,0);
+	hist[0] = 100;
+	gBalanceCuts(hist,16,4,4,cuts);
+	aiSet(expected,5,0,4,8,12,16);
+	utAssert(aiEq(cuts,expected,5),"Parts smaller than the granularity");
+
+	return 0;
+}
+
 static int testGCreateNeighborhood(){
 
 	dictionary *ini = iniGetDummy();
@@ -286,7 +571,7 @@ static int testGCreateNeighborhood(){
 	utAssert(mpiInfo->neighborhoodCenter==13, "Wrong center of tha hood computed: %i",mpiInfo->neighborhoodCenter);
 
 	double *result = malloc(6*sizeof(*result));
-	adSet(result,6,1.5,1.5,1.0,8.5,9.5,11.0);
+	adSet(result,6,1.5,1.5,1.0,10.5,11.5,12.0);
 	utAssert(adEq(mpiInfo->thresholds,result,6,pow(10,-15)), "Wrong thresholds assigned (using negative values)");
 
 	long int *resultl = malloc(27*sizeof(*resultl));
@@ -316,6 +601,11 @@ void testGrid(){
 
 	// utRun(&testGValDebug);
 	utRun(&testSwapHalo);
+	utRun(&testGHaloColor);
+	utRun(&testGHaloTime);
+	utRun(&testGHaloBoxes);
+	utRun(&testGTiles);
+	utRun(&testGBalanceCuts);
 	// utRun(&testFinDiff1st);
 	// utRun(&testFinDiff2nd2D);
 	// utRun(&testgFinDiff2nd3D);
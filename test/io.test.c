@@ -4,9 +4,102 @@
  * @author		Sigvald Marholm <sigvaldm@fys.uio.no>,
  */
 
-#include "pinc.h"
+#include "core.h"
 #include "test.h"
+#include <math.h>
+#include <stdio.h>
+
+/*
+ * Everything written to a checkpoint should be read back bit for bit, into
+ * structs that don't hold it already. The particles are out of cell order and
+ * of unequal weight, as they are during a run.
+ */
+static int testCheckpoint(){
+
+	dictionary *ini = iniGetDummy();
+	iniparser_set(ini,"files:output","data/test");
+	iniparser_set(ini,"grid:trueSize","5,4,3");
+	iniparser_set(ini,"grid:nGhostLayers","1,1,1,1,1,1");
+	iniparser_set(ini,"population:nSpecies","2");
+	iniparser_set(ini,"population:nAlloc","50,50");
+	iniparser_set(ini,"population:charge","-1,1");
+	iniparser_set(ini,"population:mass","1,1836");
+	iniparser_set(ini,"population:mergeInterval","1");
+	iniparser_set(ini,"population:ppcRange","4,8");
+	iniparser_set(ini,"methods:acc","puAcc3D1KEWeighted");
+	iniparser_set(ini,"methods:distr","puDistr3D1Weighted");
+	iniparser_set(ini,"methods:migrate","puExtractEmigrants3DWeighted");
+	iniparser_set(ini,"methods:sweep","puSweepSplit");
+
+	Grid *phi = gAlloc(ini,SCALAR);
+	Grid *phiRead = gAlloc(ini,SCALAR);
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Population *pop = pAlloc(ini);
+	Population *popRead = pAlloc(ini);
+	gsl_rng *rng = gsl_rng_alloc(gsl_rng_mt19937);
+	gsl_rng *rngRead = gsl_rng_alloc(gsl_rng_mt19937);
+
+	long int nNodes = phi->sizeProd[phi->rank];
+	for(long int j=0;j<nNodes;j++) phi->val[j] = sin(0.3*j)/3;
+	gZero(phiRead);
+
+	for(int i=0;i<30;i++){
+		double pos[] = {fmod(0.37*i,5), fmod(0.71*i,4), fmod(0.13*i,3)};
+		double vel[] = {i/3.0, -i/7.0, i*PI};
+		pNew(pop,i%3==0,pos,vel);
+		pop->weight[pop->iStop[i%3==0]-1] = 1+1/(i+3.0);
+	}
+
+	gsl_rng_set(rng,42);
+	for(int i=0;i<10;i++) gsl_rng_get(rng);
+	gsl_rng_set(rngRead,7);
+
+	hid_t ck = ckCreate(ini,7);
+	pWriteCheckpoint(ck,pop);
+	gWriteCheckpoint(ck,"phi",phi);
+	gWriteCheckpointMpi(ck,mpiInfo);
+	ckWriteRng(ck,"rng",rng);
+	ckClose(ini,ck);
+
+	long int n;
+	ck = ckOpen(ini,&n);
+	pReadCheckpoint(ck,popRead);
+	gReadCheckpoint(ck,"phi",phiRead);
+	int moved = gReadCheckpointMpi(ck,mpiInfo);
+	ckReadRng(ck,"rng",rngRead);
+	H5Fclose(ck);
+
+	utAssert(n==7,"Wrong time-step read from checkpoint");
+	utAssert(!moved,"Cuts between the subdomains changed by checkpoint");
+	utAssert(adEq(phi->val,phiRead->val,nNodes,0),"Grid not restored");
+
+	for(int s=0;s<2;s++){
+		long int iStart = pop->iStart[s];
+		long int nParticles = pop->iStop[s]-iStart;
+		utAssert(popRead->iStop[s]-popRead->iStart[s]==nParticles,"Wrong number of particles restored");
+		utAssert(utPopEq(&pop->pos[3*iStart],&popRead->pos[3*iStart],3*nParticles,0),"Positions not restored");
+		utAssert(utPopEq(&pop->vel[3*iStart],&popRead->vel[3*iStart],3*nParticles,0),"Velocities not restored");
+		utAssert(utPopEq(&pop->weight[iStart],&popRead->weight[iStart],nParticles,0),"Weights not restored");
+	}
+
+	for(int i=0;i<10;i++)
+		utAssert(gsl_rng_get(rng)==gsl_rng_get(rngRead),"Random number generator not restored");
+
+	remove("data/test_checkpoint.0.ck.h5");
+
+	gsl_rng_free(rng);
+	gsl_rng_free(rngRead);
+	pFree(pop);
+	pFree(popRead);
+	gFreeMpi(mpiInfo);
+	gFree(phi);
+	gFree(phiRead);
+	iniClose(ini);
+
+	return 0;
+}
 
 // All tests for io.c is contained in this function
 void testIo(){
+	utRun(&testCheckpoint);
 }
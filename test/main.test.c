@@ -19,6 +19,7 @@ int main(int argc, char *argv[]){
 	testPopulation();
 	testPusher();
 	testMultigrid();
+	testObject();
 	utSummary();
 
 	MPI_Finalize();
@@ -4,7 +4,7 @@
  * @author		Gullik Vetvik Killie <gullikvk@student.matnat.uio.no>
  */
 
-#include "pinc.h"
+#include "core.h"
 #include "test.h"
 #include "multigrid.h"
 #include "iniparser.h"
@@ -18,8 +18,7 @@ static int testStructs(){
 
 	dictionary *ini = iniGetDummy();
 
-	iniparser_set(ini, "grid:trueSize", "12,12,12");
-	iniparser_set(ini, "grid:stepSize", "1,1,1");
+	iniparser_set(ini, "grid:trueSize", "16,16,16");
 	iniparser_set(ini, "grid:nGhostLayers", "0,0,0,0,0,0");
 
 
@@ -58,6 +57,291 @@ static int testmgGS(){
 	return 0;
 }
 
+static int testMgcgSolve(){
+
+	// The residual should vanish on the unknown nodes, for CG (periodic) and
+	// BiCGStab (Dirichlet). gDirichlet() fixes the lowest true nodes and the
+	// upper ghost nodes at 1.
+	const char *boundaries[] = {"PERIODIC", "DIRICHLET"};
+
+	for(int b=0;b<2;b++){
+		dictionary *ini = iniGetDummy();
+		iniparser_set(ini,"grid:nDims","3");
+		iniparser_set(ini,"grid:trueSize","8,8,8");
+		iniparser_set(ini,"grid:nGhostLayers","1,1,1,1,1,1");
+		iniparser_set(ini,"grid:boundaries",boundaries[b]);
+		iniparser_set(ini,"population:nSpecies","1");
+		iniparser_set(ini,"multigrid:cycle","mgVRecursive");
+		iniparser_set(ini,"multigrid:preSmooth","gaussSeidelRB");
+		iniparser_set(ini,"multigrid:postSmooth","gaussSeidelRB");
+		iniparser_set(ini,"multigrid:coarseSolver","gaussSeidelRB");
+		iniparser_set(ini,"multigrid:mgLevels","2");
+		iniparser_set(ini,"multigrid:nCoarseSolve","10");
+
+		MpiInfo *mpiInfo = gAllocMpi(ini);
+		Grid *rho = gAlloc(ini,SCALAR);
+		Grid *phi = gAlloc(ini,SCALAR);
+		Grid *res = gAlloc(ini,SCALAR);
+		gSetBndSlices(phi,mpiInfo);
+		MgcgSolver *solver = mgcgAllocSolver(ini,rho,phi,mpiInfo);
+
+		int rank = rho->rank;
+		int *size = rho->size;
+		long int nElements = rho->sizeProd[rank];
+		for(long int p=0;p<nElements;p++){
+			rho->val[p] = (p%7)*0.1;
+			phi->val[p] = 0;
+		}
+		gNeutralizeGrid(rho,mpiInfo);
+
+		mgcgSolve(solver,rho,phi,mpiInfo);
+		mgResidual(res,rho,phi,mpiInfo);
+
+		int skip = b;	// Dirichlet nodes are not unknowns
+		double maxRes = 0;
+		int fixed = 1;
+		for(int l=1;l<size[3];l++) for(int k=1;k<size[2];k++) for(int j=1;j<size[1];j++){
+			long int p = j + k*size[1] + l*size[1]*size[2];
+			int lower = j==1 || k==1 || l==1;
+			int upper = j==size[1]-1 || k==size[2]-1 || l==size[3]-1;
+			if(!(skip && lower) && !upper && fabs(res->val[p])>maxRes) maxRes = fabs(res->val[p]);
+			if(skip && (lower || upper) && phi->val[p]!=1) fixed = 0;
+		}
+		utAssert(maxRes<1e-8,"mgcgSolve does not converge");
+		utAssert(fixed,"mgcgSolve changes Dirichlet nodes");
+
+		mgcgFreeSolver(solver);
+		gFree(rho);
+		gFree(phi);
+		gFree(res);
+		gFreeMpi(mpiInfo);
+		iniparser_freedict(ini);
+	}
+
+	return 0;
+}
+
+static int testMgMixedSolve(){
+
+	// Single precision coarse levels only change the path to the solution,
+	// which is still converged to the tolerance on the double precision
+	// finest level.
+	const char *precisions[] = {"DOUBLE", "MIXED"};
+	double *solution = NULL;
+
+	for(int m=0;m<2;m++){
+		dictionary *ini = iniGetDummy();
+		iniparser_set(ini,"grid:nDims","3");
+		iniparser_set(ini,"grid:trueSize","8,8,8");
+		iniparser_set(ini,"grid:nGhostLayers","1,1,1,1,1,1");
+		iniparser_set(ini,"grid:boundaries","PERIODIC");
+		iniparser_set(ini,"population:nSpecies","1");
+		iniparser_set(ini,"multigrid:cycle","mgVRecursive");
+		iniparser_set(ini,"multigrid:preSmooth","gaussSeidelRB");
+		iniparser_set(ini,"multigrid:postSmooth","gaussSeidelRB");
+		iniparser_set(ini,"multigrid:coarseSolver","gaussSeidelRB");
+		iniparser_set(ini,"multigrid:mgLevels","3");
+		iniparser_set(ini,"multigrid:mgCycles","100");
+		iniparser_set(ini,"multigrid:nCoarseSolve","10");
+		iniparser_set(ini,"multigrid:warmStart","0");
+		iniparser_set(ini,"multigrid:precision",precisions[m]);
+
+		MpiInfo *mpiInfo = gAllocMpi(ini);
+		Grid *rho = gAlloc(ini,SCALAR);
+		Grid *phi = gAlloc(ini,SCALAR);
+		Grid *res = gAlloc(ini,SCALAR);
+		MultigridSolver *solver = mgAllocSolver(ini,rho,phi,mpiInfo);
+
+		utAssert((solver->mgRho->mixed!=NULL)==m,"multigrid:precision not applied");
+
+		int rank = rho->rank;
+		long int nElements = rho->sizeProd[rank];
+		for(long int p=0;p<nElements;p++){
+			rho->val[p] = (p%7)*0.1;
+			phi->val[p] = 0;
+		}
+		gNeutralizeGrid(rho,mpiInfo);
+
+		mgSolve(solver,rho,phi,mpiInfo);
+		gHaloOp(setSlice,phi,mpiInfo,TOHALO);
+		mgResidual(res,rho,phi,mpiInfo);
+
+		int *size = rho->size;
+		double maxRes = 0;
+		double maxDiff = 0;
+		for(int l=1;l<size[3]-1;l++) for(int k=1;k<size[2]-1;k++) for(int j=1;j<size[1]-1;j++){
+			long int p = j + k*size[1] + l*size[1]*size[2];
+			if(fabs(res->val[p])>maxRes) maxRes = fabs(res->val[p]);
+			if(m && fabs(phi->val[p]-solution[p])>maxDiff) maxDiff = fabs(phi->val[p]-solution[p]);
+		}
+		utAssert(maxRes<1e-8,"mgSolve does not converge");
+		utAssert(maxDiff<1e-8,"mixed precision changes the solution");
+
+		if(!m){
+			solution = malloc(nElements*sizeof(*solution));
+			for(long int p=0;p<nElements;p++) solution[p] = phi->val[p];
+		}
+
+		mgFreeSolver(solver);
+		gFree(rho);
+		gFree(phi);
+		gFree(res);
+		gFreeMpi(mpiInfo);
+		iniparser_freedict(ini);
+	}
+
+	free(solution);
+
+	return 0;
+}
+
+static int testMgAutoTune(){
+
+	// The tuner leaves rho and phi as they were, settles on a candidate
+	// reaching the tolerance, and is not repeated by later allocations.
+	dictionary *ini = iniGetDummy();
+	iniparser_set(ini,"grid:nDims","3");
+	iniparser_set(ini,"grid:trueSize","8,8,8");
+	iniparser_set(ini,"grid:nGhostLayers","1,1,1,1,1,1");
+	iniparser_set(ini,"grid:boundaries","PERIODIC");
+	iniparser_set(ini,"population:nSpecies","1");
+	iniparser_set(ini,"multigrid:cycle","mgVRecursive");
+	iniparser_set(ini,"multigrid:preSmooth","jacobian");
+	iniparser_set(ini,"multigrid:postSmooth","jacobian");
+	iniparser_set(ini,"multigrid:coarseSolver","gaussSeidelRB");
+	iniparser_set(ini,"multigrid:mgLevels","2");
+	iniparser_set(ini,"multigrid:mgCycles","100");
+	iniparser_set(ini,"multigrid:nPreSmooth","3");
+	iniparser_set(ini,"multigrid:nPostSmooth","3");
+	iniparser_set(ini,"multigrid:nCoarseSolve","10");
+	iniparser_set(ini,"multigrid:tolerance","1e-10");
+	iniparser_set(ini,"multigrid:toleranceType","ABSOLUTE");
+	iniparser_set(ini,"multigrid:checkInterval","1");
+	iniparser_set(ini,"multigrid:warmStart","0");
+	iniparser_set(ini,"multigrid:agglomerate","0");
+	iniparser_set(ini,"multigrid:autoTune","1");
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Grid *rho = gAlloc(ini,SCALAR);
+	Grid *phi = gAlloc(ini,SCALAR);
+	Grid *res = gAlloc(ini,SCALAR);
+
+	int rank = rho->rank;
+	long int nElements = rho->sizeProd[rank];
+	for(long int p=0;p<nElements;p++){
+		rho->val[p] = (p%7)*0.1;
+		phi->val[p] = (p%5)*0.1;
+	}
+
+	MultigridSolver *solver = mgAllocSolver(ini,rho,phi,mpiInfo);
+
+	int restored = 1;
+	for(long int p=0;p<nElements;p++){
+		if(rho->val[p]!=(p%7)*0.1 || phi->val[p]!=(p%5)*0.1) restored = 0;
+	}
+	utAssert(restored,"multigrid:autoTune changes rho or phi");
+	utAssert(iniGetInt(ini,"multigrid:autoTune")==0,"multigrid:autoTune not reset");
+
+	gNeutralizeGrid(rho,mpiInfo);
+	mgSolve(solver,rho,phi,mpiInfo);
+	gHaloOp(setSlice,phi,mpiInfo,TOHALO);
+	mgResidual(res,rho,phi,mpiInfo);
+
+	int *size = rho->size;
+	double maxRes = 0;
+	for(int l=1;l<size[3]-1;l++) for(int k=1;k<size[2]-1;k++) for(int j=1;j<size[1]-1;j++){
+		long int p = j + k*size[1] + l*size[1]*size[2];
+		if(fabs(res->val[p])>maxRes) maxRes = fabs(res->val[p]);
+	}
+	utAssert(maxRes<1e-8,"multigrid:autoTune chooses a non-converging candidate");
+
+	mgFreeSolver(solver);
+	gFree(rho);
+	gFree(phi);
+	gFree(res);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
+static int testFusedTransfer(){
+
+	// The fused kernels should agree with the separate passes they replace
+	dictionary *ini = iniGetDummy();
+	iniparser_set(ini,"grid:nDims","3");
+	iniparser_set(ini,"grid:trueSize","8,8,8");
+	iniparser_set(ini,"grid:nGhostLayers","1,1,1,1,1,1");
+	iniparser_set(ini,"grid:boundaries","PERIODIC");
+	iniparser_set(ini,"population:nSpecies","1");
+	iniparser_set(ini,"multigrid:preSmooth","gaussSeidelRB");
+	iniparser_set(ini,"multigrid:postSmooth","gaussSeidelRB");
+	iniparser_set(ini,"multigrid:coarseSolver","gaussSeidelRB");
+	iniparser_set(ini,"multigrid:mgLevels","2");
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Grid *rho = gAlloc(ini,SCALAR);
+	Grid *phi = gAlloc(ini,SCALAR);
+	Grid *res = gAlloc(ini,SCALAR);
+	Multigrid *mgRho = mgAlloc(ini,rho);
+	Multigrid *mgPhi = mgAlloc(ini,phi);
+	Grid *coarse = mgRho->grids[1];
+	Grid *coarsePhi = mgPhi->grids[1];
+
+	utAssert(mgRho->residualRestrictor==mgHalfRestrictResidual3D,"no fused restrictor");
+	utAssert(mgRho->prolongAdder==mgBilinProlAdd3D,"no fused prolongator");
+
+	long int nElements = rho->sizeProd[rho->rank];
+	for(long int p=0;p<nElements;p++){
+		rho->val[p] = (p%7)*0.1;
+		phi->val[p] = (p%5)*0.3 - (p%3)*0.2;
+	}
+	gHaloOp(setSlice,phi,mpiInfo,TOHALO);
+
+	long int nCoarse = coarse->sizeProd[coarse->rank];
+	double *expected = malloc(nElements*sizeof(*expected));
+
+	mgResidual(res,rho,phi,mpiInfo);
+	gHaloOpFaces(res,mpiInfo,TOHALO);
+	mgHalfRestrict3D(res,coarse);
+	for(long int p=0;p<nCoarse;p++) expected[p] = coarse->val[p];
+
+	mgHalfRestrictResidual3D(phi,rho,coarse,mpiInfo);
+
+	int *size = coarse->size;
+	double maxDiff = 0;
+	for(int l=1;l<size[3]-1;l++) for(int k=1;k<size[2]-1;k++) for(int j=1;j<size[1]-1;j++){
+		long int p = j + k*size[1] + l*size[1]*size[2];
+		if(fabs(coarse->val[p]-expected[p])>maxDiff) maxDiff = fabs(coarse->val[p]-expected[p]);
+	}
+	utAssert(maxDiff<1e-12,"mgHalfRestrictResidual3D differs from mgHalfRestrict3D");
+
+	for(long int p=0;p<nCoarse;p++) coarsePhi->val[p] = (p%11)*0.1;
+	mgBilinProl3D(res,coarsePhi,mpiInfo);
+	for(long int p=0;p<nElements;p++) expected[p] = phi->val[p] - res->val[p];
+
+	mgBilinProlAdd3D(phi,coarsePhi,-1,mpiInfo);
+
+	size = phi->size;
+	maxDiff = 0;
+	for(int l=1;l<size[3]-1;l++) for(int k=1;k<size[2]-1;k++) for(int j=1;j<size[1]-1;j++){
+		long int p = j + k*size[1] + l*size[1]*size[2];
+		if(fabs(phi->val[p]-expected[p])>maxDiff) maxDiff = fabs(phi->val[p]-expected[p]);
+	}
+	utAssert(maxDiff<1e-12,"mgBilinProlAdd3D differs from mgBilinProl3D");
+
+	free(expected);
+	mgFree(mgRho);
+	mgFree(mgPhi);
+	gFree(rho);
+	gFree(phi);
+	gFree(res);
+	gFreeMpi(mpiInfo);
+	iniparser_freedict(ini);
+
+	return 0;
+}
+
 // static int testRestrictor(){
 // 	/*
 // 	 * Set up a predefined fine grid, then checks the restrictor against a
@@ -111,5 +395,9 @@ static int testmgGS(){
 void testMultigrid(){
 	utRun(&testStructs);
 	utRun(&testmgGS);
+	utRun(&testMgcgSolve);
+	utRun(&testMgMixedSolve);
+	utRun(&testFusedTransfer);
+	utRun(&testMgAutoTune);
 	// utRun(&testRestrictor);
 }
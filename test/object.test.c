@@ -0,0 +1,104 @@
+/**
+ * @file		object.test.c
+ * @brief		Unit tests for object.c
+ */
+
+#include "core.h"
+#include "object.h"
+#include "test.h"
+#include <math.h>
+#include <stdio.h>
+
+/*
+ * Writes the object identifiers in obj->domain to the dataset read by
+ * oReadH5(), and reads them back in, such that the mask and the cell types are
+ * made the way they are when running.
+ */
+static void oWriteReadH5(const dictionary *ini, Object *obj, const MpiInfo *mpiInfo){
+
+	Units units = { .length = 1 };
+	oOpenH5(ini,obj,mpiInfo,&units,1,"object");
+
+	hid_t dataset = H5Dcreate(obj->domain->h5,"Object",H5T_IEEE_F64LE,
+							  obj->domain->h5FileSpace,H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT);
+	H5Dwrite(dataset,H5T_NATIVE_DOUBLE,obj->domain->h5MemSpace,
+			 obj->domain->h5FileSpace,H5P_DEFAULT,obj->domain->val);
+	H5Dclose(dataset);
+
+	gZero(obj->domain);
+	oReadH5(obj,mpiInfo);
+	oCloseH5(obj);
+}
+
+/*
+ * A cube of nodes 3-5 along each axis is the object, which is thus resolved as
+ * the cube 2.5-5.5 (see Object). Particles in it should be removed and their
+ * charge collected, regardless of whether they are in a CELL_INSIDE cell or a
+ * CELL_SURFACE cell, whereas particles just outside of it should be kept.
+ */
+static int testORayTrace(){
+
+	dictionary *ini = iniGetDummy();
+	iniparser_set(ini,"files:output","data/test");
+	iniparser_set(ini,"population:nSpecies","1");
+	iniparser_set(ini,"population:nAlloc","10");
+	iniparser_set(ini,"population:charge","-1");
+	iniparser_set(ini,"population:mass","1");
+	iniparser_set(ini,"grid:trueSize","8,8,8");
+	iniparser_set(ini,"grid:nGhostLayers","1,1,1,1,1,1");
+
+	Population *pop = pAlloc(ini);
+	Object *obj = oAlloc(ini);
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	gCreateNeighborhood(ini,mpiInfo,obj->domain);
+
+	Grid *domain = obj->domain;
+	long int *sizeProd = domain->sizeProd;
+	for(int z=3;z<=5;z++)
+		for(int y=3;y<=5;y++)
+			for(int x=3;x<=5;x++)
+				domain->val[x*sizeProd[1]+y*sizeProd[2]+z*sizeProd[3]] = 1;
+
+	oWriteReadH5(ini,obj,mpiInfo);
+
+	utAssert(obj->nObjects==1,"Wrong number of objects read");
+	utAssert(obj->cell[4*sizeProd[1]+4*sizeProd[2]+4*sizeProd[3]]==CELL_INSIDE,"Wrong cell type inside object");
+	utAssert(obj->cell[5*sizeProd[1]+4*sizeProd[2]+4*sizeProd[3]]==CELL_SURFACE,"Wrong cell type at surface of object");
+
+	double vel[] = {0,0,0};
+	double hitInside[] = {4.2,4.3,3.9};
+	double hitSurface[] = {5.3,4.,4.};
+	double missSurface[] = {5.7,4.1,4.2};
+	double missOutside[] = {6.5,4.,4.};
+	pNew(pop,0,missOutside,vel);
+	pNew(pop,0,hitInside,vel);
+	pNew(pop,0,missSurface,vel);
+	pNew(pop,0,hitSurface,vel);
+
+	oRayTrace(pop,obj);
+
+	double tol = UT_POP_TOL(1e-12,10);
+	utAssert(pop->iStop[0]-pop->iStart[0]==2,"Wrong number of particles left");
+	utAssert(utPopEqD(&pop->pos[0],missOutside,3,tol),"Particle outside object removed");
+	utAssert(utPopEqD(&pop->pos[3],missSurface,3,tol),"Particle outside the surface of object removed");
+	utAssert(obj->charge[0]==2*pop->charge[0],"Wrong charge collected by object");
+
+	// Nothing more to hit
+	oRayTrace(pop,obj);
+	utAssert(pop->iStop[0]-pop->iStart[0]==2,"Particle removed twice");
+	utAssert(obj->charge[0]==2*pop->charge[0],"Charge collected twice");
+
+	remove("data/test_object.grid.h5");
+
+	gFreeMpi(mpiInfo);
+	oFree(obj);
+	pFree(pop);
+	iniClose(ini);
+
+	return 0;
+}
+
+// All tests for object.c is contained in this function
+void testObject(){
+	utRun(&testORayTrace);
+}
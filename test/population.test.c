@@ -4,19 +4,23 @@
  * @author		Sigvald Marholm <sigvaldm@fys.uio.no>,
  */
 
-#include "pinc.h"
+#include "core.h"
 #include "test.h"
 #include <math.h>
+#include <stdio.h>
+#include <string.h>
 
 static int testPCut(){
 
 	dictionary *ini = iniGetDummy();
 
+	iniparser_set(ini,"population:nSpecies","2");
 	iniparser_set(ini,"population:nAlloc","10,10");
 	iniparser_set(ini,"population:nParticles","0,0");
-	iniparser_set(ini,"population:q","-1,1");
-	iniparser_set(ini,"population:m","1,100");
+	iniparser_set(ini,"population:charge","-1,1");
+	iniparser_set(ini,"population:mass","1,100");
 	Population *pop = pAlloc(ini);
+	long int iStart = pop->iStart[1];
 
 	double posV[] = {0,1,2};
 	double velV[] = {0,10,20};
@@ -34,29 +38,476 @@ static int testPCut(){
 	adSet(velV,3,90.,100.,110.);
 	pNew(pop,1,posV,velV);
 
-	pCut(pop,1,33,posV,velV);
+	pCut(pop,1,3*(iStart+1),posV,velV);
 
 	double expected[] = {3,4,5};
 	utAssert(adEq(posV,expected,3,pow(10,-14)),"Particle position extracted incorrectly");
 	adSet(expected,3,30.,40.,50.);
 	utAssert(adEq(velV,expected,3,pow(10,-14)),"Particle velocity extracted incorrectly");
 
-	utAssert(pop->iStop[1]==13,"Particle counter not properly updated");
+	utAssert(pop->iStop[1]==iStart+3,"Particle counter not properly updated");
 
-	pCut(pop,1,33,posV,velV);
+	pCut(pop,1,3*(iStart+1),posV,velV);
 
 	adSet(expected,3,9.,10.,11.);
 	utAssert(adEq(posV,expected,3,pow(10,-14)),"Particle position fill-in malfunctioning");
 	adSet(expected,3,90.,100.,110.);
 	utAssert(adEq(velV,expected,3,pow(10,-14)),"Particle velocity fill-in malfunctioning");
 
-	utAssert(pop->iStop[1]==12,"Particle counter not properly updated");
+	utAssert(pop->iStop[1]==iStart+2,"Particle counter not properly updated");
 
 	return 0;
 
 }
 
+// Particles should end up in cell-order without being lost or altered
+static int testPSort(){
+
+	dictionary *ini = iniGetDummy();
+	iniparser_set(ini,"grid:nDims","3");
+	iniparser_set(ini,"grid:trueSize","6,5,4");
+	iniparser_set(ini,"grid:nGhostLayers","1");
+	iniparser_set(ini,"grid:boundaries","PERIODIC");
+	iniparser_set(ini,"population:nSpecies","2");
+	iniparser_set(ini,"population:nAlloc","1000,1000");
+	iniparser_set(ini,"population:charge","-1,2");
+	iniparser_set(ini,"population:mass","1,100");
+	iniparser_set(ini,"population:layout","AoS");
+
+	Grid *rho = gAlloc(ini,SCALAR);
+	Population *pop = pAlloc(ini);
+	int *size = rho->size;
+
+	// Velocity encodes the position to check that they are swapped together
+	for(int i=0;i<1000;i++){
+		double posV[] = {1+fmod(0.37*i,6), 1+fmod(0.71*i,5), 1+fmod(0.13*i,4)};
+		double velV[] = {posV[0]+posV[1]+posV[2],i,0};
+		pNew(pop,i%2,posV,velV);
+	}
+
+	pSort(pop,rho);
+
+	double tol = UT_POP_TOL(1e-12,16);
+	double sum = 0;
+	for(int s=0;s<2;s++){
+		utAssert(pop->iStop[s]-pop->iStart[s]==500,"Particles lost");
+
+		long int prevCell = 0;
+		for(long int i=pop->iStart[s];i<pop->iStop[s];i++){
+			popFloat *pos = &pop->pos[3*i];
+			popFloat *vel = &pop->vel[3*i];
+			long int cell = (int)pos[0] + size[1]*((int)pos[1] + size[2]*(int)pos[2]);
+			utAssert(cell>=prevCell,"Particles not sorted by cell");
+			utAssert(fabs(vel[0]-pos[0]-pos[1]-pos[2])<tol,"Velocity not moved along with position");
+			utAssert((int)vel[1]%2==s,"Particle moved to another specie");
+			prevCell = cell;
+			sum += vel[1];
+		}
+	}
+	utAssert(sum==999*1000/2,"Particles lost or duplicated");
+
+	gFree(rho);
+	pFree(pop);
+	iniClose(ini);
+
+	return 0;
+}
+
+// Particles should be accessible and preserved regardless of layout
+static int testPSetLayout(){
+
+	dictionary *ini = iniGetDummy();
+	iniparser_set(ini,"grid:nDims","3");
+	iniparser_set(ini,"population:nSpecies","2");
+	iniparser_set(ini,"population:nAlloc","10,10");
+	iniparser_set(ini,"population:charge","-1,1");
+	iniparser_set(ini,"population:mass","1,100");
+	iniparser_set(ini,"population:layout","SoA");
+	Population *pop = pAlloc(ini);
+
+	utAssert(pop->layout==SOA,"Population not allocated in SoA layout");
+	utAssert(pop->iStart[1]%8==0,"SoA arrays not padded to cache lines");
+
+	for(int i=0;i<4;i++){
+		double posV[] = {i, 10+i, 20+i};
+		double velV[] = {30+i, 40+i, 50+i};
+		pNew(pop,1,posV,velV);
+	}
+
+	double posV[3], velV[3];
+	pCut(pop,1,3*(pop->iStart[1]+1),posV,velV);
+
+	double expected[] = {1,11,21};
+	utAssert(adEq(posV,expected,3,pow(10,-14)),"Particle position extracted incorrectly");
+	adSet(expected,3,31.,41.,51.);
+	utAssert(adEq(velV,expected,3,pow(10,-14)),"Particle velocity extracted incorrectly");
+
+	pSetLayout(pop,AOS);
+	pSetLayout(pop,SOA);
+	pSetLayout(pop,AOS);
+
+	// The last particle fills in for the one cut
+	popFloat *pos = &pop->pos[3*pop->iStart[1]];
+	popFloat *vel = &pop->vel[3*pop->iStart[1]];
+	double expectedPos[] = {0,10,20, 3,13,23, 2,12,22};
+	double expectedVel[] = {30,40,50, 33,43,53, 32,42,52};
+	utAssert(pop->iStop[1]-pop->iStart[1]==3,"Particle counter not properly updated");
+	utAssert(utPopEqD(pos,expectedPos,9,pow(10,-14)),"Positions not preserved by pSetLayout()");
+	utAssert(utPopEqD(vel,expectedVel,9,pow(10,-14)),"Velocities not preserved by pSetLayout()");
+
+	pFree(pop);
+	iniClose(ini);
+
+	return 0;
+}
+
+// Particles should be counted in the right bins, or not at all if outside
+static int testPBinPhaseSpace(){
+
+	dictionary *ini = iniGetDummy();
+	iniparser_set(ini,"grid:nDims","3");
+	iniparser_set(ini,"population:nSpecies","2");
+	iniparser_set(ini,"population:nAlloc","10,10");
+	iniparser_set(ini,"population:charge","-1,1");
+	iniparser_set(ini,"population:mass","1,100");
+	Population *pop = pAlloc(ini);
+
+	double posV[] = {1.5, 0, 0};
+	double velV[] = {-0.5, 0.5, 2};		// Component 2 is outside the range
+	pNew(pop,0,posV,velV);
+	adSet(posV,3,-2.25,0.,0.);			// Wrapped to the far end of the domain
+	adSet(velV,3,0.,-1.,0.9);
+	pNew(pop,0,posV,velV);
+
+	double velMax[] = {1, 1};
+	int offset[] = {2, 0, 0};
+	MpiInfo mpiInfo = {.offset = offset};
+	PhaseSpace ps = {	.nSpecies = 2, .nDims = 3, .nVelBins = 4,
+						.velMax = velMax, .xDim = 0, .vDim = 1,
+						.nXBins = 2, .nVBins = 2, .xMax = 8 };
+	ps.nBins = 3*4 + 2*2;
+	ps.local = malloc(2*ps.nBins*sizeof(*ps.local));
+
+	pBinPhaseSpace(&ps,pop,&mpiInfo);
+
+	long int expected[] = {	0,1,1,0, 1,0,0,1, 0,0,0,1,
+							0,1, 1,0 };
+	int equal = 1;
+	for(int j=0;j<ps.nBins;j++) equal &= ps.local[j]==expected[j];
+	for(int j=ps.nBins;j<2*ps.nBins;j++) equal &= ps.local[j]==0;
+	utAssert(equal,"Particles binned incorrectly by pBinPhaseSpace()");
+
+	free(ps.local);
+	pFree(pop);
+	iniClose(ini);
+
+	return 0;
+}
+
+// All particles should be generated in the subdomain, the same for the same seed
+static int testPPosUniform(){
+
+	dictionary *ini = iniGetDummy();
+	iniparser_set(ini,"grid:nDims","3");
+	iniparser_set(ini,"grid:trueSize","6,5,4");
+	iniparser_set(ini,"grid:nGhostLayers","1,1,1,1,1,1");
+	iniparser_set(ini,"grid:boundaries","PERIODIC");
+	iniparser_set(ini,"population:nSpecies","2");
+	iniparser_set(ini,"population:nAlloc","1000,1000");
+	iniparser_set(ini,"population:nParticles","700,300");
+	iniparser_set(ini,"population:charge","-1,1");
+	iniparser_set(ini,"population:mass","1,100");
+	iniparser_set(ini,"population:drift","0,0");
+	iniparser_set(ini,"population:thermalVelocity","1,0.1");
+
+	MpiInfo *mpiInfo = gAllocMpi(ini);
+	Population *pop = pAlloc(ini);
+	Population *copy = pAlloc(ini);
+	gsl_rng *rngSync = gsl_rng_alloc(gsl_rng_mt19937);
+	gsl_rng *rngCopy = gsl_rng_alloc(gsl_rng_mt19937);
+
+	pPosUniform(ini,pop,mpiInfo,rngSync);
+	pVelMaxwell(ini,pop,mpiInfo,rngSync);
+	pPosUniform(ini,copy,mpiInfo,rngCopy);
+	pVelMaxwell(ini,copy,mpiInfo,rngCopy);
+
+	utAssert(pop->iStop[0]-pop->iStart[0]==700,"Wrong number of particles generated");
+	utAssert(pop->iStop[1]-pop->iStart[1]==300,"Wrong number of particles generated");
+
+	int inRange = 1, equal = 1;
+	for(int s=0;s<2;s++){
+		for(long int i=pop->iStart[s];i<pop->iStop[s];i++){
+			for(int d=0;d<3;d++){
+				double pos = pop->pos[3*i+d];
+				inRange &= pos>=1 && pos<1+mpiInfo->trueSize[d];
+				equal &= pos==copy->pos[3*i+d];
+				equal &= pop->vel[3*i+d]==copy->vel[3*i+d];
+			}
+		}
+	}
+	utAssert(inRange,"Particles generated outside the subdomain");
+	utAssert(equal,"Different particles generated by the same seed");
+
+	gsl_rng_free(rngSync);
+	gsl_rng_free(rngCopy);
+	pFree(pop);
+	pFree(copy);
+	gFreeMpi(mpiInfo);
+	iniClose(ini);
+
+	return 0;
+}
+
+/*
+ * Reads back a dataset of rows written by pWriteH5(), and finds the number of
+ * rows per chunk (0 if contiguous) and whether it is compressed.
+ */
+static double *pReadH5Rows(hid_t file, const char *name, long int *nRows,
+						   size_t *typeSize, long int *nRowsChunk, int *deflated){
+
+	hid_t dataset = H5Dopen(file,name,H5P_DEFAULT);
+	hid_t space = H5Dget_space(dataset);
+	hsize_t dims[2];
+	H5Sget_simple_extent_dims(space,dims,NULL);
+	*nRows = dims[0];
+
+	hid_t type = H5Dget_type(dataset);
+	*typeSize = H5Tget_size(type);
+
+	hid_t createList = H5Dget_create_plist(dataset);
+	*nRowsChunk = 0;
+	if(H5Pget_layout(createList)==H5D_CHUNKED){
+		hsize_t chunkDims[2];
+		H5Pget_chunk(createList,2,chunkDims);
+		*nRowsChunk = chunkDims[0];
+	}
+	*deflated = H5Pget_nfilters(createList)>0;
+
+	double *data = malloc(dims[0]*dims[1]*sizeof(*data));
+	H5Dread(dataset,H5T_NATIVE_DOUBLE,H5S_ALL,H5S_ALL,H5P_DEFAULT,data);
+
+	H5Pclose(createList);
+	H5Tclose(type);
+	H5Sclose(space);
+	H5Dclose(dataset);
+
+	return data;
+}
+
+/*
+ * The particles should be read back from the .pop.h5-file as they were in pop,
+ * in the global reference frame and in the precision of files:popPrecision,
+ * regardless of the layout of pop, of chunking and compression and of whether
+ * they are written at once or staged.
+ */
+static int testPWriteH5(){
+
+	const char *precision[]	= {"DOUBLE",	"SINGLE",	"DOUBLE"};
+	const char *chunk[]		= {"0",			"16",		"16"};
+	const char *deflate[]	= {"0",			"1",		"0"};
+	const char *layout[]	= {"AoS",		"AoS",		"SoA"};
+	int staged[]			= {0,			0,			1};
+
+	for(int c=0;c<3;c++){
+
+		dictionary *ini = iniGetDummy();
+		iniparser_set(ini,"files:output","data/test");
+		iniparser_set(ini,"files:stagingBudget","1");
+		iniparser_set(ini,"files:popPrecision",precision[c]);
+		iniparser_set(ini,"files:popChunk",chunk[c]);
+		iniparser_set(ini,"files:popDeflate",deflate[c]);
+		iniparser_set(ini,"grid:trueSize","6,5,4");
+		iniparser_set(ini,"grid:nGhostLayers","1,1,1,1,1,1");
+		iniparser_set(ini,"population:nSpecies","2");
+		iniparser_set(ini,"population:nAlloc","100,100");
+		iniparser_set(ini,"population:charge","-1,1");
+		iniparser_set(ini,"population:mass","1,100");
+		iniparser_set(ini,"population:layout",layout[c]);
+
+		MpiInfo *mpiInfo = gAllocMpi(ini);
+		Population *pop = pAlloc(ini);
+		Units units = { .length = 1, .velocity = 1 };
+
+		// As if this were a subdomain in the middle of the domain
+		int offset[] = {12,5,8};
+		for(int d=0;d<3;d++) mpiInfo->offset[d] = offset[d];
+
+		// Rows of position and velocity of each particle, as stored in pop
+		long int nParticles[] = {40,25};
+		popFloat *particles[2];
+		for(int s=0;s<2;s++){
+			particles[s] = malloc(6*nParticles[s]*sizeof(*particles[s]));
+			for(long int i=0;i<nParticles[s];i++){
+				double pos[] = {1+fmod(i/3.0,6), 1+fmod(0.71*i,5), 1+fmod(0.13*i,4)};
+				double vel[] = {i/7.0, -s/3.0, sin(i)};
+				pNew(pop,s,pos,vel);
+				for(int d=0;d<3;d++){
+					particles[s][6*i+d] = pos[d];
+					particles[s][6*i+3+d] = vel[d];
+				}
+			}
+		}
+
+		char fName[32];
+		sprintf(fName,"writeh5_%i",c);
+		pOpenH5(ini,pop,&units,fName);
+		if(staged[c]){
+			Stage *stage = stAlloc(ini);
+			pWriteH5Staged(stage,pop,mpiInfo,3,2.5);
+			stFree(stage);
+		} else {
+			pWriteH5(pop,mpiInfo,3,2.5);
+		}
+		pCloseH5(pop);
+
+		char fTotName[64];
+		sprintf(fTotName,"data/test_%s.pop.h5",fName);
+		hid_t file = H5Fopen(fTotName,H5F_ACC_RDONLY,H5P_DEFAULT);
+		utAssert(file>=0,"Could not open .pop.h5-file");
+
+		int single = !strcmp(precision[c],"SINGLE");
+		for(int s=0;s<2;s++){
+			for(int q=0;q<2;q++){
+
+				char name[64];
+				if(q==0) sprintf(name,"/pos/specie %i/n=3.0",s);
+				else sprintf(name,"/vel/specie %i/n=2.5",s);
+
+				long int nRows, nRowsChunk;
+				size_t typeSize;
+				int deflated;
+				double *data = pReadH5Rows(file,name,&nRows,&typeSize,&nRowsChunk,&deflated);
+
+				utAssert(nRows==nParticles[s],"Wrong number of particles in %s",name);
+				utAssert(typeSize==(single ? sizeof(float) : sizeof(double)),"Wrong precision of %s",name);
+				utAssert(nRowsChunk==atol(chunk[c]),"Wrong chunks of %s",name);
+				utAssert(deflated==(atoi(deflate[c])>0),"Wrong compression of %s",name);
+
+				for(long int i=0;i<nParticles[s];i++){
+					for(int d=0;d<3;d++){
+						double expected = particles[s][6*i+3*q+d];
+						if(q==0) expected += offset[d];
+						if(single) expected = (float)expected;
+						utAssert(data[3*i+d]==expected,"Wrong particle %li in %s",i,name);
+					}
+				}
+
+				free(data);
+			}
+		}
+
+		H5Fclose(file);
+		remove(fTotName);
+
+		free(particles[0]);
+		free(particles[1]);
+		pFree(pop);
+		gFreeMpi(mpiInfo);
+		iniClose(ini);
+	}
+
+	return 0;
+}
+
+// Sums of weight, momentum and energy of the particles in each cell
+static void pCellMoments(const Population *pop, const int *size, double *moments){
+
+	long int nCells = size[1]*size[2]*size[3];
+	adSetAll(moments,5*nCells,0);
+
+	for(long int i=pop->iStart[0];i<pop->iStop[0];i++){
+		popFloat *pos = &pop->pos[3*i];
+		popFloat *vel = &pop->vel[3*i];
+		double w = pop->weight[i];
+		long int cell = (int)pos[0] + size[1]*((int)pos[1] + size[2]*(int)pos[2]);
+		double *m = &moments[5*cell];
+		m[0] += w;
+		for(int d=0;d<3;d++){
+			m[1+d] += w*vel[d];
+			m[4] += w*vel[d]*vel[d];
+		}
+	}
+}
+
+// Merging and splitting should conserve weight, momentum and energy per cell
+static int testPMergeSplit(){
+
+	dictionary *ini = iniGetDummy();
+	iniparser_set(ini,"grid:nDims","3");
+	iniparser_set(ini,"grid:trueSize","4,4,4");
+	iniparser_set(ini,"grid:nGhostLayers","1");
+	iniparser_set(ini,"grid:boundaries","PERIODIC");
+	iniparser_set(ini,"population:nSpecies","1");
+	iniparser_set(ini,"population:nAlloc","100");
+	iniparser_set(ini,"population:charge","-1");
+	iniparser_set(ini,"population:mass","1");
+	iniparser_set(ini,"population:layout","AoS");
+	iniparser_set(ini,"population:mergeInterval","1");
+	iniparser_set(ini,"population:ppcRange","4,8");
+	iniparser_set(ini,"methods:acc","puAcc3D1KEWeighted");
+	iniparser_set(ini,"methods:distr","puDistr3D1Weighted");
+	iniparser_set(ini,"methods:migrate","puExtractEmigrants3DWeighted");
+	iniparser_set(ini,"methods:sweep","puSweepSplit");
+
+	Grid *rho = gAlloc(ini,SCALAR);
+	Population *pop = pAlloc(ini);
+	int *size = rho->size;
+	long int nCells = size[1]*size[2]*size[3];
+
+	// 11 particles in cell (1,1,1), 2 in (2,1,1) and 6 in (3,2,1)
+	double corner[][3] = {{1,1,1}, {2,1,1}, {3,2,1}};
+	int nInCell[] = {11, 2, 6};
+	for(int c=0;c<3;c++){
+		for(int i=0;i<nInCell[c];i++){
+			double posV[] = {corner[c][0]+0.09*i, corner[c][1]+0.05*i, corner[c][2]+0.5};
+			double velV[] = {0.1*i, c-0.2*i, 0.01*i*i};
+			pNew(pop,0,posV,velV);
+		}
+	}
+
+	double *before = malloc(5*nCells*sizeof(*before));
+	double *after = malloc(5*nCells*sizeof(*after));
+	pCellMoments(pop,size,before);
+
+	pMergeSplit(pop,rho,4,8);
+
+	pCellMoments(pop,size,after);
+	double tol = UT_POP_TOL(pow(10,-12),100);
+	utAssert(adEq(before,after,5*nCells,tol),"Weight, momentum or energy of a cell not conserved");
+
+	// Two groups of four merged into two particles each, two particles split
+	utAssert(pop->iStop[0]-pop->iStart[0]==7+4+6,"Wrong number of particles after merging and splitting");
+
+	int nonZero = 1;
+	for(long int i=pop->iStart[0];i<pop->iStop[0];i++) nonZero &= pop->weight[i]>0;
+	utAssert(nonZero,"Merged-away particles not removed");
+
+	long int *count = calloc(nCells,sizeof(*count));
+	for(long int i=pop->iStart[0];i<pop->iStop[0];i++){
+		popFloat *pos = &pop->pos[3*i];
+		count[(int)pos[0] + size[1]*((int)pos[1] + size[2]*(int)pos[2])]++;
+	}
+	int inRange = 1;
+	for(long int c=0;c<nCells;c++) inRange &= count[c]==0 || (count[c]>=4 && count[c]<=8);
+	utAssert(inRange,"Particles per cell outside ppcRange");
+
+	free(count);
+	free(before);
+	free(after);
+	gFree(rho);
+	pFree(pop);
+	iniClose(ini);
+
+	return 0;
+}
+
 // All tests for io.c is contained in this function
 void testPopulation(){
 	utRun(&testPCut);
+	utRun(&testPSort);
+	utRun(&testPSetLayout);
+	utRun(&testPBinPhaseSpace);
+	utRun(&testPPosUniform);
+	utRun(&testPMergeSplit);
+	utRun(&testPWriteH5);
 }
@@ -7,6 +7,7 @@
 #include "test.h"
 #include <stdarg.h>
 #include <stdio.h>
+#include <math.h>
 
 #define BUFFSIZE 256
 
@@ -67,3 +68,19 @@ dictionary *iniSetDummy(int argc, char **argv){
 dictionary *iniGetDummy(){
 	return iniSetDummy(0,0);
 }
+
+int utPopEq(const popFloat *a, const popFloat *b, long int n, double tol){
+	for(long int i=0;i<n;i++) if(fabs(a[i]-b[i])>tol) return 0;
+	return 1;
+}
+
+int utPopEqD(const popFloat *a, const double *b, long int n, double tol){
+	for(long int i=0;i<n;i++) if(fabs(a[i]-b[i])>tol) return 0;
+	return 1;
+}
+
+double utPopSum(const popFloat *a, long int n){
+	double sum = 0;
+	for(long int i=0;i<n;i++) sum += a[i];
+	return sum;
+}
@@ -8,8 +8,9 @@
 #define TEST_H
 
 #include <stdarg.h>
+#include <float.h>
 #include "iniparser.h"
-#include "pinc.h"
+#include "core.h"
 
 /**
  * @brief Tests an assertion.
@@ -88,6 +89,28 @@ void utRun(int (*fun)());
 dictionary *iniGetDummy();
 dictionary *iniSetDummy(int argc,char **argv);
 
+/**
+ * @brief Tolerance for comparing particle positions or velocities
+ * @param	tol		Tolerance in double precision
+ * @param	scale	Magnitude of the quantities compared
+ *
+ * Particles are stored as popFloat, which is single precision when PINC is
+ * compiled with POP_SINGLE. This widens 'tol' to what single precision
+ * resolves at the given scale in that case, and leaves it as is otherwise.
+ */
+#ifdef POP_SINGLE
+#define UT_POP_TOL(tol,scale) fmax((tol),64*FLT_EPSILON*(scale))
+#else
+#define UT_POP_TOL(tol,scale) (tol)
+#endif
+
+///@brief Returns 1 if the particle arrays are equal within 'tol', else 0
+int utPopEq(const popFloat *a, const popFloat *b, long int n, double tol);
+///@brief Returns 1 if the particle array equals 'b' within 'tol', else 0
+int utPopEqD(const popFloat *a, const double *b, long int n, double tol);
+///@brief Returns the sum of a particle array, accumulated in double precision
+double utPopSum(const popFloat *a, long int n);
+
 /**
  * @brief	Prints a summary of the tests
  * @return	void
@@ -143,4 +166,12 @@ void testPusher();
  */
 void testMultigrid();
 
+/**
+ * @brief	Performs all tests in object.test.c
+ * @return	void
+ *
+ * This prevents many small global test functions.
+ */
+void testObject();
+
 #endif // TEST_H